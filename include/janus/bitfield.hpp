@@ -0,0 +1,100 @@
+#pragma once
+
+#include <initializer_list>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Bitwise operations between strings. (Corresponds to the BITOP operation argument)
+ */
+enum class bitwise_op { bit_and, bit_or, bit_xor, bit_not };
+
+/**
+ * @brief An integer type of a BITFIELD sub-operation: signed up to 64 bits or unsigned up to 63 bits.
+ */
+class bitfield_type {
+public:
+	static bitfield_type u(unsigned bits) {
+		if (bits == 0 || bits > 63) throw std::invalid_argument("bitfield_type: unsigned width must be 1..63");
+		return bitfield_type(false, bits);
+	}
+
+	static bitfield_type i(unsigned bits) {
+		if (bits == 0 || bits > 64) throw std::invalid_argument("bitfield_type: signed width must be 1..64");
+		return bitfield_type(true, bits);
+	}
+
+	[[nodiscard]] std::string to_string() const {
+		return (is_signed ? "i" : "u") + std::to_string(bits);
+	}
+
+private:
+	bitfield_type(bool is_signed, unsigned bits) : is_signed(is_signed), bits(bits) {
+	}
+
+	bool is_signed;
+	unsigned bits;
+};
+
+/**
+ * @brief Builds a single BITFIELD command out of many typed GET/SET/INCRBY sub-operations.
+ * * Offsets are bit offsets; the *_nth variants address the n-th integer of the given type ("#n"), which is the
+ * natural way to store an array of fixed-width counters in one string. OVERFLOW applies to all following SET and
+ * INCRBY sub-operations, as in Redis.
+ */
+class bitfield_command {
+public:
+	enum class overflow { wrap, sat, fail };
+
+	bitfield_command &get(const bitfield_type &type, long long offset) {
+		return add({"GET", type.to_string(), std::to_string(offset)});
+	}
+
+	bitfield_command &get_nth(const bitfield_type &type, long long index) {
+		return add({"GET", type.to_string(), "#" + std::to_string(index)});
+	}
+
+	bitfield_command &set(const bitfield_type &type, long long offset, long long value) {
+		return add({"SET", type.to_string(), std::to_string(offset), std::to_string(value)});
+	}
+
+	bitfield_command &set_nth(const bitfield_type &type, long long index, long long value) {
+		return add({"SET", type.to_string(), "#" + std::to_string(index), std::to_string(value)});
+	}
+
+	bitfield_command &incrby(const bitfield_type &type, long long offset, long long increment) {
+		return add({"INCRBY", type.to_string(), std::to_string(offset), std::to_string(increment)});
+	}
+
+	bitfield_command &incrby_nth(const bitfield_type &type, long long index, long long increment) {
+		return add({"INCRBY", type.to_string(), "#" + std::to_string(index), std::to_string(increment)});
+	}
+
+	bitfield_command &with_overflow(overflow behavior) {
+		static const char *const names[] = {"WRAP", "SAT", "FAIL"};
+		args.emplace_back("OVERFLOW");
+		args.emplace_back(names[static_cast<int>(behavior)]);
+		return *this;
+	}
+
+	/* The sub-operation arguments, without the command name and key */
+	[[nodiscard]] const std::vector<std::string> &get_args() const {
+		return args;
+	}
+
+	/* The number of sub-operations that produce a result (GET, SET and INCRBY) */
+	[[nodiscard]] size_t size() const {
+		return results;
+	}
+
+private:
+	bitfield_command &add(std::initializer_list<std::string> sub_operation) {
+		args.insert(args.end(), sub_operation);
+		++results;
+		return *this;
+	}
+
+	std::vector<std::string> args;
+	size_t results{0};
+};
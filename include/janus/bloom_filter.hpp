@@ -0,0 +1,286 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "hash.hpp"
+#include "redis_template.hpp"
+
+/**
+ * @brief A Bloom filter stored in Redis bitmaps, probed client-side (no RedisBloom module required).
+ * * The bit array is split into power-of-two sized segments, each stored as a string under "<name>:<index>". An item
+ * hashes to one segment and sets or probes its k bits there (double hashing: g_i = h1 + i * h2), so every item costs
+ * exactly one BITFIELD command on one key. Batch operations group the items by segment and send one BITFIELD per
+ * segment in a single pipeline.
+ *
+ * For read-mostly filters the segments can be cached locally (enable_local_cache); probes are then answered from the
+ * cached bitmaps without any round trip until the cache entry expires.
+ * @tparam K The key type of the template; the filter name is a K.
+ * @tparam V The item type; items are hashed in their serialized form.
+ */
+template<typename K, typename V>
+class bloom_filter {
+public:
+	/* Largest segment: 8 Mbit (1 MiB) keeps BITFIELD and segment fetches cheap */
+	static constexpr uint64_t max_segment_bits = uint64_t{1} << 23;
+
+	/**
+	 * @brief Constructor. Sizes the filter for the expected number of items and false positive rate.
+	 * @param tpl The template providing the connection and serializers. Must outlive the filter.
+	 * @param name The filter name (K).
+	 * @param expected_items The number of items the filter is sized for.
+	 * @param false_positive_rate The desired false positive rate at expected_items, in (0, 1).
+	 */
+	bloom_filter(redis_template<K, V> &tpl, const K &name, uint64_t expected_items, double false_positive_rate) :
+		tpl(tpl), name(tpl.serialize_key(name)) {
+		if (expected_items == 0 || false_positive_rate <= 0.0 || false_positive_rate >= 1.0) {
+			throw std::invalid_argument("bloom_filter: invalid sizing parameters");
+		}
+		const double ln2 = std::log(2.0);
+		const double n = static_cast<double>(expected_items);
+		const auto bits = static_cast<uint64_t>(std::ceil(-n * std::log(false_positive_rate) / (ln2 * ln2)));
+		hashes = std::max<uint32_t>(1, static_cast<uint32_t>(std::lround(static_cast<double>(bits) / n * ln2)));
+
+		segment_bits = 64;
+		while (segment_bits < bits && segment_bits < max_segment_bits) {
+			segment_bits <<= 1;
+		}
+		segments = (bits + segment_bits - 1) / segment_bits;
+	}
+
+	/**
+	 * @brief Adds an item.
+	 * @param item The item (V).
+	 * @return True if the item was definitely not in the filter before, false if it may have been.
+	 */
+	bool add(const V &item) {
+		return add(std::vector<V>{item})[0];
+	}
+
+	/**
+	 * @brief Adds several items with one BITFIELD per touched segment, sent in a single pipeline.
+	 * @param items The items (V).
+	 * @return For each item: true if it was definitely not in the filter before.
+	 */
+	std::vector<bool> add(const std::vector<V> &items) {
+		return run(items, true);
+	}
+
+	/**
+	 * @brief Tests an item for membership.
+	 * @param item The item (V).
+	 * @return False if the item is definitely not in the filter, true if it probably is.
+	 */
+	bool contains(const V &item) {
+		return contains(std::vector<V>{item})[0];
+	}
+
+	/**
+	 * @brief Tests several items for membership, from the local cache if enabled, otherwise with one BITFIELD GET per
+	 * touched segment sent in a single pipeline.
+	 * @param items The items (V).
+	 * @return For each item: false if definitely absent, true if probably present.
+	 */
+	std::vector<bool> contains(const std::vector<V> &items) {
+		if (cache_ttl.count() <= 0) {
+			return run(items, false);
+		}
+
+		std::vector<uint64_t> offsets(items.size() * hashes);
+		std::vector<uint64_t> item_segments(items.size());
+		std::vector<uint64_t> missing;
+		for (size_t i = 0; i < items.size(); ++i) {
+			item_segments[i] = probe(tpl.serialize_value(items[i]), &offsets[i * hashes]);
+			if (!cached(item_segments[i])) missing.push_back(item_segments[i]);
+		}
+		fetch_segments(missing);
+
+		std::vector<bool> result(items.size());
+		for (size_t i = 0; i < items.size(); ++i) {
+			const std::string &bitmap = cache[item_segments[i]].bitmap;
+			bool present = true;
+			for (uint32_t j = 0; j < hashes && present; ++j) {
+				present = test_bit(bitmap, offsets[i * hashes + j]);
+			}
+			result[i] = present;
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Answers contains() from locally cached segments, refetching a segment once it is older than ttl.
+	 * * Items added by other processes become visible only after the cached segment expires.
+	 * @param ttl How long a fetched segment is used; zero disables the cache.
+	 */
+	void enable_local_cache(std::chrono::milliseconds ttl) {
+		cache_ttl = ttl;
+		if (ttl.count() <= 0) cache.clear();
+	}
+
+	/**
+	 * @brief Drops all locally cached segments.
+	 */
+	void invalidate_local_cache() {
+		cache.clear();
+	}
+
+	/**
+	 * @brief Deletes the filter from Redis.
+	 * @return The number of segment keys removed.
+	 */
+	long long clear() {
+		cache.clear();
+		std::vector<std::string> keys;
+		keys.reserve(segments);
+		for (uint64_t s = 0; s < segments; ++s) {
+			keys.push_back(segment_key(s));
+		}
+		return tpl.get_connection().del(keys);
+	}
+
+	[[nodiscard]] uint32_t hash_count() const {
+		return hashes;
+	}
+
+	[[nodiscard]] uint64_t bit_count() const {
+		return segment_bits * segments;
+	}
+
+	[[nodiscard]] uint64_t segment_count() const {
+		return segments;
+	}
+
+private:
+	struct cached_segment {
+		std::string bitmap;
+		std::chrono::steady_clock::time_point fetched_at;
+	};
+
+	static constexpr uint64_t seed = 0x9747b28cULL;
+
+	/* Computes the k bit offsets of an item within its segment (branch-free, vectorizable); returns the segment */
+	uint64_t probe(const std::string &raw, uint64_t *offsets) const {
+		const uint64_t h1 = murmurhash64a(raw, seed);
+		const uint64_t h2 = mix64(h1) | 1;
+		const uint64_t mask = segment_bits - 1;
+		for (uint32_t i = 0; i < hashes; ++i) {
+			offsets[i] = (h1 + i * h2) & mask;
+		}
+		return mix64(h2) % segments;
+	}
+
+	std::string segment_key(uint64_t segment) const {
+		return name + ":" + std::to_string(segment);
+	}
+
+	std::vector<bool> run(const std::vector<V> &items, bool set) {
+		std::vector<uint64_t> offsets(items.size() * hashes);
+		std::unordered_map<uint64_t, std::vector<size_t>> by_segment;
+		for (size_t i = 0; i < items.size(); ++i) {
+			by_segment[probe(tpl.serialize_value(items[i]), &offsets[i * hashes])].push_back(i);
+		}
+
+		std::vector<std::vector<std::string>> commands;
+		std::vector<uint64_t> command_segments;
+		commands.reserve(by_segment.size());
+		for (const auto &entry: by_segment) {
+			std::vector<std::string> cmd{"BITFIELD", segment_key(entry.first)};
+			cmd.reserve(2 + entry.second.size() * hashes * (set ? 4 : 3));
+			for (size_t item: entry.second) {
+				for (uint32_t j = 0; j < hashes; ++j) {
+					const std::string offset = std::to_string(offsets[item * hashes + j]);
+					if (set) {
+						cmd.insert(cmd.end(), {"SET", "u1", offset, "1"});
+					}
+					else {
+						cmd.insert(cmd.end(), {"GET", "u1", offset});
+					}
+				}
+			}
+			commands.push_back(std::move(cmd));
+			command_segments.push_back(entry.first);
+		}
+
+		auto replies = tpl.get_connection().pipeline(commands);
+
+		// SET returns the previous bit: an item is new if any of its bits was clear; GET: present if all are set
+		std::vector<bool> result(items.size());
+		for (size_t c = 0; c < replies.size(); ++c) {
+			const kv_reply &r = replies[c];
+			const auto &members = by_segment[command_segments[c]];
+			if (r.type != kv_reply::reply_type::array || r.elements.size() != members.size() * hashes) {
+				throw std::runtime_error("bloom_filter: unexpected BITFIELD reply" + (r.is_error() ? ": " + r.str : ""));
+			}
+			for (size_t m = 0; m < members.size(); ++m) {
+				bool all_set = true;
+				for (uint32_t j = 0; j < hashes; ++j) {
+					all_set = all_set && r.elements[m * hashes + j].integer == 1;
+				}
+				result[members[m]] = set ? !all_set : all_set;
+			}
+
+			auto it = cache.find(command_segments[c]);
+			if (set && it != cache.end()) {
+				for (size_t item: members) {
+					for (uint32_t j = 0; j < hashes; ++j) {
+						set_bit(it->second.bitmap, offsets[item * hashes + j]);
+					}
+				}
+			}
+		}
+		return result;
+	}
+
+	bool cached(uint64_t segment) const {
+		auto it = cache.find(segment);
+		return it != cache.end() && std::chrono::steady_clock::now() - it->second.fetched_at < cache_ttl;
+	}
+
+	void fetch_segments(std::vector<uint64_t> &missing) {
+		if (missing.empty()) return;
+		std::sort(missing.begin(), missing.end());
+		missing.erase(std::unique(missing.begin(), missing.end()), missing.end());
+
+		std::vector<std::vector<std::string>> commands;
+		commands.reserve(missing.size());
+		for (uint64_t s: missing) {
+			commands.push_back({"GET", segment_key(s)});
+		}
+		auto replies = tpl.get_connection().pipeline(commands);
+		const auto now = std::chrono::steady_clock::now();
+		for (size_t i = 0; i < missing.size(); ++i) {
+			if (replies[i].is_error()) {
+				throw std::runtime_error("bloom_filter: GET failed: " + replies[i].str);
+			}
+			cache[missing[i]] = cached_segment{std::move(replies[i].str), now};
+		}
+	}
+
+	/* Bit order matches SETBIT/BITFIELD: offset 0 is the most significant bit of the first byte */
+	static bool test_bit(const std::string &bitmap, uint64_t offset) {
+		const uint64_t byte = offset >> 3;
+		if (byte >= bitmap.size()) return false;
+		return (static_cast<unsigned char>(bitmap[byte]) >> (7 - (offset & 7))) & 1;
+	}
+
+	static void set_bit(std::string &bitmap, uint64_t offset) {
+		const uint64_t byte = offset >> 3;
+		if (byte >= bitmap.size()) bitmap.resize(byte + 1, '\0');
+		bitmap[byte] = static_cast<char>(static_cast<unsigned char>(bitmap[byte]) | (0x80 >> (offset & 7)));
+	}
+
+	redis_template<K, V> &tpl;
+	std::string name;
+	uint32_t hashes{1};
+	uint64_t segment_bits{64};
+	uint64_t segments{1};
+
+	std::chrono::milliseconds cache_ttl{0};
+	std::unordered_map<uint64_t, cached_segment> cache;
+};
@@ -0,0 +1,619 @@
+#pragma once
+
+#include <hiredis/hiredis.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <deque>
+#include <functional>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+#include "kv_connection.hpp"
+#include "redis_template.hpp"
+
+/**
+ * @brief Progress and error accounting of a bulk load.
+ */
+struct bulk_load_stats {
+	/* Commands handed to the loader */
+	uint64_t queued{0};
+	/* Commands the server answered, and how many of them with an error */
+	uint64_t replied{0};
+	uint64_t errors{0};
+	/* RESP bytes sent */
+	uint64_t bytes{0};
+	std::chrono::milliseconds elapsed{0};
+	/* The first error replies, for diagnosis */
+	std::vector<std::string> error_samples;
+
+	[[nodiscard]] double commands_per_second() const {
+		return elapsed.count() > 0 ? static_cast<double>(replied) * 1000.0 / static_cast<double>(elapsed.count()) : 0.0;
+	}
+};
+
+/**
+ * @brief Tuning knobs of a bulk_loader.
+ */
+struct bulk_load_options {
+	/* Connections opened by the host/port constructor */
+	size_t connections{4};
+	/* Commands encoded and written to a connection at once */
+	size_t batch_size{512};
+	/* Commands sent on a connection and not answered yet; the writer waits for replies beyond it */
+	size_t window{8192};
+	/* Batches waiting for each connection before the producer blocks */
+	size_t queue_depth{4};
+	std::chrono::milliseconds connect_timeout{2000};
+	/* The load stops with an exception once this many commands failed; zero never stops */
+	uint64_t max_errors{0};
+	/* Error replies kept in bulk_load_stats::error_samples */
+	size_t error_samples{16};
+	/* Called from the producing thread about every progress_interval, and once by finish() */
+	std::function<void(const bulk_load_stats &)> on_progress;
+	std::chrono::milliseconds progress_interval{1000};
+};
+
+/**
+ * @brief Loads a large number of records into Redis at close to network speed, the way redis-cli --pipe does.
+ * * Records are given as raw commands, typed records encoded with a redis_template's serializers, or read from a
+ * CSV or binary file. They are spread over several connections by key, so the commands of one key keep their order.
+ * Each connection has a writer thread that encodes its batches to RESP, writes them without waiting, and reads the
+ * replies behind, keeping up to bulk_load_options::window commands in flight. Replies are only counted: error replies
+ * are tallied with a few samples kept, and a broken connection stops the load.
+ *
+ * The host/port constructor streams raw RESP over its own hiredis connections. The other constructor sends batches
+ * through existing kv_connections with pipeline(), one batch in flight per connection, for stores that are not
+ * reached over the network (memory_connection) or decorators.
+ *
+ * The producing methods are called from one thread; finish() flushes, waits for every reply and returns the totals.
+ * Destroying the loader without finish() sends the batches already queued and drops the partial ones.
+ * @throw std::runtime_error from the producing methods and finish() once a connection failed or max_errors was
+ * reached.
+ */
+class bulk_loader {
+public:
+	/**
+	 * @brief Loads into a Redis server over options.connections new connections.
+	 */
+	bulk_loader(const std::string &host, int port, const bulk_load_options &options = bulk_load_options()) :
+		options(options) {
+		const size_t n = std::max<size_t>(options.connections, 1);
+		for (size_t i = 0; i < n; ++i) {
+			workers.push_back(std::make_unique<worker>(std::make_unique<redis_channel>(*this, host, port)));
+		}
+		start();
+	}
+
+	/**
+	 * @brief Loads through existing connections, one writer thread each.
+	 */
+	explicit bulk_loader(const std::vector<std::shared_ptr<kv_connection>> &connections,
+						 const bulk_load_options &options = bulk_load_options()) :
+		options(options) {
+		if (connections.empty()) throw std::invalid_argument("bulk_loader: no connection");
+		for (const auto &connection: connections) {
+			if (!connection) throw std::invalid_argument("bulk_loader: connection is null");
+			workers.push_back(std::make_unique<worker>(std::make_unique<connection_channel>(*this, connection)));
+		}
+		start();
+	}
+
+	~bulk_loader() {
+		stop();
+	}
+
+	bulk_loader(const bulk_loader &) = delete;
+	bulk_loader &operator=(const bulk_loader &) = delete;
+
+	/**
+	 * @brief Queues a raw command. It is routed by its first argument, taken as the key.
+	 */
+	void command(std::vector<std::string> argv) {
+		if (argv.empty()) throw std::invalid_argument("bulk_loader: empty command");
+		worker &w = *workers[route(argv.size() > 1 ? argv[1] : argv[0])];
+		w.current.push_back(std::move(argv));
+		++queued;
+		if (w.current.size() >= options.batch_size) {
+			submit(w);
+		}
+		if (++since_progress >= options.batch_size) {
+			since_progress = 0;
+			report(false);
+		}
+	}
+
+	// ============================================================================
+	// Typed records
+	// ============================================================================
+
+	/**
+	 * @brief Queues a SET of a typed record.
+	 * @param ttl The time to live; zero keeps the key persistent.
+	 */
+	template<typename K, typename V>
+	void set(const redis_template<K, V> &tpl, const K &key, const V &value,
+			 std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+		std::vector<std::string> argv{"SET", tpl.serialize_key(key), tpl.serialize_value(value)};
+		if (ttl.count() > 0) {
+			argv.emplace_back("PX");
+			argv.push_back(std::to_string(ttl.count()));
+		}
+		command(std::move(argv));
+	}
+
+	/**
+	 * @brief Queues an HSET of a typed hash; fields are serialized as keys, as hash_operations does.
+	 */
+	template<typename K, typename V>
+	void hset(const redis_template<K, V> &tpl, const K &key, const std::unordered_map<K, V> &fields,
+			  std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+		if (fields.empty()) return;
+		std::vector<std::string> argv{"HSET", tpl.serialize_key(key)};
+		argv.reserve(2 + 2 * fields.size());
+		for (const auto &field: fields) {
+			argv.push_back(tpl.serialize_key(field.first));
+			argv.push_back(tpl.serialize_value(field.second));
+		}
+		collection(std::move(argv), ttl);
+	}
+
+	template<typename K, typename V>
+	void rpush(const redis_template<K, V> &tpl, const K &key, const std::vector<V> &values,
+			   std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+		members("RPUSH", tpl, key, values, ttl);
+	}
+
+	template<typename K, typename V>
+	void sadd(const redis_template<K, V> &tpl, const K &key, const std::vector<V> &values,
+			  std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+		members("SADD", tpl, key, values, ttl);
+	}
+
+	template<typename K, typename V>
+	void zadd(const redis_template<K, V> &tpl, const K &key, const std::vector<std::pair<V, double>> &scored,
+			  std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+		if (scored.empty()) return;
+		std::vector<std::string> argv{"ZADD", tpl.serialize_key(key)};
+		argv.reserve(2 + 2 * scored.size());
+		for (const auto &member: scored) {
+			char score[32];
+			std::snprintf(score, sizeof(score), "%.17g", member.second);
+			argv.emplace_back(score);
+			argv.push_back(tpl.serialize_value(member.first));
+		}
+		collection(std::move(argv), ttl);
+	}
+
+	// ============================================================================
+	// Files
+	// ============================================================================
+
+	/**
+	 * @brief Queues the rows of a CSV stream (RFC 4180 quoting; quoted fields may hold delimiters and newlines).
+	 * @param in The stream.
+	 * @param command If empty, each row is a whole command ("SET,key,value"); otherwise each row holds the arguments
+	 * of this command ("key,value").
+	 * @param delimiter The field delimiter.
+	 * @return The number of rows queued.
+	 * @throw std::runtime_error on an unterminated quoted field.
+	 */
+	uint64_t load_csv(std::istream &in, const std::string &command = "", char delimiter = ',') {
+		uint64_t rows = 0;
+		std::vector<std::string> row;
+		while (read_csv_row(in, delimiter, row)) {
+			if (row.size() == 1 && row[0].empty()) continue;
+			if (!command.empty()) row.insert(row.begin(), command);
+			this->command(std::move(row));
+			row = std::vector<std::string>();
+			++rows;
+		}
+		return rows;
+	}
+
+	/**
+	 * @brief Queues the records of a binary stream. A record is a command: its argument count, then each argument as
+	 * a length followed by the bytes, all integers 32-bit little endian.
+	 * @return The number of records queued.
+	 * @throw std::runtime_error on a truncated record.
+	 */
+	uint64_t load_binary(std::istream &in) {
+		uint64_t records = 0;
+		uint32_t count = 0;
+		while (read_u32(in, count, true)) {
+			if (count == 0) throw std::runtime_error("bulk_loader: empty binary record");
+			std::vector<std::string> argv(count);
+			for (auto &arg: argv) {
+				uint32_t length = 0;
+				read_u32(in, length, false);
+				arg.resize(length);
+				if (length > 0 && !in.read(&arg[0], length)) {
+					throw std::runtime_error("bulk_loader: truncated binary record");
+				}
+			}
+			command(std::move(argv));
+			++records;
+		}
+		return records;
+	}
+
+	/**
+	 * @brief Sends the queued commands and waits for all replies. The loader cannot be used afterwards.
+	 * @return The totals of the load.
+	 * @throw std::runtime_error if a connection failed or max_errors was reached.
+	 */
+	bulk_load_stats finish() {
+		check();
+		for (auto &w: workers) {
+			if (!w->current.empty()) submit(*w);
+		}
+		stop();
+		check();
+		return report(true);
+	}
+
+	/**
+	 * @return The totals so far.
+	 */
+	bulk_load_stats stats() const {
+		bulk_load_stats s;
+		s.queued = queued.load();
+		s.replied = replied.load();
+		s.errors = errors.load();
+		s.bytes = bytes.load();
+		s.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		std::lock_guard<std::mutex> lock(error_mutex);
+		s.error_samples = samples;
+		return s;
+	}
+
+private:
+	using batch = std::vector<std::vector<std::string>>;
+
+	/**
+	 * @brief Where a writer thread sends its batches.
+	 */
+	class channel {
+	public:
+		explicit channel(bulk_loader &owner) : owner(owner) {
+		}
+
+		virtual ~channel() = default;
+
+		/* Sends a batch; replies may still be outstanding when it returns */
+		virtual void send(const batch &commands) = 0;
+
+		/* Waits for every outstanding reply */
+		virtual void drain() = 0;
+
+	protected:
+		bulk_loader &owner;
+	};
+
+	/**
+	 * @brief Streams RESP over a hiredis connection with a window of unanswered commands.
+	 */
+	class redis_channel: public channel {
+	public:
+		redis_channel(bulk_loader &owner, const std::string &host, int port) : channel(owner) {
+			const auto ms = owner.options.connect_timeout.count();
+			const timeval timeout{static_cast<time_t>(ms / 1000), static_cast<suseconds_t>(ms % 1000 * 1000)};
+			context = redisConnectWithTimeout(host.c_str(), port, timeout);
+			if (!context || context->err) {
+				const std::string error = context ? context->errstr : "out of memory";
+				redisFree(context);
+				throw std::runtime_error("bulk_loader: cannot connect to " + host + ":" + std::to_string(port) + ": "
+										 + error);
+			}
+		}
+
+		~redis_channel() override {
+			redisFree(context);
+		}
+
+		void send(const batch &commands) override {
+			buffer.clear();
+			for (const auto &argv: commands) {
+				encode(buffer, argv);
+			}
+			if (redisAppendFormattedCommand(context, buffer.data(), buffer.size()) != REDIS_OK) failed();
+			int done = 0;
+			while (!done) {
+				if (redisBufferWrite(context, &done) != REDIS_OK) failed();
+			}
+			owner.bytes += buffer.size();
+			outstanding += commands.size();
+			while (outstanding > owner.options.window) {
+				read_reply();
+			}
+		}
+
+		void drain() override {
+			while (outstanding > 0) {
+				read_reply();
+			}
+		}
+
+	private:
+		void read_reply() {
+			void *raw = nullptr;
+			if (redisGetReply(context, &raw) != REDIS_OK || raw == nullptr) failed();
+			auto *r = static_cast<redisReply *>(raw);
+			if (r->type == REDIS_REPLY_ERROR) owner.record_error(std::string(r->str, r->len));
+			freeReplyObject(r);
+			--outstanding;
+			++owner.replied;
+		}
+
+		[[noreturn]] void failed() const {
+			throw std::runtime_error(std::string("bulk_loader: connection failed: ") + context->errstr);
+		}
+
+		redisContext *context{nullptr};
+		std::string buffer;
+		size_t outstanding{0};
+	};
+
+	/**
+	 * @brief Sends each batch as one pipeline() of a kv_connection.
+	 */
+	class connection_channel: public channel {
+	public:
+		connection_channel(bulk_loader &owner, std::shared_ptr<kv_connection> connection) :
+			channel(owner), connection(std::move(connection)) {
+		}
+
+		void send(const batch &commands) override {
+			const std::vector<kv_reply> replies = connection->pipeline(commands);
+			uint64_t size = 0;
+			for (const auto &argv: commands) {
+				size += encoded_size(argv);
+			}
+			owner.bytes += size;
+			for (const auto &reply: replies) {
+				if (reply.is_error()) owner.record_error(reply.str);
+			}
+			owner.replied += replies.size();
+		}
+
+		void drain() override {
+		}
+
+	private:
+		std::shared_ptr<kv_connection> connection;
+	};
+
+	struct worker {
+		explicit worker(std::unique_ptr<channel> sink) : sink(std::move(sink)) {
+		}
+
+		std::unique_ptr<channel> sink;
+		/* The batch being filled by the producer */
+		batch current;
+		std::mutex mutex;
+		std::condition_variable wake;
+		std::deque<batch> queue;
+		bool closing{false};
+		std::thread thread;
+	};
+
+	void start() {
+		started = std::chrono::steady_clock::now();
+		last_progress = started;
+		for (auto &w: workers) {
+			worker *p = w.get();
+			p->thread = std::thread([this, p] { write_loop(*p); });
+		}
+	}
+
+	void stop() {
+		for (auto &w: workers) {
+			{
+				std::lock_guard<std::mutex> lock(w->mutex);
+				w->closing = true;
+			}
+			w->wake.notify_all();
+		}
+		for (auto &w: workers) {
+			if (w->thread.joinable()) w->thread.join();
+		}
+	}
+
+	void write_loop(worker &w) {
+		try {
+			for (;;) {
+				batch commands;
+				{
+					std::unique_lock<std::mutex> lock(w.mutex);
+					w.wake.wait(lock, [&w, this] { return !w.queue.empty() || w.closing || failed; });
+					if (failed) return;
+					if (w.queue.empty()) break;
+					commands = std::move(w.queue.front());
+					w.queue.pop_front();
+				}
+				// The producer may be waiting for room in the queue
+				w.wake.notify_all();
+				w.sink->send(commands);
+			}
+			w.sink->drain();
+		}
+		catch (const std::exception &e) {
+			fail(e.what());
+		}
+	}
+
+	/* Hands the producer's current batch of a connection to its writer, waiting while the queue is full */
+	void submit(worker &w) {
+		{
+			std::unique_lock<std::mutex> lock(w.mutex);
+			const size_t depth = std::max<size_t>(options.queue_depth, 1);
+			w.wake.wait(lock, [&w, depth, this] { return w.queue.size() < depth || failed; });
+			if (!failed) {
+				w.queue.push_back(std::move(w.current));
+			}
+		}
+		w.current = batch();
+		w.current.reserve(options.batch_size);
+		w.wake.notify_all();
+		check();
+	}
+
+	void record_error(const std::string &message) {
+		const uint64_t count = ++errors;
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (samples.size() < options.error_samples) samples.push_back(message);
+		}
+		if (options.max_errors > 0 && count >= options.max_errors) {
+			fail("too many errors (" + std::to_string(count) + "), last: " + message);
+		}
+	}
+
+	/* Stops every writer; the first failure is the one reported */
+	void fail(const std::string &reason) {
+		{
+			std::lock_guard<std::mutex> lock(error_mutex);
+			if (failure.empty()) failure = reason;
+		}
+		failed = true;
+		for (auto &w: workers) {
+			{ std::lock_guard<std::mutex> lock(w->mutex); }
+			w->wake.notify_all();
+		}
+	}
+
+	void check() const {
+		if (!failed) return;
+		std::lock_guard<std::mutex> lock(error_mutex);
+		throw std::runtime_error(failure.compare(0, 13, "bulk_loader: ") == 0 ? failure : "bulk_loader: " + failure);
+	}
+
+	bulk_load_stats report(bool last) {
+		const auto now = std::chrono::steady_clock::now();
+		if (!last && now - last_progress < options.progress_interval) return {};
+		last_progress = now;
+		bulk_load_stats s = stats();
+		if (options.on_progress) options.on_progress(s);
+		return s;
+	}
+
+	size_t route(const std::string &key) const {
+		return workers.size() == 1 ? 0 : static_cast<size_t>(murmurhash64a(key, 0) % workers.size());
+	}
+
+	template<typename K, typename V>
+	void members(const char *name, const redis_template<K, V> &tpl, const K &key, const std::vector<V> &values,
+				 std::chrono::milliseconds ttl) {
+		if (values.empty()) return;
+		std::vector<std::string> argv{name, tpl.serialize_key(key)};
+		argv.reserve(2 + values.size());
+		for (const auto &value: values) {
+			argv.push_back(tpl.serialize_value(value));
+		}
+		collection(std::move(argv), ttl);
+	}
+
+	/* Queues a collection write, followed by its expiry on the same connection so it applies afterwards */
+	void collection(std::vector<std::string> argv, std::chrono::milliseconds ttl) {
+		const std::string key = argv[1];
+		command(std::move(argv));
+		if (ttl.count() > 0) command({"PEXPIRE", key, std::to_string(ttl.count())});
+	}
+
+	static void encode(std::string &out, const std::vector<std::string> &argv) {
+		out += '*';
+		out += std::to_string(argv.size());
+		out += "\r\n";
+		for (const auto &arg: argv) {
+			out += '$';
+			out += std::to_string(arg.size());
+			out += "\r\n";
+			out += arg;
+			out += "\r\n";
+		}
+	}
+
+	static uint64_t encoded_size(const std::vector<std::string> &argv) {
+		uint64_t size = 3 + std::to_string(argv.size()).size();
+		for (const auto &arg: argv) {
+			size += 5 + std::to_string(arg.size()).size() + arg.size();
+		}
+		return size;
+	}
+
+	static bool read_csv_row(std::istream &in, char delimiter, std::vector<std::string> &row) {
+		row.clear();
+		if (in.peek() == std::char_traits<char>::eof()) return false;
+		std::string field;
+		bool quoted = false;
+		for (;;) {
+			const int c = in.get();
+			if (c == std::char_traits<char>::eof()) {
+				if (quoted) throw std::runtime_error("bulk_loader: unterminated quoted CSV field");
+				break;
+			}
+			if (quoted) {
+				if (c != '"') field += static_cast<char>(c);
+				else if (in.peek() == '"') field += static_cast<char>(in.get());
+				else quoted = false;
+			}
+			else if (c == '"') {
+				quoted = true;
+			}
+			else if (c == delimiter) {
+				row.push_back(std::move(field));
+				field.clear();
+			}
+			else if (c == '\n') {
+				break;
+			}
+			else if (c != '\r') {
+				field += static_cast<char>(c);
+			}
+		}
+		row.push_back(std::move(field));
+		return true;
+	}
+
+	/* Reads a little-endian 32-bit integer; at_boundary allows a clean end of the stream instead */
+	static bool read_u32(std::istream &in, uint32_t &value, bool at_boundary) {
+		unsigned char bytes[4];
+		in.read(reinterpret_cast<char *>(bytes), 4);
+		if (in.gcount() == 0 && at_boundary) return false;
+		if (in.gcount() != 4) throw std::runtime_error("bulk_loader: truncated binary record");
+		value = static_cast<uint32_t>(bytes[0]) | static_cast<uint32_t>(bytes[1]) << 8
+				| static_cast<uint32_t>(bytes[2]) << 16 | static_cast<uint32_t>(bytes[3]) << 24;
+		return true;
+	}
+
+	const bulk_load_options options;
+	std::vector<std::unique_ptr<worker>> workers;
+
+	/* Producer state; queued is also read by stats() */
+	std::atomic<uint64_t> queued{0};
+	uint64_t since_progress{0};
+	std::chrono::steady_clock::time_point started;
+	std::chrono::steady_clock::time_point last_progress;
+
+	/* Updated by the writers */
+	std::atomic<uint64_t> replied{0};
+	std::atomic<uint64_t> errors{0};
+	std::atomic<uint64_t> bytes{0};
+	std::atomic<bool> failed{false};
+	/* Guards samples and failure */
+	mutable std::mutex error_mutex;
+	std::vector<std::string> samples;
+	std::string failure;
+};
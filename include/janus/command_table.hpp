@@ -0,0 +1,155 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief Returns whether a raw command only reads data, so that a cache may let it through without invalidating and
+ * a read-only replica may answer it.
+ * @param name The command name, in any case.
+ */
+inline bool is_read_command(std::string name) {
+	static const std::unordered_set<std::string> reads{
+		"BITCOUNT", "BITPOS", "DBSIZE", "ECHO", "EXISTS", "GET", "GETBIT", "GETRANGE", "HEXISTS", "HGET",
+		"HGETALL", "HKEYS", "HLEN", "HMGET", "HVALS", "LINDEX", "LLEN", "LRANGE", "MGET", "PFCOUNT", "PING",
+		"PTTL", "SCAN", "SCARD", "SDIFF", "SINTER", "SISMEMBER", "SMEMBERS", "STRLEN", "SUNION", "TTL", "TYPE",
+		"ZCARD", "ZCOUNT", "ZRANGE", "ZRANGEBYSCORE", "ZRANK", "ZREVRANGE", "ZREVRANK", "ZSCORE"};
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+	return reads.count(name) > 0;
+}
+
+/**
+ * @brief Returns whether a raw command changes keys it does not name (FLUSHALL, FLUSHDB, SWAPDB), so that a cache must
+ * drop everything it holds.
+ * @param name The command name, in any case.
+ */
+inline bool is_keyspace_command(std::string name) {
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+	return name == "FLUSHALL" || name == "FLUSHDB" || name == "SWAPDB";
+}
+
+/**
+ * @brief Returns the key arguments of a raw command, at the positions given by the Redis command table.
+ * * Commands without keys (PING, MULTI, SCAN, PUBLISH, FLUSHALL...) return none; is_keyspace_command() tells those
+ * that change every key. A command not listed here takes its first argument as its only key, as most Redis commands do.
+ * @param argv The command and its arguments.
+ * @return The keys, in argument order.
+ */
+inline std::vector<std::string> command_keys(const std::vector<std::string> &argv) {
+	enum class positions {
+		/* No key */
+		none,
+		/* Every argument */
+		all,
+		/* Every other argument, starting with the first (MSET key value...) */
+		pairs,
+		/* The first two arguments (RENAME source destination...) */
+		first_two,
+		/* Every argument but the trailing timeout */
+		all_but_last,
+		/* A key count as the first argument, then the keys */
+		counted_at_1,
+		/* A key count as the second argument, then the keys */
+		counted_at_2,
+		/* A destination key, then a key count and the keys (ZUNIONSTORE) */
+		destination_counted,
+		/* Every argument after the first (BITOP operation destination key...) */
+		after_first,
+		/* A subcommand, then one key (OBJECT ENCODING key) */
+		subcommand
+	};
+	static const std::unordered_map<std::string, positions> table{
+		{"PING", positions::none}, {"ECHO", positions::none}, {"DBSIZE", positions::none},
+		{"SCAN", positions::none}, {"KEYS", positions::none}, {"RANDOMKEY", positions::none},
+		{"MULTI", positions::none}, {"EXEC", positions::none}, {"DISCARD", positions::none},
+		{"UNWATCH", positions::none}, {"SELECT", positions::none}, {"FLUSHALL", positions::none},
+		{"FLUSHDB", positions::none}, {"SWAPDB", positions::none}, {"PUBLISH", positions::none},
+		{"SCRIPT", positions::none}, {"FUNCTION", positions::none}, {"CONFIG", positions::none},
+		{"INFO", positions::none}, {"CLIENT", positions::none}, {"TIME", positions::none},
+		{"WAIT", positions::none}, {"REPLCONF", positions::none},
+		{"DEL", positions::all}, {"UNLINK", positions::all}, {"EXISTS", positions::all},
+		{"TOUCH", positions::all}, {"WATCH", positions::all}, {"MGET", positions::all},
+		{"SDIFF", positions::all}, {"SINTER", positions::all}, {"SUNION", positions::all},
+		{"SDIFFSTORE", positions::all}, {"SINTERSTORE", positions::all}, {"SUNIONSTORE", positions::all},
+		{"PFCOUNT", positions::all}, {"PFMERGE", positions::all},
+		{"MSET", positions::pairs}, {"MSETNX", positions::pairs},
+		{"RENAME", positions::first_two}, {"RENAMENX", positions::first_two}, {"COPY", positions::first_two},
+		{"RPOPLPUSH", positions::first_two}, {"BRPOPLPUSH", positions::first_two}, {"LMOVE", positions::first_two},
+		{"BLMOVE", positions::first_two}, {"SMOVE", positions::first_two}, {"ZRANGESTORE", positions::first_two},
+		{"GEOSEARCHSTORE", positions::first_two}, {"LCS", positions::first_two},
+		{"BLPOP", positions::all_but_last}, {"BRPOP", positions::all_but_last},
+		{"BZPOPMIN", positions::all_but_last}, {"BZPOPMAX", positions::all_but_last},
+		{"ZUNION", positions::counted_at_1}, {"ZINTER", positions::counted_at_1}, {"ZDIFF", positions::counted_at_1},
+		{"ZINTERCARD", positions::counted_at_1}, {"SINTERCARD", positions::counted_at_1},
+		{"LMPOP", positions::counted_at_1}, {"ZMPOP", positions::counted_at_1},
+		{"BLMPOP", positions::counted_at_2}, {"BZMPOP", positions::counted_at_2}, {"EVAL", positions::counted_at_2},
+		{"EVALSHA", positions::counted_at_2}, {"EVAL_RO", positions::counted_at_2},
+		{"EVALSHA_RO", positions::counted_at_2}, {"FCALL", positions::counted_at_2},
+		{"FCALL_RO", positions::counted_at_2},
+		{"ZUNIONSTORE", positions::destination_counted}, {"ZINTERSTORE", positions::destination_counted},
+		{"ZDIFFSTORE", positions::destination_counted},
+		{"BITOP", positions::after_first},
+		{"OBJECT", positions::subcommand}, {"MEMORY", positions::subcommand}};
+
+	if (argv.empty()) return {};
+	std::string name = argv[0];
+	std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+	const size_t size = argv.size();
+	const auto it = table.find(name);
+	if (it == table.end()) return size > 1 ? std::vector<std::string>{argv[1]} : std::vector<std::string>();
+
+	// The keys following a key count, bounded by the arguments actually present
+	const auto counted = [&argv, size](size_t count_at) {
+		if (count_at >= size) return std::vector<std::string>();
+		const long long count = std::max(std::atoll(argv[count_at].c_str()), 0LL);
+		const size_t end = count_at + 1 + std::min(static_cast<size_t>(count), size - count_at - 1);
+		return std::vector<std::string>(argv.begin() + static_cast<std::ptrdiff_t>(count_at + 1),
+										argv.begin() + static_cast<std::ptrdiff_t>(end));
+	};
+
+	std::vector<std::string> keys;
+	switch (it->second) {
+		case positions::none:
+			break;
+		case positions::all:
+			keys.assign(argv.begin() + 1, argv.end());
+			break;
+		case positions::pairs:
+			for (size_t i = 1; i < size; i += 2) {
+				keys.push_back(argv[i]);
+			}
+			break;
+		case positions::first_two:
+			keys.assign(argv.begin() + 1, argv.begin() + static_cast<std::ptrdiff_t>(std::min<size_t>(size, 3)));
+			break;
+		case positions::all_but_last:
+			if (size > 2) keys.assign(argv.begin() + 1, argv.end() - 1);
+			break;
+		case positions::counted_at_1:
+			keys = counted(1);
+			break;
+		case positions::counted_at_2:
+			keys = counted(2);
+			break;
+		case positions::destination_counted:
+			if (size > 1) keys.push_back(argv[1]);
+			for (auto &key: counted(2)) {
+				keys.push_back(std::move(key));
+			}
+			break;
+		case positions::after_first:
+			if (size > 2) keys.assign(argv.begin() + 2, argv.end());
+			break;
+		case positions::subcommand:
+			if (size > 2) keys.push_back(argv[2]);
+			break;
+	}
+	return keys;
+}
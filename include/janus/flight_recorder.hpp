@@ -0,0 +1,428 @@
+#pragma once
+
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "observed_connection.hpp"
+
+/**
+ * @brief One call, as kept by the flight_recorder. Names, keys and errors are truncated.
+ */
+struct flight_record {
+	/* Wall clock at the reply, microseconds since the epoch */
+	int64_t time_us;
+	uint64_t latency_ns;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	/* The size of the key, which may be longer than the prefix kept */
+	uint32_t key_size;
+	uint32_t batch;
+	/* The OS thread id of the caller */
+	uint32_t thread;
+	/* 0 for success, 1 for an exception, 2 for error replies */
+	uint32_t outcome;
+	char command[16];
+	char key[40];
+	char error[48];
+};
+
+/**
+ * @brief A command that took longer than the slow log threshold, with its context.
+ */
+struct slow_command {
+	flight_record record;
+	std::string key;
+	std::string error;
+	/* The records of the same thread just before it, oldest first */
+	std::vector<flight_record> preceding;
+};
+
+struct flight_recorder_options {
+	/* Records kept per thread */
+	size_t capacity = 256;
+	/* Calls slower than this go to the slow log; zero turns the slow log off */
+	std::chrono::microseconds slow_threshold{0};
+	size_t slow_log_size = 128;
+	/* Records of the same thread kept with a slow command */
+	size_t slow_context = 8;
+	/* Writes every thread's records to dump_fd when a call throws, at most once per dump_interval */
+	bool dump_on_error = false;
+	int dump_fd = 2;
+	std::chrono::milliseconds dump_interval{1000};
+};
+
+/**
+ * @brief A static observer keeping the last calls of each thread, to tell what a client was doing when something
+ * went wrong: observed_connection<flight_recorder>.
+ * * Each thread writes to its own ring of fixed-size records without locks or allocation; readers copy records
+ * under a per-record sequence number and skip those being overwritten. The records can be dumped on demand, from a
+ * signal handler (dump(int) is async-signal-safe), or automatically when a call throws. Calls above a threshold are
+ * also kept in a slow log, with their full key, error and the records of their thread before them.
+ *
+ * The ring of an exited thread keeps its records and is taken over by the next thread that starts recording, so
+ * memory follows the number of threads running at once rather than of threads ever started.
+ *
+ * Copies of a flight_recorder share the same rings and slow log.
+ */
+class flight_recorder {
+public:
+	explicit flight_recorder(const flight_recorder_options &options = flight_recorder_options()) :
+		state(std::make_shared<shared_state>(options)) {
+		if (options.capacity == 0) throw std::invalid_argument("flight_recorder: capacity must be positive");
+	}
+
+	void after_reply(const command_event &event) {
+		flight_record r{};
+		r.time_us = std::chrono::duration_cast<std::chrono::microseconds>(
+						std::chrono::system_clock::now().time_since_epoch())
+						.count();
+		r.latency_ns = static_cast<uint64_t>(event.duration.count());
+		r.bytes_sent = event.bytes_sent;
+		r.bytes_received = event.bytes_received;
+		r.key_size = static_cast<uint32_t>(event.key.size());
+		r.batch = static_cast<uint32_t>(event.batch);
+		r.outcome = event.error ? 1 : event.error_replies > 0 ? 2 : 0;
+		copy_truncated(r.command, sizeof(r.command), event.command, std::strlen(event.command));
+		copy_truncated(r.key, sizeof(r.key), event.key.data(), event.key.size());
+		if (event.error) copy_truncated(r.error, sizeof(r.error), event.error, std::strlen(event.error));
+
+		ring &own = local_ring();
+		r.thread = own.thread;
+		if (state->options.slow_threshold.count() > 0 && event.duration >= state->options.slow_threshold) {
+			log_slow(own, r, event);
+		}
+		own.push(r);
+		if (event.error && state->options.dump_on_error) dump_throttled();
+	}
+
+	/**
+	 * @brief Returns the records of every thread, oldest first.
+	 */
+	std::vector<flight_record> records() const {
+		std::vector<flight_record> result;
+		for (const ring *r = state->rings.load(std::memory_order_acquire); r; r = r->next) {
+			r->read([&result](const flight_record &record) { result.push_back(record); });
+		}
+		std::stable_sort(result.begin(), result.end(), [](const flight_record &a, const flight_record &b) {
+			return a.time_us < b.time_us;
+		});
+		return result;
+	}
+
+	/**
+	 * @brief Writes the records of every thread, oldest first, one line each.
+	 */
+	void dump(std::ostream &out) const {
+		char line[line_size];
+		for (const auto &record: records()) {
+			out.write(line, static_cast<std::streamsize>(format(record, line, sizeof(line))));
+		}
+	}
+
+	/**
+	 * @brief Writes the records to a file descriptor, thread by thread. Safe to call from a signal handler.
+	 */
+	void dump(int fd) const {
+		dump_state(*state, fd);
+	}
+
+	/**
+	 * @brief Returns the slow log, oldest first.
+	 */
+	std::vector<slow_command> slow_log() const {
+		std::lock_guard<std::mutex> lock(state->slow_mutex);
+		return {state->slow.begin(), state->slow.end()};
+	}
+
+	void clear_slow_log() {
+		std::lock_guard<std::mutex> lock(state->slow_mutex);
+		state->slow.clear();
+	}
+
+	/**
+	 * @brief Dumps a recorder's records to a file descriptor whenever the process receives a signal, e.g. SIGUSR1.
+	 * The recorder's rings stay alive for the process' lifetime.
+	 */
+	static void dump_on_signal(const flight_recorder &recorder, int signal = SIGUSR1, int fd = STDERR_FILENO) {
+		static std::mutex install_mutex;
+		static std::vector<std::shared_ptr<shared_state>> kept;
+		std::lock_guard<std::mutex> lock(install_mutex);
+		kept.push_back(recorder.state);
+		signal_target().store(recorder.state.get(), std::memory_order_release);
+		signal_fd().store(fd, std::memory_order_relaxed);
+		struct sigaction action {};
+		action.sa_handler = [](int) {
+			const shared_state *target = signal_target().load(std::memory_order_acquire);
+			if (target) dump_state(*target, signal_fd().load(std::memory_order_relaxed));
+		};
+		sigemptyset(&action.sa_mask);
+		action.sa_flags = SA_RESTART;
+		if (::sigaction(signal, &action, nullptr) != 0) {
+			throw std::runtime_error("flight_recorder: cannot install the signal handler");
+		}
+	}
+
+	/**
+	 * @brief Formats a record as a line: time, thread, command, key, sizes, latency and outcome. Async-signal-safe.
+	 * @return The length written, at most size - 1; the line ends with a newline and is null-terminated.
+	 * @note size must be at least 2.
+	 */
+	static size_t format(const flight_record &r, char *buffer, size_t size) {
+		line_writer w{buffer, buffer + size - 2};
+		w.number(static_cast<uint64_t>(r.time_us / 1000000));
+		w.text(".");
+		w.number(static_cast<uint64_t>(r.time_us % 1000000), 6);
+		w.text(" tid=");
+		w.number(r.thread);
+		w.text(" ");
+		w.printable(r.command);
+		w.text(" ");
+		w.printable(r.key);
+		if (r.key_size >= sizeof(r.key)) w.text("...");
+		if (r.batch > 1) {
+			w.text(" batch=");
+			w.number(r.batch);
+		}
+		w.text(" sent=");
+		w.number(r.bytes_sent);
+		w.text(" received=");
+		w.number(r.bytes_received);
+		w.text(" latency_us=");
+		w.number(r.latency_ns / 1000);
+		w.text(r.outcome == 0 ? " ok" : r.outcome == 1 ? " error " : " error-replies");
+		if (r.outcome == 1) w.printable(r.error);
+		*w.out++ = '\n';
+		*w.out = '\0';
+		return static_cast<size_t>(w.out - buffer);
+	}
+
+private:
+	static constexpr size_t line_size = 256;
+	static constexpr size_t record_words = (sizeof(flight_record) + 7) / 8;
+
+	/* The records of one thread: a ring written by that thread only, read under per-slot sequence numbers */
+	struct ring {
+		struct slot {
+			std::atomic<uint64_t> sequence{0};
+			std::atomic<uint64_t> words[record_words];
+		};
+
+		ring(size_t capacity, uint32_t thread) : capacity(capacity), thread(thread), slots(new slot[capacity]) {
+		}
+
+		void push(const flight_record &record) {
+			uint64_t words[record_words] = {};
+			std::memcpy(words, &record, sizeof(record));
+			const uint64_t n = head.load(std::memory_order_relaxed);
+			slot &s = slots[n % capacity];
+			s.sequence.store(2 * n + 1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_release);
+			for (size_t i = 0; i < record_words; ++i) {
+				s.words[i].store(words[i], std::memory_order_relaxed);
+			}
+			s.sequence.store(2 * n + 2, std::memory_order_release);
+			head.store(n + 1, std::memory_order_release);
+		}
+
+		/* Calls f with each intact record, oldest first, or with the last `limit` ones */
+		template<typename F>
+		void read(F &&f, size_t limit = SIZE_MAX) const {
+			const uint64_t end = head.load(std::memory_order_acquire);
+			const uint64_t kept = std::min<uint64_t>({end, capacity, limit});
+			for (uint64_t n = end - kept; n < end; ++n) {
+				const slot &s = slots[n % capacity];
+				const uint64_t before = s.sequence.load(std::memory_order_acquire);
+				if (before != 2 * n + 2) continue;
+				uint64_t words[record_words];
+				for (size_t i = 0; i < record_words; ++i) {
+					words[i] = s.words[i].load(std::memory_order_relaxed);
+				}
+				std::atomic_thread_fence(std::memory_order_acquire);
+				if (s.sequence.load(std::memory_order_relaxed) != before) continue;
+				flight_record record;
+				std::memcpy(&record, words, sizeof(record));
+				f(record);
+			}
+		}
+
+		const size_t capacity;
+		/* The owner's OS thread id; written and read by the owner only */
+		uint32_t thread;
+		std::unique_ptr<slot[]> slots;
+		std::atomic<uint64_t> head{0};
+		/* Cleared when the owner exits, so that a new thread can take the ring over */
+		std::atomic<bool> in_use{true};
+		/* The next ring of the recorder; rings are only ever added, so signal handlers can walk them */
+		ring *next{nullptr};
+	};
+
+	struct shared_state {
+		explicit shared_state(const flight_recorder_options &options) : id(next_id()), options(options) {
+		}
+
+		static uint64_t next_id() {
+			static std::atomic<uint64_t> next{1};
+			return next.fetch_add(1);
+		}
+
+		~shared_state() {
+			ring *r = rings.load();
+			while (r) {
+				ring *next = r->next;
+				delete r;
+				r = next;
+			}
+		}
+
+		const uint64_t id;
+		const flight_recorder_options options;
+		std::atomic<ring *> rings{nullptr};
+		std::atomic<int64_t> last_dump_ms{INT64_MIN};
+		mutable std::mutex slow_mutex;
+		std::deque<slow_command> slow;
+	};
+
+	/* The rings a thread records into, one per recorder; released when the thread exits */
+	struct thread_rings {
+		struct entry {
+			uint64_t id;
+			ring *own;
+			std::weak_ptr<shared_state> state;
+		};
+		std::vector<entry> entries;
+
+		~thread_rings() {
+			for (const auto &e: entries) {
+				// A recorder destroyed first has deleted its rings
+				if (auto state = e.state.lock()) e.own->in_use.store(false, std::memory_order_release);
+			}
+		}
+	};
+
+	/* Appends text to a fixed buffer, dropping what does not fit */
+	struct line_writer {
+		char *out;
+		char *const end;
+
+		void text(const char *s) {
+			while (*s && out < end) *out++ = *s++;
+		}
+
+		void printable(const char *s) {
+			for (; *s && out < end; ++s) {
+				*out++ = *s >= 0x20 && *s < 0x7f ? *s : '?';
+			}
+		}
+
+		void number(uint64_t v, int min_digits = 1) {
+			char digits[20];
+			int n = 0;
+			do {
+				digits[n++] = static_cast<char>('0' + v % 10);
+				v /= 10;
+			} while (v > 0 && n < 20);
+			while (n < min_digits && n < 20) digits[n++] = '0';
+			while (n > 0 && out < end) *out++ = digits[--n];
+		}
+	};
+
+	static void copy_truncated(char *to, size_t size, const char *from, size_t length) {
+		const size_t n = std::min(length, size - 1);
+		std::memcpy(to, from, n);
+		to[n] = '\0';
+	}
+
+	static void dump_state(const shared_state &s, int fd) {
+		char line[line_size];
+		for (const ring *r = s.rings.load(std::memory_order_acquire); r; r = r->next) {
+			r->read([fd, &line](const flight_record &record) {
+				const size_t length = format(record, line, sizeof(line));
+				size_t written = 0;
+				while (written < length) {
+					const ssize_t n = ::write(fd, line + written, length - written);
+					if (n <= 0) return;
+					written += static_cast<size_t>(n);
+				}
+			});
+		}
+	}
+
+	static std::atomic<const shared_state *> &signal_target() {
+		static std::atomic<const shared_state *> target{nullptr};
+		return target;
+	}
+
+	static std::atomic<int> &signal_fd() {
+		static std::atomic<int> fd{STDERR_FILENO};
+		return fd;
+	}
+
+	ring &local_ring() {
+		// Each thread caches its ring of the recorders it records into; ids are never reused
+		thread_local thread_rings cache;
+		for (const auto &entry: cache.entries) {
+			if (entry.id == state->id) return *entry.own;
+		}
+		const auto thread = static_cast<uint32_t>(::syscall(SYS_gettid));
+		ring *own = nullptr;
+		// The acquire orders the previous owner's writes before this thread's
+		for (ring *r = state->rings.load(std::memory_order_acquire); r && !own; r = r->next) {
+			bool in_use = false;
+			if (r->in_use.compare_exchange_strong(in_use, true, std::memory_order_acquire, std::memory_order_relaxed)) {
+				own = r;
+				own->thread = thread;
+			}
+		}
+		if (!own) {
+			own = new ring(state->options.capacity, thread);
+			own->next = state->rings.load(std::memory_order_relaxed);
+			while (!state->rings.compare_exchange_weak(own->next, own, std::memory_order_release,
+													   std::memory_order_relaxed)) {
+			}
+		}
+		cache.entries.push_back({state->id, own, state});
+		return *own;
+	}
+
+	void log_slow(const ring &own, const flight_record &record, const command_event &event) {
+		slow_command entry;
+		entry.record = record;
+		entry.key.assign(event.key.data(), event.key.size());
+		if (event.error) entry.error = event.error;
+		if (state->options.slow_context > 0) {
+			own.read([&entry](const flight_record &r) { entry.preceding.push_back(r); }, state->options.slow_context);
+		}
+		std::lock_guard<std::mutex> lock(state->slow_mutex);
+		state->slow.push_back(std::move(entry));
+		while (state->slow.size() > state->options.slow_log_size) {
+			state->slow.pop_front();
+		}
+	}
+
+	void dump_throttled() {
+		const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+								std::chrono::steady_clock::now().time_since_epoch())
+								.count();
+		int64_t last = state->last_dump_ms.load(std::memory_order_relaxed);
+		if (last != INT64_MIN && now - last < state->options.dump_interval.count()) return;
+		if (!state->last_dump_ms.compare_exchange_strong(last, now, std::memory_order_relaxed)) return;
+		dump(state->options.dump_fd);
+	}
+
+	std::shared_ptr<shared_state> state;
+};
@@ -0,0 +1,320 @@
+#pragma once
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "kv_connection.hpp"
+
+/**
+ * @brief A kv_connection that forwards every call to another connection.
+ * * It is the base of decorators that add behavior around some commands, such as a cache consulted before the
+ * network: they override those commands and leave the rest to this class.
+ */
+class forwarding_connection: public kv_connection {
+public:
+	explicit forwarding_connection(std::shared_ptr<kv_connection> target) : target(std::move(target)) {
+		if (!this->target) {
+			throw std::invalid_argument("forwarding_connection: target connection is null");
+		}
+	}
+
+	bool exists(const std::string &key) override {
+		return target->exists(key);
+	}
+
+	bool expire(const std::string &key, int seconds) override {
+		return target->expire(key, seconds);
+	}
+
+	bool pexpire(const std::string &key, int milliseconds) override {
+		return target->pexpire(key, milliseconds);
+	}
+
+	long long del(const std::string &key) override {
+		return target->del(key);
+	}
+
+	long long del(const std::vector<std::string> &keys) override {
+		return target->del(keys);
+	}
+
+	int64_t ttl(const std::string &key) override {
+		return target->ttl(key);
+	}
+
+	int64_t pttl(const std::string &key) override {
+		return target->pttl(key);
+	}
+
+	// ============================================================================
+	// For String
+	// ============================================================================
+
+	bool set(const std::string &key, const std::string &value) override {
+		return target->set(key, value);
+	}
+
+	bool set_not_exists(const std::string &key, const std::string &value) override {
+		return target->set_not_exists(key, value);
+	}
+
+	bool set_ex(const std::string &key, const std::string &value, int seconds) override {
+		return target->set_ex(key, value, seconds);
+	}
+
+	bool set_px(const std::string &key, const std::string &value, int milliseconds) override {
+		return target->set_px(key, value, milliseconds);
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		return target->get(key);
+	}
+
+	std::optional<std::string> getset(const std::string &key, const std::string &new_value) override {
+		return target->getset(key, new_value);
+	}
+
+	long long incr(const std::string &key, long long delta) override {
+		return target->incr(key, delta);
+	}
+
+	long long decr(const std::string &key, long long delta) override {
+		return target->decr(key, delta);
+	}
+
+	long long append(const std::string &key, const std::string &value) override {
+		return target->append(key, value);
+	}
+
+	std::string getrange(const std::string &key, long long start, long long end) override {
+		return target->getrange(key, start, end);
+	}
+
+	// ============================================================================
+	// For Hash
+	// ============================================================================
+
+	std::optional<std::string> hget(const std::string &key, const std::string &hash_key) override {
+		return target->hget(key, hash_key);
+	}
+
+	void hget(const std::string &key, std::unordered_map<std::string, std::optional<std::string>> &hash_map) override {
+		target->hget(key, hash_map);
+	}
+
+	bool hset(const std::string &key, const std::string &field, const std::string &value) override {
+		return target->hset(key, field, value);
+	}
+
+	bool hset(const std::string &key, const std::unordered_map<std::string, std::string> &hash_map) override {
+		return target->hset(key, hash_map);
+	}
+
+	std::unordered_map<std::string, std::string> hgetall(const std::string &key) override {
+		return target->hgetall(key);
+	}
+
+	std::vector<std::string> hkeys(const std::string &key) override {
+		return target->hkeys(key);
+	}
+
+	std::vector<std::string> hvals(const std::string &key) override {
+		return target->hvals(key);
+	}
+
+	long long hdel(const std::string &key, const std::string &hash_key) override {
+		return target->hdel(key, hash_key);
+	}
+
+	long long hdel(const std::string &key, const std::vector<std::string> &hash_keys) override {
+		return target->hdel(key, hash_keys);
+	}
+
+	// ============================================================================
+	// For List
+	// ============================================================================
+
+	long long lpush(const std::string &key, const std::vector<std::string> &values) override {
+		return target->lpush(key, values);
+	}
+
+	long long lpush(const std::string &key, const std::string &value) override {
+		return target->lpush(key, value);
+	}
+
+	long long rpush(const std::string &key, const std::string &value) override {
+		return target->rpush(key, value);
+	}
+
+	long long rpush(const std::string &key, const std::vector<std::string> &values) override {
+		return target->rpush(key, values);
+	}
+
+	std::optional<std::string> lpop(const std::string &key) override {
+		return target->lpop(key);
+	}
+
+	std::optional<std::string> rpop(const std::string &key) override {
+		return target->rpop(key);
+	}
+
+	std::vector<std::string> lrange(const std::string &key, long long start, long long stop) override {
+		return target->lrange(key, start, stop);
+	}
+
+	long long llen(const std::string &key) override {
+		return target->llen(key);
+	}
+
+	// ============================================================================
+	// For Set
+	// ============================================================================
+
+	long long sadd(const std::string &key, const std::vector<std::string> &members) override {
+		return target->sadd(key, members);
+	}
+
+	long long srem(const std::string &key, const std::vector<std::string> &members) override {
+		return target->srem(key, members);
+	}
+
+	std::vector<std::string> smembers(const std::string &key) override {
+		return target->smembers(key);
+	}
+
+	long long scard(const std::string &key) override {
+		return target->scard(key);
+	}
+
+	bool sismember(const std::string &key, const std::string &member) override {
+		return target->sismember(key, member);
+	}
+
+	std::optional<std::string> spop(const std::string &key) override {
+		return target->spop(key);
+	}
+
+	std::vector<std::string> sinter(const std::vector<std::string> &keys) override {
+		return target->sinter(keys);
+	}
+
+	// ============================================================================
+	// For ZSet
+	// ============================================================================
+
+	long long zadd(const std::string &key, const std::unordered_map<std::string, double> &members) override {
+		return target->zadd(key, members);
+	}
+
+	long long zrem(const std::string &key, const std::vector<std::string> &members) override {
+		return target->zrem(key, members);
+	}
+
+	std::optional<double> zscore(const std::string &key, const std::string &member) override {
+		return target->zscore(key, member);
+	}
+
+	std::vector<std::string> zrange(const std::string &key, long long start, long long stop) override {
+		return target->zrange(key, start, stop);
+	}
+
+	std::vector<std::string> zrevrange(const std::string &key, long long start, long long stop) override {
+		return target->zrevrange(key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrange_withscores(const std::string &key, long long start,
+																  long long stop) override {
+		return target->zrange_withscores(key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrevrange_withscores(const std::string &key, long long start,
+																	 long long stop) override {
+		return target->zrevrange_withscores(key, start, stop);
+	}
+
+	double zincrby(const std::string &key, double increment, const std::string &member) override {
+		return target->zincrby(key, increment, member);
+	}
+
+	std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																		 double max) override {
+		return target->zrangebyscore_withscores(key, min, max);
+	}
+
+	long long zremrangebyscore(const std::string &key, double min, double max) override {
+		return target->zremrangebyscore(key, min, max);
+	}
+
+	// ============================================================================
+	// For HyperLogLog
+	// ============================================================================
+
+	bool pfadd(const std::string &key, const std::vector<std::string> &elements) override {
+		return target->pfadd(key, elements);
+	}
+
+	long long pfcount(const std::vector<std::string> &keys) override {
+		return target->pfcount(keys);
+	}
+
+	bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) override {
+		return target->pfmerge(dest, sources);
+	}
+
+	// ============================================================================
+	// For Bitmap
+	// ============================================================================
+
+	bool setbit(const std::string &key, long long offset, bool value) override {
+		return target->setbit(key, offset, value);
+	}
+
+	bool getbit(const std::string &key, long long offset) override {
+		return target->getbit(key, offset);
+	}
+
+	long long bitcount(const std::string &key, long long start, long long end) override {
+		return target->bitcount(key, start, end);
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end) override {
+		return target->bitpos(key, bit, start, end);
+	}
+
+	long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) override {
+		return target->bitop(op, dest, keys);
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &key,
+												   const std::vector<std::string> &args) override {
+		return target->bitfield(key, args);
+	}
+
+	// ============================================================================
+	// For Scripting
+	// ============================================================================
+
+	std::string script_load(const std::string &script) override {
+		return target->script_load(script);
+	}
+
+	kv_reply evalsha(const std::string &sha1, const std::vector<std::string> &keys,
+					 const std::vector<std::string> &args) override {
+		return target->evalsha(sha1, keys, args);
+	}
+
+	// ============================================================================
+	// For Pipelining
+	// ============================================================================
+
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		return target->pipeline(commands);
+	}
+
+protected:
+	std::shared_ptr<kv_connection> target;
+};
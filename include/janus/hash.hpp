@@ -0,0 +1,108 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+/**
+ * @brief MurmurHash2, 64-bit version (MurmurHash64A), as used by Redis for HyperLogLog.
+ * * Blocks are read in little-endian order on every platform, so results match Redis bit for bit.
+ * @param key The data to hash.
+ * @param len The length of the data in bytes.
+ * @param seed The hash seed.
+ * @return The 64-bit hash.
+ */
+inline uint64_t murmurhash64a(const void *key, size_t len, uint64_t seed) {
+	const uint64_t m = 0xc6a4a7935bd1e995ULL;
+	const int r = 47;
+	uint64_t h = seed ^ (static_cast<uint64_t>(len) * m);
+	const auto *data = static_cast<const unsigned char *>(key);
+	const unsigned char *end = data + (len - (len & 7));
+
+	while (data != end) {
+		uint64_t k = static_cast<uint64_t>(data[0]) | static_cast<uint64_t>(data[1]) << 8
+					 | static_cast<uint64_t>(data[2]) << 16 | static_cast<uint64_t>(data[3]) << 24
+					 | static_cast<uint64_t>(data[4]) << 32 | static_cast<uint64_t>(data[5]) << 40
+					 | static_cast<uint64_t>(data[6]) << 48 | static_cast<uint64_t>(data[7]) << 56;
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+		data += 8;
+	}
+
+	switch (len & 7) {
+		case 7:
+			h ^= static_cast<uint64_t>(data[6]) << 48;
+			[[fallthrough]];
+		case 6:
+			h ^= static_cast<uint64_t>(data[5]) << 40;
+			[[fallthrough]];
+		case 5:
+			h ^= static_cast<uint64_t>(data[4]) << 32;
+			[[fallthrough]];
+		case 4:
+			h ^= static_cast<uint64_t>(data[3]) << 24;
+			[[fallthrough]];
+		case 3:
+			h ^= static_cast<uint64_t>(data[2]) << 16;
+			[[fallthrough]];
+		case 2:
+			h ^= static_cast<uint64_t>(data[1]) << 8;
+			[[fallthrough]];
+		case 1:
+			h ^= static_cast<uint64_t>(data[0]);
+			h *= m;
+			break;
+		default:
+			break;
+	}
+
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+inline uint64_t murmurhash64a(const std::string &data, uint64_t seed) {
+	return murmurhash64a(data.data(), data.size(), seed);
+}
+
+/**
+ * @brief The SplitMix64 finalizer: a cheap bijective mixer used to derive an independent hash from an existing one.
+ */
+inline uint64_t mix64(uint64_t x) {
+	x += 0x9e3779b97f4a7c15ULL;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+	return x ^ (x >> 31);
+}
+
+/**
+ * @brief CRC-64/Jones (reflected, polynomial 0xad93d23594c935a9), as used by Redis for RDB files and DUMP payloads.
+ * @param crc The CRC of the preceding data; 0 to start.
+ * @param data The data to add.
+ * @param len The length of the data in bytes.
+ * @return The CRC of all data so far.
+ */
+inline uint64_t crc64(uint64_t crc, const void *data, size_t len) {
+	struct table {
+		uint64_t entries[256];
+		table() : entries() {
+			for (uint64_t i = 0; i < 256; ++i) {
+				uint64_t c = i;
+				for (int bit = 0; bit < 8; ++bit) {
+					c = (c & 1) ? (c >> 1) ^ 0x95ac9329ac4bc9b5ULL : c >> 1;
+				}
+				entries[i] = c;
+			}
+		}
+	};
+	static const table t;
+	const auto *p = static_cast<const unsigned char *>(data);
+	for (size_t i = 0; i < len; ++i) {
+		crc = t.entries[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+	}
+	return crc;
+}
@@ -0,0 +1,302 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+#include "metrics.hpp"
+#include "observed_connection.hpp"
+
+/**
+ * @brief A key and a figure of it: estimated calls for hot keys, bytes for big keys.
+ */
+struct ranked_key {
+	std::string key;
+	uint64_t value{0};
+};
+
+/**
+ * @brief The traffic of the keys sharing a prefix, estimated from the sampled calls.
+ */
+struct prefix_traffic {
+	std::string prefix;
+	uint64_t calls{0};
+	uint64_t bytes_sent{0};
+	uint64_t bytes_received{0};
+};
+
+/**
+ * @brief What a hot_key_detector saw.
+ */
+struct hot_key_report {
+	/* The length of the window the hot and big keys were seen in */
+	std::chrono::milliseconds window{0};
+	/* The most called keys of the window, hottest first, with their estimated calls */
+	std::vector<ranked_key> hot;
+	/* The keys of the window that moved the most bytes in one call, largest first, with those bytes (key excluded) */
+	std::vector<ranked_key> big;
+	/* The traffic of each prefix since the detector was created, most called first */
+	std::vector<prefix_traffic> prefixes;
+};
+
+struct hot_key_options {
+	/* One call in sample_rate of each thread is looked at; estimates are scaled back */
+	uint32_t sample_rate = 8;
+	/* Keys kept in the hot and big key rankings */
+	size_t top_k = 20;
+	/* Counters per row, and rows, of the count-min sketch. An estimate exceeds the true count of a key by at most
+	 * 2/width of the window's sampled calls, with probability 1 - 2^-depth */
+	size_t sketch_width = 2048;
+	size_t sketch_depth = 4;
+	/* A key's prefix is what precedes the first delimiter: "user" for "user:42:cart". Keys without one share the
+	 * empty prefix */
+	char prefix_delimiter = ':';
+	/* Distinct prefixes tracked; the traffic of later prefixes is counted under "*" */
+	size_t max_prefixes = 256;
+	/* Length of a window: the rankings are reported and restarted when a sampled call finds it elapsed */
+	std::chrono::milliseconds window{10000};
+	/* Receives the hot_key_calls_max and big_key_bytes_max gauges at each report; may be null */
+	metrics_registry *registry = &metrics_registry::global();
+	/* Called with each report, by the thread whose call closed the window, outside of any lock */
+	std::function<void(const hot_key_report &)> on_report;
+};
+
+/**
+ * @brief A static observer finding the hot keys, big keys and the traffic by key prefix, as seen from this client:
+ * observed_connection<hot_key_detector>.
+ * * Each thread samples one call in sample_rate. A sampled call's key is counted in a count-min sketch, whose
+ * estimate ranks it in a top-K min-heap of the hottest keys; the bytes of the call rank the key among the biggest;
+ * and its prefix's totals grow. Unsampled calls cost a thread-local decrement; sampled calls a short lock.
+ *
+ * Rankings cover a window: when a sampled call finds the window elapsed, its report replaces the previous one (see
+ * report()), the gauges are set and on_report is called. Calls without a key, such as pipelines, are not counted.
+ *
+ * Copies of a hot_key_detector share the same state.
+ */
+class hot_key_detector {
+public:
+	/**
+	 * @throw std::invalid_argument If the sample rate, top_k, the sketch dimensions or the window are zero.
+	 */
+	explicit hot_key_detector(const hot_key_options &options = hot_key_options()) {
+		if (options.sample_rate == 0 || options.top_k == 0 || options.sketch_width == 0 || options.sketch_depth == 0
+			|| options.window.count() <= 0) {
+			throw std::invalid_argument("hot_key_detector: sample_rate, top_k, sketch and window must be positive");
+		}
+		state = std::make_shared<shared_state>(options);
+	}
+
+	void after_reply(const command_event &event) {
+		if (event.key.empty()) return;
+		uint32_t &countdown = sample_countdown();
+		// The countdown is shared by the detectors of a thread
+		const uint32_t every = state->options.sample_rate;
+		if (countdown > every) countdown = every;
+		if (countdown > 1) {
+			--countdown;
+			return;
+		}
+		countdown = every;
+
+		const uint64_t value_bytes = event.bytes_sent + event.bytes_received;
+		const auto now = std::chrono::steady_clock::now();
+		std::unique_lock<std::mutex> lock(state->mutex);
+		const bool closing = now - state->window_start >= state->options.window;
+		if (closing) state->close_window(now);
+		state->add(event.key, event.bytes_sent, event.bytes_received,
+				   value_bytes > event.key.size() ? value_bytes - event.key.size() : 0);
+		if (!closing) return;
+		const hot_key_report report = state->last;
+		lock.unlock();
+		publish(report);
+	}
+
+	/**
+	 * @brief Returns the report of the last complete window, with the current prefix totals.
+	 */
+	hot_key_report report() const {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		hot_key_report result = state->last;
+		result.prefixes = state->prefix_report();
+		return result;
+	}
+
+	/**
+	 * @brief Closes the current window now, e.g. before a shutdown, and returns its report.
+	 */
+	hot_key_report rotate() {
+		std::unique_lock<std::mutex> lock(state->mutex);
+		state->close_window(std::chrono::steady_clock::now());
+		const hot_key_report result = state->last;
+		lock.unlock();
+		publish(result);
+		return result;
+	}
+
+private:
+	/* A min-heap of the top_k keys by value, with the position of each key so a key already in it can move */
+	class top_keys {
+	public:
+		explicit top_keys(size_t capacity) : capacity(capacity) {
+		}
+
+		/* Ranks a key with a value, keeping the larger value of a key already ranked */
+		void offer(std::string_view key, uint64_t value) {
+			const auto it = positions.find(std::string(key));
+			if (it != positions.end()) {
+				if (value <= heap[it->second].value) return;
+				heap[it->second].value = value;
+				sift_down(it->second);
+				return;
+			}
+			if (heap.size() < capacity) {
+				heap.push_back({std::string(key), value});
+				positions[heap.back().key] = heap.size() - 1;
+				sift_up(heap.size() - 1);
+				return;
+			}
+			if (value <= heap[0].value) return;
+			positions.erase(heap[0].key);
+			heap[0] = {std::string(key), value};
+			positions[heap[0].key] = 0;
+			sift_down(0);
+		}
+
+		/* Empties the heap, returning its keys by decreasing value */
+		std::vector<ranked_key> take(uint64_t scale) {
+			std::vector<ranked_key> result = std::move(heap);
+			heap.clear();
+			positions.clear();
+			std::sort(result.begin(), result.end(), [](const ranked_key &a, const ranked_key &b) {
+				return a.value > b.value;
+			});
+			for (auto &r: result) {
+				r.value *= scale;
+			}
+			return result;
+		}
+
+	private:
+		const size_t capacity;
+		std::vector<ranked_key> heap;
+		std::unordered_map<std::string, size_t> positions;
+
+		void swap_entries(size_t a, size_t b) {
+			std::swap(heap[a], heap[b]);
+			positions[heap[a].key] = a;
+			positions[heap[b].key] = b;
+		}
+
+		void sift_up(size_t i) {
+			while (i > 0 && heap[i].value < heap[(i - 1) / 2].value) {
+				swap_entries(i, (i - 1) / 2);
+				i = (i - 1) / 2;
+			}
+		}
+
+		void sift_down(size_t i) {
+			for (;;) {
+				size_t smallest = i;
+				for (size_t child = 2 * i + 1; child <= 2 * i + 2 && child < heap.size(); ++child) {
+					if (heap[child].value < heap[smallest].value) smallest = child;
+				}
+				if (smallest == i) return;
+				swap_entries(i, smallest);
+				i = smallest;
+			}
+		}
+	};
+
+	struct shared_state {
+		explicit shared_state(const hot_key_options &options) :
+			options(options), sketch(options.sketch_width * options.sketch_depth, 0), hot(options.top_k),
+			big(options.top_k), window_start(std::chrono::steady_clock::now()) {
+		}
+
+		void add(std::string_view key, uint64_t sent, uint64_t received, uint64_t value_bytes) {
+			// Rows are indexed by h1 + row * h2 (Kirsch-Mitzenmacher)
+			const uint64_t h1 = murmurhash64a(key.data(), key.size(), 0);
+			const uint64_t h2 = mix64(h1) | 1;
+			uint32_t estimate = UINT32_MAX;
+			for (size_t row = 0; row < options.sketch_depth; ++row) {
+				uint32_t &counter = sketch[row * options.sketch_width + (h1 + row * h2) % options.sketch_width];
+				if (counter < UINT32_MAX) ++counter;
+				estimate = std::min(estimate, counter);
+			}
+			hot.offer(key, estimate);
+			big.offer(key, value_bytes);
+
+			const size_t delimiter = key.find(options.prefix_delimiter);
+			std::string prefix(key.substr(0, delimiter == std::string_view::npos ? 0 : delimiter));
+			auto it = prefixes.find(prefix);
+			if (it == prefixes.end()) {
+				if (prefixes.size() >= options.max_prefixes) prefix = "*";
+				it = prefixes.emplace(prefix, prefix_traffic{prefix, 0, 0, 0}).first;
+			}
+			it->second.calls += 1;
+			it->second.bytes_sent += sent;
+			it->second.bytes_received += received;
+		}
+
+		void close_window(std::chrono::steady_clock::time_point now) {
+			last.window = std::chrono::duration_cast<std::chrono::milliseconds>(now - window_start);
+			last.hot = hot.take(options.sample_rate);
+			last.big = big.take(1);
+			last.prefixes = prefix_report();
+			std::fill(sketch.begin(), sketch.end(), 0);
+			window_start = now;
+		}
+
+		std::vector<prefix_traffic> prefix_report() const {
+			std::vector<prefix_traffic> result;
+			result.reserve(prefixes.size());
+			for (const auto &entry: prefixes) {
+				prefix_traffic p = entry.second;
+				p.calls *= options.sample_rate;
+				p.bytes_sent *= options.sample_rate;
+				p.bytes_received *= options.sample_rate;
+				result.push_back(std::move(p));
+			}
+			std::sort(result.begin(), result.end(), [](const prefix_traffic &a, const prefix_traffic &b) {
+				return a.calls > b.calls;
+			});
+			return result;
+		}
+
+		const hot_key_options options;
+		std::mutex mutex;
+		std::vector<uint32_t> sketch;
+		top_keys hot;
+		top_keys big;
+		std::unordered_map<std::string, prefix_traffic> prefixes;
+		std::chrono::steady_clock::time_point window_start;
+		hot_key_report last;
+	};
+
+	std::shared_ptr<shared_state> state;
+
+	static uint32_t &sample_countdown() {
+		thread_local uint32_t countdown = 0;
+		return countdown;
+	}
+
+	void publish(const hot_key_report &report) const {
+		if (state->options.registry) {
+			state->options.registry->gauge("hot_key_calls_max")
+				.set(report.hot.empty() ? 0 : static_cast<int64_t>(report.hot.front().value));
+			state->options.registry->gauge("big_key_bytes_max")
+				.set(report.big.empty() ? 0 : static_cast<int64_t>(report.big.front().value));
+		}
+		if (state->options.on_report) state->options.on_report(report);
+	}
+};
@@ -0,0 +1,219 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "hash.hpp"
+
+/**
+ * @brief An in-process HyperLogLog with exactly the register layout of Redis' dense HLL encoding.
+ * * Elements are hashed like PFADD does (MurmurHash64A, seed 0xadc83b19, 14 index bits, 6-bit registers), so a sketch
+ * filled locally is bit-identical to a Redis key that received the same elements via PFADD. Many adds can therefore
+ * be aggregated in process and shipped with a single command: the raw representation (to_redis()) can be SET as a
+ * key or merged into an existing key with PFMERGE.
+ */
+class hll_sketch {
+public:
+	static constexpr int precision = 14;
+	static constexpr uint32_t register_count = 1U << precision;
+	static constexpr int register_bits = 6;
+	static constexpr uint8_t register_max = (1U << register_bits) - 1;
+	static constexpr size_t header_size = 16;
+	static constexpr size_t dense_size = header_size + (register_count * register_bits + 7) / 8;
+
+	hll_sketch() : raw(dense_size, '\0') {
+		raw[0] = 'H';
+		raw[1] = 'Y';
+		raw[2] = 'L';
+		raw[3] = 'L';
+		invalidate_cached_cardinality();
+	}
+
+	/**
+	 * @brief Builds a sketch from the value of a Redis HLL key (dense or sparse encoding).
+	 * @param data The raw string value as returned by GET; an empty string yields an empty sketch.
+	 * @throw std::runtime_error if the data is not a valid HLL.
+	 */
+	static hll_sketch from_redis(const std::string &data) {
+		hll_sketch sketch;
+		if (data.empty()) return sketch;
+		if (data.size() < header_size || data.compare(0, 4, "HYLL") != 0) {
+			throw std::runtime_error("hll_sketch: not a HyperLogLog value");
+		}
+
+		const auto encoding = static_cast<uint8_t>(data[4]);
+		if (encoding == 0) {
+			if (data.size() != dense_size) {
+				throw std::runtime_error("hll_sketch: invalid dense HyperLogLog size");
+			}
+			sketch.raw.replace(header_size, dense_size - header_size, data, header_size, dense_size - header_size);
+		}
+		else if (encoding == 1) {
+			// Sparse opcodes: ZERO 00xxxxxx, XZERO 01xxxxxx yyyyyyyy, VAL 1vvvvvxx
+			uint32_t index = 0;
+			for (size_t pos = header_size; pos < data.size(); ++pos) {
+				const auto op = static_cast<uint8_t>(data[pos]);
+				if ((op & 0xc0) == 0x00) {
+					index += (op & 0x3f) + 1;
+				}
+				else if ((op & 0xc0) == 0x40) {
+					if (++pos >= data.size()) throw std::runtime_error("hll_sketch: truncated sparse HyperLogLog");
+					index += (((op & 0x3f) << 8) | static_cast<uint8_t>(data[pos])) + 1;
+				}
+				else {
+					const uint8_t value = ((op >> 2) & 0x1f) + 1;
+					const uint32_t run = (op & 0x03) + 1;
+					if (index + run > register_count) throw std::runtime_error("hll_sketch: invalid sparse run");
+					for (uint32_t i = 0; i < run; ++i) {
+						sketch.set_register(index++, value);
+					}
+				}
+			}
+			if (index != register_count) {
+				throw std::runtime_error("hll_sketch: invalid sparse HyperLogLog length");
+			}
+		}
+		else {
+			throw std::runtime_error("hll_sketch: unsupported HyperLogLog encoding");
+		}
+		sketch.invalidate_cached_cardinality();
+		return sketch;
+	}
+
+	/**
+	 * @brief Adds an element.
+	 * @param element The element bytes; use the serialized form to match PFADD on the same values.
+	 * @return True if a register was updated (the estimate may have changed).
+	 */
+	bool add(const std::string &element) {
+		return add(element.data(), element.size());
+	}
+
+	bool add(const void *data, size_t len) {
+		uint64_t hash = murmurhash64a(data, len, 0xadc83b19ULL);
+		const auto index = static_cast<uint32_t>(hash & (register_count - 1));
+		hash >>= precision;
+		hash |= uint64_t{1} << (64 - precision);
+		uint8_t count = 1;
+		while ((hash & 1) == 0) {
+			++count;
+			hash >>= 1;
+		}
+
+		if (get_register(index) >= count) return false;
+		set_register(index, count);
+		invalidate_cached_cardinality();
+		return true;
+	}
+
+	/**
+	 * @brief Merges another sketch into this one (register-wise maximum, like PFMERGE).
+	 */
+	void merge(const hll_sketch &other) {
+		for (uint32_t i = 0; i < register_count; ++i) {
+			const uint8_t value = other.get_register(i);
+			if (value > get_register(i)) set_register(i, value);
+		}
+		invalidate_cached_cardinality();
+	}
+
+	/**
+	 * @brief Estimates the cardinality with the same estimator as PFCOUNT.
+	 */
+	[[nodiscard]] uint64_t count() const {
+		const int q = 64 - precision;
+		uint32_t histogram[64] = {};
+		for (uint32_t i = 0; i < register_count; ++i) {
+			++histogram[get_register(i)];
+		}
+
+		const double m = register_count;
+		double z = m * tau((m - histogram[q + 1]) / m);
+		for (int j = q; j >= 1; --j) {
+			z += histogram[j];
+			z *= 0.5;
+		}
+		z += m * sigma(histogram[0] / m);
+		return static_cast<uint64_t>(std::llround(0.721347520444481703680 * m * m / z));
+	}
+
+	/**
+	 * @brief Returns true if no element has been added.
+	 */
+	[[nodiscard]] bool empty() const {
+		for (size_t i = header_size; i < raw.size(); ++i) {
+			if (raw[i] != '\0') return false;
+		}
+		return true;
+	}
+
+	void clear() {
+		*this = hll_sketch();
+	}
+
+	/**
+	 * @brief Returns the dense Redis representation, ready to be written with SET.
+	 */
+	[[nodiscard]] const std::string &to_redis() const {
+		return raw;
+	}
+
+	[[nodiscard]] uint8_t get_register(uint32_t index) const {
+		const auto *p = reinterpret_cast<const unsigned char *>(raw.data() + header_size);
+		const uint32_t byte = index * register_bits / 8;
+		const uint32_t fb = index * register_bits & 7;
+		const uint32_t b0 = p[byte];
+		const uint32_t b1 = byte + 1 < raw.size() - header_size ? p[byte + 1] : 0;
+		return static_cast<uint8_t>(((b0 >> fb) | (b1 << (8 - fb))) & register_max);
+	}
+
+private:
+	void set_register(uint32_t index, uint8_t value) {
+		auto *p = reinterpret_cast<unsigned char *>(&raw[header_size]);
+		const uint32_t byte = index * register_bits / 8;
+		const uint32_t fb = index * register_bits & 7;
+		const uint32_t v = value;
+		p[byte] = static_cast<unsigned char>((p[byte] & ~(register_max << fb)) | (v << fb));
+		if (byte + 1 < raw.size() - header_size) {
+			p[byte + 1] =
+				static_cast<unsigned char>((p[byte + 1] & ~(register_max >> (8 - fb))) | (v >> (8 - fb)));
+		}
+	}
+
+	/* Marks the cached cardinality in the header as stale so Redis recomputes it on PFCOUNT */
+	void invalidate_cached_cardinality() {
+		raw[15] = static_cast<char>(static_cast<unsigned char>(raw[15]) | 0x80);
+	}
+
+	static double tau(double x) {
+		if (x == 0.0 || x == 1.0) return 0.0;
+		double z_prime;
+		double y = 1.0;
+		double z = 1 - x;
+		do {
+			x = std::sqrt(x);
+			z_prime = z;
+			y *= 0.5;
+			z -= std::pow(1 - x, 2) * y;
+		} while (z_prime != z);
+		return z / 3;
+	}
+
+	static double sigma(double x) {
+		if (x == 1.0) return INFINITY;
+		double z_prime;
+		double y = 1;
+		double z = x;
+		do {
+			x *= x;
+			z_prime = z;
+			z += x * y;
+			y += y;
+		} while (z_prime != z);
+		return z;
+	}
+
+	std::string raw;
+};
@@ -1,9 +1,41 @@
 #pragma once
 
+#include "bitfield.hpp"
+#include "bloom_filter.hpp"
+#include "bulk_loader.hpp"
+#include "command_table.hpp"
+#include "flight_recorder.hpp"
+#include "forwarding_connection.hpp"
+#include "hash.hpp"
+#include "hot_key_detector.hpp"
+#include "hyperloglog.hpp"
+#include "key_migrator.hpp"
 #include "kv_connection.hpp"
 #include "kv_template.hpp"
+#include "local_store_connection.hpp"
+#include "memory_analyzer.hpp"
+#include "memory_connection.hpp"
+#include "memory_types.hpp"
+#include "metered_connection.hpp"
+#include "metrics.hpp"
+#include "observed_connection.hpp"
+#include "openmetrics.hpp"
 #include "operations.hpp"
+#include "probes.hpp"
+#include "rdb_parser.hpp"
+#include "rate_limiter.hpp"
 #include "redis_connection.hpp"
 #include "redis_operations.hpp"
+#include "redis_subscriber.hpp"
 #include "redis_template.hpp"
+#include "replica_connection.hpp"
+#include "roaring.hpp"
+#include "scan_filter.hpp"
+#include "script.hpp"
 #include "serialization.hpp"
+#include "shm_cache.hpp"
+#include "skiplist.hpp"
+#include "stage_profiler.hpp"
+#include "tiered_connection.hpp"
+#include "timeseries.hpp"
+#include "zset_mirror.hpp"
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+#include "kv_connection.hpp"
+
+/**
+ * @brief Progress and error accounting of a migration.
+ */
+struct migration_stats {
+	/* Keys returned by SCAN (a key may be returned twice, as SCAN guarantees only that none is missed) */
+	uint64_t scanned{0};
+	/* Keys restored on the target */
+	uint64_t migrated{0};
+	/* Keys that were deleted or expired between SCAN and DUMP */
+	uint64_t vanished{0};
+	/* Keys left alone because they exist on the target and replace is off */
+	uint64_t skipped{0};
+	/* Keys whose DUMP or RESTORE failed with an error reply */
+	uint64_t errors{0};
+	/* DUMP payload bytes copied */
+	uint64_t bytes{0};
+	/* Sampled keys compared after the copy, and how many differed */
+	uint64_t verified{0};
+	uint64_t mismatches{0};
+	/* True once every cursor reached the end of its range */
+	bool completed{false};
+	std::chrono::milliseconds elapsed{0};
+	/* The first error replies and mismatching keys, for diagnosis */
+	std::vector<std::string> error_samples;
+};
+
+/**
+ * @brief Tuning knobs of a key_migrator.
+ */
+struct migration_options {
+	/* COUNT hint of each SCAN, which is also the number of keys copied per pipeline */
+	size_t scan_count{1000};
+	/* MATCH pattern of the SCAN; empty copies every key */
+	std::string match;
+	/* Parallel cursors per source; a power of two. Each scans a disjoint share of the source's hash table buckets.
+	 * Only for standalone servers: in cluster mode the cursor encodes the slot, so give one source per node instead */
+	size_t scan_splits{1};
+	/* RESTORE ... REPLACE; without it, keys that exist on the target are skipped */
+	bool replace{true};
+	/* Throughput limits over all workers; zero is unlimited */
+	double max_keys_per_second{0};
+	double max_bytes_per_second{0};
+	/* File where the cursors are saved, so an interrupted migration resumes where it stopped; empty disables */
+	std::string checkpoint_path;
+	/* Share of the keys (0 to 1) read back from the target with DUMP and compared to the source's payload, chosen by
+	 * key hash so a rerun samples the same keys. The comparison assumes both servers use the same encodings */
+	double verify_ratio{0.0};
+	/* Error messages kept in migration_stats::error_samples */
+	size_t error_samples{16};
+	/* Period of the checkpoint saves and of the progress callback */
+	std::chrono::milliseconds progress_interval{1000};
+	/* Called from the thread running run() */
+	std::function<void(const migration_stats &)> on_progress;
+};
+
+/**
+ * @brief Copies keys between servers with DUMP and RESTORE, which keeps each value's encoding and time to live and
+ * moves any type in one round trip per batch, instead of reading values type by type.
+ * * Each worker walks a SCAN cursor over its share of a source, fetches the batch with a pipeline of DUMP and PTTL,
+ * and writes it to the target with a pipeline of RESTORE. Workers run in parallel: one per source (the nodes of a
+ * cluster, or shards), times migration_options::scan_splits cursors per source. A SCAN cursor is a hash table bucket
+ * index walked in reverse-binary order, so splitting the reversed cursor space gives cursors that visit disjoint
+ * buckets; a key is still seen at least once, and a few may be seen twice across a split.
+ *
+ * A worker advances its cursor only after the batch was restored, and run() saves all cursors to the checkpoint
+ * file periodically and on exit, so a migration stopped with stop() or by a failure resumes without losing keys.
+ * Per-key error replies are counted; a failed connection stops the run.
+ */
+class key_migrator {
+public:
+	using connection_factory = std::function<std::shared_ptr<kv_connection>()>;
+
+	/**
+	 * @brief Constructor. Every worker opens its own connections with the factories.
+	 * @param sources One factory per source server (one per node of a cluster).
+	 * @param target The factory of target connections.
+	 * @param options The migration options.
+	 */
+	key_migrator(std::vector<connection_factory> sources, connection_factory target,
+				 const migration_options &options = migration_options()) :
+		sources(std::move(sources)), target(std::move(target)), options(options) {
+		const size_t splits = options.scan_splits;
+		if (this->sources.empty() || !this->target) throw std::invalid_argument("key_migrator: no source or target");
+		if (splits == 0 || (splits & (splits - 1)) != 0) {
+			throw std::invalid_argument("key_migrator: scan_splits must be a power of two");
+		}
+		for (size_t s = 0; s < this->sources.size(); ++s) {
+			for (size_t i = 0; i < splits; ++i) {
+				cursor_state state;
+				state.source = s;
+				// The reversed cursor space [lo, hi) of this split; the last split runs until the cursor wraps to 0
+				const uint64_t width = splits == 1 ? 0 : std::numeric_limits<uint64_t>::max() / splits + 1;
+				state.cursor = reverse_bits(width * i);
+				state.end = i + 1 == splits ? 0 : width * (i + 1);
+				cursors.push_back(state);
+			}
+		}
+	}
+
+	/**
+	 * @brief Runs the migration to the end, resuming from the checkpoint file when there is one.
+	 * @return The totals; completed is false if stop() interrupted the run.
+	 * @throw std::runtime_error if a connection failed (the checkpoint is saved first) or the checkpoint file does not
+	 * match the sources and splits.
+	 */
+	migration_stats run() {
+		load_checkpoint();
+		started = std::chrono::steady_clock::now();
+		stopping = false;
+		workers_exited = 0;
+		std::vector<std::thread> workers;
+		workers.reserve(cursors.size());
+		for (size_t i = 0; i < cursors.size(); ++i) {
+			workers.emplace_back([this, i] { work(i); });
+		}
+		{
+			std::unique_lock<std::mutex> lock(state_mutex);
+			while (workers_exited < cursors.size()) {
+				changed.wait_for(lock, options.progress_interval);
+				if (workers_exited == cursors.size()) break;
+				lock.unlock();
+				try {
+					save_checkpoint();
+				}
+				catch (const std::exception &e) {
+					fail(e.what());
+				}
+				report();
+				lock.lock();
+			}
+		}
+		for (auto &t: workers) {
+			t.join();
+		}
+		save_checkpoint();
+		const migration_stats s = report();
+		std::lock_guard<std::mutex> lock(state_mutex);
+		if (!failure.empty()) throw std::runtime_error("key_migrator: " + failure);
+		return s;
+	}
+
+	/**
+	 * @brief Asks a running migration to stop after the batches in progress; safe from any thread.
+	 */
+	void stop() {
+		stopping = true;
+		changed.notify_all();
+	}
+
+	migration_stats stats() const {
+		migration_stats s;
+		s.scanned = scanned.load();
+		s.migrated = migrated.load();
+		s.vanished = vanished.load();
+		s.skipped = skipped.load();
+		s.errors = errors.load();
+		s.bytes = bytes.load();
+		s.verified = verified.load();
+		s.mismatches = mismatches.load();
+		s.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		std::lock_guard<std::mutex> lock(state_mutex);
+		s.completed = std::all_of(cursors.begin(), cursors.end(), [](const cursor_state &c) { return c.done; });
+		s.error_samples = samples;
+		return s;
+	}
+
+private:
+	struct cursor_state {
+		size_t source{0};
+		uint64_t cursor{0};
+		/* Exclusive end of the range in reversed cursor space; 0 runs until the cursor wraps */
+		uint64_t end{0};
+		bool done{false};
+	};
+
+	// ==========================================================
+	// Workers
+	// ==========================================================
+
+	void work(size_t index) {
+		try {
+			cursor_state state;
+			{
+				std::lock_guard<std::mutex> lock(state_mutex);
+				state = cursors[index];
+			}
+			if (!state.done) {
+				const std::shared_ptr<kv_connection> source = sources[state.source]();
+				const std::shared_ptr<kv_connection> destination = target();
+				while (!state.done && !stopping) {
+					const uint64_t next = copy_batch(*source, *destination, state.cursor);
+					state.cursor = next;
+					state.done = next == 0 || (state.end != 0 && reverse_bits(next) >= state.end);
+					std::lock_guard<std::mutex> lock(state_mutex);
+					cursors[index] = state;
+				}
+			}
+		}
+		catch (const std::exception &e) {
+			fail(e.what());
+		}
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			++workers_exited;
+		}
+		changed.notify_all();
+	}
+
+	/* Stops every worker; the first failure is the one reported */
+	void fail(const std::string &reason) {
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			if (failure.empty()) failure = reason;
+		}
+		stop();
+	}
+
+	/**
+	 * @brief Scans one batch at a cursor and copies its keys.
+	 * @return The next cursor.
+	 */
+	uint64_t copy_batch(kv_connection &source, kv_connection &destination, uint64_t cursor) {
+		std::vector<std::string> scan{"SCAN", std::to_string(cursor), "COUNT", std::to_string(options.scan_count)};
+		if (!options.match.empty()) {
+			scan.emplace_back("MATCH");
+			scan.push_back(options.match);
+		}
+		const kv_reply page = source.pipeline({scan}).at(0);
+		if (page.is_error()) throw std::runtime_error("SCAN: " + page.str);
+		if (page.elements.size() != 2) throw std::runtime_error("SCAN: unexpected reply");
+		const uint64_t next = std::stoull(page.elements[0].str);
+		const std::vector<kv_reply> &keys = page.elements[1].elements;
+		scanned += keys.size();
+		if (keys.empty()) return next;
+
+		std::vector<std::vector<std::string>> reads;
+		reads.reserve(keys.size() * 2);
+		for (const auto &key: keys) {
+			reads.push_back({"DUMP", key.str});
+			reads.push_back({"PTTL", key.str});
+		}
+		const std::vector<kv_reply> dumps = source.pipeline(reads);
+
+		std::vector<std::vector<std::string>> restores;
+		uint64_t batch_bytes = 0;
+		for (size_t i = 0; i < keys.size(); ++i) {
+			const kv_reply &dump = dumps.at(2 * i);
+			const kv_reply &pttl = dumps.at(2 * i + 1);
+			if (dump.is_error() || pttl.is_error()) {
+				record_error(keys[i].str + ": " + (dump.is_error() ? dump.str : pttl.str));
+				continue;
+			}
+			// A PTTL of 0 is a key expiring now: RESTORE takes 0 as no expiry and would make it permanent
+			if (dump.is_nil() || pttl.integer == -2 || pttl.integer == 0) {
+				++vanished;
+				continue;
+			}
+			const long long ttl = std::max<long long>(pttl.integer, 0);
+			std::vector<std::string> restore{"RESTORE", keys[i].str, std::to_string(ttl), dump.str};
+			if (options.replace) restore.emplace_back("REPLACE");
+			restores.push_back(std::move(restore));
+			batch_bytes += dump.str.size();
+		}
+		if (restores.empty()) return next;
+
+		pace(restores.size(), batch_bytes);
+		const std::vector<kv_reply> replies = destination.pipeline(restores);
+		std::vector<size_t> sampled;
+		for (size_t j = 0; j < replies.size(); ++j) {
+			const std::string &key = restores[j][1];
+			if (!replies[j].is_error()) {
+				++migrated;
+				bytes += restores[j][3].size();
+				if (is_sampled(key)) sampled.push_back(j);
+			}
+			else if (replies[j].str.compare(0, 7, "BUSYKEY") == 0) {
+				++skipped;
+			}
+			else {
+				record_error(key + ": " + replies[j].str);
+			}
+		}
+		if (!sampled.empty()) verify(destination, restores, sampled);
+		return next;
+	}
+
+	/* Reads sampled keys back from the target and compares their payloads, leaving out the RDB version and CRC
+	 * trailer so servers of different versions compare equal when the value is */
+	void verify(kv_connection &destination, const std::vector<std::vector<std::string>> &restores,
+				const std::vector<size_t> &sampled) {
+		std::vector<std::vector<std::string>> reads;
+		reads.reserve(sampled.size());
+		for (size_t j: sampled) {
+			reads.push_back({"DUMP", restores[j][1]});
+		}
+		const std::vector<kv_reply> copies = destination.pipeline(reads);
+		for (size_t k = 0; k < sampled.size(); ++k) {
+			const std::string &expected = restores[sampled[k]][3];
+			const std::string &actual = copies.at(k).str;
+			++verified;
+			const size_t body = expected.size() >= 10 ? expected.size() - 10 : expected.size();
+			const bool same = actual.size() == expected.size() && actual.compare(0, body, expected, 0, body) == 0;
+			if (copies[k].is_error() || !same) {
+				++mismatches;
+				record_sample("mismatch: " + restores[sampled[k]][1]);
+			}
+		}
+	}
+
+	bool is_sampled(const std::string &key) const {
+		if (options.verify_ratio <= 0) return false;
+		if (options.verify_ratio >= 1) return true;
+		const auto threshold = static_cast<uint64_t>(options.verify_ratio * 18446744073709551616.0);
+		return murmurhash64a(key, 0) < threshold;
+	}
+
+	/**
+	 * @brief Waits until the throughput limits allow a batch. Batches reserve consecutive time slots, so the workers
+	 * together stay under the limits.
+	 */
+	void pace(uint64_t keys, uint64_t payload) {
+		double seconds = 0;
+		if (options.max_keys_per_second > 0) seconds = static_cast<double>(keys) / options.max_keys_per_second;
+		if (options.max_bytes_per_second > 0) {
+			seconds = std::max(seconds, static_cast<double>(payload) / options.max_bytes_per_second);
+		}
+		if (seconds <= 0) return;
+		const auto cost = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+			std::chrono::duration<double>(seconds));
+		std::chrono::steady_clock::time_point slot;
+		{
+			std::lock_guard<std::mutex> lock(pace_mutex);
+			slot = std::max(next_slot, std::chrono::steady_clock::now());
+			next_slot = slot + cost;
+		}
+		std::this_thread::sleep_until(slot);
+	}
+
+	void record_error(const std::string &message) {
+		++errors;
+		record_sample(message);
+	}
+
+	void record_sample(const std::string &message) {
+		std::lock_guard<std::mutex> lock(state_mutex);
+		if (samples.size() < options.error_samples) samples.push_back(message);
+	}
+
+	// ==========================================================
+	// Checkpoints
+	// ==========================================================
+
+	/**
+	 * @brief Restores the cursors of a previous run. The file has a header line with the number of sources and
+	 * splits, then one line per cursor: the cursor and whether its range is done.
+	 */
+	void load_checkpoint() {
+		if (options.checkpoint_path.empty()) return;
+		std::ifstream in(options.checkpoint_path);
+		if (!in) return;
+		std::string magic;
+		size_t source_count = 0;
+		size_t splits = 0;
+		in >> magic >> source_count >> splits;
+		if (magic != "janus-migration" || source_count != sources.size() || splits != options.scan_splits) {
+			throw std::runtime_error("key_migrator: checkpoint " + options.checkpoint_path
+									 + " belongs to a migration with other sources or splits");
+		}
+		std::lock_guard<std::mutex> lock(state_mutex);
+		for (auto &c: cursors) {
+			int done = 0;
+			if (!(in >> c.cursor >> done)) throw std::runtime_error("key_migrator: truncated checkpoint");
+			c.done = done != 0;
+		}
+	}
+
+	void save_checkpoint() {
+		if (options.checkpoint_path.empty()) return;
+		std::string text = "janus-migration " + std::to_string(sources.size()) + " "
+						   + std::to_string(options.scan_splits) + "\n";
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			for (const auto &c: cursors) {
+				text += std::to_string(c.cursor) + " " + (c.done ? "1" : "0") + "\n";
+			}
+		}
+		// Written aside and renamed over the previous one, so a crash leaves either file whole
+		const std::string temporary = options.checkpoint_path + ".tmp";
+		{
+			std::ofstream out(temporary, std::ios::trunc);
+			out << text;
+			if (!out.flush()) throw std::runtime_error("key_migrator: cannot write " + temporary);
+		}
+		if (std::rename(temporary.c_str(), options.checkpoint_path.c_str()) != 0) {
+			throw std::runtime_error("key_migrator: cannot replace " + options.checkpoint_path);
+		}
+	}
+
+	migration_stats report() {
+		migration_stats s = stats();
+		if (options.on_progress) options.on_progress(s);
+		return s;
+	}
+
+	static uint64_t reverse_bits(uint64_t v) {
+		uint64_t r = 0;
+		for (int i = 0; i < 64; ++i) {
+			r = (r << 1) | ((v >> i) & 1);
+		}
+		return r;
+	}
+
+	const std::vector<connection_factory> sources;
+	const connection_factory target;
+	const migration_options options;
+
+	/* Guards cursors, workers_exited, failure and samples */
+	mutable std::mutex state_mutex;
+	std::condition_variable changed;
+	std::vector<cursor_state> cursors;
+	size_t workers_exited{0};
+	std::string failure;
+	std::vector<std::string> samples;
+	std::atomic<bool> stopping{false};
+	std::chrono::steady_clock::time_point started;
+
+	std::mutex pace_mutex;
+	std::chrono::steady_clock::time_point next_slot;
+
+	std::atomic<uint64_t> scanned{0};
+	std::atomic<uint64_t> migrated{0};
+	std::atomic<uint64_t> vanished{0};
+	std::atomic<uint64_t> skipped{0};
+	std::atomic<uint64_t> errors{0};
+	std::atomic<uint64_t> bytes{0};
+	std::atomic<uint64_t> verified{0};
+	std::atomic<uint64_t> mismatches{0};
+};
@@ -1,9 +1,30 @@
 #pragma once
 
 #include <optional>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
+/**
+ * @brief A generic, backend-neutral reply for commands whose reply shape is only known at call time (e.g. scripts).
+ */
+struct kv_reply {
+	enum class reply_type { nil, integer, string, status, error, array };
+
+	reply_type type{reply_type::nil};
+	long long integer{0};
+	std::string str;
+	std::vector<kv_reply> elements;
+
+	[[nodiscard]] bool is_nil() const {
+		return type == reply_type::nil;
+	}
+
+	[[nodiscard]] bool is_error() const {
+		return type == reply_type::error;
+	}
+};
+
 class kv_connection {
 public:
 	virtual ~kv_connection() = default;
@@ -62,6 +83,13 @@ public:
 
 	virtual long long append(const std::string &key, const std::string &value) = 0;
 
+	/**
+	 * @brief Returns the substring of a string value between two byte offsets (inclusive).
+	 * @return The substring; empty if the key does not exist or the range is out of bounds.
+	 * @note Corresponds to Redis GETRANGE
+	 */
+	virtual std::string getrange(const std::string &key, long long start, long long end) = 0;
+
 	// ============================================================================
 	// For Hash
 	// ============================================================================
@@ -289,4 +317,158 @@ public:
 	 * @return The new score of the member.
 	 */
 	virtual double zincrby(const std::string &key, double increment, const std::string &member) = 0;
+
+	/**
+	 * @brief Returns the members and scores of a sorted set with a score between min and max (inclusive), ordered from
+	 * lowest to highest score.
+	 * @param key The sorted set key.
+	 * @param min The minimum score (-infinity for no lower bound).
+	 * @param max The maximum score (+infinity for no upper bound).
+	 * @return A vector of (member, score) pairs, maintaining order.
+	 * @note Corresponds to Redis ZRANGEBYSCORE ... WITHSCORES.
+	 */
+	virtual std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																				 double max) = 0;
+
+	/**
+	 * @brief Removes all members of a sorted set with a score between min and max (inclusive).
+	 * @param key The sorted set key.
+	 * @param min The minimum score (-infinity for no lower bound).
+	 * @param max The maximum score (+infinity for no upper bound).
+	 * @return The number of members removed.
+	 * @note Corresponds to Redis ZREMRANGEBYSCORE.
+	 */
+	virtual long long zremrangebyscore(const std::string &key, double min, double max) = 0;
+
+	// ============================================================================
+	// For HyperLogLog
+	// ============================================================================
+
+	/**
+	 * @brief Adds elements to a HyperLogLog.
+	 * @param key The HyperLogLog key.
+	 * @param elements The elements to add.
+	 * @return True if at least one internal register was altered.
+	 * @note Corresponds to Redis PFADD.
+	 */
+	virtual bool pfadd(const std::string &key, const std::vector<std::string> &elements) = 0;
+
+	/**
+	 * @brief Returns the approximated cardinality of the union of one or more HyperLogLogs.
+	 * @param keys The HyperLogLog keys.
+	 * @return The approximated number of unique elements; 0 if no key exists.
+	 * @note Corresponds to Redis PFCOUNT.
+	 */
+	virtual long long pfcount(const std::vector<std::string> &keys) = 0;
+
+	/**
+	 * @brief Merges HyperLogLogs into a destination key (which is included in the union if it exists).
+	 * @param dest The destination key.
+	 * @param sources The source keys.
+	 * @return True on success.
+	 * @note Corresponds to Redis PFMERGE.
+	 */
+	virtual bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) = 0;
+
+	// ============================================================================
+	// For Bitmap
+	// ============================================================================
+
+	/**
+	 * @brief Sets or clears the bit at an offset of a string.
+	 * @param key The string key.
+	 * @param offset The bit offset (0 is the most significant bit of the first byte).
+	 * @param value The new bit value.
+	 * @return The previous bit value.
+	 * @note Corresponds to Redis SETBIT.
+	 */
+	virtual bool setbit(const std::string &key, long long offset, bool value) = 0;
+
+	/**
+	 * @brief Returns the bit at an offset of a string.
+	 * @param key The string key.
+	 * @param offset The bit offset.
+	 * @return The bit value; false if the key does not exist or the offset is beyond the string.
+	 * @note Corresponds to Redis GETBIT.
+	 */
+	virtual bool getbit(const std::string &key, long long offset) = 0;
+
+	/**
+	 * @brief Counts the set bits of a string within a byte range.
+	 * @param key The string key.
+	 * @param start The first byte (negative values count from the end).
+	 * @param end The last byte, inclusive (-1 is the last byte).
+	 * @return The number of bits set to 1.
+	 * @note Corresponds to Redis BITCOUNT.
+	 */
+	virtual long long bitcount(const std::string &key, long long start, long long end) = 0;
+
+	/**
+	 * @brief Returns the position of the first bit set to the given value within a byte range.
+	 * @param key The string key.
+	 * @param bit The bit value to look for.
+	 * @param start The first byte (negative values count from the end).
+	 * @param end The last byte, inclusive (-1 is the last byte).
+	 * @return The bit position, or -1 if not found.
+	 * @note Corresponds to Redis BITPOS.
+	 */
+	virtual long long bitpos(const std::string &key, bool bit, long long start, long long end) = 0;
+
+	/**
+	 * @brief Performs a bitwise operation between strings and stores the result.
+	 * @param op The operation: "AND", "OR", "XOR" or "NOT" (NOT takes exactly one source).
+	 * @param dest The destination key.
+	 * @param keys The source keys.
+	 * @return The length of the resulting string in bytes.
+	 * @note Corresponds to Redis BITOP.
+	 */
+	virtual long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) = 0;
+
+	/**
+	 * @brief Executes several bit field sub-operations on a string in one command.
+	 * @param key The string key.
+	 * @param args The sub-operations, e.g. {"GET", "u1", "100", "SET", "u8", "#2", "255", "OVERFLOW", "SAT", ...}.
+	 * @return One result per GET/SET/INCRBY sub-operation, in order; std::nullopt where INCRBY failed with OVERFLOW
+	 * FAIL.
+	 * @note Corresponds to Redis BITFIELD.
+	 */
+	virtual std::vector<std::optional<long long>> bitfield(const std::string &key,
+														   const std::vector<std::string> &args) = 0;
+
+	// ============================================================================
+	// For Scripting
+	// ============================================================================
+
+	/**
+	 * @brief Loads a Lua script into the server script cache without executing it.
+	 * @param script The Lua source code.
+	 * @return The SHA1 digest under which the script is cached.
+	 * @note Corresponds to Redis SCRIPT LOAD.
+	 */
+	virtual std::string script_load(const std::string &script) = 0;
+
+	/**
+	 * @brief Executes a previously loaded Lua script by its SHA1 digest.
+	 * @param sha1 The SHA1 digest returned by script_load().
+	 * @param keys The key names accessed by the script (KEYS[]).
+	 * @param args The additional arguments (ARGV[]).
+	 * @return The script reply converted to a kv_reply.
+	 * @throw std::runtime_error if the script is not cached ("NOSCRIPT") or fails.
+	 * @note Corresponds to Redis EVALSHA.
+	 */
+	virtual kv_reply evalsha(const std::string &sha1, const std::vector<std::string> &keys,
+							 const std::vector<std::string> &args) = 0;
+
+	// ============================================================================
+	// For Pipelining
+	// ============================================================================
+
+	/**
+	 * @brief Sends several commands at once and then reads all replies, paying a single round trip.
+	 * @param commands The commands, each given as its argument vector (e.g. {"SETBIT", "key", "7", "1"}).
+	 * @return One reply per command, in order. Command errors are returned as error replies instead of being thrown,
+	 * so one failed command does not hide the replies of the others.
+	 * @throw std::runtime_error on connection errors.
+	 */
+	virtual std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) = 0;
 };
@@ -16,6 +16,18 @@ class zset_operations;
 template<typename K, typename V>
 class hash_operations;
 
+template<typename K, typename V>
+class filter_operations;
+
+template<typename K, typename V>
+class hll_operations;
+
+template<typename K, typename V>
+class bitmap_operations;
+
+template<typename K, typename V>
+class roaring_operations;
+
 /**
  * @brief Abstract interface that strictly mimics the Spring Data RedisTemplate.
  * * This class acts as a Facade providing access points to all Redis data structure
@@ -65,4 +77,28 @@ public:
 	 * @return A non-null reference to ZSetOperations<K, V> interface. The object is managed by the template.
 	 */
 	virtual zset_operations<K, V> &ops_for_zset() = 0;
+
+	/**
+	 * @brief Returns the FilterOperations interface (server-side filtered scans of Hash, List and Set types).
+	 * @return A non-null reference to FilterOperations<K, V> interface. The object is managed by the template.
+	 */
+	virtual filter_operations<K, V> &ops_for_filter() = 0;
+
+	/**
+	 * @brief Returns the HllOperations interface (Redis HyperLogLog type).
+	 * @return A non-null reference to HllOperations<K, V> interface. The object is managed by the template.
+	 */
+	virtual hll_operations<K, V> &ops_for_hll() = 0;
+
+	/**
+	 * @brief Returns the BitmapOperations interface (Redis bitmaps and bit fields on the String type).
+	 * @return A non-null reference to BitmapOperations<K, V> interface. The object is managed by the template.
+	 */
+	virtual bitmap_operations<K, V> &ops_for_bitmap() = 0;
+
+	/**
+	 * @brief Returns the RoaringOperations interface (compressed integer bitmaps chunked across String keys).
+	 * @return A non-null reference to RoaringOperations<K, V> interface. The object is managed by the template.
+	 */
+	virtual roaring_operations<K, V> &ops_for_roaring() = 0;
 };
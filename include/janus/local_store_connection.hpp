@@ -0,0 +1,716 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "hash.hpp"
+#include "memory_connection.hpp"
+
+/**
+ * @brief When appended log records reach the disk (the equivalent of Redis' appendfsync).
+ */
+enum class log_sync {
+	/* Leave flushing to the operating system */
+	none,
+	/* Write and fsync from the background thread every sync_interval; a crash loses at most that window */
+	periodic,
+	/* Write and fsync before every write command returns */
+	always
+};
+
+/**
+ * @brief Tuning knobs of a local_store_connection.
+ */
+struct local_store_options {
+	/* Settings of the in-memory keyspace */
+	memory_connection_options memory;
+	log_sync sync{log_sync::periodic};
+	/* Period of the background thread that flushes the log and checks whether to compact */
+	std::chrono::milliseconds sync_interval{1000};
+	/* Buffered log bytes that trigger a write even before the next background flush */
+	size_t write_buffer{64 * 1024};
+	/* The log is compacted once it is at least this large... */
+	uint64_t compaction_min_size{64ULL * 1024 * 1024};
+	/* ...and at least this fraction of it is overwritten or deleted records */
+	double compaction_ratio{0.5};
+	/* Threads used to rebuild the index at startup; 0 uses the hardware concurrency */
+	unsigned recovery_threads{0};
+};
+
+/**
+ * @brief A persistent kv_connection for nodes that must survive restarts without a Redis server.
+ * * The keyspace lives in memory (it is a memory_connection, with the same types, TTLs and raw command support), and
+ * every write appends the new value of the changed key to an append-only log, in the manner of Bitcask: each record
+ * holds a key, its type, its absolute expiry and its complete encoded value (or a tombstone). An in-memory hash index
+ * maps each key to its latest record, which tells how much of the log is garbage.
+ *
+ * At startup the log is memory-mapped and replayed in parallel: record boundaries are found by a header walk, then
+ * worker threads verify checksums and keep the latest record of each key, and finally decode the winning records
+ * into the keyspace. A record with a bad checksum marks the end of the log (a write torn by a crash); it and
+ * anything after it are truncated. Once the garbage exceeds compaction_ratio, the log is rewritten from the live
+ * keyspace into a new file that atomically replaces the old one.
+ *
+ * Log format (integers little-endian): a 16 byte header "JANUSKV1" + 8 reserved bytes, then records of
+ * [u64 checksum][u32 key length][u32 value length][i64 expire_at ms][u8 type][key][value], where the checksum is
+ * MurmurHash64A of everything after it.
+ *
+ * @note Collections are rewritten as a whole on every change, so very large hashes, lists, sets or sorted sets make
+ * writes proportionally expensive; the store is meant for many small values.
+ */
+class local_store_connection: public memory_connection {
+public:
+	/**
+	 * @brief Opens (or creates) a store and loads its log.
+	 * @param path The log file.
+	 * @param options The store options.
+	 * @throw std::runtime_error if the file cannot be opened or is not a store log.
+	 */
+	explicit local_store_connection(const std::string &path,
+									const local_store_options &options = local_store_options()) :
+		memory_connection(options.memory), path(path), store_options(options) {
+		recover();
+		observe_writes(true);
+		if (options.sync_interval.count() > 0) {
+			maintenance_thread = std::thread([this] { maintenance_loop(); });
+		}
+	}
+
+	~local_store_connection() override {
+		{
+			std::lock_guard<std::mutex> lock(maintenance_mutex);
+			stopping = true;
+		}
+		maintenance_cv.notify_all();
+		if (maintenance_thread.joinable()) maintenance_thread.join();
+		try {
+			std::lock_guard<std::mutex> lock(log_mutex);
+			flush_locked(true);
+		}
+		catch (const std::exception &) {
+			// Nothing sensible is left to do with a failed write while closing
+		}
+		if (fd >= 0) ::close(fd);
+	}
+
+	/**
+	 * @brief Writes buffered records and fsyncs the log.
+	 * @throw std::runtime_error on I/O errors.
+	 */
+	void sync() {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		flush_locked(true);
+	}
+
+	/**
+	 * @brief Rewrites the log with only the live keys. Writers wait while the new log is written; readers do not.
+	 * @throw std::runtime_error on I/O errors (the old log is then kept).
+	 */
+	void compact() {
+		auto locks = lock_all<read_lock>();
+		std::lock_guard<std::mutex> lock(log_mutex);
+		flush_locked(true);
+
+		const std::string tmp_path = path + ".compact";
+		const int tmp = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if (tmp < 0) throw_errno("open " + tmp_path);
+
+		std::unordered_map<std::string, log_location> new_index;
+		std::string buffer(header, sizeof(header));
+		uint64_t offset = sizeof(header);
+		try {
+			for_each_entry([&](const std::string &key, const memory_value &value, int64_t expire_at) {
+				const size_t size = append_record(buffer, key, &value, expire_at);
+				new_index[key] = {offset, static_cast<uint32_t>(size)};
+				offset += size;
+				if (buffer.size() >= store_options.write_buffer) {
+					write_all(tmp, buffer);
+					buffer.clear();
+				}
+			});
+			write_all(tmp, buffer);
+			if (::fsync(tmp) != 0) throw_errno("fsync " + tmp_path);
+		}
+		catch (...) {
+			::close(tmp);
+			::unlink(tmp_path.c_str());
+			throw;
+		}
+
+		if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+			::close(tmp);
+			throw_errno("rename " + tmp_path);
+		}
+		sync_directory();
+		::close(tmp);
+		::close(fd);
+		fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+		if (fd < 0) throw_errno("open " + path);
+
+		index = std::move(new_index);
+		log_size = offset;
+		live_size = offset - sizeof(header);
+	}
+
+	/**
+	 * @brief Returns the size of the log in bytes, including records not yet written out.
+	 */
+	uint64_t get_log_size() const {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		return log_size;
+	}
+
+	/**
+	 * @brief Returns the size of the latest records of the live keys, i.e. what a compaction would keep.
+	 */
+	uint64_t get_live_size() const {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		return live_size;
+	}
+
+	/**
+	 * @brief Returns whether writing the log failed, in which case the store only serves reads from then on.
+	 */
+	bool is_read_only() const {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		return !failure.empty();
+	}
+
+protected:
+	/* Once the log failed, writes are refused before they change the keyspace */
+	void before_write() override {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		// failure already names the class and the failed call
+		if (!failure.empty()) throw std::runtime_error(failure + " (the store is read-only)");
+	}
+
+	/*
+	 * A failed write of the log is recorded in failure instead of thrown, since the change is already visible; the
+	 * writes that passed before_write() before the failure stay unlogged, like the unsynced tail lost by a crash.
+	 */
+	void on_write(const std::string &key, const memory_value *value, int64_t expire_at) override {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		if (!failure.empty()) return;
+
+		auto it = index.find(key);
+		// A key that was never logged needs no tombstone
+		if (!value && it == index.end()) return;
+		const size_t size = append_record(pending, key, value, expire_at);
+		if (it != index.end()) {
+			live_size -= it->second.size;
+			if (value) {
+				it->second = {log_size, static_cast<uint32_t>(size)};
+			}
+			else {
+				index.erase(it);
+			}
+		}
+		else if (value) {
+			index.emplace(key, log_location{log_size, static_cast<uint32_t>(size)});
+		}
+		if (value) live_size += size;
+		log_size += size;
+
+		try {
+			if (store_options.sync == log_sync::always) {
+				flush_locked(true);
+			}
+			else if (pending.size() >= store_options.write_buffer) {
+				flush_locked(false);
+			}
+		}
+		catch (const std::runtime_error &) {
+			// Recorded in failure by flush_locked(): later writes are refused
+		}
+	}
+
+	void on_flush() override {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		if (!failure.empty()) return;
+		log_size += append_record(pending, std::string(), nullptr, 0, flush_type);
+		index.clear();
+		live_size = 0;
+		try {
+			flush_locked(store_options.sync == log_sync::always);
+		}
+		catch (const std::runtime_error &) {
+			// Recorded in failure by flush_locked(): later writes are refused
+		}
+	}
+
+private:
+	static constexpr char header[16] = {'J', 'A', 'N', 'U', 'S', 'K', 'V', '1', 0, 0, 0, 0, 0, 0, 0, 0};
+	static constexpr size_t record_header_size = 8 + 4 + 4 + 8 + 1;
+	static constexpr uint64_t checksum_seed = 0x6a616e75736b7631ULL;
+	static constexpr uint8_t tombstone_type = 0xfe;
+	static constexpr uint8_t flush_type = 0xff;
+
+	struct log_location {
+		uint64_t offset;
+		uint32_t size;
+	};
+
+	/* A record found by the startup scan */
+	struct scanned_record {
+		uint64_t offset;
+		uint32_t size;
+	};
+
+	// ---------------------------------------------------------------------------
+	// Encoding
+	// ---------------------------------------------------------------------------
+
+	static void put_u32(std::string &out, uint32_t v) {
+		for (int i = 0; i < 4; ++i) {
+			out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+		}
+	}
+
+	static void put_u64(std::string &out, uint64_t v) {
+		for (int i = 0; i < 8; ++i) {
+			out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+		}
+	}
+
+	static void put_bytes(std::string &out, const std::string &s) {
+		put_u32(out, static_cast<uint32_t>(s.size()));
+		out.append(s);
+	}
+
+	static uint32_t get_u32(const unsigned char *p) {
+		uint32_t v = 0;
+		for (int i = 3; i >= 0; --i) {
+			v = (v << 8) | p[i];
+		}
+		return v;
+	}
+
+	static uint64_t get_u64(const unsigned char *p) {
+		uint64_t v = 0;
+		for (int i = 7; i >= 0; --i) {
+			v = (v << 8) | p[i];
+		}
+		return v;
+	}
+
+	static void encode_value(std::string &out, const memory_value &value) {
+		switch (value.index()) {
+			case 0:
+				out.append(std::get<std::string>(value));
+				break;
+			case 1: {
+				const auto &h = std::get<compact_hash>(value);
+				put_u32(out, static_cast<uint32_t>(h.size()));
+				h.for_each([&out](const std::string &f, const std::string &v) {
+					put_bytes(out, f);
+					put_bytes(out, v);
+				});
+				break;
+			}
+			case 2: {
+				const auto &l = std::get<std::deque<std::string>>(value);
+				put_u32(out, static_cast<uint32_t>(l.size()));
+				for (const auto &e: l) {
+					put_bytes(out, e);
+				}
+				break;
+			}
+			case 3: {
+				const auto &s = std::get<compact_set>(value);
+				put_u32(out, static_cast<uint32_t>(s.size()));
+				s.for_each([&out](const std::string &m) { put_bytes(out, m); });
+				break;
+			}
+			default: {
+				const auto &z = std::get<compact_zset>(value);
+				put_u32(out, static_cast<uint32_t>(z.size()));
+				z.for_each([&out](const std::string &m, double score) {
+					uint64_t bits;
+					std::memcpy(&bits, &score, sizeof(bits));
+					put_u64(out, bits);
+					put_bytes(out, m);
+				});
+				break;
+			}
+		}
+	}
+
+	/* Appends one record to out and returns its size */
+	static size_t append_record(std::string &out, const std::string &key, const memory_value *value, int64_t expire_at,
+								uint8_t type = 0) {
+		const size_t start = out.size();
+		put_u64(out, 0);
+		put_u32(out, static_cast<uint32_t>(key.size()));
+		put_u32(out, 0);
+		put_u64(out, static_cast<uint64_t>(expire_at));
+		if (type != flush_type) type = value ? static_cast<uint8_t>(value->index()) : tombstone_type;
+		out.push_back(static_cast<char>(type));
+		out.append(key);
+		if (value) encode_value(out, *value);
+
+		const size_t value_size = out.size() - start - record_header_size - key.size();
+		for (int i = 0; i < 4; ++i) {
+			out[start + 12 + i] = static_cast<char>((value_size >> (8 * i)) & 0xff);
+		}
+		const uint64_t checksum = murmurhash64a(out.data() + start + 8, out.size() - start - 8, checksum_seed);
+		for (int i = 0; i < 8; ++i) {
+			out[start + i] = static_cast<char>((checksum >> (8 * i)) & 0xff);
+		}
+		return out.size() - start;
+	}
+
+	/* Bounds-checked reader of an encoded value */
+	struct value_reader {
+		const unsigned char *p;
+		const unsigned char *end;
+
+		void need(size_t n) const {
+			if (static_cast<size_t>(end - p) < n) throw std::runtime_error("local_store_connection: corrupt record");
+		}
+
+		uint32_t u32() {
+			need(4);
+			const uint32_t v = get_u32(p);
+			p += 4;
+			return v;
+		}
+
+		uint64_t u64() {
+			need(8);
+			const uint64_t v = get_u64(p);
+			p += 8;
+			return v;
+		}
+
+		std::string bytes() {
+			const uint32_t n = u32();
+			need(n);
+			std::string s(reinterpret_cast<const char *>(p), n);
+			p += n;
+			return s;
+		}
+	};
+
+	memory_value decode_value(uint8_t type, const unsigned char *data, size_t size) const {
+		const compact_limits &limits = get_options().limits;
+		value_reader in{data, data + size};
+		switch (type) {
+			case 0:
+				return memory_value(std::string(reinterpret_cast<const char *>(data), size));
+			case 1: {
+				compact_hash h(limits);
+				for (uint32_t n = in.u32(); n > 0; --n) {
+					std::string field = in.bytes();
+					h.set(field, in.bytes());
+				}
+				return memory_value(std::move(h));
+			}
+			case 2: {
+				std::deque<std::string> l;
+				for (uint32_t n = in.u32(); n > 0; --n) {
+					l.push_back(in.bytes());
+				}
+				return memory_value(std::move(l));
+			}
+			case 3: {
+				compact_set s(limits);
+				for (uint32_t n = in.u32(); n > 0; --n) {
+					s.add(in.bytes());
+				}
+				return memory_value(std::move(s));
+			}
+			case 4: {
+				compact_zset z(limits);
+				for (uint32_t n = in.u32(); n > 0; --n) {
+					const uint64_t bits = in.u64();
+					double score;
+					std::memcpy(&score, &bits, sizeof(score));
+					z.add(in.bytes(), score);
+				}
+				return memory_value(std::move(z));
+			}
+			default:
+				throw std::runtime_error("local_store_connection: unknown record type");
+		}
+	}
+
+	// ---------------------------------------------------------------------------
+	// Recovery
+	// ---------------------------------------------------------------------------
+
+	void recover() {
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (fd < 0) throw_errno("open " + path);
+		struct stat st {};
+		if (::fstat(fd, &st) != 0) throw_errno("fstat " + path);
+		auto size = static_cast<uint64_t>(st.st_size);
+
+		if (size == 0) {
+			write_all(fd, std::string(header, sizeof(header)));
+			size = sizeof(header);
+		}
+		else {
+			void *map = size < sizeof(header) ? MAP_FAILED : ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map == MAP_FAILED || std::memcmp(map, header, 8) != 0) {
+				if (map != MAP_FAILED) ::munmap(map, size);
+				::close(fd);
+				fd = -1;
+				throw std::runtime_error("local_store_connection: " + path + " is not a store log");
+			}
+			::madvise(map, size, MADV_WILLNEED);
+			uint64_t end;
+			try {
+				end = load(static_cast<const unsigned char *>(map), size);
+			}
+			catch (...) {
+				::munmap(map, size);
+				::close(fd);
+				fd = -1;
+				throw;
+			}
+			::munmap(map, size);
+			if (end != size) {
+				// Drop the torn tail of an interrupted write
+				if (::ftruncate(fd, static_cast<off_t>(end)) != 0) throw_errno("ftruncate " + path);
+				size = end;
+			}
+		}
+		::close(fd);
+		fd = ::open(path.c_str(), O_WRONLY | O_APPEND);
+		if (fd < 0) throw_errno("open " + path);
+		log_size = size;
+	}
+
+	/* Rebuilds the keyspace and the index from a mapped log; returns the end of the valid prefix */
+	uint64_t load(const unsigned char *base, uint64_t size) {
+		// 1. Header walk: record boundaries only, no checksums
+		std::vector<scanned_record> records;
+		uint64_t offset = sizeof(header);
+		while (size - offset >= record_header_size) {
+			const uint64_t length = record_header_size + static_cast<uint64_t>(get_u32(base + offset + 8))
+								  + get_u32(base + offset + 12);
+			if (length > size - offset || length > UINT32_MAX) break;
+			records.push_back({offset, static_cast<uint32_t>(length)});
+			offset += length;
+		}
+
+		unsigned threads = store_options.recovery_threads;
+		if (threads == 0) threads = std::max(1U, std::thread::hardware_concurrency());
+		threads = static_cast<unsigned>(std::min<size_t>(threads, std::max<size_t>(1, records.size() / 1024)));
+		const size_t partitions = threads;
+
+		// 2. Verify checksums and keep the latest record of each key, partitioned by key hash so merging is parallel
+		using latest_map = std::unordered_map<std::string_view, size_t>;
+		std::vector<std::vector<latest_map>> latest(threads, std::vector<latest_map>(partitions));
+		std::vector<size_t> first_bad(threads, records.size());
+		std::vector<std::vector<size_t>> flushes(threads);
+		const size_t chunk = (records.size() + threads - 1) / threads;
+		run_parallel(threads, [&](unsigned t) {
+			const size_t from = t * chunk;
+			const size_t to = std::min(records.size(), from + chunk);
+			for (size_t i = from; i < to; ++i) {
+				const unsigned char *r = base + records[i].offset;
+				if (get_u64(r) != murmurhash64a(r + 8, records[i].size - 8, checksum_seed)) {
+					first_bad[t] = i;
+					return;
+				}
+				if (r[24] == flush_type) {
+					flushes[t].push_back(i);
+					continue;
+				}
+				std::string_view key(reinterpret_cast<const char *>(r + record_header_size), get_u32(r + 8));
+				latest[t][partition_of(key, partitions)][key] = i;
+			}
+		});
+
+		// Records before the last FLUSHALL are dead, and so is everything from the first corrupt record on
+		const size_t valid = *std::min_element(first_bad.begin(), first_bad.end());
+		size_t keep_from = 0;
+		for (const auto &f: flushes) {
+			for (size_t i: f) {
+				if (i < valid) keep_from = std::max(keep_from, i + 1);
+			}
+		}
+
+		// 3. Merge each partition across threads (later chunks win) and decode the winners into the keyspace
+		std::vector<std::unordered_map<std::string, log_location>> part_index(partitions);
+		std::vector<uint64_t> part_live(partitions, 0);
+		const int64_t now = now_ms();
+		run_parallel(static_cast<unsigned>(partitions), [&](unsigned p) {
+			latest_map winners;
+			for (unsigned t = 0; t < threads; ++t) {
+				for (const auto &kv: latest[t][p]) {
+					if (kv.second >= valid || kv.second < keep_from) continue;
+					auto &slot = winners[kv.first];
+					slot = std::max(slot, kv.second + 1);
+				}
+			}
+			for (const auto &kv: winners) {
+				const scanned_record &rec = records[kv.second - 1];
+				const unsigned char *r = base + rec.offset;
+				const uint8_t type = r[24];
+				const auto expire_at = static_cast<int64_t>(get_u64(r + 16));
+				if (type == tombstone_type || (expire_at != 0 && expire_at <= now)) continue;
+				const uint32_t key_size = get_u32(r + 8);
+				restore(std::string(kv.first),
+						decode_value(type, r + record_header_size + key_size, get_u32(r + 12)), expire_at);
+				part_index[p].emplace(std::string(kv.first), log_location{rec.offset, rec.size});
+				part_live[p] += rec.size;
+			}
+		});
+
+		for (size_t p = 0; p < partitions; ++p) {
+			live_size += part_live[p];
+			index.merge(part_index[p]);
+		}
+		return valid < records.size() ? records[valid].offset : offset;
+	}
+
+	static size_t partition_of(std::string_view key, size_t partitions) {
+		return static_cast<size_t>(murmurhash64a(key.data(), key.size(), 0)) % partitions;
+	}
+
+	template<typename F>
+	static void run_parallel(unsigned count, F &&f) {
+		if (count <= 1) {
+			f(0U);
+			return;
+		}
+		std::vector<std::thread> workers;
+		std::vector<std::exception_ptr> errors(count);
+		for (unsigned i = 0; i < count; ++i) {
+			workers.emplace_back([&, i] {
+				try {
+					f(i);
+				}
+				catch (...) {
+					errors[i] = std::current_exception();
+				}
+			});
+		}
+		for (auto &w: workers) {
+			w.join();
+		}
+		for (auto &e: errors) {
+			if (e) std::rethrow_exception(e);
+		}
+	}
+
+	// ---------------------------------------------------------------------------
+	// Writing
+	// ---------------------------------------------------------------------------
+
+	[[noreturn]] static void throw_errno(const std::string &what) {
+		throw std::runtime_error("local_store_connection: " + what + ": " + std::strerror(errno));
+	}
+
+	static void write_all(int file, const std::string &data) {
+		size_t done = 0;
+		while (done < data.size()) {
+			const ssize_t n = ::write(file, data.data() + done, data.size() - done);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				throw_errno("write");
+			}
+			done += static_cast<size_t>(n);
+		}
+	}
+
+	/* Writes the buffered records, optionally followed by an fsync; the caller holds log_mutex */
+	void flush_locked(bool durable) {
+		try {
+			if (!pending.empty()) {
+				write_all(fd, pending);
+				pending.clear();
+				unsynced = true;
+			}
+			if (durable && unsynced) {
+#if defined(__linux__)
+				if (::fdatasync(fd) != 0) throw_errno("fdatasync " + path);
+#else
+				if (::fsync(fd) != 0) throw_errno("fsync " + path);
+#endif
+				unsynced = false;
+			}
+		}
+		catch (const std::runtime_error &e) {
+			// Later writes fail too: the log no longer matches the keyspace
+			failure = e.what();
+			throw;
+		}
+	}
+
+	void sync_directory() const {
+		std::string dir = std::filesystem::path(path).parent_path().string();
+		if (dir.empty()) dir = ".";
+		const int dfd = ::open(dir.c_str(), O_RDONLY);
+		if (dfd < 0) return;
+		::fsync(dfd);
+		::close(dfd);
+	}
+
+	bool should_compact() const {
+		std::lock_guard<std::mutex> lock(log_mutex);
+		const auto garbage = static_cast<double>(log_size - live_size);
+		return log_size >= store_options.compaction_min_size
+			&& garbage >= store_options.compaction_ratio * static_cast<double>(log_size);
+	}
+
+	void maintenance_loop() {
+		std::unique_lock<std::mutex> lock(maintenance_mutex);
+		while (!stopping) {
+			maintenance_cv.wait_for(lock, store_options.sync_interval, [this] { return stopping; });
+			if (stopping) break;
+			lock.unlock();
+			try {
+				{
+					std::lock_guard<std::mutex> log_lock(log_mutex);
+					flush_locked(store_options.sync != log_sync::none);
+				}
+				if (should_compact()) compact();
+			}
+			catch (const std::exception &) {
+				// Recorded in failure by flush_locked(); a failed compaction keeps the old log
+			}
+			lock.lock();
+		}
+	}
+
+	std::string path;
+	local_store_options store_options;
+	int fd{-1};
+
+	mutable std::mutex log_mutex;
+	std::string pending;
+	bool unsynced{false};
+	std::string failure;
+	std::unordered_map<std::string, log_location> index;
+	uint64_t log_size{0};
+	uint64_t live_size{0};
+
+	std::mutex maintenance_mutex;
+	std::condition_variable maintenance_cv;
+	bool stopping{false};
+	std::thread maintenance_thread;
+};
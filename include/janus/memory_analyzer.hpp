@@ -0,0 +1,400 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+#include "kv_connection.hpp"
+
+/**
+ * @brief The server's limits for the compact encodings, as in redis.conf.
+ */
+struct encoding_thresholds {
+	uint64_t hash_max_listpack_entries{128};
+	uint64_t hash_max_listpack_value{64};
+	uint64_t zset_max_listpack_entries{128};
+	uint64_t zset_max_listpack_value{64};
+	uint64_t set_max_listpack_entries{128};
+	uint64_t set_max_listpack_value{64};
+	uint64_t set_max_intset_entries{512};
+};
+
+/**
+ * @brief Keys and bytes of one type and encoding, e.g. "hash listpack".
+ */
+struct encoding_usage {
+	uint64_t keys{0};
+	uint64_t bytes{0};
+};
+
+/**
+ * @brief The memory of the analyzed keys sharing a prefix.
+ */
+struct prefix_memory {
+	std::string prefix;
+	uint64_t keys{0};
+	/* MEMORY USAGE of the keys, overhead included */
+	uint64_t bytes{0};
+	std::string biggest_key;
+	uint64_t biggest_bytes{0};
+	/* By "<type> <encoding>" */
+	std::map<std::string, encoding_usage> encodings;
+};
+
+/**
+ * @brief A key stored in a full encoding (hashtable, skiplist) that a compact one would hold with a small change.
+ */
+struct near_threshold_key {
+	std::string key;
+	std::string type;
+	std::string encoding;
+	/* Fields, members or elements */
+	uint64_t length{0};
+	uint64_t bytes{0};
+	/* The threshold it crossed, e.g. "hash-max-listpack-entries 128" */
+	std::string reason;
+};
+
+/**
+ * @brief The result of a memory_analyzer run. Figures cover the analyzed keys: multiply by scanned / analyzed to
+ * estimate the whole keyspace.
+ */
+struct memory_analysis {
+	/* Keys returned by SCAN, and how many of them were analyzed */
+	uint64_t scanned{0};
+	uint64_t analyzed{0};
+	/* Keys deleted between SCAN and their queries, and keys whose queries failed */
+	uint64_t vanished{0};
+	uint64_t errors{0};
+	uint64_t bytes{0};
+	/* Largest first */
+	std::vector<prefix_memory> prefixes;
+	/* By "<type> <encoding>" */
+	std::map<std::string, encoding_usage> encodings;
+	/* Largest first */
+	std::vector<near_threshold_key> near_thresholds;
+	encoding_thresholds thresholds;
+	/* False if stop() or max_keys ended the scan early */
+	bool completed{false};
+	std::chrono::milliseconds elapsed{0};
+	/* The first error replies, for diagnosis */
+	std::vector<std::string> error_samples;
+};
+
+/**
+ * @brief Tuning knobs of a memory_analyzer.
+ */
+struct memory_analysis_options {
+	/* COUNT hint of each SCAN, which is also the number of keys queried per pipeline */
+	size_t scan_count{1000};
+	/* MATCH pattern of the SCAN; empty analyzes every key */
+	std::string match;
+	/* Share of the scanned keys analyzed, chosen by key hash */
+	double sample_ratio{1.0};
+	/* Stops after this many scanned keys; 0 scans the whole keyspace */
+	uint64_t max_keys{0};
+	/* SAMPLES of MEMORY USAGE: nested values sampled to estimate an aggregate's size; 0 counts them all */
+	size_t memory_samples{5};
+	/* A key's prefix is its first prefix_depth fields, separated by the delimiter: "user:profile" for
+	 * "user:profile:42" with depth 2. Keys with fewer fields are their own prefix */
+	char prefix_delimiter{':'};
+	size_t prefix_depth{1};
+	/* Maps a key to its prefix instead, e.g. following the key schema of an application's templates */
+	std::function<std::string(const std::string &)> prefix_of;
+	/* Reads the thresholds with CONFIG GET; they keep their defaults where it fails */
+	bool read_config{true};
+	encoding_thresholds thresholds;
+	/* A full-encoded key counts as just above a threshold up to this share above it */
+	double near_ratio{0.25};
+	/* Keys kept in near_thresholds */
+	size_t max_near_keys{100};
+	/* Distinct prefixes tracked; later prefixes are counted under "*" */
+	size_t max_prefixes{10000};
+};
+
+/**
+ * @brief Measures where a server's memory goes, by key prefix and by encoding, to plan capacity and to find keys that
+ * a compact encoding (listpack, intset) would store in a fraction of their memory.
+ * * The keyspace is walked with SCAN. For each batch of keys, one pipeline queries TYPE, MEMORY USAGE and OBJECT
+ * ENCODING, and a second one the length of each aggregate (HLEN, ZCARD, ...). Hashes, sorted sets and sets kept in
+ * their full encoding with a length just above the entries threshold, or below it (so a field or member longer than
+ * the value threshold converted them), are reported as near_thresholds: raising the threshold, shortening the value
+ * or bucketing the key into smaller keys would shrink them.
+ *
+ * Run one analyzer per node of a cluster.
+ */
+class memory_analyzer {
+public:
+	/**
+	 * @throw std::invalid_argument If the connection is null, or the ratios or counts are out of range.
+	 */
+	explicit memory_analyzer(std::shared_ptr<kv_connection> connection,
+							 const memory_analysis_options &options = memory_analysis_options()) :
+		connection(std::move(connection)), options(options) {
+		if (!this->connection) throw std::invalid_argument("memory_analyzer: no connection");
+		if (options.scan_count == 0 || options.prefix_depth == 0) {
+			throw std::invalid_argument("memory_analyzer: scan_count and prefix_depth must be positive");
+		}
+		if (options.sample_ratio <= 0 || options.sample_ratio > 1) {
+			throw std::invalid_argument("memory_analyzer: sample_ratio must be in (0, 1]");
+		}
+	}
+
+	/**
+	 * @brief Scans the keyspace to the end, or until max_keys or stop().
+	 * @throw std::runtime_error If SCAN fails or the connection throws.
+	 */
+	memory_analysis run() {
+		const auto started = std::chrono::steady_clock::now();
+		stopping = false;
+		result = memory_analysis();
+		result.thresholds = options.read_config ? read_thresholds() : options.thresholds;
+		prefixes.clear();
+
+		uint64_t cursor = 0;
+		do {
+			cursor = analyze_batch(cursor);
+		} while (cursor != 0 && !stopping && (options.max_keys == 0 || result.scanned < options.max_keys));
+		result.completed = cursor == 0;
+
+		result.prefixes.reserve(prefixes.size());
+		for (auto &entry: prefixes) {
+			result.prefixes.push_back(std::move(entry.second));
+		}
+		prefixes.clear();
+		std::sort(result.prefixes.begin(), result.prefixes.end(), [](const prefix_memory &a, const prefix_memory &b) {
+			return a.bytes > b.bytes;
+		});
+		std::sort(result.near_thresholds.begin(), result.near_thresholds.end(),
+				  [](const near_threshold_key &a, const near_threshold_key &b) { return a.bytes > b.bytes; });
+		result.elapsed =
+			std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started);
+		return std::move(result);
+	}
+
+	/**
+	 * @brief Asks a running analysis to stop after the batch in progress; safe from any thread.
+	 */
+	void stop() {
+		stopping = true;
+	}
+
+	/**
+	 * @brief The prefix of a key under the options.
+	 */
+	std::string prefix_of(const std::string &key) const {
+		if (options.prefix_of) return options.prefix_of(key);
+		size_t end = 0;
+		for (size_t field = 0; field < options.prefix_depth; ++field) {
+			end = key.find(options.prefix_delimiter, field == 0 ? 0 : end + 1);
+			if (end == std::string::npos) return key;
+		}
+		return key.substr(0, end);
+	}
+
+private:
+	std::shared_ptr<kv_connection> connection;
+	const memory_analysis_options options;
+	std::atomic<bool> stopping{false};
+	memory_analysis result;
+	std::unordered_map<std::string, prefix_memory> prefixes;
+
+	static constexpr size_t max_error_samples = 10;
+
+	encoding_thresholds read_thresholds() {
+		encoding_thresholds t = options.thresholds;
+		const std::vector<std::pair<const char *, uint64_t *>> parameters{
+			{"hash-max-listpack-entries", &t.hash_max_listpack_entries},
+			{"hash-max-listpack-value", &t.hash_max_listpack_value},
+			{"zset-max-listpack-entries", &t.zset_max_listpack_entries},
+			{"zset-max-listpack-value", &t.zset_max_listpack_value},
+			{"set-max-listpack-entries", &t.set_max_listpack_entries},
+			{"set-max-listpack-value", &t.set_max_listpack_value},
+			{"set-max-intset-entries", &t.set_max_intset_entries}};
+		std::vector<std::vector<std::string>> commands;
+		for (const auto &p: parameters) {
+			commands.push_back({"CONFIG", "GET", p.first});
+		}
+		const std::vector<kv_reply> replies = connection->pipeline(commands);
+		for (size_t i = 0; i < parameters.size() && i < replies.size(); ++i) {
+			// An array of name and value; empty for parameters the server does not know
+			const kv_reply &r = replies[i];
+			if (r.is_error() || r.elements.size() != 2) continue;
+			try {
+				*parameters[i].second = std::stoull(r.elements[1].str);
+			}
+			catch (const std::exception &) {
+			}
+		}
+		return t;
+	}
+
+	bool is_sampled(const std::string &key) const {
+		if (options.sample_ratio >= 1) return true;
+		const auto threshold = static_cast<uint64_t>(options.sample_ratio * 18446744073709551616.0);
+		return murmurhash64a(key, 0) < threshold;
+	}
+
+	/**
+	 * @brief Scans one batch at a cursor and analyzes its keys.
+	 * @return The next cursor.
+	 */
+	uint64_t analyze_batch(uint64_t cursor) {
+		std::vector<std::string> scan{"SCAN", std::to_string(cursor), "COUNT", std::to_string(options.scan_count)};
+		if (!options.match.empty()) {
+			scan.emplace_back("MATCH");
+			scan.push_back(options.match);
+		}
+		const kv_reply page = connection->pipeline({scan}).at(0);
+		if (page.is_error()) throw std::runtime_error("memory_analyzer: SCAN: " + page.str);
+		if (page.elements.size() != 2) throw std::runtime_error("memory_analyzer: SCAN: unexpected reply");
+		const uint64_t next = std::stoull(page.elements[0].str);
+		std::vector<std::string> keys;
+		for (const auto &key: page.elements[1].elements) {
+			++result.scanned;
+			if (is_sampled(key.str)) keys.push_back(key.str);
+		}
+		if (keys.empty()) return next;
+
+		std::vector<std::vector<std::string>> queries;
+		queries.reserve(keys.size() * 3);
+		for (const auto &key: keys) {
+			queries.push_back({"TYPE", key});
+			queries.push_back({"MEMORY", "USAGE", key, "SAMPLES", std::to_string(options.memory_samples)});
+			queries.push_back({"OBJECT", "ENCODING", key});
+		}
+		const std::vector<kv_reply> replies = connection->pipeline(queries);
+
+		std::vector<size_t> present;
+		std::vector<std::vector<std::string>> lengths;
+		for (size_t i = 0; i < keys.size(); ++i) {
+			const kv_reply &type = replies.at(3 * i);
+			const kv_reply &usage = replies.at(3 * i + 1);
+			const kv_reply &encoding = replies.at(3 * i + 2);
+			const kv_reply *failed = type.is_error() ? &type : usage.is_error() ? &usage : &encoding;
+			if (failed->is_error()) {
+				record_error(keys[i] + ": " + failed->str);
+				continue;
+			}
+			if (type.str == "none" || usage.is_nil() || encoding.is_nil()) {
+				++result.vanished;
+				continue;
+			}
+			present.push_back(i);
+			lengths.push_back({length_command(type.str), keys[i]});
+		}
+		if (present.empty()) return next;
+		const std::vector<kv_reply> counted = connection->pipeline(lengths);
+
+		for (size_t j = 0; j < present.size(); ++j) {
+			const size_t i = present[j];
+			const kv_reply &length = counted.at(j);
+			if (length.is_error()) {
+				record_error(keys[i] + ": " + length.str);
+				continue;
+			}
+			add(keys[i], replies[3 * i].str, replies[3 * i + 2].str, static_cast<uint64_t>(replies[3 * i + 1].integer),
+				static_cast<uint64_t>(std::max(length.integer, 0LL)));
+		}
+		return next;
+	}
+
+	static std::string length_command(const std::string &type) {
+		if (type == "string") return "STRLEN";
+		if (type == "list") return "LLEN";
+		if (type == "hash") return "HLEN";
+		if (type == "set") return "SCARD";
+		if (type == "zset") return "ZCARD";
+		if (type == "stream") return "XLEN";
+		// Module types: any command answering 1 for an existing key
+		return "EXISTS";
+	}
+
+	void add(const std::string &key, const std::string &type, const std::string &encoding, uint64_t bytes,
+			 uint64_t length) {
+		++result.analyzed;
+		result.bytes += bytes;
+		const std::string kind = type + " " + encoding;
+		encoding_usage &total = result.encodings[kind];
+		++total.keys;
+		total.bytes += bytes;
+
+		std::string prefix = prefix_of(key);
+		auto it = prefixes.find(prefix);
+		if (it == prefixes.end()) {
+			if (prefixes.size() >= options.max_prefixes) prefix = "*";
+			it = prefixes.emplace(prefix, prefix_memory()).first;
+			it->second.prefix = prefix;
+		}
+		prefix_memory &p = it->second;
+		++p.keys;
+		p.bytes += bytes;
+		if (bytes > p.biggest_bytes) {
+			p.biggest_bytes = bytes;
+			p.biggest_key = key;
+		}
+		encoding_usage &usage = p.encodings[kind];
+		++usage.keys;
+		usage.bytes += bytes;
+
+		check_threshold(key, type, encoding, bytes, length);
+	}
+
+	void check_threshold(const std::string &key, const std::string &type, const std::string &encoding,
+						 uint64_t bytes, uint64_t length) {
+		const encoding_thresholds &t = result.thresholds;
+		uint64_t entries;
+		uint64_t value;
+		if (type == "hash" && encoding == "hashtable") {
+			entries = t.hash_max_listpack_entries;
+			value = t.hash_max_listpack_value;
+		}
+		else if (type == "zset" && encoding == "skiplist") {
+			entries = t.zset_max_listpack_entries;
+			value = t.zset_max_listpack_value;
+		}
+		else if (type == "set" && encoding == "hashtable") {
+			entries = t.set_max_listpack_entries;
+			value = t.set_max_listpack_value;
+		}
+		else {
+			return;
+		}
+		std::string reason;
+		if (length <= entries) {
+			reason = type + "-max-listpack-value " + std::to_string(value);
+		}
+		else if (static_cast<double>(length) <= static_cast<double>(entries) * (1.0 + options.near_ratio)) {
+			reason = type + "-max-listpack-entries " + std::to_string(entries);
+		}
+		else {
+			return;
+		}
+		auto &near = result.near_thresholds;
+		near_threshold_key found{key, type, encoding, length, bytes, std::move(reason)};
+		if (near.size() < options.max_near_keys) {
+			near.push_back(std::move(found));
+			return;
+		}
+		// Keep the largest: replace the smallest kept when this one is larger
+		auto smallest = std::min_element(near.begin(), near.end(), [](const auto &a, const auto &b) {
+			return a.bytes < b.bytes;
+		});
+		if (smallest != near.end() && smallest->bytes < bytes) *smallest = std::move(found);
+	}
+
+	void record_error(const std::string &message) {
+		++result.errors;
+		if (result.error_samples.size() < max_error_samples) result.error_samples.push_back(message);
+	}
+};
@@ -0,0 +1,2324 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <charconv>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "hash.hpp"
+#include "hyperloglog.hpp"
+#include "kv_connection.hpp"
+#include "memory_types.hpp"
+
+/**
+ * @brief Tuning knobs of a memory_connection.
+ */
+struct memory_connection_options {
+	/* Number of independently locked shards of the keyspace; rounded up to a power of two */
+	size_t shards{64};
+	/* Period of the background expiry cycle; zero disables the thread, keys then only expire lazily on access */
+	std::chrono::milliseconds active_expire_interval{100};
+	/* Maximum number of keys expired per shard in one cycle, to bound how long a shard stays locked */
+	size_t active_expire_batch{256};
+	/* Size limits of the compact hash, set and sorted set encodings */
+	compact_limits limits;
+};
+
+/**
+ * @brief An in-process key-value store implementing kv_connection, so a redis_template can run without a Redis server
+ * (tests, embedded use, a local tier in front of Redis).
+ * * The keyspace is split into shards selected by key hash, each guarded by its own reader-writer lock, so
+ * independent keys are accessed concurrently from several threads. Values use the Redis data types with compact
+ * encodings for small collections (see memory_types.hpp) and a skiplist for large sorted sets. Keys with a time to
+ * live expire lazily when accessed and actively from a background thread that drains the per-shard expiry index.
+ *
+ * pipeline() accepts raw commands, including MULTI/EXEC/DISCARD and WATCH/UNWATCH: a transaction runs with all shards
+ * locked, so it is atomic with respect to other threads. Transaction state is kept per calling thread, the way a
+ * Redis connection keeps it per client.
+ *
+ * @note Lua scripting is not available: script_load() and evalsha() throw, so helpers built on lua_script
+ * (rate_limiter, timeseries, zset_mirror) need a real Redis connection.
+ */
+class memory_connection: public kv_connection {
+public:
+	explicit memory_connection(const memory_connection_options &options = memory_connection_options()) :
+		options(options) {
+		size_t count = 1;
+		while (count < options.shards) {
+			count <<= 1;
+		}
+		shards.reserve(count);
+		for (size_t i = 0; i < count; ++i) {
+			shards.push_back(std::make_unique<shard>());
+		}
+		if (options.active_expire_interval.count() > 0) {
+			expire_thread = std::thread([this] { active_expire_loop(); });
+		}
+	}
+
+	~memory_connection() override {
+		{
+			std::lock_guard<std::mutex> lock(expire_mutex);
+			stopping = true;
+		}
+		expire_cv.notify_all();
+		if (expire_thread.joinable()) expire_thread.join();
+	}
+
+	memory_connection(const memory_connection &) = delete;
+	memory_connection &operator=(const memory_connection &) = delete;
+
+	// ============================================================================
+	// For Keys
+	// ============================================================================
+
+	bool exists(const std::string &key) override {
+		auto lock = lock_shard<read_lock>(key);
+		return find_live(key, now_ms()) != nullptr;
+	}
+
+	bool expire(const std::string &key, int seconds) override {
+		return expire_at(key, now_ms() + static_cast<int64_t>(seconds) * 1000);
+	}
+
+	bool pexpire(const std::string &key, int milliseconds) override {
+		return expire_at(key, now_ms() + milliseconds);
+	}
+
+	/**
+	 * @brief Sets the absolute expiry time of a key; a time in the past deletes the key.
+	 * @param key The key.
+	 * @param when_ms The expiry time in milliseconds since the Unix epoch.
+	 * @return True if the key exists.
+	 * @note Corresponds to Redis PEXPIREAT.
+	 */
+	bool expire_at(const std::string &key, int64_t when_ms) {
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		shard &s = shard_for(key);
+		auto it = find_for_write(s, key, now);
+		if (it == s.data.end()) return false;
+		if (when_ms <= now) {
+			erase_entry(s, it);
+			return true;
+		}
+		set_expiry(s, it, when_ms);
+		touch(it->second);
+		return true;
+	}
+
+	/**
+	 * @brief Removes the expiry of a key.
+	 * @return True if the key existed and had an expiry.
+	 * @note Corresponds to Redis PERSIST.
+	 */
+	bool persist(const std::string &key) {
+		write_scope scope(*this, key);
+		shard &s = shard_for(key);
+		auto it = find_for_write(s, key, now_ms());
+		if (it == s.data.end() || it->second.expire_at == 0) return false;
+		set_expiry(s, it, 0);
+		touch(it->second);
+		return true;
+	}
+
+	long long del(const std::string &key) override {
+		return del(std::vector<std::string>{key});
+	}
+
+	long long del(const std::vector<std::string> &keys) override {
+		write_scope scope(*this, keys);
+		const int64_t now = now_ms();
+		long long removed = 0;
+		for (const auto &key: keys) {
+			shard &s = shard_for(key);
+			auto it = find_for_write(s, key, now);
+			if (it == s.data.end()) continue;
+			erase_entry(s, it);
+			++removed;
+		}
+		return removed;
+	}
+
+	int64_t ttl(const std::string &key) override {
+		const int64_t ms = pttl(key);
+		return ms < 0 ? ms : (ms + 500) / 1000;
+	}
+
+	int64_t pttl(const std::string &key) override {
+		auto lock = lock_shard<read_lock>(key);
+		const int64_t now = now_ms();
+		const entry *e = find_live(key, now);
+		if (!e) return -2;
+		if (e->expire_at == 0) return -1;
+		return e->expire_at - now;
+	}
+
+	/**
+	 * @brief Returns the type name of the value stored at a key ("string", "hash", "list", "set", "zset" or "none").
+	 * @note Corresponds to Redis TYPE.
+	 */
+	std::string type(const std::string &key) {
+		auto lock = lock_shard<read_lock>(key);
+		const entry *e = find_live(key, now_ms());
+		return e ? memory_type_name(e->value) : "none";
+	}
+
+	/**
+	 * @brief Returns the number of keys, including expired keys that have not been purged yet.
+	 * @note Corresponds to Redis DBSIZE.
+	 */
+	size_t dbsize() const {
+		size_t total = 0;
+		for (const auto &s: shards) {
+			auto lock = lock_one<read_lock>(*s);
+			total += s->data.size();
+		}
+		return total;
+	}
+
+	/**
+	 * @brief Removes all keys.
+	 * @note Corresponds to Redis FLUSHALL.
+	 */
+	void flushall() {
+		auto locks = lock_all<write_lock>();
+		if (observed) before_write();
+		for (auto &s: shards) {
+			s->data.clear();
+			s->expires.clear();
+		}
+		version_counter.fetch_add(1, std::memory_order_relaxed);
+		if (observed) on_flush();
+	}
+
+	/**
+	 * @brief Deletes expired keys, like one cycle of the Redis active expiry.
+	 * @param limit_per_shard The maximum number of keys removed from each shard.
+	 * @return The number of removed keys.
+	 */
+	size_t purge_expired(size_t limit_per_shard = SIZE_MAX) {
+		const int64_t now = now_ms();
+		size_t removed = 0;
+		for (auto &s: shards) {
+			auto lock = lock_one<write_lock>(*s);
+			size_t n = 0;
+			while (!s->expires.empty() && s->expires.begin()->first <= now && n < limit_per_shard) {
+				if (observed) on_write(s->expires.begin()->second, nullptr, 0);
+				s->data.erase(s->expires.begin()->second);
+				s->expires.erase(s->expires.begin());
+				++n;
+			}
+			removed += n;
+		}
+		return removed;
+	}
+
+	// ============================================================================
+	// For String
+	// ============================================================================
+
+	bool set(const std::string &key, const std::string &value) override {
+		return set_string(key, value, set_condition::always, 0, false, nullptr);
+	}
+
+	bool set_not_exists(const std::string &key, const std::string &value) override {
+		return set_string(key, value, set_condition::not_exists, 0, false, nullptr);
+	}
+
+	bool set_ex(const std::string &key, const std::string &value, int seconds) override {
+		if (seconds <= 0) throw std::runtime_error("ERR invalid expire time in 'setex' command");
+		return set_string(key, value, set_condition::always, now_ms() + static_cast<int64_t>(seconds) * 1000, false,
+						  nullptr);
+	}
+
+	bool set_px(const std::string &key, const std::string &value, int milliseconds) override {
+		if (milliseconds <= 0) throw std::runtime_error("ERR invalid expire time in 'psetex' command");
+		return set_string(key, value, set_condition::always, now_ms() + milliseconds, false, nullptr);
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<std::string>(key, now_ms());
+		if (!s) return std::nullopt;
+		return *s;
+	}
+
+	std::optional<std::string> getset(const std::string &key, const std::string &new_value) override {
+		std::optional<std::string> old;
+		set_string(key, new_value, set_condition::always, 0, false, &old);
+		return old;
+	}
+
+	long long incr(const std::string &key, long long delta) override {
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		std::string *s = write_value<std::string>(key, now, false);
+		const long long current = s ? parse_integer(*s) : 0;
+		if ((delta > 0 && current > LLONG_MAX - delta) || (delta < 0 && current < LLONG_MIN - delta)) {
+			throw std::runtime_error("ERR increment or decrement would overflow");
+		}
+		if (!s) s = write_value<std::string>(key, now, true);
+		*s = std::to_string(current + delta);
+		return current + delta;
+	}
+
+	long long decr(const std::string &key, long long delta) override {
+		if (delta == LLONG_MIN) throw std::runtime_error("ERR decrement would overflow");
+		return incr(key, -delta);
+	}
+
+	/**
+	 * @brief Increments the number stored at a key by a floating point value.
+	 * @return The value after the increment.
+	 * @note Corresponds to Redis INCRBYFLOAT.
+	 */
+	double incr_float(const std::string &key, double delta) {
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		std::string *s = write_value<std::string>(key, now, false);
+		const double result = (s ? parse_double(*s) : 0.0) + delta;
+		if (std::isnan(result) || std::isinf(result)) {
+			throw std::runtime_error("ERR increment would produce NaN or Infinity");
+		}
+		if (!s) s = write_value<std::string>(key, now, true);
+		*s = format_double(result);
+		return result;
+	}
+
+	long long append(const std::string &key, const std::string &value) override {
+		write_scope scope(*this, key);
+		std::string *s = write_value<std::string>(key, now_ms(), true);
+		s->append(value);
+		return static_cast<long long>(s->size());
+	}
+
+	std::string getrange(const std::string &key, long long start, long long end) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<std::string>(key, now_ms());
+		if (!s || s->empty()) return std::string();
+		size_t first;
+		size_t last;
+		if (!byte_range(static_cast<long long>(s->size()), start, end, first, last)) return std::string();
+		return s->substr(first, last - first + 1);
+	}
+
+	/**
+	 * @brief Overwrites part of a string at an offset, padding with zero bytes as needed.
+	 * @return The length of the string after the operation.
+	 * @note Corresponds to Redis SETRANGE.
+	 */
+	long long setrange(const std::string &key, long long offset, const std::string &value) {
+		if (offset < 0 || offset + static_cast<long long>(value.size()) > max_string_size) {
+			throw std::runtime_error("ERR offset is out of range");
+		}
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		std::string *s = write_value<std::string>(key, now, false);
+		if (value.empty()) return s ? static_cast<long long>(s->size()) : 0;
+		if (!s) s = write_value<std::string>(key, now, true);
+		const auto end = static_cast<size_t>(offset) + value.size();
+		if (s->size() < end) s->resize(end, '\0');
+		s->replace(static_cast<size_t>(offset), value.size(), value);
+		return static_cast<long long>(s->size());
+	}
+
+	// ============================================================================
+	// For Hash
+	// ============================================================================
+
+	std::optional<std::string> hget(const std::string &key, const std::string &hash_key) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *h = read_value<compact_hash>(key, now_ms());
+		if (!h) return std::nullopt;
+		const std::string *v = h->find(hash_key);
+		if (!v) return std::nullopt;
+		return *v;
+	}
+
+	void hget(const std::string &key, std::unordered_map<std::string, std::optional<std::string>> &hash_map) override {
+		if (hash_map.empty()) return;
+		auto lock = lock_shard<read_lock>(key);
+		const auto *h = read_value<compact_hash>(key, now_ms());
+		for (auto &kv: hash_map) {
+			const std::string *v = h ? h->find(kv.first) : nullptr;
+			if (v) {
+				kv.second = *v;
+			}
+			else {
+				kv.second = std::nullopt;
+			}
+		}
+	}
+
+	bool hset(const std::string &key, const std::string &field, const std::string &value) override {
+		write_scope scope(*this, key);
+		write_value<compact_hash>(key, now_ms(), true)->set(field, value);
+		return true;
+	}
+
+	bool hset(const std::string &key, const std::unordered_map<std::string, std::string> &hash_map) override {
+		if (hash_map.empty()) return false;
+		write_scope scope(*this, key);
+		auto *h = write_value<compact_hash>(key, now_ms(), true);
+		for (const auto &kv: hash_map) {
+			h->set(kv.first, kv.second);
+		}
+		return true;
+	}
+
+	std::unordered_map<std::string, std::string> hgetall(const std::string &key) override {
+		std::unordered_map<std::string, std::string> result;
+		auto lock = lock_shard<read_lock>(key);
+		const auto *h = read_value<compact_hash>(key, now_ms());
+		if (!h) return result;
+		result.reserve(h->size());
+		h->for_each([&result](const std::string &f, const std::string &v) { result.emplace(f, v); });
+		return result;
+	}
+
+	std::vector<std::string> hkeys(const std::string &key) override {
+		std::vector<std::string> result;
+		auto lock = lock_shard<read_lock>(key);
+		const auto *h = read_value<compact_hash>(key, now_ms());
+		if (!h) return result;
+		result.reserve(h->size());
+		h->for_each([&result](const std::string &f, const std::string &) { result.push_back(f); });
+		return result;
+	}
+
+	std::vector<std::string> hvals(const std::string &key) override {
+		std::vector<std::string> result;
+		auto lock = lock_shard<read_lock>(key);
+		const auto *h = read_value<compact_hash>(key, now_ms());
+		if (!h) return result;
+		result.reserve(h->size());
+		h->for_each([&result](const std::string &, const std::string &v) { result.push_back(v); });
+		return result;
+	}
+
+	long long hdel(const std::string &key, const std::string &hash_key) override {
+		return hdel(key, std::vector<std::string>{hash_key});
+	}
+
+	long long hdel(const std::string &key, const std::vector<std::string> &hash_keys) override {
+		if (hash_keys.empty()) return 0;
+		write_scope scope(*this, key);
+		auto *h = write_value<compact_hash>(key, now_ms(), false);
+		if (!h) return 0;
+		long long removed = 0;
+		for (const auto &f: hash_keys) {
+			if (h->erase(f)) ++removed;
+		}
+		if (h->size() == 0) remove_key(key);
+		return removed;
+	}
+
+	/**
+	 * @brief Increments the integer stored in a hash field.
+	 * @return The value after the increment.
+	 * @note Corresponds to Redis HINCRBY.
+	 */
+	long long hincrby(const std::string &key, const std::string &field, long long delta) {
+		write_scope scope(*this, key);
+		auto *h = write_value<compact_hash>(key, now_ms(), true);
+		const std::string *v = h->find(field);
+		long long current = 0;
+		try {
+			current = v ? parse_integer(*v) : 0;
+		}
+		catch (const std::runtime_error &) {
+			if (h->size() == 0) remove_key(key);
+			throw std::runtime_error("ERR hash value is not an integer");
+		}
+		if ((delta > 0 && current > LLONG_MAX - delta) || (delta < 0 && current < LLONG_MIN - delta)) {
+			if (h->size() == 0) remove_key(key);
+			throw std::runtime_error("ERR increment or decrement would overflow");
+		}
+		h->set(field, std::to_string(current + delta));
+		return current + delta;
+	}
+
+	/**
+	 * @brief Increments the number stored in a hash field by a floating point value.
+	 * @return The value after the increment.
+	 * @note Corresponds to Redis HINCRBYFLOAT.
+	 */
+	double hincrbyfloat(const std::string &key, const std::string &field, double delta) {
+		write_scope scope(*this, key);
+		auto *h = write_value<compact_hash>(key, now_ms(), true);
+		const std::string *v = h->find(field);
+		double result = delta;
+		try {
+			result += v ? parse_double(*v) : 0.0;
+		}
+		catch (const std::runtime_error &) {
+			if (h->size() == 0) remove_key(key);
+			throw std::runtime_error("ERR hash value is not a float");
+		}
+		if (std::isnan(result) || std::isinf(result)) {
+			if (h->size() == 0) remove_key(key);
+			throw std::runtime_error("ERR increment would produce NaN or Infinity");
+		}
+		h->set(field, format_double(result));
+		return result;
+	}
+
+	// ============================================================================
+	// For list
+	// ============================================================================
+
+	long long lpush(const std::string &key, const std::vector<std::string> &values) override {
+		if (values.empty()) return llen(key);
+		write_scope scope(*this, key);
+		auto *l = write_value<list_type>(key, now_ms(), true);
+		for (const auto &v: values) {
+			l->push_front(v);
+		}
+		return static_cast<long long>(l->size());
+	}
+
+	long long lpush(const std::string &key, const std::string &value) override {
+		return lpush(key, std::vector<std::string>{value});
+	}
+
+	long long rpush(const std::string &key, const std::string &value) override {
+		return rpush(key, std::vector<std::string>{value});
+	}
+
+	long long rpush(const std::string &key, const std::vector<std::string> &values) override {
+		if (values.empty()) return llen(key);
+		write_scope scope(*this, key);
+		auto *l = write_value<list_type>(key, now_ms(), true);
+		l->insert(l->end(), values.begin(), values.end());
+		return static_cast<long long>(l->size());
+	}
+
+	std::optional<std::string> lpop(const std::string &key) override {
+		return pop(key, true);
+	}
+
+	std::optional<std::string> rpop(const std::string &key) override {
+		return pop(key, false);
+	}
+
+	std::vector<std::string> lrange(const std::string &key, long long start, long long stop) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *l = read_value<list_type>(key, now_ms());
+		if (!l || !normalize_range(static_cast<long long>(l->size()), start, stop)) return {};
+		return std::vector<std::string>(l->begin() + start, l->begin() + stop + 1);
+	}
+
+	long long llen(const std::string &key) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *l = read_value<list_type>(key, now_ms());
+		return l ? static_cast<long long>(l->size()) : 0;
+	}
+
+	/**
+	 * @brief Returns the element at an index of a list (negative indexes count from the tail).
+	 * @note Corresponds to Redis LINDEX.
+	 */
+	std::optional<std::string> lindex(const std::string &key, long long index) {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *l = read_value<list_type>(key, now_ms());
+		if (!l) return std::nullopt;
+		const auto size = static_cast<long long>(l->size());
+		if (index < 0) index += size;
+		if (index < 0 || index >= size) return std::nullopt;
+		return (*l)[static_cast<size_t>(index)];
+	}
+
+	/**
+	 * @brief Replaces the element at an index of a list.
+	 * @throw std::runtime_error if the key does not exist or the index is out of range.
+	 * @note Corresponds to Redis LSET.
+	 */
+	void lset(const std::string &key, long long index, const std::string &value) {
+		write_scope scope(*this, key);
+		auto *l = write_value<list_type>(key, now_ms(), false);
+		if (!l) throw std::runtime_error("ERR no such key");
+		const auto size = static_cast<long long>(l->size());
+		if (index < 0) index += size;
+		if (index < 0 || index >= size) throw std::runtime_error("ERR index out of range");
+		(*l)[static_cast<size_t>(index)] = value;
+	}
+
+	/**
+	 * @brief Trims a list to the elements within [start, stop].
+	 * @note Corresponds to Redis LTRIM.
+	 */
+	void ltrim(const std::string &key, long long start, long long stop) {
+		write_scope scope(*this, key);
+		auto *l = write_value<list_type>(key, now_ms(), false);
+		if (!l) return;
+		if (!normalize_range(static_cast<long long>(l->size()), start, stop)) {
+			remove_key(key);
+			return;
+		}
+		l->erase(l->begin() + stop + 1, l->end());
+		l->erase(l->begin(), l->begin() + start);
+	}
+
+	// ============================================================================
+	// For Set
+	// ============================================================================
+
+	long long sadd(const std::string &key, const std::vector<std::string> &members) override {
+		if (members.empty()) return 0;
+		write_scope scope(*this, key);
+		auto *s = write_value<compact_set>(key, now_ms(), true);
+		long long added = 0;
+		for (const auto &m: members) {
+			if (s->add(m)) ++added;
+		}
+		return added;
+	}
+
+	long long srem(const std::string &key, const std::vector<std::string> &members) override {
+		if (members.empty()) return 0;
+		write_scope scope(*this, key);
+		auto *s = write_value<compact_set>(key, now_ms(), false);
+		if (!s) return 0;
+		long long removed = 0;
+		for (const auto &m: members) {
+			if (s->erase(m)) ++removed;
+		}
+		if (s->size() == 0) remove_key(key);
+		return removed;
+	}
+
+	std::vector<std::string> smembers(const std::string &key) override {
+		std::vector<std::string> result;
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<compact_set>(key, now_ms());
+		if (!s) return result;
+		result.reserve(s->size());
+		s->for_each([&result](const std::string &m) { result.push_back(m); });
+		return result;
+	}
+
+	long long scard(const std::string &key) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<compact_set>(key, now_ms());
+		return s ? static_cast<long long>(s->size()) : 0;
+	}
+
+	bool sismember(const std::string &key, const std::string &member) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<compact_set>(key, now_ms());
+		return s && s->contains(member);
+	}
+
+	std::optional<std::string> spop(const std::string &key) override {
+		write_scope scope(*this, key);
+		auto *s = write_value<compact_set>(key, now_ms(), false);
+		if (!s) return std::nullopt;
+		std::string member = s->pop();
+		if (s->size() == 0) remove_key(key);
+		return member;
+	}
+
+	std::vector<std::string> sinter(const std::vector<std::string> &keys) override {
+		return set_algebra(keys, set_operation::inter);
+	}
+
+	/**
+	 * @brief Returns the members of the union of sets.
+	 * @note Corresponds to Redis SUNION.
+	 */
+	std::vector<std::string> sunion(const std::vector<std::string> &keys) {
+		return set_algebra(keys, set_operation::unite);
+	}
+
+	/**
+	 * @brief Returns the members of the first set that are in none of the others.
+	 * @note Corresponds to Redis SDIFF.
+	 */
+	std::vector<std::string> sdiff(const std::vector<std::string> &keys) {
+		return set_algebra(keys, set_operation::diff);
+	}
+
+	// ============================================================================
+	// For Sorted Set
+	// ============================================================================
+
+	long long zadd(const std::string &key, const std::unordered_map<std::string, double> &members) override {
+		std::vector<std::pair<double, std::string>> entries;
+		entries.reserve(members.size());
+		for (const auto &kv: members) {
+			entries.emplace_back(kv.second, kv.first);
+		}
+		return zadd(key, entries, zadd_flags());
+	}
+
+	long long zrem(const std::string &key, const std::vector<std::string> &members) override {
+		if (members.empty()) return 0;
+		write_scope scope(*this, key);
+		auto *z = write_value<compact_zset>(key, now_ms(), false);
+		if (!z) return 0;
+		long long removed = 0;
+		for (const auto &m: members) {
+			if (z->erase(m)) ++removed;
+		}
+		if (z->size() == 0) remove_key(key);
+		return removed;
+	}
+
+	std::optional<double> zscore(const std::string &key, const std::string &member) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *z = read_value<compact_zset>(key, now_ms());
+		if (!z) return std::nullopt;
+		return z->score(member);
+	}
+
+	std::vector<std::string> zrange(const std::string &key, long long start, long long stop) override {
+		return members_of(zrange_withscores(key, start, stop));
+	}
+
+	std::vector<std::string> zrevrange(const std::string &key, long long start, long long stop) override {
+		return members_of(zrevrange_withscores(key, start, stop));
+	}
+
+	std::vector<std::pair<std::string, double>> zrange_withscores(const std::string &key, long long start,
+																  long long stop) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *z = read_value<compact_zset>(key, now_ms());
+		if (!z || !normalize_range(static_cast<long long>(z->size()), start, stop)) return {};
+		return z->range_by_rank(static_cast<size_t>(start), static_cast<size_t>(stop));
+	}
+
+	std::vector<std::pair<std::string, double>> zrevrange_withscores(const std::string &key, long long start,
+																	 long long stop) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *z = read_value<compact_zset>(key, now_ms());
+		const auto size = z ? static_cast<long long>(z->size()) : 0;
+		if (!z || !normalize_range(size, start, stop)) return {};
+		auto result = z->range_by_rank(static_cast<size_t>(size - 1 - stop), static_cast<size_t>(size - 1 - start));
+		std::reverse(result.begin(), result.end());
+		return result;
+	}
+
+	double zincrby(const std::string &key, double increment, const std::string &member) override {
+		write_scope scope(*this, key);
+		auto *z = write_value<compact_zset>(key, now_ms(), true);
+		const double result = z->score(member).value_or(0.0) + increment;
+		if (std::isnan(result)) {
+			if (z->size() == 0) remove_key(key);
+			throw std::runtime_error("ERR resulting score is not a number (NaN)");
+		}
+		z->add(member, result);
+		return result;
+	}
+
+	std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																		 double max) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *z = read_value<compact_zset>(key, now_ms());
+		if (!z) return {};
+		return z->range_by_score(min, max);
+	}
+
+	long long zremrangebyscore(const std::string &key, double min, double max) override {
+		write_scope scope(*this, key);
+		auto *z = write_value<compact_zset>(key, now_ms(), false);
+		if (!z) return 0;
+		const auto removed = static_cast<long long>(z->remove_range_by_score(min, max));
+		if (z->size() == 0) remove_key(key);
+		return removed;
+	}
+
+	/**
+	 * @brief Returns the number of members of a sorted set.
+	 * @note Corresponds to Redis ZCARD.
+	 */
+	long long zcard(const std::string &key) {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *z = read_value<compact_zset>(key, now_ms());
+		return z ? static_cast<long long>(z->size()) : 0;
+	}
+
+	/**
+	 * @brief Returns the rank of a member, lowest score first (reverse = true: highest score first).
+	 * @note Corresponds to Redis ZRANK / ZREVRANK.
+	 */
+	std::optional<long long> zrank(const std::string &key, const std::string &member, bool reverse = false) {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *z = read_value<compact_zset>(key, now_ms());
+		if (!z) return std::nullopt;
+		auto rank = z->rank(member);
+		if (rank && reverse) rank = static_cast<long long>(z->size()) - 1 - *rank;
+		return rank;
+	}
+
+	// ============================================================================
+	// For HyperLogLog
+	// ============================================================================
+
+	bool pfadd(const std::string &key, const std::vector<std::string> &elements) override {
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		std::string *s = write_value<std::string>(key, now, false);
+		hll_sketch sketch = s ? to_sketch(*s) : hll_sketch();
+		bool changed = s == nullptr;
+		for (const auto &e: elements) {
+			if (sketch.add(e)) changed = true;
+		}
+		if (!changed) return false;
+		if (!s) s = write_value<std::string>(key, now, true);
+		*s = sketch.to_redis();
+		return true;
+	}
+
+	long long pfcount(const std::vector<std::string> &keys) override {
+		auto locks = lock_shards<read_lock>(keys);
+		const int64_t now = now_ms();
+		hll_sketch merged;
+		for (const auto &key: keys) {
+			if (const auto *s = read_value<std::string>(key, now)) merged.merge(to_sketch(*s));
+		}
+		return static_cast<long long>(merged.count());
+	}
+
+	bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) override {
+		std::vector<std::string> keys(sources);
+		keys.push_back(dest);
+		write_scope scope(*this, keys);
+		const int64_t now = now_ms();
+		hll_sketch merged;
+		for (const auto &key: keys) {
+			if (const auto *s = read_value<std::string>(key, now)) merged.merge(to_sketch(*s));
+		}
+		*write_value<std::string>(dest, now, true) = merged.to_redis();
+		return true;
+	}
+
+	// ============================================================================
+	// For Bitmap
+	// ============================================================================
+
+	bool setbit(const std::string &key, long long offset, bool value) override {
+		check_bit_offset(offset);
+		write_scope scope(*this, key);
+		std::string *s = write_value<std::string>(key, now_ms(), true);
+		const auto byte = static_cast<size_t>(offset >> 3);
+		if (s->size() <= byte) s->resize(byte + 1, '\0');
+		const auto mask = static_cast<unsigned char>(0x80 >> (offset & 7));
+		auto &c = reinterpret_cast<unsigned char &>((*s)[byte]);
+		const bool old = (c & mask) != 0;
+		c = static_cast<unsigned char>(value ? (c | mask) : (c & ~mask));
+		return old;
+	}
+
+	bool getbit(const std::string &key, long long offset) override {
+		check_bit_offset(offset);
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<std::string>(key, now_ms());
+		const auto byte = static_cast<size_t>(offset >> 3);
+		if (!s || s->size() <= byte) return false;
+		return (static_cast<unsigned char>((*s)[byte]) & (0x80 >> (offset & 7))) != 0;
+	}
+
+	long long bitcount(const std::string &key, long long start, long long end) override {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<std::string>(key, now_ms());
+		size_t first;
+		size_t last;
+		if (!s || !byte_range(static_cast<long long>(s->size()), start, end, first, last)) return 0;
+		long long count = 0;
+		for (size_t i = first; i <= last; ++i) {
+			count += popcount8(static_cast<unsigned char>((*s)[i]));
+		}
+		return count;
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end) override {
+		return bitpos(key, bit, start, end, true);
+	}
+
+	long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) override {
+		std::string name(op);
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+		if (name != "AND" && name != "OR" && name != "XOR" && name != "NOT") {
+			throw std::runtime_error("ERR syntax error");
+		}
+		if (name == "NOT" && keys.size() != 1) {
+			throw std::runtime_error("ERR BITOP NOT must be called with a single source key.");
+		}
+
+		std::vector<std::string> all(keys);
+		all.push_back(dest);
+		write_scope scope(*this, all);
+		const int64_t now = now_ms();
+		std::vector<const std::string *> sources;
+		size_t length = 0;
+		for (const auto &key: keys) {
+			const auto *s = read_value<std::string>(key, now);
+			sources.push_back(s);
+			if (s) length = std::max(length, s->size());
+		}
+
+		std::string result(length, '\0');
+		for (size_t i = 0; i < length; ++i) {
+			auto byte_of = [i](const std::string *s) {
+				return s && i < s->size() ? static_cast<unsigned char>((*s)[i]) : static_cast<unsigned char>(0);
+			};
+			unsigned char v = byte_of(sources[0]);
+			if (name == "NOT") {
+				v = static_cast<unsigned char>(~v);
+			}
+			for (size_t k = 1; k < sources.size(); ++k) {
+				const unsigned char b = byte_of(sources[k]);
+				if (name == "AND") v &= b;
+				else if (name == "OR") v |= b;
+				else v ^= b;
+			}
+			result[i] = static_cast<char>(v);
+		}
+
+		if (result.empty()) {
+			remove_key(dest);
+			return 0;
+		}
+		shard &s = shard_for(dest);
+		auto it = find_for_write(s, dest, now);
+		if (it != s.data.end()) erase_entry(s, it);
+		*write_value<std::string>(dest, now, true) = std::move(result);
+		return static_cast<long long>(length);
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &key,
+												   const std::vector<std::string> &args) override {
+		std::vector<bitfield_op> ops = parse_bitfield(args);
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		std::string *s = write_value<std::string>(key, now, false);
+		const std::string empty;
+		std::vector<std::optional<long long>> result;
+		for (const auto &op: ops) {
+			const std::string &current = s ? *s : empty;
+			const long long old = read_field(current, op);
+			if (op.kind == bitfield_op::get) {
+				result.emplace_back(old);
+				continue;
+			}
+			std::optional<long long> value =
+				op.kind == bitfield_op::set ? fit_field(op, op.value) : add_field(op, old, op.value);
+			if (value) {
+				if (!s) s = write_value<std::string>(key, now, true);
+				write_field(*s, op, *value);
+			}
+			if (op.kind == bitfield_op::set) {
+				result.emplace_back(value ? std::optional<long long>(old) : std::nullopt);
+			}
+			else {
+				result.push_back(value);
+			}
+		}
+		return result;
+	}
+
+	// ============================================================================
+	// For Scripting
+	// ============================================================================
+
+	std::string script_load(const std::string &) override {
+		throw std::runtime_error("memory_connection: scripting is not supported");
+	}
+
+	kv_reply evalsha(const std::string &, const std::vector<std::string> &, const std::vector<std::string> &) override {
+		throw std::runtime_error("memory_connection: scripting is not supported");
+	}
+
+	// ============================================================================
+	// For Pipelining
+	// ============================================================================
+
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		std::vector<kv_reply> result;
+		result.reserve(commands.size());
+		for (const auto &command: commands) {
+			result.push_back(execute(command));
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Executes one raw command, as a Redis server would.
+	 * @param argv The command and its arguments, e.g. {"SET", "key", "value", "PX", "1000"}.
+	 * @return The reply. Command errors are returned as error replies; they are never thrown.
+	 */
+	kv_reply execute(const std::vector<std::string> &argv) {
+		if (argv.empty()) return error_reply("ERR empty command");
+		std::string name(argv[0]);
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+
+		session *state = active_sessions.load(std::memory_order_acquire) > 0 ? find_session() : nullptr;
+		if (name == "MULTI") {
+			if (state && state->in_multi) return error_reply("ERR MULTI calls can not be nested");
+			open_session().in_multi = true;
+			return status_reply("OK");
+		}
+		if (name == "EXEC") {
+			if (!state || !state->in_multi) return error_reply("ERR EXEC without MULTI");
+			return exec(*state);
+		}
+		if (name == "DISCARD") {
+			if (!state || !state->in_multi) return error_reply("ERR DISCARD without MULTI");
+			close_session();
+			return status_reply("OK");
+		}
+		if (name == "WATCH") {
+			if (state && state->in_multi) return error_reply("ERR WATCH inside MULTI is not allowed");
+			if (argv.size() < 2) return error_reply("ERR wrong number of arguments for 'watch' command");
+			watch(std::vector<std::string>(argv.begin() + 1, argv.end()));
+			return status_reply("OK");
+		}
+		if (name == "UNWATCH") {
+			if (state && !state->in_multi) close_session();
+			return status_reply("OK");
+		}
+
+		const command_spec *spec = lookup(name, argv);
+		if (state && state->in_multi) {
+			if (!spec) {
+				state->aborted = true;
+				return check_command(name, argv);
+			}
+			state->queued.push_back(argv);
+			return status_reply("QUEUED");
+		}
+		if (!spec) return check_command(name, argv);
+		return dispatch(*spec, argv);
+	}
+
+protected:
+	using read_lock = std::shared_lock<std::shared_mutex>;
+	using write_lock = std::unique_lock<std::shared_mutex>;
+
+	/**
+	 * @brief Called by every write, with its shards locked but before anything is changed, once observe_writes(true)
+	 * was set; throwing rejects the write (e.g. while the store cannot persist it).
+	 */
+	virtual void before_write() {
+	}
+
+	/**
+	 * @brief Called after a write changed a key, while the key's shard is still locked, so the calls for one key arrive
+	 * in the order its writes were applied. Only called once observe_writes(true) was set. Active expiry reports the
+	 * keys it removes as deletions.
+	 * * The change is already visible when this is called, so it must not throw: a write that cannot be accepted is
+	 * refused by before_write() instead.
+	 * @param key The key.
+	 * @param value The new value, or nullptr if the key was deleted.
+	 * @param expire_at The absolute expiry time in milliseconds since the epoch, 0 if the key is persistent.
+	 */
+	virtual void on_write(const std::string &, const memory_value *, int64_t) {
+	}
+
+	/* Called by flushall() with every shard locked, once observe_writes(true) was set */
+	virtual void on_flush() {
+	}
+
+	void observe_writes(bool enable) {
+		observed = enable;
+	}
+
+	static int64_t now_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	}
+
+	/* Locks every shard in index order */
+	template<typename Lock>
+	std::vector<Lock> lock_all() const {
+		std::vector<Lock> locks;
+		locks.reserve(shards.size());
+		for (const auto &s: shards) {
+			locks.push_back(lock_one<Lock>(*s));
+		}
+		return locks;
+	}
+
+	/* Calls f(key, value, expire_at) for every live key; the caller holds the shard locks, e.g. from lock_all() */
+	template<typename F>
+	void for_each_entry(F &&f) const {
+		const int64_t now = now_ms();
+		for (const auto &s: shards) {
+			for (const auto &kv: s->data) {
+				if (!is_expired(kv.second, now)) f(kv.first, kv.second.value, kv.second.expire_at);
+			}
+		}
+	}
+
+	/* Stores a value without calling on_write(), e.g. while loading persisted data; thread-safe */
+	void restore(const std::string &key, memory_value value, int64_t expire_at) {
+		auto lock = lock_shard<write_lock>(key);
+		shard &s = shard_for(key);
+		auto it = s.data.find(key);
+		if (it == s.data.end()) {
+			it = s.data.emplace(key, entry{std::move(value)}).first;
+		}
+		else {
+			it->second.value = std::move(value);
+		}
+		set_expiry(s, it, expire_at);
+		touch(it->second);
+	}
+
+	[[nodiscard]] const memory_connection_options &get_options() const {
+		return options;
+	}
+
+private:
+	using list_type = std::deque<std::string>;
+
+	static constexpr long long max_string_size = 512LL * 1024 * 1024;
+	static constexpr const char *wrongtype_error = "WRONGTYPE Operation against a key holding the wrong kind of value";
+
+	struct entry {
+		memory_value value;
+		/* Absolute expiry time in ms since the epoch, 0 if persistent */
+		int64_t expire_at{0};
+		/* Bumped on every write, checked by WATCH */
+		uint64_t version{0};
+	};
+
+	struct shard {
+		mutable std::shared_mutex mutex;
+		std::unordered_map<std::string, entry> data;
+		/* Keys with an expiry, ordered by expiry time */
+		std::set<std::pair<int64_t, std::string>> expires;
+	};
+
+	/* Per-thread transaction state (MULTI queue and WATCHed key versions) */
+	struct session {
+		bool in_multi{false};
+		bool aborted{false};
+		std::vector<std::vector<std::string>> queued;
+		std::vector<std::pair<std::string, uint64_t>> watched;
+	};
+
+	struct command_spec {
+		kv_reply (*handler)(memory_connection &, const std::vector<std::string> &);
+		int arity;
+	};
+
+	enum class set_condition { always, not_exists, exists };
+	enum class set_operation { inter, unite, diff };
+
+	struct zadd_flags {
+		bool nx{false};
+		bool xx{false};
+		bool ch{false};
+	};
+
+	struct score_bound {
+		double value;
+		bool exclusive;
+	};
+
+	struct bitfield_op {
+		enum kind_type { get, set, incrby };
+		enum overflow_type { wrap, sat, fail };
+
+		kind_type kind;
+		bool is_signed;
+		unsigned bits;
+		uint64_t offset;
+		long long value;
+		overflow_type overflow;
+	};
+
+	// ---------------------------------------------------------------------------
+	// Keyspace helpers; callers hold the lock of the key's shard
+	// ---------------------------------------------------------------------------
+
+	static bool is_expired(const entry &e, int64_t now) {
+		return e.expire_at != 0 && e.expire_at <= now;
+	}
+
+	size_t shard_index(const std::string &key) const {
+		return static_cast<size_t>(murmurhash64a(key, 0x9e3779b97f4a7c15ULL)) & (shards.size() - 1);
+	}
+
+	shard &shard_for(const std::string &key) const {
+		return *shards[shard_index(key)];
+	}
+
+	/* Lookup for readers: an expired key is reported missing but left for a writer or the expiry cycle to remove */
+	const entry *find_live(const std::string &key, int64_t now) const {
+		const shard &s = shard_for(key);
+		auto it = s.data.find(key);
+		if (it == s.data.end() || is_expired(it->second, now)) return nullptr;
+		return &it->second;
+	}
+
+	/* Lookup for writers: an expired key is deleted on access */
+	std::unordered_map<std::string, entry>::iterator find_for_write(shard &s, const std::string &key, int64_t now) {
+		auto it = s.data.find(key);
+		if (it != s.data.end() && is_expired(it->second, now)) {
+			erase_entry(s, it);
+			return s.data.end();
+		}
+		return it;
+	}
+
+	template<typename T>
+	const T *read_value(const std::string &key, int64_t now) const {
+		const entry *e = find_live(key, now);
+		if (!e) return nullptr;
+		const T *v = std::get_if<T>(&e->value);
+		if (!v) throw std::runtime_error(wrongtype_error);
+		return v;
+	}
+
+	/* Returns the value of a key for modification; creates an empty value of type T if asked to */
+	template<typename T>
+	T *write_value(const std::string &key, int64_t now, bool create) {
+		shard &s = shard_for(key);
+		auto it = find_for_write(s, key, now);
+		if (it == s.data.end()) {
+			if (!create) return nullptr;
+			it = s.data.emplace(key, entry{make_value<T>()}).first;
+		}
+		T *v = std::get_if<T>(&it->second.value);
+		if (!v) throw std::runtime_error(wrongtype_error);
+		touch(it->second);
+		return v;
+	}
+
+	template<typename T>
+	memory_value make_value() const {
+		if constexpr (std::is_constructible_v<T, const compact_limits &>) {
+			return memory_value(std::in_place_type<T>, options.limits);
+		}
+		else {
+			return memory_value(std::in_place_type<T>);
+		}
+	}
+
+	void touch(entry &e) {
+		e.version = version_counter.fetch_add(1, std::memory_order_relaxed) + 1;
+	}
+
+	void set_expiry(shard &s, std::unordered_map<std::string, entry>::iterator it, int64_t when) {
+		if (it->second.expire_at != 0) s.expires.erase({it->second.expire_at, it->first});
+		it->second.expire_at = when;
+		if (when != 0) s.expires.emplace(when, it->first);
+	}
+
+	void erase_entry(shard &s, std::unordered_map<std::string, entry>::iterator it) {
+		if (it->second.expire_at != 0) s.expires.erase({it->second.expire_at, it->first});
+		s.data.erase(it);
+	}
+
+	void remove_key(const std::string &key) {
+		shard &s = shard_for(key);
+		auto it = s.data.find(key);
+		if (it != s.data.end()) erase_entry(s, it);
+	}
+
+	uint64_t current_version(const std::string &key, int64_t now) const {
+		const entry *e = find_live(key, now);
+		return e ? e->version : 0;
+	}
+
+	// ---------------------------------------------------------------------------
+	// Locking
+	// ---------------------------------------------------------------------------
+
+	/* Inside EXEC the executing thread already holds every shard lock exclusively */
+	template<typename Lock>
+	Lock lock_one(const shard &s) const {
+		if (exec_owner == this) return Lock(s.mutex, std::defer_lock);
+		return Lock(s.mutex);
+	}
+
+	template<typename Lock>
+	Lock lock_shard(const std::string &key) const {
+		return lock_one<Lock>(shard_for(key));
+	}
+
+	/* Locks the shards of several keys in index order, so that concurrent multi-key commands cannot deadlock */
+	template<typename Lock>
+	std::vector<Lock> lock_shards(const std::vector<std::string> &keys) const {
+		std::vector<Lock> locks;
+		if (exec_owner == this) return locks;
+		std::vector<size_t> indexes;
+		indexes.reserve(keys.size());
+		for (const auto &key: keys) {
+			indexes.push_back(shard_index(key));
+		}
+		std::sort(indexes.begin(), indexes.end());
+		indexes.erase(std::unique(indexes.begin(), indexes.end()), indexes.end());
+		locks.reserve(indexes.size());
+		for (size_t i: indexes) {
+			locks.emplace_back(shards[i]->mutex);
+		}
+		return locks;
+	}
+
+	/*
+	 * Write lock of one or several keys' shards. When writes are observed, it asks before_write() whether the write may
+	 * proceed, and reports every key whose version changed to on_write() before the locks are released.
+	 */
+	class write_scope {
+	public:
+		write_scope(memory_connection &owner, const std::string &key) :
+			owner(owner), single(&key), lock(owner.lock_shard<write_lock>(key)) {
+			if (!owner.observed) return;
+			owner.before_write();
+			versions.push_back(owner.current_version(key, now_ms()));
+		}
+
+		write_scope(memory_connection &owner, const std::vector<std::string> &keys) :
+			owner(owner), many(&keys), locks(owner.lock_shards<write_lock>(keys)) {
+			if (!owner.observed) return;
+			owner.before_write();
+			const int64_t now = now_ms();
+			for (const auto &key: keys) {
+				versions.push_back(owner.current_version(key, now));
+			}
+		}
+
+		write_scope(const write_scope &) = delete;
+		write_scope &operator=(const write_scope &) = delete;
+
+		// Also reports while unwinding, so a command that failed halfway still reports what it changed
+		~write_scope() {
+			if (!owner.observed) return;
+			if (single) {
+				owner.report_write(*single, versions[0]);
+				return;
+			}
+			for (size_t i = 0; i < many->size(); ++i) {
+				owner.report_write((*many)[i], versions[i]);
+			}
+		}
+
+	private:
+		memory_connection &owner;
+		const std::string *single{nullptr};
+		const std::vector<std::string> *many{nullptr};
+		std::vector<uint64_t> versions;
+		write_lock lock;
+		std::vector<write_lock> locks;
+	};
+
+	void report_write(const std::string &key, uint64_t before) {
+		const entry *e = find_live(key, now_ms());
+		if ((e ? e->version : 0) == before) return;
+		on_write(key, e ? &e->value : nullptr, e ? e->expire_at : 0);
+	}
+
+	// ---------------------------------------------------------------------------
+	// Command implementations shared by the typed API and execute()
+	// ---------------------------------------------------------------------------
+
+	bool set_string(const std::string &key, const std::string &value, set_condition condition, int64_t expire_at,
+					bool keep_ttl, std::optional<std::string> *old) {
+		write_scope scope(*this, key);
+		return store_string(key, value, condition, expire_at, keep_ttl, old);
+	}
+
+	/* SET with the key's shard already locked */
+	bool store_string(const std::string &key, const std::string &value, set_condition condition, int64_t expire_at,
+					  bool keep_ttl, std::optional<std::string> *old) {
+		shard &s = shard_for(key);
+		auto it = find_for_write(s, key, now_ms());
+		if (old) {
+			if (it != s.data.end() && !std::holds_alternative<std::string>(it->second.value)) {
+				throw std::runtime_error(wrongtype_error);
+			}
+			if (it != s.data.end()) *old = std::get<std::string>(it->second.value);
+		}
+		if ((condition == set_condition::not_exists && it != s.data.end())
+			|| (condition == set_condition::exists && it == s.data.end())) {
+			return false;
+		}
+		if (it == s.data.end()) {
+			it = s.data.emplace(key, entry{memory_value(value)}).first;
+		}
+		else {
+			it->second.value = value;
+		}
+		if (!keep_ttl) set_expiry(s, it, expire_at);
+		touch(it->second);
+		return true;
+	}
+
+	std::optional<std::string> pop(const std::string &key, bool front) {
+		write_scope scope(*this, key);
+		auto *l = write_value<list_type>(key, now_ms(), false);
+		if (!l) return std::nullopt;
+		std::string value;
+		if (front) {
+			value = std::move(l->front());
+			l->pop_front();
+		}
+		else {
+			value = std::move(l->back());
+			l->pop_back();
+		}
+		if (l->empty()) remove_key(key);
+		return value;
+	}
+
+	std::vector<std::string> set_algebra(const std::vector<std::string> &keys, set_operation op) {
+		std::vector<std::string> result;
+		if (keys.empty()) return result;
+		auto locks = lock_shards<read_lock>(keys);
+		const int64_t now = now_ms();
+		std::vector<const compact_set *> sets;
+		sets.reserve(keys.size());
+		for (const auto &key: keys) {
+			sets.push_back(read_value<compact_set>(key, now));
+		}
+
+		if (op == set_operation::unite) {
+			std::unordered_set<std::string> seen;
+			for (const auto *s: sets) {
+				if (!s) continue;
+				s->for_each([&](const std::string &m) {
+					if (seen.insert(m).second) result.push_back(m);
+				});
+			}
+			return result;
+		}
+
+		const compact_set *base = sets[0];
+		if (op == set_operation::inter) {
+			// Iterate the smallest set and probe the others
+			for (const auto *s: sets) {
+				if (!s) return result;
+				if (s->size() < base->size()) base = s;
+			}
+		}
+		if (!base) return result;
+		base->for_each([&](const std::string &m) {
+			for (size_t k = op == set_operation::diff ? 1 : 0; k < sets.size(); ++k) {
+				if (sets[k] == base && op == set_operation::inter) continue;
+				const bool contained = sets[k] && sets[k]->contains(m);
+				if (contained != (op == set_operation::inter)) return;
+			}
+			result.push_back(m);
+		});
+		return result;
+	}
+
+	long long zadd(const std::string &key, const std::vector<std::pair<double, std::string>> &entries,
+				   const zadd_flags &flags) {
+		if (entries.empty()) return 0;
+		for (const auto &e: entries) {
+			if (std::isnan(e.first)) throw std::runtime_error("ERR value is not a valid float");
+		}
+		write_scope scope(*this, key);
+		const int64_t now = now_ms();
+		compact_zset *z = write_value<compact_zset>(key, now, false);
+		if (!z && flags.xx) return 0;
+		if (!z) z = write_value<compact_zset>(key, now, true);
+		long long changed = 0;
+		for (const auto &e: entries) {
+			const std::optional<double> old = z->score(e.second);
+			if ((old && flags.nx) || (!old && flags.xx)) continue;
+			z->add(e.second, e.first);
+			if (!old || (flags.ch && *old != e.first)) ++changed;
+		}
+		return changed;
+	}
+
+	std::vector<std::pair<std::string, double>> zrangebyscore(const std::string &key, const score_bound &min,
+															  const score_bound &max) {
+		auto result = zrangebyscore_withscores(key, min.value, max.value);
+		result.erase(std::remove_if(result.begin(), result.end(),
+									[&](const std::pair<std::string, double> &e) {
+										return (min.exclusive && e.second == min.value)
+											|| (max.exclusive && e.second == max.value);
+									}),
+					 result.end());
+		return result;
+	}
+
+	long long zremrangebyscore(const std::string &key, const score_bound &min, const score_bound &max) {
+		write_scope scope(*this, key);
+		auto *z = write_value<compact_zset>(key, now_ms(), false);
+		if (!z) return 0;
+		long long removed = 0;
+		for (const auto &e: z->range_by_score(min.value, max.value)) {
+			if ((min.exclusive && e.second == min.value) || (max.exclusive && e.second == max.value)) continue;
+			z->erase(e.first);
+			++removed;
+		}
+		if (z->size() == 0) remove_key(key);
+		return removed;
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end, bool end_given) {
+		auto lock = lock_shard<read_lock>(key);
+		const auto *s = read_value<std::string>(key, now_ms());
+		if (!s || s->empty()) return bit ? -1 : 0;
+		size_t first;
+		size_t last;
+		if (!byte_range(static_cast<long long>(s->size()), start, end, first, last)) return -1;
+		for (size_t i = first; i <= last; ++i) {
+			const auto c = static_cast<unsigned char>((*s)[i]);
+			if (c == (bit ? 0x00 : 0xff)) continue;
+			for (int b = 0; b < 8; ++b) {
+				if (((c >> (7 - b)) & 1) == (bit ? 1 : 0)) return static_cast<long long>(i * 8 + b);
+			}
+		}
+		// Looking for a clear bit without an explicit end: the string is treated as padded with zeros
+		if (!bit && !end_given) return static_cast<long long>((last + 1) * 8);
+		return -1;
+	}
+
+	// ---------------------------------------------------------------------------
+	// Transactions
+	// ---------------------------------------------------------------------------
+
+	session *find_session() {
+		std::lock_guard<std::mutex> lock(sessions_mutex);
+		auto it = sessions.find(std::this_thread::get_id());
+		return it == sessions.end() ? nullptr : &it->second;
+	}
+
+	session &open_session() {
+		std::lock_guard<std::mutex> lock(sessions_mutex);
+		auto result = sessions.try_emplace(std::this_thread::get_id());
+		if (result.second) active_sessions.fetch_add(1, std::memory_order_release);
+		return result.first->second;
+	}
+
+	void close_session() {
+		std::lock_guard<std::mutex> lock(sessions_mutex);
+		if (sessions.erase(std::this_thread::get_id()) > 0) active_sessions.fetch_sub(1, std::memory_order_release);
+	}
+
+	void watch(const std::vector<std::string> &keys) {
+		const int64_t now = now_ms();
+		session &state = open_session();
+		for (const auto &key: keys) {
+			auto lock = lock_shard<read_lock>(key);
+			state.watched.emplace_back(key, current_version(key, now));
+		}
+	}
+
+	kv_reply exec(session &state) {
+		if (state.aborted) {
+			close_session();
+			return error_reply("EXECABORT Transaction discarded because of previous errors.");
+		}
+
+		auto locks = lock_all<write_lock>();
+
+		const int64_t now = now_ms();
+		for (const auto &w: state.watched) {
+			if (current_version(w.first, now) != w.second) {
+				close_session();
+				return kv_reply();
+			}
+		}
+
+		kv_reply reply;
+		reply.type = kv_reply::reply_type::array;
+		reply.elements.reserve(state.queued.size());
+		exec_owner = this;
+		for (const auto &argv: state.queued) {
+			std::string name(argv[0]);
+			std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+			reply.elements.push_back(dispatch(*lookup(name, argv), argv));
+		}
+		exec_owner = nullptr;
+		close_session();
+		return reply;
+	}
+
+	// ---------------------------------------------------------------------------
+	// Active expiry
+	// ---------------------------------------------------------------------------
+
+	void active_expire_loop() {
+		std::unique_lock<std::mutex> lock(expire_mutex);
+		while (!stopping) {
+			expire_cv.wait_for(lock, options.active_expire_interval, [this] { return stopping; });
+			if (stopping) break;
+			lock.unlock();
+			purge_expired(options.active_expire_batch);
+			lock.lock();
+		}
+	}
+
+	// ---------------------------------------------------------------------------
+	// Parsing and formatting
+	// ---------------------------------------------------------------------------
+
+	static long long parse_integer(const std::string &s) {
+		long long value = 0;
+		const char *end = s.data() + s.size();
+		auto r = std::from_chars(s.data(), end, value);
+		if (s.empty() || r.ec != std::errc() || r.ptr != end) {
+			throw std::runtime_error("ERR value is not an integer or out of range");
+		}
+		return value;
+	}
+
+	static double parse_double(const std::string &s) {
+		if (s.empty() || std::isspace(static_cast<unsigned char>(s[0]))) {
+			throw std::runtime_error("ERR value is not a valid float");
+		}
+		char *end = nullptr;
+		const double value = std::strtod(s.c_str(), &end);
+		if (end != s.c_str() + s.size() || std::isnan(value)) {
+			throw std::runtime_error("ERR value is not a valid float");
+		}
+		return value;
+	}
+
+	static score_bound parse_score_bound(const std::string &s) {
+		if (!s.empty() && s[0] == '(') {
+			try {
+				return {parse_double(s.substr(1)), true};
+			}
+			catch (const std::runtime_error &) {
+				throw std::runtime_error("ERR min or max is not a float");
+			}
+		}
+		try {
+			return {parse_double(s), false};
+		}
+		catch (const std::runtime_error &) {
+			throw std::runtime_error("ERR min or max is not a float");
+		}
+	}
+
+	/* Shortest representation that reads back as the same double */
+	static std::string format_double(double value) {
+		if (std::isinf(value)) return value > 0 ? "inf" : "-inf";
+		char buf[32];
+		for (int precision = 15; precision <= 17; ++precision) {
+			std::snprintf(buf, sizeof(buf), "%.*g", precision, value);
+			if (std::strtod(buf, nullptr) == value) break;
+		}
+		return buf;
+	}
+
+	/* Clamps an inclusive [start, stop] index range with negative indexes; false if it is empty */
+	static bool normalize_range(long long size, long long &start, long long &stop) {
+		if (start < 0) start += size;
+		if (stop < 0) stop += size;
+		if (start < 0) start = 0;
+		if (stop >= size) stop = size - 1;
+		return start <= stop;
+	}
+
+	/* Byte range of GETRANGE / BITCOUNT / BITPOS, with the same clamping rules as Redis */
+	static bool byte_range(long long size, long long start, long long end, size_t &first, size_t &last) {
+		if (start < 0 && end < 0 && start > end) return false;
+		if (start < 0) start += size;
+		if (end < 0) end += size;
+		if (start < 0) start = 0;
+		if (end < 0) end = 0;
+		if (end >= size) end = size - 1;
+		if (start > end || size == 0) return false;
+		first = static_cast<size_t>(start);
+		last = static_cast<size_t>(end);
+		return true;
+	}
+
+	static int popcount8(unsigned char v) {
+		v = static_cast<unsigned char>(v - ((v >> 1) & 0x55));
+		v = static_cast<unsigned char>((v & 0x33) + ((v >> 2) & 0x33));
+		return (v + (v >> 4)) & 0x0f;
+	}
+
+	static void check_bit_offset(long long offset) {
+		if (offset < 0 || (offset >> 3) >= max_string_size) {
+			throw std::runtime_error("ERR bit offset is not an integer or out of range");
+		}
+	}
+
+	static hll_sketch to_sketch(const std::string &raw) {
+		try {
+			return hll_sketch::from_redis(raw);
+		}
+		catch (const std::runtime_error &) {
+			throw std::runtime_error("WRONGTYPE Key is not a valid HyperLogLog string value.");
+		}
+	}
+
+	static std::vector<std::string> members_of(const std::vector<std::pair<std::string, double>> &entries) {
+		std::vector<std::string> result;
+		result.reserve(entries.size());
+		for (const auto &e: entries) {
+			result.push_back(e.first);
+		}
+		return result;
+	}
+
+	// ---------------------------------------------------------------------------
+	// BITFIELD
+	// ---------------------------------------------------------------------------
+
+	static std::vector<bitfield_op> parse_bitfield(const std::vector<std::string> &args) {
+		std::vector<bitfield_op> ops;
+		auto overflow = bitfield_op::wrap;
+		for (size_t i = 0; i < args.size();) {
+			std::string sub(args[i]);
+			std::transform(sub.begin(), sub.end(), sub.begin(), [](unsigned char c) { return std::toupper(c); });
+			if (sub == "OVERFLOW" && i + 1 < args.size()) {
+				std::string mode(args[i + 1]);
+				std::transform(mode.begin(), mode.end(), mode.begin(), [](unsigned char c) { return std::toupper(c); });
+				if (mode == "WRAP") overflow = bitfield_op::wrap;
+				else if (mode == "SAT") overflow = bitfield_op::sat;
+				else if (mode == "FAIL") overflow = bitfield_op::fail;
+				else throw std::runtime_error("ERR Invalid OVERFLOW type specified");
+				i += 2;
+				continue;
+			}
+
+			bitfield_op op{};
+			if (sub == "GET") {
+				op.kind = bitfield_op::get;
+			}
+			else if (sub == "SET") {
+				op.kind = bitfield_op::set;
+			}
+			else if (sub == "INCRBY") {
+				op.kind = bitfield_op::incrby;
+			}
+			else {
+				throw std::runtime_error("ERR syntax error");
+			}
+			const size_t needed = op.kind == bitfield_op::get ? 3 : 4;
+			if (i + needed > args.size()) throw std::runtime_error("ERR syntax error");
+
+			const std::string &type = args[i + 1];
+			if (type.size() < 2 || (type[0] != 'i' && type[0] != 'u' && type[0] != 'I' && type[0] != 'U')) {
+				throw std::runtime_error(bitfield_type_error);
+			}
+			op.is_signed = type[0] == 'i' || type[0] == 'I';
+			long long bits;
+			try {
+				bits = parse_integer(type.substr(1));
+			}
+			catch (const std::runtime_error &) {
+				throw std::runtime_error(bitfield_type_error);
+			}
+			if (bits < 1 || (op.is_signed && bits > 64) || (!op.is_signed && bits > 63)) {
+				throw std::runtime_error(bitfield_type_error);
+			}
+			op.bits = static_cast<unsigned>(bits);
+
+			const std::string &offset = args[i + 2];
+			long long position;
+			try {
+				position = !offset.empty() && offset[0] == '#' ? parse_integer(offset.substr(1)) * bits
+															   : parse_integer(offset);
+			}
+			catch (const std::runtime_error &) {
+				throw std::runtime_error("ERR bit offset is not an integer or out of range");
+			}
+			check_bit_offset(position);
+			op.offset = static_cast<uint64_t>(position);
+			if (op.kind != bitfield_op::get) op.value = parse_integer(args[i + 3]);
+			op.overflow = overflow;
+			ops.push_back(op);
+			i += needed;
+		}
+		return ops;
+	}
+
+	static constexpr const char *bitfield_type_error =
+		"ERR Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.";
+
+	static long long read_field(const std::string &s, const bitfield_op &op) {
+		uint64_t v = 0;
+		for (unsigned i = 0; i < op.bits; ++i) {
+			const uint64_t pos = op.offset + i;
+			const uint64_t byte = pos >> 3;
+			const uint64_t b = byte < s.size() ? (static_cast<unsigned char>(s[byte]) >> (7 - (pos & 7))) & 1 : 0;
+			v = (v << 1) | b;
+		}
+		if (op.is_signed && op.bits < 64 && (v >> (op.bits - 1)) & 1) v |= ~0ULL << op.bits;
+		return static_cast<long long>(v);
+	}
+
+	static void write_field(std::string &s, const bitfield_op &op, long long value) {
+		const uint64_t last_byte = (op.offset + op.bits - 1) >> 3;
+		if (s.size() <= last_byte) s.resize(last_byte + 1, '\0');
+		const auto v = static_cast<uint64_t>(value);
+		for (unsigned i = 0; i < op.bits; ++i) {
+			const uint64_t pos = op.offset + i;
+			const auto mask = static_cast<unsigned char>(0x80 >> (pos & 7));
+			auto &c = reinterpret_cast<unsigned char &>(s[pos >> 3]);
+			const bool bit = (v >> (op.bits - 1 - i)) & 1;
+			c = static_cast<unsigned char>(bit ? (c | mask) : (c & ~mask));
+		}
+	}
+
+	static long long field_min(const bitfield_op &op) {
+		if (!op.is_signed) return 0;
+		return op.bits == 64 ? LLONG_MIN : -(1LL << (op.bits - 1));
+	}
+
+	static long long field_max(const bitfield_op &op) {
+		if (!op.is_signed) return static_cast<long long>((1ULL << op.bits) - 1);
+		return op.bits == 64 ? LLONG_MAX : (1LL << (op.bits - 1)) - 1;
+	}
+
+	/* Truncates a value to the field width (two's complement wrap-around) */
+	static long long wrap_field(const bitfield_op &op, uint64_t v) {
+		if (op.bits == 64) return static_cast<long long>(v);
+		v &= (1ULL << op.bits) - 1;
+		if (op.is_signed && (v >> (op.bits - 1)) & 1) v |= ~0ULL << op.bits;
+		return static_cast<long long>(v);
+	}
+
+	/* Applies the overflow policy to a value written by SET; nullopt means the write is refused (FAIL) */
+	static std::optional<long long> fit_field(const bitfield_op &op, long long value) {
+		if (value >= field_min(op) && value <= field_max(op)) return value;
+		switch (op.overflow) {
+			case bitfield_op::wrap:
+				return wrap_field(op, static_cast<uint64_t>(value));
+			case bitfield_op::sat:
+				return value < field_min(op) ? field_min(op) : field_max(op);
+			default:
+				return std::nullopt;
+		}
+	}
+
+	/* Applies the overflow policy to old + increment */
+	static std::optional<long long> add_field(const bitfield_op &op, long long old, long long increment) {
+		const long long min = field_min(op);
+		const long long max = field_max(op);
+		bool overflow = false;
+		bool underflow = false;
+		if (op.is_signed) {
+			overflow = increment > 0 && old > max - increment;
+			underflow = increment < 0 && old < min - increment;
+		}
+		else {
+			const auto u_old = static_cast<uint64_t>(old);
+			const auto u_max = static_cast<uint64_t>(max);
+			if (increment >= 0) {
+				overflow = static_cast<uint64_t>(increment) > u_max - u_old;
+			}
+			else {
+				underflow = 0 - static_cast<uint64_t>(increment) > u_old;
+			}
+		}
+		if (!overflow && !underflow) return old + increment;
+		switch (op.overflow) {
+			case bitfield_op::wrap:
+				return wrap_field(op, static_cast<uint64_t>(old) + static_cast<uint64_t>(increment));
+			case bitfield_op::sat:
+				return overflow ? max : min;
+			default:
+				return std::nullopt;
+		}
+	}
+
+	// ---------------------------------------------------------------------------
+	// Raw command dispatch
+	// ---------------------------------------------------------------------------
+
+	static kv_reply status_reply(const std::string &status) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::status;
+		r.str = status;
+		return r;
+	}
+
+	static kv_reply error_reply(const std::string &message) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::error;
+		r.str = message;
+		return r;
+	}
+
+	static kv_reply integer_reply(long long value) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::integer;
+		r.integer = value;
+		return r;
+	}
+
+	static kv_reply bulk_reply(const std::string &value) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::string;
+		r.str = value;
+		return r;
+	}
+
+	static kv_reply optional_reply(const std::optional<std::string> &value) {
+		return value ? bulk_reply(*value) : kv_reply();
+	}
+
+	static kv_reply array_reply(const std::vector<std::string> &values) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::array;
+		r.elements.reserve(values.size());
+		for (const auto &v: values) {
+			r.elements.push_back(bulk_reply(v));
+		}
+		return r;
+	}
+
+	static kv_reply scored_reply(const std::vector<std::pair<std::string, double>> &entries, bool with_scores) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::array;
+		r.elements.reserve(entries.size() * (with_scores ? 2 : 1));
+		for (const auto &e: entries) {
+			r.elements.push_back(bulk_reply(e.first));
+			if (with_scores) r.elements.push_back(bulk_reply(format_double(e.second)));
+		}
+		return r;
+	}
+
+	static bool equals_ignore_case(const std::string &a, const char *b) {
+		size_t i = 0;
+		for (; i < a.size() && b[i]; ++i) {
+			if (std::toupper(static_cast<unsigned char>(a[i])) != b[i]) return false;
+		}
+		return i == a.size() && !b[i];
+	}
+
+	static std::vector<std::string> tail(const std::vector<std::string> &argv, size_t from) {
+		return std::vector<std::string>(argv.begin() + static_cast<std::ptrdiff_t>(from), argv.end());
+	}
+
+	kv_reply dispatch(const command_spec &spec, const std::vector<std::string> &argv) {
+		try {
+			return spec.handler(*this, argv);
+		}
+		catch (const std::exception &e) {
+			return error_reply(e.what());
+		}
+	}
+
+	/* Returns the spec of a known command called with a valid number of arguments */
+	static const command_spec *lookup(const std::string &name, const std::vector<std::string> &argv) {
+		const auto &table = command_table();
+		auto it = table.find(name);
+		if (it == table.end()) return nullptr;
+		const int arity = it->second.arity;
+		const auto argc = static_cast<int>(argv.size());
+		if ((arity > 0 && argc != arity) || (arity < 0 && argc < -arity)) return nullptr;
+		return &it->second;
+	}
+
+	/* The error for a command lookup() rejected */
+	static kv_reply check_command(const std::string &name, const std::vector<std::string> &argv) {
+		if (command_table().count(name) == 0) return error_reply("ERR unknown command '" + argv[0] + "'");
+		std::string lower(name);
+		std::transform(lower.begin(), lower.end(), lower.begin(), [](unsigned char c) { return std::tolower(c); });
+		return error_reply("ERR wrong number of arguments for '" + lower + "' command");
+	}
+
+	static kv_reply cmd_set(memory_connection &c, const std::vector<std::string> &a) {
+		set_condition condition = set_condition::always;
+		int64_t expire_at = 0;
+		bool keep_ttl = false;
+		bool get = false;
+		for (size_t i = 3; i < a.size(); ++i) {
+			const bool has_arg = i + 1 < a.size();
+			if (equals_ignore_case(a[i], "NX")) condition = set_condition::not_exists;
+			else if (equals_ignore_case(a[i], "XX")) condition = set_condition::exists;
+			else if (equals_ignore_case(a[i], "KEEPTTL")) keep_ttl = true;
+			else if (equals_ignore_case(a[i], "GET")) get = true;
+			else if (has_arg && (equals_ignore_case(a[i], "EX") || equals_ignore_case(a[i], "PX")
+								 || equals_ignore_case(a[i], "EXAT") || equals_ignore_case(a[i], "PXAT"))) {
+				const long long n = parse_integer(a[i + 1]);
+				if (n <= 0) throw std::runtime_error("ERR invalid expire time in 'set' command");
+				const char unit = static_cast<char>(std::toupper(static_cast<unsigned char>(a[i][0])));
+				const bool absolute = a[i].size() == 4;
+				const long long ms = unit == 'E' ? n * 1000 : n;
+				expire_at = absolute ? ms : now_ms() + ms;
+				++i;
+			}
+			else {
+				throw std::runtime_error("ERR syntax error");
+			}
+		}
+		std::optional<std::string> old;
+		const bool done = c.set_string(a[1], a[2], condition, expire_at, keep_ttl, get ? &old : nullptr);
+		if (get) return optional_reply(old);
+		return done ? status_reply("OK") : kv_reply();
+	}
+
+	static kv_reply cmd_expire(memory_connection &c, const std::vector<std::string> &a, long long unit, bool absolute) {
+		const long long n = parse_integer(a[2]);
+		return integer_reply(c.expire_at(a[1], (absolute ? 0 : now_ms()) + n * unit) ? 1 : 0);
+	}
+
+	static kv_reply cmd_zrange(memory_connection &c, const std::vector<std::string> &a, bool reverse) {
+		bool with_scores = false;
+		for (size_t i = 4; i < a.size(); ++i) {
+			if (!equals_ignore_case(a[i], "WITHSCORES")) throw std::runtime_error("ERR syntax error");
+			with_scores = true;
+		}
+		const long long start = parse_integer(a[2]);
+		const long long stop = parse_integer(a[3]);
+		auto entries = reverse ? c.zrevrange_withscores(a[1], start, stop) : c.zrange_withscores(a[1], start, stop);
+		return scored_reply(entries, with_scores);
+	}
+
+	static kv_reply cmd_zrangebyscore(memory_connection &c, const std::vector<std::string> &a) {
+		bool with_scores = false;
+		long long offset = 0;
+		long long count = -1;
+		for (size_t i = 4; i < a.size(); ++i) {
+			if (equals_ignore_case(a[i], "WITHSCORES")) {
+				with_scores = true;
+			}
+			else if (equals_ignore_case(a[i], "LIMIT") && i + 2 < a.size()) {
+				offset = parse_integer(a[i + 1]);
+				count = parse_integer(a[i + 2]);
+				i += 2;
+			}
+			else {
+				throw std::runtime_error("ERR syntax error");
+			}
+		}
+		auto entries = c.zrangebyscore(a[1], parse_score_bound(a[2]), parse_score_bound(a[3]));
+		if (offset < 0 || offset >= static_cast<long long>(entries.size())) {
+			entries.clear();
+		}
+		else {
+			entries.erase(entries.begin(), entries.begin() + offset);
+			if (count >= 0 && count < static_cast<long long>(entries.size())) {
+				entries.resize(static_cast<size_t>(count));
+			}
+		}
+		return scored_reply(entries, with_scores);
+	}
+
+	static kv_reply cmd_zadd(memory_connection &c, const std::vector<std::string> &a) {
+		zadd_flags flags;
+		size_t i = 2;
+		for (; i < a.size(); ++i) {
+			if (equals_ignore_case(a[i], "NX")) flags.nx = true;
+			else if (equals_ignore_case(a[i], "XX")) flags.xx = true;
+			else if (equals_ignore_case(a[i], "CH")) flags.ch = true;
+			else break;
+		}
+		if (flags.nx && flags.xx) {
+			throw std::runtime_error("ERR XX and NX options at the same time are not compatible");
+		}
+		if (i == a.size() || (a.size() - i) % 2 != 0) throw std::runtime_error("ERR syntax error");
+		std::vector<std::pair<double, std::string>> entries;
+		for (; i < a.size(); i += 2) {
+			entries.emplace_back(parse_double(a[i]), a[i + 1]);
+		}
+		return integer_reply(c.zadd(a[1], entries, flags));
+	}
+
+	static kv_reply cmd_bitfield(memory_connection &c, const std::vector<std::string> &a) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::array;
+		for (const auto &v: c.bitfield(a[1], tail(a, 2))) {
+			r.elements.push_back(v ? integer_reply(*v) : kv_reply());
+		}
+		return r;
+	}
+
+	static const std::unordered_map<std::string, command_spec> &command_table() {
+		using args = std::vector<std::string>;
+		using self = memory_connection;
+		static const std::unordered_map<std::string, command_spec> table = {
+			// Keys and server
+			{"PING", {[](self &, const args &a) { return a.size() > 1 ? bulk_reply(a[1]) : status_reply("PONG"); },
+					  -1}},
+			{"ECHO", {[](self &, const args &a) { return bulk_reply(a[1]); }, 2}},
+			{"DBSIZE", {[](self &c, const args &) { return integer_reply(static_cast<long long>(c.dbsize())); }, 1}},
+			{"FLUSHALL", {[](self &c, const args &) { return c.flushall(), status_reply("OK"); }, -1}},
+			{"FLUSHDB", {[](self &c, const args &) { return c.flushall(), status_reply("OK"); }, -1}},
+			{"TYPE", {[](self &c, const args &a) { return status_reply(c.type(a[1])); }, 2}},
+			{"EXISTS", {[](self &c, const args &a) {
+							long long n = 0;
+							for (size_t i = 1; i < a.size(); ++i) {
+								n += c.exists(a[i]) ? 1 : 0;
+							}
+							return integer_reply(n);
+						},
+						-2}},
+			{"DEL", {[](self &c, const args &a) { return integer_reply(c.del(tail(a, 1))); }, -2}},
+			{"UNLINK", {[](self &c, const args &a) { return integer_reply(c.del(tail(a, 1))); }, -2}},
+			{"EXPIRE", {[](self &c, const args &a) { return cmd_expire(c, a, 1000, false); }, 3}},
+			{"PEXPIRE", {[](self &c, const args &a) { return cmd_expire(c, a, 1, false); }, 3}},
+			{"EXPIREAT", {[](self &c, const args &a) { return cmd_expire(c, a, 1000, true); }, 3}},
+			{"PEXPIREAT", {[](self &c, const args &a) { return cmd_expire(c, a, 1, true); }, 3}},
+			{"TTL", {[](self &c, const args &a) { return integer_reply(c.ttl(a[1])); }, 2}},
+			{"PTTL", {[](self &c, const args &a) { return integer_reply(c.pttl(a[1])); }, 2}},
+			{"PERSIST", {[](self &c, const args &a) { return integer_reply(c.persist(a[1]) ? 1 : 0); }, 2}},
+			// String
+			{"SET", {cmd_set, -3}},
+			{"SETNX", {[](self &c, const args &a) { return integer_reply(c.set_not_exists(a[1], a[2]) ? 1 : 0); }, 3}},
+			{"SETEX", {[](self &c, const args &a) {
+						   return c.set_ex(a[1], a[3], static_cast<int>(parse_integer(a[2]))), status_reply("OK");
+					   },
+					   4}},
+			{"PSETEX", {[](self &c, const args &a) {
+							return c.set_px(a[1], a[3], static_cast<int>(parse_integer(a[2]))), status_reply("OK");
+						},
+						4}},
+			{"GET", {[](self &c, const args &a) { return optional_reply(c.get(a[1])); }, 2}},
+			{"GETSET", {[](self &c, const args &a) { return optional_reply(c.getset(a[1], a[2])); }, 3}},
+			{"MGET", {[](self &c, const args &a) {
+						  kv_reply r;
+						  r.type = kv_reply::reply_type::array;
+						  for (size_t i = 1; i < a.size(); ++i) {
+							  try {
+								  r.elements.push_back(optional_reply(c.get(a[i])));
+							  }
+							  catch (const std::runtime_error &) {
+								  // MGET reports keys of another type as missing
+								  r.elements.emplace_back();
+							  }
+						  }
+						  return r;
+					  },
+					  -2}},
+			{"MSET", {[](self &c, const args &a) {
+						  if (a.size() % 2 == 0) {
+							  throw std::runtime_error("ERR wrong number of arguments for 'mset' command");
+						  }
+						  std::vector<std::string> keys;
+						  for (size_t i = 1; i < a.size(); i += 2) {
+							  keys.push_back(a[i]);
+						  }
+						  write_scope scope(c, keys);
+						  for (size_t i = 1; i < a.size(); i += 2) {
+							  c.store_string(a[i], a[i + 1], set_condition::always, 0, false, nullptr);
+						  }
+						  return status_reply("OK");
+					  },
+					  -3}},
+			{"INCR", {[](self &c, const args &a) { return integer_reply(c.incr(a[1], 1)); }, 2}},
+			{"DECR", {[](self &c, const args &a) { return integer_reply(c.decr(a[1], 1)); }, 2}},
+			{"INCRBY", {[](self &c, const args &a) { return integer_reply(c.incr(a[1], parse_integer(a[2]))); }, 3}},
+			{"DECRBY", {[](self &c, const args &a) { return integer_reply(c.decr(a[1], parse_integer(a[2]))); }, 3}},
+			{"INCRBYFLOAT",
+			 {[](self &c, const args &a) { return bulk_reply(format_double(c.incr_float(a[1], parse_double(a[2])))); },
+			  3}},
+			{"APPEND", {[](self &c, const args &a) { return integer_reply(c.append(a[1], a[2])); }, 3}},
+			{"STRLEN", {[](self &c, const args &a) {
+							auto lock = c.lock_shard<read_lock>(a[1]);
+							const auto *s = c.read_value<std::string>(a[1], now_ms());
+							return integer_reply(s ? static_cast<long long>(s->size()) : 0);
+						},
+						2}},
+			{"GETRANGE", {[](self &c, const args &a) {
+							  return bulk_reply(c.getrange(a[1], parse_integer(a[2]), parse_integer(a[3])));
+						  },
+						  4}},
+			{"SETRANGE",
+			 {[](self &c, const args &a) { return integer_reply(c.setrange(a[1], parse_integer(a[2]), a[3])); }, 4}},
+			// Hash
+			{"HSET", {[](self &c, const args &a) {
+						  if (a.size() % 2 != 0) {
+							  throw std::runtime_error("ERR wrong number of arguments for 'hset' command");
+						  }
+						  write_scope scope(c, a[1]);
+						  auto *h = c.write_value<compact_hash>(a[1], now_ms(), true);
+						  long long added = 0;
+						  for (size_t i = 2; i < a.size(); i += 2) {
+							  if (h->set(a[i], a[i + 1])) ++added;
+						  }
+						  return integer_reply(added);
+					  },
+					  -4}},
+			{"HMSET", {[](self &c, const args &a) {
+						   if (a.size() % 2 != 0) {
+							   throw std::runtime_error("ERR wrong number of arguments for 'hmset' command");
+						   }
+						   write_scope scope(c, a[1]);
+						   auto *h = c.write_value<compact_hash>(a[1], now_ms(), true);
+						   for (size_t i = 2; i < a.size(); i += 2) {
+							   h->set(a[i], a[i + 1]);
+						   }
+						   return status_reply("OK");
+					   },
+					   -4}},
+			{"HSETNX", {[](self &c, const args &a) {
+							write_scope scope(c, a[1]);
+							auto *h = c.write_value<compact_hash>(a[1], now_ms(), true);
+							if (h->find(a[2])) return integer_reply(0);
+							h->set(a[2], a[3]);
+							return integer_reply(1);
+						},
+						4}},
+			{"HGET", {[](self &c, const args &a) { return optional_reply(c.hget(a[1], a[2])); }, 3}},
+			{"HMGET", {[](self &c, const args &a) {
+						   kv_reply r;
+						   r.type = kv_reply::reply_type::array;
+						   for (size_t i = 2; i < a.size(); ++i) {
+							   r.elements.push_back(optional_reply(c.hget(a[1], a[i])));
+						   }
+						   return r;
+					   },
+					   -3}},
+			{"HGETALL", {[](self &c, const args &a) {
+							 std::vector<std::string> flat;
+							 for (const auto &kv: c.hgetall(a[1])) {
+								 flat.push_back(kv.first);
+								 flat.push_back(kv.second);
+							 }
+							 return array_reply(flat);
+						 },
+						 2}},
+			{"HKEYS", {[](self &c, const args &a) { return array_reply(c.hkeys(a[1])); }, 2}},
+			{"HVALS", {[](self &c, const args &a) { return array_reply(c.hvals(a[1])); }, 2}},
+			{"HDEL", {[](self &c, const args &a) { return integer_reply(c.hdel(a[1], tail(a, 2))); }, -3}},
+			{"HLEN", {[](self &c, const args &a) {
+						  auto lock = c.lock_shard<read_lock>(a[1]);
+						  const auto *h = c.read_value<compact_hash>(a[1], now_ms());
+						  return integer_reply(h ? static_cast<long long>(h->size()) : 0);
+					  },
+					  2}},
+			{"HEXISTS", {[](self &c, const args &a) { return integer_reply(c.hget(a[1], a[2]) ? 1 : 0); }, 3}},
+			{"HINCRBY",
+			 {[](self &c, const args &a) { return integer_reply(c.hincrby(a[1], a[2], parse_integer(a[3]))); }, 4}},
+			{"HINCRBYFLOAT", {[](self &c, const args &a) {
+								  return bulk_reply(format_double(c.hincrbyfloat(a[1], a[2], parse_double(a[3]))));
+							  },
+							  4}},
+			// List
+			{"LPUSH", {[](self &c, const args &a) { return integer_reply(c.lpush(a[1], tail(a, 2))); }, -3}},
+			{"RPUSH", {[](self &c, const args &a) { return integer_reply(c.rpush(a[1], tail(a, 2))); }, -3}},
+			{"LPOP", {[](self &c, const args &a) { return optional_reply(c.lpop(a[1])); }, 2}},
+			{"RPOP", {[](self &c, const args &a) { return optional_reply(c.rpop(a[1])); }, 2}},
+			{"LRANGE", {[](self &c, const args &a) {
+							return array_reply(c.lrange(a[1], parse_integer(a[2]), parse_integer(a[3])));
+						},
+						4}},
+			{"LLEN", {[](self &c, const args &a) { return integer_reply(c.llen(a[1])); }, 2}},
+			{"LINDEX", {[](self &c, const args &a) { return optional_reply(c.lindex(a[1], parse_integer(a[2]))); }, 3}},
+			{"LSET",
+			 {[](self &c, const args &a) { return c.lset(a[1], parse_integer(a[2]), a[3]), status_reply("OK"); }, 4}},
+			{"LTRIM", {[](self &c, const args &a) {
+						   return c.ltrim(a[1], parse_integer(a[2]), parse_integer(a[3])), status_reply("OK");
+					   },
+					   4}},
+			// Set
+			{"SADD", {[](self &c, const args &a) { return integer_reply(c.sadd(a[1], tail(a, 2))); }, -3}},
+			{"SREM", {[](self &c, const args &a) { return integer_reply(c.srem(a[1], tail(a, 2))); }, -3}},
+			{"SMEMBERS", {[](self &c, const args &a) { return array_reply(c.smembers(a[1])); }, 2}},
+			{"SCARD", {[](self &c, const args &a) { return integer_reply(c.scard(a[1])); }, 2}},
+			{"SISMEMBER", {[](self &c, const args &a) { return integer_reply(c.sismember(a[1], a[2]) ? 1 : 0); }, 3}},
+			{"SPOP", {[](self &c, const args &a) { return optional_reply(c.spop(a[1])); }, 2}},
+			{"SINTER", {[](self &c, const args &a) { return array_reply(c.sinter(tail(a, 1))); }, -2}},
+			{"SUNION", {[](self &c, const args &a) { return array_reply(c.sunion(tail(a, 1))); }, -2}},
+			{"SDIFF", {[](self &c, const args &a) { return array_reply(c.sdiff(tail(a, 1))); }, -2}},
+			// Sorted set
+			{"ZADD", {cmd_zadd, -4}},
+			{"ZREM", {[](self &c, const args &a) { return integer_reply(c.zrem(a[1], tail(a, 2))); }, -3}},
+			{"ZSCORE", {[](self &c, const args &a) {
+							auto s = c.zscore(a[1], a[2]);
+							return s ? bulk_reply(format_double(*s)) : kv_reply();
+						},
+						3}},
+			{"ZINCRBY", {[](self &c, const args &a) {
+							 return bulk_reply(format_double(c.zincrby(a[1], parse_double(a[2]), a[3])));
+						 },
+						 4}},
+			{"ZCARD", {[](self &c, const args &a) { return integer_reply(c.zcard(a[1])); }, 2}},
+			{"ZRANK", {[](self &c, const args &a) {
+						   auto r = c.zrank(a[1], a[2]);
+						   return r ? integer_reply(*r) : kv_reply();
+					   },
+					   3}},
+			{"ZREVRANK", {[](self &c, const args &a) {
+							  auto r = c.zrank(a[1], a[2], true);
+							  return r ? integer_reply(*r) : kv_reply();
+						  },
+						  3}},
+			{"ZCOUNT", {[](self &c, const args &a) {
+							auto entries = c.zrangebyscore(a[1], parse_score_bound(a[2]), parse_score_bound(a[3]));
+							return integer_reply(static_cast<long long>(entries.size()));
+						},
+						4}},
+			{"ZRANGE", {[](self &c, const args &a) { return cmd_zrange(c, a, false); }, -4}},
+			{"ZREVRANGE", {[](self &c, const args &a) { return cmd_zrange(c, a, true); }, -4}},
+			{"ZRANGEBYSCORE", {cmd_zrangebyscore, -4}},
+			{"ZREMRANGEBYSCORE", {[](self &c, const args &a) {
+									  return integer_reply(
+										  c.zremrangebyscore(a[1], parse_score_bound(a[2]), parse_score_bound(a[3])));
+								  },
+								  4}},
+			// HyperLogLog
+			{"PFADD", {[](self &c, const args &a) { return integer_reply(c.pfadd(a[1], tail(a, 2)) ? 1 : 0); }, -2}},
+			{"PFCOUNT", {[](self &c, const args &a) { return integer_reply(c.pfcount(tail(a, 1))); }, -2}},
+			{"PFMERGE", {[](self &c, const args &a) { return c.pfmerge(a[1], tail(a, 2)), status_reply("OK"); }, -2}},
+			// Bitmap
+			{"SETBIT", {[](self &c, const args &a) {
+							const long long bit = parse_integer(a[3]);
+							if (bit != 0 && bit != 1) {
+								throw std::runtime_error("ERR bit is not an integer or out of range");
+							}
+							return integer_reply(c.setbit(a[1], parse_integer(a[2]), bit == 1) ? 1 : 0);
+						},
+						4}},
+			{"GETBIT",
+			 {[](self &c, const args &a) { return integer_reply(c.getbit(a[1], parse_integer(a[2])) ? 1 : 0); }, 3}},
+			{"BITCOUNT", {[](self &c, const args &a) {
+							  if (a.size() == 2) return integer_reply(c.bitcount(a[1], 0, -1));
+							  if (a.size() != 4) throw std::runtime_error("ERR syntax error");
+							  return integer_reply(c.bitcount(a[1], parse_integer(a[2]), parse_integer(a[3])));
+						  },
+						  -2}},
+			{"BITPOS", {[](self &c, const args &a) {
+							const long long bit = parse_integer(a[2]);
+							if (bit != 0 && bit != 1) throw std::runtime_error("ERR The bit argument must be 1 or 0.");
+							const long long start = a.size() > 3 ? parse_integer(a[3]) : 0;
+							const long long end = a.size() > 4 ? parse_integer(a[4]) : -1;
+							return integer_reply(c.bitpos(a[1], bit == 1, start, end, a.size() > 4));
+						},
+						-3}},
+			{"BITOP", {[](self &c, const args &a) { return integer_reply(c.bitop(a[1], a[2], tail(a, 3))); }, -4}},
+			{"BITFIELD", {cmd_bitfield, -2}},
+		};
+		return table;
+	}
+
+	memory_connection_options options;
+	std::vector<std::unique_ptr<shard>> shards;
+	std::atomic<uint64_t> version_counter{0};
+	bool observed{false};
+
+	std::mutex sessions_mutex;
+	std::unordered_map<std::thread::id, session> sessions;
+	std::atomic<size_t> active_sessions{0};
+	/* The connection whose EXEC the current thread is running, if any */
+	static inline thread_local const memory_connection *exec_owner = nullptr;
+
+	std::mutex expire_mutex;
+	std::condition_variable expire_cv;
+	bool stopping{false};
+	std::thread expire_thread;
+};
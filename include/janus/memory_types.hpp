@@ -0,0 +1,382 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <deque>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#include "skiplist.hpp"
+
+/**
+ * @brief Size limits below which collections use a compact flat encoding, like Redis' listpack thresholds
+ * (hash-max-listpack-entries / -value, set-max-listpack-entries, zset-max-listpack-entries / -value).
+ */
+struct compact_limits {
+	size_t max_entries{128};
+	size_t max_value{64};
+};
+
+/**
+ * @brief A hash that stores up to a few entries in a flat vector (cache-friendly linear scan) and converts to a hash
+ * table once it grows beyond the compact limits. The conversion is one-way, as in Redis.
+ */
+class compact_hash {
+public:
+	explicit compact_hash(const compact_limits &limits = {}) : limits(limits) {
+	}
+
+	[[nodiscard]] const std::string *find(const std::string &field) const {
+		if (compact) {
+			for (const auto &e: entries) {
+				if (e.first == field) return &e.second;
+			}
+			return nullptr;
+		}
+		auto it = table.find(field);
+		return it == table.end() ? nullptr : &it->second;
+	}
+
+	std::string *find(const std::string &field) {
+		return const_cast<std::string *>(static_cast<const compact_hash *>(this)->find(field));
+	}
+
+	/**
+	 * @brief Sets a field.
+	 * @return True if the field is new.
+	 */
+	bool set(const std::string &field, std::string value) {
+		if (std::string *existing = find(field)) {
+			*existing = std::move(value);
+			if (compact && existing->size() > limits.max_value) convert();
+			return false;
+		}
+		if (compact) {
+			entries.emplace_back(field, std::move(value));
+			if (entries.size() > limits.max_entries || field.size() > limits.max_value
+				|| entries.back().second.size() > limits.max_value) {
+				convert();
+			}
+		}
+		else {
+			table.emplace(field, std::move(value));
+		}
+		return true;
+	}
+
+	bool erase(const std::string &field) {
+		if (!compact) return table.erase(field) > 0;
+		for (auto it = entries.begin(); it != entries.end(); ++it) {
+			if (it->first == field) {
+				entries.erase(it);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	[[nodiscard]] size_t size() const {
+		return compact ? entries.size() : table.size();
+	}
+
+	[[nodiscard]] bool is_compact() const {
+		return compact;
+	}
+
+	/* Calls f(field, value) for every entry */
+	template<typename F>
+	void for_each(F &&f) const {
+		if (compact) {
+			for (const auto &e: entries) {
+				f(e.first, e.second);
+			}
+		}
+		else {
+			for (const auto &e: table) {
+				f(e.first, e.second);
+			}
+		}
+	}
+
+private:
+	void convert() {
+		table.reserve(entries.size() * 2);
+		for (auto &e: entries) {
+			table.emplace(std::move(e.first), std::move(e.second));
+		}
+		entries = std::vector<std::pair<std::string, std::string>>();
+		compact = false;
+	}
+
+	compact_limits limits;
+	bool compact{true};
+	std::vector<std::pair<std::string, std::string>> entries;
+	std::unordered_map<std::string, std::string> table;
+};
+
+/**
+ * @brief A set stored as a flat vector while small and as a hash set beyond the compact limits.
+ */
+class compact_set {
+public:
+	explicit compact_set(const compact_limits &limits = {}) : limits(limits) {
+	}
+
+	[[nodiscard]] bool contains(const std::string &member) const {
+		if (compact) return std::find(members.begin(), members.end(), member) != members.end();
+		return table.count(member) > 0;
+	}
+
+	/**
+	 * @brief Adds a member.
+	 * @return True if the member is new.
+	 */
+	bool add(const std::string &member) {
+		if (!compact) return table.insert(member).second;
+		if (contains(member)) return false;
+		members.push_back(member);
+		if (members.size() > limits.max_entries || member.size() > limits.max_value) convert();
+		return true;
+	}
+
+	bool erase(const std::string &member) {
+		if (!compact) return table.erase(member) > 0;
+		auto it = std::find(members.begin(), members.end(), member);
+		if (it == members.end()) return false;
+		// Order is irrelevant in a set: swap with the last element to erase in O(1)
+		std::swap(*it, members.back());
+		members.pop_back();
+		return true;
+	}
+
+	/**
+	 * @brief Removes and returns an arbitrary member; the set must not be empty.
+	 */
+	std::string pop() {
+		std::string member;
+		if (compact) {
+			member = std::move(members.back());
+			members.pop_back();
+		}
+		else {
+			auto node = table.extract(table.begin());
+			member = std::move(node.value());
+		}
+		return member;
+	}
+
+	[[nodiscard]] size_t size() const {
+		return compact ? members.size() : table.size();
+	}
+
+	[[nodiscard]] bool is_compact() const {
+		return compact;
+	}
+
+	template<typename F>
+	void for_each(F &&f) const {
+		if (compact) {
+			for (const auto &m: members) {
+				f(m);
+			}
+		}
+		else {
+			for (const auto &m: table) {
+				f(m);
+			}
+		}
+	}
+
+private:
+	void convert() {
+		table.reserve(members.size() * 2);
+		for (auto &m: members) {
+			table.insert(std::move(m));
+		}
+		members = std::vector<std::string>();
+		compact = false;
+	}
+
+	compact_limits limits;
+	bool compact{true};
+	std::vector<std::string> members;
+	std::unordered_set<std::string> table;
+};
+
+/**
+ * @brief A sorted set stored as a sorted vector of (score, member) while small, and as a skiplist plus a
+ * member -> score dictionary beyond the compact limits (the Redis zset encoding).
+ */
+class compact_zset {
+public:
+	explicit compact_zset(const compact_limits &limits = {}) : limits(limits) {
+	}
+
+	[[nodiscard]] std::optional<double> score(const std::string &member) const {
+		if (compact) {
+			for (const auto &e: entries) {
+				if (e.second == member) return e.first;
+			}
+			return std::nullopt;
+		}
+		auto it = dict.find(member);
+		if (it == dict.end()) return std::nullopt;
+		return it->second;
+	}
+
+	/**
+	 * @brief Adds a member or updates its score.
+	 * @return True if the member is new.
+	 */
+	bool add(const std::string &member, double value) {
+		std::optional<double> old = score(member);
+		if (old && *old == value) return false;
+		if (old) erase_entry(*old, member);
+		insert_entry(value, member);
+		return !old.has_value();
+	}
+
+	bool erase(const std::string &member) {
+		std::optional<double> old = score(member);
+		if (!old) return false;
+		erase_entry(*old, member);
+		return true;
+	}
+
+	[[nodiscard]] size_t size() const {
+		return compact ? entries.size() : list.size();
+	}
+
+	[[nodiscard]] bool is_compact() const {
+		return compact;
+	}
+
+	/**
+	 * @brief Returns the 0-based rank of a member, lowest score first.
+	 */
+	[[nodiscard]] std::optional<long long> rank(const std::string &member) const {
+		std::optional<double> s = score(member);
+		if (!s) return std::nullopt;
+		if (!compact) return list.rank(*s, member);
+		auto it = std::lower_bound(entries.begin(), entries.end(), std::make_pair(*s, member));
+		return static_cast<long long>(it - entries.begin());
+	}
+
+	/**
+	 * @brief Returns the entries with ranks in [start, stop] (already normalized, 0 <= start <= stop < size()).
+	 */
+	[[nodiscard]] std::vector<std::pair<std::string, double>> range_by_rank(size_t start, size_t stop) const {
+		std::vector<std::pair<std::string, double>> result;
+		result.reserve(stop - start + 1);
+		if (compact) {
+			for (size_t i = start; i <= stop; ++i) {
+				result.emplace_back(entries[i].second, entries[i].first);
+			}
+			return result;
+		}
+		const auto *n = list.at(start);
+		for (size_t i = start; i <= stop && n; ++i, n = n->next()) {
+			result.emplace_back(n->member, n->score);
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Returns the entries with a score in [min, max], lowest first.
+	 */
+	[[nodiscard]] std::vector<std::pair<std::string, double>> range_by_score(double min, double max) const {
+		std::vector<std::pair<std::string, double>> result;
+		if (compact) {
+			for (const auto &e: entries) {
+				if (e.first > max) break;
+				if (e.first >= min) result.emplace_back(e.second, e.first);
+			}
+			return result;
+		}
+		for (const auto *n = list.lower_bound(min); n && n->score <= max; n = n->next()) {
+			result.emplace_back(n->member, n->score);
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Removes the entries with a score in [min, max].
+	 * @return The number of removed entries.
+	 */
+	size_t remove_range_by_score(double min, double max) {
+		auto victims = range_by_score(min, max);
+		for (const auto &v: victims) {
+			erase_entry(v.second, v.first);
+		}
+		return victims.size();
+	}
+
+	template<typename F>
+	void for_each(F &&f) const {
+		if (compact) {
+			for (const auto &e: entries) {
+				f(e.second, e.first);
+			}
+			return;
+		}
+		for (const auto *n = list.front(); n; n = n->next()) {
+			f(n->member, n->score);
+		}
+	}
+
+private:
+	void insert_entry(double value, const std::string &member) {
+		if (!compact) {
+			list.insert(value, member);
+			dict[member] = value;
+			return;
+		}
+		auto entry = std::make_pair(value, member);
+		entries.insert(std::upper_bound(entries.begin(), entries.end(), entry), entry);
+		if (entries.size() > limits.max_entries || member.size() > limits.max_value) convert();
+	}
+
+	void erase_entry(double value, const std::string &member) {
+		if (!compact) {
+			list.erase(value, member);
+			dict.erase(member);
+			return;
+		}
+		auto it = std::lower_bound(entries.begin(), entries.end(), std::make_pair(value, member));
+		if (it != entries.end() && it->second == member) entries.erase(it);
+	}
+
+	void convert() {
+		dict.reserve(entries.size() * 2);
+		for (const auto &e: entries) {
+			list.insert(e.first, e.second);
+			dict.emplace(e.second, e.first);
+		}
+		entries = std::vector<std::pair<double, std::string>>();
+		compact = false;
+	}
+
+	compact_limits limits;
+	bool compact{true};
+	std::vector<std::pair<double, std::string>> entries;
+	order_statistic_skiplist list;
+	std::unordered_map<std::string, double> dict;
+};
+
+/**
+ * @brief The value of a key in an in-process store: one of the Redis data types.
+ */
+using memory_value = std::variant<std::string, compact_hash, std::deque<std::string>, compact_set, compact_zset>;
+
+/**
+ * @brief The Redis type name of a value (as returned by TYPE).
+ */
+inline const char *memory_type_name(const memory_value &value) {
+	static const char *const names[] = {"string", "hash", "list", "set", "zset"};
+	return names[value.index()];
+}
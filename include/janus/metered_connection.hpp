@@ -0,0 +1,62 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "metrics.hpp"
+#include "observed_connection.hpp"
+
+/**
+ * @brief An observer recording every call into a metrics_registry: latency, payload bytes, reply elements and
+ * failures by command name. Calls that throw count as errors, and so do error replies of evalsha() and pipeline().
+ * Pipelines are recorded as one "PIPELINE" call, and their size in the gauges "pipeline_depth" (the last one) and
+ * "pipeline_depth_max".
+ */
+class metrics_observer {
+public:
+	/**
+	 * @param registry Where to record; it must outlive the observer.
+	 */
+	explicit metrics_observer(metrics_registry &registry = metrics_registry::global()) :
+		registry(&registry), pipeline_depth(&registry.gauge("pipeline_depth")),
+		pipeline_depth_max(&registry.gauge("pipeline_depth_max")),
+		pipeline_id(metrics_registry::command_id("PIPELINE")) {
+	}
+
+	bool active() const {
+		return registry->enabled();
+	}
+
+	void after_reply(const command_event &event) {
+		if (event.command_id == pipeline_id) {
+			pipeline_depth->set(static_cast<int64_t>(event.batch));
+			pipeline_depth_max->raise(static_cast<int64_t>(event.batch));
+		}
+		registry->record(event.command_id, static_cast<uint64_t>(event.duration.count()), event.bytes_sent,
+						 event.bytes_received, event.elements, (event.error ? 1 : 0) + event.error_replies);
+	}
+
+private:
+	metrics_registry *registry;
+	metrics_gauge *pipeline_depth;
+	metrics_gauge *pipeline_depth_max;
+	size_t pipeline_id;
+};
+
+/**
+ * @brief A kv_connection recording every call into a metrics_registry; see metrics_observer. When the registry is
+ * disabled each call costs one relaxed load, and nothing with JANUS_DISABLE_METRICS.
+ */
+class metered_connection: public observed_connection<metrics_observer> {
+public:
+	/**
+	 * @param target The connection to measure.
+	 * @param registry Where to record; it must outlive the connection.
+	 */
+	explicit metered_connection(std::shared_ptr<kv_connection> target,
+								metrics_registry &registry = metrics_registry::global()) :
+		observed_connection(std::move(target), metrics_observer(registry)) {
+	}
+};
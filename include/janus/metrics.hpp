@@ -0,0 +1,444 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A latency histogram with HDR-style log-linear buckets: values below 16 have their own bucket, and each
+ * power of two above is split in 16 linear sub-buckets, so a value is known within 1/16 (6.25%) of itself at any
+ * magnitude. Values are nanoseconds and saturate at 2^40 ns (about 18 minutes).
+ */
+class latency_histogram {
+public:
+	static constexpr int sub_bucket_bits = 4;
+	static constexpr uint64_t sub_buckets = 1u << sub_bucket_bits;
+	static constexpr int max_bits = 40;
+	static constexpr size_t bucket_count = (max_bits - sub_bucket_bits + 1) * sub_buckets;
+
+	static size_t bucket_of(uint64_t value) {
+		value = std::min<uint64_t>(value, (uint64_t{1} << max_bits) - 1);
+		if (value < sub_buckets) return static_cast<size_t>(value);
+		const int msb = 63 - __builtin_clzll(value);
+		const int shift = msb - sub_bucket_bits;
+		return static_cast<size_t>((shift + 1) * sub_buckets + ((value >> shift) - sub_buckets));
+	}
+
+	/* The smallest value of a bucket */
+	static uint64_t lower_bound(size_t bucket) {
+		const size_t group = bucket / sub_buckets;
+		const uint64_t offset = bucket % sub_buckets;
+		return group == 0 ? offset : (sub_buckets + offset) << (group - 1);
+	}
+
+	/* The largest value of a bucket */
+	static uint64_t upper_bound(size_t bucket) {
+		return bucket + 1 < bucket_count ? lower_bound(bucket + 1) - 1 : (uint64_t{1} << max_bits) - 1;
+	}
+
+	latency_histogram() : counts(bucket_count, 0) {
+	}
+
+	void record(uint64_t value, uint64_t times = 1) {
+		counts[bucket_of(value)] += times;
+		total += times;
+		sum += value * times;
+		max_value = std::max(max_value, value);
+		min_value = std::min(min_value, value);
+	}
+
+	void merge(const latency_histogram &other) {
+		for (size_t i = 0; i < bucket_count; ++i) {
+			counts[i] += other.counts[i];
+		}
+		total += other.total;
+		sum += other.sum;
+		max_value = std::max(max_value, other.max_value);
+		min_value = std::min(min_value, other.min_value);
+	}
+
+	/**
+	 * @param quantile Between 0 and 1, e.g. 0.99.
+	 * @return The upper bound of the bucket holding the quantile, capped by the largest value recorded; 0 if empty.
+	 */
+	uint64_t percentile(double quantile) const {
+		if (total == 0) return 0;
+		const auto rank = static_cast<uint64_t>(std::max(1.0, quantile * static_cast<double>(total) + 0.5));
+		uint64_t seen = 0;
+		for (size_t i = 0; i < bucket_count; ++i) {
+			seen += counts[i];
+			if (seen >= rank) return std::min(upper_bound(i), max_value);
+		}
+		return max_value;
+	}
+
+	uint64_t count() const {
+		return total;
+	}
+
+	uint64_t total_value() const {
+		return sum;
+	}
+
+	uint64_t max() const {
+		return max_value;
+	}
+
+	uint64_t min() const {
+		return total == 0 ? 0 : min_value;
+	}
+
+	double mean() const {
+		return total == 0 ? 0.0 : static_cast<double>(sum) / static_cast<double>(total);
+	}
+
+	/**
+	 * @brief Returns the histogram of the values multiplied by a factor, e.g. to convert clock ticks to nanoseconds.
+	 * Each bucket moves as a whole, from its middle value.
+	 */
+	latency_histogram scaled(double factor) const {
+		latency_histogram result;
+		for (size_t i = 0; i < bucket_count; ++i) {
+			if (counts[i] == 0) continue;
+			const double middle = static_cast<double>(lower_bound(i) + upper_bound(i)) / 2.0;
+			result.counts[bucket_of(static_cast<uint64_t>(middle * factor))] += counts[i];
+		}
+		result.total = total;
+		result.sum = static_cast<uint64_t>(static_cast<double>(sum) * factor);
+		result.max_value = static_cast<uint64_t>(static_cast<double>(max_value) * factor);
+		result.min_value = total == 0 ? UINT64_MAX : static_cast<uint64_t>(static_cast<double>(min_value) * factor);
+		return result;
+	}
+
+	/* The count of each bucket; see lower_bound() and upper_bound() */
+	const std::vector<uint64_t> &buckets() const {
+		return counts;
+	}
+
+private:
+	friend class metrics_registry;
+
+	std::vector<uint64_t> counts;
+	uint64_t total{0};
+	uint64_t sum{0};
+	uint64_t max_value{0};
+	uint64_t min_value{UINT64_MAX};
+};
+
+/**
+ * @brief The totals of one command type.
+ */
+struct command_stats {
+	uint64_t ops{0};
+	uint64_t errors{0};
+	/* Bytes of the keys, values and arguments sent, and of the values received (RESP framing excluded) */
+	uint64_t bytes_sent{0};
+	uint64_t bytes_received{0};
+	/* Elements of multi-element replies (list items, hash fields, pipeline replies, ...) */
+	uint64_t elements{0};
+	/* Call latency in nanoseconds */
+	latency_histogram latency;
+};
+
+/**
+ * @brief A consistent-enough copy of every metric, taken by metrics_registry::snapshot().
+ */
+struct metrics_snapshot {
+	/* By command name; pipelines are recorded as "PIPELINE" */
+	std::map<std::string, command_stats> commands;
+	std::map<std::string, int64_t> gauges;
+};
+
+/**
+ * @brief A gauge: a value set or adjusted by its owner and read by snapshots.
+ */
+class metrics_gauge {
+public:
+	void set(int64_t v) {
+		value.store(v, std::memory_order_relaxed);
+	}
+
+	void add(int64_t delta) {
+		value.fetch_add(delta, std::memory_order_relaxed);
+	}
+
+	/* Raises the gauge to v if it is lower, for high-water marks */
+	void raise(int64_t v) {
+		int64_t current = value.load(std::memory_order_relaxed);
+		while (current < v && !value.compare_exchange_weak(current, v, std::memory_order_relaxed)) {
+		}
+	}
+
+	int64_t get() const {
+		return value.load(std::memory_order_relaxed);
+	}
+
+private:
+	std::atomic<int64_t> value{0};
+};
+
+/**
+ * @brief Collects per-command counters and latency histograms, and named gauges.
+ * * Recording is lock-free and contention-free: each thread records into its own shard, with plain loads and stores
+ * of atomics that only that thread writes, and snapshot() merges the shards of all threads (including threads that
+ * have exited). The shard of an exited thread keeps its counts and is handed to the next thread that starts
+ * recording, so memory follows the number of threads running at once rather than of threads ever started. A disabled
+ * registry costs one relaxed load per call.
+ *
+ * Defining JANUS_DISABLE_METRICS compiles recording out: enabled() is then a constant false and the instrumentation
+ * of metered_connection reduces to the forwarded call.
+ */
+class metrics_registry {
+public:
+	/* Distinct command names a registry can tell apart; later names are recorded as "OTHER" */
+	static constexpr size_t max_commands = 1024;
+
+	metrics_registry() : id(next_registry_id()) {
+	}
+
+	~metrics_registry() = default;
+
+	metrics_registry(const metrics_registry &) = delete;
+	metrics_registry &operator=(const metrics_registry &) = delete;
+
+	/**
+	 * @brief The registry of the process, used by default by the instrumented classes.
+	 */
+	static metrics_registry &global() {
+		static metrics_registry registry;
+		return registry;
+	}
+
+#ifdef JANUS_DISABLE_METRICS
+	static constexpr bool enabled() {
+		return false;
+	}
+
+	void set_enabled(bool) {
+	}
+#else
+	bool enabled() const {
+		return on.load(std::memory_order_relaxed);
+	}
+
+	void set_enabled(bool enable) {
+		on.store(enable, std::memory_order_relaxed);
+	}
+#endif
+
+	/**
+	 * @brief Returns the index of a command name, the same in every registry. Call sites keep it in a static.
+	 */
+	static size_t command_id(const std::string &name) {
+		auto &table = command_table();
+		std::lock_guard<std::mutex> lock(table.mutex);
+		auto it = table.ids.find(name);
+		if (it != table.ids.end()) return it->second;
+		if (table.names.size() + 1 >= max_commands) return table.ids.at("OTHER");
+		table.names.push_back(name);
+		return table.ids[name] = table.names.size() - 1;
+	}
+
+	/**
+	 * @brief Records one call.
+	 * @param command A command_id().
+	 * @param latency_ns The call duration in nanoseconds.
+	 * @param sent Bytes sent.
+	 * @param received Bytes received.
+	 * @param elements Reply elements.
+	 * @param errors 1 for a failed call, or the error replies of a pipeline.
+	 */
+	void record(size_t command, uint64_t latency_ns, uint64_t sent, uint64_t received, uint64_t elements,
+				uint64_t errors) {
+		if (!enabled()) return;
+		slot &s = local_shard().at(command);
+		bump(s.ops, 1);
+		bump(s.errors, errors);
+		bump(s.sent, sent);
+		bump(s.received, received);
+		bump(s.elements, elements);
+		bump(s.latency_sum, latency_ns);
+		if (latency_ns > s.latency_max.load(std::memory_order_relaxed)) {
+			s.latency_max.store(latency_ns, std::memory_order_relaxed);
+		}
+		bump(s.buckets[latency_histogram::bucket_of(latency_ns)], 1);
+	}
+
+	/**
+	 * @brief Returns a gauge, created at zero on first use. The reference stays valid for the registry's lifetime.
+	 */
+	metrics_gauge &gauge(const std::string &name) {
+		std::lock_guard<std::mutex> lock(gauges_mutex);
+		auto &g = gauges[name];
+		if (!g) g = std::make_unique<metrics_gauge>();
+		return *g;
+	}
+
+	/**
+	 * @brief Merges the shards of every thread. Counts recorded concurrently may or may not be included.
+	 */
+	metrics_snapshot snapshot() const {
+		metrics_snapshot result;
+		std::vector<std::string> names;
+		{
+			auto &table = command_table();
+			std::lock_guard<std::mutex> lock(table.mutex);
+			names = table.names;
+		}
+		{
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			for (const auto &shard: pool->shards) {
+				for (size_t c = 0; c < names.size(); ++c) {
+					const slot *s = shard->slots[c].load(std::memory_order_acquire);
+					if (!s || s->ops.load(std::memory_order_relaxed) == 0) continue;
+					merge(result.commands[names[c]], *s);
+				}
+			}
+		}
+		std::lock_guard<std::mutex> lock(gauges_mutex);
+		for (const auto &g: gauges) {
+			result.gauges[g.first] = g.second->get();
+		}
+		return result;
+	}
+
+private:
+	struct slot {
+		std::atomic<uint64_t> ops{0};
+		std::atomic<uint64_t> errors{0};
+		std::atomic<uint64_t> sent{0};
+		std::atomic<uint64_t> received{0};
+		std::atomic<uint64_t> elements{0};
+		std::atomic<uint64_t> latency_sum{0};
+		std::atomic<uint64_t> latency_max{0};
+		std::array<std::atomic<uint64_t>, latency_histogram::bucket_count> buckets{};
+	};
+
+	/* The slots of one thread; only that thread creates slots and writes to them */
+	struct shard {
+		std::array<std::atomic<slot *>, max_commands> slots{};
+		std::vector<std::unique_ptr<slot>> owned;
+
+		slot &at(size_t command) {
+			slot *s = slots[command].load(std::memory_order_relaxed);
+			if (s) return *s;
+			auto created = std::make_unique<slot>();
+			s = created.get();
+			owned.push_back(std::move(created));
+			slots[command].store(s, std::memory_order_release);
+			return *s;
+		}
+	};
+
+	/* The shards of a registry, shared with the threads recording into it, which may outlive the registry */
+	struct shard_pool {
+		std::mutex mutex;
+		std::vector<std::unique_ptr<shard>> shards;
+		/* Shards of exited threads, waiting for a new owner */
+		std::vector<shard *> free;
+	};
+
+	/* The shards a thread records into, one per registry; handed back to their pools when the thread exits */
+	struct thread_shards {
+		struct entry {
+			uint64_t id;
+			shard *owned;
+			std::weak_ptr<shard_pool> pool;
+		};
+		std::vector<entry> entries;
+
+		~thread_shards() {
+			for (const auto &e: entries) {
+				if (auto pool = e.pool.lock()) {
+					std::lock_guard<std::mutex> lock(pool->mutex);
+					pool->free.push_back(e.owned);
+				}
+			}
+		}
+	};
+
+	struct command_names {
+		std::mutex mutex;
+		std::vector<std::string> names;
+		std::unordered_map<std::string, size_t> ids;
+
+		command_names() {
+			names.emplace_back("OTHER");
+			ids.emplace("OTHER", 0);
+		}
+	};
+
+	static command_names &command_table() {
+		static command_names table;
+		return table;
+	}
+
+	static uint64_t next_registry_id() {
+		static std::atomic<uint64_t> next{1};
+		return next.fetch_add(1);
+	}
+
+	/* Single-writer increment: no read-modify-write instruction is needed, as no other thread writes the counter */
+	static void bump(std::atomic<uint64_t> &counter, uint64_t delta) {
+		counter.store(counter.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+
+	static void merge(command_stats &into, const slot &s) {
+		into.ops += s.ops.load(std::memory_order_relaxed);
+		into.errors += s.errors.load(std::memory_order_relaxed);
+		into.bytes_sent += s.sent.load(std::memory_order_relaxed);
+		into.bytes_received += s.received.load(std::memory_order_relaxed);
+		into.elements += s.elements.load(std::memory_order_relaxed);
+		latency_histogram h;
+		for (size_t b = 0; b < latency_histogram::bucket_count; ++b) {
+			const uint64_t n = s.buckets[b].load(std::memory_order_relaxed);
+			if (n == 0) continue;
+			h.counts[b] = n;
+			h.total += n;
+			h.min_value = std::min(h.min_value, latency_histogram::lower_bound(b));
+		}
+		// The buckets only bound the values; the sum and the maximum are kept exactly
+		h.sum = s.latency_sum.load(std::memory_order_relaxed);
+		h.max_value = s.latency_max.load(std::memory_order_relaxed);
+		into.latency.merge(h);
+	}
+
+	shard &local_shard() {
+		// Each thread caches its shard of the registries it records into; ids are never reused
+		thread_local thread_shards cache;
+		for (const auto &entry: cache.entries) {
+			if (entry.id == id) return *entry.owned;
+		}
+		shard *s;
+		{
+			// The pool's mutex orders the previous owner's writes before this thread's
+			std::lock_guard<std::mutex> lock(pool->mutex);
+			if (!pool->free.empty()) {
+				s = pool->free.back();
+				pool->free.pop_back();
+			}
+			else {
+				pool->shards.push_back(std::make_unique<shard>());
+				s = pool->shards.back().get();
+			}
+		}
+		cache.entries.push_back({id, s, pool});
+		return *s;
+	}
+
+	const uint64_t id;
+#ifndef JANUS_DISABLE_METRICS
+	std::atomic<bool> on{true};
+#endif
+	const std::shared_ptr<shard_pool> pool{std::make_shared<shard_pool>()};
+	mutable std::mutex gauges_mutex;
+	std::map<std::string, std::unique_ptr<metrics_gauge>> gauges;
+};
@@ -0,0 +1,756 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "forwarding_connection.hpp"
+#include "hash.hpp"
+#include "metrics.hpp"
+#include "probes.hpp"
+
+/**
+ * @brief A command name and its metrics_registry::command_id(), kept in a static at each call site.
+ */
+struct command_name {
+	explicit command_name(const char *text) : text(text), id(metrics_registry::command_id(text)) {
+	}
+
+	const char *text;
+	size_t id;
+};
+
+/**
+ * @brief What observers learn of a call. before_command() sees the name, key, batch and bytes sent; after_reply()
+ * sees everything.
+ */
+struct command_event {
+	command_event(const command_name &name, std::string_view key, uint64_t batch) :
+		command(name.text), command_id(name.id), key(key), batch(batch) {
+	}
+
+	/* The command, e.g. "HGETALL", or "PIPELINE" */
+	const char *command;
+	size_t command_id;
+	/* The first key, empty for pipelines and commands without keys */
+	std::string_view key;
+	/* Commands sent by the call: 1, or the size of a pipeline */
+	uint64_t batch;
+	/* Bytes of the keys, values and arguments sent, and of the values received (RESP framing excluded) */
+	uint64_t bytes_sent{0};
+	uint64_t bytes_received{0};
+	/* Elements of multi-element replies */
+	uint64_t elements{0};
+	/* Error replies returned by evalsha() and pipeline() */
+	uint64_t error_replies{0};
+	std::chrono::nanoseconds duration{0};
+	/* The message of the exception the call throws, or null */
+	const char *error{nullptr};
+};
+
+/**
+ * @brief An observer registered at runtime in dynamic_observers. Static observers need not derive from it: any type
+ * with some of before_command(command_event &), after_reply(const command_event &) and bool active() const will do.
+ */
+class command_observer {
+public:
+	virtual ~command_observer() = default;
+
+	virtual void before_command(command_event &) {
+	}
+
+	virtual void after_reply(const command_event &) {
+	}
+};
+
+/**
+ * @brief A static observer dispatching to observers added and removed at runtime.
+ * * The list is copy-on-write: calls read it without locking, and cost one relaxed load while it is empty. Copies of
+ * a dynamic_observers share the same list.
+ */
+class dynamic_observers {
+public:
+	using observer_list = std::vector<std::shared_ptr<command_observer>>;
+
+	dynamic_observers() : state(std::make_shared<shared_state>()) {
+	}
+
+	void add(std::shared_ptr<command_observer> observer) {
+		if (!observer) throw std::invalid_argument("dynamic_observers: observer is null");
+		std::lock_guard<std::mutex> lock(state->mutex);
+		auto next = std::make_shared<observer_list>(*std::atomic_load(&state->observers));
+		next->push_back(std::move(observer));
+		publish(std::move(next));
+	}
+
+	/**
+	 * @return Whether the observer was registered.
+	 */
+	bool remove(const std::shared_ptr<command_observer> &observer) {
+		std::lock_guard<std::mutex> lock(state->mutex);
+		auto next = std::make_shared<observer_list>(*std::atomic_load(&state->observers));
+		const auto it = std::find(next->begin(), next->end(), observer);
+		if (it == next->end()) return false;
+		next->erase(it);
+		publish(std::move(next));
+		return true;
+	}
+
+	bool active() const {
+		return state->count.load(std::memory_order_relaxed) != 0;
+	}
+
+	void before_command(command_event &event) {
+		for (const auto &observer: *std::atomic_load(&state->observers)) {
+			observer->before_command(event);
+		}
+	}
+
+	void after_reply(const command_event &event) {
+		for (const auto &observer: *std::atomic_load(&state->observers)) {
+			observer->after_reply(event);
+		}
+	}
+
+private:
+	struct shared_state {
+		std::mutex mutex;
+		std::shared_ptr<const observer_list> observers{std::make_shared<observer_list>()};
+		std::atomic<size_t> count{0};
+	};
+
+	void publish(std::shared_ptr<observer_list> next) {
+		state->count.store(next->size(), std::memory_order_relaxed);
+		std::atomic_store(&state->observers, std::shared_ptr<const observer_list>(std::move(next)));
+	}
+
+	std::shared_ptr<shared_state> state;
+};
+
+/**
+ * @brief A static observer firing the command__send and reply__receive USDT probes (see probes.hpp) with the command,
+ * the hash of its key, its sizes and its latency. It is active only while a tracer is attached to either probe.
+ */
+class probe_observer {
+public:
+	bool active() const {
+		return JANUS_PROBE_ENABLED(command__send) || JANUS_PROBE_ENABLED(reply__receive);
+	}
+
+	void before_command(command_event &event) {
+		JANUS_PROBE5(command__send, event.command, event.command_id, key_hash(event), event.bytes_sent, event.batch);
+	}
+
+	void after_reply(const command_event &event) {
+		JANUS_PROBE6(reply__receive, event.command, event.command_id, key_hash(event), event.bytes_received,
+					 static_cast<uint64_t>(event.duration.count()), event.error ? 1 : 0);
+	}
+
+private:
+	static uint64_t key_hash(const command_event &event) {
+		return murmurhash64a(event.key.data(), event.key.size(), 0);
+	}
+};
+
+/**
+ * @brief A kv_connection calling observers before each command and after its reply, for tracing, sampling, auditing
+ * or custom metrics.
+ * * Observers are template parameters and are called without virtual dispatch, in order; hooks an observer lacks are
+ * not called, and while no observer is active() a call costs the active() checks. observed_connection<> is a plain
+ * forwarding_connection. Add dynamic_observers for observers registered at runtime.
+ *
+ * Observers are called on the calling thread, and concurrently when the connection is shared. An exception thrown by
+ * the connection reaches after_reply() with its message, then the caller; one thrown by an observer reaches the
+ * caller.
+ *
+ * @tparam Observers The observer types, e.g. metrics_observer.
+ */
+template<typename... Observers>
+class observed_connection: public forwarding_connection {
+public:
+	/**
+	 * @param target The connection to observe.
+	 * @param args Nothing to default-construct the observers, or one value per observer.
+	 */
+	template<typename... Args>
+	explicit observed_connection(std::shared_ptr<kv_connection> target, Args &&...args) :
+		forwarding_connection(std::move(target)), observers(std::forward<Args>(args)...) {
+	}
+
+	/**
+	 * @brief Returns the observer of a type, e.g. observer<dynamic_observers>().add(...).
+	 */
+	template<typename T>
+	T &observer() {
+		return std::get<T>(observers);
+	}
+
+	bool exists(const std::string &key) override {
+		static const command_name name("EXISTS");
+		return observe(name, key, [&] { return target->exists(key); }, key);
+	}
+
+	bool expire(const std::string &key, int seconds) override {
+		static const command_name name("EXPIRE");
+		return observe(name, key, [&] { return target->expire(key, seconds); }, key, seconds);
+	}
+
+	bool pexpire(const std::string &key, int milliseconds) override {
+		static const command_name name("PEXPIRE");
+		return observe(name, key, [&] { return target->pexpire(key, milliseconds); }, key, milliseconds);
+	}
+
+	long long del(const std::string &key) override {
+		static const command_name name("DEL");
+		return observe(name, key, [&] { return target->del(key); }, key);
+	}
+
+	long long del(const std::vector<std::string> &keys) override {
+		static const command_name name("DEL");
+		return observe(name, first_key(keys), [&] { return target->del(keys); }, keys);
+	}
+
+	int64_t ttl(const std::string &key) override {
+		static const command_name name("TTL");
+		return observe(name, key, [&] { return target->ttl(key); }, key);
+	}
+
+	int64_t pttl(const std::string &key) override {
+		static const command_name name("PTTL");
+		return observe(name, key, [&] { return target->pttl(key); }, key);
+	}
+
+	// ============================================================================
+	// For String
+	// ============================================================================
+
+	bool set(const std::string &key, const std::string &value) override {
+		static const command_name name("SET");
+		return observe(name, key, [&] { return target->set(key, value); }, key, value);
+	}
+
+	bool set_not_exists(const std::string &key, const std::string &value) override {
+		static const command_name name("SET");
+		return observe(name, key, [&] { return target->set_not_exists(key, value); }, key, value);
+	}
+
+	bool set_ex(const std::string &key, const std::string &value, int seconds) override {
+		static const command_name name("SET");
+		return observe(name, key, [&] { return target->set_ex(key, value, seconds); }, key, value, seconds);
+	}
+
+	bool set_px(const std::string &key, const std::string &value, int milliseconds) override {
+		static const command_name name("SET");
+		return observe(name, key, [&] { return target->set_px(key, value, milliseconds); }, key, value, milliseconds);
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		static const command_name name("GET");
+		return observe(name, key, [&] { return target->get(key); }, key);
+	}
+
+	std::optional<std::string> getset(const std::string &key, const std::string &new_value) override {
+		static const command_name name("GETSET");
+		return observe(name, key, [&] { return target->getset(key, new_value); }, key, new_value);
+	}
+
+	long long incr(const std::string &key, long long delta) override {
+		static const command_name name("INCRBY");
+		return observe(name, key, [&] { return target->incr(key, delta); }, key, delta);
+	}
+
+	long long decr(const std::string &key, long long delta) override {
+		static const command_name name("DECRBY");
+		return observe(name, key, [&] { return target->decr(key, delta); }, key, delta);
+	}
+
+	long long append(const std::string &key, const std::string &value) override {
+		static const command_name name("APPEND");
+		return observe(name, key, [&] { return target->append(key, value); }, key, value);
+	}
+
+	std::string getrange(const std::string &key, long long start, long long end) override {
+		static const command_name name("GETRANGE");
+		return observe(name, key, [&] { return target->getrange(key, start, end); }, key, start, end);
+	}
+
+	// ============================================================================
+	// For Hash
+	// ============================================================================
+
+	std::optional<std::string> hget(const std::string &key, const std::string &hash_key) override {
+		static const command_name name("HGET");
+		return observe(name, key, [&] { return target->hget(key, hash_key); }, key, hash_key);
+	}
+
+	void hget(const std::string &key, std::unordered_map<std::string, std::optional<std::string>> &hash_map) override {
+		static const command_name name("HMGET");
+		observe(name, key, [&] {
+			target->hget(key, hash_map);
+			return std::cref(hash_map);
+		}, key, hash_map);
+	}
+
+	bool hset(const std::string &key, const std::string &field, const std::string &value) override {
+		static const command_name name("HSET");
+		return observe(name, key, [&] { return target->hset(key, field, value); }, key, field, value);
+	}
+
+	bool hset(const std::string &key, const std::unordered_map<std::string, std::string> &hash_map) override {
+		static const command_name name("HSET");
+		return observe(name, key, [&] { return target->hset(key, hash_map); }, key, hash_map);
+	}
+
+	std::unordered_map<std::string, std::string> hgetall(const std::string &key) override {
+		static const command_name name("HGETALL");
+		return observe(name, key, [&] { return target->hgetall(key); }, key);
+	}
+
+	std::vector<std::string> hkeys(const std::string &key) override {
+		static const command_name name("HKEYS");
+		return observe(name, key, [&] { return target->hkeys(key); }, key);
+	}
+
+	std::vector<std::string> hvals(const std::string &key) override {
+		static const command_name name("HVALS");
+		return observe(name, key, [&] { return target->hvals(key); }, key);
+	}
+
+	long long hdel(const std::string &key, const std::string &hash_key) override {
+		static const command_name name("HDEL");
+		return observe(name, key, [&] { return target->hdel(key, hash_key); }, key, hash_key);
+	}
+
+	long long hdel(const std::string &key, const std::vector<std::string> &hash_keys) override {
+		static const command_name name("HDEL");
+		return observe(name, key, [&] { return target->hdel(key, hash_keys); }, key, hash_keys);
+	}
+
+	// ============================================================================
+	// For List
+	// ============================================================================
+
+	long long lpush(const std::string &key, const std::vector<std::string> &values) override {
+		static const command_name name("LPUSH");
+		return observe(name, key, [&] { return target->lpush(key, values); }, key, values);
+	}
+
+	long long lpush(const std::string &key, const std::string &value) override {
+		static const command_name name("LPUSH");
+		return observe(name, key, [&] { return target->lpush(key, value); }, key, value);
+	}
+
+	long long rpush(const std::string &key, const std::string &value) override {
+		static const command_name name("RPUSH");
+		return observe(name, key, [&] { return target->rpush(key, value); }, key, value);
+	}
+
+	long long rpush(const std::string &key, const std::vector<std::string> &values) override {
+		static const command_name name("RPUSH");
+		return observe(name, key, [&] { return target->rpush(key, values); }, key, values);
+	}
+
+	std::optional<std::string> lpop(const std::string &key) override {
+		static const command_name name("LPOP");
+		return observe(name, key, [&] { return target->lpop(key); }, key);
+	}
+
+	std::optional<std::string> rpop(const std::string &key) override {
+		static const command_name name("RPOP");
+		return observe(name, key, [&] { return target->rpop(key); }, key);
+	}
+
+	std::vector<std::string> lrange(const std::string &key, long long start, long long stop) override {
+		static const command_name name("LRANGE");
+		return observe(name, key, [&] { return target->lrange(key, start, stop); }, key, start, stop);
+	}
+
+	long long llen(const std::string &key) override {
+		static const command_name name("LLEN");
+		return observe(name, key, [&] { return target->llen(key); }, key);
+	}
+
+	// ============================================================================
+	// For Set
+	// ============================================================================
+
+	long long sadd(const std::string &key, const std::vector<std::string> &members) override {
+		static const command_name name("SADD");
+		return observe(name, key, [&] { return target->sadd(key, members); }, key, members);
+	}
+
+	long long srem(const std::string &key, const std::vector<std::string> &members) override {
+		static const command_name name("SREM");
+		return observe(name, key, [&] { return target->srem(key, members); }, key, members);
+	}
+
+	std::vector<std::string> smembers(const std::string &key) override {
+		static const command_name name("SMEMBERS");
+		return observe(name, key, [&] { return target->smembers(key); }, key);
+	}
+
+	long long scard(const std::string &key) override {
+		static const command_name name("SCARD");
+		return observe(name, key, [&] { return target->scard(key); }, key);
+	}
+
+	bool sismember(const std::string &key, const std::string &member) override {
+		static const command_name name("SISMEMBER");
+		return observe(name, key, [&] { return target->sismember(key, member); }, key, member);
+	}
+
+	std::optional<std::string> spop(const std::string &key) override {
+		static const command_name name("SPOP");
+		return observe(name, key, [&] { return target->spop(key); }, key);
+	}
+
+	std::vector<std::string> sinter(const std::vector<std::string> &keys) override {
+		static const command_name name("SINTER");
+		return observe(name, first_key(keys), [&] { return target->sinter(keys); }, keys);
+	}
+
+	// ============================================================================
+	// For ZSet
+	// ============================================================================
+
+	long long zadd(const std::string &key, const std::unordered_map<std::string, double> &members) override {
+		static const command_name name("ZADD");
+		return observe(name, key, [&] { return target->zadd(key, members); }, key, members);
+	}
+
+	long long zrem(const std::string &key, const std::vector<std::string> &members) override {
+		static const command_name name("ZREM");
+		return observe(name, key, [&] { return target->zrem(key, members); }, key, members);
+	}
+
+	std::optional<double> zscore(const std::string &key, const std::string &member) override {
+		static const command_name name("ZSCORE");
+		return observe(name, key, [&] { return target->zscore(key, member); }, key, member);
+	}
+
+	std::vector<std::string> zrange(const std::string &key, long long start, long long stop) override {
+		static const command_name name("ZRANGE");
+		return observe(name, key, [&] { return target->zrange(key, start, stop); }, key, start, stop);
+	}
+
+	std::vector<std::string> zrevrange(const std::string &key, long long start, long long stop) override {
+		static const command_name name("ZREVRANGE");
+		return observe(name, key, [&] { return target->zrevrange(key, start, stop); }, key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrange_withscores(const std::string &key, long long start,
+																  long long stop) override {
+		static const command_name name("ZRANGE");
+		return observe(name, key, [&] { return target->zrange_withscores(key, start, stop); }, key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrevrange_withscores(const std::string &key, long long start,
+																	 long long stop) override {
+		static const command_name name("ZREVRANGE");
+		return observe(name, key, [&] { return target->zrevrange_withscores(key, start, stop); }, key, start, stop);
+	}
+
+	double zincrby(const std::string &key, double increment, const std::string &member) override {
+		static const command_name name("ZINCRBY");
+		return observe(name, key, [&] { return target->zincrby(key, increment, member); }, key, increment, member);
+	}
+
+	std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																		 double max) override {
+		static const command_name name("ZRANGEBYSCORE");
+		return observe(name, key, [&] { return target->zrangebyscore_withscores(key, min, max); }, key, min, max);
+	}
+
+	long long zremrangebyscore(const std::string &key, double min, double max) override {
+		static const command_name name("ZREMRANGEBYSCORE");
+		return observe(name, key, [&] { return target->zremrangebyscore(key, min, max); }, key, min, max);
+	}
+
+	// ============================================================================
+	// For HyperLogLog
+	// ============================================================================
+
+	bool pfadd(const std::string &key, const std::vector<std::string> &elements) override {
+		static const command_name name("PFADD");
+		return observe(name, key, [&] { return target->pfadd(key, elements); }, key, elements);
+	}
+
+	long long pfcount(const std::vector<std::string> &keys) override {
+		static const command_name name("PFCOUNT");
+		return observe(name, first_key(keys), [&] { return target->pfcount(keys); }, keys);
+	}
+
+	bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) override {
+		static const command_name name("PFMERGE");
+		return observe(name, dest, [&] { return target->pfmerge(dest, sources); }, dest, sources);
+	}
+
+	// ============================================================================
+	// For Bitmap
+	// ============================================================================
+
+	bool setbit(const std::string &key, long long offset, bool value) override {
+		static const command_name name("SETBIT");
+		return observe(name, key, [&] { return target->setbit(key, offset, value); }, key, offset, value);
+	}
+
+	bool getbit(const std::string &key, long long offset) override {
+		static const command_name name("GETBIT");
+		return observe(name, key, [&] { return target->getbit(key, offset); }, key, offset);
+	}
+
+	long long bitcount(const std::string &key, long long start, long long end) override {
+		static const command_name name("BITCOUNT");
+		return observe(name, key, [&] { return target->bitcount(key, start, end); }, key, start, end);
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end) override {
+		static const command_name name("BITPOS");
+		return observe(name, key, [&] { return target->bitpos(key, bit, start, end); }, key, bit, start, end);
+	}
+
+	long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) override {
+		static const command_name name("BITOP");
+		return observe(name, dest, [&] { return target->bitop(op, dest, keys); }, op, dest, keys);
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &key,
+												   const std::vector<std::string> &args) override {
+		static const command_name name("BITFIELD");
+		return observe(name, key, [&] { return target->bitfield(key, args); }, key, args);
+	}
+
+	// ============================================================================
+	// For Scripting
+	// ============================================================================
+
+	std::string script_load(const std::string &script) override {
+		static const command_name name("SCRIPT");
+		return observe(name, {}, [&] { return target->script_load(script); }, script);
+	}
+
+	kv_reply evalsha(const std::string &sha1, const std::vector<std::string> &keys,
+					 const std::vector<std::string> &args) override {
+		static const command_name name("EVALSHA");
+		return observe(name, first_key(keys), [&] { return target->evalsha(sha1, keys, args); }, sha1, keys, args);
+	}
+
+	// ============================================================================
+	// For Pipelining
+	// ============================================================================
+
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		static const command_name name("PIPELINE");
+		return observe_batch(name, {}, commands.size(), [&] { return target->pipeline(commands); }, commands);
+	}
+
+protected:
+	using clock = std::chrono::steady_clock;
+
+	template<typename F, typename... Args>
+	auto observe(const command_name &name, std::string_view key, F &&call, const Args &...args) -> decltype(call()) {
+		return observe_batch(name, key, 1, std::forward<F>(call), args...);
+	}
+
+	template<typename F, typename... Args>
+	auto observe_batch(const command_name &name, std::string_view key, uint64_t batch, F &&call, const Args &...args)
+		-> decltype(call()) {
+		if (!any_active()) return call();
+		command_event event(name, key, batch);
+		event.bytes_sent = payload_bytes(args...);
+		notify_before(event);
+		const auto start = clock::now();
+		try {
+			auto result = call();
+			event.bytes_received = payload_bytes(result);
+			event.elements = reply_elements(result);
+			event.error_replies = reply_errors(result);
+			notify_after(event, start);
+			return result;
+		}
+		catch (const std::exception &e) {
+			event.error = e.what();
+			notify_after(event, start);
+			throw;
+		}
+		catch (...) {
+			event.error = "unknown error";
+			notify_after(event, start);
+			throw;
+		}
+	}
+
+private:
+	template<typename T, typename = void>
+	struct has_active: std::false_type {};
+	template<typename T>
+	struct has_active<T, std::void_t<decltype(std::declval<const T &>().active())>>: std::true_type {};
+
+	template<typename T, typename = void>
+	struct has_before: std::false_type {};
+	template<typename T>
+	struct has_before<T, std::void_t<decltype(std::declval<T &>().before_command(std::declval<command_event &>()))>>
+		: std::true_type {};
+
+	template<typename T, typename = void>
+	struct has_after: std::false_type {};
+	template<typename T>
+	struct has_after<T, std::void_t<decltype(std::declval<T &>().after_reply(std::declval<const command_event &>()))>>
+		: std::true_type {};
+
+	template<typename T>
+	static bool is_active(const T &observer) {
+		if constexpr (has_active<T>::value) return observer.active();
+		else return true;
+	}
+
+	bool any_active() const {
+		return std::apply([](const auto &...o) { return (false || ... || is_active(o)); }, observers);
+	}
+
+	void notify_before(command_event &event) {
+		std::apply([&event](auto &...o) { (before(o, event), ...); }, observers);
+	}
+
+	void notify_after(command_event &event, clock::time_point start) {
+		event.duration = std::chrono::duration_cast<std::chrono::nanoseconds>(clock::now() - start);
+		std::apply([&event](auto &...o) { (after(o, event), ...); }, observers);
+	}
+
+	template<typename T>
+	static void before(T &observer, command_event &event) {
+		if constexpr (has_before<T>::value) {
+			if (is_active(observer)) observer.before_command(event);
+		}
+	}
+
+	template<typename T>
+	static void after(T &observer, const command_event &event) {
+		if constexpr (has_after<T>::value) {
+			if (is_active(observer)) observer.after_reply(event);
+		}
+	}
+
+	static std::string_view first_key(const std::vector<std::string> &keys) {
+		return keys.empty() ? std::string_view() : std::string_view(keys.front());
+	}
+
+	// ============================================================================
+	// Payload sizes: the bytes of strings, numbers excluded
+	// ============================================================================
+
+	static uint64_t payload_bytes() {
+		return 0;
+	}
+
+	static uint64_t payload_bytes(const std::string &s) {
+		return s.size();
+	}
+
+	static uint64_t payload_bytes(const kv_reply &reply) {
+		uint64_t bytes = reply.str.size();
+		for (const auto &element: reply.elements) {
+			bytes += payload_bytes(element);
+		}
+		return bytes;
+	}
+
+	template<typename T, typename = std::enable_if_t<std::is_arithmetic_v<T>>>
+	static uint64_t payload_bytes(T) {
+		return 0;
+	}
+
+	template<typename T>
+	static uint64_t payload_bytes(const std::optional<T> &value) {
+		return value ? payload_bytes(*value) : 0;
+	}
+
+	template<typename T>
+	static uint64_t payload_bytes(const std::reference_wrapper<T> &ref) {
+		return payload_bytes(ref.get());
+	}
+
+	template<typename A, typename B>
+	static uint64_t payload_bytes(const std::pair<A, B> &pair) {
+		return payload_bytes(pair.first) + payload_bytes(pair.second);
+	}
+
+	template<typename T>
+	static uint64_t payload_bytes(const std::vector<T> &values) {
+		uint64_t bytes = 0;
+		for (const auto &value: values) {
+			bytes += payload_bytes(value);
+		}
+		return bytes;
+	}
+
+	template<typename K, typename V>
+	static uint64_t payload_bytes(const std::unordered_map<K, V> &map) {
+		uint64_t bytes = 0;
+		for (const auto &entry: map) {
+			bytes += payload_bytes(entry.first) + payload_bytes(entry.second);
+		}
+		return bytes;
+	}
+
+	template<typename First, typename Second, typename... Rest>
+	static uint64_t payload_bytes(const First &first, const Second &second, const Rest &...rest) {
+		return payload_bytes(first) + payload_bytes(second, rest...);
+	}
+
+	template<typename T>
+	static uint64_t reply_elements(const T &) {
+		return 0;
+	}
+
+	template<typename T>
+	static uint64_t reply_elements(const std::reference_wrapper<T> &ref) {
+		return reply_elements(ref.get());
+	}
+
+	template<typename T>
+	static uint64_t reply_elements(const std::vector<T> &values) {
+		return values.size();
+	}
+
+	template<typename K, typename V>
+	static uint64_t reply_elements(const std::unordered_map<K, V> &map) {
+		return map.size();
+	}
+
+	static uint64_t reply_elements(const kv_reply &reply) {
+		return reply.elements.size();
+	}
+
+	template<typename T>
+	static uint64_t reply_errors(const T &) {
+		return 0;
+	}
+
+	static uint64_t reply_errors(const kv_reply &reply) {
+		return reply.is_error() ? 1 : 0;
+	}
+
+	static uint64_t reply_errors(const std::vector<kv_reply> &replies) {
+		uint64_t errors = 0;
+		for (const auto &reply: replies) {
+			errors += reply.is_error() ? 1 : 0;
+		}
+		return errors;
+	}
+
+	std::tuple<Observers...> observers;
+};
@@ -0,0 +1,650 @@
+#pragma once
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cerrno>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "bulk_loader.hpp"
+#include "hot_key_detector.hpp"
+#include "key_migrator.hpp"
+#include "memory_analyzer.hpp"
+#include "metrics.hpp"
+#include "replica_connection.hpp"
+#include "shm_cache.hpp"
+#include "stage_profiler.hpp"
+#include "tiered_connection.hpp"
+
+/* Label names and values of a sample */
+using metric_labels = std::vector<std::pair<std::string, std::string>>;
+
+/**
+ * @brief Builds an exposition in the OpenMetrics text format, which Prometheus scrapes natively.
+ * * Samples may be added in any order: they are grouped by family, so several sources (e.g. two tiered_connections
+ * told apart by a label) can write the same family. Names get the writer's prefix and are sanitized; counters get
+ * their "_total" suffix. Label values that are not valid UTF-8, such as binary Redis keys, are exported as "0x"
+ * followed by the hex digits of their bytes.
+ */
+class openmetrics_writer {
+public:
+	explicit openmetrics_writer(std::string prefix = "janus") : prefix(std::move(prefix)) {
+	}
+
+	/**
+	 * @brief Adds a sample to a counter family.
+	 * @param name The family name, without prefix and "_total".
+	 * @throw std::invalid_argument If the family was added with another type.
+	 */
+	void counter(const std::string &name, const char *help, uint64_t value, const metric_labels &labels = {}) {
+		family &f = get(name, "counter", help);
+		sample(f, "_total", labels, nullptr, [&](std::string &out) { append_integer(out, value); });
+	}
+
+	/**
+	 * @brief Adds a sample to a gauge family.
+	 * @throw std::invalid_argument If the family was added with another type.
+	 */
+	void gauge(const std::string &name, const char *help, double value, const metric_labels &labels = {}) {
+		family &f = get(name, "gauge", help);
+		sample(f, "", labels, nullptr, [&](std::string &out) { append_number(out, value); });
+	}
+
+	/**
+	 * @brief Adds a histogram to a histogram family, with its buckets summed into coarser ones.
+	 * @param bounds The upper bounds of the exported buckets, ascending, in the unit of the histogram's values; the
+	 * "+Inf" bucket is added. A bucket of the histogram counts towards a bound only when all its values are below it.
+	 * @param unit The factor from the histogram's values to the exported unit, e.g. 1e-9 from nanoseconds to seconds.
+	 * @throw std::invalid_argument If the family was added with another type.
+	 */
+	void histogram(const std::string &name, const char *help, const latency_histogram &histogram,
+				   const std::vector<uint64_t> &bounds, double unit, const metric_labels &labels = {}) {
+		family &f = get(name, "histogram", help);
+		const std::vector<uint64_t> &counts = histogram.buckets();
+		uint64_t cumulative = 0;
+		size_t bucket = 0;
+		std::string le;
+		for (const uint64_t bound: bounds) {
+			for (; bucket < counts.size() && latency_histogram::upper_bound(bucket) <= bound; ++bucket) {
+				cumulative += counts[bucket];
+			}
+			le.clear();
+			append_number(le, static_cast<double>(bound) * unit);
+			sample(f, "_bucket", labels, le.c_str(), [&](std::string &out) { append_integer(out, cumulative); });
+		}
+		sample(f, "_bucket", labels, "+Inf", [&](std::string &out) { append_integer(out, histogram.count()); });
+		sample(f, "_count", labels, nullptr, [&](std::string &out) { append_integer(out, histogram.count()); });
+		sample(f, "_sum", labels, nullptr, [&](std::string &out) {
+			append_number(out, static_cast<double>(histogram.total_value()) * unit);
+		});
+	}
+
+	/**
+	 * @brief Appends the families, in the order they were first added, and the closing "# EOF" line.
+	 */
+	void finish(std::string &out) const {
+		for (const auto &f: families) {
+			out += "# TYPE ";
+			out += f.name;
+			out += ' ';
+			out += f.type;
+			out += '\n';
+			if (!f.help.empty()) {
+				out += "# HELP ";
+				out += f.name;
+				out += ' ';
+				out += f.help;
+				out += '\n';
+			}
+			out += f.samples;
+		}
+		out += "# EOF\n";
+	}
+
+	/* Replaces the characters metric names do not allow with '_' */
+	static std::string sanitize(const std::string &name) {
+		std::string result = name;
+		for (char &c: result) {
+			if (!std::isalnum(static_cast<unsigned char>(c)) && c != '_' && c != ':') c = '_';
+		}
+		if (result.empty() || std::isdigit(static_cast<unsigned char>(result[0]))) result.insert(0, 1, '_');
+		return result;
+	}
+
+private:
+	struct family {
+		std::string name;
+		const char *type;
+		std::string help;
+		std::string samples;
+	};
+
+	std::string prefix;
+	std::vector<family> families;
+	/* Family name without prefix, to its index in families */
+	std::unordered_map<std::string, size_t> index;
+
+	family &get(const std::string &name, const char *type, const char *help) {
+		auto it = index.find(name);
+		if (it == index.end()) {
+			std::string full = prefix.empty() ? sanitize(name) : sanitize(prefix) + "_" + sanitize(name);
+			families.push_back({std::move(full), type, help ? help : "", {}});
+			it = index.emplace(name, families.size() - 1).first;
+		}
+		family &f = families[it->second];
+		if (std::strcmp(f.type, type) != 0) {
+			throw std::invalid_argument("openmetrics_writer: " + f.name + " is a " + f.type + ", not a " + type);
+		}
+		return f;
+	}
+
+	template<typename Value>
+	static void sample(family &f, const char *suffix, const metric_labels &labels, const char *le,
+					   const Value &value) {
+		std::string &out = f.samples;
+		out += f.name;
+		out += suffix;
+		if (!labels.empty() || le) {
+			char separator = '{';
+			for (const auto &label: labels) {
+				out += separator;
+				out += sanitize(label.first);
+				out += "=\"";
+				append_escaped(out, label.second);
+				out += '"';
+				separator = ',';
+			}
+			if (le) {
+				out += separator;
+				out += "le=\"";
+				out += le;
+				out += '"';
+			}
+			out += '}';
+		}
+		out += ' ';
+		value(out);
+		out += '\n';
+	}
+
+	static void append_escaped(std::string &out, const std::string &value) {
+		if (!is_utf8(value)) {
+			static constexpr char digits[] = "0123456789abcdef";
+			out += "0x";
+			for (const char c: value) {
+				out += digits[static_cast<unsigned char>(c) >> 4];
+				out += digits[static_cast<unsigned char>(c) & 0xf];
+			}
+			return;
+		}
+		for (const char c: value) {
+			if (c == '\\') out += "\\\\";
+			else if (c == '"') out += "\\\"";
+			else if (c == '\n') out += "\\n";
+			else out += c;
+		}
+	}
+
+	/* Rejects overlong forms, surrogates and code points past U+10FFFF, as the exposition must be valid UTF-8 */
+	static bool is_utf8(const std::string &value) {
+		const auto *p = reinterpret_cast<const unsigned char *>(value.data());
+		const size_t n = value.size();
+		for (size_t i = 0; i < n;) {
+			const unsigned char c = p[i];
+			size_t length;
+			uint32_t code;
+			uint32_t min;
+			if (c < 0x80) {
+				++i;
+				continue;
+			}
+			if ((c & 0xe0) == 0xc0) {
+				length = 2;
+				code = c & 0x1f;
+				min = 0x80;
+			}
+			else if ((c & 0xf0) == 0xe0) {
+				length = 3;
+				code = c & 0x0f;
+				min = 0x800;
+			}
+			else if ((c & 0xf8) == 0xf0) {
+				length = 4;
+				code = c & 0x07;
+				min = 0x10000;
+			}
+			else {
+				return false;
+			}
+			if (i + length > n) return false;
+			for (size_t k = 1; k < length; ++k) {
+				if ((p[i + k] & 0xc0) != 0x80) return false;
+				code = (code << 6) | (p[i + k] & 0x3f);
+			}
+			if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) return false;
+			i += length;
+		}
+		return true;
+	}
+
+	static void append_integer(std::string &out, uint64_t value) {
+		char buffer[24];
+		const auto result = std::to_chars(buffer, buffer + sizeof(buffer), value);
+		out.append(buffer, result.ptr);
+	}
+
+	static void append_number(std::string &out, double value) {
+		if (std::isnan(value)) {
+			out += "NaN";
+		}
+		else if (std::isinf(value)) {
+			out += value > 0 ? "+Inf" : "-Inf";
+		}
+		else if (value == std::floor(value) && std::fabs(value) < 1e15) {
+			char buffer[24];
+			const auto result = std::to_chars(buffer, buffer + sizeof(buffer), static_cast<int64_t>(value));
+			out.append(buffer, result.ptr);
+		}
+		else {
+			char buffer[32];
+			const int length = std::snprintf(buffer, sizeof(buffer), "%.9g", value);
+			out.append(buffer, static_cast<size_t>(length));
+		}
+	}
+};
+
+// ============================================================================
+// The stats of janus' components
+// ============================================================================
+
+inline void write_stats(openmetrics_writer &w, const tier_stats &s, const metric_labels &labels = {}) {
+	w.counter("tier_hits", "Reads answered by the local tier", s.hits, labels);
+	w.counter("tier_misses", "Reads answered by Redis", s.misses, labels);
+	const uint64_t reads = s.hits + s.misses;
+	w.gauge("tier_hit_ratio", "Share of the reads answered by the local tier since start",
+			reads == 0 ? 0.0 : static_cast<double>(s.hits) / static_cast<double>(reads), labels);
+	w.counter("tier_promotions", "Keys copied into the local tier", s.promotions, labels);
+	w.counter("tier_demotions", "Local copies evicted", s.demotions, labels);
+	w.counter("tier_invalidations", "Local copies dropped by invalidation messages", s.invalidations, labels);
+	w.counter("tier_flushed", "Dirty keys written back to Redis", s.flushed, labels);
+	w.counter("tier_flush_errors", "Failed write-backs", s.flush_errors, labels);
+	w.counter("tier_publish_errors", "Failed invalidation publications", s.publish_errors, labels);
+	w.counter("tier_warmed", "Keys loaded from the snapshot", s.warmed, labels);
+	w.counter("tier_snapshot_errors", "Failed snapshot saves and loads", s.snapshot_errors, labels);
+	w.gauge("tier_local_keys", "Keys with a local copy", static_cast<double>(s.local_keys), labels);
+	w.gauge("tier_local_bytes", "Bytes of the local copies", static_cast<double>(s.local_bytes), labels);
+}
+
+inline void write_stats(openmetrics_writer &w, const shm_cache_stats &s, const metric_labels &labels = {}) {
+	w.counter("shm_cache_hits", "Lookups that found an entry", s.hits, labels);
+	w.counter("shm_cache_misses", "Lookups that found no entry", s.misses, labels);
+	const uint64_t lookups = s.hits + s.misses;
+	w.gauge("shm_cache_hit_ratio", "Share of the lookups that found an entry since start",
+			lookups == 0 ? 0.0 : static_cast<double>(s.hits) / static_cast<double>(lookups), labels);
+	w.counter("shm_cache_sets", "Entries stored", s.sets, labels);
+	w.counter("shm_cache_rejected", "Entries not cached for lack of room", s.rejected, labels);
+	w.counter("shm_cache_evictions", "Entries evicted", s.evictions, labels);
+}
+
+inline void write_stats(openmetrics_writer &w, const replica_stats &s, const metric_labels &labels = {}) {
+	w.gauge("replica_link_up", "Whether the replication link is streaming", s.link_up ? 1 : 0, labels);
+	w.gauge("replica_synced", "Whether a full synchronization completed", s.synced ? 1 : 0, labels);
+	w.gauge("replica_offset", "Replication offset of the last command applied", static_cast<double>(s.offset),
+			labels);
+	w.counter("replica_full_syncs", "Full synchronizations", s.full_syncs, labels);
+	w.counter("replica_partial_syncs", "Partial synchronizations", s.partial_syncs, labels);
+	w.counter("replica_commands", "Commands applied from the stream", s.commands, labels);
+	w.counter("replica_skipped_commands", "Stream commands dropped", s.skipped_commands, labels);
+	w.counter("replica_skipped_keys", "Snapshot keys dropped", s.skipped_keys, labels);
+	w.counter("replica_link_failures", "Replication link failures", s.link_failures, labels);
+	w.gauge("replica_last_io_seconds", "Time since data was last received from the primary",
+			static_cast<double>(s.last_io.count()) / 1000.0, labels);
+}
+
+inline void write_stats(openmetrics_writer &w, const bulk_load_stats &s, const metric_labels &labels = {}) {
+	w.counter("bulk_load_queued", "Commands handed to the bulk loader", s.queued, labels);
+	w.counter("bulk_load_replied", "Bulk load commands answered", s.replied, labels);
+	w.counter("bulk_load_errors", "Bulk load commands answered with an error", s.errors, labels);
+	w.counter("bulk_load_sent_bytes", "Bulk load bytes sent", s.bytes, labels);
+}
+
+inline void write_stats(openmetrics_writer &w, const migration_stats &s, const metric_labels &labels = {}) {
+	w.counter("migration_scanned", "Keys returned by SCAN", s.scanned, labels);
+	w.counter("migration_migrated", "Keys restored on the target", s.migrated, labels);
+	w.counter("migration_vanished", "Keys gone before they were dumped", s.vanished, labels);
+	w.counter("migration_skipped", "Keys kept on the target", s.skipped, labels);
+	w.counter("migration_errors", "Keys whose DUMP or RESTORE failed", s.errors, labels);
+	w.counter("migration_copied_bytes", "DUMP payload bytes copied", s.bytes, labels);
+	w.counter("migration_verified", "Keys compared after the copy", s.verified, labels);
+	w.counter("migration_mismatches", "Compared keys that differed", s.mismatches, labels);
+	w.gauge("migration_completed", "Whether every cursor reached its end", s.completed ? 1 : 0, labels);
+}
+
+inline void write_stats(openmetrics_writer &w, const hot_key_report &r, const metric_labels &labels = {}) {
+	for (const auto &k: r.hot) {
+		metric_labels key_labels = labels;
+		key_labels.emplace_back("key", k.key);
+		w.gauge("hot_key_calls", "Estimated calls of the hottest keys in the last window", static_cast<double>(k.value),
+				key_labels);
+	}
+	for (const auto &k: r.big) {
+		metric_labels key_labels = labels;
+		key_labels.emplace_back("key", k.key);
+		w.gauge("big_key_bytes", "Largest bytes moved by one call of the biggest keys in the last window",
+				static_cast<double>(k.value), key_labels);
+	}
+	for (const auto &p: r.prefixes) {
+		metric_labels prefix_labels = labels;
+		prefix_labels.emplace_back("prefix", p.prefix);
+		w.counter("key_prefix_calls", "Estimated calls by key prefix", p.calls, prefix_labels);
+		w.counter("key_prefix_sent_bytes", "Estimated bytes sent by key prefix", p.bytes_sent, prefix_labels);
+		w.counter("key_prefix_received_bytes", "Estimated bytes received by key prefix", p.bytes_received,
+				  prefix_labels);
+	}
+}
+
+inline void write_stats(openmetrics_writer &w, const memory_analysis &a, const metric_labels &labels = {}) {
+	w.gauge("memory_analyzed_keys", "Keys analyzed by the last memory analysis", static_cast<double>(a.analyzed),
+			labels);
+	for (const auto &p: a.prefixes) {
+		metric_labels prefix_labels = labels;
+		prefix_labels.emplace_back("prefix", p.prefix);
+		w.gauge("memory_prefix_bytes", "MEMORY USAGE of the analyzed keys by prefix", static_cast<double>(p.bytes),
+				prefix_labels);
+		w.gauge("memory_prefix_keys", "Analyzed keys by prefix", static_cast<double>(p.keys), prefix_labels);
+	}
+	for (const auto &e: a.encodings) {
+		metric_labels encoding_labels = labels;
+		const size_t space = e.first.find(' ');
+		encoding_labels.emplace_back("type", e.first.substr(0, space));
+		encoding_labels.emplace_back("encoding", space == std::string::npos ? "" : e.first.substr(space + 1));
+		w.gauge("memory_encoding_bytes", "MEMORY USAGE of the analyzed keys by type and encoding",
+				static_cast<double>(e.second.bytes), encoding_labels);
+		w.gauge("memory_encoding_keys", "Analyzed keys by type and encoding", static_cast<double>(e.second.keys),
+				encoding_labels);
+	}
+	w.gauge("memory_near_threshold_keys", "Analyzed keys just above a listpack threshold",
+			static_cast<double>(a.near_thresholds.size()), labels);
+}
+
+// ============================================================================
+// Exporter
+// ============================================================================
+
+/**
+ * @brief Tuning knobs of an openmetrics_exporter.
+ */
+struct openmetrics_options {
+	/* Prefix of every metric name */
+	std::string prefix{"janus"};
+	/* Upper bounds, in nanoseconds, of the latency buckets exported. The registry's 592 buckets are summed into
+	 * these, which keeps scrapes small; Prometheus computes quantiles from them */
+	std::vector<uint64_t> latency_bounds{25'000,     50'000,      100'000,     250'000,      500'000,
+										 1'000'000,  2'500'000,   5'000'000,   10'000'000,   25'000'000,
+										 50'000'000, 100'000'000, 250'000'000, 1'000'000'000};
+	/* Also export the stage_profiler's histograms while profiling is on */
+	bool stages{true};
+};
+
+/**
+ * @brief Renders a metrics_registry, and whatever the registered collectors add, in the OpenMetrics text format.
+ * * Exported families, with the default prefix:
+ * - janus_commands_total, janus_command_errors_total, janus_command_sent_bytes_total,
+ *   janus_command_received_bytes_total, janus_command_reply_elements_total and the janus_command_duration_seconds
+ *   histogram, labelled by command;
+ * - janus_stage_duration_seconds, labelled by command and stage, while the stage_profiler samples;
+ * - one gauge per registry gauge, e.g. janus_pipeline_depth_max;
+ * - what the collectors write, e.g. with write_stats() for tier_stats, shm_cache_stats, replica_stats, the
+ *   hot_key_detector's report or a memory_analysis, ...
+ *
+ * Rendering takes a registry snapshot, which reads the per-thread shards with relaxed loads: recording threads are
+ * never blocked, so scrapes do not disturb the calls being measured. A render costs in the order of a microsecond
+ * per command type and collector sample.
+ */
+class openmetrics_exporter {
+public:
+	using collector = std::function<void(openmetrics_writer &)>;
+
+	/* The Content-Type of the rendered text */
+	static constexpr const char *content_type = "application/openmetrics-text; version=1.0.0; charset=utf-8";
+
+	explicit openmetrics_exporter(metrics_registry &registry = metrics_registry::global(),
+								  openmetrics_options options = {})
+		: registry(&registry), options(std::move(options)) {
+		std::sort(this->options.latency_bounds.begin(), this->options.latency_bounds.end());
+	}
+
+	/**
+	 * @brief Registers a source of metrics, called at each render, e.g.
+	 * exporter.add_collector([tier](openmetrics_writer &w) { write_stats(w, tier->stats(), {{"tier", "sessions"}}); });
+	 * @note The collector must stay callable as long as the exporter renders.
+	 */
+	void add_collector(collector c) {
+		std::lock_guard<std::mutex> lock(mutex);
+		collectors.push_back(std::move(c));
+	}
+
+	std::string render() const {
+		std::string out;
+		render(out);
+		return out;
+	}
+
+	/**
+	 * @brief Appends the exposition to a string, whose capacity may be reused from scrape to scrape.
+	 * @throw Whatever a collector throws.
+	 */
+	void render(std::string &out) const {
+		openmetrics_writer w(options.prefix);
+		const metrics_snapshot snapshot = registry->snapshot();
+		for (const auto &entry: snapshot.commands) {
+			const metric_labels labels{{"command", entry.first}};
+			const command_stats &s = entry.second;
+			w.counter("commands", "Calls by command", s.ops, labels);
+			w.counter("command_errors", "Calls that failed or returned error replies", s.errors, labels);
+			w.counter("command_sent_bytes", "Bytes of keys, values and arguments sent", s.bytes_sent, labels);
+			w.counter("command_received_bytes", "Bytes of values received", s.bytes_received, labels);
+			w.counter("command_reply_elements", "Elements of multi-element replies", s.elements, labels);
+			w.histogram("command_duration_seconds", "Call latency", s.latency, options.latency_bounds, 1e-9, labels);
+		}
+		for (const auto &entry: snapshot.gauges) {
+			w.gauge(entry.first, "Registry gauge", static_cast<double>(entry.second));
+		}
+		if (options.stages && stage_profiler::sample_rate() != 0) {
+			for (const auto &command: stage_profiler::snapshot().commands) {
+				for (const auto &s: command.second) {
+					w.histogram("stage_duration_seconds", "Sampled duration of the stages of a call", s.second,
+								options.latency_bounds, 1e-9, {{"command", command.first}, {"stage", s.first}});
+				}
+			}
+		}
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			for (const auto &c: collectors) {
+				c(w);
+			}
+		}
+		w.finish(out);
+	}
+
+private:
+	metrics_registry *registry;
+	openmetrics_options options;
+	mutable std::mutex mutex;
+	std::vector<collector> collectors;
+};
+
+/**
+ * @brief A minimal HTTP server answering GET /metrics with an exporter's rendering, for Prometheus to scrape.
+ * * It listens on the loopback interface by default, serves one request per connection on a thread of its own, and
+ * gives up on clients that do not send their request within a second. Anything else than GET /metrics is answered
+ * with 404 or 405.
+ */
+class openmetrics_listener {
+public:
+	/**
+	 * @param exporter Must outlive the listener.
+	 * @param port The TCP port; 0 picks a free one, see port().
+	 * @param address The IPv4 address to listen on.
+	 * @throw std::invalid_argument If the address is not an IPv4 address.
+	 * @throw std::runtime_error If the socket cannot be set up.
+	 */
+	openmetrics_listener(const openmetrics_exporter &exporter, uint16_t port, const std::string &address = "127.0.0.1")
+		: exporter(exporter) {
+		sockaddr_in bound{};
+		bound.sin_family = AF_INET;
+		bound.sin_port = htons(port);
+		if (::inet_pton(AF_INET, address.c_str(), &bound.sin_addr) != 1) {
+			throw std::invalid_argument("openmetrics_listener: not an IPv4 address: " + address);
+		}
+		int pipe_fds[2];
+		if (::pipe2(pipe_fds, O_CLOEXEC) != 0) throw_errno("pipe");
+		wake_read = pipe_fds[0];
+		wake_write = pipe_fds[1];
+		fd = ::socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		if (fd < 0) {
+			close_all();
+			throw_errno("socket");
+		}
+		const int one = 1;
+		::setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		socklen_t length = sizeof(bound);
+		if (::bind(fd, reinterpret_cast<const sockaddr *>(&bound), length) != 0 || ::listen(fd, 16) != 0
+			|| ::getsockname(fd, reinterpret_cast<sockaddr *>(&bound), &length) != 0) {
+			const int error = errno;
+			close_all();
+			errno = error;
+			throw_errno("cannot listen on " + address + ":" + std::to_string(port));
+		}
+		bound_port = ntohs(bound.sin_port);
+		worker = std::thread([this] { run(); });
+	}
+
+	~openmetrics_listener() {
+		const char stop = 0;
+		while (::write(wake_write, &stop, 1) < 0 && errno == EINTR) {
+		}
+		worker.join();
+		close_all();
+	}
+
+	openmetrics_listener(const openmetrics_listener &) = delete;
+	openmetrics_listener &operator=(const openmetrics_listener &) = delete;
+
+	uint16_t port() const {
+		return bound_port;
+	}
+
+private:
+	const openmetrics_exporter &exporter;
+	int fd{-1};
+	int wake_read{-1};
+	int wake_write{-1};
+	uint16_t bound_port{0};
+	std::thread worker;
+	/* The last rendering, whose capacity is reused */
+	std::string body;
+
+	[[noreturn]] static void throw_errno(const std::string &what) {
+		throw std::runtime_error("openmetrics_listener: " + what + ": " + std::strerror(errno));
+	}
+
+	void close_all() {
+		for (int *f: {&fd, &wake_read, &wake_write}) {
+			if (*f >= 0) ::close(*f);
+			*f = -1;
+		}
+	}
+
+	void run() {
+		for (;;) {
+			pollfd fds[2] = {{fd, POLLIN, 0}, {wake_read, POLLIN, 0}};
+			if (::poll(fds, 2, -1) < 0) {
+				if (errno == EINTR) continue;
+				return;
+			}
+			if (fds[1].revents != 0) return;
+			const int client = ::accept4(fd, nullptr, nullptr, SOCK_CLOEXEC);
+			if (client < 0) continue;
+			serve(client);
+			::close(client);
+		}
+	}
+
+	void serve(int client) {
+		const timeval timeout{1, 0};
+		::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+		::setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		std::string request;
+		char buffer[1024];
+		while (request.find("\r\n\r\n") == std::string::npos && request.size() < 8192) {
+			const ssize_t n = ::read(client, buffer, sizeof(buffer));
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return;
+			request.append(buffer, static_cast<size_t>(n));
+		}
+		const size_t line_end = request.find("\r\n");
+		const std::string line = request.substr(0, line_end);
+		const size_t space = line.find(' ');
+		const std::string method = line.substr(0, space);
+		std::string path;
+		if (space != std::string::npos) path = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+		path = path.substr(0, path.find('?'));
+
+		if (path != "/metrics") {
+			respond(client, "404 Not Found", "text/plain", "not found\n");
+		}
+		else if (method != "GET") {
+			respond(client, "405 Method Not Allowed", "text/plain", "method not allowed\n");
+		}
+		else {
+			try {
+				body.clear();
+				exporter.render(body);
+				respond(client, "200 OK", openmetrics_exporter::content_type, body);
+			}
+			catch (const std::exception &e) {
+				respond(client, "500 Internal Server Error", "text/plain", std::string(e.what()) + "\n");
+			}
+		}
+	}
+
+	static void respond(int client, const char *status, const char *type, const std::string &content) {
+		std::string header = "HTTP/1.1 ";
+		header += status;
+		header += "\r\nContent-Type: ";
+		header += type;
+		header += "\r\nContent-Length: " + std::to_string(content.size()) + "\r\nConnection: close\r\n\r\n";
+		if (write_all(client, header.data(), header.size())) write_all(client, content.data(), content.size());
+	}
+
+	static bool write_all(int client, const char *data, size_t size) {
+		while (size > 0) {
+			const ssize_t n = ::send(client, data, size, MSG_NOSIGNAL);
+			if (n < 0 && errno == EINTR) continue;
+			if (n <= 0) return false;
+			data += n;
+			size -= static_cast<size_t>(n);
+		}
+		return true;
+	}
+};
@@ -1,9 +1,16 @@
 #pragma once
 
+#include <array>
 #include <optional>
+#include <stdexcept>
 #include <unordered_map>
 #include <vector>
 
+#include "bitfield.hpp"
+#include "hyperloglog.hpp"
+#include "roaring.hpp"
+#include "scan_filter.hpp"
+
 template<typename K, typename V>
 class value_operations {
 public:
@@ -312,3 +319,290 @@ public:
 	 */
 	virtual std::vector<std::pair<V, double>> zrevrange_withscores(const K &key, long long start, long long stop) = 0;
 };
+
+template<typename K, typename V>
+class filter_operations {
+public:
+	virtual ~filter_operations() = default;
+
+	/**
+	 * @brief Returns the hash entries matching a filter. The filter runs server-side over HSCAN pages, so only matching
+	 * entries are transferred. (Corresponds to HSCAN inside a Lua script)
+	 * @param key The hash key (K).
+	 * @param where The filter, see filter_field() and filter_value().
+	 * @param limit The maximum number of entries to return, or 0 for no limit.
+	 * @return An unordered map containing the matching fields and values.
+	 */
+	virtual std::unordered_map<K, V> hscan(const K &key, const filter_expr &where, long long limit) = 0;
+
+	/**
+	 * @brief Returns the fields of the hash entries matching a filter; values are not transferred.
+	 * @param key The hash key (K).
+	 * @param where The filter, see filter_field() and filter_value().
+	 * @param limit The maximum number of fields to return, or 0 for no limit.
+	 * @return A vector of the matching field keys.
+	 */
+	virtual std::vector<K> hscan_fields(const K &key, const filter_expr &where, long long limit) = 0;
+
+	/**
+	 * @brief Returns the values of the hash entries matching a filter; fields are not transferred.
+	 * @param key The hash key (K).
+	 * @param where The filter, see filter_field() and filter_value().
+	 * @param limit The maximum number of values to return, or 0 for no limit.
+	 * @return A vector of the matching values.
+	 */
+	virtual std::vector<V> hscan_values(const K &key, const filter_expr &where, long long limit) = 0;
+
+	/**
+	 * @brief Returns the set members matching a filter. (Corresponds to SSCAN inside a Lua script)
+	 * @param key The set key (K).
+	 * @param where The filter; field and value both refer to the member.
+	 * @param limit The maximum number of members to return, or 0 for no limit.
+	 * @return A vector of the matching members (V).
+	 */
+	virtual std::vector<V> sscan(const K &key, const filter_expr &where, long long limit) = 0;
+
+	/**
+	 * @brief Returns the list elements matching a filter, in list order. (Corresponds to paged LRANGE inside a Lua
+	 * script)
+	 * @param key The list key (K).
+	 * @param where The filter; field and value both refer to the element.
+	 * @param limit The maximum number of elements to return, or 0 for no limit.
+	 * @return A vector of the matching elements (V).
+	 */
+	virtual std::vector<V> lrange(const K &key, const filter_expr &where, long long limit) = 0;
+};
+
+template<typename K, typename V>
+class hll_operations {
+public:
+	virtual ~hll_operations() = default;
+
+	/**
+	 * @brief Adds elements to a HyperLogLog. (Corresponds to PFADD)
+	 * @param key The HyperLogLog key (K).
+	 * @param elements The elements (V) to add.
+	 * @return True if the approximated cardinality may have changed.
+	 */
+	virtual bool pfadd(const K &key, const std::vector<V> &elements) = 0;
+
+	/**
+	 * @brief Returns the approximated cardinality of a HyperLogLog. (Corresponds to PFCOUNT)
+	 * @param key The HyperLogLog key (K).
+	 * @return The approximated number of unique elements, or 0 if the key does not exist.
+	 */
+	virtual long long pfcount(const K &key) = 0;
+
+	/**
+	 * @brief Returns the approximated cardinality of the union of several HyperLogLogs. (Corresponds to PFCOUNT)
+	 * @param keys The HyperLogLog keys (K).
+	 * @return The approximated number of unique elements in the union.
+	 */
+	virtual long long pfcount(const std::vector<K> &keys) = 0;
+
+	/**
+	 * @brief Merges HyperLogLogs into a destination key. (Corresponds to PFMERGE)
+	 * @param dest The destination key (K); its current content is part of the union.
+	 * @param sources The source keys (K).
+	 * @return True on success.
+	 */
+	virtual bool pfmerge(const K &dest, const std::vector<K> &sources) = 0;
+
+	/**
+	 * @brief Merges a locally aggregated sketch into a HyperLogLog key in one round trip. (Corresponds to SET of the raw
+	 * representation followed by PFMERGE, inside MULTI/EXEC)
+	 * @param dest The destination key (K).
+	 * @param sketch The sketch; elements must have been added in serialized form to match PFADD.
+	 * @return True on success.
+	 */
+	virtual bool pfmerge(const K &dest, const hll_sketch &sketch) = 0;
+
+	/**
+	 * @brief Reads a HyperLogLog key into a local sketch. (Corresponds to GET)
+	 * @param key The HyperLogLog key (K).
+	 * @return The sketch; empty if the key does not exist.
+	 */
+	virtual hll_sketch get_sketch(const K &key) = 0;
+};
+
+template<typename K, typename V>
+class bitmap_operations {
+public:
+	virtual ~bitmap_operations() = default;
+
+	/**
+	 * @brief Sets or clears a single bit. (Corresponds to SETBIT)
+	 * @param key The string key (K).
+	 * @param offset The bit offset (0 is the most significant bit of the first byte).
+	 * @param value The new bit value.
+	 * @return The previous bit value.
+	 */
+	virtual bool setbit(const K &key, long long offset, bool value) = 0;
+
+	/**
+	 * @brief Returns a single bit. (Corresponds to GETBIT)
+	 * @param key The string key (K).
+	 * @param offset The bit offset.
+	 * @return The bit value; false if the key does not exist or the offset is beyond the string.
+	 */
+	virtual bool getbit(const K &key, long long offset) = 0;
+
+	/**
+	 * @brief Sets or clears many bits in one round trip. (Corresponds to BITFIELD with SET u1 sub-operations)
+	 * @param key The string key (K).
+	 * @param offsets The bit offsets.
+	 * @param value The new bit value.
+	 * @return The previous bit values, in offset order.
+	 */
+	virtual std::vector<bool> setbits(const K &key, const std::vector<long long> &offsets, bool value) = 0;
+
+	/**
+	 * @brief Returns many bits in one round trip. (Corresponds to BITFIELD with GET u1 sub-operations)
+	 * @param key The string key (K).
+	 * @param offsets The bit offsets.
+	 * @return The bit values, in offset order.
+	 */
+	virtual std::vector<bool> getbits(const K &key, const std::vector<long long> &offsets) = 0;
+
+	/**
+	 * @brief Counts all set bits of a string. (Corresponds to BITCOUNT)
+	 * @param key The string key (K).
+	 * @return The number of bits set to 1, or 0 if the key does not exist.
+	 */
+	virtual long long bitcount(const K &key) = 0;
+
+	/**
+	 * @brief Counts the set bits of a string within a byte range. (Corresponds to BITCOUNT start end)
+	 * @param key The string key (K).
+	 * @param start The first byte (negative values count from the end).
+	 * @param end The last byte, inclusive (-1 is the last byte).
+	 * @return The number of bits set to 1.
+	 */
+	virtual long long bitcount(const K &key, long long start, long long end) = 0;
+
+	/**
+	 * @brief Returns the position of the first bit set to the given value. (Corresponds to BITPOS)
+	 * @param key The string key (K).
+	 * @param bit The bit value to look for.
+	 * @param start The first byte (negative values count from the end).
+	 * @param end The last byte, inclusive (-1 is the last byte).
+	 * @return The bit position, or -1 if not found.
+	 */
+	virtual long long bitpos(const K &key, bool bit, long long start, long long end) = 0;
+
+	/**
+	 * @brief Performs a bitwise operation between strings and stores the result in dest. (Corresponds to BITOP)
+	 * @param op The operation; bit_not takes exactly one source key.
+	 * @param dest The destination key (K).
+	 * @param keys The source keys (K).
+	 * @return The length of the resulting string in bytes.
+	 */
+	virtual long long bitop(bitwise_op op, const K &dest, const std::vector<K> &keys) = 0;
+
+	/**
+	 * @brief Executes all sub-operations of a bitfield_command in one round trip. (Corresponds to BITFIELD)
+	 * @param key The string key (K).
+	 * @param command The sub-operations.
+	 * @return One result per sub-operation, in order; std::nullopt where INCRBY failed with OVERFLOW FAIL.
+	 */
+	virtual std::vector<std::optional<long long>> bitfield(const K &key, const bitfield_command &command) = 0;
+
+	/**
+	 * @brief Executes a bitfield_command with a known number of sub-operations and decodes the results into a fixed
+	 * array.
+	 * @tparam N The number of sub-operations of the command.
+	 * @param key The string key (K).
+	 * @param command The sub-operations.
+	 * @return One result per sub-operation, in order.
+	 * @throw std::invalid_argument if the command does not have exactly N sub-operations.
+	 */
+	template<size_t N>
+	std::array<std::optional<long long>, N> bitfield(const K &key, const bitfield_command &command) {
+		if (command.size() != N) {
+			throw std::invalid_argument("bitfield: command does not have the expected number of sub-operations");
+		}
+		auto values = bitfield(key, command);
+		if (values.size() != N) {
+			throw std::runtime_error("BITFIELD: unexpected number of results");
+		}
+		std::array<std::optional<long long>, N> result;
+		for (size_t i = 0; i < N; ++i) {
+			result[i] = values[i];
+		}
+		return result;
+	}
+};
+
+template<typename K, typename V>
+class roaring_operations {
+public:
+	virtual ~roaring_operations() = default;
+
+	/**
+	 * @brief Adds integers to a chunked roaring bitmap. Only the chunks the integers fall into are read and rewritten,
+	 * in one optimistic transaction. (Corresponds to WATCH + GET, then MULTI / SET / HSET / EXEC)
+	 * @param key The bitmap key (K).
+	 * @param values The integers to add.
+	 * @return The number of integers that were not present before.
+	 */
+	virtual long long add(const K &key, const std::vector<uint32_t> &values) = 0;
+
+	/**
+	 * @brief Removes integers from a chunked roaring bitmap; chunks that become empty are deleted.
+	 * @param key The bitmap key (K).
+	 * @param values The integers to remove.
+	 * @return The number of integers that were present.
+	 */
+	virtual long long remove(const K &key, const std::vector<uint32_t> &values) = 0;
+
+	/**
+	 * @brief Replaces a chunked roaring bitmap with a local one.
+	 * @param key The bitmap key (K).
+	 * @param bitmap The new content.
+	 */
+	virtual void store(const K &key, const roaring_bitmap &bitmap) = 0;
+
+	/**
+	 * @brief Reads all chunks of a roaring bitmap.
+	 * @param key The bitmap key (K).
+	 * @return The bitmap; empty if the key does not exist.
+	 */
+	virtual roaring_bitmap load(const K &key) = 0;
+
+	/**
+	 * @brief Tests membership by reading only the type byte and the relevant bitmap byte of one chunk. Chunks in array
+	 * form (at most 8 KiB) need a second round trip. (Corresponds to GETRANGE)
+	 * @param key The bitmap key (K).
+	 * @param value The integer to test.
+	 * @return True if the integer is in the bitmap.
+	 */
+	virtual bool contains(const K &key, uint32_t value) = 0;
+
+	/**
+	 * @brief Returns the number of integers in the bitmap from the chunk index, without reading any chunk.
+	 * @param key The bitmap key (K).
+	 * @return The cardinality, or 0 if the key does not exist.
+	 */
+	virtual long long cardinality(const K &key) = 0;
+
+	/**
+	 * @brief Intersects several bitmaps client-side, fetching only the chunks present in all of them.
+	 * @param keys The bitmap keys (K).
+	 * @return The intersection; empty if keys is empty.
+	 */
+	virtual roaring_bitmap intersect(const std::vector<K> &keys) = 0;
+
+	/**
+	 * @brief Unites several bitmaps client-side.
+	 * @param keys The bitmap keys (K).
+	 * @return The union.
+	 */
+	virtual roaring_bitmap unite(const std::vector<K> &keys) = 0;
+
+	/**
+	 * @brief Deletes a bitmap with all of its chunks.
+	 * @param key The bitmap key (K).
+	 * @return The number of Redis keys removed.
+	 */
+	virtual long long del(const K &key) = 0;
+};
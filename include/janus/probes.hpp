@@ -0,0 +1,131 @@
+#pragma once
+
+/**
+ * USDT (SystemTap/DTrace-style) static probes of provider "janus", for bpftrace and perf on production hosts:
+ *
+ *   command__send(const char *command, size_t command_id, uint64_t key_hash, uint64_t bytes, uint64_t batch)
+ *   reply__receive(const char *command, size_t command_id, uint64_t key_hash, uint64_t bytes, uint64_t latency_ns,
+ *                  int failed)
+ *       Around each call of an observed_connection with a probe_observer. key_hash is the murmurhash64a of the
+ *       first key, command_id a metrics_registry::command_id().
+ *   redis__send(const char *command, size_t command_length, uint64_t bytes)
+ *   redis__receive(const char *command, size_t command_length, uint64_t latency_ns, int reply_type)
+ *       Around each round trip of a redis_connection; command is not null-terminated, and bytes counts the arguments
+ *       of commands sent as argument vectors (0 otherwise).
+ *   redis__connect(const char *host, int port, int ok)
+ *       When a redis_connection connects.
+ *   replica__link(const char *host, int port, int ok)
+ *       When a replica_connection (re)connects to its primary.
+ *   serialize(int kind, uint64_t bytes), deserialize(int kind, uint64_t bytes)
+ *       Around redis_template's serializers; kind is 0 for keys and 1 for values.
+ *
+ * For example: bpftrace -e 'usdt:./app:janus:reply__receive { @us[str(arg0)] = hist(arg4 / 1000); }'
+ *
+ * A probe is a NOP until a tracer attaches. Probes whose arguments cost something to compute are guarded by
+ * JANUS_PROBE_ENABLED(name), which reads the probe's semaphore: the tracer raises it while attached. Probes are
+ * compiled in on x86-64 and AArch64 ELF targets, and out with JANUS_DISABLE_PROBES.
+ *
+ * The probe notes (.note.stapsdt) and semaphores are emitted here rather than through <sys/sdt.h>, in the format it
+ * defines, so nothing depends on systemtap-sdt-dev and nothing leaks into the including translation unit: its own
+ * DTRACE_PROBEs keep whatever semaphore setting it chose, whether it includes sdt.h before or after this header.
+ */
+
+#include <type_traits>
+
+#if !defined(JANUS_DISABLE_PROBES) && defined(__ELF__) && (defined(__x86_64__) || defined(__aarch64__))
+#define JANUS_PROBES 1
+#endif
+
+#ifdef JANUS_PROBES
+/* Size of a probe argument in the note: negative for signed types, as sdt.h encodes it (printed negated by %n) */
+template<typename T>
+struct janus_probe_arg {
+	using type = std::decay_t<T>;
+	static constexpr int size = (std::is_signed<type>::value ? 1 : -1) * static_cast<int>(sizeof(type));
+};
+
+#define JANUS_PROBE_SEMAPHORE(name)                                                                                   \
+	inline volatile unsigned short janus_##name##_semaphore __attribute__((section(".probes"), used)) = 0;
+#define JANUS_PROBE_ENABLED(name) __builtin_expect(janus_##name##_semaphore != 0, 0)
+
+#define JANUS_PROBE_STR(...) #__VA_ARGS__
+#define JANUS_PROBE_ASM(...) JANUS_PROBE_STR(__VA_ARGS__) "\n"
+#define JANUS_PROBE_OPERAND(n, x)                                                                                     \
+	[janus_size##n] "n"(janus_probe_arg<decltype(x)>::size), [janus_arg##n] "nor"(x)
+#define JANUS_PROBE_FORMAT(no) JANUS_PROBE_STR(%n[janus_size##no]@%[janus_arg##no])
+
+/*
+ * The probe site is a NOP at label 990; the note records its address, the semaphore address and the argument
+ * locations. .stapsdt.base lets tracers correct the addresses of prelinked binaries, as sdt.h does.
+ */
+#define JANUS_PROBE_ASM_NOTE(name, formats, ...)                                                                      \
+	__asm__ __volatile__(JANUS_PROBE_ASM(990: nop)                                                                    \
+						 JANUS_PROBE_ASM(.pushsection .note.stapsdt, "?", "note")                                     \
+						 JANUS_PROBE_ASM(.balign 4)                                                                   \
+						 JANUS_PROBE_ASM(.4byte 992f-991f, 994f-993f, 3)                                              \
+						 JANUS_PROBE_ASM(991: .asciz "stapsdt")                                                       \
+						 JANUS_PROBE_ASM(992: .balign 4)                                                              \
+						 JANUS_PROBE_ASM(993: .8byte 990b)                                                            \
+						 JANUS_PROBE_ASM(.8byte _.stapsdt.base)                                                       \
+						 JANUS_PROBE_ASM(.8byte janus_##name##_semaphore)                                             \
+						 JANUS_PROBE_ASM(.asciz "janus")                                                              \
+						 JANUS_PROBE_ASM(.asciz #name)                                                                \
+						 ".asciz \"" formats "\"\n"                                                                    \
+						 JANUS_PROBE_ASM(994: .balign 4)                                                              \
+						 JANUS_PROBE_ASM(.popsection)                                                                 \
+						 JANUS_PROBE_ASM(.ifndef _.stapsdt.base)                                                      \
+						 JANUS_PROBE_ASM(.pushsection .stapsdt.base, "aG", "progbits", .stapsdt.base, comdat)         \
+						 JANUS_PROBE_ASM(.weak _.stapsdt.base)                                                        \
+						 JANUS_PROBE_ASM(.hidden _.stapsdt.base)                                                      \
+						 JANUS_PROBE_ASM(_.stapsdt.base: .space 1)                                                    \
+						 JANUS_PROBE_ASM(.size _.stapsdt.base, 1)                                                     \
+						 JANUS_PROBE_ASM(.popsection)                                                                 \
+						 JANUS_PROBE_ASM(.endif)                                                                      \
+						 :                                                                                            \
+						 : __VA_ARGS__)
+
+#define JANUS_PROBE2(name, a, b)                                                                                      \
+	JANUS_PROBE_ASM_NOTE(name, JANUS_PROBE_FORMAT(1) " " JANUS_PROBE_FORMAT(2), JANUS_PROBE_OPERAND(1, a),          \
+						 JANUS_PROBE_OPERAND(2, b))
+#define JANUS_PROBE3(name, a, b, c)                                                                                   \
+	JANUS_PROBE_ASM_NOTE(name, JANUS_PROBE_FORMAT(1) " " JANUS_PROBE_FORMAT(2) " " JANUS_PROBE_FORMAT(3),           \
+						 JANUS_PROBE_OPERAND(1, a), JANUS_PROBE_OPERAND(2, b), JANUS_PROBE_OPERAND(3, c))
+#define JANUS_PROBE4(name, a, b, c, d)                                                                                \
+	JANUS_PROBE_ASM_NOTE(name,                                                                                        \
+						 JANUS_PROBE_FORMAT(1) " " JANUS_PROBE_FORMAT(2) " " JANUS_PROBE_FORMAT(3) " "               \
+							 JANUS_PROBE_FORMAT(4),                                                                   \
+						 JANUS_PROBE_OPERAND(1, a), JANUS_PROBE_OPERAND(2, b), JANUS_PROBE_OPERAND(3, c),             \
+						 JANUS_PROBE_OPERAND(4, d))
+#define JANUS_PROBE5(name, a, b, c, d, e)                                                                             \
+	JANUS_PROBE_ASM_NOTE(name,                                                                                        \
+						 JANUS_PROBE_FORMAT(1) " " JANUS_PROBE_FORMAT(2) " " JANUS_PROBE_FORMAT(3) " "               \
+							 JANUS_PROBE_FORMAT(4) " " JANUS_PROBE_FORMAT(5),                                         \
+						 JANUS_PROBE_OPERAND(1, a), JANUS_PROBE_OPERAND(2, b), JANUS_PROBE_OPERAND(3, c),             \
+						 JANUS_PROBE_OPERAND(4, d), JANUS_PROBE_OPERAND(5, e))
+#define JANUS_PROBE6(name, a, b, c, d, e, f)                                                                          \
+	JANUS_PROBE_ASM_NOTE(name,                                                                                        \
+						 JANUS_PROBE_FORMAT(1) " " JANUS_PROBE_FORMAT(2) " " JANUS_PROBE_FORMAT(3) " "               \
+							 JANUS_PROBE_FORMAT(4) " " JANUS_PROBE_FORMAT(5) " " JANUS_PROBE_FORMAT(6),               \
+						 JANUS_PROBE_OPERAND(1, a), JANUS_PROBE_OPERAND(2, b), JANUS_PROBE_OPERAND(3, c),             \
+						 JANUS_PROBE_OPERAND(4, d), JANUS_PROBE_OPERAND(5, e), JANUS_PROBE_OPERAND(6, f))
+#else
+#define JANUS_PROBE_SEMAPHORE(name)
+#define JANUS_PROBE_ENABLED(name) 0
+// The arguments are not evaluated, only marked as used
+#define JANUS_PROBE2(name, a, b) ((void)sizeof((a), (b)))
+#define JANUS_PROBE3(name, a, b, c) ((void)sizeof((a), (b), (c)))
+#define JANUS_PROBE4(name, a, b, c, d) ((void)sizeof((a), (b), (c), (d)))
+#define JANUS_PROBE5(name, a, b, c, d, e) ((void)sizeof((a), (b), (c), (d), (e)))
+#define JANUS_PROBE6(name, a, b, c, d, e, f) ((void)sizeof((a), (b), (c), (d), (e), (f)))
+#endif
+
+JANUS_PROBE_SEMAPHORE(command__send)
+JANUS_PROBE_SEMAPHORE(reply__receive)
+JANUS_PROBE_SEMAPHORE(redis__send)
+JANUS_PROBE_SEMAPHORE(redis__receive)
+JANUS_PROBE_SEMAPHORE(redis__connect)
+JANUS_PROBE_SEMAPHORE(replica__link)
+JANUS_PROBE_SEMAPHORE(serialize)
+JANUS_PROBE_SEMAPHORE(deserialize)
+
+#undef JANUS_PROBE_SEMAPHORE
@@ -0,0 +1,256 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+
+#include "redis_template.hpp"
+#include "script.hpp"
+
+/**
+ * @brief The outcome of a rate limiter acquisition.
+ */
+struct rate_limit_decision {
+	/* True if the requested permits were granted */
+	bool allowed{false};
+	/* Permits still available after this decision (in leased mode: permits left in the local lease) */
+	long long remaining{0};
+	/* When denied: how long to wait before the requested permits can be granted */
+	std::chrono::milliseconds retry_after{0};
+};
+
+/**
+ * @brief A distributed rate limiter whose state lives in Redis and is updated atomically by Lua scripts.
+ * * Two algorithms are available:
+ * - sliding_window: an exact sliding log kept in a sorted set (one member per permit, scored by grant time).
+ * - gcra: the Generic Cell Rate Algorithm (equivalent to a token bucket), keeping a single timestamp per key.
+ * Both use the server clock (TIME), so limiter instances in different processes agree on time.
+ *
+ * In leased mode (lease_size > 0) a process reserves up to lease_size permits in one script call and hands them out
+ * locally with atomic operations until the lease is used up or expires, so most acquisitions never leave the
+ * process. Leased permits are counted against the limit when reserved; unused permits of an expired lease are
+ * dropped, never returned, so the limit is never exceeded.
+ * @tparam K The key type of the template.
+ * @tparam V The value type of the template.
+ */
+template<typename K, typename V>
+class rate_limiter {
+public:
+	enum class algorithm { sliding_window, gcra };
+
+	/**
+	 * @brief Constructor.
+	 * @param tpl The template providing the connection and key serializer. Must outlive the limiter.
+	 * @param algo The limiting algorithm.
+	 * @param limit The number of permits allowed per period (for gcra: also the burst capacity).
+	 * @param period The length of the period.
+	 * @param lease_size The number of permits reserved per server call, or 0 to check every acquisition remotely.
+	 * @param lease_ttl How long a lease may be consumed locally; defaults to the period.
+	 */
+	rate_limiter(redis_template<K, V> &tpl, algorithm algo, long long limit, std::chrono::milliseconds period,
+				 long long lease_size = 0, std::chrono::milliseconds lease_ttl = std::chrono::milliseconds::zero()) :
+		tpl(tpl), algo(algo), limit(limit), period(period), lease_size(lease_size),
+		lease_ttl(lease_ttl.count() > 0 ? lease_ttl : period),
+		script(algo == algorithm::sliding_window ? sliding_window_source() : gcra_source()) {
+		if (limit <= 0 || period.count() <= 0 || lease_size < 0) {
+			throw std::invalid_argument("rate_limiter: limit and period must be positive");
+		}
+	}
+
+	/**
+	 * @brief Tries to acquire permits for a key without blocking.
+	 * @param key The rate-limited key (K), e.g. a user or API token.
+	 * @param permits The number of permits to acquire.
+	 * @return The decision; permits are either fully granted or not at all.
+	 */
+	rate_limit_decision try_acquire(const K &key, long long permits = 1) {
+		if (permits <= 0) {
+			return {true, 0, std::chrono::milliseconds::zero()};
+		}
+		if (lease_size == 0 || permits > lease_size) {
+			std::lock_guard<std::mutex> lock(remote_mutex);
+			return reserve(tpl.serialize_key(key), permits, permits).first;
+		}
+
+		const std::string raw_key = tpl.serialize_key(key);
+		const long long now = steady_now_ms();
+		// Held for the whole call: release_lease() or eviction may drop the lease from the map meanwhile
+		const std::shared_ptr<lease> held = lease_for(raw_key, now);
+		lease &l = *held;
+
+		// Fast path: take permits from the local lease
+		if (now < l.expires_at.load(std::memory_order_acquire)) {
+			long long tokens = l.tokens.load(std::memory_order_relaxed);
+			while (tokens >= permits) {
+				if (l.tokens.compare_exchange_weak(tokens, tokens - permits, std::memory_order_acq_rel)) {
+					return {true, tokens - permits, std::chrono::milliseconds::zero()};
+				}
+			}
+		}
+
+		// Slow path: refill the lease from the server; the connection is used by one thread at a time
+		std::lock_guard<std::mutex> lock(remote_mutex);
+		if (now < l.expires_at.load(std::memory_order_acquire)) {
+			long long tokens = l.tokens.load(std::memory_order_relaxed);
+			while (tokens >= permits) {
+				if (l.tokens.compare_exchange_weak(tokens, tokens - permits, std::memory_order_acq_rel)) {
+					return {true, tokens - permits, std::chrono::milliseconds::zero()};
+				}
+			}
+		}
+
+		auto [decision, granted] = reserve(raw_key, lease_size, permits);
+		if (!decision.allowed) {
+			return decision;
+		}
+		l.tokens.store(granted - permits, std::memory_order_relaxed);
+		l.expires_at.store(steady_now_ms() + lease_ttl.count(), std::memory_order_release);
+		decision.remaining = granted - permits;
+		return decision;
+	}
+
+	/**
+	 * @brief Drops the local lease of a key; its unused permits are forfeited. Expired leases are also dropped as new
+	 * keys are leased, so the leases kept stay proportional to the keys in use.
+	 * @param key The rate-limited key (K).
+	 */
+	void release_lease(const K &key) {
+		std::unique_lock<std::shared_mutex> lock(leases_mutex);
+		leases.erase(tpl.serialize_key(key));
+	}
+
+private:
+	struct lease {
+		std::atomic<long long> tokens{0};
+		std::atomic<long long> expires_at{0};
+	};
+
+	static long long steady_now_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	std::shared_ptr<lease> lease_for(const std::string &raw_key, long long now) {
+		{
+			std::shared_lock<std::shared_mutex> lock(leases_mutex);
+			auto it = leases.find(raw_key);
+			if (it != leases.end()) return it->second;
+		}
+		std::unique_lock<std::shared_mutex> lock(leases_mutex);
+		auto it = leases.find(raw_key);
+		if (it != leases.end()) return it->second;
+		if (leases.size() >= next_sweep) {
+			// Amortized: the map at most doubles between sweeps
+			for (auto e = leases.begin(); e != leases.end();) {
+				if (e->second->expires_at.load(std::memory_order_acquire) <= now) e = leases.erase(e);
+				else ++e;
+			}
+			next_sweep = std::max<size_t>(min_sweep, 2 * leases.size());
+		}
+		return leases.emplace(raw_key, std::make_shared<lease>()).first->second;
+	}
+
+	/*
+	 * Reserves between `minimum` and `wanted` permits on the server.
+	 * Script reply: {granted, remaining, retry_after_ms}; granted is 0 when fewer than `minimum` are available.
+	 */
+	std::pair<rate_limit_decision, long long> reserve(const std::string &raw_key, long long wanted,
+													  long long minimum) {
+		std::vector<std::string> keys{raw_key};
+		if (algo == algorithm::sliding_window) {
+			keys.push_back(raw_key + ":seq");
+		}
+		std::vector<std::string> args{std::to_string(period.count()), std::to_string(limit), std::to_string(wanted),
+									  std::to_string(minimum)};
+
+		kv_reply r = script.execute(tpl.get_connection(), keys, args);
+		if (r.type != kv_reply::reply_type::array || r.elements.size() != 3) {
+			throw std::runtime_error("rate_limiter: unexpected script reply");
+		}
+		const long long granted = r.elements[0].integer;
+		rate_limit_decision decision;
+		decision.allowed = granted >= minimum;
+		decision.remaining = r.elements[1].integer;
+		decision.retry_after = std::chrono::milliseconds(r.elements[2].integer);
+		return {decision, granted};
+	}
+
+	/*
+	 * KEYS[1]: sorted set of granted permits scored by grant time, KEYS[2]: member sequence
+	 * ARGV: window_ms, limit, wanted, minimum
+	 */
+	static std::string sliding_window_source() {
+		return "local t = redis.call('TIME')\n"
+			   "local now = tonumber(t[1]) * 1000 + math.floor(tonumber(t[2]) / 1000)\n"
+			   "local window = tonumber(ARGV[1])\n"
+			   "local limit = tonumber(ARGV[2])\n"
+			   "local wanted = tonumber(ARGV[3])\n"
+			   "local minimum = tonumber(ARGV[4])\n"
+			   "redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', now - window)\n"
+			   "local used = redis.call('ZCARD', KEYS[1])\n"
+			   "local granted = math.min(wanted, limit - used)\n"
+			   "if granted < minimum then\n"
+			   "  local retry = 0\n"
+			   "  local oldest = redis.call('ZRANGE', KEYS[1], 0, minimum - (limit - used) - 1, 'WITHSCORES')\n"
+			   "  if #oldest > 0 then retry = tonumber(oldest[#oldest]) + window - now + 1 end\n"
+			   "  return {0, limit - used, retry}\n"
+			   "end\n"
+			   "local seq = redis.call('INCRBY', KEYS[2], granted)\n"
+			   "local batch = {}\n"
+			   "for i = seq - granted + 1, seq do\n"
+			   "  batch[#batch + 1] = now\n"
+			   "  batch[#batch + 1] = i\n"
+			   "  if #batch >= 1000 then redis.call('ZADD', KEYS[1], unpack(batch)); batch = {} end\n"
+			   "end\n"
+			   "if #batch > 0 then redis.call('ZADD', KEYS[1], unpack(batch)) end\n"
+			   "redis.call('PEXPIRE', KEYS[1], window)\n"
+			   "redis.call('PEXPIRE', KEYS[2], window)\n"
+			   "return {granted, limit - used - granted, 0}\n";
+	}
+
+	/*
+	 * KEYS[1]: theoretical arrival time (TAT) in milliseconds
+	 * ARGV: period_ms, limit, wanted, minimum
+	 */
+	static std::string gcra_source() {
+		return "local t = redis.call('TIME')\n"
+			   "local now = tonumber(t[1]) * 1000 + tonumber(t[2]) / 1000\n"
+			   "local limit = tonumber(ARGV[2])\n"
+			   "local interval = tonumber(ARGV[1]) / limit\n"
+			   "local wanted = tonumber(ARGV[3])\n"
+			   "local minimum = tonumber(ARGV[4])\n"
+			   "local tolerance = interval * limit\n"
+			   "local tat = tonumber(redis.call('GET', KEYS[1])) or now\n"
+			   "if tat < now then tat = now end\n"
+			   "local available = math.floor((now + tolerance - tat) / interval)\n"
+			   "local granted = math.min(wanted, available)\n"
+			   "if granted < minimum then\n"
+			   "  return {0, math.max(available, 0), math.ceil(tat + interval * minimum - tolerance - now)}\n"
+			   "end\n"
+			   "local new_tat = tat + granted * interval\n"
+			   "redis.call('SET', KEYS[1], string.format('%.3f', new_tat), 'PX', math.max(1, math.ceil(new_tat - now)))\n"
+			   "return {granted, available - granted, 0}\n";
+	}
+
+	redis_template<K, V> &tpl;
+	algorithm algo;
+	long long limit;
+	std::chrono::milliseconds period;
+	long long lease_size;
+	std::chrono::milliseconds lease_ttl;
+	lua_script script;
+
+	/* Leases by serialized key; expired ones are swept when the map reaches next_sweep entries */
+	static constexpr size_t min_sweep = 64;
+	std::unordered_map<std::string, std::shared_ptr<lease>> leases;
+	size_t next_sweep{min_sweep};
+	std::shared_mutex leases_mutex;
+	std::mutex remote_mutex;
+};
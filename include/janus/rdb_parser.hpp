@@ -0,0 +1,922 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <istream>
+#include <limits>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "hash.hpp"
+#include "redis_template.hpp"
+
+/**
+ * @brief The data type of an RDB entry.
+ */
+enum class rdb_type { string, list, set, zset, hash, stream, module };
+
+/**
+ * @brief One key of an RDB file, with its decoded value.
+ */
+struct rdb_entry {
+	int db{0};
+	std::string key;
+	rdb_type type{rdb_type::string};
+	/* The encoding the value was saved with, named like OBJECT ENCODING reports it: "int", "embstr", "raw",
+	 * "linkedlist", "quicklist", "ziplist", "listpack", "intset", "hashtable", "skiplist", "zipmap", "stream",
+	 * "module" */
+	std::string encoding;
+	/* Absolute expiry in Unix milliseconds; -1 if the key does not expire */
+	int64_t expire_at{-1};
+	/* LRU idle time in seconds and LFU frequency, when the file has them (maxmemory-policy dependent); -1 otherwise */
+	int64_t idle{-1};
+	int freq{-1};
+	/* Bytes the key and value take in the file */
+	uint64_t rdb_size{0};
+
+	/* The value of a string */
+	std::string value;
+	/* The elements of a list, in order, or the members of a set */
+	std::vector<std::string> elements;
+	/* The fields and values of a hash; fields whose own TTL has passed are left out */
+	std::vector<std::pair<std::string, std::string>> fields;
+	/* The members and scores of a sorted set */
+	std::vector<std::pair<std::string, double>> members;
+};
+
+/**
+ * @brief An RDB entry whose key and values went through a template's serializers.
+ */
+template<typename K, typename V>
+struct rdb_typed_entry {
+	int db{0};
+	K key;
+	rdb_type type{rdb_type::string};
+	int64_t expire_at{-1};
+	std::optional<V> value;
+	std::vector<V> elements;
+	/* Fields are deserialized as keys, as hash_operations does */
+	std::unordered_map<K, V> fields;
+	std::vector<std::pair<V, double>> members;
+};
+
+struct rdb_options {
+	/* Whether the CRC-64 trailer is checked at the end of the file (files saved with rdbchecksum no have none) */
+	bool verify_checksum{true};
+};
+
+/**
+ * @brief A streaming reader of Redis RDB files (BGSAVE/SAVE dumps), versions 1 to 12.
+ * * Entries are read one at a time with next(), so memory use is bounded by the largest key rather than the file:
+ * a dump can feed a local cache, a memory report or a secondary index without issuing a command to the server.
+ * Every value encoding Redis has saved is decoded: plain and LZF compressed strings, integer strings, linked lists,
+ * ziplists, quicklists (both versions), listpacks, intsets, zipmaps, skiplist sorted sets (string and binary scores),
+ * and hashes with field TTLs. Streams and module values are skipped and reported with their size only.
+ *
+ * The AUX fields of the file (redis-ver, used-mem, ...) are collected as they are read; see aux().
+ * @throw std::runtime_error from the constructor and next() if the file is truncated or corrupt.
+ */
+class rdb_parser {
+public:
+	/**
+	 * @brief Reads an RDB stream; the stream must outlive the parser.
+	 */
+	explicit rdb_parser(std::istream &in, rdb_options options = {}) : in(&in), options(options) {
+		read_header();
+	}
+
+	/**
+	 * @brief Reads an RDB file.
+	 */
+	explicit rdb_parser(const std::string &path, rdb_options options = {}) :
+		file(std::make_unique<std::ifstream>(path, std::ios::binary)), in(file.get()), options(options) {
+		if (!*file) throw std::runtime_error("rdb_parser: cannot open " + path);
+		read_header();
+	}
+
+	/**
+	 * @brief Reads the next key.
+	 * @param entry Receives the key; its previous content is replaced.
+	 * @return False at the end of the file, after the checksum was verified.
+	 */
+	bool next(rdb_entry &entry) {
+		if (finished) return false;
+		int64_t expire_at = -1;
+		int64_t idle = -1;
+		int freq = -1;
+		for (;;) {
+			const uint64_t start = offset;
+			const uint8_t opcode = read_byte();
+			switch (opcode) {
+				case opcode_eof:
+					finish();
+					return false;
+				case opcode_select_db:
+					db = static_cast<int>(read_length());
+					continue;
+				case opcode_expire_time:
+					expire_at = static_cast<int64_t>(read_le(4)) * 1000;
+					continue;
+				case opcode_expire_time_ms:
+					expire_at = static_cast<int64_t>(read_le(8));
+					continue;
+				case opcode_resize_db:
+					read_length();
+					read_length();
+					continue;
+				case opcode_aux: {
+					std::string name = read_string();
+					aux_fields[name] = read_string();
+					continue;
+				}
+				case opcode_freq:
+					freq = read_byte();
+					continue;
+				case opcode_idle:
+					idle = static_cast<int64_t>(read_length());
+					continue;
+				case opcode_module_aux:
+					skip_module_value(true);
+					continue;
+				case opcode_function:
+					// The code of a function library, as written by FUNCTION LOAD
+					read_string();
+					continue;
+				case opcode_function_pre_ga:
+					// Redis 7.0 release candidates; Redis itself no longer loads this layout
+					throw std::runtime_error("rdb_parser: pre-GA function records (opcode 246) are not supported");
+				case opcode_slot_info:
+					read_length();
+					read_length();
+					read_length();
+					continue;
+				default:
+					break;
+			}
+
+			entry = rdb_entry{};
+			entry.db = db;
+			entry.expire_at = expire_at;
+			entry.idle = idle;
+			entry.freq = freq;
+			entry.key = read_string();
+			read_value(opcode, entry);
+			entry.rdb_size = offset - start;
+			return true;
+		}
+	}
+
+	/**
+	 * @brief Reads the next key and deserializes it with a template's key and value serializers.
+	 * @return False at the end of the file.
+	 */
+	template<typename K, typename V>
+	bool next(rdb_typed_entry<K, V> &entry, const redis_template<K, V> &tpl) {
+		rdb_entry raw;
+		if (!next(raw)) return false;
+		entry = rdb_typed_entry<K, V>{};
+		entry.db = raw.db;
+		entry.key = tpl.deserialize_key(raw.key);
+		entry.type = raw.type;
+		entry.expire_at = raw.expire_at;
+		if (raw.type == rdb_type::string) entry.value = tpl.deserialize_value(raw.value);
+		entry.elements.reserve(raw.elements.size());
+		for (const auto &e: raw.elements) {
+			entry.elements.push_back(tpl.deserialize_value(e));
+		}
+		for (const auto &f: raw.fields) {
+			entry.fields.emplace(tpl.deserialize_key(f.first), tpl.deserialize_value(f.second));
+		}
+		entry.members.reserve(raw.members.size());
+		for (const auto &m: raw.members) {
+			entry.members.emplace_back(tpl.deserialize_value(m.first), m.second);
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Returns the RDB version of the file.
+	 */
+	[[nodiscard]] int version() const {
+		return rdb_version;
+	}
+
+	/**
+	 * @brief Returns the AUX fields read so far; all of them once next() returned false.
+	 */
+	[[nodiscard]] const std::unordered_map<std::string, std::string> &aux() const {
+		return aux_fields;
+	}
+
+	/**
+	 * @brief Decompresses LZF data, as used for compressed RDB strings.
+	 * @param data The compressed data.
+	 * @param length The length of the decompressed data.
+	 * @throw std::runtime_error if the data is corrupt.
+	 */
+	static std::string lzf_decompress(const std::string &data, size_t length) {
+		std::string out(length, '\0');
+		const auto *in = reinterpret_cast<const unsigned char *>(data.data());
+		size_t i = 0;
+		size_t o = 0;
+		while (i < data.size()) {
+			size_t ctrl = in[i++];
+			if (ctrl < 32) {
+				// A run of ctrl + 1 literal bytes
+				++ctrl;
+				if (i + ctrl > data.size() || o + ctrl > length) throw corrupt("LZF literal run");
+				std::memcpy(&out[o], in + i, ctrl);
+				i += ctrl;
+				o += ctrl;
+				continue;
+			}
+			// A back reference: 3 bits of length (7 means more in the next byte), 13 bits of distance
+			size_t len = ctrl >> 5;
+			if (len == 7) {
+				if (i >= data.size()) throw corrupt("LZF back reference");
+				len += in[i++];
+			}
+			if (i >= data.size()) throw corrupt("LZF back reference");
+			const size_t distance = ((ctrl & 0x1f) << 8) + in[i++] + 1;
+			len += 2;
+			if (distance > o || o + len > length) throw corrupt("LZF back reference");
+			// Byte by byte: the source may overlap the destination
+			for (size_t k = 0; k < len; ++k, ++o) {
+				out[o] = out[o - distance];
+			}
+		}
+		if (o != length) throw corrupt("LZF length");
+		return out;
+	}
+
+private:
+	static constexpr uint8_t opcode_slot_info = 0xf4;
+	static constexpr uint8_t opcode_function = 0xf5;
+	static constexpr uint8_t opcode_function_pre_ga = 0xf6;
+	static constexpr uint8_t opcode_module_aux = 0xf7;
+	static constexpr uint8_t opcode_idle = 0xf8;
+	static constexpr uint8_t opcode_freq = 0xf9;
+	static constexpr uint8_t opcode_aux = 0xfa;
+	static constexpr uint8_t opcode_resize_db = 0xfb;
+	static constexpr uint8_t opcode_expire_time_ms = 0xfc;
+	static constexpr uint8_t opcode_expire_time = 0xfd;
+	static constexpr uint8_t opcode_select_db = 0xfe;
+	static constexpr uint8_t opcode_eof = 0xff;
+
+	/* Value types, as numbered by rdb.h */
+	enum value_type : uint8_t {
+		type_string = 0,
+		type_list = 1,
+		type_set = 2,
+		type_zset = 3,
+		type_hash = 4,
+		type_zset_2 = 5,
+		type_module_2 = 7,
+		type_hash_zipmap = 9,
+		type_list_ziplist = 10,
+		type_set_intset = 11,
+		type_zset_ziplist = 12,
+		type_hash_ziplist = 13,
+		type_list_quicklist = 14,
+		type_stream_listpacks = 15,
+		type_hash_listpack = 16,
+		type_zset_listpack = 17,
+		type_list_quicklist_2 = 18,
+		type_stream_listpacks_2 = 19,
+		type_set_listpack = 20,
+		type_stream_listpacks_3 = 21,
+		type_hash_metadata = 24,
+		type_hash_listpack_ex = 25
+	};
+
+	static constexpr int max_version = 12;
+	/* Strings are at most 512 MB in Redis; a larger length means a corrupt file */
+	static constexpr uint64_t max_string = 1ULL << 32;
+
+	static std::runtime_error corrupt(const std::string &what) {
+		return std::runtime_error("rdb_parser: corrupt " + what);
+	}
+
+	// ==========================================================
+	// Reading the stream
+	// ==========================================================
+
+	void fill() {
+		in->read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+		buffered = static_cast<size_t>(in->gcount());
+		position = 0;
+		if (buffered == 0) throw std::runtime_error("rdb_parser: unexpected end of file");
+	}
+
+	uint8_t read_byte() {
+		if (position == buffered) fill();
+		const auto b = static_cast<uint8_t>(buffer[position++]);
+		checksum = crc64(checksum, &b, 1);
+		++offset;
+		return b;
+	}
+
+	void read_raw(char *out, size_t n) {
+		while (n > 0) {
+			if (position == buffered) fill();
+			const size_t chunk = std::min(n, buffered - position);
+			std::memcpy(out, buffer.data() + position, chunk);
+			checksum = crc64(checksum, out, chunk);
+			position += chunk;
+			offset += chunk;
+			out += chunk;
+			n -= chunk;
+		}
+	}
+
+	std::string read_raw(size_t n) {
+		// Grown as data arrives, so a corrupt length fails at the end of the file rather than allocating first
+		constexpr size_t chunk = 1 << 20;
+		std::string s;
+		while (s.size() < n) {
+			const size_t done = s.size();
+			s.resize(done + std::min(chunk, n - done));
+			read_raw(&s[done], s.size() - done);
+		}
+		return s;
+	}
+
+	uint64_t read_le(int bytes) {
+		unsigned char b[8];
+		read_raw(reinterpret_cast<char *>(b), static_cast<size_t>(bytes));
+		uint64_t v = 0;
+		for (int i = bytes - 1; i >= 0; --i) {
+			v = (v << 8) | b[i];
+		}
+		return v;
+	}
+
+	uint64_t read_be(int bytes) {
+		uint64_t v = 0;
+		for (int i = 0; i < bytes; ++i) {
+			v = (v << 8) | read_byte();
+		}
+		return v;
+	}
+
+	void read_header() {
+		buffer.resize(64 * 1024);
+		char magic[9];
+		try {
+			read_raw(magic, 9);
+		}
+		catch (const std::runtime_error &) {
+			throw std::runtime_error("rdb_parser: not an RDB file");
+		}
+		if (std::memcmp(magic, "REDIS", 5) != 0) throw std::runtime_error("rdb_parser: not an RDB file");
+		rdb_version = 0;
+		for (int i = 5; i < 9; ++i) {
+			if (magic[i] < '0' || magic[i] > '9') throw std::runtime_error("rdb_parser: not an RDB file");
+			rdb_version = rdb_version * 10 + (magic[i] - '0');
+		}
+		if (rdb_version < 1 || rdb_version > max_version) {
+			throw std::runtime_error("rdb_parser: unsupported RDB version " + std::to_string(rdb_version));
+		}
+	}
+
+	void finish() {
+		finished = true;
+		if (rdb_version < 5) return;
+		const uint64_t expected = checksum;
+		const uint64_t stored = read_le(8);
+		// A zero checksum means the file was saved without one
+		if (options.verify_checksum && stored != 0 && stored != expected) {
+			throw std::runtime_error("rdb_parser: checksum mismatch");
+		}
+	}
+
+	/**
+	 * @brief Reads a length. The two top bits of the first byte select 6, 14, 32 or 64 bit lengths, or a special
+	 * string encoding, returned with encoded set.
+	 */
+	uint64_t read_length(bool *encoded = nullptr) {
+		if (encoded) *encoded = false;
+		const uint8_t first = read_byte();
+		switch (first >> 6) {
+			case 0:
+				return first & 0x3f;
+			case 1:
+				return (static_cast<uint64_t>(first & 0x3f) << 8) | read_byte();
+			case 2:
+				if (first == 0x80) return read_be(4);
+				if (first == 0x81) return read_be(8);
+				throw corrupt("length");
+			default:
+				if (!encoded) throw corrupt("length");
+				*encoded = true;
+				return first & 0x3f;
+		}
+	}
+
+	std::string read_string(bool *is_integer = nullptr) {
+		if (is_integer) *is_integer = false;
+		bool encoded = false;
+		const uint64_t length = read_length(&encoded);
+		if (!encoded) {
+			if (length > max_string) throw corrupt("string length");
+			return read_raw(static_cast<size_t>(length));
+		}
+		switch (length) {
+			case 0:
+			case 1:
+			case 2: {
+				// 8, 16 or 32 bit little-endian integers
+				const int bytes = 1 << length;
+				const uint64_t raw = read_le(bytes);
+				const int shift = 64 - 8 * bytes;
+				if (is_integer) *is_integer = true;
+				return std::to_string(static_cast<int64_t>(raw << shift) >> shift);
+			}
+			case 3: {
+				const uint64_t compressed = read_length();
+				const uint64_t size = read_length();
+				if (compressed > max_string || size > max_string) throw corrupt("LZF string length");
+				return lzf_decompress(read_raw(static_cast<size_t>(compressed)), static_cast<size_t>(size));
+			}
+			default:
+				throw corrupt("string encoding");
+		}
+	}
+
+	/* Scores of type_zset: a length byte, then the score as text; 253, 254 and 255 stand for nan, inf and -inf */
+	double read_string_double() {
+		const uint8_t length = read_byte();
+		switch (length) {
+			case 253:
+				return std::numeric_limits<double>::quiet_NaN();
+			case 254:
+				return std::numeric_limits<double>::infinity();
+			case 255:
+				return -std::numeric_limits<double>::infinity();
+			default:
+				return to_double(read_raw(length));
+		}
+	}
+
+	double read_binary_double() {
+		const uint64_t bits = read_le(8);
+		double d;
+		std::memcpy(&d, &bits, sizeof(d));
+		return d;
+	}
+
+	static double to_double(const std::string &s) {
+		char *end = nullptr;
+		const double d = std::strtod(s.c_str(), &end);
+		if (end == s.c_str()) throw corrupt("score");
+		return d;
+	}
+
+	// ==========================================================
+	// Values
+	// ==========================================================
+
+	void read_value(uint8_t type, rdb_entry &entry) {
+		switch (type) {
+			case type_string: {
+				bool is_integer = false;
+				entry.type = rdb_type::string;
+				entry.value = read_string(&is_integer);
+				entry.encoding = is_integer ? "int" : entry.value.size() <= 44 ? "embstr" : "raw";
+				return;
+			}
+			case type_list:
+			case type_set:
+				entry.type = type == type_list ? rdb_type::list : rdb_type::set;
+				entry.encoding = type == type_list ? "linkedlist" : "hashtable";
+				for (uint64_t n = read_length(); n > 0; --n) {
+					entry.elements.push_back(read_string());
+				}
+				return;
+			case type_zset:
+			case type_zset_2:
+				entry.type = rdb_type::zset;
+				entry.encoding = "skiplist";
+				for (uint64_t n = read_length(); n > 0; --n) {
+					std::string member = read_string();
+					const double score = type == type_zset ? read_string_double() : read_binary_double();
+					entry.members.emplace_back(std::move(member), score);
+				}
+				return;
+			case type_hash:
+				entry.type = rdb_type::hash;
+				entry.encoding = "hashtable";
+				for (uint64_t n = read_length(); n > 0; --n) {
+					std::string field = read_string();
+					entry.fields.emplace_back(std::move(field), read_string());
+				}
+				return;
+			case type_hash_metadata:
+				read_hash_metadata(entry);
+				return;
+			case type_hash_listpack_ex:
+				read_hash_listpack_ex(entry);
+				return;
+			case type_list_quicklist:
+			case type_list_quicklist_2:
+				entry.type = rdb_type::list;
+				entry.encoding = "quicklist";
+				for (uint64_t n = read_length(); n > 0; --n) {
+					if (type == type_list_quicklist) {
+						parse_ziplist(read_string(), entry.elements);
+						continue;
+					}
+					// Nodes of version 2 are a single large element (1, plain) or a listpack (2, packed)
+					const uint64_t container = read_length();
+					if (container == 1) {
+						entry.elements.push_back(read_string());
+					}
+					else if (container == 2) {
+						parse_listpack(read_string(), entry.elements);
+					}
+					else {
+						throw corrupt("quicklist node");
+					}
+				}
+				return;
+			case type_stream_listpacks:
+			case type_stream_listpacks_2:
+			case type_stream_listpacks_3:
+				entry.type = rdb_type::stream;
+				entry.encoding = "stream";
+				skip_stream(type);
+				return;
+			case type_module_2:
+				entry.type = rdb_type::module;
+				entry.encoding = "module";
+				skip_module_value(false);
+				return;
+			default:
+				break;
+		}
+
+		// The remaining types are a single blob in a compact encoding
+		const std::string blob = read_string();
+		std::vector<std::string> items;
+		switch (type) {
+			case type_list_ziplist:
+				entry.type = rdb_type::list;
+				entry.encoding = "ziplist";
+				parse_ziplist(blob, entry.elements);
+				return;
+			case type_set_intset:
+				entry.type = rdb_type::set;
+				entry.encoding = "intset";
+				parse_intset(blob, entry.elements);
+				return;
+			case type_set_listpack:
+				entry.type = rdb_type::set;
+				entry.encoding = "listpack";
+				parse_listpack(blob, entry.elements);
+				return;
+			case type_zset_ziplist:
+			case type_zset_listpack:
+				entry.type = rdb_type::zset;
+				entry.encoding = type == type_zset_ziplist ? "ziplist" : "listpack";
+				type == type_zset_ziplist ? parse_ziplist(blob, items) : parse_listpack(blob, items);
+				if (items.size() % 2 != 0) throw corrupt("sorted set");
+				for (size_t i = 0; i < items.size(); i += 2) {
+					entry.members.emplace_back(std::move(items[i]), to_double(items[i + 1]));
+				}
+				return;
+			case type_hash_zipmap:
+				entry.type = rdb_type::hash;
+				entry.encoding = "zipmap";
+				parse_zipmap(blob, entry.fields);
+				return;
+			case type_hash_ziplist:
+			case type_hash_listpack:
+				entry.type = rdb_type::hash;
+				entry.encoding = type == type_hash_ziplist ? "ziplist" : "listpack";
+				type == type_hash_ziplist ? parse_ziplist(blob, items) : parse_listpack(blob, items);
+				if (items.size() % 2 != 0) throw corrupt("hash");
+				for (size_t i = 0; i < items.size(); i += 2) {
+					entry.fields.emplace_back(std::move(items[i]), std::move(items[i + 1]));
+				}
+				return;
+			default:
+				throw std::runtime_error("rdb_parser: unsupported value type " + std::to_string(type));
+		}
+	}
+
+	/* type_hash_listpack_ex is a blob too, but preceded by the earliest field expiry */
+	void read_hash_listpack_ex(rdb_entry &entry) {
+		read_le(8);
+		const std::string blob = read_string();
+		std::vector<std::string> items;
+		parse_listpack(blob, items);
+		if (items.size() % 3 != 0) throw corrupt("hash");
+		const int64_t now = now_ms();
+		entry.type = rdb_type::hash;
+		entry.encoding = "listpack";
+		for (size_t i = 0; i < items.size(); i += 3) {
+			// Field, value, then the field's absolute expiry in milliseconds (0 if it has none)
+			const int64_t field_expire_at = std::stoll(items[i + 2]);
+			if (field_expire_at != 0 && field_expire_at <= now) continue;
+			entry.fields.emplace_back(std::move(items[i]), std::move(items[i + 1]));
+		}
+	}
+
+	/* A hashtable hash with field TTLs: the earliest expiry, then per field its TTL relative to it (0 if none) */
+	void read_hash_metadata(rdb_entry &entry) {
+		const auto min_expire = static_cast<int64_t>(read_le(8));
+		const int64_t now = now_ms();
+		entry.type = rdb_type::hash;
+		entry.encoding = "hashtable";
+		for (uint64_t n = read_length(); n > 0; --n) {
+			const uint64_t ttl = read_length();
+			std::string field = read_string();
+			std::string value = read_string();
+			if (ttl != 0 && static_cast<int64_t>(ttl) + min_expire - 1 <= now) continue;
+			entry.fields.emplace_back(std::move(field), std::move(value));
+		}
+	}
+
+	static int64_t now_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	}
+
+	/* Streams are skipped: their listpacks, metadata, consumer groups and pending entries */
+	void skip_stream(uint8_t type) {
+		for (uint64_t n = read_length(); n > 0; --n) {
+			read_string();
+			read_string();
+		}
+		// Length and last id; version 2 adds the first id, the max deleted id and the number of entries added
+		const int lengths = type == type_stream_listpacks ? 3 : 8;
+		for (int i = 0; i < lengths; ++i) {
+			read_length();
+		}
+		for (uint64_t groups = read_length(); groups > 0; --groups) {
+			read_string();
+			read_length();
+			read_length();
+			if (type != type_stream_listpacks) read_length();
+			for (uint64_t pending = read_length(); pending > 0; --pending) {
+				// Entry id, delivery time, delivery count
+				read_raw(16 + 8);
+				read_length();
+			}
+			for (uint64_t consumers = read_length(); consumers > 0; --consumers) {
+				read_string();
+				read_raw(type == type_stream_listpacks_3 ? 16 : 8);
+				for (uint64_t pending = read_length(); pending > 0; --pending) {
+					read_raw(16);
+				}
+			}
+		}
+	}
+
+	/* Module values are skipped through the self-describing opcodes modules are saved with */
+	void skip_module_value(bool aux) {
+		read_length();
+		if (aux) {
+			read_length();
+			read_length();
+		}
+		for (;;) {
+			switch (read_length()) {
+				case 0:
+					return;
+				case 1:
+				case 2:
+					read_length();
+					break;
+				case 3:
+					read_raw(4);
+					break;
+				case 4:
+					read_raw(8);
+					break;
+				case 5:
+					read_string();
+					break;
+				default:
+					throw corrupt("module value");
+			}
+		}
+	}
+
+	// ==========================================================
+	// Compact encodings
+	// ==========================================================
+
+	static void need(const std::string &blob, size_t pos, size_t n, const char *what) {
+		if (pos > blob.size() || blob.size() - pos < n) throw corrupt(what);
+	}
+
+	static uint64_t le(const std::string &blob, size_t pos, int bytes) {
+		uint64_t v = 0;
+		for (int i = bytes - 1; i >= 0; --i) {
+			v = (v << 8) | static_cast<uint8_t>(blob[pos + static_cast<size_t>(i)]);
+		}
+		return v;
+	}
+
+	static std::string signed_le(const std::string &blob, size_t pos, int bytes) {
+		const int shift = 64 - 8 * bytes;
+		return std::to_string(static_cast<int64_t>(le(blob, pos, bytes) << shift) >> shift);
+	}
+
+	static void parse_ziplist(const std::string &blob, std::vector<std::string> &out) {
+		// zlbytes, zltail, zllen
+		size_t pos = 10;
+		for (;;) {
+			need(blob, pos, 1, "ziplist");
+			if (static_cast<uint8_t>(blob[pos]) == 0xff) return;
+			pos += static_cast<uint8_t>(blob[pos]) == 0xfe ? 5 : 1;
+			need(blob, pos, 1, "ziplist");
+			const auto encoding = static_cast<uint8_t>(blob[pos]);
+			size_t length = 0;
+			switch (encoding >> 6) {
+				case 0:
+					length = encoding & 0x3f;
+					pos += 1;
+					break;
+				case 1:
+					need(blob, pos, 2, "ziplist");
+					length = (static_cast<size_t>(encoding & 0x3f) << 8) | static_cast<uint8_t>(blob[pos + 1]);
+					pos += 2;
+					break;
+				case 2:
+					need(blob, pos, 5, "ziplist");
+					length = 0;
+					for (size_t i = 1; i <= 4; ++i) {
+						length = (length << 8) | static_cast<uint8_t>(blob[pos + i]);
+					}
+					pos += 5;
+					break;
+				default: {
+					pos += 1;
+					int bytes = 0;
+					switch (encoding) {
+						case 0xc0:
+							bytes = 2;
+							break;
+						case 0xd0:
+							bytes = 4;
+							break;
+						case 0xe0:
+							bytes = 8;
+							break;
+						case 0xf0:
+							bytes = 3;
+							break;
+						case 0xfe:
+							bytes = 1;
+							break;
+						default:
+							// 1111xxxx: an immediate 0 to 12, stored as xxxx - 1
+							if (encoding < 0xf1 || encoding > 0xfd) throw corrupt("ziplist");
+							out.push_back(std::to_string((encoding & 0x0f) - 1));
+							continue;
+					}
+					need(blob, pos, static_cast<size_t>(bytes), "ziplist");
+					out.push_back(signed_le(blob, pos, bytes));
+					pos += static_cast<size_t>(bytes);
+					continue;
+				}
+			}
+			need(blob, pos, length, "ziplist");
+			out.push_back(blob.substr(pos, length));
+			pos += length;
+		}
+	}
+
+	/* Bytes of the back length that follows a listpack element of the given size */
+	static size_t backlen_size(size_t length) {
+		return length <= 127 ? 1 : length < 16383 ? 2 : length < 2097151 ? 3 : length < 268435455 ? 4 : 5;
+	}
+
+	static void parse_listpack(const std::string &blob, std::vector<std::string> &out) {
+		// Total bytes, number of elements
+		size_t pos = 6;
+		for (;;) {
+			need(blob, pos, 1, "listpack");
+			const auto b = static_cast<uint8_t>(blob[pos]);
+			if (b == 0xff) return;
+			size_t size;
+			if ((b & 0x80) == 0) {
+				// 7 bit unsigned integer
+				out.push_back(std::to_string(b & 0x7f));
+				size = 1;
+			}
+			else if ((b & 0xc0) == 0x80) {
+				// String of up to 63 bytes
+				const size_t length = b & 0x3f;
+				need(blob, pos + 1, length, "listpack");
+				out.push_back(blob.substr(pos + 1, length));
+				size = 1 + length;
+			}
+			else if ((b & 0xe0) == 0xc0) {
+				// 13 bit signed integer
+				need(blob, pos, 2, "listpack");
+				int v = ((b & 0x1f) << 8) | static_cast<uint8_t>(blob[pos + 1]);
+				if (v >= 1 << 12) v -= 1 << 13;
+				out.push_back(std::to_string(v));
+				size = 2;
+			}
+			else if ((b & 0xf0) == 0xe0) {
+				// String of up to 4095 bytes
+				need(blob, pos, 2, "listpack");
+				const size_t length = (static_cast<size_t>(b & 0x0f) << 8) | static_cast<uint8_t>(blob[pos + 1]);
+				need(blob, pos + 2, length, "listpack");
+				out.push_back(blob.substr(pos + 2, length));
+				size = 2 + length;
+			}
+			else if (b == 0xf0) {
+				need(blob, pos, 5, "listpack");
+				const auto length = static_cast<size_t>(le(blob, pos + 1, 4));
+				need(blob, pos + 5, length, "listpack");
+				out.push_back(blob.substr(pos + 5, length));
+				size = 5 + length;
+			}
+			else if (b >= 0xf1 && b <= 0xf4) {
+				// 16, 24, 32 and 64 bit signed integers
+				static const int widths[] = {2, 3, 4, 8};
+				const int bytes = widths[b - 0xf1];
+				need(blob, pos, 1 + static_cast<size_t>(bytes), "listpack");
+				out.push_back(signed_le(blob, pos + 1, bytes));
+				size = 1 + static_cast<size_t>(bytes);
+			}
+			else {
+				throw corrupt("listpack");
+			}
+			pos += size + backlen_size(size);
+		}
+	}
+
+	static void parse_intset(const std::string &blob, std::vector<std::string> &out) {
+		need(blob, 0, 8, "intset");
+		const auto width = static_cast<int>(le(blob, 0, 4));
+		const uint64_t count = le(blob, 4, 4);
+		if (width != 2 && width != 4 && width != 8) throw corrupt("intset");
+		need(blob, 8, count * static_cast<uint64_t>(width), "intset");
+		for (uint64_t i = 0; i < count; ++i) {
+			out.push_back(signed_le(blob, 8 + i * static_cast<uint64_t>(width), width));
+		}
+	}
+
+	static void parse_zipmap(const std::string &blob, std::vector<std::pair<std::string, std::string>> &out) {
+		size_t pos = 1;
+		auto read_length_at = [&]() {
+			need(blob, pos, 1, "zipmap");
+			const auto b = static_cast<uint8_t>(blob[pos]);
+			if (b < 254) {
+				pos += 1;
+				return static_cast<size_t>(b);
+			}
+			if (b != 254) throw corrupt("zipmap");
+			need(blob, pos, 5, "zipmap");
+			const auto length = static_cast<size_t>(le(blob, pos + 1, 4));
+			pos += 5;
+			return length;
+		};
+		for (;;) {
+			need(blob, pos, 1, "zipmap");
+			if (static_cast<uint8_t>(blob[pos]) == 0xff) return;
+			const size_t key_length = read_length_at();
+			need(blob, pos, key_length, "zipmap");
+			std::string field = blob.substr(pos, key_length);
+			pos += key_length;
+			const size_t value_length = read_length_at();
+			need(blob, pos, 1, "zipmap");
+			// Unused bytes after the value
+			const size_t free = static_cast<uint8_t>(blob[pos]);
+			pos += 1;
+			need(blob, pos, value_length + free, "zipmap");
+			out.emplace_back(std::move(field), blob.substr(pos, value_length));
+			pos += value_length + free;
+		}
+	}
+
+	std::unique_ptr<std::ifstream> file;
+	std::istream *in;
+	rdb_options options;
+	std::vector<char> buffer;
+	size_t buffered{0};
+	size_t position{0};
+	uint64_t offset{0};
+	uint64_t checksum{0};
+	int rdb_version{0};
+	int db{0};
+	bool finished{false};
+	std::unordered_map<std::string, std::string> aux_fields;
+};
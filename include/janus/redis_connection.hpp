@@ -1,15 +1,20 @@
 #pragma once
 
 #include <hiredis/hiredis.h>
+#include <chrono>
+#include <cstring>
 #include <memory>
 #include <string>
 
 #include "kv_connection.hpp"
+#include "probes.hpp"
+#include "stage_profiler.hpp"
 
 class redis_connection: public kv_connection {
 public:
 	redis_connection(const std::string &host, const unsigned short port) {
 		context = redisConnect(host.c_str(), port);
+		JANUS_PROBE3(redis__connect, host.c_str(), static_cast<int>(port), context && !context->err ? 1 : 0);
 		if (!context || context->err) {
 			throw std::runtime_error("Redis connect failed");
 		}
@@ -156,6 +161,14 @@ public:
 		return r->integer;
 	}
 
+	std::string getrange(const std::string &key, long long start, long long end) override {
+		auto r = exec("GETRANGE %s %lld %lld", key.c_str(), start, end);
+		if (r->type != REDIS_REPLY_STRING) {
+			throw std::runtime_error("GETRANGE: unexpected reply type");
+		}
+		return std::string(r->str, r->len);
+	}
+
 	// ============================================================================
 	// For Hash
 	// ============================================================================
@@ -230,8 +243,7 @@ public:
 			argvlen.push_back(kv.second.size());
 		}
 
-		redisReply *raw = static_cast<redisReply *>(
-			redisCommandArgv(context, static_cast<int>(argv.size()), argv.data(), argvlen.data()));
+		redisReply *raw = round_trip(static_cast<int>(argv.size()), argv.data(), argvlen.data());
 		if (!raw) throw std::runtime_error("HSET command failed");
 		std::unique_ptr<redisReply, reply_deleter> r(raw);
 
@@ -725,40 +737,454 @@ public:
 		throw std::runtime_error("ZINCRBY: unexpected reply type");
 	}
 
+	std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																		 double max) override {
+		// ZRANGEBYSCORE key min max WITHSCORES
+		std::vector<std::pair<std::string, double>> result;
+		const std::string min_str = std::to_string(min);
+		const std::string max_str = std::to_string(max);
+		auto r = exec("ZRANGEBYSCORE %s %s %s WITHSCORES", key.c_str(), min_str.c_str(), max_str.c_str());
+		if (r->type != REDIS_REPLY_ARRAY || r->elements % 2 != 0) {
+			throw std::runtime_error("ZRANGEBYSCORE WITHSCORES: unexpected reply type");
+		}
+		result.reserve(r->elements / 2);
+		for (size_t i = 0; i + 1 < r->elements; i += 2) {
+			redisReply *member_reply = r->element[i];
+			redisReply *score_reply = r->element[i + 1];
+			if (member_reply->type != REDIS_REPLY_STRING || score_reply->type != REDIS_REPLY_STRING) {
+				throw std::runtime_error("ZRANGEBYSCORE WITHSCORES: unexpected element type");
+			}
+			try {
+				double score = std::stod(std::string(score_reply->str, score_reply->len));
+				result.emplace_back(std::string(member_reply->str, member_reply->len), score);
+			}
+			catch (const std::exception &) {
+				throw std::runtime_error("ZRANGEBYSCORE WITHSCORES: score conversion failed");
+			}
+		}
+		return result;
+	}
+
+	long long zremrangebyscore(const std::string &key, double min, double max) override {
+		const std::string min_str = std::to_string(min);
+		const std::string max_str = std::to_string(max);
+		auto r = exec("ZREMRANGEBYSCORE %s %s %s", key.c_str(), min_str.c_str(), max_str.c_str());
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("ZREMRANGEBYSCORE: unexpected reply type");
+		}
+		return r->integer;
+	}
+
+	// ============================================================================
+	// For HyperLogLog
+	// ============================================================================
+
+	bool pfadd(const std::string &key, const std::vector<std::string> &elements) override {
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+
+		argv.push_back("PFADD");
+		argvlen.push_back(5);
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+
+		for (const auto &e: elements) {
+			argv.push_back(e.c_str());
+			argvlen.push_back(e.size());
+		}
+
+		auto r = execv(argv, argvlen);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("PFADD: unexpected reply type");
+		}
+		return r->integer == 1;
+	}
+
+	long long pfcount(const std::vector<std::string> &keys) override {
+		if (keys.empty()) return 0;
+
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+
+		argv.push_back("PFCOUNT");
+		argvlen.push_back(7);
+		for (const auto &k: keys) {
+			argv.push_back(k.c_str());
+			argvlen.push_back(k.size());
+		}
+
+		auto r = execv(argv, argvlen);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("PFCOUNT: unexpected reply type");
+		}
+		return r->integer;
+	}
+
+	bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) override {
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+
+		argv.push_back("PFMERGE");
+		argvlen.push_back(7);
+		argv.push_back(dest.c_str());
+		argvlen.push_back(dest.size());
+
+		for (const auto &k: sources) {
+			argv.push_back(k.c_str());
+			argvlen.push_back(k.size());
+		}
+
+		auto r = execv(argv, argvlen);
+		return (r->type == REDIS_REPLY_STATUS) && (std::string(r->str, r->len) == "OK");
+	}
+
+	// ============================================================================
+	// For Bitmap
+	// ============================================================================
+
+	bool setbit(const std::string &key, long long offset, bool value) override {
+		auto r = exec("SETBIT %s %lld %d", key.c_str(), offset, value ? 1 : 0);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("SETBIT: unexpected reply type");
+		}
+		return r->integer == 1;
+	}
+
+	bool getbit(const std::string &key, long long offset) override {
+		auto r = exec("GETBIT %s %lld", key.c_str(), offset);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("GETBIT: unexpected reply type");
+		}
+		return r->integer == 1;
+	}
+
+	long long bitcount(const std::string &key, long long start, long long end) override {
+		auto r = exec("BITCOUNT %s %lld %lld", key.c_str(), start, end);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("BITCOUNT: unexpected reply type");
+		}
+		return r->integer;
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end) override {
+		auto r = exec("BITPOS %s %d %lld %lld", key.c_str(), bit ? 1 : 0, start, end);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("BITPOS: unexpected reply type");
+		}
+		return r->integer;
+	}
+
+	long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) override {
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+
+		argv.push_back("BITOP");
+		argvlen.push_back(5);
+		argv.push_back(op.c_str());
+		argvlen.push_back(op.size());
+		argv.push_back(dest.c_str());
+		argvlen.push_back(dest.size());
+
+		for (const auto &k: keys) {
+			argv.push_back(k.c_str());
+			argvlen.push_back(k.size());
+		}
+
+		auto r = execv(argv, argvlen);
+		if (r->type != REDIS_REPLY_INTEGER) {
+			throw std::runtime_error("BITOP: unexpected reply type");
+		}
+		return r->integer;
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &key,
+												   const std::vector<std::string> &args) override {
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+
+		argv.push_back("BITFIELD");
+		argvlen.push_back(8);
+		argv.push_back(key.c_str());
+		argvlen.push_back(key.size());
+
+		for (const auto &a: args) {
+			argv.push_back(a.c_str());
+			argvlen.push_back(a.size());
+		}
+
+		std::vector<std::optional<long long>> result;
+		auto r = execv(argv, argvlen);
+		if (r->type != REDIS_REPLY_ARRAY) {
+			throw std::runtime_error("BITFIELD: unexpected reply type");
+		}
+		result.reserve(r->elements);
+		for (size_t i = 0; i < r->elements; ++i) {
+			if (r->element[i]->type == REDIS_REPLY_INTEGER) {
+				result.emplace_back(r->element[i]->integer);
+			}
+			else {
+				result.emplace_back(std::nullopt);
+			}
+		}
+		return result;
+	}
+
+	// ============================================================================
+	// For Scripting
+	// ============================================================================
+
+	std::string script_load(const std::string &script) override {
+		std::vector<const char *> argv{"SCRIPT", "LOAD", script.c_str()};
+		std::vector<size_t> argvlen{6, 4, script.size()};
+
+		auto r = execv(argv, argvlen);
+		if (r->type != REDIS_REPLY_STRING) {
+			throw std::runtime_error("SCRIPT LOAD: unexpected reply type");
+		}
+		return std::string(r->str, r->len);
+	}
+
+	kv_reply evalsha(const std::string &sha1, const std::vector<std::string> &keys,
+					 const std::vector<std::string> &args) override {
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+
+		std::string num_keys = std::to_string(keys.size());
+		argv.push_back("EVALSHA");
+		argvlen.push_back(7);
+		argv.push_back(sha1.c_str());
+		argvlen.push_back(sha1.size());
+		argv.push_back(num_keys.c_str());
+		argvlen.push_back(num_keys.size());
+
+		for (const auto &k: keys) {
+			argv.push_back(k.c_str());
+			argvlen.push_back(k.size());
+		}
+		for (const auto &a: args) {
+			argv.push_back(a.c_str());
+			argvlen.push_back(a.size());
+		}
+
+		auto r = execv(argv, argvlen);
+		return to_kv_reply(r.get());
+	}
+
+	// ============================================================================
+	// For Pipelining
+	// ============================================================================
+
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		recover();
+		std::vector<const char *> argv;
+		std::vector<size_t> argvlen;
+		round_trip_probe probe;
+		if (probe.on) {
+			uint64_t bytes = 0;
+			for (const auto &command: commands) {
+				for (const auto &arg: command) {
+					bytes += arg.size();
+				}
+			}
+			probe.send("PIPELINE", 8, bytes);
+		}
+
+		std::vector<kv_reply> result;
+		result.reserve(commands.size());
+		try {
+			for (const auto &command: commands) {
+				argv.clear();
+				argvlen.clear();
+				for (const auto &arg: command) {
+					argv.push_back(arg.c_str());
+					argvlen.push_back(arg.size());
+				}
+				if (redisAppendCommandArgv(context, static_cast<int>(argv.size()), argv.data(), argvlen.data())
+					!= REDIS_OK) {
+					throw std::runtime_error("Pipeline: failed to buffer command");
+				}
+			}
+
+			for (size_t i = 0; i < commands.size(); ++i) {
+				void *raw = nullptr;
+				if (redisGetReply(context, &raw) != REDIS_OK || raw == nullptr) {
+					throw std::runtime_error("Pipeline: failed to read reply");
+				}
+				reply_ptr r(static_cast<redisReply *>(raw));
+				result.push_back(to_kv_reply(r.get()));
+				if (probe.on && i + 1 == commands.size()) probe.receive(r.get());
+			}
+		}
+		catch (...) {
+			// Commands left buffered or replies left unread would be taken by the next call for its own
+			broken = true;
+			throw;
+		}
+		return result;
+	}
+
 protected:
 	struct reply_deleter {
 		void operator()(redisReply *r) const noexcept {
 			if (r) freeReplyObject(r);
+			stage_profiler::reply_released();
 		}
 	};
 	using reply_ptr = std::unique_ptr<redisReply, reply_deleter>;
 
 	reply_ptr exec(const char *fmt, ...) const {
+		recover();
+		round_trip_probe probe;
+		if (probe.on) probe.send(fmt, std::strcspn(fmt, " "), 0);
 		va_list ap;
 		va_start(ap, fmt);
-		redisReply *r = static_cast<redisReply *>(redisvCommand(context, fmt, ap));
+		redisReply *r;
+		if (stage_profiler::begin_command()) {
+			stage_profiler::name_command(fmt, std::strcspn(fmt, " "));
+			r = timed_round_trip([this, fmt, &ap] { return redisvAppendCommand(context, fmt, ap); });
+		}
+		else {
+			r = static_cast<redisReply *>(redisvCommand(context, fmt, ap));
+		}
 		va_end(ap);
-		if (!r) throw std::runtime_error("Command failed");
+		if (probe.on) probe.receive(r);
+		if (!r) {
+			broken = true;
+			throw std::runtime_error("Command failed");
+		}
 		if (r->type == REDIS_REPLY_ERROR) {
 			std::string err(r->str, r->len);
 			freeReplyObject(r);
 			throw std::runtime_error("Redis error: " + err);
 		}
+		stage_profiler::reply_returned();
 		return reply_ptr(r);
 	}
 
 	[[nodiscard]] reply_ptr execv(const std::vector<const char *> &argv, const std::vector<size_t> &argvlen) const {
-		redisReply *r = static_cast<redisReply *>(redisCommandArgv(
-			context, static_cast<int>(argv.size()), const_cast<const char **>(argv.data()), argvlen.data()));
+		redisReply *r = round_trip(static_cast<int>(argv.size()), argv.data(), argvlen.data());
 		if (!r) throw std::runtime_error("CommandArgv failed");
 		if (r->type == REDIS_REPLY_ERROR) {
 			std::string err(r->str, r->len);
 			freeReplyObject(r);
 			throw std::runtime_error("Redis error: " + err);
 		}
+		stage_profiler::reply_returned();
 		return reply_ptr(r);
 	}
 
+	/* Sends a command and reads its reply, timing the stages of the calls sampled by the stage_profiler */
+	redisReply *round_trip(int argc, const char *const *argv, const size_t *argvlen) const {
+		recover();
+		const auto args = const_cast<const char **>(argv);
+		round_trip_probe probe;
+		if (probe.on) {
+			uint64_t bytes = 0;
+			for (int i = 0; i < argc; ++i) {
+				bytes += argvlen[i];
+			}
+			probe.send(argv[0], argvlen[0], bytes);
+		}
+		redisReply *r;
+		if (stage_profiler::begin_command()) {
+			stage_profiler::name_command(argv[0], argvlen[0]);
+			r = timed_round_trip([this, argc, args, argvlen] {
+				return redisAppendCommandArgv(context, argc, args, argvlen);
+			});
+		}
+		else {
+			r = static_cast<redisReply *>(redisCommandArgv(context, argc, args, argvlen));
+		}
+		if (probe.on) probe.receive(r);
+		// The context is unusable after an I/O or protocol error
+		if (!r) broken = true;
+		return r;
+	}
+
+	/* Reconnects before the next command once a failure left the context broken or out of step with the server */
+	void recover() const {
+		if (!broken) return;
+		if (redisReconnect(context) != REDIS_OK) throw std::runtime_error("Redis reconnect failed");
+		broken = false;
+	}
+
+	/* The redis__send and redis__receive probes of a round trip, fired only while a tracer is attached */
+	struct round_trip_probe {
+		const bool on{JANUS_PROBE_ENABLED(redis__send) || JANUS_PROBE_ENABLED(redis__receive)};
+		const char *command{nullptr};
+		size_t length{0};
+		std::chrono::steady_clock::time_point sent_at;
+
+		void send(const char *name, size_t name_length, uint64_t bytes) {
+			command = name;
+			length = name_length;
+			JANUS_PROBE3(redis__send, command, length, bytes);
+			sent_at = std::chrono::steady_clock::now();
+		}
+
+		void receive(const redisReply *reply) {
+			const auto latency = std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - sent_at);
+			JANUS_PROBE4(redis__receive, command, length, static_cast<uint64_t>(latency.count()),
+						 reply ? reply->type : -1);
+		}
+	};
+
+	/* What redisCommand() does, one stage at a time */
+	template<typename Append>
+	redisReply *timed_round_trip(Append &&append) const {
+		uint64_t t = stage_clock::now();
+		if (append() != REDIS_OK) return nullptr;
+		t = stage_profiler::lap(stage::encode, t);
+		int done = 0;
+		do {
+			if (redisBufferWrite(context, &done) != REDIS_OK) return nullptr;
+		} while (!done);
+		t = stage_profiler::lap(stage::write, t);
+		for (;;) {
+			void *reply = nullptr;
+			if (redisGetReplyFromReader(context, &reply) != REDIS_OK) return nullptr;
+			t = stage_profiler::lap(stage::parse, t);
+			if (reply) return static_cast<redisReply *>(reply);
+			if (redisBufferRead(context) != REDIS_OK) return nullptr;
+			t = stage_profiler::lap(stage::wait, t);
+		}
+	}
+
+	static kv_reply to_kv_reply(const redisReply *r) {
+		kv_reply reply;
+		switch (r->type) {
+			case REDIS_REPLY_INTEGER:
+				reply.type = kv_reply::reply_type::integer;
+				reply.integer = r->integer;
+				break;
+			case REDIS_REPLY_STRING:
+				reply.type = kv_reply::reply_type::string;
+				reply.str.assign(r->str, r->len);
+				break;
+			case REDIS_REPLY_STATUS:
+				reply.type = kv_reply::reply_type::status;
+				reply.str.assign(r->str, r->len);
+				break;
+			case REDIS_REPLY_ERROR:
+				reply.type = kv_reply::reply_type::error;
+				reply.str.assign(r->str, r->len);
+				break;
+			case REDIS_REPLY_ARRAY:
+				reply.type = kv_reply::reply_type::array;
+				reply.elements.reserve(r->elements);
+				for (size_t i = 0; i < r->elements; ++i) {
+					reply.elements.push_back(to_kv_reply(r->element[i]));
+				}
+				break;
+			default:
+				break;
+		}
+		return reply;
+	}
+
 private:
 	redisContext *context;
+	/* Set when a command failed partway; the next command reconnects first */
+	mutable bool broken{false};
 };
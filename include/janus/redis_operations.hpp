@@ -1,6 +1,7 @@
 #pragma once
 
 #include "operations.hpp"
+#include "script.hpp"
 
 template<typename K, typename V>
 class redis_template;
@@ -335,3 +336,536 @@ public:
 private:
 	redis_template<K, V> &tpl;
 };
+
+template<typename K, typename V>
+class default_filter_operations: public filter_operations<K, V> {
+public:
+	explicit default_filter_operations(redis_template<K, V> &ops) : tpl(ops) {
+	}
+
+	std::unordered_map<K, V> hscan(const K &key, const filter_expr &where, long long limit) override {
+		auto raw = scan(scan_source::hash, projection::entries, key, where, limit);
+		std::unordered_map<K, V> result;
+		for (size_t i = 0; i + 1 < raw.size(); i += 2) {
+			result.emplace(tpl.deserialize_key(raw[i]), tpl.deserialize_value(raw[i + 1]));
+		}
+		return result;
+	}
+
+	std::vector<K> hscan_fields(const K &key, const filter_expr &where, long long limit) override {
+		auto raw = scan(scan_source::hash, projection::fields, key, where, limit);
+		std::vector<K> result;
+		result.reserve(raw.size());
+		for (const auto &f: raw) {
+			result.push_back(tpl.deserialize_key(f));
+		}
+		return result;
+	}
+
+	std::vector<V> hscan_values(const K &key, const filter_expr &where, long long limit) override {
+		return deserialize_values(scan(scan_source::hash, projection::values, key, where, limit));
+	}
+
+	std::vector<V> sscan(const K &key, const filter_expr &where, long long limit) override {
+		return deserialize_values(scan(scan_source::set, projection::values, key, where, limit));
+	}
+
+	std::vector<V> lrange(const K &key, const filter_expr &where, long long limit) override {
+		return deserialize_values(scan(scan_source::list, projection::values, key, where, limit));
+	}
+
+private:
+	enum class scan_source { hash, set, list };
+	enum class projection { entries, fields, values };
+
+	/* Number of elements examined by one script invocation; bounds the time the server is blocked per call */
+	static constexpr long long page_size = 1000;
+
+	std::vector<V> deserialize_values(const std::vector<std::string> &raw) const {
+		std::vector<V> result;
+		result.reserve(raw.size());
+		for (const auto &v: raw) {
+			result.push_back(tpl.deserialize_value(v));
+		}
+		return result;
+	}
+
+	/*
+	 * Runs the compiled filter page by page. Each script call examines one page and returns {next_cursor, matches};
+	 * the loop ends when the cursor wraps to "0" or the limit is reached.
+	 */
+	std::vector<std::string> scan(scan_source source, projection proj, const K &key, const filter_expr &where,
+								  long long limit) {
+		std::vector<std::string> constants;
+		const std::string expr = where.compile(constants);
+		const lua_script &script = script_for(source, proj, expr);
+		const size_t stride = proj == projection::entries ? 2 : 1;
+
+		std::vector<std::string> keys{tpl.serialize_key(key)};
+		std::vector<std::string> args{"0", std::to_string(page_size), "0"};
+		args.insert(args.end(), constants.begin(), constants.end());
+
+		std::vector<std::string> result;
+		do {
+			long long remaining = 0;
+			if (limit > 0) {
+				remaining = limit - static_cast<long long>(result.size() / stride);
+			}
+			args[2] = std::to_string(remaining);
+
+			kv_reply r = script.execute(tpl.get_connection(), keys, args);
+			if (r.type != kv_reply::reply_type::array || r.elements.size() != 2
+				|| r.elements[1].type != kv_reply::reply_type::array) {
+				throw std::runtime_error("Filtered scan: unexpected script reply");
+			}
+			args[0] = r.elements[0].type == kv_reply::reply_type::integer ? std::to_string(r.elements[0].integer)
+																		  : r.elements[0].str;
+			for (auto &e: r.elements[1].elements) {
+				result.push_back(std::move(e.str));
+			}
+		} while (args[0] != "0" && (limit <= 0 || static_cast<long long>(result.size() / stride) < limit));
+		return result;
+	}
+
+	const lua_script &script_for(scan_source source, projection proj, const std::string &expr) {
+		std::string src = "local function num(x) return tonumber(x) or (0 / 0) end\n"
+						  "local a, n = {}, {}\n"
+						  "for i = 4, #ARGV do a[i - 3] = ARGV[i]; n[i - 3] = tonumber(ARGV[i]) end\n"
+						  "local limit = tonumber(ARGV[3])\n";
+		if (source == scan_source::list) {
+			src += "local start = tonumber(ARGV[1])\n"
+				   "local count = tonumber(ARGV[2])\n"
+				   "local items = redis.call('LRANGE', KEYS[1], start, start + count - 1)\n"
+				   "local cursor = '0'\n"
+				   "if #items == count then cursor = tostring(start + count) end\n";
+		}
+		else {
+			src += std::string("local page = redis.call('") + (source == scan_source::hash ? "HSCAN" : "SSCAN")
+				   + "', KEYS[1], ARGV[1], 'COUNT', ARGV[2])\n"
+					 "local items = page[2]\n"
+					 "local cursor = page[1]\n";
+		}
+
+		const bool pairs = source == scan_source::hash;
+		src += "local out, matched = {}, 0\n";
+		src += pairs ? "for i = 1, #items, 2 do\n"
+					   "local f, v = items[i], items[i + 1]\n"
+					 : "for i = 1, #items do\n"
+					   "local f, v = items[i], items[i]\n";
+		src += "if " + expr + " then\n";
+		if (proj != projection::values) src += "out[#out + 1] = f\n";
+		if (proj != projection::fields) src += "out[#out + 1] = v\n";
+		src += "matched = matched + 1\n"
+			   "if limit > 0 and matched >= limit then break end\n"
+			   "end\n"
+			   "end\n"
+			   "return {cursor, out}\n";
+
+		return scripts.try_emplace(src, src).first->second;
+	}
+
+	redis_template<K, V> &tpl;
+	/* Compiled scripts by source; filters with the same shape map to the same script */
+	std::unordered_map<std::string, lua_script> scripts;
+};
+
+template<typename K, typename V>
+class default_hll_operations: public hll_operations<K, V> {
+public:
+	explicit default_hll_operations(redis_template<K, V> &ops) : tpl(ops) {
+	}
+
+	bool pfadd(const K &key, const std::vector<V> &elements) override {
+		std::vector<std::string> serialized_elements;
+		serialized_elements.reserve(elements.size());
+		for (const auto &e: elements) {
+			serialized_elements.push_back(tpl.serialize_value(e));
+		}
+		return tpl.get_connection().pfadd(tpl.serialize_key(key), serialized_elements);
+	}
+
+	long long pfcount(const K &key) override {
+		return tpl.get_connection().pfcount({tpl.serialize_key(key)});
+	}
+
+	long long pfcount(const std::vector<K> &keys) override {
+		std::vector<std::string> serialized_keys;
+		serialized_keys.reserve(keys.size());
+		for (const auto &k: keys) {
+			serialized_keys.push_back(tpl.serialize_key(k));
+		}
+		return tpl.get_connection().pfcount(serialized_keys);
+	}
+
+	bool pfmerge(const K &dest, const std::vector<K> &sources) override {
+		std::vector<std::string> serialized_keys;
+		serialized_keys.reserve(sources.size());
+		for (const auto &k: sources) {
+			serialized_keys.push_back(tpl.serialize_key(k));
+		}
+		return tpl.get_connection().pfmerge(tpl.serialize_key(dest), serialized_keys);
+	}
+
+	bool pfmerge(const K &dest, const hll_sketch &sketch) override {
+		if (sketch.empty()) return true;
+
+		// The sketch travels once as a temporary key that only exists inside the transaction
+		const std::string dest_key = tpl.serialize_key(dest);
+		const std::string tmp_key = dest_key + ":pfmerge:tmp";
+		auto replies = tpl.get_connection().pipeline({{"MULTI"},
+													   {"SET", tmp_key, sketch.to_redis()},
+													   {"PFMERGE", dest_key, tmp_key},
+													   {"DEL", tmp_key},
+													   {"EXEC"}});
+		const kv_reply &exec = replies.back();
+		if (exec.type != kv_reply::reply_type::array || exec.elements.size() != 3) {
+			throw std::runtime_error("PFMERGE: transaction failed" + (exec.is_error() ? ": " + exec.str : ""));
+		}
+		const kv_reply &merged = exec.elements[1];
+		if (merged.is_error()) {
+			throw std::runtime_error("Redis error: " + merged.str);
+		}
+		return merged.type == kv_reply::reply_type::status && merged.str == "OK";
+	}
+
+	hll_sketch get_sketch(const K &key) override {
+		auto raw = tpl.get_connection().get(tpl.serialize_key(key));
+		return raw ? hll_sketch::from_redis(*raw) : hll_sketch();
+	}
+
+private:
+	redis_template<K, V> &tpl;
+};
+
+template<typename K, typename V>
+class default_bitmap_operations: public bitmap_operations<K, V> {
+public:
+	using bitmap_operations<K, V>::bitfield;
+
+	explicit default_bitmap_operations(redis_template<K, V> &ops) : tpl(ops) {
+	}
+
+	bool setbit(const K &key, long long offset, bool value) override {
+		return tpl.get_connection().setbit(tpl.serialize_key(key), offset, value);
+	}
+
+	bool getbit(const K &key, long long offset) override {
+		return tpl.get_connection().getbit(tpl.serialize_key(key), offset);
+	}
+
+	std::vector<bool> setbits(const K &key, const std::vector<long long> &offsets, bool value) override {
+		bitfield_command command;
+		for (long long offset: offsets) {
+			command.set(bitfield_type::u(1), offset, value ? 1 : 0);
+		}
+		return to_bits(bitfield(key, command));
+	}
+
+	std::vector<bool> getbits(const K &key, const std::vector<long long> &offsets) override {
+		bitfield_command command;
+		for (long long offset: offsets) {
+			command.get(bitfield_type::u(1), offset);
+		}
+		return to_bits(bitfield(key, command));
+	}
+
+	long long bitcount(const K &key) override {
+		return tpl.get_connection().bitcount(tpl.serialize_key(key), 0, -1);
+	}
+
+	long long bitcount(const K &key, long long start, long long end) override {
+		return tpl.get_connection().bitcount(tpl.serialize_key(key), start, end);
+	}
+
+	long long bitpos(const K &key, bool bit, long long start, long long end) override {
+		return tpl.get_connection().bitpos(tpl.serialize_key(key), bit, start, end);
+	}
+
+	long long bitop(bitwise_op op, const K &dest, const std::vector<K> &keys) override {
+		static const char *const names[] = {"AND", "OR", "XOR", "NOT"};
+		std::vector<std::string> serialized_keys;
+		serialized_keys.reserve(keys.size());
+		for (const auto &k: keys) {
+			serialized_keys.push_back(tpl.serialize_key(k));
+		}
+		return tpl.get_connection().bitop(names[static_cast<int>(op)], tpl.serialize_key(dest), serialized_keys);
+	}
+
+	std::vector<std::optional<long long>> bitfield(const K &key, const bitfield_command &command) override {
+		if (command.size() == 0) return {};
+		return tpl.get_connection().bitfield(tpl.serialize_key(key), command.get_args());
+	}
+
+private:
+	static std::vector<bool> to_bits(const std::vector<std::optional<long long>> &values) {
+		std::vector<bool> result;
+		result.reserve(values.size());
+		for (const auto &v: values) {
+			result.push_back(v.value_or(0) == 1);
+		}
+		return result;
+	}
+
+	redis_template<K, V> &tpl;
+};
+
+/*
+ * A roaring bitmap under key k is stored as one string per container: "k:<high 16 bits>" holds the encoded container
+ * (roaring_bitmap::encode_container), and the hash "k:index" maps each present chunk to its cardinality. Writers read
+ * and rewrite only the chunks they touch inside WATCH/MULTI/EXEC and retry when a concurrent writer got there first.
+ */
+template<typename K, typename V>
+class default_roaring_operations: public roaring_operations<K, V> {
+public:
+	explicit default_roaring_operations(redis_template<K, V> &ops) : tpl(ops) {
+	}
+
+	long long add(const K &key, const std::vector<uint32_t> &values) override {
+		return modify(key, values, true);
+	}
+
+	long long remove(const K &key, const std::vector<uint32_t> &values) override {
+		return modify(key, values, false);
+	}
+
+	void store(const K &key, const roaring_bitmap &bitmap) override {
+		const std::string raw_key = tpl.serialize_key(key);
+		const std::string index = index_key(raw_key);
+		for (int attempt = 0; attempt < max_attempts; ++attempt) {
+			auto replies = tpl.get_connection().pipeline({{"WATCH", index}, {"HKEYS", index}});
+			check(replies, "HKEYS");
+
+			std::vector<std::vector<std::string>> commands{{"MULTI"}};
+			std::vector<std::string> del{"DEL", index};
+			for (const auto &chunk: replies[1].elements) {
+				del.push_back(raw_key + ":" + chunk.str);
+			}
+			commands.push_back(std::move(del));
+			std::vector<std::string> hset{"HSET", index};
+			for (const auto &c: bitmap.get_containers()) {
+				commands.push_back({"SET", chunk_key(raw_key, c.first), roaring_bitmap::encode_container(c.second)});
+				hset.push_back(std::to_string(c.first));
+				hset.push_back(std::to_string(c.second.cardinality));
+			}
+			if (hset.size() > 2) commands.push_back(std::move(hset));
+			commands.push_back({"EXEC"});
+			if (committed(tpl.get_connection().pipeline(commands))) return;
+		}
+		throw std::runtime_error("roaring_operations: too many concurrent modifications");
+	}
+
+	roaring_bitmap load(const K &key) override {
+		return unite({key});
+	}
+
+	bool contains(const K &key, uint32_t value) override {
+		const std::string chunk = chunk_key(tpl.serialize_key(key), roaring_bitmap::high_bits(value));
+		const uint16_t low = roaring_bitmap::low_bits(value);
+		const std::string byte = std::to_string(1 + (low >> 3));
+		auto replies = tpl.get_connection().pipeline({{"GETRANGE", chunk, "0", "0"}, {"GETRANGE", chunk, byte, byte}});
+		check(replies, "GETRANGE");
+		if (replies[0].str.empty()) return false;
+		if (replies[0].str[0] == roaring_bitmap::bitmap_type) {
+			return !replies[1].str.empty() && (static_cast<uint8_t>(replies[1].str[0]) >> (7 - (low & 7))) & 1;
+		}
+
+		auto data = tpl.get_connection().get(chunk);
+		return data && roaring_bitmap::decode_container(*data).contains(low);
+	}
+
+	long long cardinality(const K &key) override {
+		long long total = 0;
+		for (const auto &count: tpl.get_connection().hvals(index_key(tpl.serialize_key(key)))) {
+			total += std::stoll(count);
+		}
+		return total;
+	}
+
+	roaring_bitmap intersect(const std::vector<K> &keys) override {
+		roaring_bitmap result;
+		if (keys.empty()) return result;
+		std::vector<std::string> raw_keys = serialize_keys(keys);
+		auto chunks = list_chunks(raw_keys);
+
+		// Only chunks present in every bitmap can contribute
+		std::vector<uint16_t> common = chunks[0];
+		for (size_t i = 1; i < chunks.size() && !common.empty(); ++i) {
+			std::vector<uint16_t> next;
+			std::set_intersection(common.begin(), common.end(), chunks[i].begin(), chunks[i].end(),
+								  std::back_inserter(next));
+			common = std::move(next);
+		}
+		if (common.empty()) return result;
+
+		std::vector<std::vector<std::string>> commands;
+		commands.reserve(raw_keys.size() * common.size());
+		for (uint16_t high: common) {
+			for (const auto &raw_key: raw_keys) {
+				commands.push_back({"GET", chunk_key(raw_key, high)});
+			}
+		}
+		auto replies = tpl.get_connection().pipeline(commands);
+		check(replies, "GET");
+
+		roaring_bitmap partial;
+		for (size_t c = 0; c < common.size(); ++c) {
+			partial.clear();
+			partial.set_container(common[c], roaring_bitmap::decode_container(replies[c * raw_keys.size()].str));
+			for (size_t k = 1; k < raw_keys.size() && !partial.empty(); ++k) {
+				roaring_bitmap other;
+				other.set_container(common[c], roaring_bitmap::decode_container(replies[c * raw_keys.size() + k].str));
+				partial &= other;
+			}
+			result |= partial;
+		}
+		return result;
+	}
+
+	roaring_bitmap unite(const std::vector<K> &keys) override {
+		roaring_bitmap result;
+		std::vector<std::string> raw_keys = serialize_keys(keys);
+		auto chunks = list_chunks(raw_keys);
+
+		std::vector<std::vector<std::string>> commands;
+		std::vector<uint16_t> command_chunks;
+		for (size_t k = 0; k < raw_keys.size(); ++k) {
+			for (uint16_t high: chunks[k]) {
+				commands.push_back({"GET", chunk_key(raw_keys[k], high)});
+				command_chunks.push_back(high);
+			}
+		}
+		if (commands.empty()) return result;
+		auto replies = tpl.get_connection().pipeline(commands);
+		check(replies, "GET");
+
+		for (size_t i = 0; i < replies.size(); ++i) {
+			roaring_bitmap chunk;
+			chunk.set_container(command_chunks[i], roaring_bitmap::decode_container(replies[i].str));
+			result |= chunk;
+		}
+		return result;
+	}
+
+	long long del(const K &key) override {
+		const std::string raw_key = tpl.serialize_key(key);
+		const std::string index = index_key(raw_key);
+		std::vector<std::string> keys{index};
+		for (const auto &chunk: tpl.get_connection().hkeys(index)) {
+			keys.push_back(raw_key + ":" + chunk);
+		}
+		return tpl.get_connection().del(keys);
+	}
+
+private:
+	static constexpr int max_attempts = 16;
+
+	static std::string index_key(const std::string &raw_key) {
+		return raw_key + ":index";
+	}
+
+	static std::string chunk_key(const std::string &raw_key, uint16_t high) {
+		return raw_key + ":" + std::to_string(high);
+	}
+
+	static void check(const std::vector<kv_reply> &replies, const char *command) {
+		for (const auto &r: replies) {
+			if (r.is_error()) throw std::runtime_error(std::string(command) + ": " + r.str);
+		}
+	}
+
+	/* EXEC replies with an array when the transaction ran and with nil when a watched key changed */
+	static bool committed(const std::vector<kv_reply> &replies) {
+		const kv_reply &exec = replies.back();
+		if (exec.is_error()) throw std::runtime_error("EXEC: " + exec.str);
+		for (const auto &r: exec.elements) {
+			if (r.is_error()) throw std::runtime_error("Redis error: " + r.str);
+		}
+		return exec.type == kv_reply::reply_type::array;
+	}
+
+	std::vector<std::string> serialize_keys(const std::vector<K> &keys) const {
+		std::vector<std::string> raw_keys;
+		raw_keys.reserve(keys.size());
+		for (const auto &k: keys) {
+			raw_keys.push_back(tpl.serialize_key(k));
+		}
+		return raw_keys;
+	}
+
+	/* The sorted chunk numbers of each bitmap, read from the indexes in one pipeline */
+	std::vector<std::vector<uint16_t>> list_chunks(const std::vector<std::string> &raw_keys) {
+		std::vector<std::vector<std::string>> commands;
+		commands.reserve(raw_keys.size());
+		for (const auto &raw_key: raw_keys) {
+			commands.push_back({"HKEYS", index_key(raw_key)});
+		}
+		auto replies = tpl.get_connection().pipeline(commands);
+		check(replies, "HKEYS");
+
+		std::vector<std::vector<uint16_t>> chunks(raw_keys.size());
+		for (size_t i = 0; i < replies.size(); ++i) {
+			for (const auto &e: replies[i].elements) {
+				chunks[i].push_back(static_cast<uint16_t>(std::stoul(e.str)));
+			}
+			std::sort(chunks[i].begin(), chunks[i].end());
+		}
+		return chunks;
+	}
+
+	long long modify(const K &key, const std::vector<uint32_t> &values, bool insert) {
+		if (values.empty()) return 0;
+		const std::string raw_key = tpl.serialize_key(key);
+		const std::string index = index_key(raw_key);
+		std::map<uint16_t, std::vector<uint16_t>> by_chunk;
+		for (uint32_t v: values) {
+			by_chunk[roaring_bitmap::high_bits(v)].push_back(roaring_bitmap::low_bits(v));
+		}
+
+		for (int attempt = 0; attempt < max_attempts; ++attempt) {
+			std::vector<std::vector<std::string>> commands;
+			std::vector<std::string> watch{"WATCH", index};
+			for (const auto &entry: by_chunk) {
+				watch.push_back(chunk_key(raw_key, entry.first));
+			}
+			commands.push_back(std::move(watch));
+			for (const auto &entry: by_chunk) {
+				commands.push_back({"GET", chunk_key(raw_key, entry.first)});
+			}
+			auto replies = tpl.get_connection().pipeline(commands);
+			check(replies, "GET");
+
+			long long changed = 0;
+			commands = {{"MULTI"}};
+			size_t i = 1;
+			for (const auto &entry: by_chunk) {
+				auto container = roaring_bitmap::decode_container(replies[i++].str);
+				long long chunk_changed = 0;
+				for (uint16_t low: entry.second) {
+					chunk_changed += insert ? container.add(low) : container.remove(low);
+				}
+				if (chunk_changed == 0) continue;
+				changed += chunk_changed;
+
+				const std::string chunk = chunk_key(raw_key, entry.first);
+				const std::string field = std::to_string(entry.first);
+				if (container.cardinality == 0) {
+					commands.push_back({"DEL", chunk});
+					commands.push_back({"HDEL", index, field});
+				}
+				else {
+					commands.push_back({"SET", chunk, roaring_bitmap::encode_container(container)});
+					commands.push_back({"HSET", index, field, std::to_string(container.cardinality)});
+				}
+			}
+			if (changed == 0) {
+				tpl.get_connection().pipeline({{"UNWATCH"}});
+				return 0;
+			}
+			commands.push_back({"EXEC"});
+			if (committed(tpl.get_connection().pipeline(commands))) return changed;
+		}
+		throw std::runtime_error("roaring_operations: too many concurrent modifications");
+	}
+
+	redis_template<K, V> &tpl;
+};
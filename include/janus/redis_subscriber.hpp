@@ -0,0 +1,136 @@
+#pragma once
+
+#include <hiredis/hiredis.h>
+#include <poll.h>
+
+#include <cerrno>
+#include <chrono>
+#include <deque>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A message received on a subscribed channel.
+ */
+struct pubsub_message {
+	std::string channel;
+	std::string payload;
+};
+
+/**
+ * @brief A dedicated Redis connection in subscriber mode (SUBSCRIBE), read with a timeout.
+ * * A subscribed connection cannot run other commands, so it is kept apart from redis_connection. poll() waits on the
+ * socket for at most the given timeout, which lets a listener thread check a stop flag between messages.
+ *
+ * The subscriber is not thread-safe; it is meant to be owned by one listener thread.
+ */
+class redis_subscriber {
+public:
+	redis_subscriber(const std::string &host, const unsigned short port) {
+		context = redisConnect(host.c_str(), port);
+		if (!context || context->err) {
+			if (context) redisFree(context);
+			throw std::runtime_error("Redis connect failed");
+		}
+	}
+
+	~redis_subscriber() {
+		redisFree(context);
+	}
+
+	redis_subscriber(const redis_subscriber &) = delete;
+	redis_subscriber &operator=(const redis_subscriber &) = delete;
+
+	/**
+	 * @brief Subscribes to channels and waits until the server has confirmed every subscription.
+	 * @param channels The channel names.
+	 * @throw std::runtime_error on connection errors.
+	 * @note Corresponds to Redis SUBSCRIBE
+	 */
+	void subscribe(const std::vector<std::string> &channels) {
+		if (channels.empty()) return;
+		std::vector<const char *> argv{"SUBSCRIBE"};
+		std::vector<size_t> argvlen{9};
+		for (const auto &c: channels) {
+			argv.push_back(c.c_str());
+			argvlen.push_back(c.size());
+		}
+		if (redisAppendCommandArgv(context, static_cast<int>(argv.size()), argv.data(), argvlen.data()) != REDIS_OK) {
+			throw std::runtime_error("SUBSCRIBE: failed to buffer command");
+		}
+
+		size_t confirmed = 0;
+		while (confirmed < channels.size()) {
+			void *raw = nullptr;
+			if (redisGetReply(context, &raw) != REDIS_OK || raw == nullptr) {
+				throw std::runtime_error("SUBSCRIBE: failed to read reply");
+			}
+			auto *r = static_cast<redisReply *>(raw);
+			if (is_kind(r, "subscribe")) {
+				++confirmed;
+			}
+			else if (is_kind(r, "message")) {
+				// A message on a channel confirmed earlier in this loop: keep it for poll()
+				received.push_back(to_message(r));
+			}
+			freeReplyObject(r);
+		}
+	}
+
+	/**
+	 * @brief Waits for the next message.
+	 * @param timeout How long to wait for data on the socket.
+	 * @return The message, or std::nullopt if none arrived in time (or only a control reply did).
+	 * @throw std::runtime_error on connection errors.
+	 */
+	std::optional<pubsub_message> poll(std::chrono::milliseconds timeout) {
+		if (!received.empty()) {
+			pubsub_message m = std::move(received.front());
+			received.pop_front();
+			return m;
+		}
+
+		void *raw = nullptr;
+		if (redisGetReplyFromReader(context, &raw) != REDIS_OK) {
+			throw std::runtime_error("Subscriber: protocol error");
+		}
+		if (!raw) {
+			// Nothing buffered: wait for the socket, then read whatever arrived
+			pollfd fd{context->fd, POLLIN, 0};
+			const int ready = ::poll(&fd, 1, static_cast<int>(timeout.count()));
+			if (ready < 0 && errno != EINTR) {
+				throw std::runtime_error("Subscriber: poll failed");
+			}
+			if (ready <= 0) return std::nullopt;
+			if (redisBufferRead(context) != REDIS_OK || redisGetReplyFromReader(context, &raw) != REDIS_OK) {
+				throw std::runtime_error("Subscriber: connection lost");
+			}
+			if (!raw) return std::nullopt;
+		}
+
+		auto *r = static_cast<redisReply *>(raw);
+		std::optional<pubsub_message> result;
+		if (is_kind(r, "message")) {
+			result = to_message(r);
+		}
+		freeReplyObject(r);
+		return result;
+	}
+
+private:
+	/* Push replies are arrays whose first element names their kind: "subscribe", "message", ... */
+	static bool is_kind(const redisReply *r, const char *kind) {
+		return r->type == REDIS_REPLY_ARRAY && r->elements >= 3 && r->element[0]->type == REDIS_REPLY_STRING
+			&& std::string(r->element[0]->str, r->element[0]->len) == kind;
+	}
+
+	static pubsub_message to_message(const redisReply *r) {
+		return {std::string(r->element[1]->str, r->element[1]->len),
+				std::string(r->element[2]->str, r->element[2]->len)};
+	}
+
+	redisContext *context;
+	std::deque<pubsub_message> received;
+};
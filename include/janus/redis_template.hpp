@@ -3,7 +3,9 @@
 #include <memory>
 #include <string>
 
+#include "probes.hpp"
 #include "redis_operations.hpp"
+#include "stage_profiler.hpp"
 
 class kv_connection;
 
@@ -35,6 +37,14 @@ public:
 	virtual set_operations<K, V> &ops_for_set() = 0;
 
 	virtual zset_operations<K, V> &ops_for_zset() = 0;
+
+	virtual filter_operations<K, V> &ops_for_filter() = 0;
+
+	virtual hll_operations<K, V> &ops_for_hll() = 0;
+
+	virtual bitmap_operations<K, V> &ops_for_bitmap() = 0;
+
+	virtual roaring_operations<K, V> &ops_for_roaring() = 0;
 };
 
 template<typename K, typename V>
@@ -58,6 +68,10 @@ public:
 		list_ops = std::make_unique<default_list_operations<K, V>>(*this);
 		set_ops = std::make_unique<default_set_operations<K, V>>(*this);
 		zset_ops = std::make_unique<default_zset_operations<K, V>>(*this);
+		filter_ops = std::make_unique<default_filter_operations<K, V>>(*this);
+		hll_ops = std::make_unique<default_hll_operations<K, V>>(*this);
+		bitmap_ops = std::make_unique<default_bitmap_operations<K, V>>(*this);
+		roaring_ops = std::make_unique<default_roaring_operations<K, V>>(*this);
 	}
 
 	bool exists(const K &key) override {
@@ -122,19 +136,45 @@ public:
 		return *zset_ops;
 	}
 
+	filter_operations<K, V> &ops_for_filter() override {
+		return *filter_ops;
+	}
+
+	hll_operations<K, V> &ops_for_hll() override {
+		return *hll_ops;
+	}
+
+	bitmap_operations<K, V> &ops_for_bitmap() override {
+		return *bitmap_ops;
+	}
+
+	roaring_operations<K, V> &ops_for_roaring() override {
+		return *roaring_ops;
+	}
+
 	[[nodiscard]] std::string serialize_key(const K &key) const {
-		return key_serializer->serialize(key);
+		stage_timer timer(stage::serialize);
+		std::string data = key_serializer->serialize(key);
+		JANUS_PROBE2(serialize, 0, data.size());
+		return data;
 	}
 
 	[[nodiscard]] K deserialize_key(const std::string &data) const {
+		stage_timer timer(stage::deserialize);
+		JANUS_PROBE2(deserialize, 0, data.size());
 		return key_serializer->deserialize(data);
 	}
 
 	[[nodiscard]] std::string serialize_value(const V &value) const {
-		return value_serializer->serialize(value);
+		stage_timer timer(stage::serialize);
+		std::string data = value_serializer->serialize(value);
+		JANUS_PROBE2(serialize, 1, data.size());
+		return data;
 	}
 
 	[[nodiscard]] V deserialize_value(const std::string &data) const {
+		stage_timer timer(stage::deserialize);
+		JANUS_PROBE2(deserialize, 1, data.size());
 		return value_serializer->deserialize(data);
 	}
 
@@ -153,4 +193,8 @@ private:
 	std::unique_ptr<list_operations<K, V>> list_ops;
 	std::unique_ptr<set_operations<K, V>> set_ops;
 	std::unique_ptr<zset_operations<K, V>> zset_ops;
+	std::unique_ptr<filter_operations<K, V>> filter_ops;
+	std::unique_ptr<hll_operations<K, V>> hll_ops;
+	std::unique_ptr<bitmap_operations<K, V>> bitmap_ops;
+	std::unique_ptr<roaring_operations<K, V>> roaring_ops;
 };
@@ -0,0 +1,1107 @@
+#pragma once
+
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <istream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "command_table.hpp"
+#include "forwarding_connection.hpp"
+#include "memory_connection.hpp"
+#include "probes.hpp"
+#include "rdb_parser.hpp"
+
+/**
+ * @brief Tuning knobs of a replica_connection.
+ */
+struct replica_options {
+	/* The database replicated; keys and commands of other databases are ignored */
+	int db{0};
+	/* Credentials sent with AUTH before the handshake; an empty user authenticates as the default user */
+	std::string user;
+	std::string password;
+	std::chrono::milliseconds connect_timeout{2000};
+	/* Delay between attempts once the link to the primary is lost */
+	std::chrono::milliseconds reconnect_delay{1000};
+	/* Period of the REPLCONF ACK messages reporting the applied offset to the primary */
+	std::chrono::milliseconds ack_interval{1000};
+	/* Reads throw once nothing was received from the primary for this long; zero disables the check. The primary
+	 * pings its replicas every repl-ping-replica-period (10 s by default), so the bound must be larger than that */
+	std::chrono::milliseconds max_lag{0};
+	/* Options of the in-process store holding the replicated keys */
+	memory_connection_options store;
+};
+
+/**
+ * @brief The replication state of a replica_connection.
+ */
+struct replica_stats {
+	/* Whether the replication link is established and streaming */
+	bool link_up{false};
+	/* Whether a full synchronization completed, so the store holds the primary's data */
+	bool synced{false};
+	/* The replication id of the primary and the offset of the last command applied from its stream */
+	std::string replid;
+	uint64_t offset{0};
+	uint64_t full_syncs{0};
+	uint64_t partial_syncs{0};
+	/* Commands applied from the stream */
+	uint64_t commands{0};
+	/* Stream commands and snapshot keys the store does not implement (streams, modules, ...), which are dropped; the
+	 * keys such a command names read as out of date until the primary replaces them */
+	uint64_t skipped_commands{0};
+	uint64_t skipped_keys{0};
+	/* Times the link failed, and the reason of the last failure */
+	uint64_t link_failures{0};
+	std::string last_error;
+	/* Time since data was last received from the primary */
+	std::chrono::milliseconds last_io{0};
+};
+
+/**
+ * @brief A read-only kv_connection served from an in-process replica of a Redis primary.
+ * * A background thread connects to the primary as a replica would: it sends PSYNC, loads the RDB snapshot of a full
+ * synchronization into a memory_connection with rdb_parser, then applies the command stream the primary propagates
+ * to it, acknowledging the applied offset with REPLCONF ACK. Reads are served from process memory without a network
+ * round trip, and stay consistent with the primary up to the replication lag. When the link breaks the thread
+ * reconnects and resumes with a partial synchronization when the primary's backlog still covers the offset.
+ *
+ * Writes throw, as they do on a read-only Redis replica; pipeline() returns a READONLY error for each write command.
+ * Reads throw while no synchronization completed (the way a loading Redis replies LOADING) and, with
+ * replica_options::max_lag, once the primary has been silent for too long. offset() and wait_for_offset() give
+ * read-your-writes: after a write on the primary, wait until the replica applied the primary's offset (from
+ * INFO replication, or the WAIT command) before reading.
+ *
+ * @note The primary must be able to send a disk-based snapshot: the replica does not announce the EOF capability,
+ * so a primary configured with repl-diskless-sync falls back to a disk snapshot for it. Commands the store does not
+ * implement (RENAME, LREM, XADD, ...) are dropped and counted in replica_stats::skipped_commands; the keys they name
+ * are deleted, and reading them throws until the primary replaces their value or the next full synchronization. One
+ * naming no key (SWAPDB, ...) forces a full synchronization.
+ */
+class replica_connection: public forwarding_connection {
+public:
+	/**
+	 * @brief Starts replicating a primary. The constructor returns immediately; see wait_for_sync().
+	 * @param host The primary's host.
+	 * @param port The primary's port.
+	 * @param options The replication options.
+	 */
+	replica_connection(const std::string &host, int port, const replica_options &options = replica_options()) :
+		forwarding_connection(std::make_shared<memory_connection>(options.store)),
+		store(std::static_pointer_cast<memory_connection>(target)), host(host), port(port), options(options) {
+		worker = std::thread([this] { run(); });
+	}
+
+	~replica_connection() override {
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			stopping = true;
+		}
+		changed.notify_all();
+		if (worker.joinable()) {
+			worker.join();
+		}
+		close_link();
+	}
+
+	replica_connection(const replica_connection &) = delete;
+	replica_connection &operator=(const replica_connection &) = delete;
+
+	/**
+	 * @brief Waits until a full synchronization completed.
+	 * @return False if it did not complete within the timeout.
+	 */
+	bool wait_for_sync(std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(state_mutex);
+		return changed.wait_for(lock, timeout, [this] { return synced.load() || stopping.load(); }) && synced;
+	}
+
+	/**
+	 * @brief Waits until the replica applied the primary's stream up to an offset.
+	 * @param offset A replication offset of the primary, e.g. master_repl_offset after a write.
+	 * @return False if the offset was not reached within the timeout.
+	 */
+	bool wait_for_offset(uint64_t offset, std::chrono::milliseconds timeout) {
+		std::unique_lock<std::mutex> lock(state_mutex);
+		return changed.wait_for(lock, timeout, [this, offset] { return reached(offset) || stopping.load(); })
+			   && reached(offset);
+	}
+
+	/**
+	 * @return The replication offset of the last command applied.
+	 */
+	uint64_t offset() const {
+		return applied.load();
+	}
+
+	replica_stats stats() const {
+		replica_stats s;
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			s.replid = replid;
+			s.last_error = last_error;
+		}
+		s.link_up = link_up.load();
+		s.synced = synced.load();
+		s.offset = applied.load();
+		s.full_syncs = full_syncs.load();
+		s.partial_syncs = partial_syncs.load();
+		s.commands = commands.load();
+		s.skipped_commands = skipped_commands.load();
+		s.skipped_keys = skipped_keys.load();
+		s.link_failures = link_failures.load();
+		s.last_io = std::chrono::milliseconds(steady_ms() - last_io.load());
+		return s;
+	}
+
+	// ============================================================================
+	// Reads, served from the store
+	// ============================================================================
+
+	bool exists(const std::string &key) override {
+		check_readable(key);
+		return target->exists(key);
+	}
+
+	int64_t ttl(const std::string &key) override {
+		check_readable(key);
+		return target->ttl(key);
+	}
+
+	int64_t pttl(const std::string &key) override {
+		check_readable(key);
+		return target->pttl(key);
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		check_readable(key);
+		return target->get(key);
+	}
+
+	std::string getrange(const std::string &key, long long start, long long end) override {
+		check_readable(key);
+		return target->getrange(key, start, end);
+	}
+
+	std::optional<std::string> hget(const std::string &key, const std::string &hash_key) override {
+		check_readable(key);
+		return target->hget(key, hash_key);
+	}
+
+	void hget(const std::string &key, std::unordered_map<std::string, std::optional<std::string>> &hash_map) override {
+		check_readable(key);
+		target->hget(key, hash_map);
+	}
+
+	std::unordered_map<std::string, std::string> hgetall(const std::string &key) override {
+		check_readable(key);
+		return target->hgetall(key);
+	}
+
+	std::vector<std::string> hkeys(const std::string &key) override {
+		check_readable(key);
+		return target->hkeys(key);
+	}
+
+	std::vector<std::string> hvals(const std::string &key) override {
+		check_readable(key);
+		return target->hvals(key);
+	}
+
+	std::vector<std::string> lrange(const std::string &key, long long start, long long stop) override {
+		check_readable(key);
+		return target->lrange(key, start, stop);
+	}
+
+	long long llen(const std::string &key) override {
+		check_readable(key);
+		return target->llen(key);
+	}
+
+	std::vector<std::string> smembers(const std::string &key) override {
+		check_readable(key);
+		return target->smembers(key);
+	}
+
+	long long scard(const std::string &key) override {
+		check_readable(key);
+		return target->scard(key);
+	}
+
+	bool sismember(const std::string &key, const std::string &member) override {
+		check_readable(key);
+		return target->sismember(key, member);
+	}
+
+	std::vector<std::string> sinter(const std::vector<std::string> &keys) override {
+		check_readable(keys);
+		return target->sinter(keys);
+	}
+
+	std::optional<double> zscore(const std::string &key, const std::string &member) override {
+		check_readable(key);
+		return target->zscore(key, member);
+	}
+
+	std::vector<std::string> zrange(const std::string &key, long long start, long long stop) override {
+		check_readable(key);
+		return target->zrange(key, start, stop);
+	}
+
+	std::vector<std::string> zrevrange(const std::string &key, long long start, long long stop) override {
+		check_readable(key);
+		return target->zrevrange(key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrange_withscores(const std::string &key, long long start,
+																  long long stop) override {
+		check_readable(key);
+		return target->zrange_withscores(key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrevrange_withscores(const std::string &key, long long start,
+																	 long long stop) override {
+		check_readable(key);
+		return target->zrevrange_withscores(key, start, stop);
+	}
+
+	std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																		 double max) override {
+		check_readable(key);
+		return target->zrangebyscore_withscores(key, min, max);
+	}
+
+	long long pfcount(const std::vector<std::string> &keys) override {
+		check_readable(keys);
+		return target->pfcount(keys);
+	}
+
+	bool getbit(const std::string &key, long long offset) override {
+		check_readable(key);
+		return target->getbit(key, offset);
+	}
+
+	long long bitcount(const std::string &key, long long start, long long end) override {
+		check_readable(key);
+		return target->bitcount(key, start, end);
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end) override {
+		check_readable(key);
+		return target->bitpos(key, bit, start, end);
+	}
+
+	/**
+	 * @brief Runs the read commands of a pipeline against the store.
+	 * @return The replies in order; write commands get a READONLY error reply.
+	 */
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		check_readable();
+		std::vector<kv_reply> replies;
+		replies.reserve(commands.size());
+		for (const auto &command: commands) {
+			kv_reply reply;
+			reply.type = kv_reply::reply_type::error;
+			if (!command.empty() && !is_allowed_command(command[0])) {
+				reply.str = "READONLY You can't write against a read only replica.";
+			}
+			else if (auto key = has_missing.load() ? first_missing(command_keys(command)) : std::nullopt) {
+				reply.str = not_replicated(*key);
+			}
+			else {
+				reply = store->execute(command);
+			}
+			replies.push_back(std::move(reply));
+		}
+		return replies;
+	}
+
+	// ============================================================================
+	// Writes, refused
+	// ============================================================================
+
+	bool expire(const std::string &, int) override {
+		read_only();
+	}
+
+	bool pexpire(const std::string &, int) override {
+		read_only();
+	}
+
+	long long del(const std::string &) override {
+		read_only();
+	}
+
+	long long del(const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	bool set(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	bool set_not_exists(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	bool set_ex(const std::string &, const std::string &, int) override {
+		read_only();
+	}
+
+	bool set_px(const std::string &, const std::string &, int) override {
+		read_only();
+	}
+
+	std::optional<std::string> getset(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	long long incr(const std::string &, long long) override {
+		read_only();
+	}
+
+	long long decr(const std::string &, long long) override {
+		read_only();
+	}
+
+	long long append(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	bool hset(const std::string &, const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	bool hset(const std::string &, const std::unordered_map<std::string, std::string> &) override {
+		read_only();
+	}
+
+	long long hdel(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	long long hdel(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	long long lpush(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	long long lpush(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	long long rpush(const std::string &, const std::string &) override {
+		read_only();
+	}
+
+	long long rpush(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	std::optional<std::string> lpop(const std::string &) override {
+		read_only();
+	}
+
+	std::optional<std::string> rpop(const std::string &) override {
+		read_only();
+	}
+
+	long long sadd(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	long long srem(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	std::optional<std::string> spop(const std::string &) override {
+		read_only();
+	}
+
+	long long zadd(const std::string &, const std::unordered_map<std::string, double> &) override {
+		read_only();
+	}
+
+	long long zrem(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	double zincrby(const std::string &, double, const std::string &) override {
+		read_only();
+	}
+
+	long long zremrangebyscore(const std::string &, double, double) override {
+		read_only();
+	}
+
+	bool pfadd(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	bool pfmerge(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	bool setbit(const std::string &, long long, bool) override {
+		read_only();
+	}
+
+	long long bitop(const std::string &, const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+	std::string script_load(const std::string &) override {
+		read_only();
+	}
+
+	kv_reply evalsha(const std::string &, const std::vector<std::string> &, const std::vector<std::string> &) override {
+		read_only();
+	}
+
+private:
+	/* Thrown by the I/O helpers once the destructor asked the worker to stop */
+	struct stop_requested {};
+
+	/**
+	 * @brief Feeds the RDB payload of a full synchronization from the link to rdb_parser, without reading past it.
+	 */
+	class payload_buffer: public std::streambuf {
+	public:
+		payload_buffer(replica_connection &owner, uint64_t size) : owner(owner), remaining(size), chunk(64 * 1024) {
+		}
+
+	protected:
+		int_type underflow() override {
+			if (gptr() < egptr()) return traits_type::to_int_type(*gptr());
+			if (remaining == 0) return traits_type::eof();
+			while (owner.input_pos == owner.input.size()) {
+				owner.fill();
+			}
+			const size_t n = static_cast<size_t>(
+				std::min<uint64_t>({remaining, owner.input.size() - owner.input_pos, chunk.size()}));
+			std::memcpy(chunk.data(), owner.input.data() + owner.input_pos, n);
+			owner.input_pos += n;
+			remaining -= n;
+			setg(chunk.data(), chunk.data(), chunk.data() + n);
+			return traits_type::to_int_type(*gptr());
+		}
+
+	private:
+		replica_connection &owner;
+		uint64_t remaining;
+		std::vector<char> chunk;
+	};
+
+	// ==========================================================
+	// Replication thread
+	// ==========================================================
+
+	void run() {
+		while (!stopping) {
+			try {
+				open_link();
+				handshake();
+				link_up = true;
+				for (;;) {
+					apply_stream();
+					fill();
+				}
+			}
+			catch (const stop_requested &) {
+				break;
+			}
+			catch (const std::exception &e) {
+				std::lock_guard<std::mutex> lock(state_mutex);
+				last_error = e.what();
+				++link_failures;
+			}
+			link_up = false;
+			close_link();
+			std::unique_lock<std::mutex> lock(state_mutex);
+			changed.wait_for(lock, options.reconnect_delay, [this] { return stopping.load(); });
+		}
+		link_up = false;
+	}
+
+	void handshake() {
+		if (!options.password.empty()) {
+			if (options.user.empty()) send_command({"AUTH", options.password});
+			else send_command({"AUTH", options.user, options.password});
+			expect_ok("AUTH");
+		}
+		send_command({"PING"});
+		const std::string pong = read_line();
+		if (pong.empty() || pong[0] == '-') throw std::runtime_error("replica_connection: PING failed: " + pong);
+		send_command({"REPLCONF", "capa", "psync2"});
+		expect_ok("REPLCONF");
+
+		std::string id;
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			id = replid;
+		}
+		// A partial synchronization needs data applied from a known history
+		if (synced && !id.empty()) send_command({"PSYNC", id, std::to_string(applied.load() + 1)});
+		else send_command({"PSYNC", "?", "-1"});
+
+		const std::string reply = read_line();
+		if (reply.compare(0, 12, "+FULLRESYNC ") == 0) {
+			const size_t space = reply.find(' ', 12);
+			if (space == std::string::npos) throw std::runtime_error("replica_connection: bad reply: " + reply);
+			full_sync(reply.substr(12, space - 12), std::stoull(reply.substr(space + 1)));
+		}
+		else if (reply.compare(0, 9, "+CONTINUE") == 0) {
+			// The primary may have changed its replication id after a failover; the offsets carry on
+			if (reply.size() > 10) {
+				std::lock_guard<std::mutex> lock(state_mutex);
+				replid = reply.substr(10);
+			}
+			++partial_syncs;
+		}
+		else {
+			throw std::runtime_error("replica_connection: PSYNC failed: " + reply);
+		}
+	}
+
+	/**
+	 * @brief Replaces the store's content with the snapshot the primary sends.
+	 */
+	void full_sync(const std::string &id, uint64_t start) {
+		const std::string header = read_line();
+		if (header.size() < 2 || header[0] != '$') {
+			throw std::runtime_error("replica_connection: bad snapshot header: " + header);
+		}
+		if (header.compare(0, 5, "$EOF:") == 0) {
+			throw std::runtime_error("replica_connection: the primary sent a diskless snapshot");
+		}
+		synced = false;
+		store->flushall();
+		{
+			std::lock_guard<std::mutex> lock(missing_mutex);
+			missing.clear();
+			has_missing = false;
+		}
+		payload_buffer buffer(*this, std::stoull(header.substr(1)));
+		std::istream payload(&buffer);
+		// Rethrows the errors of the link (and stop requests) rather than reporting a truncated file
+		payload.exceptions(std::ios::badbit);
+		rdb_parser parser(payload);
+		rdb_entry entry;
+		const int64_t now = std::chrono::duration_cast<std::chrono::milliseconds>(
+								std::chrono::system_clock::now().time_since_epoch())
+								.count();
+		while (parser.next(entry)) {
+			if (entry.db != options.db || (entry.expire_at >= 0 && entry.expire_at <= now)) continue;
+			load(entry);
+		}
+
+		db = 0;
+		in_multi = false;
+		queued.clear();
+		{
+			std::lock_guard<std::mutex> lock(state_mutex);
+			replid = id;
+			applied = start;
+			synced = true;
+		}
+		++full_syncs;
+		changed.notify_all();
+	}
+
+	void load(const rdb_entry &entry) {
+		std::vector<std::string> argv;
+		switch (entry.type) {
+			case rdb_type::string:
+				argv = {"SET", entry.key, entry.value};
+				break;
+			case rdb_type::list:
+			case rdb_type::set:
+				argv = {entry.type == rdb_type::list ? "RPUSH" : "SADD", entry.key};
+				argv.insert(argv.end(), entry.elements.begin(), entry.elements.end());
+				break;
+			case rdb_type::hash:
+				argv = {"HSET", entry.key};
+				for (const auto &field: entry.fields) {
+					argv.push_back(field.first);
+					argv.push_back(field.second);
+				}
+				break;
+			case rdb_type::zset:
+				argv = {"ZADD", entry.key};
+				for (const auto &member: entry.members) {
+					argv.push_back(format_score(member.second));
+					argv.push_back(member.first);
+				}
+				break;
+			default:
+				++skipped_keys;
+				return;
+		}
+		// An empty collection (all hash fields expired) leaves no key behind
+		if (argv.size() < 3) return;
+		if (store->execute(argv).is_error()) {
+			++skipped_keys;
+			return;
+		}
+		if (entry.expire_at >= 0) {
+			store->execute({"PEXPIREAT", entry.key, std::to_string(entry.expire_at)});
+		}
+	}
+
+	/**
+	 * @brief Applies the complete commands buffered from the stream.
+	 */
+	void apply_stream() {
+		std::vector<std::string> argv;
+		size_t size = 0;
+		bool progressed = false;
+		while (parse_command(argv, size)) {
+			apply(argv);
+			applied += size;
+			++commands;
+			progressed = true;
+		}
+		if (progressed) {
+			// Empty critical section: a waiter between its predicate check and its wait cannot miss the notification
+			{ std::lock_guard<std::mutex> lock(state_mutex); }
+			changed.notify_all();
+		}
+	}
+
+	void apply(const std::vector<std::string> &argv) {
+		std::string name = argv[0];
+		std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+		// Propagated without changing any key
+		if (name == "PING" || name == "PUBLISH" || name == "SPUBLISH" || name == "SCRIPT" || name == "FUNCTION") return;
+		if (name == "SELECT") {
+			db = argv.size() > 1 ? std::atoi(argv[1].c_str()) : 0;
+			return;
+		}
+		if (name == "REPLCONF") {
+			// The reported offset excludes the GETACK itself, as a Redis replica's does
+			if (argv.size() > 1 && equals_ignore_case(argv[1], "GETACK")) send_ack();
+			return;
+		}
+		if (db != options.db) return;
+		if (name == "MULTI") {
+			in_multi = true;
+			queued.clear();
+			return;
+		}
+		if (name == "EXEC") {
+			in_multi = false;
+			apply_transaction();
+			return;
+		}
+		if (in_multi) {
+			queued.push_back(argv);
+			return;
+		}
+		applied_command(argv, !store->execute(argv).is_error());
+	}
+
+	/**
+	 * @brief Applies a transaction atomically. When it holds a command the store does not implement, the store aborts
+	 * the whole transaction, so its commands are then applied one by one to keep the others.
+	 */
+	void apply_transaction() {
+		std::vector<std::vector<std::string>> commands{{"MULTI"}};
+		commands.insert(commands.end(), queued.begin(), queued.end());
+		commands.push_back({"EXEC"});
+		const std::vector<kv_reply> replies = store->pipeline(commands);
+		const std::vector<std::vector<std::string>> transaction = std::move(queued);
+		queued.clear();
+		const std::vector<kv_reply> &results = replies.back().elements;
+		for (size_t i = 0; i < transaction.size(); ++i) {
+			const bool ok = replies.back().is_error() ? !store->execute(transaction[i]).is_error()
+													  : i < results.size() && !results[i].is_error();
+			applied_command(transaction[i], ok);
+		}
+	}
+
+	/**
+	 * @brief Accounts for a stream command after the store ran it. The primary only propagates commands that
+	 * succeeded, so one the store rejected (RENAME, LREM, SMOVE, RESTORE... are not implemented) leaves the keys it
+	 * names out of date: they are deleted and reads of them fail until the primary replaces their value or the next
+	 * full synchronization. A rejected command naming no key may have changed any of them, so it forces a full
+	 * synchronization.
+	 * @throw std::runtime_error to drop the link and resynchronize.
+	 */
+	void applied_command(const std::vector<std::string> &argv, bool ok) {
+		const std::vector<std::string> keys = command_keys(argv);
+		if (ok) {
+			if (has_missing.load() && replaces_value(argv)) {
+				std::lock_guard<std::mutex> lock(missing_mutex);
+				for (const auto &key: keys) {
+					missing.erase(key);
+				}
+				has_missing = !missing.empty();
+			}
+			return;
+		}
+		++skipped_commands;
+		if (keys.empty()) {
+			{
+				std::lock_guard<std::mutex> lock(state_mutex);
+				replid.clear();
+			}
+			synced = false;
+			throw std::runtime_error("replica_connection: cannot apply " + argv[0] + ", resynchronizing");
+		}
+		{
+			// Marked before the deletion, so no reader sees the key as simply absent
+			std::lock_guard<std::mutex> lock(missing_mutex);
+			missing.insert(keys.begin(), keys.end());
+			has_missing = true;
+		}
+		std::vector<std::string> del{"DEL"};
+		del.insert(del.end(), keys.begin(), keys.end());
+		store->execute(del);
+	}
+
+	/* Whether a command sets the whole value and TTL of its keys, whatever they held */
+	static bool replaces_value(const std::vector<std::string> &argv) {
+		const std::string &name = argv[0];
+		if (equals_ignore_case(name, "SET")) {
+			return std::none_of(argv.begin() + 1, argv.end(),
+								[](const std::string &a) { return equals_ignore_case(a, "KEEPTTL"); });
+		}
+		for (const char *command: {"DEL", "UNLINK", "MSET", "SETEX", "PSETEX"}) {
+			if (equals_ignore_case(name, command)) return true;
+		}
+		return false;
+	}
+
+	// ==========================================================
+	// Link I/O
+	// ==========================================================
+
+	void open_link() {
+		addrinfo hints{};
+		hints.ai_family = AF_UNSPEC;
+		hints.ai_socktype = SOCK_STREAM;
+		addrinfo *addresses = nullptr;
+		const int rc = ::getaddrinfo(host.c_str(), std::to_string(port).c_str(), &hints, &addresses);
+		if (rc != 0) throw std::runtime_error("replica_connection: cannot resolve " + host + ": " + gai_strerror(rc));
+		std::string error = "no address";
+		for (addrinfo *a = addresses; a && fd < 0; a = a->ai_next) {
+			const int s = ::socket(a->ai_family, a->ai_socktype | SOCK_CLOEXEC, a->ai_protocol);
+			if (s < 0) continue;
+			if (connect_with_timeout(s, a->ai_addr, a->ai_addrlen)) {
+				fd = s;
+			}
+			else {
+				error = std::strerror(errno);
+				::close(s);
+			}
+		}
+		::freeaddrinfo(addresses);
+		JANUS_PROBE3(replica__link, host.c_str(), port, fd >= 0 ? 1 : 0);
+		if (fd < 0) {
+			throw std::runtime_error("replica_connection: cannot connect to " + host + ":" + std::to_string(port)
+									 + ": " + error);
+		}
+		const int one = 1;
+		::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+		input.clear();
+		input_pos = 0;
+		last_io = steady_ms();
+		last_ack = last_io.load();
+	}
+
+	bool connect_with_timeout(int s, const sockaddr *address, socklen_t length) {
+		const int flags = ::fcntl(s, F_GETFL);
+		::fcntl(s, F_SETFL, flags | O_NONBLOCK);
+		if (::connect(s, address, length) != 0) {
+			if (errno != EINPROGRESS) return false;
+			pollfd p{s, POLLOUT, 0};
+			const int ready = ::poll(&p, 1, static_cast<int>(options.connect_timeout.count()));
+			if (ready <= 0) {
+				errno = ready == 0 ? ETIMEDOUT : errno;
+				return false;
+			}
+			int error = 0;
+			socklen_t size = sizeof(error);
+			::getsockopt(s, SOL_SOCKET, SO_ERROR, &error, &size);
+			if (error != 0) {
+				errno = error;
+				return false;
+			}
+		}
+		::fcntl(s, F_SETFL, flags);
+		return true;
+	}
+
+	void close_link() {
+		if (fd >= 0) {
+			::close(fd);
+			fd = -1;
+		}
+	}
+
+	/**
+	 * @brief Waits up to a slice for data from the primary and appends it to the input buffer. Between slices it
+	 * sends the periodic acknowledgement and checks for a stop request.
+	 * @throw std::runtime_error if the primary closed the link.
+	 */
+	void fill() {
+		if (stopping) throw stop_requested();
+		if (input_pos > 0 && input_pos == input.size()) {
+			input.clear();
+			input_pos = 0;
+		}
+		else if (input_pos > 64 * 1024 && input_pos * 2 > input.size()) {
+			input.erase(0, input_pos);
+			input_pos = 0;
+		}
+		const auto slice = std::min<std::chrono::milliseconds>(options.ack_interval, std::chrono::milliseconds(100));
+		pollfd p{fd, POLLIN, 0};
+		const int ready = ::poll(&p, 1, static_cast<int>(std::max<int64_t>(slice.count(), 1)));
+		if (ready < 0 && errno != EINTR) {
+			throw std::runtime_error(std::string("replica_connection: ") + std::strerror(errno));
+		}
+		if (ready > 0) {
+			char buffer[16 * 1024];
+			const ssize_t n = ::recv(fd, buffer, sizeof(buffer), 0);
+			if (n == 0) throw std::runtime_error("replica_connection: connection closed by the primary");
+			if (n < 0 && errno != EINTR && errno != EAGAIN) {
+				throw std::runtime_error(std::string("replica_connection: ") + std::strerror(errno));
+			}
+			if (n > 0) {
+				input.append(buffer, static_cast<size_t>(n));
+				last_io = steady_ms();
+			}
+		}
+		if (synced && link_up && steady_ms() - last_ack >= options.ack_interval.count()) {
+			send_ack();
+		}
+	}
+
+	/**
+	 * @brief Reads a reply line, skipping the empty lines the primary sends to keep the link alive while it prepares
+	 * a snapshot.
+	 */
+	std::string read_line() {
+		for (;;) {
+			const size_t end = input.find('\n', input_pos);
+			if (end == std::string::npos) {
+				fill();
+				continue;
+			}
+			std::string line = input.substr(input_pos, end - input_pos);
+			input_pos = end + 1;
+			if (!line.empty() && line.back() == '\r') line.pop_back();
+			if (!line.empty()) return line;
+		}
+	}
+
+	void expect_ok(const char *command) {
+		const std::string reply = read_line();
+		if (reply != "+OK") {
+			throw std::runtime_error(std::string("replica_connection: ") + command + " failed: " + reply);
+		}
+	}
+
+	/**
+	 * @brief Parses one command of the stream from the input buffer.
+	 * @param argv Receives the command.
+	 * @param size Receives the number of stream bytes it took, which advance the replication offset.
+	 * @return False if the buffer does not hold a complete command yet.
+	 */
+	bool parse_command(std::vector<std::string> &argv, size_t &size) {
+		size_t pos = input_pos;
+		long long count = 0;
+		if (!parse_header(pos, '*', count)) return false;
+		if (count <= 0) throw std::runtime_error("replica_connection: bad command in the stream");
+		argv.clear();
+		for (long long i = 0; i < count; ++i) {
+			long long length = 0;
+			if (!parse_header(pos, '$', length)) return false;
+			if (length < 0) throw std::runtime_error("replica_connection: bad argument in the stream");
+			if (input.size() - pos < static_cast<size_t>(length) + 2) return false;
+			argv.emplace_back(input, pos, static_cast<size_t>(length));
+			pos += static_cast<size_t>(length) + 2;
+		}
+		size = pos - input_pos;
+		input_pos = pos;
+		return true;
+	}
+
+	bool parse_header(size_t &pos, char prefix, long long &value) {
+		const size_t end = input.find("\r\n", pos);
+		if (end == std::string::npos) return false;
+		if (input[pos] != prefix) {
+			throw std::runtime_error("replica_connection: unexpected data in the stream: "
+									 + input.substr(pos, std::min<size_t>(end - pos, 64)));
+		}
+		value = std::atoll(input.c_str() + pos + 1);
+		pos = end + 2;
+		return true;
+	}
+
+	void send_command(const std::vector<std::string> &argv) {
+		std::string out = "*" + std::to_string(argv.size()) + "\r\n";
+		for (const auto &arg: argv) {
+			out += "$" + std::to_string(arg.size()) + "\r\n";
+			out += arg;
+			out += "\r\n";
+		}
+		size_t sent = 0;
+		while (sent < out.size()) {
+			const ssize_t n = ::send(fd, out.data() + sent, out.size() - sent, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EINTR) continue;
+				throw std::runtime_error(std::string("replica_connection: ") + std::strerror(errno));
+			}
+			sent += static_cast<size_t>(n);
+		}
+	}
+
+	void send_ack() {
+		send_command({"REPLCONF", "ACK", std::to_string(applied.load())});
+		last_ack = steady_ms();
+	}
+
+	// ==========================================================
+	// Helpers
+	// ==========================================================
+
+	void check_readable() const {
+		if (!synced) throw std::runtime_error("replica_connection: LOADING, not synchronized with the primary yet");
+		if (options.max_lag.count() > 0) {
+			const int64_t silent = steady_ms() - last_io.load();
+			if (silent > options.max_lag.count()) {
+				throw std::runtime_error("replica_connection: no data from the primary for " + std::to_string(silent)
+										 + " ms");
+			}
+		}
+	}
+
+	void check_readable(const std::string &key) const {
+		check_readable();
+		if (!has_missing.load()) return;
+		std::lock_guard<std::mutex> lock(missing_mutex);
+		if (missing.count(key) > 0) throw std::runtime_error("replica_connection: " + not_replicated(key));
+	}
+
+	void check_readable(const std::vector<std::string> &keys) const {
+		check_readable();
+		if (!has_missing.load()) return;
+		if (auto key = first_missing(keys)) throw std::runtime_error("replica_connection: " + not_replicated(*key));
+	}
+
+	/* Returns the first of the keys left out of date by a command the store does not implement */
+	std::optional<std::string> first_missing(const std::vector<std::string> &keys) const {
+		std::lock_guard<std::mutex> lock(missing_mutex);
+		for (const auto &key: keys) {
+			if (missing.count(key) > 0) return key;
+		}
+		return std::nullopt;
+	}
+
+	static std::string not_replicated(const std::string &key) {
+		return "key " + key + " is out of date: the primary changed it with a command the replica does not implement";
+	}
+
+	[[noreturn]] static void read_only() {
+		throw std::runtime_error("replica_connection: READONLY You can't write against a read only replica.");
+	}
+
+	/* The caller holds state_mutex */
+	bool reached(uint64_t offset) const {
+		return synced && applied >= offset;
+	}
+
+	/* Reads, and the transaction commands wrapping them */
+	static bool is_allowed_command(const std::string &name) {
+		if (is_read_command(name)) return true;
+		for (const char *control: {"DISCARD", "EXEC", "MULTI", "UNWATCH", "WATCH"}) {
+			if (equals_ignore_case(name, control)) return true;
+		}
+		return false;
+	}
+
+	static bool equals_ignore_case(const std::string &a, const char *b) {
+		return a.size() == std::strlen(b) && std::equal(a.begin(), a.end(), b, [](char x, char y) {
+				   return std::toupper(static_cast<unsigned char>(x)) == std::toupper(static_cast<unsigned char>(y));
+			   });
+	}
+
+	static std::string format_score(double score) {
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.17g", score);
+		return buffer;
+	}
+
+	static int64_t steady_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::steady_clock::now().time_since_epoch())
+			.count();
+	}
+
+	std::shared_ptr<memory_connection> store;
+	const std::string host;
+	const int port;
+	const replica_options options;
+
+	/* Guards replid, last_error and stopping, and pairs with changed for the waits */
+	mutable std::mutex state_mutex;
+	std::condition_variable changed;
+	std::atomic<bool> stopping{false};
+	std::string replid;
+	std::string last_error;
+	std::atomic<bool> link_up{false};
+	std::atomic<bool> synced{false};
+	/* Written by the worker only; read by any thread */
+	std::atomic<uint64_t> applied{0};
+	std::atomic<int64_t> last_io{0};
+	std::atomic<uint64_t> full_syncs{0};
+	std::atomic<uint64_t> partial_syncs{0};
+	std::atomic<uint64_t> commands{0};
+	std::atomic<uint64_t> skipped_commands{0};
+	std::atomic<uint64_t> skipped_keys{0};
+	std::atomic<uint64_t> link_failures{0};
+
+	/* Keys left out of date by commands the store does not implement, written by the worker */
+	mutable std::mutex missing_mutex;
+	std::unordered_set<std::string> missing;
+	std::atomic<bool> has_missing{false};
+
+	/* Worker state */
+	int fd{-1};
+	std::string input;
+	size_t input_pos{0};
+	int64_t last_ack{0};
+	int db{0};
+	bool in_multi{false};
+	std::vector<std::vector<std::string>> queued;
+	std::thread worker;
+};
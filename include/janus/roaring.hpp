@@ -0,0 +1,460 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <iterator>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "serialization.hpp"
+
+/**
+ * @brief A compressed bitmap of 32-bit integers (a Roaring bitmap with array and bitmap containers).
+ * * Integers are partitioned by their high 16 bits into containers. A container holding at most 4096 values is a
+ * sorted array of the low 16 bits; a denser one is a 65536-bit bitmap. Bitmap containers are combined word by word in
+ * plain loops over uint64_t that the compiler vectorizes, array containers with merge-style set algorithms.
+ *
+ * The encoded form of a container (encode_container()) is a type byte (0 = array, 1 = bitmap) followed by either the
+ * little-endian uint16 values or the 8192 bitmap bytes. Within bitmap bytes, value x is bit (7 - x % 8) of byte x / 8,
+ * the bit order of SETBIT/GETBIT, so a single value of a stored container can be probed by reading one byte.
+ */
+class roaring_bitmap {
+public:
+	static constexpr uint32_t array_max = 4096;
+	static constexpr size_t bitmap_words = 1024;
+	static constexpr size_t bitmap_bytes = bitmap_words * 8;
+	static constexpr char array_type = 0;
+	static constexpr char bitmap_type = 1;
+
+	struct container {
+		bool is_bitmap{false};
+		uint32_t cardinality{0};
+		std::vector<uint16_t> array;
+		std::vector<uint64_t> bitmap;
+
+		[[nodiscard]] bool contains(uint16_t low) const {
+			if (is_bitmap) return test_bit(bitmap, low);
+			return std::binary_search(array.begin(), array.end(), low);
+		}
+
+		bool add(uint16_t low) {
+			if (is_bitmap) {
+				if (test_bit(bitmap, low)) return false;
+				set_bit(bitmap, low);
+				++cardinality;
+				return true;
+			}
+			auto it = std::lower_bound(array.begin(), array.end(), low);
+			if (it != array.end() && *it == low) return false;
+			array.insert(it, low);
+			if (++cardinality > array_max) to_bitmap();
+			return true;
+		}
+
+		bool remove(uint16_t low) {
+			if (is_bitmap) {
+				if (!test_bit(bitmap, low)) return false;
+				clear_bit(bitmap, low);
+				if (--cardinality <= array_max) to_array();
+				return true;
+			}
+			auto it = std::lower_bound(array.begin(), array.end(), low);
+			if (it == array.end() || *it != low) return false;
+			array.erase(it);
+			--cardinality;
+			return true;
+		}
+
+		void to_bitmap() {
+			bitmap.assign(bitmap_words, 0);
+			for (uint16_t v: array) {
+				set_bit(bitmap, v);
+			}
+			array = std::vector<uint16_t>();
+			is_bitmap = true;
+		}
+
+		void to_array() {
+			std::vector<uint16_t> values;
+			values.reserve(cardinality);
+			for_each_bit(bitmap, [&values](uint16_t v) { values.push_back(v); });
+			array = std::move(values);
+			bitmap = std::vector<uint64_t>();
+			is_bitmap = false;
+		}
+
+		/* Recomputes the cardinality after a bulk operation and switches to the cheaper representation */
+		void normalize() {
+			if (is_bitmap) {
+				cardinality = popcount(bitmap);
+				if (cardinality <= array_max) to_array();
+			}
+			else {
+				cardinality = static_cast<uint32_t>(array.size());
+				if (cardinality > array_max) to_bitmap();
+			}
+		}
+	};
+
+	roaring_bitmap() = default;
+
+	roaring_bitmap(std::initializer_list<uint32_t> values) {
+		for (uint32_t v: values) {
+			add(v);
+		}
+	}
+
+	/**
+	 * @brief Adds a value.
+	 * @return True if the value was not present before.
+	 */
+	bool add(uint32_t value) {
+		return containers[high_bits(value)].add(low_bits(value));
+	}
+
+	/**
+	 * @brief Removes a value.
+	 * @return True if the value was present.
+	 */
+	bool remove(uint32_t value) {
+		auto it = containers.find(high_bits(value));
+		if (it == containers.end() || !it->second.remove(low_bits(value))) return false;
+		if (it->second.cardinality == 0) containers.erase(it);
+		return true;
+	}
+
+	[[nodiscard]] bool contains(uint32_t value) const {
+		auto it = containers.find(high_bits(value));
+		return it != containers.end() && it->second.contains(low_bits(value));
+	}
+
+	[[nodiscard]] uint64_t cardinality() const {
+		uint64_t total = 0;
+		for (const auto &c: containers) {
+			total += c.second.cardinality;
+		}
+		return total;
+	}
+
+	[[nodiscard]] bool empty() const {
+		return containers.empty();
+	}
+
+	void clear() {
+		containers.clear();
+	}
+
+	/**
+	 * @brief Returns all values in ascending order.
+	 */
+	[[nodiscard]] std::vector<uint32_t> to_vector() const {
+		std::vector<uint32_t> result;
+		result.reserve(cardinality());
+		for (const auto &c: containers) {
+			const uint32_t high = static_cast<uint32_t>(c.first) << 16;
+			if (c.second.is_bitmap) {
+				for_each_bit(c.second.bitmap, [&result, high](uint16_t v) { result.push_back(high | v); });
+			}
+			else {
+				for (uint16_t v: c.second.array) {
+					result.push_back(high | v);
+				}
+			}
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Intersects this bitmap with another one in place.
+	 */
+	roaring_bitmap &operator&=(const roaring_bitmap &other) {
+		for (auto it = containers.begin(); it != containers.end();) {
+			auto o = other.containers.find(it->first);
+			if (o != other.containers.end()) intersect(it->second, o->second);
+			if (o == other.containers.end() || it->second.cardinality == 0) {
+				it = containers.erase(it);
+			}
+			else {
+				++it;
+			}
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Unites this bitmap with another one in place.
+	 */
+	roaring_bitmap &operator|=(const roaring_bitmap &other) {
+		for (const auto &o: other.containers) {
+			auto it = containers.find(o.first);
+			if (it == containers.end()) {
+				containers.emplace(o.first, o.second);
+			}
+			else {
+				unite(it->second, o.second);
+			}
+		}
+		return *this;
+	}
+
+	friend roaring_bitmap operator&(roaring_bitmap lhs, const roaring_bitmap &rhs) {
+		return lhs &= rhs;
+	}
+
+	friend roaring_bitmap operator|(roaring_bitmap lhs, const roaring_bitmap &rhs) {
+		return lhs |= rhs;
+	}
+
+	bool operator==(const roaring_bitmap &other) const {
+		return to_vector() == other.to_vector();
+	}
+
+	bool operator!=(const roaring_bitmap &other) const {
+		return !(*this == other);
+	}
+
+	/**
+	 * @brief Returns the containers, keyed by the high 16 bits of their values.
+	 */
+	[[nodiscard]] const std::map<uint16_t, container> &get_containers() const {
+		return containers;
+	}
+
+	/**
+	 * @brief Replaces the container of one chunk; an empty container removes the chunk.
+	 */
+	void set_container(uint16_t high, container c) {
+		if (c.cardinality == 0) {
+			containers.erase(high);
+		}
+		else {
+			containers[high] = std::move(c);
+		}
+	}
+
+	static uint16_t high_bits(uint32_t value) {
+		return static_cast<uint16_t>(value >> 16);
+	}
+
+	static uint16_t low_bits(uint32_t value) {
+		return static_cast<uint16_t>(value & 0xffff);
+	}
+
+	static std::string encode_container(const container &c) {
+		std::string data;
+		if (c.is_bitmap) {
+			data.resize(1 + bitmap_bytes);
+			data[0] = bitmap_type;
+			std::memcpy(&data[1], c.bitmap.data(), bitmap_bytes);
+		}
+		else {
+			data.resize(1 + c.array.size() * 2);
+			data[0] = array_type;
+			for (size_t i = 0; i < c.array.size(); ++i) {
+				data[1 + i * 2] = static_cast<char>(c.array[i] & 0xff);
+				data[2 + i * 2] = static_cast<char>(c.array[i] >> 8);
+			}
+		}
+		return data;
+	}
+
+	/**
+	 * @brief Decodes a container; empty data yields an empty container.
+	 * @throw std::runtime_error if the data is not a valid container.
+	 */
+	static container decode_container(const char *data, size_t len) {
+		container c;
+		if (len == 0) return c;
+		if (data[0] == bitmap_type) {
+			if (len != 1 + bitmap_bytes) throw std::runtime_error("roaring_bitmap: invalid bitmap container");
+			c.is_bitmap = true;
+			c.bitmap.resize(bitmap_words);
+			std::memcpy(c.bitmap.data(), data + 1, bitmap_bytes);
+		}
+		else if (data[0] == array_type) {
+			if ((len - 1) % 2 != 0) throw std::runtime_error("roaring_bitmap: invalid array container");
+			c.array.resize((len - 1) / 2);
+			for (size_t i = 0; i < c.array.size(); ++i) {
+				c.array[i] = static_cast<uint16_t>(static_cast<uint8_t>(data[1 + i * 2])
+												   | static_cast<uint8_t>(data[2 + i * 2]) << 8);
+			}
+			if (!std::is_sorted(c.array.begin(), c.array.end())) {
+				throw std::runtime_error("roaring_bitmap: unsorted array container");
+			}
+		}
+		else {
+			throw std::runtime_error("roaring_bitmap: unknown container type");
+		}
+		c.normalize();
+		return c;
+	}
+
+	static container decode_container(const std::string &data) {
+		return decode_container(data.data(), data.size());
+	}
+
+	/* Bit order within bitmap bytes follows SETBIT: value x is bit (7 - x % 8) of byte x / 8 */
+	static bool test_bit(const std::vector<uint64_t> &bitmap, uint16_t v) {
+		return (reinterpret_cast<const uint8_t *>(bitmap.data())[v >> 3] >> (7 - (v & 7))) & 1;
+	}
+
+private:
+	static void set_bit(std::vector<uint64_t> &bitmap, uint16_t v) {
+		reinterpret_cast<uint8_t *>(bitmap.data())[v >> 3] |= static_cast<uint8_t>(0x80 >> (v & 7));
+	}
+
+	static void clear_bit(std::vector<uint64_t> &bitmap, uint16_t v) {
+		reinterpret_cast<uint8_t *>(bitmap.data())[v >> 3] &= static_cast<uint8_t>(~(0x80 >> (v & 7)));
+	}
+
+	/* Calls f for every set bit in ascending value order, skipping empty words */
+	template<typename F>
+	static void for_each_bit(const std::vector<uint64_t> &bitmap, F &&f) {
+		const auto *bytes = reinterpret_cast<const uint8_t *>(bitmap.data());
+		for (size_t w = 0; w < bitmap_words; ++w) {
+			if (bitmap[w] == 0) continue;
+			for (size_t i = w * 8; i < w * 8 + 8; ++i) {
+				unsigned j = 0;
+				for (unsigned b = bytes[i]; b != 0; b = (b << 1) & 0xff, ++j) {
+					if (b & 0x80) f(static_cast<uint16_t>(i * 8 + j));
+				}
+			}
+		}
+	}
+
+	static uint32_t popcount(const std::vector<uint64_t> &bitmap) {
+		uint32_t count = 0;
+		for (uint64_t word: bitmap) {
+#if defined(__GNUC__) || defined(__clang__)
+			count += static_cast<uint32_t>(__builtin_popcountll(word));
+#else
+			word = word - ((word >> 1) & 0x5555555555555555ULL);
+			word = (word & 0x3333333333333333ULL) + ((word >> 2) & 0x3333333333333333ULL);
+			word = (word + (word >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+			count += static_cast<uint32_t>((word * 0x0101010101010101ULL) >> 56);
+#endif
+		}
+		return count;
+	}
+
+	static void intersect(container &a, const container &b) {
+		if (a.is_bitmap && b.is_bitmap) {
+			for (size_t i = 0; i < bitmap_words; ++i) {
+				a.bitmap[i] &= b.bitmap[i];
+			}
+		}
+		else if (a.is_bitmap) {
+			std::vector<uint16_t> values;
+			values.reserve(b.array.size());
+			for (uint16_t v: b.array) {
+				if (test_bit(a.bitmap, v)) values.push_back(v);
+			}
+			a.array = std::move(values);
+			a.bitmap = std::vector<uint64_t>();
+			a.is_bitmap = false;
+		}
+		else if (b.is_bitmap) {
+			a.array.erase(std::remove_if(a.array.begin(), a.array.end(),
+										 [&b](uint16_t v) { return !test_bit(b.bitmap, v); }),
+						  a.array.end());
+		}
+		else {
+			std::vector<uint16_t> values;
+			values.reserve(std::min(a.array.size(), b.array.size()));
+			std::set_intersection(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+								  std::back_inserter(values));
+			a.array = std::move(values);
+		}
+		a.normalize();
+	}
+
+	static void unite(container &a, const container &b) {
+		if (a.is_bitmap && b.is_bitmap) {
+			for (size_t i = 0; i < bitmap_words; ++i) {
+				a.bitmap[i] |= b.bitmap[i];
+			}
+		}
+		else if (a.is_bitmap) {
+			for (uint16_t v: b.array) {
+				set_bit(a.bitmap, v);
+			}
+		}
+		else if (b.is_bitmap) {
+			std::vector<uint64_t> words = b.bitmap;
+			for (uint16_t v: a.array) {
+				set_bit(words, v);
+			}
+			a.bitmap = std::move(words);
+			a.array = std::vector<uint16_t>();
+			a.is_bitmap = true;
+		}
+		else {
+			std::vector<uint16_t> values;
+			values.reserve(a.array.size() + b.array.size());
+			std::set_union(a.array.begin(), a.array.end(), b.array.begin(), b.array.end(),
+						   std::back_inserter(values));
+			a.array = std::move(values);
+		}
+		a.normalize();
+	}
+
+	std::map<uint16_t, container> containers;
+};
+
+/**
+ * @brief Serializes a whole roaring_bitmap into a single value.
+ * * Layout: container count (uint32), then per container its high bits (uint16), the encoded length (uint32) and the
+ * encoded container; all integers little-endian. Suited to small bitmaps; large ones are better stored chunked with
+ * roaring_operations.
+ */
+class roaring_serializer: public serializer<roaring_bitmap> {
+public:
+	std::string serialize(const roaring_bitmap &bitmap) const override {
+		std::string data;
+		put(data, static_cast<uint32_t>(bitmap.get_containers().size()), 4);
+		for (const auto &c: bitmap.get_containers()) {
+			const std::string encoded = roaring_bitmap::encode_container(c.second);
+			put(data, c.first, 2);
+			put(data, static_cast<uint32_t>(encoded.size()), 4);
+			data += encoded;
+		}
+		return data;
+	}
+
+	roaring_bitmap deserialize(const std::string &data) const override {
+		roaring_bitmap bitmap;
+		if (data.empty()) return bitmap;
+		size_t pos = 0;
+		const uint32_t count = static_cast<uint32_t>(get(data, pos, 4));
+		for (uint32_t i = 0; i < count; ++i) {
+			const auto high = static_cast<uint16_t>(get(data, pos, 2));
+			const size_t len = get(data, pos, 4);
+			if (data.size() - pos < len) throw std::runtime_error("roaring_serializer: truncated container");
+			bitmap.set_container(high, roaring_bitmap::decode_container(data.data() + pos, len));
+			pos += len;
+		}
+		return bitmap;
+	}
+
+private:
+	static void put(std::string &data, uint32_t value, int bytes) {
+		for (int i = 0; i < bytes; ++i) {
+			data.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+		}
+	}
+
+	static size_t get(const std::string &data, size_t &pos, int bytes) {
+		if (data.size() - pos < static_cast<size_t>(bytes)) {
+			throw std::runtime_error("roaring_serializer: truncated data");
+		}
+		size_t value = 0;
+		for (int i = 0; i < bytes; ++i) {
+			value |= static_cast<size_t>(static_cast<uint8_t>(data[pos++])) << (8 * i);
+		}
+		return value;
+	}
+};
@@ -0,0 +1,216 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+/**
+ * @brief A predicate over collection elements that is evaluated server-side.
+ * * A filter is an expression tree built with the small DSL below, e.g.
+ * `filter_value() > 100 && filter_field().starts_with("user:")`. It is compiled into a Lua boolean expression over the
+ * current element: `f` is the hash field (or the member itself for lists and sets) and `v` is the hash value (or the
+ * member). All comparisons apply to the serialized representation. Constants are not inlined into the script but
+ * passed as script arguments, so filters of the same shape share a single cached script.
+ */
+class filter_expr {
+public:
+	enum class target { field, value };
+
+	enum class op { eq, ne, num_eq, num_ne, lt, le, gt, ge, starts_with, contains, logical_and, logical_or, logical_not };
+
+	/**
+	 * @brief Compiles the filter into a Lua expression.
+	 * @param constants Receives the constants referenced by the expression; constant i (1-based) is addressed as
+	 * `a[i]` (string) and `n[i]` (number) in the generated code.
+	 * @return The Lua boolean expression.
+	 */
+	[[nodiscard]] std::string compile(std::vector<std::string> &constants) const {
+		return compile(*root, constants);
+	}
+
+	static filter_expr comparison(op kind, target subject, std::string operand) {
+		auto n = std::make_shared<node>();
+		n->kind = kind;
+		n->subject = subject;
+		n->operand = std::move(operand);
+		return filter_expr(std::move(n));
+	}
+
+	static filter_expr combine(op kind, const filter_expr &lhs, const filter_expr &rhs) {
+		auto n = std::make_shared<node>();
+		n->kind = kind;
+		n->lhs = lhs.root;
+		n->rhs = rhs.root;
+		return filter_expr(std::move(n));
+	}
+
+	static filter_expr negate(const filter_expr &expr) {
+		auto n = std::make_shared<node>();
+		n->kind = op::logical_not;
+		n->lhs = expr.root;
+		return filter_expr(std::move(n));
+	}
+
+private:
+	struct node {
+		op kind{op::eq};
+		target subject{target::value};
+		std::string operand;
+		std::shared_ptr<const node> lhs;
+		std::shared_ptr<const node> rhs;
+	};
+
+	explicit filter_expr(std::shared_ptr<const node> root) : root(std::move(root)) {
+	}
+
+	static std::string compile(const node &n, std::vector<std::string> &constants) {
+		switch (n.kind) {
+			case op::logical_and:
+				return "(" + compile(*n.lhs, constants) + " and " + compile(*n.rhs, constants) + ")";
+			case op::logical_or:
+				return "(" + compile(*n.lhs, constants) + " or " + compile(*n.rhs, constants) + ")";
+			case op::logical_not:
+				return "(not " + compile(*n.lhs, constants) + ")";
+			default:
+				break;
+		}
+
+		constants.push_back(n.operand);
+		const std::string idx = std::to_string(constants.size());
+		const std::string var = n.subject == target::field ? "f" : "v";
+		const std::string str = "a[" + idx + "]";
+		const std::string num = "n[" + idx + "]";
+
+		switch (n.kind) {
+			case op::eq:
+				return "(" + var + " == " + str + ")";
+			case op::ne:
+				return "(" + var + " ~= " + str + ")";
+			case op::num_eq:
+				return "(num(" + var + ") == " + num + ")";
+			case op::num_ne:
+				return "(num(" + var + ") ~= " + num + ")";
+			case op::lt:
+				return "(num(" + var + ") < " + num + ")";
+			case op::le:
+				return "(num(" + var + ") <= " + num + ")";
+			case op::gt:
+				return "(num(" + var + ") > " + num + ")";
+			case op::ge:
+				return "(num(" + var + ") >= " + num + ")";
+			case op::starts_with:
+				return "(string.sub(" + var + ", 1, #" + str + ") == " + str + ")";
+			case op::contains:
+				return "(string.find(" + var + ", " + str + ", 1, true) ~= nil)";
+			default:
+				throw std::logic_error("filter_expr: unknown operator");
+		}
+	}
+
+	std::shared_ptr<const node> root;
+};
+
+/**
+ * @brief The left-hand side of a filter comparison: either the field or the value of the current element.
+ */
+class filter_operand {
+public:
+	explicit filter_operand(filter_expr::target subject) : subject(subject) {
+	}
+
+	[[nodiscard]] filter_expr starts_with(const std::string &prefix) const {
+		return filter_expr::comparison(filter_expr::op::starts_with, subject, prefix);
+	}
+
+	[[nodiscard]] filter_expr contains(const std::string &needle) const {
+		return filter_expr::comparison(filter_expr::op::contains, subject, needle);
+	}
+
+	[[nodiscard]] filter_expr compare(filter_expr::op kind, const std::string &operand) const {
+		return filter_expr::comparison(kind, subject, operand);
+	}
+
+	template<typename N>
+	[[nodiscard]] filter_expr compare(filter_expr::op kind, N number) const {
+		char buf[32];
+		std::snprintf(buf, sizeof(buf), "%.17g", static_cast<double>(number));
+		return filter_expr::comparison(kind, subject, buf);
+	}
+
+private:
+	filter_expr::target subject;
+};
+
+/* The hash field of the current element (for lists and sets: the member itself) */
+inline filter_operand filter_field() {
+	return filter_operand(filter_expr::target::field);
+}
+
+/* The value of the current element */
+inline filter_operand filter_value() {
+	return filter_operand(filter_expr::target::value);
+}
+
+template<typename T>
+using enable_if_number_t = std::enable_if_t<std::is_arithmetic_v<T>, filter_expr>;
+
+inline filter_expr operator==(const filter_operand &lhs, const std::string &rhs) {
+	return lhs.compare(filter_expr::op::eq, rhs);
+}
+
+inline filter_expr operator!=(const filter_operand &lhs, const std::string &rhs) {
+	return lhs.compare(filter_expr::op::ne, rhs);
+}
+
+inline filter_expr operator==(const filter_operand &lhs, const char *rhs) {
+	return lhs.compare(filter_expr::op::eq, std::string(rhs));
+}
+
+inline filter_expr operator!=(const filter_operand &lhs, const char *rhs) {
+	return lhs.compare(filter_expr::op::ne, std::string(rhs));
+}
+
+template<typename N>
+enable_if_number_t<N> operator==(const filter_operand &lhs, N rhs) {
+	return lhs.compare(filter_expr::op::num_eq, rhs);
+}
+
+template<typename N>
+enable_if_number_t<N> operator!=(const filter_operand &lhs, N rhs) {
+	return lhs.compare(filter_expr::op::num_ne, rhs);
+}
+
+template<typename N>
+enable_if_number_t<N> operator<(const filter_operand &lhs, N rhs) {
+	return lhs.compare(filter_expr::op::lt, rhs);
+}
+
+template<typename N>
+enable_if_number_t<N> operator<=(const filter_operand &lhs, N rhs) {
+	return lhs.compare(filter_expr::op::le, rhs);
+}
+
+template<typename N>
+enable_if_number_t<N> operator>(const filter_operand &lhs, N rhs) {
+	return lhs.compare(filter_expr::op::gt, rhs);
+}
+
+template<typename N>
+enable_if_number_t<N> operator>=(const filter_operand &lhs, N rhs) {
+	return lhs.compare(filter_expr::op::ge, rhs);
+}
+
+inline filter_expr operator&&(const filter_expr &lhs, const filter_expr &rhs) {
+	return filter_expr::combine(filter_expr::op::logical_and, lhs, rhs);
+}
+
+inline filter_expr operator||(const filter_expr &lhs, const filter_expr &rhs) {
+	return filter_expr::combine(filter_expr::op::logical_or, lhs, rhs);
+}
+
+inline filter_expr operator!(const filter_expr &expr) {
+	return filter_expr::negate(expr);
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "kv_connection.hpp"
+
+/**
+ * @brief A Lua script that is executed through the server script cache.
+ * * The script is loaded once (SCRIPT LOAD) and afterwards invoked by its SHA1 digest (EVALSHA), so only the digest
+ * travels over the wire. If the server lost its script cache (restart, SCRIPT FLUSH, failover), the script is loaded
+ * again transparently and the call is retried once.
+ */
+class lua_script {
+public:
+	explicit lua_script(std::string source) : source(std::move(source)) {
+	}
+
+	/**
+	 * @brief Executes the script on the given connection.
+	 * @param conn The connection to execute the script on.
+	 * @param keys The key names accessed by the script (KEYS[]).
+	 * @param args The additional arguments (ARGV[]).
+	 * @return The script reply.
+	 * @throw std::runtime_error if the script fails.
+	 */
+	kv_reply execute(kv_connection &conn, const std::vector<std::string> &keys,
+					 const std::vector<std::string> &args) const {
+		if (sha1.empty()) {
+			sha1 = conn.script_load(source);
+		}
+		try {
+			return conn.evalsha(sha1, keys, args);
+		}
+		catch (const std::runtime_error &e) {
+			if (std::string(e.what()).find("NOSCRIPT") == std::string::npos) {
+				throw;
+			}
+		}
+		sha1 = conn.script_load(source);
+		return conn.evalsha(sha1, keys, args);
+	}
+
+	[[nodiscard]] const std::string &get_source() const {
+		return source;
+	}
+
+private:
+	std::string source;
+	mutable std::string sha1;
+};
@@ -0,0 +1,774 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "command_table.hpp"
+#include "forwarding_connection.hpp"
+#include "hash.hpp"
+
+/**
+ * @brief Geometry of a shm_cache segment. Every process attaching to a named segment must use the same values.
+ */
+struct shm_cache_options {
+	/* Bytes of each arena; every block size gets an arena of its own, so one size class cannot starve the others */
+	size_t arena_bytes{16 * 1024 * 1024};
+	/* Block sizes of the arenas, ascending multiples of 8. An entry takes the smallest block that holds its 40 byte
+	 * header, its key (padded to 8 bytes) and its value; larger entries are not cached */
+	std::vector<uint32_t> block_sizes{128, 512, 2048, 8192, 65536};
+};
+
+/**
+ * @brief Counters of the calling process, see shm_cache::stats().
+ */
+struct shm_cache_stats {
+	uint64_t hits{0};
+	uint64_t misses{0};
+	uint64_t sets{0};
+	/* Entries not cached: too large, or no block or index slot could be claimed */
+	uint64_t rejected{0};
+	uint64_t evictions{0};
+};
+
+/**
+ * @brief A string cache in shared memory, so the worker processes of a host share one copy of their hot keys.
+ * * The segment is either named (shm_open: any process opening the same name attaches to it) or anonymous (memfd:
+ * inherited by the processes forked after it was created). It holds:
+ * - An open-addressing index of 64 bit words, each holding 32 bits of the key hash and a block number. It is updated
+ *   with compare-and-swap only; removed entries leave tombstones that later inserts reuse, and probing is bounded.
+ * - Arenas of fixed-size blocks, one per size class, each with a fixed byte budget. A block holds one entry and is
+ *   protected by a seqlock: a writer claims it by making its sequence odd with a compare-and-swap and releases it
+ *   with the next even value; readers copy the entry and retry if the sequence moved, so they never block writers.
+ * - A CLOCK hand per arena: an entry read since the hand last passed has its reference bit cleared and survives; the
+ *   first unreferenced block is reused for the new entry, evicting the previous one.
+ * - Invalidation epochs, one per stripe of the key space, which let a reader that fetched a value from Redis detect
+ *   a concurrent invalidation before its stale value lands in the cache (see fill()).
+ *
+ * All shared state is accessed with atomic operations, so processes and threads may use the cache concurrently
+ * without locks. Expiry uses wall-clock milliseconds, which all processes of a host agree on.
+ * @note A process killed while writing a block leaves that block claimed; it is never reused, which only costs
+ * capacity.
+ */
+class shm_cache {
+public:
+	/**
+	 * @brief Creates an anonymous segment, shared with the processes forked after this call.
+	 * @throw std::runtime_error if the segment cannot be created.
+	 */
+	explicit shm_cache(const shm_cache_options &options = {}) {
+		const segment_header h = layout(options);
+		fd = ::memfd_create("janus-shm-cache", MFD_CLOEXEC);
+		if (fd < 0) throw std::runtime_error("shm_cache: memfd_create failed: " + std::string(std::strerror(errno)));
+		try {
+			create(h);
+		}
+		catch (...) {
+			release();
+			throw;
+		}
+	}
+
+	/**
+	 * @brief Attaches to the named segment, creating it if it does not exist yet.
+	 * @param name The POSIX shared memory name, e.g. "/myservice-cache".
+	 * @throw std::invalid_argument if the options are invalid.
+	 * @throw std::runtime_error if the segment cannot be created, or exists with a different geometry.
+	 */
+	shm_cache(const std::string &name, const shm_cache_options &options = {}) {
+		// Validated before anything is created, so invalid options leave no segment behind
+		const segment_header h = layout(options);
+		fd = ::shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+		if (fd >= 0) {
+			try {
+				create(h);
+			}
+			catch (...) {
+				// An uninitialized segment would make later attachers wait for it in vain
+				release();
+				::shm_unlink(name.c_str());
+				throw;
+			}
+			return;
+		}
+		if (errno != EEXIST) {
+			throw std::runtime_error("shm_cache: cannot create " + name + ": " + std::strerror(errno));
+		}
+		fd = ::shm_open(name.c_str(), O_RDWR | O_CLOEXEC, 0);
+		if (fd < 0) throw std::runtime_error("shm_cache: cannot open " + name + ": " + std::strerror(errno));
+		try {
+			attach(h);
+		}
+		catch (...) {
+			release();
+			throw;
+		}
+	}
+
+	~shm_cache() {
+		release();
+	}
+
+	shm_cache(const shm_cache &) = delete;
+	shm_cache &operator=(const shm_cache &) = delete;
+
+	/**
+	 * @brief Removes a named segment; processes attached to it keep their mapping.
+	 */
+	static void unlink(const std::string &name) {
+		::shm_unlink(name.c_str());
+	}
+
+	/**
+	 * @brief Returns the cached value of a key, or std::nullopt if it is not cached or has expired.
+	 */
+	std::optional<std::string> get(const std::string &key) {
+		const uint64_t hash = hash_of(key);
+		const int64_t now = now_ms();
+		std::string value;
+		for (uint64_t i = 0; i < max_probe; ++i) {
+			const uint64_t entry = __atomic_load_n(&buckets[(hash + i) & bucket_mask], __ATOMIC_ACQUIRE);
+			if (entry == empty_bucket) break;
+			if (entry == tombstone || (entry >> 32) != (hash >> 32)) continue;
+			block_header *b = block(slot_of(entry));
+			if (read_block(b, hash, key, &value, now)) {
+				if (!__atomic_load_n(&b->referenced, __ATOMIC_RELAXED)) {
+					__atomic_store_n(&b->referenced, 1, __ATOMIC_RELAXED);
+				}
+				++counters.hits;
+				return value;
+			}
+		}
+		++counters.misses;
+		return std::nullopt;
+	}
+
+	/**
+	 * @brief Caches a value, replacing any previous value of the key.
+	 * @param ttl The time to live; zero keeps the entry until it is evicted.
+	 * @return False if the entry was not cached (see shm_cache_stats::rejected).
+	 */
+	bool set(const std::string &key, const std::string &value,
+			 std::chrono::milliseconds ttl = std::chrono::milliseconds(0)) {
+		const uint64_t hash = hash_of(key);
+		remove(hash, key);
+		return insert(hash, key, value, ttl.count() > 0 ? now_ms() + ttl.count() : 0);
+	}
+
+	/**
+	 * @brief Returns the invalidation epoch of a key, to be passed to fill().
+	 */
+	[[nodiscard]] uint64_t epoch(const std::string &key) const {
+		return __atomic_load_n(stripe(hash_of(key)), __ATOMIC_ACQUIRE);
+	}
+
+	/**
+	 * @brief Caches a value read from the source of truth, unless the key was invalidated since epoch was taken.
+	 * * Take the epoch before reading the source: an erase() after the read either bumps the epoch before the check
+	 * here, or removes the entry after it was inserted.
+	 * @return True if the value is cached.
+	 */
+	bool fill(const std::string &key, const std::string &value, std::chrono::milliseconds ttl, uint64_t epoch) {
+		const uint64_t hash = hash_of(key);
+		if (__atomic_load_n(stripe(hash), __ATOMIC_ACQUIRE) != epoch) return false;
+		remove(hash, key);
+		if (!insert(hash, key, value, ttl.count() > 0 ? now_ms() + ttl.count() : 0)) return false;
+		if (__atomic_load_n(stripe(hash), __ATOMIC_ACQUIRE) == epoch) return true;
+		remove(hash, key);
+		return false;
+	}
+
+	/**
+	 * @brief Removes a key from the cache and invalidates concurrent fills of it.
+	 * @return True if an entry was removed.
+	 */
+	bool erase(const std::string &key) noexcept {
+		const uint64_t hash = hash_of(key);
+		__atomic_fetch_add(stripe(hash), 1, __ATOMIC_ACQ_REL);
+		return remove(hash, key);
+	}
+
+	/**
+	 * @brief Removes every entry and invalidates concurrent fills of any key, as after FLUSHALL on the source of truth.
+	 */
+	void clear() noexcept {
+		auto *stripes = reinterpret_cast<uint64_t *>(base + header_size);
+		for (uint64_t i = 0; i < stripe_count; ++i) {
+			__atomic_fetch_add(stripes + i, 1, __ATOMIC_ACQ_REL);
+		}
+		// Tombstones rather than empty buckets, so concurrent probes still reach the entries inserted past them
+		for (uint64_t i = 0; i <= bucket_mask; ++i) {
+			uint64_t entry = __atomic_load_n(&buckets[i], __ATOMIC_ACQUIRE);
+			if (entry == empty_bucket || entry == tombstone) continue;
+			__atomic_compare_exchange_n(&buckets[i], &entry, tombstone, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+		}
+	}
+
+	[[nodiscard]] shm_cache_stats stats() const {
+		shm_cache_stats s;
+		s.hits = counters.hits.load(std::memory_order_relaxed);
+		s.misses = counters.misses.load(std::memory_order_relaxed);
+		s.sets = counters.sets.load(std::memory_order_relaxed);
+		s.rejected = counters.rejected.load(std::memory_order_relaxed);
+		s.evictions = counters.evictions.load(std::memory_order_relaxed);
+		return s;
+	}
+
+private:
+	static constexpr char magic[8] = {'J', 'A', 'N', 'U', 'S', 'S', 'H', 'M'};
+	static constexpr size_t header_size = 4096;
+	static constexpr size_t max_arenas = 16;
+	static constexpr uint64_t stripe_count = 4096;
+	static constexpr uint64_t max_probe = 32;
+	static constexpr uint64_t empty_bucket = 0;
+	static constexpr uint64_t tombstone = 1;
+
+	struct arena_header {
+		uint32_t block_size;
+		uint32_t blocks;
+		uint64_t offset;
+		/* Number of the arena's first block; blocks are numbered across arenas */
+		uint64_t first_slot;
+		/* The CLOCK hand, advanced with fetch_add */
+		uint64_t hand;
+	};
+
+	struct segment_header {
+		char magic[8];
+		/* Set last by the creating process */
+		uint32_t ready;
+		uint32_t arena_count;
+		uint64_t total_size;
+		uint64_t bucket_count;
+		uint64_t index_offset;
+		uint64_t stripes_offset;
+		arena_header arenas[max_arenas];
+	};
+
+	/* Precedes the entry's key (padded to 8 bytes) and value in every block */
+	struct block_header {
+		uint32_t seq;
+		uint32_t referenced;
+		uint32_t used;
+		uint32_t key_length;
+		uint64_t hash;
+		int64_t expire_at;
+		uint32_t value_length;
+		uint32_t reserved;
+	};
+	static_assert(sizeof(block_header) == 40, "block data must start 8 byte aligned");
+	static_assert(sizeof(segment_header) <= header_size, "segment header too large");
+
+	/* Computes the layout of a segment for the given options */
+	static segment_header layout(const shm_cache_options &options) {
+		if (options.block_sizes.empty() || options.block_sizes.size() > max_arenas) {
+			throw std::invalid_argument("shm_cache: between 1 and 16 block sizes are required");
+		}
+		segment_header h{};
+		std::memcpy(h.magic, magic, sizeof(magic));
+		h.arena_count = static_cast<uint32_t>(options.block_sizes.size());
+		h.stripes_offset = header_size;
+		h.index_offset = h.stripes_offset + stripe_count * sizeof(uint64_t);
+
+		uint64_t total_blocks = 0;
+		uint32_t previous = 0;
+		for (size_t i = 0; i < options.block_sizes.size(); ++i) {
+			const uint32_t block_size = options.block_sizes[i];
+			if (block_size % 8 != 0 || block_size <= sizeof(block_header) || block_size <= previous) {
+				throw std::invalid_argument("shm_cache: block sizes must be ascending multiples of 8 above 40");
+			}
+			previous = block_size;
+			h.arenas[i].block_size = block_size;
+			h.arenas[i].blocks = static_cast<uint32_t>(std::max<size_t>(1, options.arena_bytes / block_size));
+			h.arenas[i].first_slot = total_blocks;
+			total_blocks += h.arenas[i].blocks;
+		}
+		// At most half full, so probe sequences stay short
+		h.bucket_count = 64;
+		while (h.bucket_count < 2 * total_blocks) {
+			h.bucket_count <<= 1;
+		}
+
+		uint64_t offset = h.index_offset + h.bucket_count * sizeof(uint64_t);
+		for (size_t i = 0; i < h.arena_count; ++i) {
+			offset = (offset + 63) & ~uint64_t(63);
+			h.arenas[i].offset = offset;
+			offset += uint64_t(h.arenas[i].blocks) * h.arenas[i].block_size;
+		}
+		h.total_size = offset;
+		return h;
+	}
+
+	/* The constructors release the segment when these throw */
+	void create(const segment_header &h) {
+		if (::ftruncate(fd, static_cast<off_t>(h.total_size)) != 0) {
+			throw std::runtime_error("shm_cache: cannot size segment: " + std::string(std::strerror(errno)));
+		}
+		map(h.total_size);
+		// The segment is zero-filled: every bucket is empty and every block unused
+		segment_header *shared = header();
+		*shared = h;
+		shared->ready = 0;
+		bind();
+		__atomic_store_n(&shared->ready, 1, __ATOMIC_RELEASE);
+	}
+
+	void attach(const segment_header &expected) {
+		// The creator may still be sizing and initializing the segment
+		const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+		for (;;) {
+			struct stat st {};
+			if (::fstat(fd, &st) == 0 && static_cast<uint64_t>(st.st_size) >= expected.total_size) {
+				if (!base) map(expected.total_size);
+				if (__atomic_load_n(&header()->ready, __ATOMIC_ACQUIRE)) break;
+			}
+			if (std::chrono::steady_clock::now() > deadline) {
+				throw std::runtime_error("shm_cache: segment was not initialized in time");
+			}
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+		}
+		const segment_header *h = header();
+		bool same = std::memcmp(h->magic, magic, sizeof(magic)) == 0 && h->total_size == expected.total_size
+			&& h->arena_count == expected.arena_count;
+		for (size_t i = 0; same && i < h->arena_count; ++i) {
+			same = h->arenas[i].block_size == expected.arenas[i].block_size
+				&& h->arenas[i].blocks == expected.arenas[i].blocks;
+		}
+		if (!same) throw std::runtime_error("shm_cache: the segment exists with a different geometry");
+		bind();
+	}
+
+	void map(uint64_t total_size) {
+		void *p = ::mmap(nullptr, total_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (p == MAP_FAILED) throw std::runtime_error("shm_cache: mmap failed: " + std::string(std::strerror(errno)));
+		base = static_cast<unsigned char *>(p);
+		size = total_size;
+	}
+
+	void release() {
+		if (base) ::munmap(base, size);
+		if (fd >= 0) ::close(fd);
+		base = nullptr;
+		fd = -1;
+	}
+
+	/* Caches the index location once the header is valid */
+	void bind() {
+		buckets = reinterpret_cast<uint64_t *>(base + header()->index_offset);
+		bucket_mask = header()->bucket_count - 1;
+	}
+
+	segment_header *header() const {
+		return reinterpret_cast<segment_header *>(base);
+	}
+
+	uint64_t *stripe(uint64_t hash) const {
+		return reinterpret_cast<uint64_t *>(base + header_size) + ((hash >> 16) & (stripe_count - 1));
+	}
+
+	static uint64_t hash_of(const std::string &key) {
+		return murmurhash64a(key, 0x73686d6361636865ULL);
+	}
+
+	static uint64_t slot_of(uint64_t entry) {
+		return (entry & 0xffffffffULL) - 2;
+	}
+
+	static uint64_t make_entry(uint64_t hash, uint64_t slot) {
+		return (hash & 0xffffffff00000000ULL) | (slot + 2);
+	}
+
+	static int64_t now_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	}
+
+	static uint64_t padded(uint64_t n) {
+		return (n + 7) & ~uint64_t(7);
+	}
+
+	block_header *block(uint64_t slot) const {
+		const segment_header *h = header();
+		for (uint32_t i = 0; i + 1 < h->arena_count; ++i) {
+			if (slot < h->arenas[i + 1].first_slot) {
+				return reinterpret_cast<block_header *>(base + h->arenas[i].offset
+														+ (slot - h->arenas[i].first_slot) * h->arenas[i].block_size);
+			}
+		}
+		const arena_header &last = h->arenas[h->arena_count - 1];
+		return reinterpret_cast<block_header *>(base + last.offset + (slot - last.first_slot) * last.block_size);
+	}
+
+	static unsigned char *data(block_header *b) {
+		return reinterpret_cast<unsigned char *>(b) + sizeof(block_header);
+	}
+
+	/* Block contents are read and written one 8 byte word at a time with relaxed atomics, as the seqlock requires */
+	static void copy_out(std::string &out, const unsigned char *src, size_t n) {
+		out.resize(n);
+		const auto *words = reinterpret_cast<const uint64_t *>(src);
+		for (size_t i = 0; i < n; i += 8) {
+			const uint64_t w = __atomic_load_n(words + i / 8, __ATOMIC_RELAXED);
+			std::memcpy(&out[i], &w, std::min<size_t>(8, n - i));
+		}
+	}
+
+	static void copy_in(unsigned char *dst, const std::string &in) {
+		auto *words = reinterpret_cast<uint64_t *>(dst);
+		for (size_t i = 0; i < in.size(); i += 8) {
+			uint64_t w = 0;
+			std::memcpy(&w, in.data() + i, std::min<size_t>(8, in.size() - i));
+			__atomic_store_n(words + i / 8, w, __ATOMIC_RELAXED);
+		}
+	}
+
+	/**
+	 * @brief Reads a block with the seqlock protocol.
+	 * @param value Receives the value if the block holds the key; may be nullptr.
+	 * @param now The current time, or 0 to accept expired entries.
+	 * @return True if the block holds the key. A block being written counts as a miss rather than being waited for.
+	 */
+	bool read_block(block_header *b, uint64_t hash, const std::string &key, std::string *value, int64_t now) const {
+		const uint64_t capacity = block_capacity(b);
+		std::string stored_key;
+		for (int attempt = 0; attempt < 4; ++attempt) {
+			const uint32_t seq = __atomic_load_n(&b->seq, __ATOMIC_ACQUIRE);
+			if (seq & 1) return false;
+			const uint64_t key_length = __atomic_load_n(&b->key_length, __ATOMIC_RELAXED);
+			const uint64_t value_length = __atomic_load_n(&b->value_length, __ATOMIC_RELAXED);
+			const int64_t expire_at = __atomic_load_n(&b->expire_at, __ATOMIC_RELAXED);
+			bool matches = __atomic_load_n(&b->used, __ATOMIC_RELAXED)
+				&& __atomic_load_n(&b->hash, __ATOMIC_RELAXED) == hash && key_length == key.size()
+				&& (now == 0 || expire_at == 0 || expire_at > now)
+				&& padded(key_length) + value_length <= capacity;
+			if (matches) {
+				copy_out(stored_key, data(b), key_length);
+				matches = stored_key == key;
+				if (matches && value) copy_out(*value, data(b) + padded(key_length), value_length);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			if (__atomic_load_n(&b->seq, __ATOMIC_RELAXED) == seq) return matches;
+		}
+		return false;
+	}
+
+	uint64_t block_capacity(const block_header *b) const {
+		const segment_header *h = header();
+		const auto offset = static_cast<uint64_t>(reinterpret_cast<const unsigned char *>(b) - base);
+		uint32_t i = h->arena_count - 1;
+		while (i > 0 && offset < h->arenas[i].offset) {
+			--i;
+		}
+		return h->arenas[i].block_size - sizeof(block_header);
+	}
+
+	/* Removes every index entry of a key (concurrent inserts can leave two) */
+	bool remove(uint64_t hash, const std::string &key) noexcept {
+		bool removed = false;
+		for (uint64_t i = 0; i < max_probe; ++i) {
+			uint64_t *bucket = &buckets[(hash + i) & bucket_mask];
+			uint64_t entry = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+			if (entry == empty_bucket) break;
+			if (entry == tombstone || (entry >> 32) != (hash >> 32)) continue;
+			try {
+				if (!read_block(block(slot_of(entry)), hash, key, nullptr, 0)) continue;
+			}
+			catch (const std::bad_alloc &) {
+				continue;
+			}
+			removed |= __atomic_compare_exchange_n(bucket, &entry, tombstone, false, __ATOMIC_ACQ_REL,
+												   __ATOMIC_ACQUIRE);
+		}
+		return removed;
+	}
+
+	bool insert(uint64_t hash, const std::string &key, const std::string &value, int64_t expire_at) {
+		const uint64_t needed = padded(key.size()) + value.size();
+		const segment_header *h = header();
+		arena_header *arena = nullptr;
+		for (uint32_t i = 0; i < h->arena_count; ++i) {
+			if (needed <= h->arenas[i].block_size - sizeof(block_header)) {
+				arena = &header()->arenas[i];
+				break;
+			}
+		}
+		uint64_t slot = 0;
+		uint32_t seq = 0;
+		if (!arena || !claim(*arena, slot, seq)) {
+			++counters.rejected;
+			return false;
+		}
+
+		block_header *b = block(slot);
+		if (__atomic_load_n(&b->used, __ATOMIC_RELAXED)
+			&& unindex(__atomic_load_n(&b->hash, __ATOMIC_RELAXED), slot)) {
+			++counters.evictions;
+		}
+		__atomic_store_n(&b->hash, hash, __ATOMIC_RELAXED);
+		__atomic_store_n(&b->key_length, static_cast<uint32_t>(key.size()), __ATOMIC_RELAXED);
+		__atomic_store_n(&b->value_length, static_cast<uint32_t>(value.size()), __ATOMIC_RELAXED);
+		__atomic_store_n(&b->expire_at, expire_at, __ATOMIC_RELAXED);
+		copy_in(data(b), key);
+		copy_in(data(b) + padded(key.size()), value);
+		__atomic_store_n(&b->referenced, 1, __ATOMIC_RELAXED);
+
+		// Indexed while the block is still claimed: readers that find it early see an odd sequence and miss
+		const bool indexed = index(hash, slot);
+		__atomic_store_n(&b->used, indexed ? 1 : 0, __ATOMIC_RELAXED);
+		__atomic_store_n(&b->seq, seq + 2, __ATOMIC_RELEASE);
+		if (!indexed) {
+			++counters.rejected;
+			return false;
+		}
+		++counters.sets;
+		return true;
+	}
+
+	/* Claims a block with the CLOCK hand; on success seq holds the block's (even) sequence before the claim */
+	bool claim(arena_header &arena, uint64_t &slot, uint32_t &seq) const {
+		// Referenced blocks get a second chance; past a bounded sweep the next unclaimed block is taken regardless
+		const uint64_t sweep = std::min<uint64_t>(2ULL * arena.blocks, 1024);
+		for (uint64_t attempt = 0; attempt < sweep + 64; ++attempt) {
+			slot = arena.first_slot + __atomic_fetch_add(&arena.hand, 1, __ATOMIC_RELAXED) % arena.blocks;
+			auto *b = reinterpret_cast<block_header *>(base + arena.offset
+													   + (slot - arena.first_slot) * arena.block_size);
+			if (attempt < sweep && __atomic_load_n(&b->referenced, __ATOMIC_RELAXED)) {
+				__atomic_store_n(&b->referenced, 0, __ATOMIC_RELAXED);
+				continue;
+			}
+			seq = __atomic_load_n(&b->seq, __ATOMIC_RELAXED);
+			if ((seq & 1) == 0
+				&& __atomic_compare_exchange_n(&b->seq, &seq, seq + 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+				return true;
+			}
+		}
+		return false;
+	}
+
+	bool index(uint64_t hash, uint64_t slot) {
+		const uint64_t entry = make_entry(hash, slot);
+		for (uint64_t i = 0; i < max_probe; ++i) {
+			uint64_t *bucket = &buckets[(hash + i) & bucket_mask];
+			uint64_t current = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+			while (current == empty_bucket || current == tombstone) {
+				if (__atomic_compare_exchange_n(bucket, &current, entry, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE)) {
+					return true;
+				}
+			}
+		}
+		return false;
+	}
+
+	bool unindex(uint64_t hash, uint64_t slot) {
+		uint64_t entry = make_entry(hash, slot);
+		for (uint64_t i = 0; i < max_probe; ++i) {
+			uint64_t *bucket = &buckets[(hash + i) & bucket_mask];
+			const uint64_t current = __atomic_load_n(bucket, __ATOMIC_ACQUIRE);
+			if (current == empty_bucket) return false;
+			if (current == entry) {
+				return __atomic_compare_exchange_n(bucket, &entry, tombstone, false, __ATOMIC_ACQ_REL,
+												   __ATOMIC_ACQUIRE);
+			}
+		}
+		return false;
+	}
+
+	int fd{-1};
+	unsigned char *base{nullptr};
+	uint64_t size{0};
+	uint64_t *buckets{nullptr};
+	uint64_t bucket_mask{0};
+	struct {
+		std::atomic<uint64_t> hits{0};
+		std::atomic<uint64_t> misses{0};
+		std::atomic<uint64_t> sets{0};
+		std::atomic<uint64_t> rejected{0};
+		std::atomic<uint64_t> evictions{0};
+	} counters;
+};
+
+/**
+ * @brief A connection that answers GET from a shm_cache before going to the network.
+ * * A miss reads the value and its TTL from the target in one round trip and caches it for at most max_ttl (and
+ * never beyond the key's own expiry). Every write issued through this connection removes the keys it touches from
+ * the cache after the target has applied it, in all processes sharing the segment; writes from other hosts become
+ * visible within max_ttl.
+ *
+ * Only string values are cached. The connection is as thread-safe as its target.
+ */
+class shm_cached_connection: public forwarding_connection {
+public:
+	/**
+	 * @param target The connection to Redis.
+	 * @param cache The cache, usually shared by all workers of the host.
+	 * @param max_ttl How long a cached value may be served without consulting the target.
+	 */
+	shm_cached_connection(std::shared_ptr<kv_connection> target, std::shared_ptr<shm_cache> cache,
+						  std::chrono::milliseconds max_ttl = std::chrono::seconds(60))
+		: forwarding_connection(std::move(target)), cache(std::move(cache)), max_ttl(max_ttl) {
+		if (!this->cache) throw std::invalid_argument("shm_cached_connection: cache is null");
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		if (auto cached = cache->get(key)) return cached;
+		// Taken before the read: a write that lands after it is not hidden by the value read here
+		const uint64_t epoch = cache->epoch(key);
+		auto replies = target->pipeline({{"GET", key}, {"PTTL", key}});
+		if (replies[0].is_error()) throw std::runtime_error("Redis error: " + replies[0].str);
+		if (replies[0].type != kv_reply::reply_type::string) return std::nullopt;
+		std::chrono::milliseconds ttl = max_ttl;
+		if (replies[1].type == kv_reply::reply_type::integer && replies[1].integer > 0) {
+			ttl = std::min(ttl, std::chrono::milliseconds(replies[1].integer));
+		}
+		cache->fill(key, replies[0].str, ttl, epoch);
+		return replies[0].str;
+	}
+
+	bool expire(const std::string &key, int seconds) override {
+		return invalidating(key, [&] { return target->expire(key, seconds); });
+	}
+
+	bool pexpire(const std::string &key, int milliseconds) override {
+		return invalidating(key, [&] { return target->pexpire(key, milliseconds); });
+	}
+
+	long long del(const std::string &key) override {
+		return invalidating(key, [&] { return target->del(key); });
+	}
+
+	long long del(const std::vector<std::string> &keys) override {
+		return invalidating(keys, [&] { return target->del(keys); });
+	}
+
+	bool set(const std::string &key, const std::string &value) override {
+		return invalidating(key, [&] { return target->set(key, value); });
+	}
+
+	bool set_not_exists(const std::string &key, const std::string &value) override {
+		return invalidating(key, [&] { return target->set_not_exists(key, value); });
+	}
+
+	bool set_ex(const std::string &key, const std::string &value, int seconds) override {
+		return invalidating(key, [&] { return target->set_ex(key, value, seconds); });
+	}
+
+	bool set_px(const std::string &key, const std::string &value, int milliseconds) override {
+		return invalidating(key, [&] { return target->set_px(key, value, milliseconds); });
+	}
+
+	std::optional<std::string> getset(const std::string &key, const std::string &new_value) override {
+		return invalidating(key, [&] { return target->getset(key, new_value); });
+	}
+
+	long long incr(const std::string &key, long long delta) override {
+		return invalidating(key, [&] { return target->incr(key, delta); });
+	}
+
+	long long decr(const std::string &key, long long delta) override {
+		return invalidating(key, [&] { return target->decr(key, delta); });
+	}
+
+	long long append(const std::string &key, const std::string &value) override {
+		return invalidating(key, [&] { return target->append(key, value); });
+	}
+
+	bool pfadd(const std::string &key, const std::vector<std::string> &elements) override {
+		return invalidating(key, [&] { return target->pfadd(key, elements); });
+	}
+
+	bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) override {
+		return invalidating(dest, [&] { return target->pfmerge(dest, sources); });
+	}
+
+	bool setbit(const std::string &key, long long offset, bool value) override {
+		return invalidating(key, [&] { return target->setbit(key, offset, value); });
+	}
+
+	long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) override {
+		return invalidating(dest, [&] { return target->bitop(op, dest, keys); });
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &key,
+												   const std::vector<std::string> &args) override {
+		return invalidating(key, [&] { return target->bitfield(key, args); });
+	}
+
+	kv_reply evalsha(const std::string &sha1, const std::vector<std::string> &keys,
+					 const std::vector<std::string> &args) override {
+		return invalidating(keys, [&] { return target->evalsha(sha1, keys, args); });
+	}
+
+	/**
+	 * @brief Forwards a pipeline and invalidates the keys of its write commands, or the whole cache if one of them is
+	 * FLUSHALL, FLUSHDB or SWAPDB.
+	 */
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		std::vector<std::string> keys;
+		bool every_key = false;
+		for (const auto &command: commands) {
+			if (command.empty() || is_read_command(command[0])) continue;
+			every_key = every_key || is_keyspace_command(command[0]);
+			for (auto &key: command_keys(command)) {
+				keys.push_back(std::move(key));
+			}
+		}
+		if (every_key) {
+			struct guard {
+				shm_cache &cache;
+				~guard() {
+					cache.clear();
+				}
+			} g{*cache};
+			return target->pipeline(commands);
+		}
+		return invalidating(keys, [&] { return target->pipeline(commands); });
+	}
+
+private:
+	/* Runs a write, then removes the keys from the cache, also when the write throws (it may have been applied) */
+	template<typename F>
+	std::invoke_result_t<F &> invalidating(const std::string &key, F &&op) {
+		struct guard {
+			shm_cache &cache;
+			const std::string &key;
+			~guard() {
+				cache.erase(key);
+			}
+		} g{*cache, key};
+		return op();
+	}
+
+	template<typename F>
+	std::invoke_result_t<F &> invalidating(const std::vector<std::string> &keys, F &&op) {
+		struct guard {
+			shm_cache &cache;
+			const std::vector<std::string> &keys;
+			~guard() {
+				for (const auto &key: keys) {
+					cache.erase(key);
+				}
+			}
+		} g{*cache, keys};
+		return op();
+	}
+
+	std::shared_ptr<shm_cache> cache;
+	std::chrono::milliseconds max_ttl;
+};
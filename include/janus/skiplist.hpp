@@ -0,0 +1,240 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+/**
+ * @brief A skiplist of (score, member) pairs with rank support, modelled on the Redis sorted set skiplist (zskiplist).
+ * * Entries are ordered by score, then by member bytes. Every forward link stores its span (the number of level-0
+ * steps it skips), so insert, erase, rank and access by rank are all O(log n) expected.
+ *
+ * The list does not check for duplicate members; callers keep a member -> score dictionary next to it, as Redis does.
+ */
+class order_statistic_skiplist {
+public:
+	static constexpr int max_level = 32;
+
+	struct node {
+		double score;
+		std::string member;
+
+		[[nodiscard]] const node *next() const {
+			return links[0].forward;
+		}
+
+	private:
+		friend class order_statistic_skiplist;
+
+		struct link {
+			node *forward{nullptr};
+			size_t span{0};
+		};
+
+		node(double score, std::string member, int level) : score(score), member(std::move(member)), links(level) {
+		}
+
+		std::vector<link> links;
+	};
+
+	order_statistic_skiplist() : head(new node(0, std::string(), max_level)) {
+	}
+
+	~order_statistic_skiplist() {
+		clear();
+		delete head;
+	}
+
+	order_statistic_skiplist(const order_statistic_skiplist &) = delete;
+	order_statistic_skiplist &operator=(const order_statistic_skiplist &) = delete;
+
+	order_statistic_skiplist(order_statistic_skiplist &&other) noexcept :
+		head(other.head), level(other.level), length(other.length), rng(other.rng) {
+		other.head = new node(0, std::string(), max_level);
+		other.level = 1;
+		other.length = 0;
+	}
+
+	order_statistic_skiplist &operator=(order_statistic_skiplist &&other) noexcept {
+		if (this != &other) {
+			std::swap(head, other.head);
+			std::swap(level, other.level);
+			std::swap(length, other.length);
+			other.clear();
+		}
+		return *this;
+	}
+
+	/**
+	 * @brief Inserts an entry; the member must not already be in the list.
+	 */
+	void insert(double score, const std::string &member) {
+		node *update[max_level];
+		size_t rank[max_level];
+		node *x = head;
+		for (int i = level - 1; i >= 0; --i) {
+			rank[i] = i == level - 1 ? 0 : rank[i + 1];
+			while (x->links[i].forward && less(x->links[i].forward, score, member)) {
+				rank[i] += x->links[i].span;
+				x = x->links[i].forward;
+			}
+			update[i] = x;
+		}
+
+		const int new_level = random_level();
+		if (new_level > level) {
+			for (int i = level; i < new_level; ++i) {
+				rank[i] = 0;
+				update[i] = head;
+				update[i]->links[i].span = length;
+			}
+			level = new_level;
+		}
+
+		x = new node(score, member, new_level);
+		for (int i = 0; i < new_level; ++i) {
+			x->links[i].forward = update[i]->links[i].forward;
+			update[i]->links[i].forward = x;
+			x->links[i].span = update[i]->links[i].span - (rank[0] - rank[i]);
+			update[i]->links[i].span = (rank[0] - rank[i]) + 1;
+		}
+		for (int i = new_level; i < level; ++i) {
+			++update[i]->links[i].span;
+		}
+		++length;
+	}
+
+	/**
+	 * @brief Removes an entry.
+	 * @return True if the entry was found.
+	 */
+	bool erase(double score, const std::string &member) {
+		node *update[max_level];
+		node *x = head;
+		for (int i = level - 1; i >= 0; --i) {
+			while (x->links[i].forward && less(x->links[i].forward, score, member)) {
+				x = x->links[i].forward;
+			}
+			update[i] = x;
+		}
+
+		x = x->links[0].forward;
+		if (!x || x->score != score || x->member != member) return false;
+		for (int i = 0; i < level; ++i) {
+			if (update[i]->links[i].forward == x) {
+				update[i]->links[i].span += x->links[i].span - 1;
+				update[i]->links[i].forward = x->links[i].forward;
+			}
+			else {
+				--update[i]->links[i].span;
+			}
+		}
+		while (level > 1 && head->links[level - 1].forward == nullptr) {
+			--level;
+		}
+		--length;
+		delete x;
+		return true;
+	}
+
+	/**
+	 * @brief Returns the 0-based rank of an entry, or -1 if it is not in the list.
+	 */
+	[[nodiscard]] long long rank(double score, const std::string &member) const {
+		size_t traversed = 0;
+		const node *x = head;
+		for (int i = level - 1; i >= 0; --i) {
+			while (x->links[i].forward && !less_than_node(score, member, x->links[i].forward)) {
+				traversed += x->links[i].span;
+				x = x->links[i].forward;
+			}
+			if (x != head && x->score == score && x->member == member) {
+				return static_cast<long long>(traversed) - 1;
+			}
+		}
+		return -1;
+	}
+
+	/**
+	 * @brief Returns the entry at a 0-based rank, or nullptr if the rank is out of range.
+	 */
+	[[nodiscard]] const node *at(size_t index) const {
+		if (index >= length) return nullptr;
+		const size_t target = index + 1;
+		size_t traversed = 0;
+		const node *x = head;
+		for (int i = level - 1; i >= 0; --i) {
+			while (x->links[i].forward && traversed + x->links[i].span <= target) {
+				traversed += x->links[i].span;
+				x = x->links[i].forward;
+			}
+			if (traversed == target) return x;
+		}
+		return nullptr;
+	}
+
+	/**
+	 * @brief Returns the first entry with a score of at least min, or nullptr.
+	 */
+	[[nodiscard]] const node *lower_bound(double min) const {
+		const node *x = head;
+		for (int i = level - 1; i >= 0; --i) {
+			while (x->links[i].forward && x->links[i].forward->score < min) {
+				x = x->links[i].forward;
+			}
+		}
+		return x->links[0].forward;
+	}
+
+	[[nodiscard]] const node *front() const {
+		return head->links[0].forward;
+	}
+
+	[[nodiscard]] size_t size() const {
+		return length;
+	}
+
+	[[nodiscard]] bool empty() const {
+		return length == 0;
+	}
+
+	void clear() {
+		node *x = head->links[0].forward;
+		while (x) {
+			node *next = x->links[0].forward;
+			delete x;
+			x = next;
+		}
+		for (auto &l: head->links) {
+			l = node::link();
+		}
+		level = 1;
+		length = 0;
+	}
+
+private:
+	/* Same ordering as Redis: by score, ties broken by member bytes */
+	static bool less(const node *x, double score, const std::string &member) {
+		return x->score < score || (x->score == score && x->member < member);
+	}
+
+	static bool less_than_node(double score, const std::string &member, const node *x) {
+		return score < x->score || (score == x->score && member < x->member);
+	}
+
+	/* Each level is kept with probability 1/4, as in Redis */
+	int random_level() {
+		int l = 1;
+		while (l < max_level && (rng() & 0xffff) < 0xffff / 4) {
+			++l;
+		}
+		return l;
+	}
+
+	node *head;
+	int level{1};
+	size_t length{0};
+	std::minstd_rand rng{0x5eed};
+};
@@ -0,0 +1,287 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+
+#include "metrics.hpp"
+
+/**
+ * @brief The stages of a call through redis_template and redis_connection, in order.
+ */
+enum class stage {
+	/* Keys and values to strings, by the template's serializers */
+	serialize,
+	/* The command to RESP, into the connection's output buffer */
+	encode,
+	/* The write syscalls */
+	write,
+	/* Blocked in the read syscalls for the reply */
+	wait,
+	/* RESP to a hiredis reply */
+	parse,
+	/* The hiredis reply to the connection's result (strings, maps, ...), until the reply is freed */
+	convert,
+	/* Strings back to keys and values, by the template's serializers */
+	deserialize
+};
+
+/**
+ * @brief A cheap clock for stage timing: the time-stamp counter on x86, nanoseconds of the steady clock elsewhere.
+ * Ticks are converted to nanoseconds only when profiles are read; the counter is assumed invariant, as on any x86
+ * processor of the last decade.
+ */
+class stage_clock {
+public:
+	static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+		return __rdtsc();
+#else
+		return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+										 std::chrono::steady_clock::now().time_since_epoch())
+										 .count());
+#endif
+	}
+};
+
+/**
+ * @brief Per-command, per-stage latency histograms (nanoseconds), by command name then stage name.
+ */
+struct stage_profile {
+	std::map<std::string, std::map<std::string, latency_histogram>> commands;
+};
+
+/**
+ * @brief Samples one call in N on each thread and times its stages, to show where the time of a call goes.
+ * * A call starts with its first serialization or command, and ends when the thread serializes for or sends the
+ * next command; its deserialization is attributed to the command before it. A sampled call is recorded when it ends,
+ * when flush() is called or when its thread exits. Only single commands of redis_connection are broken down;
+ * pipelines are not.
+ *
+ * Profiling is off until set_sample_rate() is called: the instrumentation then costs one relaxed load, and nothing
+ * with JANUS_DISABLE_METRICS. Unsampled calls cost a few thread-local reads and writes.
+ */
+class stage_profiler {
+public:
+	static constexpr size_t stage_count = 7;
+
+	static const char *stage_name(stage s) {
+		static const char *const names[stage_count] = {"serialize", "encode", "write", "wait",
+													   "parse", "convert", "deserialize"};
+		return names[static_cast<size_t>(s)];
+	}
+
+	/**
+	 * @brief Samples one call in every n of each thread; 0 turns profiling off.
+	 */
+	static void set_sample_rate(uint32_t every) {
+		calibration_origin();
+		rate().store(every, std::memory_order_relaxed);
+	}
+
+#ifdef JANUS_DISABLE_METRICS
+	static constexpr uint32_t sample_rate() {
+		return 0;
+	}
+#else
+	static uint32_t sample_rate() {
+		return rate().load(std::memory_order_relaxed);
+	}
+#endif
+
+	/**
+	 * @brief Ends the calling thread's current call, recording it if it is sampled.
+	 */
+	static void flush() {
+		if (sample_rate() != 0) local().close();
+	}
+
+	/**
+	 * @brief Merges the calls recorded by every thread, converted to nanoseconds.
+	 */
+	static stage_profile snapshot() {
+		stage_profile profile;
+		const double ns_per_tick = 1.0 / ticks_per_ns();
+		for (const auto &entry: registry().snapshot().commands) {
+			const size_t space = entry.first.rfind(' ');
+			if (space == std::string::npos) continue;
+			profile.commands[entry.first.substr(0, space)][entry.first.substr(space + 1)] =
+				entry.second.latency.scaled(ns_per_tick);
+		}
+		return profile;
+	}
+
+	// ============================================================================
+	// Instrumentation points
+	// ============================================================================
+
+	/**
+	 * @brief Enters a serialization stage. A serialization after a command starts a new call.
+	 * @return Whether the current call is sampled.
+	 */
+	static bool enter(stage s) {
+		if (sample_rate() == 0) return false;
+		trace &t = local();
+		if (s == stage::serialize && t.command_seen) t.close();
+		if (!t.open) t.start();
+		return t.sampled;
+	}
+
+	/**
+	 * @brief Starts a command. A command after a command starts a new call.
+	 * @return Whether the current call is sampled; the caller then names the command and times its stages.
+	 */
+	static bool begin_command() {
+		if (sample_rate() == 0) return false;
+		trace &t = local();
+		if (t.command_seen) t.close();
+		if (!t.open) t.start();
+		t.command_seen = true;
+		return t.sampled;
+	}
+
+	static void name_command(const char *name, size_t length) {
+		local().command.assign(name, length);
+	}
+
+	/* Adds the ticks since a time to a stage of the current call, and returns the current time */
+	static uint64_t lap(stage s, uint64_t since) {
+		const uint64_t now = stage_clock::now();
+		add(s, now - since);
+		return now;
+	}
+
+	static void add(stage s, uint64_t ticks) {
+		trace &t = local();
+		t.ticks[static_cast<size_t>(s)] += ticks;
+		t.visited |= 1u << static_cast<unsigned>(s);
+	}
+
+	/* Starts the convert stage of a sampled call, when its command returns the reply */
+	static void reply_returned() {
+		if (sample_rate() == 0) return;
+		trace &t = local();
+		if (t.sampled) t.returned_at = stage_clock::now();
+	}
+
+	/* Ends the convert stage, if started */
+	static void reply_released() {
+		if (sample_rate() == 0) return;
+		trace &t = local();
+		if (t.returned_at == 0) return;
+		add(stage::convert, stage_clock::now() - t.returned_at);
+		t.returned_at = 0;
+	}
+
+private:
+	struct trace {
+		bool open{false};
+		bool sampled{false};
+		bool command_seen{false};
+		uint32_t countdown{1};
+		uint32_t visited{0};
+		uint64_t returned_at{0};
+		std::string command;
+		std::array<uint64_t, stage_count> ticks{};
+		/* Registry ids of the command and stage pairs */
+		std::unordered_map<std::string, std::array<size_t, stage_count>> ids;
+
+		~trace() {
+			close();
+		}
+
+		void start() {
+			const uint32_t every = rate().load(std::memory_order_relaxed);
+			if (countdown > every) countdown = every;
+			sampled = --countdown == 0;
+			if (sampled) countdown = every;
+			open = true;
+		}
+
+		void close() {
+			if (open && sampled && !command.empty()) record();
+			open = sampled = command_seen = false;
+			visited = 0;
+			returned_at = 0;
+			command.clear();
+			ticks.fill(0);
+		}
+
+		void record() {
+			auto it = ids.find(command);
+			if (it == ids.end()) {
+				std::array<size_t, stage_count> stage_ids{};
+				for (size_t s = 0; s < stage_count; ++s) {
+					stage_ids[s] = metrics_registry::command_id(command + " " + stage_name(static_cast<stage>(s)));
+				}
+				it = ids.emplace(command, stage_ids).first;
+			}
+			for (size_t s = 0; s < stage_count; ++s) {
+				if (visited & (1u << s)) registry().record(it->second[s], ticks[s], 0, 0, 0, 0);
+			}
+		}
+	};
+
+	static trace &local() {
+		thread_local trace t;
+		return t;
+	}
+
+	static std::atomic<uint32_t> &rate() {
+		static std::atomic<uint32_t> every{0};
+		return every;
+	}
+
+	/* Stage durations, in ticks, recorded as "<command> <stage>" */
+	static metrics_registry &registry() {
+		static metrics_registry stages;
+		return stages;
+	}
+
+	static const std::pair<uint64_t, std::chrono::steady_clock::time_point> &calibration_origin() {
+		static const std::pair<uint64_t, std::chrono::steady_clock::time_point> origin{
+			stage_clock::now(), std::chrono::steady_clock::now()};
+		return origin;
+	}
+
+	/* Measured over the time since profiling was first enabled, and at least 10 ms */
+	static double ticks_per_ns() {
+		const auto &origin = calibration_origin();
+		const auto minimum = origin.second + std::chrono::milliseconds(10);
+		if (std::chrono::steady_clock::now() < minimum) std::this_thread::sleep_until(minimum);
+		const auto elapsed = std::chrono::steady_clock::now() - origin.second;
+		const uint64_t ticks = stage_clock::now() - origin.first;
+		const auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+		return ns > 0 && ticks > 0 ? static_cast<double>(ticks) / static_cast<double>(ns) : 1.0;
+	}
+};
+
+/**
+ * @brief Times a scope as a stage of the current call, when the call is sampled.
+ */
+class stage_timer {
+public:
+	explicit stage_timer(stage s) : s(s), start(stage_profiler::enter(s) ? stage_clock::now() : 0) {
+	}
+
+	~stage_timer() {
+		if (start != 0) stage_profiler::add(s, stage_clock::now() - start);
+	}
+
+	stage_timer(const stage_timer &) = delete;
+	stage_timer &operator=(const stage_timer &) = delete;
+
+private:
+	const stage s;
+	const uint64_t start;
+};
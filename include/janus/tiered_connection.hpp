@@ -0,0 +1,1486 @@
+#pragma once
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "command_table.hpp"
+#include "kv_connection.hpp"
+#include "redis_subscriber.hpp"
+
+/**
+ * @brief Where the writes of a tiered_connection go first.
+ */
+enum class write_policy {
+	/* Writes go to Redis, then to the local copy of the key if there is one */
+	write_through,
+	/* Writes go to the local tier only; changed keys are copied to Redis by flush() or the background thread */
+	write_back
+};
+
+/**
+ * @brief Tuning knobs of a tiered_connection.
+ */
+struct tiered_options {
+	write_policy writes{write_policy::write_through};
+	/* Misses of a key after which it is copied into the local tier (1 promotes on the first miss) */
+	unsigned promote_after{2};
+	/* Misses between two halvings of all miss counts, so keys that were hot long ago stop counting */
+	size_t aging_period{10000};
+	/* Budget of the local tier, estimated from key and value sizes; cold copies are demoted beyond it */
+	size_t max_local_bytes{64 * 1024 * 1024};
+	/* Age after which a local copy is reloaded even without an invalidation message; 0 disables */
+	std::chrono::milliseconds max_staleness{0};
+	/* Period of the background thread that flushes dirty keys and publishes invalidations; 0 disables it */
+	std::chrono::milliseconds flush_interval{100};
+	/* Pub/sub channel of invalidation messages; empty disables publishing */
+	std::string invalidation_channel{"janus:invalidate"};
+	/* File the hottest local copies are saved to, and loaded from in the background at startup; empty disables */
+	std::string snapshot_path;
+	/* Period of snapshots taken by the background thread; 0 saves only on destruction */
+	std::chrono::milliseconds snapshot_interval{60000};
+	/* Most keys kept in a snapshot, the most read first */
+	size_t snapshot_max_keys{10000};
+	/* Whether loaded keys are checked against Redis (pipelined PTTL) before they are served */
+	bool revalidate_snapshot{true};
+	/*
+	 * Age after which a copy loaded from a snapshot is reloaded from Redis, bounding how long a value changed while
+	 * the process was down is served; 0 keeps loaded copies as long as the others
+	 */
+	std::chrono::milliseconds snapshot_max_age{10000};
+};
+
+/**
+ * @brief Counters of a tiered_connection, see tiered_connection::stats().
+ */
+struct tier_stats {
+	uint64_t hits{0};
+	uint64_t misses{0};
+	uint64_t promotions{0};
+	uint64_t demotions{0};
+	uint64_t invalidations{0};
+	uint64_t flushed{0};
+	uint64_t flush_errors{0};
+	uint64_t publish_errors{0};
+	/* Keys copied into the local tier from a snapshot */
+	uint64_t warmed{0};
+	uint64_t snapshot_errors{0};
+	size_t local_keys{0};
+	size_t local_bytes{0};
+};
+
+/**
+ * @brief A kv_connection that keeps copies of hot keys in a fast local tier in front of Redis, the shared tier.
+ * * The local tier is any kv_connection that accepts raw commands through pipeline(), such as a memory_connection or
+ * a local_store_connection (which survives restarts). Redis stays the source of truth:
+ * - Reads of a key with a local copy are answered by the local tier. Other reads go to Redis and count as misses of
+ *   the key; after promote_after misses the whole key (any of the five core types, with its TTL) is copied into the
+ *   local tier in one transaction. A copy of a key that does not exist is kept too, and answers "not found".
+ * - Write-through writes go to Redis and are then replayed on the local copy, if any. Write-back writes are applied to
+ *   the local copy only (the key is loaded first when needed) and mark it dirty; dirty keys are copied to Redis as a
+ *   whole, each in a transaction, by flush() or the background thread.
+ * - The local tier is bounded by max_local_bytes. Beyond it, copies are demoted with the CLOCK algorithm: a copy
+ *   read or written since the hand last passed gets a second chance. Dirty copies are never demoted before they are
+ *   flushed, so write-back may exceed the budget until the next flush.
+ * - Every process publishes the keys it changed in Redis on invalidation_channel, batched by the background thread.
+ *   With a redis_subscriber, a listener thread drops the local copies named by other processes' messages. If the
+ *   subscription fails, clean copies are dropped and reads stop promoting, as copies could no longer be kept fresh.
+ * - With a snapshot_path, the most read clean copies are saved with their remaining TTLs by the background thread and
+ *   on destruction, and loaded by a thread of their own at startup, so a restarted process does not start cold. The
+ *   loaded copies are reloaded from Redis after snapshot_max_age, as they may miss changes made in the meantime.
+ *
+ * Multi-key commands are answered locally only when every key has a local copy; otherwise they, and all multi-key
+ * writes, run on Redis after flushing the dirty keys involved, and drop the local copies of the keys they write.
+ * pipeline() and evalsha() always run on Redis; a pipeline that is not read-only drops the copies of the keys its
+ * commands name (see command_keys()), or every copy if it holds FLUSHALL, FLUSHDB or SWAPDB.
+ *
+ * The connection is thread-safe. Reads of local copies share a lock; Redis calls are serialized.
+ */
+class tiered_connection: public kv_connection {
+public:
+	/**
+	 * @brief Constructor.
+	 * @param local The local tier; its content is managed by this connection.
+	 * @param remote The Redis connection.
+	 * @param options Tuning knobs.
+	 * @param subscriber Optional connection for invalidation messages from other processes.
+	 */
+	tiered_connection(std::shared_ptr<kv_connection> local, std::shared_ptr<kv_connection> remote,
+					  tiered_options options = {}, std::unique_ptr<redis_subscriber> subscriber = nullptr) :
+		local(std::move(local)), remote(std::move(remote)), options(std::move(options)),
+		subscriber(std::move(subscriber)), origin(make_origin()) {
+		background = this->options.flush_interval.count() > 0;
+		if (this->subscriber && !this->options.invalidation_channel.empty()) {
+			this->subscriber->subscribe({this->options.invalidation_channel});
+			listener = std::thread([this] { listen(); });
+		}
+		if (background) {
+			flusher = std::thread([this] { run_background(); });
+		}
+		if (!this->options.snapshot_path.empty()) {
+			warmer = std::thread([this] {
+				try {
+					load_snapshot(this->options.snapshot_path);
+				}
+				catch (const std::exception &) {
+					// An unreadable snapshot only means a cold start
+					++snapshot_errors;
+				}
+			});
+		}
+	}
+
+	~tiered_connection() override {
+		{
+			std::lock_guard<std::mutex> lock(wake_mutex);
+			stopping = true;
+		}
+		wake.notify_all();
+		if (flusher.joinable()) flusher.join();
+		if (listener.joinable()) listener.join();
+		if (warmer.joinable()) warmer.join();
+		try {
+			flush();
+		}
+		catch (const std::exception &) {
+			// Redis is unreachable: unflushed write-back changes are lost, as with any write-back cache
+		}
+		try {
+			if (!options.snapshot_path.empty()) save_snapshot(options.snapshot_path);
+		}
+		catch (const std::exception &) {
+			// The next start is cold
+		}
+	}
+
+	tiered_connection(const tiered_connection &) = delete;
+	tiered_connection &operator=(const tiered_connection &) = delete;
+
+	/**
+	 * @brief Copies every dirty key to Redis and publishes the pending invalidations.
+	 * @throw std::runtime_error if Redis rejects the copy; the keys stay dirty.
+	 */
+	void flush() {
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		flush_dirty(nullptr);
+		publish_pending();
+	}
+
+	/**
+	 * @brief Drops the local copy of a key, after flushing it if it is dirty (the last writer wins).
+	 */
+	void invalidate(const std::string &key) {
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		const std::vector<std::string> keys{key};
+		flush_dirty(&keys);
+		std::unique_lock<std::shared_mutex> lock(state_mutex);
+		auto it = residents.find(key);
+		if (it != residents.end()) {
+			drop(it);
+			++invalidations;
+		}
+	}
+
+	/**
+	 * @brief Returns true if the key has a copy in the local tier.
+	 */
+	[[nodiscard]] bool is_local(const std::string &key) const {
+		std::shared_lock<std::shared_mutex> lock(state_mutex);
+		return residents.count(key) > 0;
+	}
+
+	[[nodiscard]] tier_stats stats() const {
+		tier_stats s;
+		s.hits = hits.load(std::memory_order_relaxed);
+		s.misses = misses.load(std::memory_order_relaxed);
+		s.promotions = promotions.load(std::memory_order_relaxed);
+		s.demotions = demotions.load(std::memory_order_relaxed);
+		s.invalidations = invalidations.load(std::memory_order_relaxed);
+		s.flushed = flushed.load(std::memory_order_relaxed);
+		s.flush_errors = flush_errors.load(std::memory_order_relaxed);
+		s.publish_errors = publish_errors.load(std::memory_order_relaxed);
+		s.warmed = warmed.load(std::memory_order_relaxed);
+		s.snapshot_errors = snapshot_errors.load(std::memory_order_relaxed);
+		std::shared_lock<std::shared_mutex> lock(state_mutex);
+		s.local_keys = residents.size();
+		s.local_bytes = local_bytes;
+		return s;
+	}
+
+	/**
+	 * @brief Saves the most read clean local copies, with their remaining TTLs, to a snapshot file.
+	 * * The file is written next to path and renamed over it, so a crash keeps the previous snapshot. It holds a fixed
+	 * size entry table followed by the keys and values, and is read through mmap by load_snapshot(). Dirty copies and
+	 * copies of missing keys are left out.
+	 * @param path The snapshot file.
+	 * @return The number of keys saved.
+	 * @throw std::runtime_error on I/O errors.
+	 */
+	size_t save_snapshot(const std::string &path) {
+		std::vector<std::pair<std::string, snapshot>> entries;
+		{
+			std::shared_lock<std::shared_mutex> lock(state_mutex);
+			std::vector<std::pair<uint32_t, const std::string *>> hottest;
+			hottest.reserve(residents.size());
+			for (auto &kv: residents) {
+				const uint32_t accesses = kv.second.accesses.load(std::memory_order_relaxed);
+				if (!kv.second.dirty && !kv.second.flushing) hottest.emplace_back(accesses, &kv.first);
+				// Age the counts, so keys that were read long ago make room for the current ones
+				kv.second.accesses.store(accesses / 2, std::memory_order_relaxed);
+			}
+			const size_t kept = std::min(hottest.size(), options.snapshot_max_keys);
+			std::partial_sort(hottest.begin(), hottest.begin() + static_cast<std::ptrdiff_t>(kept), hottest.end(),
+							  [](const auto &a, const auto &b) { return a.first > b.first; });
+			for (size_t i = 0; i < kept; ++i) {
+				std::optional<snapshot> s = fetch(*local, *hottest[i].second);
+				if (s && s->type != "none") entries.emplace_back(*hottest[i].second, std::move(*s));
+			}
+		}
+		write_snapshot(path, entries);
+		return entries.size();
+	}
+
+	/**
+	 * @brief Copies the keys of a snapshot file into the local tier.
+	 * * Expired entries are skipped, and so are keys that already have a local copy. With revalidate_snapshot, the
+	 * remaining keys are checked with pipelined PTTL commands: keys deleted from Redis are skipped and the others take
+	 * the TTL Redis reports. Values changed in Redis while the process was down are not detected, so the loaded copies
+	 * are reloaded from Redis once they are older than snapshot_max_age (or max_staleness, if shorter).
+	 * @param path The snapshot file; a missing file loads nothing.
+	 * @return The number of keys loaded.
+	 * @throw std::runtime_error if the file is not a snapshot, or Redis fails during revalidation.
+	 */
+	size_t load_snapshot(const std::string &path) {
+		std::vector<std::pair<std::string, snapshot>> entries = read_snapshot(path);
+		size_t loaded = 0;
+		for (size_t begin = 0; begin < entries.size() && !stopping.load(); begin += snapshot_batch) {
+			const size_t end = std::min(entries.size(), begin + snapshot_batch);
+			// Held across the check and the copy, so a write of the key cannot slip in between
+			std::lock_guard<std::mutex> remote_lock(remote_mutex);
+			if (options.revalidate_snapshot) {
+				std::vector<std::vector<std::string>> commands;
+				for (size_t i = begin; i < end; ++i) {
+					commands.push_back({"PTTL", entries[i].first});
+				}
+				auto replies = remote->pipeline(commands);
+				for (size_t i = begin; i < end; ++i) {
+					const kv_reply &reply = replies[i - begin];
+					if (reply.is_error()) throw std::runtime_error("tiered_connection: " + reply.str);
+					// -2: the key is gone
+					entries[i].second.pttl = reply.integer == -2 ? 0 : reply.integer;
+				}
+			}
+			std::unique_lock<std::shared_mutex> lock(state_mutex);
+			for (size_t i = begin; i < end; ++i) {
+				const std::string &key = entries[i].first;
+				const snapshot &s = entries[i].second;
+				if (s.pttl == 0 || residents.count(key) > 0) continue;
+				apply(*local, replace_commands(key, s));
+				auto it = residents.try_emplace(key).first;
+				it->second.slot = ring.size();
+				ring.push_back(key);
+				it->second.bytes = key.size() + value_size(s.value);
+				local_bytes += it->second.bytes;
+				it->second.loaded = std::chrono::steady_clock::now();
+				it->second.from_snapshot = true;
+				++loaded;
+			}
+			enforce_budget();
+		}
+		warmed += loaded;
+		return loaded;
+	}
+
+	bool exists(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.exists(key); });
+	}
+
+	bool expire(const std::string &key, int seconds) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.expire(key, seconds); });
+	}
+
+	bool pexpire(const std::string &key, int milliseconds) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.pexpire(key, milliseconds); });
+	}
+
+	long long del(const std::string &key) override {
+		return write(key, becomes(0), [&](kv_connection &c) { return c.del(key); });
+	}
+
+	long long del(const std::vector<std::string> &keys) override {
+		return write_many(keys, [&](kv_connection &c) { return c.del(keys); });
+	}
+
+	int64_t ttl(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.ttl(key); });
+	}
+
+	int64_t pttl(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.pttl(key); });
+	}
+
+	// ============================================================================
+	// For String
+	// ============================================================================
+
+	bool set(const std::string &key, const std::string &value) override {
+		return write(key, becomes(value.size()), [&](kv_connection &c) { return c.set(key, value); });
+	}
+
+	bool set_not_exists(const std::string &key, const std::string &value) override {
+		return write(key, grows(value.size()), [&](kv_connection &c) { return c.set_not_exists(key, value); });
+	}
+
+	bool set_ex(const std::string &key, const std::string &value, int seconds) override {
+		return write(key, becomes(value.size()), [&](kv_connection &c) { return c.set_ex(key, value, seconds); });
+	}
+
+	bool set_px(const std::string &key, const std::string &value, int milliseconds) override {
+		return write(key, becomes(value.size()), [&](kv_connection &c) { return c.set_px(key, value, milliseconds); });
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.get(key); });
+	}
+
+	std::optional<std::string> getset(const std::string &key, const std::string &new_value) override {
+		return write(key, becomes(new_value.size()), [&](kv_connection &c) { return c.getset(key, new_value); });
+	}
+
+	long long incr(const std::string &key, long long delta) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.incr(key, delta); });
+	}
+
+	long long decr(const std::string &key, long long delta) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.decr(key, delta); });
+	}
+
+	long long append(const std::string &key, const std::string &value) override {
+		return write(key, grows(value.size()), [&](kv_connection &c) { return c.append(key, value); });
+	}
+
+	std::string getrange(const std::string &key, long long start, long long end) override {
+		return read(key, [&](kv_connection &c) { return c.getrange(key, start, end); });
+	}
+
+	// ============================================================================
+	// For Hash
+	// ============================================================================
+
+	std::optional<std::string> hget(const std::string &key, const std::string &hash_key) override {
+		return read(key, [&](kv_connection &c) { return c.hget(key, hash_key); });
+	}
+
+	void hget(const std::string &key, std::unordered_map<std::string, std::optional<std::string>> &hash_map) override {
+		hash_map = read(key, [&](kv_connection &c) {
+			auto fields = hash_map;
+			c.hget(key, fields);
+			return fields;
+		});
+	}
+
+	bool hset(const std::string &key, const std::string &field, const std::string &value) override {
+		return write(key, grows(field.size() + value.size()),
+					 [&](kv_connection &c) { return c.hset(key, field, value); });
+	}
+
+	bool hset(const std::string &key, const std::unordered_map<std::string, std::string> &hash_map) override {
+		size_t bytes = 0;
+		for (const auto &kv: hash_map) {
+			bytes += kv.first.size() + kv.second.size();
+		}
+		return write(key, grows(bytes), [&](kv_connection &c) { return c.hset(key, hash_map); });
+	}
+
+	std::unordered_map<std::string, std::string> hgetall(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.hgetall(key); });
+	}
+
+	std::vector<std::string> hkeys(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.hkeys(key); });
+	}
+
+	std::vector<std::string> hvals(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.hvals(key); });
+	}
+
+	long long hdel(const std::string &key, const std::string &hash_key) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.hdel(key, hash_key); });
+	}
+
+	long long hdel(const std::string &key, const std::vector<std::string> &hash_keys) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.hdel(key, hash_keys); });
+	}
+
+	// ============================================================================
+	// For list
+	// ===========================================================================
+
+	long long lpush(const std::string &key, const std::vector<std::string> &values) override {
+		return write(key, grows(total_size(values)), [&](kv_connection &c) { return c.lpush(key, values); });
+	}
+
+	long long lpush(const std::string &key, const std::string &value) override {
+		return write(key, grows(value.size()), [&](kv_connection &c) { return c.lpush(key, value); });
+	}
+
+	long long rpush(const std::string &key, const std::string &value) override {
+		return write(key, grows(value.size()), [&](kv_connection &c) { return c.rpush(key, value); });
+	}
+
+	long long rpush(const std::string &key, const std::vector<std::string> &values) override {
+		return write(key, grows(total_size(values)), [&](kv_connection &c) { return c.rpush(key, values); });
+	}
+
+	std::optional<std::string> lpop(const std::string &key) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.lpop(key); });
+	}
+
+	std::optional<std::string> rpop(const std::string &key) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.rpop(key); });
+	}
+
+	std::vector<std::string> lrange(const std::string &key, long long start, long long stop) override {
+		return read(key, [&](kv_connection &c) { return c.lrange(key, start, stop); });
+	}
+
+	long long llen(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.llen(key); });
+	}
+
+	// ============================================================================
+	// For Set
+	// ============================================================================
+
+	long long sadd(const std::string &key, const std::vector<std::string> &members) override {
+		return write(key, grows(total_size(members)), [&](kv_connection &c) { return c.sadd(key, members); });
+	}
+
+	long long srem(const std::string &key, const std::vector<std::string> &members) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.srem(key, members); });
+	}
+
+	std::vector<std::string> smembers(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.smembers(key); });
+	}
+
+	long long scard(const std::string &key) override {
+		return read(key, [&](kv_connection &c) { return c.scard(key); });
+	}
+
+	bool sismember(const std::string &key, const std::string &member) override {
+		return read(key, [&](kv_connection &c) { return c.sismember(key, member); });
+	}
+
+	std::optional<std::string> spop(const std::string &key) override {
+		// The popped member is random: the local copy removes the one Redis chose instead of popping its own
+		return write(
+			key, grows(0), [&](kv_connection &c) { return c.spop(key); },
+			[&](kv_connection &c, const std::optional<std::string> &popped) {
+				if (popped) c.srem(key, {*popped});
+			});
+	}
+
+	std::vector<std::string> sinter(const std::vector<std::string> &keys) override {
+		return read_many(keys, [&](kv_connection &c) { return c.sinter(keys); });
+	}
+
+	// ============================================================================
+	// For ZSet
+	// ============================================================================
+
+	long long zadd(const std::string &key, const std::unordered_map<std::string, double> &members) override {
+		size_t bytes = 0;
+		for (const auto &m: members) {
+			bytes += m.first.size() + sizeof(double);
+		}
+		return write(key, grows(bytes), [&](kv_connection &c) { return c.zadd(key, members); });
+	}
+
+	long long zrem(const std::string &key, const std::vector<std::string> &members) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.zrem(key, members); });
+	}
+
+	std::optional<double> zscore(const std::string &key, const std::string &member) override {
+		return read(key, [&](kv_connection &c) { return c.zscore(key, member); });
+	}
+
+	std::vector<std::string> zrange(const std::string &key, long long start, long long stop) override {
+		return read(key, [&](kv_connection &c) { return c.zrange(key, start, stop); });
+	}
+
+	std::vector<std::string> zrevrange(const std::string &key, long long start, long long stop) override {
+		return read(key, [&](kv_connection &c) { return c.zrevrange(key, start, stop); });
+	}
+
+	std::vector<std::pair<std::string, double>> zrange_withscores(const std::string &key, long long start,
+																  long long stop) override {
+		return read(key, [&](kv_connection &c) { return c.zrange_withscores(key, start, stop); });
+	}
+
+	std::vector<std::pair<std::string, double>> zrevrange_withscores(const std::string &key, long long start,
+																	 long long stop) override {
+		return read(key, [&](kv_connection &c) { return c.zrevrange_withscores(key, start, stop); });
+	}
+
+	double zincrby(const std::string &key, double increment, const std::string &member) override {
+		return write(key, grows(member.size() + sizeof(double)),
+					 [&](kv_connection &c) { return c.zincrby(key, increment, member); });
+	}
+
+	std::vector<std::pair<std::string, double>> zrangebyscore_withscores(const std::string &key, double min,
+																		 double max) override {
+		return read(key, [&](kv_connection &c) { return c.zrangebyscore_withscores(key, min, max); });
+	}
+
+	long long zremrangebyscore(const std::string &key, double min, double max) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.zremrangebyscore(key, min, max); });
+	}
+
+	// ============================================================================
+	// For HyperLogLog
+	// ============================================================================
+
+	bool pfadd(const std::string &key, const std::vector<std::string> &elements) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.pfadd(key, elements); });
+	}
+
+	long long pfcount(const std::vector<std::string> &keys) override {
+		return read_many(keys, [&](kv_connection &c) { return c.pfcount(keys); });
+	}
+
+	bool pfmerge(const std::string &dest, const std::vector<std::string> &sources) override {
+		std::vector<std::string> keys{dest};
+		keys.insert(keys.end(), sources.begin(), sources.end());
+		return write_many(keys, [&](kv_connection &c) { return c.pfmerge(dest, sources); });
+	}
+
+	// ============================================================================
+	// For Bitmap
+	// ============================================================================
+
+	bool setbit(const std::string &key, long long offset, bool value) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.setbit(key, offset, value); });
+	}
+
+	bool getbit(const std::string &key, long long offset) override {
+		return read(key, [&](kv_connection &c) { return c.getbit(key, offset); });
+	}
+
+	long long bitcount(const std::string &key, long long start, long long end) override {
+		return read(key, [&](kv_connection &c) { return c.bitcount(key, start, end); });
+	}
+
+	long long bitpos(const std::string &key, bool bit, long long start, long long end) override {
+		return read(key, [&](kv_connection &c) { return c.bitpos(key, bit, start, end); });
+	}
+
+	long long bitop(const std::string &op, const std::string &dest, const std::vector<std::string> &keys) override {
+		std::vector<std::string> all{dest};
+		all.insert(all.end(), keys.begin(), keys.end());
+		return write_many(all, [&](kv_connection &c) { return c.bitop(op, dest, keys); });
+	}
+
+	std::vector<std::optional<long long>> bitfield(const std::string &key,
+												   const std::vector<std::string> &args) override {
+		return write(key, grows(0), [&](kv_connection &c) { return c.bitfield(key, args); });
+	}
+
+	// ============================================================================
+	// For Scripting
+	// ============================================================================
+
+	std::string script_load(const std::string &script) override {
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		return remote->script_load(script);
+	}
+
+	kv_reply evalsha(const std::string &sha1, const std::vector<std::string> &keys,
+					 const std::vector<std::string> &args) override {
+		return write_many(keys, [&](kv_connection &c) { return c.evalsha(sha1, keys, args); });
+	}
+
+	// ============================================================================
+	// For Pipelining
+	// ============================================================================
+
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		std::vector<std::string> keys;
+		bool read_only = true;
+		bool every_key = false;
+		for (const auto &command: commands) {
+			if (command.empty()) continue;
+			read_only = read_only && is_read_command(command[0]);
+			every_key = every_key || is_keyspace_command(command[0]);
+			for (auto &key: command_keys(command)) {
+				keys.push_back(std::move(key));
+			}
+		}
+		if (read_only) {
+			std::lock_guard<std::mutex> remote_lock(remote_mutex);
+			flush_dirty(&keys);
+			return remote->pipeline(commands);
+		}
+		if (every_key) {
+			// FLUSHALL and the like: writes made before the pipeline land first, then no copy is valid any more
+			std::lock_guard<std::mutex> remote_lock(remote_mutex);
+			flush_dirty(nullptr);
+			auto replies = remote->pipeline(commands);
+			{
+				std::unique_lock<std::shared_mutex> lock(state_mutex);
+				drop_all();
+			}
+			queue_invalidation({}, true);
+			return replies;
+		}
+		return write_many(keys, [&](kv_connection &c) { return c.pipeline(commands); }, false);
+	}
+
+private:
+	/* A local copy of a key */
+	struct resident {
+		/* Set on every access, cleared as the CLOCK hand passes */
+		std::atomic<bool> referenced{true};
+		/* Reads served by the copy, halved by every snapshot; ranks the copies kept in a snapshot */
+		std::atomic<uint32_t> accesses{0};
+		bool dirty{false};
+		/* Being copied to Redis by flush_dirty(); never demoted, so a failed copy can be marked dirty again */
+		bool flushing{false};
+		size_t bytes{0};
+		/* Position in the CLOCK ring */
+		size_t slot{0};
+		std::chrono::steady_clock::time_point loaded;
+		/* Loaded from a snapshot and not refreshed from Redis since */
+		bool from_snapshot{false};
+	};
+
+	/* The whole content of a key, as read in one transaction */
+	struct snapshot {
+		std::string type;
+		long long pttl{-1};
+		kv_reply value;
+	};
+
+	/* How a write changes the estimated size of a local copy */
+	struct footprint {
+		size_t bytes;
+		bool replaces;
+	};
+
+	static footprint grows(size_t bytes) {
+		return {bytes, false};
+	}
+
+	static footprint becomes(size_t bytes) {
+		return {bytes, true};
+	}
+
+	static size_t total_size(const std::vector<std::string> &values) {
+		size_t bytes = 0;
+		for (const auto &v: values) {
+			bytes += v.size();
+		}
+		return bytes;
+	}
+
+	template<typename F>
+	std::invoke_result_t<F &, kv_connection &> read(const std::string &key, F &&op) {
+		{
+			std::shared_lock<std::shared_mutex> lock(state_mutex);
+			auto it = residents.find(key);
+			if (it != residents.end() && fresh(it->second)) {
+				touch(it->second);
+				++hits;
+				return op(*local);
+			}
+		}
+
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		bool stale = false;
+		{
+			// Another thread may have loaded the key while this one waited for Redis
+			std::unique_lock<std::shared_mutex> lock(state_mutex);
+			auto it = residents.find(key);
+			if (it != residents.end() && fresh(it->second)) {
+				touch(it->second);
+				++hits;
+				return op(*local);
+			}
+			if (it != residents.end()) {
+				drop(it);
+				stale = true;
+			}
+		}
+		++misses;
+		auto result = op(*remote);
+		// A copy that aged out was hot: reload it right away
+		if ((stale && caching.load(std::memory_order_relaxed)) || count_miss(key)) promote(key);
+		return result;
+	}
+
+	template<typename F>
+	std::invoke_result_t<F &, kv_connection &> write(const std::string &key, footprint size, F &&op) {
+		return write(key, size, op, [&](kv_connection &c, const auto &) { op(c); });
+	}
+
+	/**
+	 * @brief Runs a single-key write.
+	 * @param op Runs the write on a tier.
+	 * @param replay Applies the write to the local copy after op ran on Redis (write-through), given op's result.
+	 */
+	template<typename F, typename G>
+	std::invoke_result_t<F &, kv_connection &> write(const std::string &key, footprint size, F &&op, G &&replay) {
+		if (options.writes == write_policy::write_back) {
+			for (;;) {
+				{
+					std::unique_lock<std::shared_mutex> lock(state_mutex);
+					auto it = residents.find(key);
+					if (it != residents.end() && fresh(it->second)) {
+						auto result = op(*local);
+						it->second.dirty = true;
+						resize(it->second, size);
+						enforce_budget();
+						return result;
+					}
+				}
+				std::lock_guard<std::mutex> remote_lock(remote_mutex);
+				// Keys of types the local tier cannot hold are written through. The budget is enforced once the
+				// write made the copy dirty, or the new copy could be demoted right away
+				if (!is_fresh(key) && !promote(key, false)) break;
+			}
+		}
+
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		auto result = op(*remote);
+		{
+			std::unique_lock<std::shared_mutex> lock(state_mutex);
+			auto it = residents.find(key);
+			if (it != residents.end()) {
+				bool replayed = false;
+				try {
+					replay(*local, result);
+					replayed = true;
+				}
+				catch (const std::exception &) {
+					// The copy diverged from Redis; it is reloaded once the key is hot again
+				}
+				if (replayed) {
+					it->second.referenced.store(true, std::memory_order_relaxed);
+					resize(it->second, size);
+					enforce_budget();
+				}
+				else {
+					drop(it);
+				}
+			}
+		}
+		queue_invalidation({key});
+		return result;
+	}
+
+	template<typename F>
+	std::invoke_result_t<F &, kv_connection &> read_many(const std::vector<std::string> &keys, F &&op) {
+		{
+			std::shared_lock<std::shared_mutex> lock(state_mutex);
+			bool all_local = !keys.empty();
+			for (const auto &key: keys) {
+				auto it = residents.find(key);
+				if (it == residents.end() || !fresh(it->second)) {
+					all_local = false;
+					break;
+				}
+			}
+			if (all_local) {
+				for (const auto &key: keys) {
+					touch(residents.find(key)->second);
+				}
+				++hits;
+				return op(*local);
+			}
+		}
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		flush_dirty(&keys);
+		++misses;
+		return op(*remote);
+	}
+
+	/* Runs a write on Redis after flushing the dirty keys involved, then drops their local copies */
+	template<typename F>
+	std::invoke_result_t<F &, kv_connection &> write_many(const std::vector<std::string> &keys, F &&op,
+														  bool publish = true) {
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		flush_dirty(&keys);
+		auto result = op(*remote);
+		{
+			std::unique_lock<std::shared_mutex> lock(state_mutex);
+			for (const auto &key: keys) {
+				auto it = residents.find(key);
+				if (it != residents.end()) drop(it);
+			}
+		}
+		if (publish) queue_invalidation(keys);
+		return result;
+	}
+
+	static void touch(resident &r) {
+		r.referenced.store(true, std::memory_order_relaxed);
+		r.accesses.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	[[nodiscard]] bool fresh(const resident &r) const {
+		if (r.dirty) return true;
+		std::chrono::milliseconds max_age = options.max_staleness;
+		if (r.from_snapshot && options.snapshot_max_age.count() > 0
+			&& (max_age.count() == 0 || options.snapshot_max_age < max_age)) {
+			max_age = options.snapshot_max_age;
+		}
+		return max_age.count() == 0 || std::chrono::steady_clock::now() - r.loaded < max_age;
+	}
+
+	[[nodiscard]] bool is_fresh(const std::string &key) const {
+		std::shared_lock<std::shared_mutex> lock(state_mutex);
+		auto it = residents.find(key);
+		return it != residents.end() && fresh(it->second);
+	}
+
+	/* Counts a miss; returns true when the key became hot enough to promote */
+	bool count_miss(const std::string &key) {
+		if (!caching.load(std::memory_order_relaxed)) return false;
+		std::unique_lock<std::shared_mutex> lock(state_mutex);
+		if (++misses_since_aging >= options.aging_period) {
+			misses_since_aging = 0;
+			for (auto it = candidates.begin(); it != candidates.end();) {
+				it->second /= 2;
+				it = it->second == 0 ? candidates.erase(it) : std::next(it);
+			}
+		}
+		unsigned &count = candidates[key];
+		if (++count < options.promote_after) return false;
+		candidates.erase(key);
+		return true;
+	}
+
+	/**
+	 * @brief Copies a key from Redis into the local tier. The caller holds remote_mutex.
+	 * @param enforce Whether to demote other copies if the tier is now over budget.
+	 * @return False if the key has a type the local tier does not hold.
+	 */
+	bool promote(const std::string &key, bool enforce = true) {
+		std::optional<snapshot> s = fetch(*remote, key);
+		if (!s) return false;
+		std::unique_lock<std::shared_mutex> lock(state_mutex);
+		auto it = residents.find(key);
+		// Never overwrite unflushed changes
+		if (it != residents.end() && it->second.dirty) return true;
+		apply(*local, replace_commands(key, *s));
+		if (it == residents.end()) {
+			it = residents.try_emplace(key).first;
+			it->second.slot = ring.size();
+			ring.push_back(key);
+		}
+		resident &r = it->second;
+		local_bytes -= r.bytes;
+		r.bytes = key.size() + value_size(s->value);
+		local_bytes += r.bytes;
+		r.loaded = std::chrono::steady_clock::now();
+		r.from_snapshot = false;
+		r.referenced.store(true, std::memory_order_relaxed);
+		++promotions;
+		if (enforce) enforce_budget();
+		return true;
+	}
+
+	/* The caller holds state_mutex exclusively */
+	void resize(resident &r, footprint size) {
+		local_bytes -= r.bytes;
+		r.bytes = size.replaces ? ring[r.slot].size() + size.bytes : r.bytes + size.bytes;
+		local_bytes += r.bytes;
+	}
+
+	/* Demotes clean copies with the CLOCK algorithm until the budget holds. The caller holds state_mutex exclusively */
+	void enforce_budget() {
+		size_t skipped = 0;
+		while (local_bytes > options.max_local_bytes && !ring.empty()) {
+			if (skipped >= 2 * ring.size()) {
+				// Only dirty copies are left: ask the background thread to flush them
+				wake.notify_one();
+				return;
+			}
+			if (hand >= ring.size()) hand = 0;
+			auto it = residents.find(ring[hand]);
+			if (it->second.dirty || it->second.flushing
+				|| it->second.referenced.exchange(false, std::memory_order_relaxed)) {
+				++hand;
+				++skipped;
+				continue;
+			}
+			drop(it);
+			++demotions;
+			skipped = 0;
+		}
+	}
+
+	/* Removes a local copy. The caller holds state_mutex exclusively */
+	void drop(std::unordered_map<std::string, resident>::iterator it) {
+		local->del(it->first);
+		const size_t slot = it->second.slot;
+		if (slot + 1 != ring.size()) {
+			ring[slot] = std::move(ring.back());
+			residents.find(ring[slot])->second.slot = slot;
+		}
+		ring.pop_back();
+		local_bytes -= it->second.bytes;
+		residents.erase(it);
+	}
+
+	/* Removes every local copy, dirty or not. The caller holds state_mutex exclusively */
+	void drop_all() {
+		while (!residents.empty()) {
+			drop(residents.begin());
+		}
+	}
+
+	/**
+	 * @brief Copies dirty keys to Redis; all of them if keys is nullptr. The caller holds remote_mutex.
+	 * @throw std::runtime_error if Redis rejects a copy; the keys stay dirty.
+	 */
+	void flush_dirty(const std::vector<std::string> *keys) {
+		if (options.writes != write_policy::write_back) return;
+		std::vector<std::pair<std::string, snapshot>> dumps;
+		{
+			std::unique_lock<std::shared_mutex> lock(state_mutex);
+			auto take = [&](const std::string &key, resident &r) {
+				if (!r.dirty) return;
+				dumps.emplace_back(key, *fetch(*local, key));
+				// Writes made while the copy is sent mark it dirty again
+				r.dirty = false;
+				r.flushing = true;
+				r.loaded = std::chrono::steady_clock::now();
+				r.from_snapshot = false;
+			};
+			if (keys) {
+				for (const auto &key: *keys) {
+					auto it = residents.find(key);
+					if (it != residents.end()) take(it->first, it->second);
+				}
+			}
+			else {
+				for (auto &kv: residents) {
+					take(kv.first, kv.second);
+				}
+			}
+		}
+		if (dumps.empty()) return;
+
+		std::vector<std::vector<std::string>> commands;
+		std::vector<std::string> flushed_keys;
+		for (const auto &d: dumps) {
+			auto c = replace_commands(d.first, d.second);
+			commands.insert(commands.end(), std::make_move_iterator(c.begin()), std::make_move_iterator(c.end()));
+			flushed_keys.push_back(d.first);
+		}
+		// Copies are only dropped under remote_mutex or by enforce_budget(), which skips them until they are unpinned
+		const auto unpin = [&](bool failed) {
+			std::unique_lock<std::shared_mutex> lock(state_mutex);
+			for (const auto &key: flushed_keys) {
+				resident &r = residents.find(key)->second;
+				r.flushing = false;
+				r.dirty = r.dirty || failed;
+			}
+			enforce_budget();
+		};
+		try {
+			apply(*remote, commands);
+		}
+		catch (const std::exception &) {
+			unpin(true);
+			++flush_errors;
+			throw;
+		}
+		flushed += dumps.size();
+		queue_invalidation(flushed_keys);
+		unpin(false);
+	}
+
+	/* Reads a key of one of the five core types in one transaction; std::nullopt for other types */
+	static std::optional<snapshot> fetch(kv_connection &c, const std::string &key) {
+		auto replies = c.pipeline({{"MULTI"},
+								   {"TYPE", key},
+								   {"PTTL", key},
+								   {"GET", key},
+								   {"HGETALL", key},
+								   {"LRANGE", key, "0", "-1"},
+								   {"SMEMBERS", key},
+								   {"ZRANGE", key, "0", "-1", "WITHSCORES"},
+								   {"EXEC"}});
+		const kv_reply &exec = replies.back();
+		if (exec.type != kv_reply::reply_type::array || exec.elements.size() != 7) {
+			throw std::runtime_error("tiered_connection: failed to read key " + key);
+		}
+		static const char *const types[] = {"none", "string", "hash", "list", "set", "zset"};
+		snapshot s;
+		s.type = exec.elements[0].str;
+		s.pttl = exec.elements[1].integer;
+		for (size_t i = 0; i < 6; ++i) {
+			if (s.type != types[i]) continue;
+			// The reply of the read command matching the type; the others failed with WRONGTYPE
+			if (i > 0) s.value = exec.elements[i + 1];
+			return s;
+		}
+		return std::nullopt;
+	}
+
+	/* Commands that replace a key by a snapshot in one transaction */
+	static std::vector<std::vector<std::string>> replace_commands(const std::string &key, const snapshot &s) {
+		std::vector<std::vector<std::string>> commands{{"MULTI"}, {"DEL", key}};
+		const auto &elements = s.value.elements;
+		std::vector<std::string> write;
+		if (s.type == "string") {
+			write = {"SET", key, s.value.str};
+		}
+		else if (s.type == "zset" && !elements.empty()) {
+			write = {"ZADD", key};
+			for (size_t i = 0; i + 1 < elements.size(); i += 2) {
+				write.push_back(elements[i + 1].str);
+				write.push_back(elements[i].str);
+			}
+		}
+		else if (!elements.empty()) {
+			write = {s.type == "hash" ? "HSET" : s.type == "list" ? "RPUSH" : "SADD", key};
+			for (const auto &e: elements) {
+				write.push_back(e.str);
+			}
+		}
+		if (!write.empty()) commands.push_back(std::move(write));
+		if (s.type != "none" && s.pttl > 0) commands.push_back({"PEXPIRE", key, std::to_string(s.pttl)});
+		commands.push_back({"EXEC"});
+		return commands;
+	}
+
+	/* Runs commands built by replace_commands(), throwing on the first error */
+	static void apply(kv_connection &c, const std::vector<std::vector<std::string>> &commands) {
+		for (const auto &reply: c.pipeline(commands)) {
+			if (reply.is_error()) throw std::runtime_error("tiered_connection: " + reply.str);
+			for (const auto &e: reply.elements) {
+				if (e.is_error()) throw std::runtime_error("tiered_connection: " + e.str);
+			}
+		}
+	}
+
+	static size_t value_size(const kv_reply &value) {
+		size_t bytes = value.str.size();
+		for (const auto &e: value.elements) {
+			bytes += e.str.size();
+		}
+		return bytes;
+	}
+
+	// ==========================================================
+	// Invalidation messages
+	// ==========================================================
+
+	/**
+	 * @brief Queues keys changed in Redis for the next invalidation message. The caller holds remote_mutex.
+	 * @param all Whether every key changed, as after FLUSHALL; the message then names none.
+	 */
+	void queue_invalidation(const std::vector<std::string> &keys, bool all = false) {
+		if (options.invalidation_channel.empty() || (keys.empty() && !all)) return;
+		{
+			std::lock_guard<std::mutex> lock(publish_mutex);
+			pending.insert(pending.end(), keys.begin(), keys.end());
+			pending_all = pending_all || all;
+		}
+		if (background) {
+			wake.notify_one();
+		}
+		else {
+			publish_pending();
+		}
+	}
+
+	/**
+	 * @brief Publishes the queued keys as one message: the 16 hex digit origin id, then "<length>:<key>" per key, or
+	 * "*" when every key changed. The caller holds remote_mutex.
+	 */
+	void publish_pending() {
+		std::vector<std::string> keys;
+		bool all = false;
+		{
+			std::lock_guard<std::mutex> lock(publish_mutex);
+			keys.swap(pending);
+			std::swap(all, pending_all);
+		}
+		if (keys.empty() && !all) return;
+		std::string payload = origin;
+		if (all) {
+			payload += '*';
+			keys.clear();
+		}
+		for (const auto &key: keys) {
+			payload += std::to_string(key.size());
+			payload += ':';
+			payload += key;
+		}
+		try {
+			auto replies = remote->pipeline({{"PUBLISH", options.invalidation_channel, payload}});
+			if (replies.empty() || replies[0].is_error()) ++publish_errors;
+		}
+		catch (const std::exception &) {
+			// Other processes keep their copies until max_staleness, if set
+			++publish_errors;
+		}
+	}
+
+	/* Decodes a message; returns nothing for this process' own messages, and sets all when every key changed */
+	std::vector<std::string> decode(const std::string &payload, bool &all) const {
+		std::vector<std::string> keys;
+		all = false;
+		if (payload.size() < origin.size() || payload.compare(0, origin.size(), origin) == 0) return keys;
+		if (payload.compare(origin.size(), std::string::npos, "*") == 0) {
+			all = true;
+			return keys;
+		}
+		size_t pos = origin.size();
+		while (pos < payload.size()) {
+			const size_t colon = payload.find(':', pos);
+			if (colon == std::string::npos) break;
+			const size_t length = std::stoull(payload.substr(pos, colon - pos));
+			if (colon + 1 + length > payload.size()) break;
+			keys.push_back(payload.substr(colon + 1, length));
+			pos = colon + 1 + length;
+		}
+		return keys;
+	}
+
+	void listen() {
+		while (!stopping.load()) {
+			std::optional<pubsub_message> message;
+			try {
+				message = subscriber->poll(std::chrono::milliseconds(100));
+			}
+			catch (const std::exception &) {
+				stop_caching();
+				return;
+			}
+			if (!message || message->channel != options.invalidation_channel) continue;
+			try {
+				bool all = false;
+				const auto keys = decode(message->payload, all);
+				if (all) invalidate_all();
+				for (const auto &key: keys) {
+					invalidate(key);
+				}
+			}
+			catch (const std::exception &) {
+				// A malformed message, or a dirty copy that could not be flushed; it stays local
+			}
+		}
+	}
+
+	/* Drops every local copy after another process changed keys without naming them, flushing dirty ones first */
+	void invalidate_all() {
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		flush_dirty(nullptr);
+		std::unique_lock<std::shared_mutex> lock(state_mutex);
+		invalidations += residents.size();
+		drop_all();
+	}
+
+	/* Without invalidation messages local copies would go stale: drop the clean ones and stop promoting */
+	void stop_caching() {
+		caching = false;
+		std::lock_guard<std::mutex> remote_lock(remote_mutex);
+		std::unique_lock<std::shared_mutex> lock(state_mutex);
+		for (auto it = residents.begin(); it != residents.end();) {
+			auto next = std::next(it);
+			if (!it->second.dirty) drop(it);
+			it = next;
+		}
+	}
+
+	void run_background() {
+		const bool snapshots = !options.snapshot_path.empty() && options.snapshot_interval.count() > 0;
+		auto next_snapshot = std::chrono::steady_clock::now() + options.snapshot_interval;
+		std::unique_lock<std::mutex> lock(wake_mutex);
+		while (!stopping) {
+			wake.wait_for(lock, options.flush_interval);
+			if (stopping) break;
+			lock.unlock();
+			try {
+				std::lock_guard<std::mutex> remote_lock(remote_mutex);
+				flush_dirty(nullptr);
+				publish_pending();
+			}
+			catch (const std::exception &) {
+				// Counted in flush_errors; the keys stay dirty and are retried next time
+			}
+			if (snapshots && std::chrono::steady_clock::now() >= next_snapshot) {
+				try {
+					save_snapshot(options.snapshot_path);
+				}
+				catch (const std::exception &) {
+					++snapshot_errors;
+				}
+				next_snapshot = std::chrono::steady_clock::now() + options.snapshot_interval;
+			}
+			lock.lock();
+		}
+	}
+
+	// ==========================================================
+	// Snapshot files
+	// ==========================================================
+
+	/* File header, followed by count entries, then the keys and values they point to (native byte order) */
+	struct snapshot_header {
+		char magic[8];
+		uint32_t version;
+		uint32_t count;
+		/* Wall-clock milliseconds, like the expiry times */
+		int64_t saved_at;
+	};
+
+	struct snapshot_entry {
+		/* Offset of the key in the file; the value follows it */
+		uint64_t offset;
+		uint32_t key_length;
+		uint32_t value_length;
+		/* Wall-clock milliseconds; 0 if the key has no TTL */
+		int64_t expire_at;
+		/* Index in snapshot_types */
+		uint32_t type;
+		uint32_t reserved;
+	};
+
+	static constexpr char snapshot_magic[8] = {'J', 'A', 'N', 'U', 'S', 'N', 'C', 'S'};
+	static constexpr uint32_t snapshot_version = 1;
+	static constexpr size_t snapshot_batch = 256;
+	static constexpr const char *snapshot_types[] = {"string", "hash", "list", "set", "zset"};
+
+	static int64_t wall_clock_ms() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+				   std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	}
+
+	[[noreturn]] static void throw_errno(const std::string &what) {
+		throw std::runtime_error("tiered_connection: " + what + ": " + std::strerror(errno));
+	}
+
+	/* A string value is stored as is; the elements of the other types as a 4 byte length then the bytes, each */
+	static std::string encode_value(const snapshot &s) {
+		if (s.type == "string") return s.value.str;
+		std::string out;
+		for (const auto &e: s.value.elements) {
+			const auto length = static_cast<uint32_t>(e.str.size());
+			out.append(reinterpret_cast<const char *>(&length), sizeof(length));
+			out += e.str;
+		}
+		return out;
+	}
+
+	static kv_reply decode_value(const std::string &type, const char *data, size_t size) {
+		kv_reply value;
+		if (type == "string") {
+			value.type = kv_reply::reply_type::string;
+			value.str.assign(data, size);
+			return value;
+		}
+		value.type = kv_reply::reply_type::array;
+		size_t pos = 0;
+		while (pos < size) {
+			uint32_t length = 0;
+			if (size - pos < sizeof(length)) throw std::runtime_error("tiered_connection: corrupt snapshot value");
+			std::memcpy(&length, data + pos, sizeof(length));
+			pos += sizeof(length);
+			if (size - pos < length) throw std::runtime_error("tiered_connection: corrupt snapshot value");
+			kv_reply e;
+			e.type = kv_reply::reply_type::string;
+			e.str.assign(data + pos, length);
+			value.elements.push_back(std::move(e));
+			pos += length;
+		}
+		return value;
+	}
+
+	static void write_snapshot(const std::string &path, const std::vector<std::pair<std::string, snapshot>> &entries) {
+		const int64_t now = wall_clock_ms();
+		snapshot_header header{};
+		std::memcpy(header.magic, snapshot_magic, sizeof(snapshot_magic));
+		header.version = snapshot_version;
+		header.count = static_cast<uint32_t>(entries.size());
+		header.saved_at = now;
+
+		std::string table(reinterpret_cast<const char *>(&header), sizeof(header));
+		std::string data;
+		uint64_t offset = sizeof(header) + entries.size() * sizeof(snapshot_entry);
+		for (const auto &kv: entries) {
+			const std::string value = encode_value(kv.second);
+			snapshot_entry entry{};
+			entry.offset = offset + data.size();
+			entry.key_length = static_cast<uint32_t>(kv.first.size());
+			entry.value_length = static_cast<uint32_t>(value.size());
+			entry.expire_at = kv.second.pttl > 0 ? now + kv.second.pttl : 0;
+			entry.type = static_cast<uint32_t>(std::find(std::begin(snapshot_types), std::end(snapshot_types),
+														 kv.second.type)
+											   - std::begin(snapshot_types));
+			table.append(reinterpret_cast<const char *>(&entry), sizeof(entry));
+			data += kv.first;
+			data += value;
+		}
+
+		const std::string tmp_path = path + ".tmp";
+		const int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+		if (fd < 0) throw_errno("open " + tmp_path);
+		try {
+			for (const std::string *part: {&table, &data}) {
+				size_t done = 0;
+				while (done < part->size()) {
+					const ssize_t n = ::write(fd, part->data() + done, part->size() - done);
+					if (n < 0 && errno == EINTR) continue;
+					if (n < 0) throw_errno("write " + tmp_path);
+					done += static_cast<size_t>(n);
+				}
+			}
+			if (::fsync(fd) != 0) throw_errno("fsync " + tmp_path);
+		}
+		catch (...) {
+			::close(fd);
+			::unlink(tmp_path.c_str());
+			throw;
+		}
+		::close(fd);
+		if (::rename(tmp_path.c_str(), path.c_str()) != 0) {
+			::unlink(tmp_path.c_str());
+			throw_errno("rename " + tmp_path);
+		}
+	}
+
+	/* Maps a snapshot file and decodes its unexpired entries, with their remaining TTLs */
+	static std::vector<std::pair<std::string, snapshot>> read_snapshot(const std::string &path) {
+		std::vector<std::pair<std::string, snapshot>> entries;
+		const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+		if (fd < 0) {
+			if (errno == ENOENT) return entries;
+			throw_errno("open " + path);
+		}
+		struct stat st {};
+		if (::fstat(fd, &st) != 0) {
+			::close(fd);
+			throw_errno("fstat " + path);
+		}
+		const auto size = static_cast<size_t>(st.st_size);
+		void *map = size < sizeof(snapshot_header) ? MAP_FAILED : ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+		if (map == MAP_FAILED) throw std::runtime_error("tiered_connection: " + path + " is not a snapshot");
+		::madvise(map, size, MADV_SEQUENTIAL);
+
+		const char *base = static_cast<const char *>(map);
+		try {
+			snapshot_header header{};
+			std::memcpy(&header, base, sizeof(header));
+			if (std::memcmp(header.magic, snapshot_magic, sizeof(snapshot_magic)) != 0
+				|| header.version != snapshot_version
+				|| (size - sizeof(header)) / sizeof(snapshot_entry) < header.count) {
+				throw std::runtime_error("tiered_connection: " + path + " is not a snapshot");
+			}
+			const int64_t now = wall_clock_ms();
+			entries.reserve(header.count);
+			for (uint32_t i = 0; i < header.count; ++i) {
+				snapshot_entry entry{};
+				std::memcpy(&entry, base + sizeof(header) + i * sizeof(snapshot_entry), sizeof(entry));
+				if (entry.expire_at != 0 && entry.expire_at <= now) continue;
+				if (entry.type >= std::size(snapshot_types) || entry.offset > size
+					|| size - entry.offset < uint64_t(entry.key_length) + entry.value_length) {
+					throw std::runtime_error("tiered_connection: corrupt snapshot entry in " + path);
+				}
+				snapshot s;
+				s.type = snapshot_types[entry.type];
+				s.pttl = entry.expire_at == 0 ? -1 : entry.expire_at - now;
+				s.value = decode_value(s.type, base + entry.offset + entry.key_length, entry.value_length);
+				entries.emplace_back(std::string(base + entry.offset, entry.key_length), std::move(s));
+			}
+		}
+		catch (...) {
+			::munmap(map, size);
+			throw;
+		}
+		::munmap(map, size);
+		return entries;
+	}
+
+	static std::string make_origin() {
+		std::random_device rd;
+		const uint64_t id = (static_cast<uint64_t>(rd()) << 32) ^ rd();
+		static const char digits[] = "0123456789abcdef";
+		std::string s(16, '0');
+		for (int i = 0; i < 16; ++i) {
+			s[i] = digits[(id >> (60 - 4 * i)) & 0xf];
+		}
+		return s;
+	}
+
+	std::shared_ptr<kv_connection> local;
+	std::shared_ptr<kv_connection> remote;
+	tiered_options options;
+	std::unique_ptr<redis_subscriber> subscriber;
+	const std::string origin;
+	bool background{false};
+
+	/* Serializes Redis calls and every change of a key's local copy that involves Redis; taken before state_mutex */
+	std::mutex remote_mutex;
+	/* Guards the residency bookkeeping and the local tier content */
+	mutable std::shared_mutex state_mutex;
+	std::unordered_map<std::string, resident> residents;
+	std::vector<std::string> ring;
+	size_t hand{0};
+	size_t local_bytes{0};
+	std::unordered_map<std::string, unsigned> candidates;
+	size_t misses_since_aging{0};
+	std::atomic<bool> caching{true};
+
+	std::mutex publish_mutex;
+	std::vector<std::string> pending;
+	bool pending_all{false};
+
+	std::atomic<uint64_t> hits{0};
+	std::atomic<uint64_t> misses{0};
+	std::atomic<uint64_t> promotions{0};
+	std::atomic<uint64_t> demotions{0};
+	std::atomic<uint64_t> invalidations{0};
+	std::atomic<uint64_t> flushed{0};
+	std::atomic<uint64_t> flush_errors{0};
+	std::atomic<uint64_t> publish_errors{0};
+	std::atomic<uint64_t> warmed{0};
+	std::atomic<uint64_t> snapshot_errors{0};
+
+	std::mutex wake_mutex;
+	std::condition_variable wake;
+	std::atomic<bool> stopping{false};
+	std::thread flusher;
+	std::thread listener;
+	std::thread warmer;
+};
@@ -0,0 +1,375 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <iomanip>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "redis_template.hpp"
+#include "script.hpp"
+
+/**
+ * @brief A downsampling level of a timeseries: buckets of a fixed width, optionally kept for a limited time.
+ */
+struct rollup_policy {
+	/* The bucket width; buckets start at multiples of it since the epoch */
+	std::chrono::milliseconds resolution;
+	/* How long buckets are kept by timeseries::trim(); zero keeps them forever */
+	std::chrono::milliseconds retention{0};
+};
+
+/**
+ * @brief The aggregate of all samples that fell into one rollup bucket.
+ */
+struct rollup_bucket {
+	/* Start of the bucket, in milliseconds since the epoch */
+	int64_t start{0};
+	double min{0};
+	double max{0};
+	double sum{0};
+	long long count{0};
+
+	[[nodiscard]] double mean() const {
+		return count == 0 ? 0.0 : sum / static_cast<double>(count);
+	}
+};
+
+/**
+ * @brief A numeric time series stored in a sorted set, with incrementally maintained rollups.
+ * * Raw samples live in the sorted set under the series name, scored by their timestamp (milliseconds since the
+ * epoch). Each rollup_policy adds a hash "<name>:rollup:<resolution ms>" with the fields "<bucket>:min", ":max",
+ * ":sum" and ":count", so a long-range chart reads a few hundred buckets instead of millions of raw points.
+ *
+ * Samples are buffered locally and written in batches: flush() pre-aggregates the batch per bucket and sends it
+ * through one Lua script that adds the raw samples, merges the partial aggregates into the rollup hashes and trims
+ * raw samples older than the retention, all atomically and in one round trip.
+ *
+ * An instance is not thread-safe; use one per thread or guard it externally.
+ * @tparam K The key type of the template; the series name is a K.
+ * @tparam V The sample value type; must be arithmetic.
+ */
+template<typename K, typename V>
+class timeseries {
+	static_assert(std::is_arithmetic<V>::value, "timeseries: the value type must be arithmetic");
+
+public:
+	struct sample {
+		/* Milliseconds since the epoch */
+		int64_t timestamp;
+		V value;
+	};
+
+	/**
+	 * @brief Constructor.
+	 * @param tpl The template providing the connection and serializers. Must outlive the series.
+	 * @param name The series name (K).
+	 * @param retention How long raw samples are kept; zero keeps them forever.
+	 * @param rollups The downsampling levels to maintain.
+	 * @param batch_size The number of buffered samples that triggers an automatic flush.
+	 */
+	timeseries(redis_template<K, V> &tpl, const K &name, std::chrono::milliseconds retention,
+			   std::vector<rollup_policy> rollups = {}, size_t batch_size = 512) :
+		tpl(tpl), name(tpl.serialize_key(name)), retention(retention), rollups(std::move(rollups)),
+		batch_size(batch_size == 0 ? 1 : batch_size), script(append_source()) {
+		for (const auto &r: this->rollups) {
+			if (r.resolution.count() <= 0) {
+				throw std::invalid_argument("timeseries: rollup resolution must be positive");
+			}
+		}
+		std::random_device rd;
+		std::ostringstream oss;
+		oss << std::hex << ((static_cast<uint64_t>(rd()) << 32) | rd());
+		writer_id = oss.str();
+	}
+
+	/**
+	 * @brief Flushes buffered samples; errors are swallowed because a destructor must not throw.
+	 */
+	~timeseries() {
+		try {
+			flush();
+		}
+		catch (const std::exception &) {
+		}
+	}
+
+	timeseries(const timeseries &) = delete;
+	timeseries &operator=(const timeseries &) = delete;
+
+	/**
+	 * @brief Buffers a sample stamped with the current time.
+	 */
+	void add(const V &value) {
+		add(now(), value);
+	}
+
+	/**
+	 * @brief Buffers a sample; flushes when the batch is full.
+	 * @param timestamp Milliseconds since the epoch.
+	 * @param value The sample value.
+	 */
+	void add(int64_t timestamp, const V &value) {
+		pending.push_back({timestamp, value});
+		if (pending.size() >= batch_size) flush();
+	}
+
+	/**
+	 * @brief Writes all buffered samples and their rollup updates in one script call, trimming expired raw samples.
+	 * @return The number of samples written.
+	 */
+	size_t flush() {
+		if (pending.empty()) return 0;
+
+		std::vector<std::string> keys{name};
+		for (const auto &r: rollups) {
+			keys.push_back(rollup_key(r.resolution));
+		}
+
+		std::vector<std::string> args;
+		args.reserve(3 + pending.size() * 2 + rollups.size() * (1 + pending.size() * 5));
+		args.push_back(retention.count() > 0 ? std::to_string(now() - retention.count()) : "");
+		args.push_back(std::to_string(pending.size()));
+		for (const auto &s: pending) {
+			args.push_back(std::to_string(s.timestamp));
+			args.push_back(writer_id + "." + std::to_string(sequence++) + ":" + tpl.serialize_value(s.value));
+		}
+
+		// Pre-aggregate the batch so the script merges one partial aggregate per touched bucket
+		for (const auto &r: rollups) {
+			std::vector<rollup_bucket> buckets;
+			std::unordered_map<int64_t, size_t> index;
+			for (const auto &s: pending) {
+				const int64_t start = bucket_start(s.timestamp, r.resolution);
+				const auto v = static_cast<double>(s.value);
+				auto it = index.find(start);
+				if (it == index.end()) {
+					index.emplace(start, buckets.size());
+					buckets.push_back({start, v, v, v, 1});
+					continue;
+				}
+				rollup_bucket &b = buckets[it->second];
+				b.min = std::min(b.min, v);
+				b.max = std::max(b.max, v);
+				b.sum += v;
+				++b.count;
+			}
+			args.push_back(std::to_string(buckets.size()));
+			for (const auto &b: buckets) {
+				args.push_back(std::to_string(b.start));
+				args.push_back(format(b.min));
+				args.push_back(format(b.max));
+				args.push_back(format(b.sum));
+				args.push_back(std::to_string(b.count));
+			}
+		}
+
+		script.execute(tpl.get_connection(), keys, args);
+		const size_t written = pending.size();
+		pending.clear();
+		return written;
+	}
+
+	/**
+	 * @brief Returns the raw samples within a time range (inclusive), oldest first. Buffered samples are flushed first.
+	 * @param from Milliseconds since the epoch.
+	 * @param to Milliseconds since the epoch.
+	 */
+	std::vector<sample> range(int64_t from, int64_t to) {
+		flush();
+		auto members = tpl.get_connection().zrangebyscore_withscores(name, static_cast<double>(from),
+																	   static_cast<double>(to));
+		std::vector<sample> result;
+		result.reserve(members.size());
+		for (const auto &m: members) {
+			const auto colon = m.first.find(':');
+			if (colon == std::string::npos) throw std::runtime_error("timeseries: malformed sample member");
+			result.push_back({static_cast<int64_t>(m.second), tpl.deserialize_value(m.first.substr(colon + 1))});
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Returns the non-empty rollup buckets of one resolution overlapping a time range, oldest first.
+	 * @param resolution One of the configured rollup resolutions.
+	 * @param from Milliseconds since the epoch.
+	 * @param to Milliseconds since the epoch.
+	 * @throw std::invalid_argument if no rollup with this resolution is configured.
+	 */
+	std::vector<rollup_bucket> rollup(std::chrono::milliseconds resolution, int64_t from, int64_t to) {
+		bool configured = false;
+		for (const auto &r: rollups) {
+			configured = configured || r.resolution == resolution;
+		}
+		if (!configured) throw std::invalid_argument("timeseries: no rollup with this resolution");
+		flush();
+
+		static const char *const suffixes[] = {":min", ":max", ":sum", ":count"};
+		const std::string key = rollup_key(resolution);
+		std::vector<int64_t> starts;
+		for (int64_t b = bucket_start(from, resolution); b <= to; b += resolution.count()) {
+			starts.push_back(b);
+		}
+
+		std::vector<std::vector<std::string>> commands;
+		for (size_t i = 0; i < starts.size(); i += buckets_per_command) {
+			std::vector<std::string> cmd{"HMGET", key};
+			for (size_t j = i; j < starts.size() && j < i + buckets_per_command; ++j) {
+				for (const char *suffix: suffixes) {
+					cmd.push_back(std::to_string(starts[j]) + suffix);
+				}
+			}
+			commands.push_back(std::move(cmd));
+		}
+		auto replies = tpl.get_connection().pipeline(commands);
+
+		std::vector<rollup_bucket> result;
+		for (size_t c = 0; c < replies.size(); ++c) {
+			if (replies[c].is_error()) throw std::runtime_error("HMGET: " + replies[c].str);
+			const auto &fields = replies[c].elements;
+			for (size_t j = 0; j + 3 < fields.size(); j += 4) {
+				if (fields[j + 3].is_nil()) continue;
+				rollup_bucket b;
+				b.start = starts[c * buckets_per_command + j / 4];
+				b.min = std::stod(fields[j].str);
+				b.max = std::stod(fields[j + 1].str);
+				b.sum = std::stod(fields[j + 2].str);
+				b.count = std::stoll(fields[j + 3].str);
+				result.push_back(b);
+			}
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Removes raw samples older than the retention (ZREMRANGEBYSCORE) and rollup buckets older than their
+	 * policy's retention.
+	 * @return The number of raw samples removed.
+	 */
+	long long trim() {
+		flush();
+		kv_connection &conn = tpl.get_connection();
+		const int64_t current = now();
+		long long removed = 0;
+		if (retention.count() > 0) {
+			removed = conn.zremrangebyscore(name, -INFINITY, static_cast<double>(current - retention.count() - 1));
+		}
+
+		for (const auto &r: rollups) {
+			if (r.retention.count() <= 0) continue;
+			const std::string key = rollup_key(r.resolution);
+			const int64_t cutoff = current - r.retention.count();
+			std::vector<std::string> expired;
+			for (const auto &field: conn.hkeys(key)) {
+				// A bucket goes once it has ended before the cutoff
+				if (std::stoll(field.substr(0, field.find(':'))) + r.resolution.count() <= cutoff) {
+					expired.push_back(field);
+				}
+			}
+			if (!expired.empty()) conn.hdel(key, expired);
+		}
+		return removed;
+	}
+
+	/**
+	 * @brief Deletes the raw samples and all rollups, and drops buffered samples.
+	 * @return The number of keys removed.
+	 */
+	long long clear() {
+		pending.clear();
+		std::vector<std::string> keys{name};
+		for (const auto &r: rollups) {
+			keys.push_back(rollup_key(r.resolution));
+		}
+		return tpl.get_connection().del(keys);
+	}
+
+	[[nodiscard]] size_t pending_count() const {
+		return pending.size();
+	}
+
+	static int64_t now() {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(
+					   std::chrono::system_clock::now().time_since_epoch())
+			.count();
+	}
+
+private:
+	/* Buckets per HMGET command when reading rollups (4 fields each) */
+	static constexpr size_t buckets_per_command = 1024;
+
+	std::string rollup_key(std::chrono::milliseconds resolution) const {
+		return name + ":rollup:" + std::to_string(resolution.count());
+	}
+
+	/* Floors towards negative infinity so pre-epoch timestamps land in the right bucket */
+	static int64_t bucket_start(int64_t timestamp, std::chrono::milliseconds resolution) {
+		const int64_t width = resolution.count();
+		const int64_t rem = timestamp % width;
+		return timestamp - (rem < 0 ? rem + width : rem);
+	}
+
+	static std::string format(double v) {
+		std::ostringstream oss;
+		oss << std::setprecision(17) << v;
+		return oss.str();
+	}
+
+	/*
+	 * KEYS[1] = raw sorted set, KEYS[2..] = rollup hashes.
+	 * ARGV = raw cutoff ("" for none), n, n x (timestamp, member), then per rollup hash:
+	 * m, m x (bucket, min, max, sum, count).
+	 */
+	static std::string append_source() {
+		return R"lua(
+local n = tonumber(ARGV[2])
+local pos = 3
+for i = 1, n do
+	redis.call('ZADD', KEYS[1], ARGV[pos], ARGV[pos + 1])
+	pos = pos + 2
+end
+for k = 2, #KEYS do
+	local h = KEYS[k]
+	local m = tonumber(ARGV[pos])
+	pos = pos + 1
+	for i = 1, m do
+		local b = ARGV[pos]
+		redis.call('HINCRBY', h, b .. ':count', ARGV[pos + 4])
+		redis.call('HINCRBYFLOAT', h, b .. ':sum', ARGV[pos + 3])
+		local mn = redis.call('HGET', h, b .. ':min')
+		if not mn or tonumber(ARGV[pos + 1]) < tonumber(mn) then
+			redis.call('HSET', h, b .. ':min', ARGV[pos + 1])
+		end
+		local mx = redis.call('HGET', h, b .. ':max')
+		if not mx or tonumber(ARGV[pos + 2]) > tonumber(mx) then
+			redis.call('HSET', h, b .. ':max', ARGV[pos + 2])
+		end
+		pos = pos + 5
+	end
+end
+if ARGV[1] ~= '' then
+	redis.call('ZREMRANGEBYSCORE', KEYS[1], '-inf', '(' .. ARGV[1])
+end
+return n
+)lua";
+	}
+
+	redis_template<K, V> &tpl;
+	std::string name;
+	std::chrono::milliseconds retention;
+	std::vector<rollup_policy> rollups;
+	size_t batch_size;
+	lua_script script;
+
+	/* Makes raw members unique, so equal values at the same timestamp are all kept */
+	std::string writer_id;
+	uint64_t sequence{0};
+	std::vector<sample> pending;
+};
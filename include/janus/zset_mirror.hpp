@@ -0,0 +1,418 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "redis_template.hpp"
+#include "script.hpp"
+#include "skiplist.hpp"
+
+/**
+ * @brief An in-process copy of a sorted set that answers range, score and rank queries locally in O(log n).
+ * * The mirror loads the sorted set once and then follows a companion change stream "<key>:changes". Writes made
+ * through zadd(), zincrby() and zrem() update the sorted set and append the resulting member state, numbered by the
+ * counter "<key>:changes:seq", to the stream in one Lua script, so every mirror of the key can replay them. The
+ * snapshot is read in a transaction together with the counter, so replay resumes exactly after it.
+ *
+ * Reads sync with the stream at most once per max_staleness; in between they never leave the process. If the stream
+ * was trimmed past changes not yet applied (a gap in the numbering), the mirror reloads the whole sorted set. Writes
+ * that bypass the mirror (plain ZADD) are only picked up by reload().
+ *
+ * The mirror is thread-safe: reads share a lock, syncing takes it exclusively and serializes all server calls.
+ * @tparam K The key type of the template.
+ * @tparam V The member type of the sorted set.
+ */
+template<typename K, typename V>
+class zset_mirror {
+public:
+	/**
+	 * @brief Constructor. Loads the sorted set.
+	 * @param tpl The template providing the connection and serializers. Must outlive the mirror.
+	 * @param key The sorted set key (K).
+	 * @param max_staleness How old the local copy may get before a read syncs with the change stream.
+	 * @param stream_max_length The approximate number of changes kept in the stream (XADD MAXLEN ~).
+	 */
+	zset_mirror(redis_template<K, V> &tpl, const K &key,
+				std::chrono::milliseconds max_staleness = std::chrono::milliseconds(100),
+				long long stream_max_length = 10000) :
+		tpl(tpl), key(tpl.serialize_key(key)), stream(this->key + ":changes"), sequence_key(stream + ":seq"),
+		max_staleness(max_staleness), stream_max_length(stream_max_length), write_script(write_source()) {
+		reload();
+	}
+
+	// ==========================================================
+	// Local reads
+	// ==========================================================
+
+	/**
+	 * @brief Returns members by rank, lowest score first. (Local equivalent of ZRANGE)
+	 */
+	std::vector<V> zrange(long long start, long long stop) {
+		return members(range_withscores(start, stop, false));
+	}
+
+	/**
+	 * @brief Returns members by rank, highest score first. (Local equivalent of ZREVRANGE)
+	 */
+	std::vector<V> zrevrange(long long start, long long stop) {
+		return members(range_withscores(start, stop, true));
+	}
+
+	/**
+	 * @brief Returns members and scores by rank, lowest score first. (Local equivalent of ZRANGE ... WITHSCORES)
+	 */
+	std::vector<std::pair<V, double>> zrange_withscores(long long start, long long stop) {
+		return range_withscores(start, stop, false);
+	}
+
+	/**
+	 * @brief Returns members and scores by rank, highest score first. (Local equivalent of ZREVRANGE ... WITHSCORES)
+	 */
+	std::vector<std::pair<V, double>> zrevrange_withscores(long long start, long long stop) {
+		return range_withscores(start, stop, true);
+	}
+
+	/**
+	 * @brief Returns members with a score between min and max (inclusive). (Local equivalent of ZRANGEBYSCORE)
+	 */
+	std::vector<std::pair<V, double>> zrangebyscore_withscores(double min, double max) {
+		refresh_if_stale();
+		std::shared_lock<std::shared_mutex> lock(data_mutex);
+		std::vector<std::pair<V, double>> result;
+		for (auto *n = list.lower_bound(min); n && n->score <= max; n = n->next()) {
+			result.emplace_back(tpl.deserialize_value(n->member), n->score);
+		}
+		return result;
+	}
+
+	/**
+	 * @brief Returns the score of a member. (Local equivalent of ZSCORE)
+	 */
+	std::optional<double> zscore(const V &member) {
+		refresh_if_stale();
+		const std::string raw = tpl.serialize_value(member);
+		std::shared_lock<std::shared_mutex> lock(data_mutex);
+		auto it = scores.find(raw);
+		if (it == scores.end()) return std::nullopt;
+		return it->second;
+	}
+
+	/**
+	 * @brief Returns the 0-based rank of a member, lowest score first. (Local equivalent of ZRANK)
+	 */
+	std::optional<long long> zrank(const V &member) {
+		return rank(member, false);
+	}
+
+	/**
+	 * @brief Returns the 0-based rank of a member, highest score first. (Local equivalent of ZREVRANK)
+	 */
+	std::optional<long long> zrevrank(const V &member) {
+		return rank(member, true);
+	}
+
+	/**
+	 * @brief Returns the number of members. (Local equivalent of ZCARD)
+	 */
+	long long zcard() {
+		refresh_if_stale();
+		std::shared_lock<std::shared_mutex> lock(data_mutex);
+		return static_cast<long long>(list.size());
+	}
+
+	// ==========================================================
+	// Writes (server first, then local)
+	// ==========================================================
+
+	/**
+	 * @brief Adds a member or updates its score, and publishes the change.
+	 * @return True if the member was added, false if its score was updated.
+	 */
+	bool zadd(const V &member, double score) {
+		auto r = write("add", tpl.serialize_value(member), format_score(score));
+		return r.first == 1;
+	}
+
+	/**
+	 * @brief Increments the score of a member, and publishes the change.
+	 * @return The new score.
+	 */
+	double zincrby(const V &member, double increment) {
+		return *write("incr", tpl.serialize_value(member), format_score(increment)).second;
+	}
+
+	/**
+	 * @brief Removes a member, and publishes the change.
+	 * @return True if the member was removed.
+	 */
+	bool zrem(const V &member) {
+		return write("rem", tpl.serialize_value(member), "").first == 1;
+	}
+
+	// ==========================================================
+	// Synchronization
+	// ==========================================================
+
+	/**
+	 * @brief Replaces the local copy with the current content of the sorted set.
+	 */
+	void reload() {
+		std::lock_guard<std::mutex> remote(remote_mutex);
+		reload_locked();
+	}
+
+	/**
+	 * @brief Applies all changes published since the last sync.
+	 * @return The number of changes applied; a full reload counts as one.
+	 */
+	size_t sync() {
+		std::lock_guard<std::mutex> remote(remote_mutex);
+		return sync_locked();
+	}
+
+	/**
+	 * @brief Returns the id of the last applied change stream entry ("0-0" if none).
+	 */
+	std::string get_last_id() {
+		std::lock_guard<std::mutex> remote(remote_mutex);
+		return format_id(last_id);
+	}
+
+private:
+	using stream_id = std::pair<uint64_t, uint64_t>;
+
+	/* Changes read per XREAD call */
+	static constexpr long long read_batch = 1000;
+
+	std::vector<std::pair<V, double>> range_withscores(long long start, long long stop, bool reverse) {
+		refresh_if_stale();
+		std::shared_lock<std::shared_mutex> lock(data_mutex);
+		const auto size = static_cast<long long>(list.size());
+		if (start < 0) start = std::max(0LL, size + start);
+		if (stop < 0) stop += size;
+		if (stop >= size) stop = size - 1;
+		std::vector<std::pair<V, double>> result;
+		if (start > stop) return result;
+
+		result.reserve(static_cast<size_t>(stop - start + 1));
+		const long long first = reverse ? size - 1 - stop : start;
+		const auto *n = list.at(static_cast<size_t>(first));
+		for (long long i = start; i <= stop && n; ++i, n = n->next()) {
+			result.emplace_back(tpl.deserialize_value(n->member), n->score);
+		}
+		if (reverse) std::reverse(result.begin(), result.end());
+		return result;
+	}
+
+	std::vector<V> members(const std::vector<std::pair<V, double>> &entries) const {
+		std::vector<V> result;
+		result.reserve(entries.size());
+		for (const auto &e: entries) {
+			result.push_back(e.first);
+		}
+		return result;
+	}
+
+	std::optional<long long> rank(const V &member, bool reverse) {
+		refresh_if_stale();
+		const std::string raw = tpl.serialize_value(member);
+		std::shared_lock<std::shared_mutex> lock(data_mutex);
+		auto it = scores.find(raw);
+		if (it == scores.end()) return std::nullopt;
+		const long long r = list.rank(it->second, raw);
+		return reverse ? static_cast<long long>(list.size()) - 1 - r : r;
+	}
+
+	void refresh_if_stale() {
+		if (std::chrono::steady_clock::now() - last_sync.load() < max_staleness) return;
+		std::unique_lock<std::mutex> remote(remote_mutex, std::try_to_lock);
+		// Another thread is already syncing; serve the current copy instead of waiting
+		if (!remote.owns_lock()) return;
+		if (std::chrono::steady_clock::now() - last_sync.load() < max_staleness) return;
+		sync_locked();
+	}
+
+	std::pair<long long, std::optional<double>> write(const char *op, const std::string &member,
+													  const std::string &arg) {
+		std::lock_guard<std::mutex> remote(remote_mutex);
+		auto r = write_script.execute(tpl.get_connection(), {key, stream, sequence_key},
+									  {op, member, arg, std::to_string(stream_max_length)});
+		if (r.type != kv_reply::reply_type::array || r.elements.empty()) {
+			throw std::runtime_error("zset_mirror: unexpected script reply");
+		}
+		std::optional<double> score;
+		if (r.elements.size() > 1) score = std::stod(r.elements[1].str);
+		// Catch up to (and including) the change just published so local reads see our own write
+		sync_locked();
+		return {r.elements[0].integer, score};
+	}
+
+	void reload_locked() {
+		// One transaction reads a consistent snapshot together with the position of the change stream
+		auto replies = tpl.get_connection().pipeline({{"MULTI"},
+													   {"GET", sequence_key},
+													   {"XREVRANGE", stream, "+", "-", "COUNT", "1"},
+													   {"ZRANGE", key, "0", "-1", "WITHSCORES"},
+													   {"EXEC"}});
+		const kv_reply &exec = replies.back();
+		if (exec.type != kv_reply::reply_type::array || exec.elements.size() != 3) {
+			throw std::runtime_error("zset_mirror: snapshot failed" + (exec.is_error() ? ": " + exec.str : ""));
+		}
+		for (const auto &r: exec.elements) {
+			if (r.is_error()) throw std::runtime_error("zset_mirror: " + r.str);
+		}
+
+		const auto &entries = exec.elements[2].elements;
+		{
+			std::unique_lock<std::shared_mutex> lock(data_mutex);
+			list.clear();
+			scores.clear();
+			for (size_t i = 0; i + 1 < entries.size(); i += 2) {
+				const double score = std::stod(entries[i + 1].str);
+				scores.emplace(entries[i].str, score);
+				list.insert(score, entries[i].str);
+			}
+		}
+		last_sequence = exec.elements[0].is_nil() ? 0 : std::stoll(exec.elements[0].str);
+		last_id = exec.elements[1].elements.empty() ? stream_id{0, 0}
+													: parse_id(exec.elements[1].elements[0].elements[0].str);
+		last_sync = std::chrono::steady_clock::now();
+	}
+
+	size_t sync_locked() {
+		size_t applied = 0;
+		while (true) {
+			auto replies = tpl.get_connection().pipeline(
+				{{"XREAD", "COUNT", std::to_string(read_batch), "STREAMS", stream, format_id(last_id)}});
+			const kv_reply &read = replies[0];
+			if (read.is_error()) throw std::runtime_error("XREAD: " + read.str);
+			if (read.is_nil() || read.elements.empty()) break;
+
+			const auto &changes = read.elements[0].elements[1].elements;
+			std::unique_lock<std::shared_mutex> lock(data_mutex);
+			for (const auto &change: changes) {
+				const long long sequence = apply(change.elements[1].elements);
+				if (sequence > last_sequence + 1) {
+					// Changes between the last applied one and this one were trimmed from the stream
+					lock.unlock();
+					reload_locked();
+					return applied + 1;
+				}
+				last_sequence = std::max(last_sequence, sequence);
+				last_id = parse_id(change.elements[0].str);
+				++applied;
+			}
+			if (static_cast<long long>(changes.size()) < read_batch) break;
+		}
+		last_sync = std::chrono::steady_clock::now();
+		return applied;
+	}
+
+	/*
+	 * Fields: n <sequence> m <member> [s <score>]; without a score the member was removed. Applies the change only if
+	 * it directly follows the last applied one and returns its sequence number.
+	 */
+	long long apply(const std::vector<kv_reply> &fields) {
+		long long sequence = 0;
+		const std::string *member = nullptr;
+		std::optional<double> score;
+		for (size_t i = 0; i + 1 < fields.size(); i += 2) {
+			if (fields[i].str == "n") sequence = std::stoll(fields[i + 1].str);
+			if (fields[i].str == "m") member = &fields[i + 1].str;
+			if (fields[i].str == "s") score = std::stod(fields[i + 1].str);
+		}
+		if (!member || sequence != last_sequence + 1) return sequence;
+
+		auto it = scores.find(*member);
+		if (it != scores.end()) {
+			list.erase(it->second, *member);
+			if (!score) {
+				scores.erase(it);
+				return sequence;
+			}
+			it->second = *score;
+		}
+		else if (!score) {
+			return sequence;
+		}
+		else {
+			scores.emplace(*member, *score);
+		}
+		list.insert(*score, *member);
+		return sequence;
+	}
+
+	static stream_id parse_id(const std::string &id) {
+		const auto dash = id.find('-');
+		if (dash == std::string::npos) throw std::runtime_error("zset_mirror: malformed stream id " + id);
+		return {std::stoull(id.substr(0, dash)), std::stoull(id.substr(dash + 1))};
+	}
+
+	/* Round-trips every double; std::to_string would keep 6 decimals */
+	static std::string format_score(double score) {
+		char buffer[32];
+		std::snprintf(buffer, sizeof(buffer), "%.17g", score);
+		return buffer;
+	}
+
+	static std::string format_id(const stream_id &id) {
+		return std::to_string(id.first) + "-" + std::to_string(id.second);
+	}
+
+	/*
+	 * KEYS[1] = sorted set, KEYS[2] = change stream, KEYS[3] = change sequence counter.
+	 * ARGV = op ("add", "incr", "rem"), member, score or increment, stream max length.
+	 * Returns {changed, score} for add/incr and {removed} for rem.
+	 */
+	static std::string write_source() {
+		return R"lua(
+if ARGV[1] == 'rem' then
+	local removed = redis.call('ZREM', KEYS[1], ARGV[2])
+	if removed == 1 then
+		local n = redis.call('INCR', KEYS[3])
+		redis.call('XADD', KEYS[2], 'MAXLEN', '~', ARGV[4], '*', 'n', n, 'm', ARGV[2])
+	end
+	return {removed}
+end
+local changed = 0
+if ARGV[1] == 'add' then
+	changed = redis.call('ZADD', KEYS[1], ARGV[3], ARGV[2])
+else
+	redis.call('ZINCRBY', KEYS[1], ARGV[3], ARGV[2])
+end
+local score = redis.call('ZSCORE', KEYS[1], ARGV[2])
+local n = redis.call('INCR', KEYS[3])
+redis.call('XADD', KEYS[2], 'MAXLEN', '~', ARGV[4], '*', 'n', n, 'm', ARGV[2], 's', score)
+return {changed, score}
+)lua";
+	}
+
+	redis_template<K, V> &tpl;
+	std::string key;
+	std::string stream;
+	std::string sequence_key;
+	std::chrono::milliseconds max_staleness;
+	long long stream_max_length;
+	lua_script write_script;
+
+	std::shared_mutex data_mutex;
+	order_statistic_skiplist list;
+	std::unordered_map<std::string, double> scores;
+
+	/* Serializes server calls; the connection is not thread-safe */
+	std::mutex remote_mutex;
+	stream_id last_id{0, 0};
+	long long last_sequence{0};
+	std::atomic<std::chrono::steady_clock::time_point> last_sync{};
+};
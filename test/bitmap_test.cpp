@@ -0,0 +1,170 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class bitmap_operations_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = std::string;
+
+	const key_type TEST_KEY_A = "test_bitmap_a";
+	const key_type TEST_KEY_B = "test_bitmap_b";
+	const key_type TEST_KEY_DEST = "test_bitmap_dest";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		tpl->del(std::vector<key_type>{TEST_KEY_A, TEST_KEY_B, TEST_KEY_DEST});
+	}
+
+	// Helper function to get Bitmap operations interface
+	[[nodiscard]] auto &bitmap_ops() const {
+		return tpl->ops_for_bitmap();
+	}
+};
+
+// --- Test Cases ---
+
+TEST_F(bitmap_operations_test, setbit_getbit_bitcount) {
+	EXPECT_FALSE(bitmap_ops().setbit(TEST_KEY_A, 7, true)) << "SETBIT should return the previous bit (0).";
+	EXPECT_TRUE(bitmap_ops().setbit(TEST_KEY_A, 7, true)) << "SETBIT should return the previous bit (1).";
+	EXPECT_TRUE(bitmap_ops().getbit(TEST_KEY_A, 7));
+	EXPECT_FALSE(bitmap_ops().getbit(TEST_KEY_A, 6));
+	EXPECT_FALSE(bitmap_ops().getbit(TEST_KEY_A, 100000)) << "GETBIT beyond the string should return 0.";
+
+	bitmap_ops().setbit(TEST_KEY_A, 8, true);
+	EXPECT_EQ(bitmap_ops().bitcount(TEST_KEY_A), 2);
+	EXPECT_EQ(bitmap_ops().bitcount(TEST_KEY_A, 1, 1), 1);
+
+	EXPECT_EQ(bitmap_ops().bitpos(TEST_KEY_A, true, 0, -1), 7);
+	EXPECT_EQ(bitmap_ops().bitpos(TEST_KEY_A, false, 0, -1), 0);
+}
+
+TEST_F(bitmap_operations_test, batched_bits) {
+	std::vector<long long> days = {0, 3, 17, 364};
+	auto previous = bitmap_ops().setbits(TEST_KEY_A, days, true);
+	EXPECT_EQ(previous, (std::vector<bool>{false, false, false, false}));
+
+	auto bits = bitmap_ops().getbits(TEST_KEY_A, {0, 1, 3, 17, 364, 365});
+	EXPECT_EQ(bits, (std::vector<bool>{true, false, true, true, true, false}));
+	EXPECT_EQ(bitmap_ops().bitcount(TEST_KEY_A), 4);
+}
+
+TEST_F(bitmap_operations_test, bitop) {
+	bitmap_ops().setbits(TEST_KEY_A, {0, 1}, true);
+	bitmap_ops().setbits(TEST_KEY_B, {1, 2}, true);
+
+	EXPECT_EQ(bitmap_ops().bitop(bitwise_op::bit_and, TEST_KEY_DEST, {TEST_KEY_A, TEST_KEY_B}), 1);
+	EXPECT_EQ(bitmap_ops().getbits(TEST_KEY_DEST, {0, 1, 2}), (std::vector<bool>{false, true, false}));
+
+	bitmap_ops().bitop(bitwise_op::bit_or, TEST_KEY_DEST, {TEST_KEY_A, TEST_KEY_B});
+	EXPECT_EQ(bitmap_ops().bitcount(TEST_KEY_DEST), 3);
+
+	bitmap_ops().bitop(bitwise_op::bit_not, TEST_KEY_DEST, {TEST_KEY_A});
+	EXPECT_EQ(bitmap_ops().bitcount(TEST_KEY_DEST), 6);
+}
+
+TEST_F(bitmap_operations_test, typed_bitfield) {
+	// Three u8 counters and one i16 counter packed in one string
+	bitfield_command init;
+	init.set_nth(bitfield_type::u(8), 0, 10).set_nth(bitfield_type::u(8), 1, 250).set(bitfield_type::i(16), 24, -5);
+	auto old_values = bitmap_ops().bitfield<3>(TEST_KEY_A, init);
+	EXPECT_EQ(old_values[0], 0);
+	EXPECT_EQ(old_values[2], 0);
+
+	bitfield_command update;
+	update.incrby_nth(bitfield_type::u(8), 0, 5)
+		.with_overflow(bitfield_command::overflow::sat)
+		.incrby_nth(bitfield_type::u(8), 1, 10)
+		.with_overflow(bitfield_command::overflow::fail)
+		.incrby_nth(bitfield_type::u(8), 1, 10)
+		.get(bitfield_type::i(16), 24);
+	auto values = bitmap_ops().bitfield<4>(TEST_KEY_A, update);
+	EXPECT_EQ(values[0], 15);
+	EXPECT_EQ(values[1], 255) << "OVERFLOW SAT should saturate at the type maximum.";
+	EXPECT_EQ(values[2], std::nullopt) << "OVERFLOW FAIL should yield a nil result.";
+	EXPECT_EQ(values[3], -5);
+
+	EXPECT_THROW(bitmap_ops().bitfield<2>(TEST_KEY_A, update), std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
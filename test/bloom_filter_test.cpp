@@ -0,0 +1,163 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class bloom_filter_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = unsigned int;
+	using filter_type = bloom_filter<key_type, value_type>;
+
+	const key_type TEST_KEY = "test_bloom_filter";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		filter_type(*tpl, TEST_KEY, 100000, 0.01).clear();
+	}
+};
+
+// --- Test Cases ---
+
+TEST_F(bloom_filter_test, sizing) {
+	filter_type filter(*tpl, TEST_KEY, 100000, 0.01);
+
+	// m = -n ln(p) / ln(2)^2 ~ 958506 bits, k = m / n ln(2) ~ 7
+	EXPECT_EQ(filter.hash_count(), 7);
+	EXPECT_GE(filter.bit_count(), 958506);
+	EXPECT_EQ(filter.segment_count(), 1);
+
+	filter_type large(*tpl, TEST_KEY, 10000000, 0.01);
+	EXPECT_EQ(large.segment_count(), 12) << "95.8 Mbit should span twelve 8 Mbit segments.";
+}
+
+TEST_F(bloom_filter_test, add_and_contains) {
+	filter_type filter(*tpl, TEST_KEY, 100000, 0.01);
+
+	EXPECT_TRUE(filter.add(42U)) << "First add of an item should report it as new.";
+	EXPECT_FALSE(filter.add(42U)) << "Second add of an item should report it as possibly present.";
+	EXPECT_TRUE(filter.contains(42U));
+
+	std::vector<value_type> items;
+	for (value_type i = 1000; i < 6000; ++i) {
+		items.push_back(i);
+	}
+	filter.add(items);
+
+	auto present = filter.contains(items);
+	for (size_t i = 0; i < items.size(); ++i) {
+		ASSERT_TRUE(present[i]) << "Added item " << items[i] << " reported as absent.";
+	}
+
+	std::vector<value_type> others;
+	for (value_type i = 100000; i < 120000; ++i) {
+		others.push_back(i);
+	}
+	auto false_positives = filter.contains(others);
+	size_t count = 0;
+	for (bool fp: false_positives) {
+		count += fp ? 1 : 0;
+	}
+	// Filled to 5% of capacity, the false positive rate is far below 1%
+	EXPECT_LT(count, 200U) << "Too many false positives.";
+}
+
+TEST_F(bloom_filter_test, local_cache) {
+	filter_type writer(*tpl, TEST_KEY, 100000, 0.01);
+	filter_type reader(*tpl, TEST_KEY, 100000, 0.01);
+	reader.enable_local_cache(std::chrono::minutes(1));
+
+	writer.add({1U, 2U, 3U});
+	EXPECT_EQ(reader.contains(std::vector<value_type>{1U, 2U, 3U}), (std::vector<bool>{true, true, true}));
+
+	// Items added elsewhere are not visible until the cached segment is refreshed
+	writer.add(4U);
+	EXPECT_FALSE(reader.contains(4U));
+	reader.invalidate_local_cache();
+	EXPECT_TRUE(reader.contains(4U));
+
+	// Items added through the caching instance are visible immediately
+	reader.add(5U);
+	EXPECT_TRUE(reader.contains(5U));
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,161 @@
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+namespace {
+std::string binary_record(const std::vector<std::string> &argv) {
+	std::string out;
+	auto u32 = [&out](size_t v) {
+		for (int i = 0; i < 4; ++i) {
+			out += static_cast<char>((v >> (8 * i)) & 0xff);
+		}
+	};
+	u32(argv.size());
+	for (const auto &arg: argv) {
+		u32(arg.size());
+		out += arg;
+	}
+	return out;
+}
+} // namespace
+
+TEST(bulk_loader_test, typed_records_over_several_connections) {
+	auto store = std::make_shared<memory_connection>();
+	redis_template<std::string, int> tpl(store, std::make_shared<string_serializer<std::string>>(),
+										 std::make_shared<string_serializer<int>>());
+	bulk_load_options options;
+	options.batch_size = 64;
+	int progress_calls = 0;
+	options.on_progress = [&progress_calls](const bulk_load_stats &) { ++progress_calls; };
+	options.progress_interval = std::chrono::milliseconds(0);
+	bulk_loader loader(std::vector<std::shared_ptr<kv_connection>>(4, store), options);
+
+	for (int i = 0; i < 10000; ++i) {
+		loader.set(tpl, "k" + std::to_string(i), i);
+	}
+	loader.set(tpl, std::string("ttl"), 1, std::chrono::seconds(60));
+	loader.hset(tpl, std::string("h"), std::unordered_map<std::string, int>{{"a", 1}, {"b", 2}});
+	loader.rpush(tpl, std::string("l"), std::vector<int>{1, 2, 3}, std::chrono::seconds(60));
+	loader.sadd(tpl, std::string("s"), std::vector<int>{4, 5});
+	loader.zadd(tpl, std::string("z"), std::vector<std::pair<int, double>>{{7, 0.1}, {8, -2.5}});
+	// Commands of one key keep their order across connections
+	for (int i = 0; i < 1000; ++i) {
+		loader.command({"INCR", "counter"});
+	}
+	const bulk_load_stats stats = loader.finish();
+
+	EXPECT_EQ(stats.queued, 10000u + 6 + 1000);
+	EXPECT_EQ(stats.replied, stats.queued);
+	EXPECT_EQ(stats.errors, 0u);
+	EXPECT_GT(stats.bytes, 10000u * 20);
+	EXPECT_GT(progress_calls, 1);
+	EXPECT_EQ(tpl.ops_for_value().get("k9999").value_or(0), 9999);
+	EXPECT_GT(store->pttl("ttl"), 0);
+	EXPECT_EQ(store->hget("h", "b").value_or(""), "2");
+	EXPECT_EQ(store->lrange("l", 0, -1), (std::vector<std::string>{"1", "2", "3"}));
+	EXPECT_GT(store->pttl("l"), 0);
+	EXPECT_EQ(store->scard("s"), 2);
+	EXPECT_EQ(store->zscore("z", "8").value_or(0), -2.5);
+	EXPECT_EQ(store->get("counter").value_or(""), "1000");
+}
+
+TEST(bulk_loader_test, csv_and_binary_files) {
+	auto store = std::make_shared<memory_connection>();
+	bulk_load_options options;
+	options.batch_size = 2;
+	bulk_loader loader(std::vector<std::shared_ptr<kv_connection>>(2, store), options);
+
+	std::istringstream commands("SET,a,1\r\nHSET,h,f,\"x,\"\"y\"\"\nz\"\n\nRPUSH,l,1,2\nNOSUCH,k\n");
+	EXPECT_EQ(loader.load_csv(commands), 4u);
+	std::istringstream pairs("b;2\nc;3");
+	EXPECT_EQ(loader.load_csv(pairs, "SET", ';'), 2u);
+	std::istringstream records(binary_record({"SET", "bin", std::string("\0\r\n", 3)}) + binary_record({"DEL", "a"}));
+	EXPECT_EQ(loader.load_binary(records), 2u);
+	std::istringstream truncated(binary_record({"SET", "x", "y"}).substr(0, 10));
+	EXPECT_THROW(loader.load_binary(truncated), std::runtime_error);
+	std::istringstream unterminated("SET,a,\"b\n");
+	EXPECT_THROW(loader.load_csv(unterminated), std::runtime_error);
+
+	const bulk_load_stats stats = loader.finish();
+	EXPECT_EQ(stats.replied, 8u);
+	EXPECT_EQ(stats.errors, 1u);
+	ASSERT_EQ(stats.error_samples.size(), 1u);
+	EXPECT_NE(stats.error_samples[0].find("unknown command"), std::string::npos);
+	EXPECT_EQ(store->hget("h", "f").value_or(""), "x,\"y\"\nz");
+	EXPECT_EQ(store->lrange("l", 0, -1), (std::vector<std::string>{"1", "2"}));
+	EXPECT_EQ(store->get("c").value_or(""), "3");
+	EXPECT_EQ(store->get("bin").value_or(""), std::string("\0\r\n", 3));
+	EXPECT_FALSE(store->exists("a"));
+}
+
+TEST(bulk_loader_test, stops_after_too_many_errors) {
+	auto store = std::make_shared<memory_connection>();
+	bulk_load_options options;
+	options.batch_size = 1;
+	options.max_errors = 3;
+	bulk_loader loader(std::vector<std::shared_ptr<kv_connection>>{store}, options);
+	EXPECT_THROW(
+		{
+			for (int i = 0; i < 1000; ++i) {
+				loader.command({"NOSUCH", "k"});
+			}
+			loader.finish();
+		},
+		std::runtime_error);
+	EXPECT_GE(loader.stats().errors, 3u);
+	EXPECT_LT(loader.stats().replied, 1000u);
+}
+
+TEST(bulk_loader_redis_test, pipes_into_redis) {
+	std::string host = DEFAULT_REDIS_HOST;
+	int port = DEFAULT_REDIS_PORT;
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = std::atoi(env_port);
+
+	std::unique_ptr<bulk_loader> loader;
+	std::shared_ptr<redis_connection> direct;
+	try {
+		direct = std::make_shared<redis_connection>(host, static_cast<unsigned short>(port));
+		bulk_load_options options;
+		options.connections = 2;
+		options.batch_size = 100;
+		options.window = 1000;
+		loader = std::make_unique<bulk_loader>(host, port, options);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	for (int i = 0; i < 20000; ++i) {
+		loader->command({"SET", "test_bulk_" + std::to_string(i), std::to_string(i)});
+	}
+	loader->command({"INCR", "test_bulk_0x"});
+	loader->command({"HSET", "test_bulk_1", "f", "v"});
+	const bulk_load_stats stats = loader->finish();
+	EXPECT_EQ(stats.replied, 20002u);
+	EXPECT_EQ(stats.errors, 1u);
+	EXPECT_EQ(direct->get("test_bulk_19999").value_or(""), "19999");
+
+	std::vector<std::string> keys{"test_bulk_0x"};
+	for (int i = 0; i < 20000; ++i) {
+		keys.push_back("test_bulk_" + std::to_string(i));
+	}
+	direct->del(keys);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class filter_operations_test: public ::testing::Test {
+protected:
+	// Type aliases (K and V are both std::string)
+	using key_type = std::string;
+	using value_type = std::string;
+
+	const key_type TEST_HASH_KEY = "test_filter_hash";
+	const key_type TEST_LIST_KEY = "test_filter_list";
+	const key_type TEST_SET_KEY = "test_filter_set";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		tpl->del(std::vector<key_type>{TEST_HASH_KEY, TEST_LIST_KEY, TEST_SET_KEY});
+	}
+
+	// Helper function to get Filter operations interface
+	[[nodiscard]] auto &filter_ops() const {
+		return tpl->ops_for_filter();
+	}
+};
+
+// --- Test Cases ---
+
+TEST_F(filter_operations_test, hscan_numeric_value) {
+	// Fields f0..f2999 with values 0..2999, spanning several scan pages
+	std::unordered_map<key_type, value_type> data;
+	for (int i = 0; i < 3000; ++i) {
+		data.emplace("f" + std::to_string(i), std::to_string(i));
+	}
+	ASSERT_TRUE(tpl->ops_for_hash().hset(TEST_HASH_KEY, data));
+
+	auto matched = filter_ops().hscan(TEST_HASH_KEY, filter_value() >= 2990, 0);
+	EXPECT_EQ(matched.size(), 10) << "Filtered HSCAN returned incorrect number of entries.";
+	EXPECT_EQ(matched["f2995"], "2995") << "Filtered HSCAN returned incorrect value.";
+
+	// Combined predicate on field and value
+	auto fields = filter_ops().hscan_fields(TEST_HASH_KEY, filter_field().starts_with("f1") && filter_value() < 100, 0);
+	EXPECT_EQ(fields.size(), 11) << "Combined filter returned incorrect number of fields (f1, f10..f19).";
+
+	// Projection on values only
+	auto values = filter_ops().hscan_values(TEST_HASH_KEY, filter_field() == "f42", 0);
+	ASSERT_EQ(values.size(), 1);
+	EXPECT_EQ(values[0], "42");
+}
+
+TEST_F(filter_operations_test, hscan_limit) {
+	std::unordered_map<key_type, value_type> data;
+	for (int i = 0; i < 500; ++i) {
+		data.emplace("f" + std::to_string(i), std::to_string(i));
+	}
+	ASSERT_TRUE(tpl->ops_for_hash().hset(TEST_HASH_KEY, data));
+
+	auto matched = filter_ops().hscan_fields(TEST_HASH_KEY, filter_value() > 99, 5);
+	EXPECT_EQ(matched.size(), 5) << "Filtered HSCAN did not respect the limit.";
+
+	// Missing key yields no entries
+	tpl->del(TEST_HASH_KEY);
+	EXPECT_TRUE(filter_ops().hscan(TEST_HASH_KEY, filter_value() > 0, 0).empty());
+}
+
+TEST_F(filter_operations_test, lrange_in_order) {
+	std::vector<value_type> values;
+	for (int i = 0; i < 2500; ++i) {
+		values.push_back(std::to_string(i));
+	}
+	tpl->ops_for_list().rpush(TEST_LIST_KEY, values);
+
+	auto matched = filter_ops().lrange(TEST_LIST_KEY, filter_value().contains("99") && !(filter_value() > 1000), 0);
+	std::vector<value_type> expected = {"99", "199", "299", "399", "499", "599", "699", "799", "899", "990",
+										"991", "992", "993", "994", "995", "996", "997", "998", "999"};
+	EXPECT_EQ(matched, expected) << "Filtered LRANGE returned incorrect elements or order.";
+
+	auto limited = filter_ops().lrange(TEST_LIST_KEY, filter_value() != "0", 3);
+	EXPECT_EQ(limited, (std::vector<value_type>{"1", "2", "3"}));
+}
+
+TEST_F(filter_operations_test, sscan_prefix) {
+	tpl->ops_for_set().sadd(TEST_SET_KEY, {"user:1", "user:2", "admin:1", "guest:7"});
+
+	auto matched = filter_ops().sscan(TEST_SET_KEY, filter_value().starts_with("user:") || filter_value() == "guest:7", 0);
+	std::sort(matched.begin(), matched.end());
+	EXPECT_EQ(matched, (std::vector<value_type>{"guest:7", "user:1", "user:2"}));
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,158 @@
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <csignal>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+namespace {
+/* A connection whose GET of "slow" sleeps and of "broken" throws */
+class troubled_connection: public memory_connection {
+public:
+	std::optional<std::string> get(const std::string &key) override {
+		if (key == "slow") std::this_thread::sleep_for(std::chrono::milliseconds(20));
+		if (key == "broken") throw std::runtime_error("troubled_connection: broken");
+		return memory_connection::get(key);
+	}
+};
+
+std::string read_all(int fd) {
+	std::string text;
+	char buffer[4096];
+	ssize_t n;
+	while ((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+		text.append(buffer, static_cast<size_t>(n));
+	}
+	return text;
+}
+} // namespace
+
+TEST(flight_recorder_test, keeps_the_last_calls_of_each_thread) {
+	flight_recorder_options options;
+	options.capacity = 8;
+	flight_recorder recorder(options);
+	observed_connection<flight_recorder> connection(std::make_shared<memory_connection>(), recorder);
+	for (int i = 0; i < 20; ++i) {
+		connection.set("key" + std::to_string(i), "value");
+	}
+	std::thread other([&connection] { connection.get("from_other_thread"); });
+	other.join();
+	connection.pipeline({{"GET", "a"}, {"INCR", "key0"}});
+
+	const auto records = recorder.records();
+	ASSERT_EQ(records.size(), 9u);
+	EXPECT_EQ(std::string(records[0].key), "key13");
+	EXPECT_EQ(std::string(records[0].command), "SET");
+	EXPECT_EQ(records[0].bytes_sent, 10u);
+	int other_thread = 0;
+	for (const auto &r: records) {
+		other_thread += std::string(r.key) == "from_other_thread" ? 1 : 0;
+	}
+	EXPECT_EQ(other_thread, 1);
+	EXPECT_EQ(std::string(records.back().command), "PIPELINE");
+	EXPECT_EQ(records.back().batch, 2u);
+	EXPECT_EQ(records.back().outcome, 2u);
+
+	std::ostringstream out;
+	recorder.dump(out);
+	EXPECT_NE(out.str().find(" SET key19 sent=10 received=0 latency_us="), std::string::npos);
+	EXPECT_NE(out.str().find(" PIPELINE  batch=2 "), std::string::npos);
+	EXPECT_NE(out.str().find("error-replies\n"), std::string::npos);
+
+	// Threads that exited hand their ring over: the next ones write to it rather than to rings of their own
+	for (int i = 0; i < 20; ++i) {
+		std::thread([&connection, i] { connection.get("short_lived" + std::to_string(i)); }).join();
+	}
+	int short_lived = 0;
+	for (const auto &r: recorder.records()) {
+		short_lived += std::string(r.key).compare(0, 11, "short_lived") == 0 ? 1 : 0;
+	}
+	EXPECT_EQ(short_lived, 8);
+}
+
+TEST(flight_recorder_test, formats_long_and_binary_keys_safely) {
+	flight_recorder recorder;
+	observed_connection<flight_recorder> connection(std::make_shared<memory_connection>(), recorder);
+	connection.set(std::string(100, 'k'), "v");
+	connection.set(std::string("bin\x01\xff", 5), "v");
+	std::ostringstream out;
+	recorder.dump(out);
+	EXPECT_NE(out.str().find(" SET " + std::string(39, 'k') + "... "), std::string::npos);
+	EXPECT_NE(out.str().find(" SET bin?? "), std::string::npos);
+	EXPECT_EQ(recorder.records()[0].key_size, 100u);
+}
+
+TEST(flight_recorder_test, slow_log_keeps_the_context) {
+	flight_recorder_options options;
+	options.slow_threshold = std::chrono::milliseconds(10);
+	options.slow_log_size = 2;
+	options.slow_context = 3;
+	flight_recorder recorder(options);
+	observed_connection<flight_recorder> connection(std::make_shared<troubled_connection>(), recorder);
+	for (int i = 0; i < 5; ++i) {
+		connection.get("fast" + std::to_string(i));
+	}
+	connection.get("slow");
+	EXPECT_THROW(connection.get("broken"), std::runtime_error);
+
+	auto slow = recorder.slow_log();
+	ASSERT_EQ(slow.size(), 1u);
+	EXPECT_EQ(slow[0].key, "slow");
+	EXPECT_GE(slow[0].record.latency_ns, 20000000u);
+	ASSERT_EQ(slow[0].preceding.size(), 3u);
+	EXPECT_EQ(std::string(slow[0].preceding[0].key), "fast2");
+	EXPECT_EQ(std::string(slow[0].preceding[2].key), "fast4");
+
+	for (int i = 0; i < 3; ++i) {
+		connection.get("slow");
+	}
+	EXPECT_EQ(recorder.slow_log().size(), 2u);
+	recorder.clear_slow_log();
+	EXPECT_TRUE(recorder.slow_log().empty());
+	const auto records = recorder.records();
+	EXPECT_EQ(records[6].outcome, 1u);
+	EXPECT_EQ(std::string(records[6].error), "troubled_connection: broken");
+}
+
+TEST(flight_recorder_test, dumps_on_errors_and_signals) {
+	int fds[2];
+	ASSERT_EQ(::pipe(fds), 0);
+	::fcntl(fds[0], F_SETFL, O_NONBLOCK);
+
+	flight_recorder_options options;
+	options.dump_on_error = true;
+	options.dump_fd = fds[1];
+	options.dump_interval = std::chrono::hours(1);
+	flight_recorder recorder(options);
+	observed_connection<flight_recorder> connection(std::make_shared<troubled_connection>(), recorder);
+	connection.set("before", "v");
+	EXPECT_THROW(connection.get("broken"), std::runtime_error);
+	EXPECT_THROW(connection.get("broken"), std::runtime_error);
+	std::string dumped = read_all(fds[0]);
+	EXPECT_NE(dumped.find(" SET before "), std::string::npos);
+	EXPECT_NE(dumped.find(" GET broken "), std::string::npos);
+	// The second failure falls within the dump interval
+	EXPECT_EQ(dumped.find(" GET broken "), dumped.rfind(" GET broken "));
+
+	flight_recorder::dump_on_signal(recorder, SIGUSR2, fds[1]);
+	std::raise(SIGUSR2);
+	dumped = read_all(fds[0]);
+	EXPECT_NE(dumped.find(" SET before "), std::string::npos);
+	EXPECT_EQ(std::count(dumped.begin(), dumped.end(), '\n'), 3);
+	::close(fds[0]);
+	::close(fds[1]);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,181 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class hll_operations_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = unsigned int;
+
+	const key_type TEST_KEY_A = "test_hll_a";
+	const key_type TEST_KEY_B = "test_hll_b";
+	const key_type TEST_KEY_MERGED = "test_hll_merged";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		tpl->del(std::vector<key_type>{TEST_KEY_A, TEST_KEY_B, TEST_KEY_MERGED});
+	}
+
+	// Helper function to get HyperLogLog operations interface
+	[[nodiscard]] auto &hll_ops() const {
+		return tpl->ops_for_hll();
+	}
+};
+
+// --- Test Cases ---
+
+TEST(hll_sketch_test, estimate) {
+	hll_sketch sketch;
+	EXPECT_TRUE(sketch.empty());
+	EXPECT_EQ(sketch.count(), 0U);
+
+	for (int i = 0; i < 100000; ++i) {
+		sketch.add(std::to_string(i));
+	}
+	// Standard error of 14-bit HLL is 0.81%
+	EXPECT_NEAR(static_cast<double>(sketch.count()), 100000.0, 3000.0);
+
+	// Re-adding existing elements does not change the registers
+	EXPECT_FALSE(sketch.add("42"));
+
+	// Raw representation round trip
+	hll_sketch copy = hll_sketch::from_redis(sketch.to_redis());
+	EXPECT_EQ(copy.to_redis(), sketch.to_redis());
+	EXPECT_EQ(copy.count(), sketch.count());
+}
+
+TEST(hll_sketch_test, merge) {
+	hll_sketch a;
+	hll_sketch b;
+	for (int i = 0; i < 20000; ++i) {
+		a.add(std::to_string(i));
+		b.add(std::to_string(i + 10000));
+	}
+	a.merge(b);
+	EXPECT_NEAR(static_cast<double>(a.count()), 30000.0, 900.0);
+}
+
+TEST_F(hll_operations_test, pfadd_pfcount_pfmerge) {
+	EXPECT_TRUE(hll_ops().pfadd(TEST_KEY_A, {1U, 2U, 3U}));
+	EXPECT_FALSE(hll_ops().pfadd(TEST_KEY_A, {1U, 2U})) << "Re-adding elements should not alter the HyperLogLog.";
+	EXPECT_TRUE(hll_ops().pfadd(TEST_KEY_B, {3U, 4U}));
+
+	EXPECT_EQ(hll_ops().pfcount(TEST_KEY_A), 3);
+	EXPECT_EQ(hll_ops().pfcount(std::vector<key_type>{TEST_KEY_A, TEST_KEY_B}), 4);
+
+	EXPECT_TRUE(hll_ops().pfmerge(TEST_KEY_MERGED, {TEST_KEY_A, TEST_KEY_B}));
+	EXPECT_EQ(hll_ops().pfcount(TEST_KEY_MERGED), 4);
+}
+
+TEST_F(hll_operations_test, local_sketch_matches_redis) {
+	// The same elements via PFADD and via a local sketch produce identical registers
+	std::vector<value_type> elements;
+	hll_sketch sketch;
+	for (value_type i = 0; i < 5000; ++i) {
+		elements.push_back(i);
+		sketch.add(tpl->serialize_value(i));
+	}
+	hll_ops().pfadd(TEST_KEY_A, elements);
+
+	hll_sketch remote = hll_ops().get_sketch(TEST_KEY_A);
+	for (uint32_t i = 0; i < hll_sketch::register_count; ++i) {
+		ASSERT_EQ(remote.get_register(i), sketch.get_register(i)) << "Register " << i << " differs.";
+	}
+	EXPECT_EQ(static_cast<uint64_t>(hll_ops().pfcount(TEST_KEY_A)), sketch.count());
+}
+
+TEST_F(hll_operations_test, flush_sketch) {
+	hll_ops().pfadd(TEST_KEY_A, {100000U, 100001U});
+
+	hll_sketch sketch;
+	for (value_type i = 0; i < 10000; ++i) {
+		sketch.add(tpl->serialize_value(i));
+	}
+	EXPECT_TRUE(hll_ops().pfmerge(TEST_KEY_A, sketch));
+	EXPECT_FALSE(tpl->exists(TEST_KEY_A + ":pfmerge:tmp")) << "Temporary merge key was left behind.";
+
+	sketch.add(tpl->serialize_value(100000U));
+	sketch.add(tpl->serialize_value(100001U));
+	EXPECT_EQ(static_cast<uint64_t>(hll_ops().pfcount(TEST_KEY_A)), sketch.count());
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
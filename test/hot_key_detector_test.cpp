@@ -0,0 +1,118 @@
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+TEST(hot_key_detector_test, ranks_hot_and_big_keys) {
+	metrics_registry registry;
+	hot_key_options options;
+	options.sample_rate = 1;
+	options.top_k = 3;
+	options.window = std::chrono::hours(1);
+	options.registry = &registry;
+	std::vector<hot_key_report> reports;
+	options.on_report = [&reports](const hot_key_report &r) { reports.push_back(r); };
+	hot_key_detector detector(options);
+	observed_connection<hot_key_detector> connection(std::make_shared<memory_connection>(), detector);
+
+	connection.set("user:blob", std::string(5000, 'x'));
+	for (int i = 0; i < 100; ++i) {
+		connection.get("user:hot");
+		if (i % 2 == 0) connection.get("session:warm");
+		connection.get("cold:" + std::to_string(i));
+	}
+	connection.pipeline({{"GET", "user:hot"}});
+
+	const hot_key_report report = detector.rotate();
+	ASSERT_EQ(report.hot.size(), 3u);
+	EXPECT_EQ(report.hot[0].key, "user:hot");
+	EXPECT_GE(report.hot[0].value, 100u);
+	EXPECT_EQ(report.hot[1].key, "session:warm");
+	EXPECT_GE(report.hot[1].value, 50u);
+	ASSERT_FALSE(report.big.empty());
+	EXPECT_EQ(report.big[0].key, "user:blob");
+	EXPECT_EQ(report.big[0].value, 5000u);
+
+	ASSERT_EQ(report.prefixes.size(), 3u);
+	EXPECT_EQ(report.prefixes[0].prefix, "user");
+	EXPECT_EQ(report.prefixes[0].calls, 101u);
+	EXPECT_EQ(report.prefixes[0].bytes_sent, 9u + 5000u + 100u * 8u);
+	EXPECT_EQ(report.prefixes[1].prefix, "cold");
+	EXPECT_EQ(report.prefixes[1].calls, 100u);
+
+	ASSERT_EQ(reports.size(), 1u);
+	const metrics_snapshot snapshot = registry.snapshot();
+	EXPECT_EQ(snapshot.gauges.at("hot_key_calls_max"), static_cast<int64_t>(report.hot[0].value));
+	EXPECT_EQ(snapshot.gauges.at("big_key_bytes_max"), 5000);
+
+	// A new window starts empty, while prefix totals carry on
+	const hot_key_report next = detector.rotate();
+	EXPECT_TRUE(next.hot.empty());
+	EXPECT_EQ(next.prefixes.size(), 3u);
+}
+
+TEST(hot_key_detector_test, samples_and_bounds_prefixes) {
+	hot_key_options options;
+	options.sample_rate = 4;
+	options.max_prefixes = 2;
+	options.window = std::chrono::milliseconds(20);
+	options.registry = nullptr;
+	hot_key_detector detector(options);
+	observed_connection<hot_key_detector> connection(std::make_shared<memory_connection>(), detector);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&connection, t] {
+			for (int i = 0; i < 4000; ++i) {
+				const std::string key = "p" + std::to_string(t) + ":" + std::to_string(i);
+				connection.get(i % 4 == 0 ? "a:x" : i % 4 == 1 ? "b:x" : key);
+			}
+		});
+	}
+	for (auto &thread: threads) {
+		thread.join();
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(25));
+	connection.get("a:x");
+
+	const hot_key_report report = detector.report();
+	EXPECT_GT(report.window.count(), 0);
+	uint64_t calls = 0;
+	for (const auto &p: report.prefixes) {
+		calls += p.calls;
+	}
+	EXPECT_LE(report.prefixes.size(), 3u);
+	// Sampled counts are scaled back, within a sample per thread
+	EXPECT_GE(calls, 16000u - 4 * options.sample_rate);
+	EXPECT_LE(calls, 16001u + 4 * options.sample_rate);
+
+	options.top_k = 0;
+	EXPECT_THROW(hot_key_detector{options}, std::invalid_argument);
+}
+
+TEST(hot_key_detector_test, exports_the_report) {
+	hot_key_options options;
+	options.sample_rate = 1;
+	options.registry = nullptr;
+	hot_key_detector detector(options);
+	observed_connection<hot_key_detector> connection(std::make_shared<memory_connection>(), detector);
+	connection.get("user:1");
+	detector.rotate();
+
+	metrics_registry registry;
+	openmetrics_exporter exporter(registry);
+	exporter.add_collector([&detector](openmetrics_writer &w) { write_stats(w, detector.report()); });
+	const std::string text = exporter.render();
+	EXPECT_NE(text.find("janus_hot_key_calls{key=\"user:1\"} 1\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_key_prefix_calls_total{prefix=\"user\"} 1\n"), std::string::npos);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
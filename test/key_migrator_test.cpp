@@ -0,0 +1,253 @@
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+namespace {
+/**
+ * A memory_connection answering SCAN over 16 hash buckets walked in reverse-binary order, as Redis does, and DUMP and
+ * RESTORE of strings with a payload of the value and a 10-byte trailer. The key "expiring" has a PTTL of 0.
+ */
+class dump_node: public memory_connection {
+public:
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		std::vector<kv_reply> replies;
+		for (const auto &c: commands) {
+			if (c[0] == "SCAN") replies.push_back(scan(std::stoull(c[1]), std::stoull(c[3])));
+			else if (c[0] == "DUMP") replies.push_back(dump(c[1]));
+			else if (c[0] == "RESTORE") replies.push_back(restore(c));
+			else if (c[0] == "PTTL" && c[1] == "expiring") replies.push_back(integer(0));
+			else replies.push_back(execute(c));
+		}
+		return replies;
+	}
+
+private:
+	static constexpr uint64_t mask = 15;
+
+	kv_reply scan(uint64_t cursor, uint64_t count) {
+		std::vector<std::string> keys;
+		{
+			auto locks = lock_all<read_lock>();
+			for_each_entry([&keys](const std::string &key, const memory_value &, int64_t) { keys.push_back(key); });
+		}
+		kv_reply page = array();
+		kv_reply &found = page.elements[1];
+		do {
+			for (const auto &key: keys) {
+				if ((murmurhash64a(key, 0) & mask) == (cursor & mask)) found.elements.push_back(string(key));
+			}
+			cursor |= ~mask;
+			cursor = reverse(reverse(cursor) + 1);
+		} while (cursor != 0 && found.elements.size() < count);
+		page.elements[0] = string(std::to_string(cursor));
+		return page;
+	}
+
+	kv_reply dump(const std::string &key) {
+		const auto value = get(key);
+		if (!value) return kv_reply{};
+		return string(*value + std::string(10, '\x0b'));
+	}
+
+	kv_reply restore(const std::vector<std::string> &c) {
+		if (c[1] == "bad") return error("ERR DUMP payload version or checksum are wrong");
+		if (c.size() < 5 && exists(c[1])) return error("BUSYKEY Target key name already exists.");
+		const std::string value = c[3].substr(0, c[3].size() - 10);
+		if (c[2] == "0") execute({"SET", c[1], value});
+		else execute({"SET", c[1], value, "PX", c[2]});
+		kv_reply ok;
+		ok.type = kv_reply::reply_type::status;
+		ok.str = "OK";
+		return ok;
+	}
+
+	static uint64_t reverse(uint64_t v) {
+		uint64_t r = 0;
+		for (int i = 0; i < 64; ++i) {
+			r = (r << 1) | ((v >> i) & 1);
+		}
+		return r;
+	}
+
+	static kv_reply string(const std::string &s) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::string;
+		r.str = s;
+		return r;
+	}
+
+	static kv_reply integer(long long n) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::integer;
+		r.integer = n;
+		return r;
+	}
+
+	static kv_reply array() {
+		kv_reply r;
+		r.type = kv_reply::reply_type::array;
+		r.elements.resize(2);
+		r.elements[1].type = kv_reply::reply_type::array;
+		return r;
+	}
+
+	static kv_reply error(const std::string &message) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::error;
+		r.str = message;
+		return r;
+	}
+};
+
+key_migrator::connection_factory factory(const std::shared_ptr<dump_node> &node) {
+	return [node] { return node; };
+}
+} // namespace
+
+TEST(key_migrator_test, copies_every_key_over_split_cursors) {
+	auto first = std::make_shared<dump_node>();
+	auto second = std::make_shared<dump_node>();
+	auto target = std::make_shared<dump_node>();
+	for (int i = 0; i < 1000; ++i) {
+		first->set("a" + std::to_string(i), std::to_string(i));
+		second->set_px("b" + std::to_string(i), std::to_string(i), 60000);
+	}
+	first->set("bad", "v");
+	first->set("expiring", "v");
+
+	migration_options options;
+	options.scan_count = 20;
+	options.scan_splits = 4;
+	options.verify_ratio = 0.25;
+	key_migrator migrator({factory(first), factory(second)}, factory(target), options);
+	const migration_stats stats = migrator.run();
+
+	// A SCAN call crossing into the next split's buckets returns a few keys twice
+	EXPECT_TRUE(stats.completed);
+	EXPECT_GE(stats.scanned, 2002u);
+	EXPECT_EQ(stats.migrated, stats.scanned - stats.errors - stats.vanished);
+	EXPECT_EQ(stats.errors, 1u);
+	// A key about to expire is not restored without an expiry
+	EXPECT_GE(stats.vanished, 1u);
+	EXPECT_FALSE(target->exists("expiring"));
+	ASSERT_FALSE(stats.error_samples.empty());
+	EXPECT_EQ(stats.error_samples[0].compare(0, 5, "bad: "), 0);
+	EXPECT_GT(stats.verified, 300u);
+	EXPECT_LT(stats.verified, 900u);
+	EXPECT_EQ(stats.mismatches, 0u);
+	EXPECT_GE(stats.bytes, 2000u * 10 + 2 * (10 + 90 * 2 + 900 * 3));
+	EXPECT_EQ(target->execute({"DBSIZE"}).integer, 2000);
+	EXPECT_EQ(target->get("a999").value_or(""), "999");
+	EXPECT_EQ(target->pttl("a1"), -1);
+	EXPECT_GT(target->pttl("b1"), 50000);
+}
+
+TEST(key_migrator_test, resumes_from_checkpoint_and_skips_existing_keys) {
+	auto source = std::make_shared<dump_node>();
+	auto target = std::make_shared<dump_node>();
+	for (int i = 0; i < 500; ++i) {
+		source->set("k" + std::to_string(i), "new");
+	}
+	target->set("k7", "old");
+
+	const std::string checkpoint = "/tmp/janus-migration-test-" + std::to_string(getpid());
+	std::remove(checkpoint.c_str());
+	migration_options options;
+	options.scan_count = 10;
+	options.scan_splits = 2;
+	options.replace = false;
+	options.checkpoint_path = checkpoint;
+	options.max_keys_per_second = 2000;
+	options.progress_interval = std::chrono::milliseconds(1);
+	key_migrator *running = nullptr;
+	options.on_progress = [&running](const migration_stats &s) {
+		if (running && s.migrated >= 100) running->stop();
+	};
+
+	key_migrator interrupted({factory(source)}, factory(target), options);
+	running = &interrupted;
+	const migration_stats partial = interrupted.run();
+	EXPECT_FALSE(partial.completed);
+	EXPECT_LT(partial.migrated, 400u);
+
+	options.on_progress = nullptr;
+	options.max_keys_per_second = 0;
+	key_migrator resumed({factory(source)}, factory(target), options);
+	const migration_stats rest = resumed.run();
+	EXPECT_TRUE(rest.completed);
+	EXPECT_LT(rest.scanned, 500u);
+	EXPECT_GE(partial.skipped + rest.skipped, 1u);
+	EXPECT_EQ(target->execute({"DBSIZE"}).integer, 500);
+	EXPECT_EQ(target->get("k7").value_or(""), "old");
+	EXPECT_EQ(target->get("k499").value_or(""), "new");
+
+	// A finished checkpoint makes a rerun a no-op; one with other splits is refused
+	EXPECT_EQ(key_migrator({factory(source)}, factory(target), options).run().scanned, 0u);
+	options.scan_splits = 4;
+	EXPECT_THROW(key_migrator({factory(source)}, factory(target), options).run(), std::runtime_error);
+	std::remove(checkpoint.c_str());
+}
+
+TEST(key_migrator_test, stops_when_a_connection_fails) {
+	auto source = std::make_shared<dump_node>();
+	source->set("k", "v");
+	key_migrator migrator({factory(source)}, [] () -> std::shared_ptr<kv_connection> {
+		throw std::runtime_error("connect failed");
+	});
+	EXPECT_THROW(migrator.run(), std::runtime_error);
+	EXPECT_THROW(key_migrator({}, factory(source)), std::invalid_argument);
+	migration_options options;
+	options.scan_splits = 3;
+	EXPECT_THROW(key_migrator({factory(source)}, factory(source), options), std::invalid_argument);
+}
+
+TEST(key_migrator_redis_test, restores_onto_redis) {
+	std::string host = DEFAULT_REDIS_HOST;
+	auto port = static_cast<unsigned short>(DEFAULT_REDIS_PORT);
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = static_cast<unsigned short>(std::atoi(env_port));
+
+	std::shared_ptr<redis_connection> direct;
+	try {
+		direct = std::make_shared<redis_connection>(host, port);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	direct->set_px("test_migrate_s", "v", 60000);
+	direct->rpush("test_migrate_l", std::vector<std::string>{"a", "b"});
+	// Restoring a server onto itself with REPLACE exercises the whole path without a second server
+	migration_options options;
+	options.match = "test_migrate_*";
+	options.scan_splits = 2;
+	options.verify_ratio = 1;
+	auto connect = [host, port]() -> std::shared_ptr<kv_connection> {
+		return std::make_shared<redis_connection>(host, port);
+	};
+	const migration_stats stats = key_migrator({connect}, connect, options).run();
+	EXPECT_TRUE(stats.completed);
+	EXPECT_GE(stats.migrated, 2u);
+	EXPECT_EQ(stats.errors, 0u);
+	EXPECT_EQ(stats.mismatches, 0u);
+	EXPECT_GT(direct->pttl("test_migrate_s"), 0);
+	EXPECT_EQ(direct->lrange("test_migrate_l", 0, -1), (std::vector<std::string>{"a", "b"}));
+	direct->del(std::vector<std::string>{"test_migrate_s", "test_migrate_l"});
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,189 @@
+#include <sys/resource.h>
+
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+class local_store_test: public ::testing::Test {
+protected:
+	std::string path;
+
+	void SetUp() override {
+		path = (std::filesystem::temp_directory_path() / "janus_local_store_test.log").string();
+		std::filesystem::remove(path);
+	}
+
+	void TearDown() override {
+		std::filesystem::remove(path);
+	}
+
+	static local_store_options options(log_sync sync = log_sync::none) {
+		local_store_options opts;
+		opts.sync = sync;
+		opts.sync_interval = std::chrono::milliseconds(0);
+		opts.memory.shards = 8;
+		opts.memory.active_expire_interval = std::chrono::milliseconds(0);
+		opts.memory.limits.max_entries = 4;
+		opts.recovery_threads = 4;
+		return opts;
+	}
+};
+
+TEST_F(local_store_test, reopen_restores_all_types) {
+	{
+		local_store_connection store(path, options());
+		store.set("s", "value");
+		store.hset("h", std::unordered_map<std::string, std::string>{{"a", "1"}, {"b", "2"}});
+		store.rpush("l", std::vector<std::string>{"x", "y", "z"});
+		store.sadd("set", std::vector<std::string>{"m1", "m2", "m3", "m4", "m5"});
+		store.zadd("z", std::unordered_map<std::string, double>{{"low", -1.5}, {"high", 10}});
+		store.set_px("gone", "v", 1);
+		store.set_ex("kept", "v", 1000);
+		store.set("deleted", "v");
+		store.del("deleted");
+		store.incr("counter", 41);
+		store.incr("counter", 1);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+
+	local_store_connection store(path, options());
+	EXPECT_EQ(store.get("s").value_or(""), "value");
+	EXPECT_EQ(store.hget("h", "b").value_or(""), "2");
+	EXPECT_EQ(store.lrange("l", 0, -1), (std::vector<std::string>{"x", "y", "z"}));
+	EXPECT_EQ(store.scard("set"), 5);
+	EXPECT_EQ(store.zrange("z", 0, -1), (std::vector<std::string>{"low", "high"}));
+	EXPECT_DOUBLE_EQ(store.zscore("z", "low").value_or(0), -1.5);
+	EXPECT_FALSE(store.exists("gone"));
+	EXPECT_GT(store.ttl("kept"), 990);
+	EXPECT_FALSE(store.exists("deleted"));
+	EXPECT_EQ(store.get("counter").value_or(""), "42");
+}
+
+TEST_F(local_store_test, torn_tail_is_truncated) {
+	{
+		local_store_connection store(path, options(log_sync::always));
+		store.set("a", "1");
+		store.set("b", "2");
+	}
+	const auto good_size = std::filesystem::file_size(path);
+	{
+		std::ofstream out(path, std::ios::binary | std::ios::app);
+		// A record header announcing more bytes than were written, as left by a crash mid-write
+		const char partial[] = {1, 2, 3, 4, 5, 6, 7, 8, 1, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 'c', '3'};
+		out.write(partial, sizeof(partial));
+	}
+
+	local_store_connection store(path, options());
+	EXPECT_EQ(std::filesystem::file_size(path), good_size);
+	EXPECT_EQ(store.get("a").value_or(""), "1");
+	EXPECT_EQ(store.get("b").value_or(""), "2");
+	store.set("c", "3");
+	store.sync();
+	EXPECT_GT(std::filesystem::file_size(path), good_size);
+}
+
+TEST_F(local_store_test, compaction_keeps_live_keys) {
+	{
+		local_store_connection store(path, options());
+		for (int round = 0; round < 20; ++round) {
+			for (int i = 0; i < 100; ++i) {
+				store.set("k" + std::to_string(i), "round" + std::to_string(round));
+			}
+		}
+		store.hset("h", "f", "v");
+		store.flushall();
+		for (int i = 0; i < 100; ++i) {
+			store.set("k" + std::to_string(i), "final");
+		}
+		EXPECT_LT(store.get_live_size() * 10, store.get_log_size());
+		store.compact();
+		EXPECT_EQ(store.get_live_size() + 16, store.get_log_size());
+		EXPECT_EQ(std::filesystem::file_size(path), store.get_log_size());
+		store.set("after", "compaction");
+	}
+
+	local_store_connection store(path, options());
+	EXPECT_EQ(store.dbsize(), 101u);
+	EXPECT_EQ(store.get("k7").value_or(""), "final");
+	EXPECT_FALSE(store.exists("h"));
+	EXPECT_EQ(store.get("after").value_or(""), "compaction");
+}
+
+TEST_F(local_store_test, parallel_recovery_of_many_keys) {
+	{
+		local_store_connection store(path, options());
+		for (int i = 0; i < 20000; ++i) {
+			store.hset("user:" + std::to_string(i % 5000), "f" + std::to_string(i), std::to_string(i));
+		}
+		auto replies = store.pipeline({{"MULTI"}, {"SET", "tx", "1"}, {"DEL", "user:0"}, {"EXEC"}});
+		EXPECT_EQ(replies[3].elements.size(), 2u);
+	}
+
+	local_store_connection store(path, options());
+	EXPECT_EQ(store.dbsize(), 5000u);
+	EXPECT_EQ(store.hgetall("user:42").size(), 4u);
+	EXPECT_EQ(store.get("tx").value_or(""), "1");
+}
+
+TEST_F(local_store_test, active_expiry_is_logged) {
+	local_store_connection store(path, options());
+	store.set("kept", "v");
+	const uint64_t kept_size = store.get_live_size();
+	store.set_px("a", "v", 1);
+	store.pipeline({{"MSET", "b", "v", "c", "v"}});
+	store.pexpire("b", 1);
+	store.pexpire("c", 1);
+	std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	EXPECT_EQ(store.purge_expired(), 3u);
+	EXPECT_EQ(store.get_live_size(), kept_size);
+}
+
+TEST_F(local_store_test, log_failure_makes_the_store_read_only) {
+	local_store_connection store(path, options(log_sync::always));
+	store.set("a", "1");
+
+	// Writes past the file size limit fail with EFBIG once SIGXFSZ is ignored
+	rlimit saved{};
+	ASSERT_EQ(getrlimit(RLIMIT_FSIZE, &saved), 0);
+	rlimit limited = saved;
+	limited.rlim_cur = std::filesystem::file_size(path);
+	const auto previous = std::signal(SIGXFSZ, SIG_IGN);
+	ASSERT_EQ(setrlimit(RLIMIT_FSIZE, &limited), 0);
+	store.set("a", "2");
+	setrlimit(RLIMIT_FSIZE, &saved);
+	std::signal(SIGXFSZ, previous);
+
+	EXPECT_TRUE(store.is_read_only());
+	// Refused before anything changes, so readers never see a value the log does not hold
+	EXPECT_THROW(store.set("b", "1"), std::runtime_error);
+	EXPECT_THROW(store.incr("n", 1), std::runtime_error);
+	EXPECT_THROW(store.del(std::vector<std::string>{"a", "b"}), std::runtime_error);
+	EXPECT_FALSE(store.exists("b"));
+	EXPECT_FALSE(store.exists("n"));
+	EXPECT_EQ(store.get("a").value_or(""), "2");
+	const auto replies = store.pipeline({{"SET", "c", "1"}, {"GET", "a"}});
+	EXPECT_EQ(replies[0].type, kv_reply::reply_type::error);
+	EXPECT_EQ(replies[1].str, "2");
+}
+
+TEST_F(local_store_test, rejects_foreign_files) {
+	{
+		std::ofstream out(path, std::ios::binary);
+		out << "this is not a store log";
+	}
+	EXPECT_THROW(local_store_connection(path, options()), std::runtime_error);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
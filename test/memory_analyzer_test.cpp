@@ -0,0 +1,235 @@
+#include <algorithm>
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+namespace {
+/**
+ * A memory_connection answering SCAN in key order, CONFIG GET of hash-max-listpack-entries (4) and
+ * hash-max-listpack-value (8) only, OBJECT ENCODING under those thresholds, and MEMORY USAGE as 10 bytes per
+ * element plus the key.
+ */
+class analyzed_node: public memory_connection {
+public:
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		std::vector<kv_reply> replies;
+		for (const auto &c: commands) {
+			if (c[0] == "SCAN") replies.push_back(scan(std::stoull(c[1]), std::stoull(c[3])));
+			else if (c[0] == "CONFIG") replies.push_back(config(c[2]));
+			else if (c[0] == "MEMORY") replies.push_back(usage(c[2]));
+			else if (c[0] == "OBJECT") replies.push_back(encoding(c[2]));
+			else replies.push_back(execute(c));
+		}
+		return replies;
+	}
+
+private:
+	kv_reply scan(uint64_t cursor, uint64_t count) {
+		std::vector<std::string> keys;
+		{
+			auto locks = lock_all<read_lock>();
+			for_each_entry([&keys](const std::string &key, const memory_value &, int64_t) { keys.push_back(key); });
+		}
+		std::sort(keys.begin(), keys.end());
+		kv_reply page = array(2);
+		page.elements[1] = array(0);
+		const uint64_t end = std::min<uint64_t>(keys.size(), cursor + count);
+		for (uint64_t i = cursor; i < end; ++i) {
+			page.elements[1].elements.push_back(string(keys[i]));
+		}
+		page.elements[0] = string(std::to_string(end == keys.size() ? 0 : end));
+		return page;
+	}
+
+	static kv_reply config(const std::string &name) {
+		const std::map<std::string, std::string> known{{"hash-max-listpack-entries", "4"},
+													   {"hash-max-listpack-value", "8"}};
+		const auto it = known.find(name);
+		if (it == known.end()) return array(0);
+		kv_reply r = array(0);
+		r.elements = {string(it->first), string(it->second)};
+		return r;
+	}
+
+	kv_reply usage(const std::string &key) {
+		const std::string type = execute({"TYPE", key}).str;
+		if (type == "none") return kv_reply{};
+		kv_reply r;
+		r.type = kv_reply::reply_type::integer;
+		r.integer = static_cast<long long>(key.size()) + 10 * length(key, type);
+		return r;
+	}
+
+	kv_reply encoding(const std::string &key) {
+		const std::string type = execute({"TYPE", key}).str;
+		if (type == "none") return kv_reply{};
+		if (type == "string") return string("embstr");
+		if (type == "hash") {
+			bool compact = length(key, type) <= 4;
+			for (const auto &v: execute({"HVALS", key}).elements) {
+				compact = compact && v.str.size() <= 8;
+			}
+			return string(compact ? "listpack" : "hashtable");
+		}
+		return string(length(key, type) <= 128 ? "listpack" : type == "zset" ? "skiplist" : "hashtable");
+	}
+
+	long long length(const std::string &key, const std::string &type) {
+		if (type == "string") return execute({"STRLEN", key}).integer;
+		if (type == "hash") return execute({"HLEN", key}).integer;
+		if (type == "zset") return execute({"ZCARD", key}).integer;
+		if (type == "set") return execute({"SCARD", key}).integer;
+		return execute({"LLEN", key}).integer;
+	}
+
+	static kv_reply string(const std::string &s) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::string;
+		r.str = s;
+		return r;
+	}
+
+	static kv_reply array(size_t size) {
+		kv_reply r;
+		r.type = kv_reply::reply_type::array;
+		r.elements.resize(size);
+		return r;
+	}
+};
+
+std::unordered_map<std::string, std::string> fields(int count, size_t value_size) {
+	std::unordered_map<std::string, std::string> result;
+	for (int i = 0; i < count; ++i) {
+		result["f" + std::to_string(i)] = std::string(value_size, 'v');
+	}
+	return result;
+}
+} // namespace
+
+TEST(memory_analyzer_test, aggregates_by_prefix_and_encoding) {
+	auto node = std::make_shared<analyzed_node>();
+	for (int i = 0; i < 30; ++i) {
+		node->set("session:" + std::to_string(i), "0123456789");
+	}
+	node->hset("user:compact", fields(3, 4));
+	node->hset("user:just_above", fields(5, 4));
+	node->hset("user:long_value", fields(2, 20));
+	node->hset("user:far_above", fields(40, 4));
+	node->sadd("tags", std::vector<std::string>{"a", "b"});
+
+	memory_analysis_options options;
+	options.scan_count = 7;
+	const memory_analysis analysis = memory_analyzer(node, options).run();
+
+	EXPECT_TRUE(analysis.completed);
+	EXPECT_EQ(analysis.scanned, 35u);
+	EXPECT_EQ(analysis.analyzed, 35u);
+	EXPECT_EQ(analysis.errors, 0u);
+	EXPECT_EQ(analysis.thresholds.hash_max_listpack_entries, 4u);
+	EXPECT_EQ(analysis.thresholds.hash_max_listpack_value, 8u);
+	// Unknown to the server, so the default is kept
+	EXPECT_EQ(analysis.thresholds.zset_max_listpack_entries, 128u);
+
+	// Largest first
+	ASSERT_EQ(analysis.prefixes.size(), 3u);
+	EXPECT_EQ(analysis.prefixes[0].prefix, "session");
+	EXPECT_EQ(analysis.prefixes[0].bytes, 30u * 100 + 10u * 9 + 20u * 10);
+	EXPECT_EQ(analysis.prefixes[1].prefix, "user");
+	EXPECT_EQ(analysis.prefixes[1].keys, 4u);
+	EXPECT_EQ(analysis.prefixes[1].biggest_key, "user:far_above");
+	EXPECT_EQ(analysis.prefixes[1].encodings.at("hash hashtable").keys, 3u);
+	EXPECT_EQ(analysis.prefixes[2].prefix, "tags");
+	EXPECT_EQ(analysis.encodings.at("string embstr").keys, 30u);
+	EXPECT_EQ(analysis.encodings.at("hash listpack").keys, 1u);
+
+	// far_above is 10 times the threshold: bucketing, not a threshold change, would help it
+	ASSERT_EQ(analysis.near_thresholds.size(), 2u);
+	EXPECT_EQ(analysis.near_thresholds[0].key, "user:just_above");
+	EXPECT_EQ(analysis.near_thresholds[0].reason, "hash-max-listpack-entries 4");
+	EXPECT_EQ(analysis.near_thresholds[1].key, "user:long_value");
+	EXPECT_EQ(analysis.near_thresholds[1].reason, "hash-max-listpack-value 8");
+
+	openmetrics_writer w;
+	write_stats(w, analysis);
+	std::string text;
+	w.finish(text);
+	EXPECT_NE(text.find("janus_memory_prefix_bytes{prefix=\"session\"} 3290\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_memory_encoding_keys{type=\"hash\",encoding=\"listpack\"} 1\n"), std::string::npos);
+}
+
+TEST(memory_analyzer_test, samples_limits_and_maps_prefixes) {
+	auto node = std::make_shared<analyzed_node>();
+	for (int i = 0; i < 400; ++i) {
+		node->set("app:user:" + std::to_string(i), "v");
+		node->set("app:cart:" + std::to_string(i), "v");
+	}
+
+	memory_analysis_options options;
+	options.scan_count = 50;
+	options.sample_ratio = 0.5;
+	options.prefix_depth = 2;
+	options.read_config = false;
+	memory_analysis analysis = memory_analyzer(node, options).run();
+	EXPECT_EQ(analysis.scanned, 800u);
+	EXPECT_GT(analysis.analyzed, 300u);
+	EXPECT_LT(analysis.analyzed, 500u);
+	ASSERT_EQ(analysis.prefixes.size(), 2u);
+	EXPECT_TRUE(analysis.prefixes[0].prefix == "app:user" || analysis.prefixes[0].prefix == "app:cart");
+
+	options.sample_ratio = 1;
+	options.max_keys = 100;
+	options.prefix_of = [](const std::string &key) { return key.substr(key.rfind(':') + 1, 1); };
+	analysis = memory_analyzer(node, options).run();
+	EXPECT_FALSE(analysis.completed);
+	EXPECT_EQ(analysis.scanned, 100u);
+	for (const auto &p: analysis.prefixes) {
+		EXPECT_EQ(p.prefix.size(), 1u);
+	}
+
+	options.sample_ratio = 0;
+	EXPECT_THROW(memory_analyzer(node, options), std::invalid_argument);
+	EXPECT_THROW(memory_analyzer(nullptr), std::invalid_argument);
+}
+
+TEST(memory_analyzer_redis_test, analyzes_redis) {
+	std::string host = DEFAULT_REDIS_HOST;
+	auto port = static_cast<unsigned short>(DEFAULT_REDIS_PORT);
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = static_cast<unsigned short>(std::atoi(env_port));
+
+	std::shared_ptr<redis_connection> connection;
+	try {
+		connection = std::make_shared<redis_connection>(host, port);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	connection->set("test_memory:s", "v");
+	connection->hset("test_memory:h", fields(3, 4));
+	memory_analysis_options options;
+	options.match = "test_memory:*";
+	const memory_analysis analysis = memory_analyzer(connection, options).run();
+	EXPECT_TRUE(analysis.completed);
+	EXPECT_EQ(analysis.analyzed, 2u);
+	EXPECT_EQ(analysis.errors, 0u);
+	ASSERT_EQ(analysis.prefixes.size(), 1u);
+	EXPECT_GT(analysis.prefixes[0].bytes, 0u);
+	EXPECT_EQ(analysis.encodings.count("hash listpack") + analysis.encodings.count("hash ziplist"), 1u);
+	connection->del(std::vector<std::string>{"test_memory:s", "test_memory:h"});
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,237 @@
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+class memory_connection_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = std::string;
+
+	std::shared_ptr<memory_connection> conn;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		memory_connection_options options;
+		options.shards = 8;
+		options.active_expire_interval = std::chrono::milliseconds(10);
+		options.limits.max_entries = 4;
+		conn = std::make_shared<memory_connection>(options);
+		tpl = std::make_unique<redis_template<key_type, value_type>>(
+			conn, std::make_shared<string_serializer<key_type>>(), std::make_shared<string_serializer<value_type>>());
+	}
+};
+
+TEST_F(memory_connection_test, value_operations) {
+	auto &ops = tpl->ops_for_value();
+	EXPECT_TRUE(ops.set("k", "v1"));
+	EXPECT_EQ(ops.get("k").value_or(""), "v1");
+	EXPECT_EQ(ops.get_and_set("k", "v2").value_or(""), "v1");
+	EXPECT_EQ(ops.append("k", "xy"), 4);
+	EXPECT_EQ(ops.get("k").value_or(""), "v2xy");
+	EXPECT_FALSE(ops.get("missing").has_value());
+
+	EXPECT_EQ(ops.incr("n", 5), 5);
+	EXPECT_EQ(ops.decr("n", 7), -2);
+	EXPECT_THROW(ops.incr("k", 1), std::runtime_error);
+	EXPECT_EQ(tpl->del(std::vector<key_type>{"k", "n", "missing"}), 2);
+	EXPECT_FALSE(tpl->exists("k"));
+}
+
+TEST_F(memory_connection_test, hash_operations) {
+	auto &ops = tpl->ops_for_hash();
+	for (int i = 0; i < 10; ++i) {
+		EXPECT_TRUE(ops.hset("h", "f" + std::to_string(i), "v" + std::to_string(i)));
+	}
+	EXPECT_EQ(ops.hgetall("h").size(), 10u);
+	EXPECT_EQ(ops.hget("h", "f3").value_or(""), "v3");
+	EXPECT_EQ(ops.hdel("h", std::vector<key_type>{"f0", "f1", "nope"}), 2);
+	EXPECT_EQ(ops.hkeys("h").size(), 8u);
+
+	std::unordered_map<key_type, std::optional<value_type>> fields{{"f2", std::nullopt}, {"f0", std::nullopt}};
+	ops.hget("h", fields);
+	EXPECT_EQ(fields["f2"].value_or(""), "v2");
+	EXPECT_FALSE(fields["f0"].has_value());
+
+	std::vector<key_type> all;
+	for (int i = 2; i < 10; ++i) {
+		all.push_back("f" + std::to_string(i));
+	}
+	EXPECT_EQ(ops.hdel("h", all), 8);
+	EXPECT_FALSE(tpl->exists("h"));
+}
+
+TEST_F(memory_connection_test, list_and_set_operations) {
+	auto &list = tpl->ops_for_list();
+	EXPECT_EQ(list.rpush("l", std::vector<value_type>{"b", "c"}), 2);
+	EXPECT_EQ(list.lpush("l", "a"), 3);
+	EXPECT_EQ(list.lrange("l", 0, -1), (std::vector<value_type>{"a", "b", "c"}));
+	EXPECT_EQ(list.lrange("l", -2, 100), (std::vector<value_type>{"b", "c"}));
+	EXPECT_EQ(list.lpop("l").value_or(""), "a");
+	EXPECT_EQ(list.rpop("l").value_or(""), "c");
+	EXPECT_EQ(list.llen("l"), 1);
+
+	auto &set = tpl->ops_for_set();
+	EXPECT_EQ(set.sadd("s1", std::vector<value_type>{"a", "b", "c", "d", "e", "f"}), 6);
+	EXPECT_EQ(set.sadd("s2", std::vector<value_type>{"b", "d", "z"}), 3);
+	EXPECT_TRUE(set.sismember("s1", "e"));
+	auto common = set.sinter(std::vector<key_type>{"s1", "s2"});
+	std::sort(common.begin(), common.end());
+	EXPECT_EQ(common, (std::vector<value_type>{"b", "d"}));
+	EXPECT_EQ(set.srem("s2", std::vector<value_type>{"z"}), 1);
+	EXPECT_EQ(set.scard("s2"), 2);
+
+	// Wrong type access is reported like Redis does
+	EXPECT_THROW(set.sadd("l", std::vector<value_type>{"x"}), std::runtime_error);
+}
+
+TEST_F(memory_connection_test, zset_operations) {
+	auto &ops = tpl->ops_for_zset();
+	std::unordered_map<value_type, double> members;
+	for (int i = 0; i < 20; ++i) {
+		members["m" + std::to_string(i)] = i;
+	}
+	EXPECT_EQ(ops.zadd("z", members), 20);
+	EXPECT_EQ(ops.zrange("z", 0, 2), (std::vector<value_type>{"m0", "m1", "m2"}));
+	EXPECT_EQ(ops.zrevrange("z", 0, 1), (std::vector<value_type>{"m19", "m18"}));
+	EXPECT_DOUBLE_EQ(ops.zincrby("z", 100, "m0"), 100);
+	EXPECT_EQ(ops.zrevrange("z", 0, 0), (std::vector<value_type>{"m0"}));
+	EXPECT_EQ(ops.zrem("z", std::vector<value_type>{"m0", "m1"}), 2);
+	EXPECT_FALSE(ops.zscore("z", "m1").has_value());
+
+	auto range = conn->zrangebyscore_withscores("z", 5, 7);
+	ASSERT_EQ(range.size(), 3u);
+	EXPECT_EQ(range[0].first, "m5");
+	EXPECT_EQ(conn->zremrangebyscore("z", 0, 9.5), 8);
+	EXPECT_EQ(conn->zcard("z"), 10);
+	EXPECT_EQ(conn->zrank("z", "m10").value_or(-1), 0);
+}
+
+TEST_F(memory_connection_test, expiry) {
+	EXPECT_TRUE(conn->set_px("short", "v", 30));
+	EXPECT_TRUE(conn->set("long", "v"));
+	EXPECT_TRUE(conn->expire("long", 100));
+	EXPECT_GT(conn->ttl("long"), 98);
+	EXPECT_EQ(conn->pttl("nope"), -2);
+	EXPECT_TRUE(conn->set("persistent", "v"));
+	EXPECT_EQ(conn->pttl("persistent"), -1);
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(100));
+	EXPECT_FALSE(conn->exists("short"));
+	// The active expiry thread has removed the key, not only hidden it
+	EXPECT_EQ(conn->dbsize(), 2u);
+	EXPECT_TRUE(conn->persist("long"));
+	EXPECT_EQ(conn->pttl("long"), -1);
+}
+
+TEST_F(memory_connection_test, hll_and_bitmap) {
+	auto &hll = tpl->ops_for_hll();
+	std::vector<value_type> elements;
+	for (int i = 0; i < 1000; ++i) {
+		elements.push_back("e" + std::to_string(i));
+	}
+	EXPECT_TRUE(hll.pfadd("hll", elements));
+	EXPECT_NEAR(static_cast<double>(hll.pfcount("hll")), 1000.0, 30.0);
+
+	auto &bits = tpl->ops_for_bitmap();
+	EXPECT_FALSE(bits.setbit("b", 7, true));
+	EXPECT_TRUE(bits.getbit("b", 7));
+	EXPECT_EQ(bits.bitcount("b"), 1);
+	EXPECT_EQ(bits.bitpos("b", true, 0, -1), 7);
+
+	bitfield_command cmd;
+	cmd.set(bitfield_type::u(8), 8, 255).incrby(bitfield_type::u(8), 8, 1).get(bitfield_type::i(8), 8);
+	auto result = bits.bitfield("b", cmd);
+	ASSERT_EQ(result.size(), 3u);
+	EXPECT_EQ(result[0].value_or(-1), 0);
+	EXPECT_EQ(result[1].value_or(-1), 0);
+	EXPECT_EQ(result[2].value_or(-1), 0);
+}
+
+TEST_F(memory_connection_test, roaring_uses_transactions) {
+	auto &ops = tpl->ops_for_roaring();
+	EXPECT_EQ(ops.add("r", {1, 2, 3, 70000}), 4);
+	EXPECT_TRUE(ops.contains("r", 70000));
+	EXPECT_EQ(ops.cardinality("r"), 4);
+	EXPECT_EQ(ops.remove("r", {2}), 1);
+	EXPECT_EQ(ops.load("r").to_vector(), (std::vector<uint32_t>{1, 3, 70000}));
+}
+
+TEST_F(memory_connection_test, raw_commands_and_transactions) {
+	EXPECT_EQ(conn->execute({"SET", "a", "1", "NX", "PX", "10000"}).str, "OK");
+	EXPECT_TRUE(conn->execute({"SET", "a", "2", "NX"}).is_nil());
+	EXPECT_EQ(conn->execute({"INCRBY", "a", "41"}).integer, 42);
+	EXPECT_GT(conn->execute({"PTTL", "a"}).integer, 0);
+	EXPECT_TRUE(conn->execute({"HSET", "a", "f", "v"}).is_error());
+	EXPECT_TRUE(conn->execute({"NOPE"}).is_error());
+	EXPECT_TRUE(conn->execute({"GET"}).is_error());
+
+	auto replies = conn->pipeline({{"MULTI"}, {"INCR", "a"}, {"RPUSH", "l", "x", "y"}, {"EXEC"}});
+	ASSERT_EQ(replies.size(), 4u);
+	EXPECT_EQ(replies[1].str, "QUEUED");
+	ASSERT_EQ(replies[3].elements.size(), 2u);
+	EXPECT_EQ(replies[3].elements[0].integer, 43);
+	EXPECT_EQ(replies[3].elements[1].integer, 2);
+
+	// A watched key modified by another thread aborts the transaction
+	EXPECT_EQ(conn->execute({"WATCH", "a"}).str, "OK");
+	std::thread([this] { conn->set("a", "0"); }).join();
+	replies = conn->pipeline({{"MULTI"}, {"SET", "a", "100"}, {"EXEC"}});
+	EXPECT_TRUE(replies[2].is_nil());
+	EXPECT_EQ(conn->get("a").value_or(""), "0");
+
+	auto range = conn->execute({"ZADD", "z", "1", "a", "2", "b", "3", "c"});
+	EXPECT_EQ(range.integer, 3);
+	range = conn->execute({"ZRANGEBYSCORE", "z", "(1", "+inf", "WITHSCORES"});
+	ASSERT_EQ(range.elements.size(), 4u);
+	EXPECT_EQ(range.elements[0].str, "b");
+	EXPECT_EQ(range.elements[1].str, "2");
+}
+
+TEST_F(memory_connection_test, concurrent_writers) {
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([this, t] {
+			for (int i = 0; i < 1000; ++i) {
+				conn->incr("counter", 1);
+				conn->set("k" + std::to_string(t) + ":" + std::to_string(i), "v");
+			}
+		});
+	}
+	for (auto &t: threads) {
+		t.join();
+	}
+	EXPECT_EQ(conn->get("counter").value_or(""), "4000");
+	EXPECT_EQ(conn->dbsize(), 4001u);
+}
+
+TEST(compact_types_test, encodings_convert_past_limits) {
+	compact_limits limits{4, 8};
+	compact_zset z(limits);
+	for (int i = 0; i < 4; ++i) {
+		z.add("m" + std::to_string(i), 4 - i);
+	}
+	EXPECT_TRUE(z.is_compact());
+	EXPECT_EQ(z.rank("m3").value_or(-1), 0);
+	z.add("m4", 0.5);
+	EXPECT_FALSE(z.is_compact());
+	EXPECT_EQ(z.rank("m4").value_or(-1), 0);
+	EXPECT_EQ(z.range_by_rank(0, 1)[1].first, "m3");
+
+	compact_hash h(limits);
+	h.set("f", "short");
+	EXPECT_TRUE(h.is_compact());
+	h.set("f", "a value longer than eight bytes");
+	EXPECT_FALSE(h.is_compact());
+	EXPECT_EQ(*h.find("f"), "a value longer than eight bytes");
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,173 @@
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+namespace {
+/* A connection whose GET fails, to count errors */
+class failing_connection: public memory_connection {
+public:
+	std::optional<std::string> get(const std::string &key) override {
+		if (key == "broken") throw std::runtime_error("failing_connection: broken");
+		return memory_connection::get(key);
+	}
+};
+} // namespace
+
+TEST(metrics_test, histogram_buckets_bound_values_within_a_sixteenth) {
+	for (uint64_t v: {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull, (1ull << 39) + 12345}) {
+		const size_t bucket = latency_histogram::bucket_of(v);
+		EXPECT_LE(latency_histogram::lower_bound(bucket), v);
+		EXPECT_GE(latency_histogram::upper_bound(bucket), v);
+		EXPECT_LE(latency_histogram::upper_bound(bucket) - latency_histogram::lower_bound(bucket), v / 16);
+	}
+	EXPECT_EQ(latency_histogram::bucket_of(uint64_t{1} << 50), latency_histogram::bucket_count - 1);
+
+	latency_histogram h;
+	for (uint64_t v = 1; v <= 1000; ++v) {
+		h.record(v * 1000);
+	}
+	EXPECT_EQ(h.count(), 1000u);
+	EXPECT_EQ(h.min(), 1000u);
+	EXPECT_EQ(h.max(), 1000000u);
+	EXPECT_DOUBLE_EQ(h.mean(), 500500.0);
+	EXPECT_NEAR(static_cast<double>(h.percentile(0.5)), 500000.0, 500000.0 / 16);
+	EXPECT_NEAR(static_cast<double>(h.percentile(0.99)), 990000.0, 990000.0 / 16);
+	EXPECT_EQ(h.percentile(1.0), 1000000u);
+	EXPECT_EQ(latency_histogram().percentile(0.5), 0u);
+}
+
+TEST(metrics_test, records_commands_bytes_elements_and_errors) {
+	metrics_registry registry;
+	auto store = std::make_shared<failing_connection>();
+	metered_connection connection(store, registry);
+
+	connection.set("k", "value");
+	EXPECT_EQ(connection.get("k").value_or(""), "value");
+	EXPECT_FALSE(connection.get("missing"));
+	connection.rpush("l", std::vector<std::string>{"a", "bb", "ccc"});
+	EXPECT_EQ(connection.lrange("l", 0, -1).size(), 3u);
+	EXPECT_THROW(connection.get("broken"), std::runtime_error);
+	std::unordered_map<std::string, std::optional<std::string>> fields{{"f", std::nullopt}};
+	connection.hset("h", "f", "vv");
+	connection.hget("h", fields);
+	EXPECT_EQ(fields["f"].value_or(""), "vv");
+	connection.pipeline({{"SET", "p", "1"}, {"INCR", "k"}, {"GET", "p"}});
+
+	const metrics_snapshot snapshot = registry.snapshot();
+	const command_stats &get = snapshot.commands.at("GET");
+	EXPECT_EQ(get.ops, 3u);
+	EXPECT_EQ(get.errors, 1u);
+	EXPECT_EQ(get.bytes_sent, 1u + 7u + 6u);
+	EXPECT_EQ(get.bytes_received, 5u);
+	EXPECT_EQ(get.latency.count(), 3u);
+	EXPECT_GE(get.latency.max(), get.latency.min());
+
+	const command_stats &lrange = snapshot.commands.at("LRANGE");
+	EXPECT_EQ(lrange.elements, 3u);
+	EXPECT_EQ(lrange.bytes_received, 6u);
+	EXPECT_EQ(snapshot.commands.at("SET").bytes_sent, 6u);
+	EXPECT_EQ(snapshot.commands.at("HMGET").bytes_received, 3u);
+
+	// The INCR of a non-integer is an error reply, counted without failing the pipeline
+	const command_stats &pipeline = snapshot.commands.at("PIPELINE");
+	EXPECT_EQ(pipeline.ops, 1u);
+	EXPECT_EQ(pipeline.elements, 3u);
+	EXPECT_EQ(pipeline.errors, 1u);
+	EXPECT_EQ(snapshot.gauges.at("pipeline_depth"), 3);
+	EXPECT_EQ(snapshot.gauges.at("pipeline_depth_max"), 3);
+	EXPECT_EQ(snapshot.commands.count("DEL"), 0u);
+}
+
+TEST(metrics_test, merges_the_shards_of_every_thread) {
+	metrics_registry registry;
+	metered_connection connection(std::make_shared<memory_connection>(), registry);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&connection, t] {
+			for (int i = 0; i < 1000; ++i) {
+				connection.incr("counter" + std::to_string(t), 1);
+			}
+		});
+	}
+	// Snapshots taken while recording are partial but never torn
+	for (int i = 0; i < 10; ++i) {
+		const metrics_snapshot partial = registry.snapshot();
+		auto it = partial.commands.find("INCRBY");
+		if (it != partial.commands.end()) {
+			EXPECT_LE(it->second.ops, 4000u);
+		}
+	}
+	for (auto &thread: threads) {
+		thread.join();
+	}
+	const metrics_snapshot snapshot = registry.snapshot();
+	EXPECT_EQ(snapshot.commands.at("INCRBY").ops, 4000u);
+	EXPECT_EQ(snapshot.commands.at("INCRBY").latency.count(), 4000u);
+	EXPECT_EQ(connection.get("counter3").value_or(""), "1000");
+
+	// Short-lived threads reuse the shards of exited ones, which keep their counts
+	for (int t = 0; t < 100; ++t) {
+		std::thread([&registry] {
+			for (int i = 0; i < 10; ++i) {
+				registry.record(metrics_registry::command_id("PING"), 1000, 1, 1, 0, 0);
+			}
+		}).join();
+	}
+	EXPECT_EQ(registry.snapshot().commands.at("PING").ops, 1000u);
+	EXPECT_EQ(registry.snapshot().commands.at("INCRBY").ops, 4000u);
+
+	// A thread may outlive a registry it recorded into
+	auto short_lived = std::make_unique<metrics_registry>();
+	std::mutex mutex;
+	std::condition_variable changed;
+	bool recorded = false;
+	bool destroyed = false;
+	std::thread outliving([&] {
+		short_lived->record(metrics_registry::command_id("PING"), 1000, 1, 1, 0, 0);
+		std::unique_lock<std::mutex> lock(mutex);
+		recorded = true;
+		changed.notify_all();
+		changed.wait(lock, [&destroyed] { return destroyed; });
+	});
+	{
+		std::unique_lock<std::mutex> lock(mutex);
+		changed.wait(lock, [&recorded] { return recorded; });
+		EXPECT_EQ(short_lived->snapshot().commands.at("PING").ops, 1u);
+		short_lived.reset();
+		destroyed = true;
+		changed.notify_all();
+	}
+	outliving.join();
+}
+
+TEST(metrics_test, disabled_registry_records_nothing) {
+	metrics_registry registry;
+	registry.set_enabled(false);
+	metered_connection connection(std::make_shared<memory_connection>(), registry);
+	connection.set("k", "v");
+	connection.pipeline({{"GET", "k"}});
+	const metrics_snapshot snapshot = registry.snapshot();
+	EXPECT_TRUE(snapshot.commands.empty());
+	EXPECT_EQ(snapshot.gauges.at("pipeline_depth"), 0);
+
+	registry.set_enabled(true);
+	connection.get("k");
+	EXPECT_EQ(registry.snapshot().commands.size(), 1u);
+	EXPECT_EQ(metrics_registry::command_id("GET"), metrics_registry::command_id("GET"));
+	EXPECT_EQ(metrics_registry::command_id("OTHER"), 0u);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,139 @@
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+namespace {
+struct recorded {
+	std::string command;
+	std::string key;
+	uint64_t batch;
+	uint64_t bytes_sent;
+	uint64_t bytes_received;
+	uint64_t elements;
+	uint64_t error_replies;
+	std::string error;
+};
+
+/* A static observer keeping every event */
+struct recording_observer {
+	std::shared_ptr<std::vector<recorded>> before = std::make_shared<std::vector<recorded>>();
+	std::shared_ptr<std::vector<recorded>> after = std::make_shared<std::vector<recorded>>();
+
+	void before_command(command_event &event) {
+		before->push_back(copy(event));
+	}
+
+	void after_reply(const command_event &event) {
+		EXPECT_GE(event.duration.count(), 0);
+		after->push_back(copy(event));
+	}
+
+	static recorded copy(const command_event &e) {
+		return {e.command, std::string(e.key), e.batch, e.bytes_sent, e.bytes_received, e.elements, e.error_replies,
+				e.error ? e.error : ""};
+	}
+};
+
+/* A static observer with only after_reply, switched by a flag */
+struct switchable_observer {
+	std::shared_ptr<bool> on = std::make_shared<bool>(false);
+	std::shared_ptr<int> calls = std::make_shared<int>(0);
+
+	bool active() const {
+		return *on;
+	}
+
+	void after_reply(const command_event &) {
+		++*calls;
+	}
+};
+
+class counting_observer: public command_observer {
+public:
+	void after_reply(const command_event &event) override {
+		++calls;
+		last = event.command;
+	}
+
+	int calls{0};
+	std::string last;
+};
+} // namespace
+
+TEST(observed_connection_test, static_observers_see_every_call) {
+	auto store = std::make_shared<memory_connection>();
+	recording_observer observer;
+	observed_connection<recording_observer> connection(store, observer);
+
+	connection.set("k", "value");
+	EXPECT_EQ(connection.hset("h", std::unordered_map<std::string, std::string>{{"f", "v"}}), true);
+	EXPECT_EQ(connection.hgetall("h").size(), 1u);
+	EXPECT_EQ(connection.del(std::vector<std::string>{"x", "y"}), 0);
+	EXPECT_THROW(connection.incr("k", 1), std::runtime_error);
+	connection.pipeline({{"GET", "k"}, {"INCR", "k"}});
+
+	const auto &after = *observer.after;
+	ASSERT_EQ(observer.before->size(), 6u);
+	ASSERT_EQ(after.size(), 6u);
+	EXPECT_EQ(after[0].command, "SET");
+	EXPECT_EQ(after[0].key, "k");
+	EXPECT_EQ(after[0].bytes_sent, 6u);
+	EXPECT_EQ(after[2].command, "HGETALL");
+	EXPECT_EQ(after[2].bytes_received, 2u);
+	EXPECT_EQ(after[2].elements, 1u);
+	EXPECT_EQ(after[3].key, "x");
+	EXPECT_EQ(after[4].command, "INCRBY");
+	EXPECT_FALSE(after[4].error.empty());
+	EXPECT_EQ(after[5].command, "PIPELINE");
+	EXPECT_EQ(after[5].key, "");
+	EXPECT_EQ(after[5].batch, 2u);
+	EXPECT_EQ(after[5].elements, 2u);
+	EXPECT_EQ(after[5].error_replies, 1u);
+	EXPECT_EQ((*observer.before)[5].bytes_received, 0u);
+}
+
+TEST(observed_connection_test, inactive_observers_are_skipped) {
+	switchable_observer observer;
+	observed_connection<switchable_observer> connection(std::make_shared<memory_connection>(), observer);
+	connection.set("k", "v");
+	EXPECT_EQ(*observer.calls, 0);
+	*observer.on = true;
+	connection.get("k");
+	EXPECT_EQ(*observer.calls, 1);
+	EXPECT_EQ(*connection.observer<switchable_observer>().calls, 1);
+
+	// Without observers the connection only forwards
+	observed_connection<> plain(std::make_shared<memory_connection>());
+	plain.set("k", "v");
+	EXPECT_EQ(plain.get("k").value_or(""), "v");
+}
+
+TEST(observed_connection_test, dynamic_observers_register_at_runtime) {
+	observed_connection<dynamic_observers, metrics_observer> connection(std::make_shared<memory_connection>());
+	auto observer = std::make_shared<counting_observer>();
+	connection.set("k", "v");
+	EXPECT_EQ(observer->calls, 0);
+
+	connection.observer<dynamic_observers>().add(observer);
+	connection.get("k");
+	connection.lpush("l", "a");
+	EXPECT_EQ(observer->calls, 2);
+	EXPECT_EQ(observer->last, "LPUSH");
+
+	EXPECT_TRUE(connection.observer<dynamic_observers>().remove(observer));
+	EXPECT_FALSE(connection.observer<dynamic_observers>().remove(observer));
+	connection.get("k");
+	EXPECT_EQ(observer->calls, 2);
+	EXPECT_THROW(connection.observer<dynamic_observers>().add(nullptr), std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,141 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+namespace {
+/* Sends a request to the listener and returns the whole response */
+std::string fetch(uint16_t port, const std::string &request) {
+	const int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	::inet_pton(AF_INET, "127.0.0.1", &address.sin_addr);
+	if (::connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) != 0) {
+		::close(fd);
+		throw std::runtime_error("cannot connect");
+	}
+	::send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+	std::string response;
+	char buffer[4096];
+	ssize_t n;
+	while ((n = ::read(fd, buffer, sizeof(buffer))) > 0) {
+		response.append(buffer, static_cast<size_t>(n));
+	}
+	::close(fd);
+	return response;
+}
+
+size_t occurrences(const std::string &text, const std::string &part) {
+	size_t count = 0;
+	for (size_t at = text.find(part); at != std::string::npos; at = text.find(part, at + 1)) {
+		++count;
+	}
+	return count;
+}
+} // namespace
+
+TEST(openmetrics_test, renders_commands_gauges_and_histograms) {
+	metrics_registry registry;
+	const size_t get = metrics_registry::command_id("GET");
+	registry.record(get, 30'000, 10, 100, 0, 0);
+	registry.record(get, 200'000, 10, 100, 0, 0);
+	registry.record(get, 3'000'000'000, 10, 0, 0, 1);
+	registry.gauge("pipeline_depth_max").set(7);
+
+	openmetrics_options options;
+	options.latency_bounds = {100'000, 1'000'000};
+	const std::string text = openmetrics_exporter(registry, options).render();
+
+	EXPECT_NE(text.find("# TYPE janus_commands counter\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_commands_total{command=\"GET\"} 3\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_errors_total{command=\"GET\"} 1\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_sent_bytes_total{command=\"GET\"} 30\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_received_bytes_total{command=\"GET\"} 200\n"), std::string::npos);
+	// Cumulative buckets in seconds
+	EXPECT_NE(text.find("# TYPE janus_command_duration_seconds histogram\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_duration_seconds_bucket{command=\"GET\",le=\"0.0001\"} 1\n"),
+			  std::string::npos);
+	EXPECT_NE(text.find("janus_command_duration_seconds_bucket{command=\"GET\",le=\"0.001\"} 2\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_duration_seconds_bucket{command=\"GET\",le=\"+Inf\"} 3\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_duration_seconds_count{command=\"GET\"} 3\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_command_duration_seconds_sum{command=\"GET\"} 3.00023\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_pipeline_depth_max 7\n"), std::string::npos);
+	ASSERT_GE(text.size(), 6u);
+	EXPECT_EQ(text.substr(text.size() - 6), "# EOF\n");
+}
+
+TEST(openmetrics_test, groups_the_samples_of_a_family) {
+	metrics_registry registry;
+	openmetrics_exporter exporter(registry);
+	tier_stats sessions;
+	sessions.hits = 3;
+	sessions.misses = 1;
+	tier_stats carts;
+	exporter.add_collector([&](openmetrics_writer &w) { write_stats(w, sessions, {{"tier", "sessions"}}); });
+	exporter.add_collector([&](openmetrics_writer &w) {
+		write_stats(w, carts, {{"tier", "ca\"rts\n"}});
+		w.gauge("compression.ratio", "Stored bytes per raw byte", 0.25);
+	});
+	const std::string text = exporter.render();
+
+	EXPECT_EQ(occurrences(text, "# TYPE janus_tier_hits counter\n"), 1u);
+	const size_t first = text.find("janus_tier_hits_total{tier=\"sessions\"} 3\n");
+	const size_t second = text.find("janus_tier_hits_total{tier=\"ca\\\"rts\\n\"} 0\n");
+	ASSERT_NE(first, std::string::npos);
+	ASSERT_NE(second, std::string::npos);
+	// Both samples follow the family's metadata, before the next family
+	EXPECT_LT(first, text.find("# TYPE janus_tier_misses"));
+	EXPECT_LT(second, text.find("# TYPE janus_tier_misses"));
+	EXPECT_NE(text.find("janus_tier_hit_ratio{tier=\"sessions\"} 0.75\n"), std::string::npos);
+	EXPECT_NE(text.find("janus_compression_ratio 0.25\n"), std::string::npos);
+
+	openmetrics_writer w;
+	w.counter("calls", nullptr, 1);
+	EXPECT_THROW(w.gauge("calls", nullptr, 1), std::invalid_argument);
+
+	// Binary keys are hex-encoded, as the exposition is UTF-8; valid UTF-8 is kept as is
+	hot_key_report report;
+	report.hot.push_back({std::string("user:\xff\x00", 7), 5});
+	report.hot.push_back({"caf\xc3\xa9", 4});
+	report.hot.push_back({"\xed\xa0\x80", 3});
+	openmetrics_writer keys;
+	write_stats(keys, report);
+	std::string exposition;
+	keys.finish(exposition);
+	EXPECT_NE(exposition.find("janus_hot_key_calls{key=\"0x757365723aff00\"} 5\n"), std::string::npos);
+	EXPECT_NE(exposition.find("janus_hot_key_calls{key=\"caf\xc3\xa9\"} 4\n"), std::string::npos);
+	EXPECT_NE(exposition.find("janus_hot_key_calls{key=\"0xeda080\"} 3\n"), std::string::npos);
+}
+
+TEST(openmetrics_test, serves_metrics_over_http) {
+	metrics_registry registry;
+	registry.record(metrics_registry::command_id("SET"), 1'000, 1, 0, 0, 0);
+	openmetrics_exporter exporter(registry);
+	openmetrics_listener listener(exporter, 0);
+	ASSERT_NE(listener.port(), 0);
+
+	const std::string ok = fetch(listener.port(), "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n");
+	EXPECT_EQ(ok.rfind("HTTP/1.1 200 OK\r\n", 0), 0u);
+	EXPECT_NE(ok.find(std::string("Content-Type: ") + openmetrics_exporter::content_type), std::string::npos);
+	EXPECT_NE(ok.find("janus_commands_total{command=\"SET\"} 1\n"), std::string::npos);
+
+	const std::string missing = fetch(listener.port(), "GET / HTTP/1.1\r\n\r\n");
+	EXPECT_EQ(missing.rfind("HTTP/1.1 404", 0), 0u);
+	const std::string post = fetch(listener.port(), "POST /metrics HTTP/1.1\r\n\r\n");
+	EXPECT_EQ(post.rfind("HTTP/1.1 405", 0), 0u);
+
+	EXPECT_THROW(openmetrics_listener(exporter, 0, "localhost"), std::invalid_argument);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
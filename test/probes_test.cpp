@@ -0,0 +1,56 @@
+// A program's own probes, from sdt.h included first, must not be affected by janus' probes
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define PROBES_TEST_SDT 1
+#endif
+#endif
+
+#include <memory>
+#include <string>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+TEST(probes_test, probes_are_off_without_a_tracer) {
+	EXPECT_FALSE(JANUS_PROBE_ENABLED(command__send));
+	EXPECT_FALSE(JANUS_PROBE_ENABLED(redis__receive));
+	EXPECT_FALSE(probe_observer().active());
+
+	// An unattached probe site costs nothing and changes nothing
+	observed_connection<probe_observer> connection(std::make_shared<memory_connection>());
+	connection.set("k", "v");
+	EXPECT_EQ(connection.get("k").value_or(""), "v");
+	auto tpl = std::make_shared<redis_template<std::string, std::string>>(
+		std::make_shared<memory_connection>(), std::make_shared<string_serializer<std::string>>(),
+		std::make_shared<string_serializer<std::string>>());
+	tpl->ops_for_value().set("k", "v");
+	EXPECT_EQ(tpl->ops_for_value().get("k").value_or(""), "v");
+}
+
+#ifdef JANUS_PROBES
+TEST(probes_test, semaphores_enable_probes) {
+	// What a tracer does while attached
+	janus_reply__receive_semaphore = 1;
+	EXPECT_TRUE(JANUS_PROBE_ENABLED(reply__receive));
+	EXPECT_TRUE(probe_observer().active());
+	observed_connection<probe_observer> connection(std::make_shared<memory_connection>());
+	connection.set("k", "v");
+	EXPECT_EQ(connection.get("k").value_or(""), "v");
+	janus_reply__receive_semaphore = 0;
+	EXPECT_FALSE(probe_observer().active());
+}
+#endif
+
+#ifdef PROBES_TEST_SDT
+TEST(probes_test, own_probes_still_link) {
+	int fired = 0;
+	DTRACE_PROBE2(probes_test, own, fired, 1);
+	EXPECT_EQ(fired, 0);
+}
+#endif
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,162 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class rate_limiter_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = std::string;
+	using limiter_type = rate_limiter<key_type, value_type>;
+
+	const key_type TEST_KEY = "test_rate_limiter";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		tpl->del(std::vector<key_type>{TEST_KEY, TEST_KEY + ":seq"});
+	}
+};
+
+// --- Test Cases ---
+
+TEST_F(rate_limiter_test, sliding_window) {
+	limiter_type limiter(*tpl, limiter_type::algorithm::sliding_window, 5, std::chrono::milliseconds(1000));
+
+	for (int i = 0; i < 5; ++i) {
+		auto decision = limiter.try_acquire(TEST_KEY);
+		EXPECT_TRUE(decision.allowed) << "Permit " << i << " within the limit was denied.";
+		EXPECT_EQ(decision.remaining, 4 - i);
+	}
+
+	auto denied = limiter.try_acquire(TEST_KEY);
+	EXPECT_FALSE(denied.allowed) << "Permit above the limit was granted.";
+	EXPECT_GT(denied.retry_after.count(), 0);
+	EXPECT_LE(denied.retry_after.count(), 1001);
+
+	// Requests above the limit are never granted
+	EXPECT_FALSE(limiter.try_acquire(TEST_KEY, 6).allowed);
+}
+
+TEST_F(rate_limiter_test, sliding_window_recovers) {
+	limiter_type limiter(*tpl, limiter_type::algorithm::sliding_window, 2, std::chrono::milliseconds(200));
+
+	EXPECT_TRUE(limiter.try_acquire(TEST_KEY, 2).allowed);
+	auto denied = limiter.try_acquire(TEST_KEY);
+	ASSERT_FALSE(denied.allowed);
+
+	std::this_thread::sleep_for(denied.retry_after + std::chrono::milliseconds(20));
+	EXPECT_TRUE(limiter.try_acquire(TEST_KEY).allowed) << "Permit was not granted after retry_after.";
+}
+
+TEST_F(rate_limiter_test, gcra) {
+	limiter_type limiter(*tpl, limiter_type::algorithm::gcra, 10, std::chrono::milliseconds(10000));
+
+	// The full burst is available at once
+	EXPECT_TRUE(limiter.try_acquire(TEST_KEY, 10).allowed);
+
+	auto denied = limiter.try_acquire(TEST_KEY);
+	EXPECT_FALSE(denied.allowed) << "Permit above the burst capacity was granted.";
+	// One permit is emitted every 1000 ms
+	EXPECT_GT(denied.retry_after.count(), 900);
+	EXPECT_LE(denied.retry_after.count(), 1000);
+}
+
+TEST_F(rate_limiter_test, leased_permits_respect_limit) {
+	for (auto algo: {limiter_type::algorithm::sliding_window, limiter_type::algorithm::gcra}) {
+		clear_test_keys();
+		limiter_type limiter(*tpl, algo, 10, std::chrono::milliseconds(10000), 4);
+
+		int allowed = 0;
+		for (int i = 0; i < 25; ++i) {
+			if (limiter.try_acquire(TEST_KEY).allowed) ++allowed;
+		}
+		// Leases of 4 + 4 + 2 permits
+		EXPECT_EQ(allowed, 10) << "Leased limiter granted an incorrect number of permits.";
+
+		// A second process sharing the key sees the permits as consumed
+		limiter_type other(*tpl, algo, 10, std::chrono::milliseconds(10000), 4);
+		EXPECT_FALSE(other.try_acquire(TEST_KEY).allowed);
+	}
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,349 @@
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+namespace {
+/* Writes RDB files byte by byte, with the encodings Redis uses */
+class rdb_builder {
+public:
+	explicit rdb_builder(int version = 11) {
+		data = "REDIS";
+		const std::string v = std::to_string(version);
+		data += std::string(4 - v.size(), '0') + v;
+	}
+
+	rdb_builder &byte(int b) {
+		data += static_cast<char>(b);
+		return *this;
+	}
+
+	rdb_builder &raw(const std::string &bytes) {
+		data += bytes;
+		return *this;
+	}
+
+	rdb_builder &le(uint64_t v, int bytes) {
+		for (int i = 0; i < bytes; ++i) {
+			byte(static_cast<int>((v >> (8 * i)) & 0xff));
+		}
+		return *this;
+	}
+
+	rdb_builder &length(uint64_t n) {
+		if (n < 64) return byte(static_cast<int>(n));
+		if (n < 16384) return byte(0x40 | static_cast<int>(n >> 8)).byte(static_cast<int>(n & 0xff));
+		byte(0x80);
+		for (int i = 3; i >= 0; --i) {
+			byte(static_cast<int>((n >> (8 * i)) & 0xff));
+		}
+		return *this;
+	}
+
+	rdb_builder &string(const std::string &s) {
+		return length(s.size()).raw(s);
+	}
+
+	rdb_builder &eof(bool with_checksum = true) {
+		byte(0xff);
+		return le(with_checksum ? crc64(0, data.data(), data.size()) : 0, 8);
+	}
+
+	std::string data;
+};
+
+std::string lp_string(const std::string &s) {
+	std::string e(1, static_cast<char>(0x80 | s.size()));
+	e += s;
+	e += static_cast<char>(e.size());
+	return e;
+}
+
+std::string lp_uint7(int v) {
+	return std::string{static_cast<char>(v), 1};
+}
+
+std::string lp_int13(int v) {
+	const int u = v < 0 ? v + (1 << 13) : v;
+	return std::string{static_cast<char>(0xc0 | (u >> 8)), static_cast<char>(u & 0xff), 2};
+}
+
+std::string lp_int16(int v) {
+	const auto u = static_cast<uint16_t>(v);
+	return std::string{static_cast<char>(0xf1), static_cast<char>(u & 0xff), static_cast<char>(u >> 8), 3};
+}
+
+std::string listpack(const std::vector<std::string> &entries) {
+	std::string body;
+	for (const auto &e: entries) {
+		body += e;
+	}
+	rdb_builder b;
+	b.data.clear();
+	b.le(6 + body.size() + 1, 4).le(entries.size(), 2).raw(body).byte(0xff);
+	return b.data;
+}
+
+/* Ziplist entries: strings under 64 bytes and immediates 0..12 */
+std::string ziplist(const std::vector<std::string> &entries) {
+	std::string body;
+	size_t previous = 0;
+	for (const auto &e: entries) {
+		std::string entry(1, static_cast<char>(previous));
+		const bool immediate = e.size() <= 2 && std::isdigit(static_cast<unsigned char>(e[0])) && std::stoi(e) <= 12;
+		if (immediate) {
+			entry += static_cast<char>(0xf1 + std::stoi(e));
+		}
+		else {
+			entry += static_cast<char>(e.size());
+			entry += e;
+		}
+		previous = entry.size();
+		body += entry;
+	}
+	rdb_builder b;
+	b.data.clear();
+	b.le(10 + body.size() + 1, 4).le(0, 4).le(entries.size(), 2).raw(body).byte(0xff);
+	return b.data;
+}
+
+std::vector<rdb_entry> parse_all(const std::string &data, rdb_options options = {}) {
+	std::istringstream in(data);
+	rdb_parser parser(in, options);
+	std::vector<rdb_entry> entries;
+	rdb_entry entry;
+	while (parser.next(entry)) {
+		entries.push_back(entry);
+	}
+	return entries;
+}
+} // namespace
+
+TEST(rdb_parser_test, reads_strings_expiries_and_metadata) {
+	rdb_builder b;
+	b.byte(0xfa).string("redis-ver").string("7.2.4");
+	b.byte(0xfe).length(0).byte(0xfb).length(4).length(1);
+	b.byte(0).string("plain").string("hello");
+	// Integer encodings: 8 and 32 bit
+	b.byte(0).string("small").byte(0xc0).byte(123);
+	b.byte(0).string("negative").byte(0xc2).le(static_cast<uint32_t>(-100000), 4);
+	// LZF: a literal run "abc", then a back reference copying 9 bytes from 3 bytes back
+	b.byte(0xfc).le(1700000000123ULL, 8);
+	b.byte(0).string("compressed").byte(0xc3).length(7).length(12).raw(std::string("\x02" "abc" "\xe0\x00\x02", 7));
+	b.byte(0xfe).length(3);
+	b.byte(0xfd).le(1700000000, 4).byte(0xf9).byte(7);
+	b.byte(0).string("in_db3").string(std::string(50, 'x'));
+	b.eof();
+
+	std::istringstream in(b.data);
+	rdb_parser parser(in);
+	EXPECT_EQ(parser.version(), 11);
+	std::vector<rdb_entry> entries;
+	rdb_entry entry;
+	while (parser.next(entry)) {
+		entries.push_back(entry);
+	}
+	EXPECT_FALSE(parser.next(entry));
+	EXPECT_EQ(parser.aux().at("redis-ver"), "7.2.4");
+	ASSERT_EQ(entries.size(), 5u);
+
+	EXPECT_EQ(entries[0].key, "plain");
+	EXPECT_EQ(entries[0].value, "hello");
+	EXPECT_EQ(entries[0].encoding, "embstr");
+	EXPECT_EQ(entries[0].expire_at, -1);
+	EXPECT_EQ(entries[0].rdb_size, 1u + 6 + 6);
+	EXPECT_EQ(entries[1].value, "123");
+	EXPECT_EQ(entries[1].encoding, "int");
+	EXPECT_EQ(entries[2].value, "-100000");
+	EXPECT_EQ(entries[3].value, "abcabcabcabc");
+	EXPECT_EQ(entries[3].expire_at, 1700000000123LL);
+	EXPECT_EQ(entries[4].db, 3);
+	EXPECT_EQ(entries[4].expire_at, 1700000000000LL);
+	EXPECT_EQ(entries[4].freq, 7);
+	EXPECT_EQ(entries[4].encoding, "raw");
+
+	// A damaged byte is caught by the checksum, unless the file was saved without one
+	std::string damaged = b.data;
+	damaged[damaged.find("hello")] = 'j';
+	EXPECT_THROW(parse_all(damaged), std::runtime_error);
+	rdb_options unchecked;
+	unchecked.verify_checksum = false;
+	EXPECT_EQ(parse_all(damaged, unchecked)[0].value, "jello");
+	rdb_builder no_checksum;
+	no_checksum.byte(0).string("k").string("v").eof(false);
+	EXPECT_EQ(parse_all(no_checksum.data).size(), 1u);
+
+	// Truncated files and other formats
+	EXPECT_THROW(parse_all(b.data.substr(0, b.data.size() - 20)), std::runtime_error);
+	EXPECT_THROW(parse_all("NOTREDIS0011"), std::runtime_error);
+	EXPECT_THROW(parse_all("REDIS0099"), std::runtime_error);
+}
+
+TEST(rdb_parser_test, skips_function_libraries) {
+	// Redis 7 writes one record per library loaded with FUNCTION LOAD, ahead of the keys
+	rdb_builder b;
+	b.byte(0xfa).string("redis-ver").string("7.2.4");
+	b.byte(0xf5).string("#!lua name=mylib\nredis.register_function('f', function() return 1 end)");
+	b.byte(0xfe).length(0).byte(0).string("k").string("v");
+	b.byte(0xf5).string(std::string(100, 'x'));
+	b.eof();
+	const auto entries = parse_all(b.data);
+	ASSERT_EQ(entries.size(), 1u);
+	EXPECT_EQ(entries[0].key, "k");
+	EXPECT_EQ(entries[0].value, "v");
+
+	// The layout of the 7.0 release candidates is refused by name rather than as an unknown value type
+	rdb_builder pre_ga;
+	pre_ga.byte(0xf6).string("mylib").string("LUA").byte(0).string("code");
+	pre_ga.eof();
+	try {
+		parse_all(pre_ga.data);
+		FAIL() << "pre-GA function records were accepted";
+	} catch (const std::runtime_error &e) {
+		EXPECT_NE(std::string(e.what()).find("pre-GA"), std::string::npos);
+	}
+}
+
+TEST(rdb_parser_test, decodes_compact_encodings) {
+	rdb_builder b;
+	// Quicklist 2: a packed listpack node, then a plain node
+	b.byte(18).string("list").length(2);
+	b.length(2).string(listpack({lp_string("a"), lp_uint7(7), lp_int13(-5), lp_int16(1000)}));
+	b.length(1).string("big element");
+	// Quicklist 1: ziplist nodes
+	b.byte(14).string("old_list").length(1).string(ziplist({"x", "3", "yz"}));
+	// Intset of 16 bit integers
+	rdb_builder intset;
+	intset.data.clear();
+	intset.le(2, 4).le(3, 4).le(static_cast<uint16_t>(-2), 2).le(5, 2).le(300, 2);
+	b.byte(11).string("ints").string(intset.data);
+	b.byte(20).string("set").string(listpack({lp_string("m1"), lp_string("m2")}));
+	b.byte(17).string("zset").string(listpack({lp_string("low"), lp_int13(-3), lp_string("high"), lp_string("2.5")}));
+	b.byte(16).string("hash").string(listpack({lp_string("f1"), lp_string("v1"), lp_string("f2"), lp_uint7(9)}));
+	b.byte(13).string("old_hash").string(ziplist({"f", "v"}));
+	// Zipmap: zmlen, then length-prefixed field and value, with one free byte after the value
+	b.byte(9).string("zipmap").string(std::string("\x01\x01" "a" "\x02\x01" "bc" "?" "\xff", 9));
+	// Skiplist sorted sets, with binary and text scores
+	b.byte(5).string("zset2").length(2).string("a");
+	double score = 1.25;
+	uint64_t bits;
+	std::memcpy(&bits, &score, sizeof(bits));
+	b.le(bits, 8).string("b").le(0, 8);
+	b.byte(3).string("zset1").length(2).string("inf").byte(254).string("n").byte(4).raw("-0.5");
+	b.byte(2).string("hset").length(1).string("member");
+	b.byte(4).string("dict").length(1).string("field").string("value");
+	b.eof();
+
+	std::map<std::string, rdb_entry> by_key;
+	for (auto &e: parse_all(b.data)) {
+		by_key[e.key] = e;
+	}
+	ASSERT_EQ(by_key.size(), 12u);
+	EXPECT_EQ(by_key["list"].type, rdb_type::list);
+	EXPECT_EQ(by_key["list"].encoding, "quicklist");
+	EXPECT_EQ(by_key["list"].elements, (std::vector<std::string>{"a", "7", "-5", "1000", "big element"}));
+	EXPECT_EQ(by_key["old_list"].elements, (std::vector<std::string>{"x", "3", "yz"}));
+	EXPECT_EQ(by_key["ints"].encoding, "intset");
+	EXPECT_EQ(by_key["ints"].elements, (std::vector<std::string>{"-2", "5", "300"}));
+	EXPECT_EQ(by_key["set"].elements, (std::vector<std::string>{"m1", "m2"}));
+	ASSERT_EQ(by_key["zset"].members.size(), 2u);
+	EXPECT_EQ(by_key["zset"].members[0], (std::pair<std::string, double>{"low", -3}));
+	EXPECT_EQ(by_key["zset"].members[1], (std::pair<std::string, double>{"high", 2.5}));
+	EXPECT_EQ(by_key["hash"].fields,
+			  (std::vector<std::pair<std::string, std::string>>{{"f1", "v1"}, {"f2", "9"}}));
+	EXPECT_EQ(by_key["old_hash"].encoding, "ziplist");
+	EXPECT_EQ(by_key["old_hash"].fields, (std::vector<std::pair<std::string, std::string>>{{"f", "v"}}));
+	EXPECT_EQ(by_key["zipmap"].fields, (std::vector<std::pair<std::string, std::string>>{{"a", "bc"}}));
+	EXPECT_EQ(by_key["zset2"].members[0].second, 1.25);
+	EXPECT_EQ(by_key["zset2"].encoding, "skiplist");
+	EXPECT_TRUE(std::isinf(by_key["zset1"].members[0].second));
+	EXPECT_EQ(by_key["zset1"].members[1].second, -0.5);
+	EXPECT_EQ(by_key["hset"].encoding, "hashtable");
+	EXPECT_EQ(by_key["dict"].fields[0].second, "value");
+
+	// Out-of-bounds lengths inside a blob are rejected
+	rdb_builder bad;
+	std::string lp = listpack({lp_string("abc")});
+	lp[6] = static_cast<char>(0x80 | 40);
+	bad.byte(20).string("set").string(lp).eof();
+	EXPECT_THROW(parse_all(bad.data), std::runtime_error);
+}
+
+TEST(rdb_parser_test, emits_typed_entries_through_template_serializers) {
+	rdb_builder b;
+	b.byte(11).string("ids").string(std::string("\x02\x00\x00\x00\x02\x00\x00\x00\x07\x00\x2a\x00", 12));
+	b.byte(0).string("count").byte(0xc0).byte(42);
+	b.eof();
+
+	auto tpl = std::make_shared<redis_template<std::string, int>>(std::make_shared<memory_connection>(),
+																	std::make_shared<string_serializer<std::string>>(),
+																	std::make_shared<string_serializer<int>>());
+	std::istringstream in(b.data);
+	rdb_parser parser(in);
+	rdb_typed_entry<std::string, int> entry;
+	ASSERT_TRUE(parser.next(entry, *tpl));
+	EXPECT_EQ(entry.key, "ids");
+	EXPECT_EQ(entry.type, rdb_type::set);
+	EXPECT_EQ(entry.elements, (std::vector<int>{7, 42}));
+	ASSERT_TRUE(parser.next(entry, *tpl));
+	EXPECT_EQ(entry.value.value_or(0), 42);
+	EXPECT_FALSE(parser.next(entry, *tpl));
+}
+
+TEST(rdb_parser_redis_test, parses_a_dump_of_the_local_server) {
+	std::string host = DEFAULT_REDIS_HOST;
+	unsigned short port = DEFAULT_REDIS_PORT;
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = static_cast<unsigned short>(std::atoi(env_port));
+	std::shared_ptr<kv_connection> c;
+	try {
+		c = std::make_shared<redis_connection>(host, port);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	c->del(std::vector<std::string>{"test_rdb_string", "test_rdb_list", "test_rdb_hash", "test_rdb_zset"});
+	c->set("test_rdb_string", std::string(100, 'a'));
+	c->rpush("test_rdb_list", std::vector<std::string>{"x", "1", "-20000"});
+	c->hset("test_rdb_hash", "f", "v");
+	c->zadd("test_rdb_zset", {{"m", 1.5}});
+	c->expire("test_rdb_hash", 1000);
+	auto replies = c->pipeline({{"SAVE"}, {"CONFIG", "GET", "dir"}, {"CONFIG", "GET", "dbfilename"}});
+	if (replies[0].is_error() || replies[1].elements.size() < 2 || replies[2].elements.size() < 2) {
+		GTEST_SKIP() << "SAVE or CONFIG GET is not allowed";
+	}
+	const std::string path = replies[1].elements[1].str + "/" + replies[2].elements[1].str;
+	if (!std::filesystem::exists(path)) GTEST_SKIP() << "The dump is not on this host: " << path;
+
+	rdb_parser parser(path);
+	std::map<std::string, rdb_entry> found;
+	rdb_entry entry;
+	while (parser.next(entry)) {
+		if (entry.key.rfind("test_rdb_", 0) == 0) found[entry.key] = entry;
+	}
+	EXPECT_EQ(found["test_rdb_string"].value, std::string(100, 'a'));
+	EXPECT_EQ(found["test_rdb_list"].elements, (std::vector<std::string>{"x", "1", "-20000"}));
+	EXPECT_EQ(found["test_rdb_hash"].fields, (std::vector<std::pair<std::string, std::string>>{{"f", "v"}}));
+	EXPECT_GT(found["test_rdb_hash"].expire_at, 0);
+	EXPECT_EQ(found["test_rdb_zset"].members[0].second, 1.5);
+	EXPECT_FALSE(parser.aux().empty());
+	c->del(std::vector<std::string>{"test_rdb_string", "test_rdb_list", "test_rdb_hash", "test_rdb_zset"});
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
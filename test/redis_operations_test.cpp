@@ -246,6 +246,31 @@ TEST_F(redis_operations_functional_test, pttl_and_pexpire) {
 		<< "PTTL must decrease by at least the sleep time.";
 }
 
+// -----------------------------------------------------------------------------
+// Test Case 4: a pipeline that fails partway
+// -----------------------------------------------------------------------------
+
+// Test: the replies a failed pipeline left unread are not taken by the next command.
+TEST_F(redis_operations_functional_test, pipeline_failure_does_not_leak_replies) {
+	const auto id = conn->pipeline({{"CLIENT", "ID"}});
+	ASSERT_EQ(id.size(), 1u);
+	ASSERT_EQ(id[0].type, kv_reply::reply_type::integer);
+
+	// The server closes the connection after the kill: the replies of the later commands never arrive
+	EXPECT_THROW(conn->pipeline({{"CLIENT", "KILL", "ID", std::to_string(id[0].integer), "SKIPME", "no"},
+								 {"SET", test_key_single, "1"},
+								 {"GET", test_key_single}}),
+				 std::runtime_error);
+
+	// The next commands reconnect and see their own replies
+	set_test_key(test_key_single);
+	EXPECT_TRUE(tpl->exists(test_key_single));
+	const auto replies = conn->pipeline({{"PING"}, {"ECHO", "after"}});
+	ASSERT_EQ(replies.size(), 2u);
+	EXPECT_EQ(replies[0].str, "PONG");
+	EXPECT_EQ(replies[1].str, "after");
+}
+
 int main(int argc, char **argv) {
 	testing::InitGoogleTest(&argc, argv);
 	return RUN_ALL_TESTS();
@@ -0,0 +1,331 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+namespace {
+/* Writes the few RDB records the tests need */
+class rdb_builder {
+public:
+	rdb_builder() : data("REDIS0011") {
+	}
+
+	rdb_builder &byte(int b) {
+		data += static_cast<char>(b);
+		return *this;
+	}
+
+	rdb_builder &le(uint64_t v, int bytes) {
+		for (int i = 0; i < bytes; ++i) {
+			byte(static_cast<int>((v >> (8 * i)) & 0xff));
+		}
+		return *this;
+	}
+
+	rdb_builder &string(const std::string &s) {
+		return byte(static_cast<int>(s.size())).raw(s);
+	}
+
+	rdb_builder &raw(const std::string &bytes) {
+		data += bytes;
+		return *this;
+	}
+
+	std::string finish() {
+		byte(0xff);
+		le(crc64(0, data.data(), data.size()), 8);
+		return data;
+	}
+
+	std::string data;
+};
+
+/* A primary speaking just enough of the replication protocol, one replica at a time */
+class fake_primary {
+public:
+	fake_primary() {
+		listener = ::socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		socklen_t size = sizeof(address);
+		if (::bind(listener, reinterpret_cast<sockaddr *>(&address), size) != 0 || ::listen(listener, 4) != 0
+			|| ::getsockname(listener, reinterpret_cast<sockaddr *>(&address), &size) != 0) {
+			throw std::runtime_error("fake_primary: cannot listen");
+		}
+		port = ntohs(address.sin_port);
+	}
+
+	~fake_primary() {
+		drop();
+		::close(listener);
+	}
+
+	void accept() {
+		drop();
+		client = ::accept(listener, nullptr, nullptr);
+		timeval timeout{5, 0};
+		::setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	}
+
+	/* Answers the handshake up to PSYNC, and returns the PSYNC arguments */
+	std::vector<std::string> handshake() {
+		EXPECT_EQ(read_command(), std::vector<std::string>{"PING"});
+		send("+PONG\r\n");
+		EXPECT_EQ(read_command()[0], "REPLCONF");
+		send("+OK\r\n");
+		return read_command();
+	}
+
+	std::vector<std::string> read_command() {
+		long long count = std::atoll(read_line().c_str() + 1);
+		std::vector<std::string> argv;
+		for (long long i = 0; i < count; ++i) {
+			const size_t length = std::strtoull(read_line().c_str() + 1, nullptr, 10);
+			while (input.size() < length + 2) {
+				receive();
+			}
+			argv.push_back(input.substr(0, length));
+			input.erase(0, length + 2);
+		}
+		return argv;
+	}
+
+	void send(const std::string &data) {
+		ASSERT_EQ(::send(client, data.data(), data.size(), MSG_NOSIGNAL), static_cast<ssize_t>(data.size()));
+	}
+
+	void drop() {
+		if (client >= 0) ::close(client);
+		client = -1;
+		input.clear();
+	}
+
+	static std::string command(const std::vector<std::string> &argv) {
+		std::string out = "*" + std::to_string(argv.size()) + "\r\n";
+		for (const auto &arg: argv) {
+			out += "$" + std::to_string(arg.size()) + "\r\n" + arg + "\r\n";
+		}
+		return out;
+	}
+
+	int port{0};
+
+private:
+	std::string read_line() {
+		size_t end;
+		while ((end = input.find("\r\n")) == std::string::npos) {
+			receive();
+		}
+		std::string line = input.substr(0, end);
+		input.erase(0, end + 2);
+		return line;
+	}
+
+	void receive() {
+		char buffer[4096];
+		const ssize_t n = ::recv(client, buffer, sizeof(buffer), 0);
+		if (n <= 0) throw std::runtime_error("fake_primary: replica is gone");
+		input.append(buffer, static_cast<size_t>(n));
+	}
+
+	int listener{-1};
+	int client{-1};
+	std::string input;
+};
+
+const std::string replid(40, 'a');
+
+std::string snapshot() {
+	rdb_builder rdb;
+	rdb.byte(0xfe).byte(0);
+	rdb.byte(0).string("s").string("1");
+	rdb.byte(1).string("l").byte(2).string("x").string("y");
+	rdb.byte(4).string("h0").byte(1).string("f").string("v");
+	// Expires in an hour, and one that already expired
+	const auto now = std::chrono::duration_cast<std::chrono::milliseconds>(
+						 std::chrono::system_clock::now().time_since_epoch())
+						 .count();
+	rdb.byte(0xfc).le(static_cast<uint64_t>(now + 3600000), 8).byte(0).string("t").string("v");
+	rdb.byte(0xfc).le(static_cast<uint64_t>(now - 1000), 8).byte(0).string("gone").string("v");
+	rdb.byte(0xfe).byte(1);
+	rdb.byte(0).string("other").string("v");
+	return rdb.finish();
+}
+} // namespace
+
+TEST(replica_connection_test, full_sync_stream_and_partial_resync) {
+	fake_primary primary;
+	replica_options options;
+	options.reconnect_delay = std::chrono::milliseconds(10);
+	replica_connection replica("127.0.0.1", primary.port, options);
+	EXPECT_THROW(replica.get("s"), std::runtime_error);
+
+	primary.accept();
+	EXPECT_EQ(primary.handshake(), (std::vector<std::string>{"PSYNC", "?", "-1"}));
+	const std::string rdb = snapshot();
+	primary.send("+FULLRESYNC " + replid + " 100\r\n\n\n$" + std::to_string(rdb.size()) + "\r\n" + rdb);
+	ASSERT_TRUE(replica.wait_for_sync(std::chrono::seconds(5)));
+
+	EXPECT_EQ(replica.offset(), 100u);
+	EXPECT_EQ(replica.get("s").value_or(""), "1");
+	EXPECT_EQ(replica.lrange("l", 0, -1), (std::vector<std::string>{"x", "y"}));
+	EXPECT_EQ(replica.hget("h0", "f").value_or(""), "v");
+	EXPECT_GT(replica.ttl("t"), 3500);
+	EXPECT_FALSE(replica.exists("gone"));
+	EXPECT_FALSE(replica.exists("other"));
+	EXPECT_THROW(replica.set("s", "2"), std::runtime_error);
+	const auto replies = replica.pipeline({{"GET", "s"}, {"INCR", "s"}});
+	EXPECT_EQ(replies[0].str, "1");
+	EXPECT_TRUE(replies[1].is_error());
+
+	std::string stream;
+	for (const auto &argv: std::vector<std::vector<std::string>>{
+			 {"SELECT", "0"}, {"SET", "a", "1"}, {"PING"}, {"SELECT", "1"}, {"SET", "other", "2"}, {"SELECT", "0"},
+			 {"MULTI"}, {"HSET", "h", "f", "v"}, {"XADD", "s2", "*", "k", "v"}, {"INCR", "a"}, {"EXEC"},
+			 {"DEL", "s"}}) {
+		stream += fake_primary::command(argv);
+	}
+	const std::string getack = fake_primary::command({"REPLCONF", "GETACK", "*"});
+	primary.send(stream + getack);
+	EXPECT_EQ(primary.read_command(),
+			  (std::vector<std::string>{"REPLCONF", "ACK", std::to_string(100 + stream.size())}));
+	const uint64_t end = 100 + stream.size() + getack.size();
+	ASSERT_TRUE(replica.wait_for_offset(end, std::chrono::seconds(5)));
+	EXPECT_EQ(replica.get("a").value_or(""), "2");
+	EXPECT_EQ(replica.hget("h", "f").value_or(""), "v");
+	EXPECT_FALSE(replica.exists("s"));
+	EXPECT_FALSE(replica.exists("other"));
+	EXPECT_EQ(replica.stats().skipped_commands, 1u);
+
+	// The link breaks: the replica resumes where it stopped, keeping its data meanwhile
+	primary.drop();
+	primary.accept();
+	EXPECT_EQ(primary.handshake(), (std::vector<std::string>{"PSYNC", replid, std::to_string(end + 1)}));
+	EXPECT_EQ(replica.get("a").value_or(""), "2");
+	primary.send("+CONTINUE\r\n" + fake_primary::command({"SET", "b", "3"}));
+	const uint64_t resumed = end + fake_primary::command({"SET", "b", "3"}).size();
+	ASSERT_TRUE(replica.wait_for_offset(resumed, std::chrono::seconds(5)));
+	EXPECT_EQ(replica.get("b").value_or(""), "3");
+
+	const auto stats = replica.stats();
+	EXPECT_EQ(stats.full_syncs, 1u);
+	EXPECT_EQ(stats.partial_syncs, 1u);
+	EXPECT_EQ(stats.link_failures, 1u);
+	EXPECT_EQ(stats.replid, replid);
+	EXPECT_TRUE(stats.link_up);
+}
+
+TEST(replica_connection_test, unimplemented_commands_leave_no_stale_keys) {
+	fake_primary primary;
+	replica_options options;
+	options.reconnect_delay = std::chrono::milliseconds(10);
+	replica_connection replica("127.0.0.1", primary.port, options);
+	primary.accept();
+	primary.handshake();
+	const std::string rdb = snapshot();
+	primary.send("+FULLRESYNC " + replid + " 0\r\n$" + std::to_string(rdb.size()) + "\r\n" + rdb);
+	ASSERT_TRUE(replica.wait_for_sync(std::chrono::seconds(5)));
+
+	std::string stream;
+	for (const auto &argv: std::vector<std::vector<std::string>>{
+			 {"RENAME", "s", "renamed"}, {"MULTI"}, {"LREM", "l", "0", "x"}, {"SET", "a", "1"}, {"EXEC"},
+			 {"APPEND", "renamed", "0"}, {"SET", "s", "2"}}) {
+		stream += fake_primary::command(argv);
+	}
+	primary.send(stream);
+	ASSERT_TRUE(replica.wait_for_offset(stream.size(), std::chrono::seconds(5)));
+	EXPECT_EQ(replica.stats().skipped_commands, 2u);
+	// Neither the old values nor "not found": the replica does not know them
+	EXPECT_THROW(replica.get("renamed"), std::runtime_error);
+	EXPECT_THROW(replica.lrange("l", 0, -1), std::runtime_error);
+	const auto replies = replica.pipeline({{"GET", "a"}, {"LLEN", "l"}});
+	EXPECT_EQ(replies[0].str, "1");
+	EXPECT_TRUE(replies[1].is_error());
+	// Replaced by the primary since
+	EXPECT_EQ(replica.get("s").value_or(""), "2");
+
+	// A command naming no key may have changed anything: the replica synchronizes again
+	primary.send(fake_primary::command({"SWAPDB", "0", "1"}));
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (replica.stats().synced && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_THROW(replica.get("a"), std::runtime_error);
+	primary.accept();
+	EXPECT_EQ(primary.handshake(), (std::vector<std::string>{"PSYNC", "?", "-1"}));
+	primary.send("+FULLRESYNC " + replid + " 500\r\n$" + std::to_string(rdb.size()) + "\r\n" + rdb);
+	ASSERT_TRUE(replica.wait_for_offset(500, std::chrono::seconds(5)));
+	EXPECT_EQ(replica.lrange("l", 0, -1), (std::vector<std::string>{"x", "y"}));
+	EXPECT_FALSE(replica.exists("renamed"));
+	EXPECT_EQ(replica.stats().full_syncs, 2u);
+}
+
+TEST(replica_connection_test, reads_fail_when_the_primary_is_silent) {
+	fake_primary primary;
+	replica_options options;
+	options.max_lag = std::chrono::milliseconds(100);
+	replica_connection replica("127.0.0.1", primary.port, options);
+	primary.accept();
+	primary.handshake();
+	const std::string rdb = rdb_builder().finish();
+	primary.send("+FULLRESYNC " + replid + " 0\r\n$" + std::to_string(rdb.size()) + "\r\n" + rdb);
+	ASSERT_TRUE(replica.wait_for_sync(std::chrono::seconds(5)));
+	EXPECT_FALSE(replica.exists("k"));
+	EXPECT_FALSE(replica.wait_for_offset(1, std::chrono::milliseconds(10)));
+
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	EXPECT_THROW(replica.exists("k"), std::runtime_error);
+	// Any data from the primary, such as its periodic PING, refreshes the link
+	primary.send(fake_primary::command({"PING"}));
+	ASSERT_TRUE(replica.wait_for_offset(14, std::chrono::seconds(5)));
+	EXPECT_FALSE(replica.exists("k"));
+}
+
+TEST(replica_connection_redis_test, follows_a_redis_primary) {
+	std::string host = DEFAULT_REDIS_HOST;
+	int port = DEFAULT_REDIS_PORT;
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = std::atoi(env_port);
+
+	std::shared_ptr<redis_connection> primary;
+	try {
+		primary = std::make_shared<redis_connection>(host, port);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	primary->set("test_replica_key", "v1");
+	replica_connection replica(host, port);
+	ASSERT_TRUE(replica.wait_for_sync(std::chrono::seconds(30))) << replica.stats().last_error;
+	EXPECT_EQ(replica.get("test_replica_key").value_or(""), "v1");
+
+	primary->set("test_replica_key", "v2");
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (replica.get("test_replica_key").value_or("") != "v2" && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+	EXPECT_EQ(replica.get("test_replica_key").value_or(""), "v2");
+	primary->del("test_replica_key");
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,213 @@
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class roaring_operations_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = unsigned int;
+
+	const key_type TEST_KEY_A = "test_roaring_a";
+	const key_type TEST_KEY_B = "test_roaring_b";
+	const key_type TEST_KEY_C = "test_roaring_c";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		for (const auto &key: {TEST_KEY_A, TEST_KEY_B, TEST_KEY_C}) {
+			tpl->ops_for_roaring().del(key);
+		}
+	}
+
+	// Helper function to get roaring bitmap operations interface
+	[[nodiscard]] auto &roaring_ops() const {
+		return tpl->ops_for_roaring();
+	}
+};
+
+// --- Test Cases ---
+
+TEST(roaring_bitmap_test, containers_switch_representation) {
+	roaring_bitmap bitmap;
+	for (uint32_t i = 0; i < roaring_bitmap::array_max; ++i) {
+		EXPECT_TRUE(bitmap.add(i * 2));
+	}
+	EXPECT_FALSE(bitmap.add(0));
+	EXPECT_FALSE(bitmap.get_containers().at(0).is_bitmap);
+
+	bitmap.add(1);
+	EXPECT_TRUE(bitmap.get_containers().at(0).is_bitmap) << "A container above 4096 values should be a bitmap.";
+	EXPECT_EQ(bitmap.cardinality(), roaring_bitmap::array_max + 1);
+
+	EXPECT_TRUE(bitmap.remove(1));
+	EXPECT_FALSE(bitmap.get_containers().at(0).is_bitmap);
+	EXPECT_TRUE(bitmap.contains(8190));
+	EXPECT_FALSE(bitmap.contains(8191));
+
+	bitmap.add(0x12345678);
+	EXPECT_EQ(bitmap.get_containers().size(), 2U);
+	EXPECT_TRUE(bitmap.remove(0x12345678));
+	EXPECT_EQ(bitmap.get_containers().size(), 1U) << "Empty containers should be dropped.";
+}
+
+TEST(roaring_bitmap_test, set_algebra) {
+	roaring_bitmap dense;
+	roaring_bitmap sparse{5, 70000, 200000};
+	for (uint32_t i = 0; i < 100000; ++i) {
+		dense.add(i);
+	}
+
+	roaring_bitmap both = dense & sparse;
+	EXPECT_EQ(both.to_vector(), (std::vector<uint32_t>{5, 70000}));
+
+	roaring_bitmap either = dense | sparse;
+	EXPECT_EQ(either.cardinality(), 100001U);
+	EXPECT_TRUE(either.contains(200000));
+
+	roaring_bitmap even;
+	roaring_bitmap odd;
+	for (uint32_t i = 0; i < 20000; ++i) {
+		(i % 2 == 0 ? even : odd).add(i);
+	}
+	EXPECT_TRUE((even & odd).empty());
+	EXPECT_EQ((even | odd).cardinality(), 20000U);
+}
+
+TEST(roaring_bitmap_test, serializer_round_trip) {
+	roaring_bitmap bitmap{1, 2, 3, 0xffffffff};
+	for (uint32_t i = 0; i < 10000; ++i) {
+		bitmap.add(0x10000 + i * 3);
+	}
+	roaring_serializer serializer;
+	EXPECT_EQ(serializer.deserialize(serializer.serialize(bitmap)), bitmap);
+	EXPECT_TRUE(serializer.deserialize("").empty());
+	EXPECT_THROW(serializer.deserialize(std::string("\x01\x00\x00", 3)), std::runtime_error);
+}
+
+TEST_F(roaring_operations_test, add_remove_contains) {
+	EXPECT_EQ(roaring_ops().add(TEST_KEY_A, {1, 2, 3, 70000}), 4);
+	EXPECT_EQ(roaring_ops().add(TEST_KEY_A, {3, 4}), 1) << "Only new values should be counted.";
+	EXPECT_EQ(roaring_ops().cardinality(TEST_KEY_A), 5);
+
+	EXPECT_TRUE(roaring_ops().contains(TEST_KEY_A, 70000));
+	EXPECT_FALSE(roaring_ops().contains(TEST_KEY_A, 70001));
+	EXPECT_FALSE(roaring_ops().contains(TEST_KEY_A, 0x7fff0000)) << "A missing chunk means not present.";
+
+	EXPECT_EQ(roaring_ops().remove(TEST_KEY_A, {70000, 99}), 1);
+	EXPECT_FALSE(tpl->exists(TEST_KEY_A + ":1")) << "An emptied chunk should be deleted.";
+	EXPECT_EQ(roaring_ops().load(TEST_KEY_A).to_vector(), (std::vector<uint32_t>{1, 2, 3, 4}));
+}
+
+TEST_F(roaring_operations_test, bitmap_chunk_membership) {
+	std::vector<uint32_t> values;
+	for (uint32_t i = 0; i < 10000; ++i) {
+		values.push_back(i * 5);
+	}
+	roaring_ops().add(TEST_KEY_A, values);
+
+	// The first chunk holds more than 4096 values and is probed with GETRANGE on a single byte
+	EXPECT_TRUE(roaring_ops().contains(TEST_KEY_A, 0));
+	EXPECT_TRUE(roaring_ops().contains(TEST_KEY_A, 65535));
+	EXPECT_FALSE(roaring_ops().contains(TEST_KEY_A, 65534));
+	EXPECT_EQ(roaring_ops().cardinality(TEST_KEY_A), 10000);
+}
+
+TEST_F(roaring_operations_test, store_intersect_unite) {
+	roaring_bitmap a;
+	roaring_bitmap b{7, 0x30000};
+	for (uint32_t i = 0; i < 50000; ++i) {
+		a.add(i);
+	}
+	roaring_ops().store(TEST_KEY_A, a);
+	roaring_ops().store(TEST_KEY_B, b);
+	EXPECT_EQ(roaring_ops().load(TEST_KEY_A), a);
+
+	EXPECT_EQ(roaring_ops().intersect({TEST_KEY_A, TEST_KEY_B}).to_vector(), std::vector<uint32_t>{7});
+	EXPECT_EQ(roaring_ops().unite({TEST_KEY_A, TEST_KEY_B}), a | b);
+	EXPECT_TRUE(roaring_ops().intersect({TEST_KEY_A, TEST_KEY_C}).empty());
+
+	// Storing again replaces the old chunks
+	roaring_ops().store(TEST_KEY_A, roaring_bitmap{0x50000});
+	EXPECT_FALSE(tpl->exists(TEST_KEY_A + ":0"));
+	EXPECT_EQ(roaring_ops().load(TEST_KEY_A).to_vector(), std::vector<uint32_t>{0x50000});
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
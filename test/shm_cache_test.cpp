@@ -0,0 +1,215 @@
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+namespace {
+shm_cache_options small_options() {
+	shm_cache_options options;
+	options.arena_bytes = 64 * 128;
+	options.block_sizes = {128, 256};
+	return options;
+}
+} // namespace
+
+TEST(shm_cache_test, set_get_erase_and_expiry) {
+	shm_cache cache;
+	EXPECT_FALSE(cache.get("k").has_value());
+	EXPECT_TRUE(cache.set("k", "v1"));
+	EXPECT_EQ(cache.get("k").value_or(""), "v1");
+	EXPECT_TRUE(cache.set("k", std::string(300, 'x')));
+	EXPECT_EQ(cache.get("k").value_or(""), std::string(300, 'x'));
+	EXPECT_TRUE(cache.set("", ""));
+	EXPECT_EQ(cache.get("").value_or("missing"), "");
+
+	EXPECT_TRUE(cache.erase("k"));
+	EXPECT_FALSE(cache.erase("k"));
+	EXPECT_FALSE(cache.get("k").has_value());
+
+	EXPECT_TRUE(cache.set("t", "v", std::chrono::milliseconds(20)));
+	EXPECT_TRUE(cache.get("t").has_value());
+	std::this_thread::sleep_for(std::chrono::milliseconds(40));
+	EXPECT_FALSE(cache.get("t").has_value());
+
+	// Larger than the largest block
+	EXPECT_FALSE(cache.set("big", std::string(70000, 'b')));
+	auto stats = cache.stats();
+	EXPECT_EQ(stats.rejected, 1u);
+	EXPECT_GE(stats.hits, 4u);
+}
+
+TEST(shm_cache_test, fills_lose_against_concurrent_invalidation) {
+	shm_cache cache;
+	uint64_t epoch = cache.epoch("k");
+	EXPECT_TRUE(cache.fill("k", "v1", std::chrono::milliseconds(0), epoch));
+	EXPECT_EQ(cache.get("k").value_or(""), "v1");
+
+	epoch = cache.epoch("k");
+	cache.erase("k");
+	EXPECT_FALSE(cache.fill("k", "stale", std::chrono::milliseconds(0), epoch));
+	EXPECT_FALSE(cache.get("k").has_value());
+
+	// clear() invalidates every key
+	EXPECT_TRUE(cache.set("a", "1"));
+	epoch = cache.epoch("k");
+	cache.clear();
+	EXPECT_FALSE(cache.get("a").has_value());
+	EXPECT_FALSE(cache.fill("k", "stale", std::chrono::milliseconds(0), epoch));
+	EXPECT_TRUE(cache.set("a", "2"));
+	EXPECT_EQ(cache.get("a").value_or(""), "2");
+}
+
+TEST(shm_cache_test, clock_eviction_keeps_referenced_entries) {
+	shm_cache cache(small_options());
+	for (int i = 0; i < 64; ++i) {
+		ASSERT_TRUE(cache.set("k" + std::to_string(i), "v"));
+	}
+	// The first pass of the hand clears every reference bit, so entries read afterwards get a second chance
+	ASSERT_TRUE(cache.set("warmup", "v"));
+	for (int round = 0; round < 3; ++round) {
+		ASSERT_TRUE(cache.get("k1").has_value());
+		for (int i = 0; i < 20; ++i) {
+			ASSERT_TRUE(cache.set("n" + std::to_string(round * 20 + i), "v"));
+		}
+	}
+	EXPECT_TRUE(cache.get("k1").has_value());
+	EXPECT_GT(cache.stats().evictions, 0u);
+
+	int resident = 0;
+	for (int i = 0; i < 64; ++i) {
+		resident += cache.get("k" + std::to_string(i)).has_value();
+	}
+	EXPECT_LT(resident, 64);
+	// Arenas are budgeted separately: a large entry does not evict small ones
+	const auto before = cache.stats().evictions;
+	ASSERT_TRUE(cache.set("large", std::string(150, 'l')));
+	EXPECT_EQ(cache.stats().evictions, before);
+}
+
+TEST(shm_cache_test, forked_processes_share_anonymous_segment) {
+	shm_cache cache;
+	cache.set("parent", "p");
+	const pid_t pid = fork();
+	ASSERT_GE(pid, 0);
+	if (pid == 0) {
+		const bool ok = cache.get("parent").value_or("") == "p" && cache.set("child", "c");
+		_exit(ok ? 0 : 1);
+	}
+	int status = 0;
+	ASSERT_EQ(waitpid(pid, &status, 0), pid);
+	ASSERT_TRUE(WIFEXITED(status));
+	EXPECT_EQ(WEXITSTATUS(status), 0);
+	EXPECT_EQ(cache.get("child").value_or(""), "c");
+}
+
+TEST(shm_cache_test, named_segments_are_attached_by_name) {
+	const std::string name = "/janus-shm-cache-test-" + std::to_string(getpid());
+	shm_cache::unlink(name);
+	{
+		// Invalid options create nothing, so the next process creates the segment instead of waiting for it
+		shm_cache_options invalid = small_options();
+		invalid.block_sizes = {100};
+		EXPECT_THROW(shm_cache(name, invalid), std::invalid_argument);
+		const auto start = std::chrono::steady_clock::now();
+		shm_cache first(name, small_options());
+		EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(1));
+		shm_cache second(name, small_options());
+		first.set("k", "v");
+		EXPECT_EQ(second.get("k").value_or(""), "v");
+		second.erase("k");
+		EXPECT_FALSE(first.get("k").has_value());
+
+		shm_cache_options other = small_options();
+		other.block_sizes = {128};
+		EXPECT_THROW(shm_cache(name, other), std::runtime_error);
+	}
+	shm_cache::unlink(name);
+}
+
+TEST(shm_cache_test, concurrent_readers_and_writers) {
+	shm_cache cache(small_options());
+	std::vector<std::thread> threads;
+	std::atomic<int> corrupt{0};
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&cache, &corrupt, t] {
+			for (int i = 0; i < 5000; ++i) {
+				const std::string key = "k" + std::to_string((i * 7 + t) % 200);
+				if ((i + t) % 3 == 0) {
+					cache.set(key, key + std::string(i % 100, '.'));
+				}
+				else if (i % 50 == 0) {
+					cache.erase(key);
+				}
+				else if (auto value = cache.get(key)) {
+					// A value always starts with its own key
+					if (value->compare(0, key.size(), key) != 0) ++corrupt;
+				}
+			}
+		});
+	}
+	for (auto &t: threads) {
+		t.join();
+	}
+	EXPECT_EQ(corrupt.load(), 0);
+	EXPECT_GT(cache.stats().evictions, 0u);
+}
+
+TEST(shm_cache_test, cached_connection_invalidates_on_write) {
+	auto backend = std::make_shared<memory_connection>();
+	auto cache = std::make_shared<shm_cache>();
+	shm_cached_connection connection(backend, cache);
+
+	backend->set("k", "v1");
+	EXPECT_EQ(connection.get("k").value_or(""), "v1");
+	// Changed behind the connection's back: the cached value answers
+	backend->set("k", "v2");
+	EXPECT_EQ(connection.get("k").value_or(""), "v1");
+	EXPECT_EQ(cache->stats().hits, 1u);
+
+	EXPECT_TRUE(connection.set("k", "v3"));
+	EXPECT_EQ(connection.get("k").value_or(""), "v3");
+	EXPECT_EQ(connection.incr("n", 2), 2);
+	EXPECT_EQ(connection.get("n").value_or(""), "2");
+	EXPECT_EQ(connection.incr("n", 1), 3);
+	EXPECT_EQ(connection.get("n").value_or(""), "3");
+	EXPECT_EQ(connection.get("k").value_or(""), "v3");
+	connection.pipeline({{"GET", "n"}, {"APPEND", "n", "0"}, {"SETRANGE", "n", "0", "k"}});
+	EXPECT_EQ(connection.get("n").value_or(""), "k0");
+	// Arguments that are not keys stay cached
+	EXPECT_EQ(cache->get("k").value_or(""), "v3");
+	EXPECT_EQ(connection.del(std::vector<std::string>{"k", "n"}), 2);
+	EXPECT_FALSE(connection.get("k").has_value());
+	EXPECT_FALSE(cache->get("k").has_value());
+
+	// Entries expire with their key
+	backend->set_px("t", "v", 30);
+	EXPECT_EQ(connection.get("t").value_or(""), "v");
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+	EXPECT_FALSE(connection.get("t").has_value());
+
+	// Failed writes invalidate too, as they may have been applied
+	backend->hset("h", "f", "v");
+	EXPECT_THROW(connection.incr("h", 1), std::runtime_error);
+	EXPECT_THROW(connection.get("h"), std::runtime_error);
+
+	// Writes that name no key clear the whole cache
+	backend->set("a", "v");
+	EXPECT_EQ(connection.get("a").value_or(""), "v");
+	connection.pipeline({{"FLUSHALL"}});
+	EXPECT_FALSE(cache->get("a").has_value());
+	EXPECT_FALSE(connection.get("a").has_value());
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
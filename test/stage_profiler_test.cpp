@@ -0,0 +1,136 @@
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+namespace {
+/* Reports the stages of a network connection for HGETALL and GET, as redis_connection does */
+class staged_connection: public forwarding_connection {
+public:
+	explicit staged_connection(const std::string &prefix) :
+		forwarding_connection(std::make_shared<memory_connection>()), prefix(prefix) {
+	}
+
+	std::unordered_map<std::string, std::string> hgetall(const std::string &key) override {
+		if (stage_profiler::begin_command()) {
+			const std::string name = prefix + "HGETALL";
+			stage_profiler::name_command(name.data(), name.size());
+			stage_profiler::add(stage::wait, 1000000);
+		}
+		return target->hgetall(key);
+	}
+
+	std::optional<std::string> get(const std::string &key) override {
+		if (stage_profiler::begin_command()) {
+			const std::string name = prefix + "GET";
+			stage_profiler::name_command(name.data(), name.size());
+		}
+		return target->get(key);
+	}
+
+private:
+	std::string prefix;
+};
+
+std::shared_ptr<redis_template<std::string, int>> make_template(const std::shared_ptr<kv_connection> &connection) {
+	return std::make_shared<redis_template<std::string, int>>(
+		connection, std::make_shared<string_serializer<std::string>>(), std::make_shared<string_serializer<int>>());
+}
+} // namespace
+
+TEST(stage_profiler_test, attributes_serialization_to_the_command_of_the_call) {
+	auto connection = std::make_shared<staged_connection>("attr_");
+	auto tpl = make_template(connection);
+	std::unordered_map<std::string, int> fields;
+	for (int i = 0; i < 100; ++i) {
+		fields["f" + std::to_string(i)] = i;
+	}
+	connection->hset("h", std::unordered_map<std::string, std::string>{{"f", "1"}});
+	stage_profiler::set_sample_rate(1);
+	EXPECT_EQ(tpl->ops_for_hash().hgetall("h").size(), 1u);
+	EXPECT_FALSE(tpl->ops_for_value().get("missing"));
+	stage_profiler::flush();
+	stage_profiler::set_sample_rate(0);
+
+	const stage_profile profile = stage_profiler::snapshot();
+	const auto &hgetall = profile.commands.at("attr_HGETALL");
+	EXPECT_EQ(hgetall.at("serialize").count(), 1u);
+	EXPECT_EQ(hgetall.at("deserialize").count(), 1u);
+	EXPECT_EQ(hgetall.at("wait").count(), 1u);
+	EXPECT_EQ(hgetall.count("encode"), 0u);
+	const auto &get = profile.commands.at("attr_GET");
+	EXPECT_EQ(get.at("serialize").count(), 1u);
+	EXPECT_EQ(get.count("deserialize"), 0u);
+
+	// The wait of 1000000 ticks converts to nanoseconds with the measured tick rate
+	const uint64_t wait_ns = hgetall.at("wait").max();
+	EXPECT_GT(wait_ns, 1000u);
+	EXPECT_LT(wait_ns, 10000000u);
+}
+
+TEST(stage_profiler_test, samples_one_call_in_n_per_thread) {
+	auto connection = std::make_shared<staged_connection>("sample_");
+	auto tpl = make_template(connection);
+	stage_profiler::set_sample_rate(4);
+	std::thread worker([&tpl] {
+		for (int i = 0; i < 100; ++i) {
+			tpl->ops_for_value().get("k");
+		}
+	});
+	for (int i = 0; i < 100; ++i) {
+		tpl->ops_for_value().get("k");
+	}
+	stage_profiler::flush();
+	worker.join();
+	stage_profiler::set_sample_rate(0);
+
+	const stage_profile profile = stage_profiler::snapshot();
+	EXPECT_EQ(profile.commands.at("sample_GET").at("serialize").count(), 50u);
+
+	// Off, the instrumentation records nothing
+	for (int i = 0; i < 100; ++i) {
+		tpl->ops_for_value().get("k");
+	}
+	stage_profiler::flush();
+	EXPECT_EQ(stage_profiler::snapshot().commands.at("sample_GET").at("serialize").count(), 50u);
+}
+
+TEST(stage_profiler_redis_test, breaks_down_redis_round_trips) {
+	std::string host = DEFAULT_REDIS_HOST;
+	auto port = static_cast<unsigned short>(DEFAULT_REDIS_PORT);
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = static_cast<unsigned short>(std::atoi(env_port));
+
+	std::shared_ptr<redis_connection> connection;
+	try {
+		connection = std::make_shared<redis_connection>(host, port);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	auto tpl = make_template(connection);
+	connection->hset("test_stage_h", std::unordered_map<std::string, std::string>{{"a", "1"}, {"b", "2"}});
+	stage_profiler::set_sample_rate(1);
+	EXPECT_EQ(tpl->ops_for_hash().hgetall("test_stage_h").size(), 2u);
+	stage_profiler::flush();
+	stage_profiler::set_sample_rate(0);
+	connection->del("test_stage_h");
+
+	const auto &hgetall = stage_profiler::snapshot().commands.at("HGETALL");
+	for (const char *name: {"serialize", "encode", "write", "wait", "parse", "convert", "deserialize"}) {
+		EXPECT_EQ(hgetall.at(name).count(), 1u) << name;
+	}
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
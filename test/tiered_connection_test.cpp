@@ -0,0 +1,465 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class tiered_connection_test: public ::testing::Test {
+protected:
+	std::shared_ptr<memory_connection> local;
+	// Stands in for Redis, so the tier can be checked against the shared copy directly
+	std::shared_ptr<memory_connection> remote;
+
+	void SetUp() override {
+		memory_connection_options memory;
+		memory.shards = 8;
+		memory.active_expire_interval = std::chrono::milliseconds(0);
+		local = std::make_shared<memory_connection>(memory);
+		remote = std::make_shared<memory_connection>(memory);
+	}
+
+	static tiered_options make_options(write_policy writes = write_policy::write_through) {
+		tiered_options options;
+		options.writes = writes;
+		options.flush_interval = std::chrono::milliseconds(0);
+		options.invalidation_channel.clear();
+		return options;
+	}
+
+	std::unique_ptr<tiered_connection> make_tier(const tiered_options &options) {
+		return std::make_unique<tiered_connection>(local, remote, options);
+	}
+};
+
+TEST_F(tiered_connection_test, promotes_hot_keys_and_serves_them_locally) {
+	auto tier = make_tier(make_options());
+	remote->set("k", "v1");
+
+	EXPECT_EQ(tier->get("k").value_or(""), "v1");
+	EXPECT_FALSE(tier->is_local("k"));
+	EXPECT_EQ(tier->get("k").value_or(""), "v1");
+	ASSERT_TRUE(tier->is_local("k"));
+
+	// Changed behind the tier's back: the local copy answers until it is invalidated
+	remote->set("k", "v2");
+	EXPECT_EQ(tier->get("k").value_or(""), "v1");
+	tier->invalidate("k");
+	EXPECT_FALSE(tier->is_local("k"));
+	EXPECT_EQ(tier->get("k").value_or(""), "v2");
+
+	// Every core type is copied whole, with its TTL
+	remote->hset("h", std::unordered_map<std::string, std::string>{{"f1", "a"}, {"f2", "b"}});
+	remote->expire("h", 100);
+	remote->zadd("z", {{"m1", 1.5}, {"m2", -2}});
+	for (int i = 0; i < 2; ++i) {
+		tier->hget("h", "f1");
+		tier->zscore("z", "m1");
+	}
+	ASSERT_TRUE(tier->is_local("h"));
+	EXPECT_EQ(local->hgetall("h").size(), 2u);
+	EXPECT_GT(local->ttl("h"), 98);
+	EXPECT_EQ(tier->zrange("z", 0, -1), (std::vector<std::string>{"m2", "m1"}));
+
+	// A missing key is cached as missing
+	tier->get("absent");
+	tier->get("absent");
+	EXPECT_TRUE(tier->is_local("absent"));
+	EXPECT_FALSE(tier->exists("absent"));
+
+	auto stats = tier->stats();
+	EXPECT_EQ(stats.promotions, 4u);
+	EXPECT_GE(stats.hits, 3u);
+	EXPECT_EQ(stats.invalidations, 1u);
+}
+
+TEST_F(tiered_connection_test, write_through_keeps_copies_consistent) {
+	auto options = make_options();
+	options.promote_after = 1;
+	auto tier = make_tier(options);
+	remote->hset("h", "f", "v");
+	remote->sadd("s", {"a", "b", "c", "d"});
+	remote->rpush("l", std::vector<std::string>{"x", "y"});
+	tier->hgetall("h");
+	tier->scard("s");
+	tier->llen("l");
+
+	EXPECT_TRUE(tier->hset("h", "g", "w"));
+	EXPECT_EQ(tier->zincrby("z", 2, "m"), 2);
+	auto popped = tier->spop("s");
+	ASSERT_TRUE(popped.has_value());
+	EXPECT_EQ(tier->lpop("l").value_or(""), "x");
+	EXPECT_EQ(tier->incr("n", 3), 3);
+
+	EXPECT_EQ(tier->hgetall("h"), remote->hgetall("h"));
+	auto local_members = tier->smembers("s");
+	auto remote_members = remote->smembers("s");
+	std::sort(local_members.begin(), local_members.end());
+	std::sort(remote_members.begin(), remote_members.end());
+	EXPECT_EQ(local_members, remote_members);
+	EXPECT_FALSE(tier->sismember("s", *popped));
+	EXPECT_EQ(tier->lrange("l", 0, -1), remote->lrange("l", 0, -1));
+	EXPECT_EQ(remote->get("n").value_or(""), "3");
+
+	// Failed writes change nothing
+	EXPECT_THROW(tier->incr("h", 1), std::runtime_error);
+	EXPECT_TRUE(tier->is_local("h"));
+}
+
+TEST_F(tiered_connection_test, write_back_defers_remote_writes) {
+	remote->hset("h", "f1", "v1");
+	{
+		auto tier = make_tier(make_options(write_policy::write_back));
+		EXPECT_TRUE(tier->set("a", "1"));
+		EXPECT_TRUE(tier->hset("h", "f2", "v2"));
+		EXPECT_EQ(tier->incr("n", 5), 5);
+		EXPECT_FALSE(remote->exists("a"));
+		EXPECT_EQ(tier->get("a").value_or(""), "1");
+		// The key was loaded before the write, so the existing field is kept
+		EXPECT_EQ(tier->hgetall("h").size(), 2u);
+
+		tier->flush();
+		EXPECT_EQ(remote->get("a").value_or(""), "1");
+		EXPECT_EQ(remote->hgetall("h").size(), 2u);
+		EXPECT_EQ(tier->stats().flushed, 3u);
+
+		// Multi-key commands see the dirty keys, which are flushed first
+		tier->sadd("s1", {"a", "b"});
+		remote->sadd("s2", {"b", "c"});
+		EXPECT_EQ(tier->sinter({"s1", "s2"}), (std::vector<std::string>{"b"}));
+
+		tier->del("a");
+		tier->set_px("t", "v", 100000);
+	}
+	// Destruction flushes the rest
+	EXPECT_FALSE(remote->exists("a"));
+	EXPECT_GT(remote->pttl("t"), 0);
+}
+
+TEST_F(tiered_connection_test, demotes_cold_copies_over_budget) {
+	auto options = make_options();
+	options.promote_after = 1;
+	options.max_local_bytes = 2000;
+	auto tier = make_tier(options);
+	const std::string value(100, 'v');
+	for (int i = 0; i < 100; ++i) {
+		remote->set("k" + std::to_string(i), value);
+	}
+	for (int i = 0; i < 100; ++i) {
+		EXPECT_EQ(tier->get("k" + std::to_string(i)).value_or(""), value);
+	}
+	auto stats = tier->stats();
+	EXPECT_EQ(stats.promotions, 100u);
+	EXPECT_GT(stats.demotions, 0u);
+	EXPECT_LE(stats.local_bytes, options.max_local_bytes);
+	EXPECT_EQ(local->dbsize(), stats.local_keys);
+
+	// Dirty copies stay until they are flushed
+	auto back = make_options(write_policy::write_back);
+	back.max_local_bytes = 2000;
+	auto writer = std::make_unique<tiered_connection>(std::make_shared<memory_connection>(), remote, back);
+	for (int i = 0; i < 50; ++i) {
+		writer->set("w" + std::to_string(i), value);
+	}
+	EXPECT_GT(writer->stats().local_bytes, back.max_local_bytes);
+	writer->flush();
+	EXPECT_LE(writer->stats().local_bytes, back.max_local_bytes);
+	EXPECT_EQ(remote->get("w49").value_or(""), value);
+}
+
+namespace {
+// Runs a hook, then fails, on the next pipeline once armed
+class failing_connection: public memory_connection {
+public:
+	std::function<void()> hook;
+
+	std::vector<kv_reply> pipeline(const std::vector<std::vector<std::string>> &commands) override {
+		if (!hook) return memory_connection::pipeline(commands);
+		auto run = std::move(hook);
+		hook = nullptr;
+		run();
+		throw std::runtime_error("failing_connection: pipeline");
+	}
+};
+} // namespace
+
+TEST_F(tiered_connection_test, failed_flushes_keep_copies_dirty) {
+	auto failing = std::make_shared<failing_connection>();
+	auto options = make_options(write_policy::write_back);
+	options.max_local_bytes = 300;
+	tiered_connection tier(local, failing, options);
+	tier.set("a", std::string(100, 'a'));
+	tier.set("b", "b");
+
+	// While "a" is sent, a write to "b" takes the tier over budget: "a" must not be demoted meanwhile
+	failing->hook = [&tier] { tier.set("b", std::string(400, 'b')); };
+	EXPECT_THROW(tier.pipeline({{"GET", "a"}}), std::runtime_error);
+	EXPECT_EQ(tier.stats().flush_errors, 1u);
+	ASSERT_TRUE(tier.is_local("a"));
+	EXPECT_FALSE(failing->exists("a"));
+
+	tier.flush();
+	EXPECT_EQ(failing->get("a").value_or(""), std::string(100, 'a'));
+	EXPECT_EQ(failing->get("b").value_or(""), std::string(400, 'b'));
+}
+
+TEST_F(tiered_connection_test, stale_copies_are_reloaded) {
+	auto options = make_options();
+	options.promote_after = 1;
+	options.max_staleness = std::chrono::milliseconds(20);
+	auto tier = make_tier(options);
+	remote->set("k", "v1");
+	tier->get("k");
+	remote->set("k", "v2");
+	EXPECT_EQ(tier->get("k").value_or(""), "v1");
+	std::this_thread::sleep_for(std::chrono::milliseconds(40));
+	EXPECT_EQ(tier->get("k").value_or(""), "v2");
+	EXPECT_TRUE(tier->is_local("k"));
+	EXPECT_EQ(tier->stats().promotions, 2u);
+}
+
+TEST_F(tiered_connection_test, multi_key_writes_and_pipelines_drop_copies) {
+	auto options = make_options();
+	options.promote_after = 1;
+	auto tier = make_tier(options);
+	for (const char *key: {"a", "b", "c", "w"}) {
+		remote->set(key, "v");
+		tier->get(key);
+	}
+	EXPECT_EQ(tier->del(std::vector<std::string>{"a", "b"}), 2);
+	EXPECT_FALSE(tier->is_local("a"));
+	EXPECT_FALSE(tier->exists("b"));
+
+	auto replies = tier->pipeline({{"GET", "c"}, {"STRLEN", "c"}});
+	EXPECT_EQ(replies[0].str, "v");
+	EXPECT_TRUE(tier->is_local("c"));
+	tier->pipeline({{"GET", "c"}, {"APPEND", "c", "w"}});
+	EXPECT_FALSE(tier->is_local("c"));
+	// Only key positions are dropped, not values that happen to name a key
+	EXPECT_TRUE(tier->is_local("w"));
+	EXPECT_EQ(tier->get("c").value_or(""), "vw");
+
+	EXPECT_EQ(command_keys({"mset", "k1", "v1", "k2", "v2"}), (std::vector<std::string>{"k1", "k2"}));
+	EXPECT_EQ(command_keys({"ZUNIONSTORE", "d", "2", "s1", "s2", "WEIGHTS", "1", "2"}),
+			  (std::vector<std::string>{"d", "s1", "s2"}));
+	EXPECT_EQ(command_keys({"EVALSHA", "sha", "1", "k", "arg"}), (std::vector<std::string>{"k"}));
+	EXPECT_EQ(command_keys({"BLPOP", "l1", "l2", "0"}), (std::vector<std::string>{"l1", "l2"}));
+	EXPECT_EQ(command_keys({"LREM", "l", "0", "x"}), (std::vector<std::string>{"l"}));
+	EXPECT_TRUE(command_keys({"PUBLISH", "channel", "message"}).empty());
+
+	// Writes that name no key drop every copy
+	EXPECT_TRUE(tier->is_local("c"));
+	tier->pipeline({{"FLUSHALL"}});
+	EXPECT_FALSE(tier->is_local("c"));
+	EXPECT_FALSE(tier->is_local("w"));
+	EXPECT_FALSE(tier->get("c").has_value());
+	EXPECT_EQ(local->dbsize(), 0);
+
+	// Dirty copies are flushed first, so writes made before FLUSHALL do not come back after it
+	auto back = std::make_unique<tiered_connection>(std::make_shared<memory_connection>(), remote,
+													make_options(write_policy::write_back));
+	back->set("d", "v");
+	back->pipeline({{"flushdb"}});
+	EXPECT_FALSE(back->is_local("d"));
+	EXPECT_FALSE(back->get("d").has_value());
+	back->flush();
+	EXPECT_FALSE(remote->exists("d"));
+}
+
+TEST_F(tiered_connection_test, concurrent_readers_and_writers) {
+	auto options = make_options();
+	options.flush_interval = std::chrono::milliseconds(5);
+	options.invalidation_channel = "janus:invalidate";
+	options.max_local_bytes = 512;
+	auto tier = make_tier(options);
+
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 4; ++t) {
+		threads.emplace_back([&tier, t] {
+			for (int i = 0; i < 500; ++i) {
+				const std::string key = "k" + std::to_string(i % 16);
+				if ((i + t) % 4 == 0) {
+					tier->incr(key, 1);
+				}
+				else {
+					tier->get(key);
+				}
+			}
+		});
+	}
+	for (auto &t: threads) {
+		t.join();
+	}
+	long long total = 0;
+	for (int i = 0; i < 16; ++i) {
+		const std::string key = "k" + std::to_string(i);
+		EXPECT_EQ(tier->get(key), remote->get(key));
+		total += std::stoll(remote->get(key).value_or("0"));
+	}
+	EXPECT_EQ(total, 500);
+	// The stand-in server rejects PUBLISH; invalidations are best effort
+	EXPECT_GT(tier->stats().publish_errors, 0u);
+}
+
+TEST_F(tiered_connection_test, snapshots_restore_hot_copies) {
+	const std::string path = (std::filesystem::temp_directory_path() / "janus_tiered_snapshot_test.bin").string();
+	std::filesystem::remove(path);
+	auto options = make_options();
+	options.promote_after = 1;
+	remote->set("s", "v");
+	remote->expire("s", 100);
+	remote->hset("h", std::unordered_map<std::string, std::string>{{"f1", "a"}, {"f2", std::string(3, '\0')}});
+	remote->zadd("z", {{"m1", 1.5}, {"m2", -2}});
+	remote->rpush("l", std::vector<std::string>{"x", "y"});
+	remote->set_px("short", "v", 30);
+	{
+		auto tier = make_tier(options);
+		tier->get("s");
+		tier->hgetall("h");
+		tier->zscore("z", "m1");
+		tier->llen("l");
+		tier->get("short");
+		tier->get("absent");
+		EXPECT_EQ(tier->save_snapshot(path), 5u);
+	}
+	std::this_thread::sleep_for(std::chrono::milliseconds(60));
+
+	// A restart: the local tier is empty
+	auto cold = std::make_shared<memory_connection>();
+	options.revalidate_snapshot = false;
+	auto tier = std::make_unique<tiered_connection>(cold, remote, options);
+	EXPECT_EQ(tier->load_snapshot(path), 4u);
+	for (const char *key: {"s", "h", "z", "l"}) {
+		EXPECT_TRUE(tier->is_local(key)) << key;
+	}
+	EXPECT_FALSE(tier->is_local("short"));
+	EXPECT_GT(cold->ttl("s"), 98);
+	EXPECT_EQ(cold->hgetall("h"), remote->hgetall("h"));
+	EXPECT_EQ(tier->zrange("z", 0, -1), (std::vector<std::string>{"m2", "m1"}));
+	EXPECT_EQ(tier->lrange("l", 0, -1), (std::vector<std::string>{"x", "y"}));
+	EXPECT_EQ(tier->stats().warmed, 4u);
+	EXPECT_EQ(tier->stats().misses, 0u);
+
+	// Revalidation skips keys deleted meanwhile and takes the TTLs Redis reports
+	remote->del("h");
+	remote->expire("s", 1000);
+	options.revalidate_snapshot = true;
+	cold = std::make_shared<memory_connection>();
+	tier = std::make_unique<tiered_connection>(cold, remote, options);
+	EXPECT_EQ(tier->load_snapshot(path), 3u);
+	EXPECT_FALSE(tier->is_local("h"));
+	EXPECT_GT(cold->ttl("s"), 998);
+
+	// Values changed while the process was down are served only until the loaded copies age out
+	remote->set("s", "changed");
+	options.snapshot_max_age = std::chrono::milliseconds(30);
+	cold = std::make_shared<memory_connection>();
+	tier = std::make_unique<tiered_connection>(cold, remote, options);
+	EXPECT_EQ(tier->load_snapshot(path), 3u);
+	EXPECT_EQ(tier->get("s").value_or(""), "v");
+	std::this_thread::sleep_for(std::chrono::milliseconds(40));
+	EXPECT_EQ(tier->get("s").value_or(""), "changed");
+	EXPECT_TRUE(tier->is_local("s"));
+
+	EXPECT_EQ(tier->load_snapshot(path + ".missing"), 0u);
+	std::ofstream(path, std::ios::binary) << "garbage";
+	EXPECT_THROW(tier->load_snapshot(path), std::runtime_error);
+	std::filesystem::remove(path);
+}
+
+TEST_F(tiered_connection_test, keeps_the_most_read_keys_across_restarts) {
+	const std::string path = (std::filesystem::temp_directory_path() / "janus_tiered_warm_test.bin").string();
+	std::filesystem::remove(path);
+	auto options = make_options();
+	options.promote_after = 1;
+	options.snapshot_path = path;
+	options.snapshot_max_keys = 2;
+	for (const char *key: {"a", "b", "c"}) {
+		remote->set(key, key);
+	}
+	{
+		auto tier = make_tier(options);
+		for (int i = 0; i < 6; ++i) {
+			tier->get("a");
+			if (i < 4) tier->get("b");
+			if (i < 2) tier->get("c");
+		}
+		// The snapshot is saved on destruction
+	}
+	ASSERT_TRUE(std::filesystem::exists(path));
+
+	auto tier = std::make_unique<tiered_connection>(std::make_shared<memory_connection>(), remote, options);
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (tier->stats().warmed < 2 && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	EXPECT_TRUE(tier->is_local("a"));
+	EXPECT_TRUE(tier->is_local("b"));
+	EXPECT_FALSE(tier->is_local("c"));
+	EXPECT_EQ(tier->get("a").value_or(""), "a");
+	tier.reset();
+	std::filesystem::remove(path);
+}
+
+TEST(tiered_connection_redis_test, invalidations_are_published) {
+	std::string host = DEFAULT_REDIS_HOST;
+	unsigned short port = DEFAULT_REDIS_PORT;
+	if (const char *env_host = std::getenv("TEST_REDIS_HOST")) host = env_host;
+	if (const char *env_port = std::getenv("TEST_REDIS_PORT")) port = static_cast<unsigned short>(std::atoi(env_port));
+
+	std::shared_ptr<kv_connection> direct;
+	std::unique_ptr<tiered_connection> reader;
+	std::unique_ptr<tiered_connection> writer;
+	tiered_options options;
+	options.promote_after = 1;
+	options.flush_interval = std::chrono::milliseconds(1);
+	options.invalidation_channel = "janus:test:invalidate";
+	try {
+		direct = std::make_shared<redis_connection>(host, port);
+		reader = std::make_unique<tiered_connection>(std::make_shared<memory_connection>(),
+													 std::make_shared<redis_connection>(host, port), options,
+													 std::make_unique<redis_subscriber>(host, port));
+		writer = std::make_unique<tiered_connection>(std::make_shared<memory_connection>(),
+													 std::make_shared<redis_connection>(host, port), options);
+	}
+	catch (const std::exception &e) {
+		GTEST_SKIP() << "Redis not available: " << e.what();
+	}
+
+	direct->set("test_tiered_key", "v1");
+	EXPECT_EQ(reader->get("test_tiered_key").value_or(""), "v1");
+	ASSERT_TRUE(reader->is_local("test_tiered_key"));
+
+	writer->set("test_tiered_key", "v2");
+	const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (reader->is_local("test_tiered_key") && std::chrono::steady_clock::now() < deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_EQ(reader->get("test_tiered_key").value_or(""), "v2");
+	EXPECT_EQ(reader->stats().invalidations, 1u);
+
+	// SWAPDB names no key: every copy is dropped (swapping a database with itself changes nothing on the server)
+	ASSERT_TRUE(reader->is_local("test_tiered_key"));
+	writer->pipeline({{"SWAPDB", "0", "0"}});
+	const auto swap_deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+	while (reader->is_local("test_tiered_key") && std::chrono::steady_clock::now() < swap_deadline) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(5));
+	}
+	EXPECT_FALSE(reader->is_local("test_tiered_key"));
+	direct->del("test_tiered_key");
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,168 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class timeseries_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = double;
+	using series_type = timeseries<key_type, value_type>;
+
+	const key_type TEST_KEY = "test_timeseries";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		series_type(*tpl, TEST_KEY, std::chrono::milliseconds(0), rollups()).clear();
+	}
+
+	static std::vector<rollup_policy> rollups() {
+		// Minute buckets kept for an hour, hourly buckets kept forever
+		return {{std::chrono::minutes(1), std::chrono::hours(1)}, {std::chrono::hours(1), std::chrono::hours(0)}};
+	}
+};
+
+// --- Test Cases ---
+
+TEST_F(timeseries_test, batched_append_and_range) {
+	series_type series(*tpl, TEST_KEY, std::chrono::milliseconds(0), {}, 4);
+	const int64_t base = 1700000000000;
+
+	series.add(base, 1.5);
+	series.add(base + 10, 2.5);
+	series.add(base + 10, 2.5);
+	EXPECT_EQ(series.pending_count(), 3U) << "Samples should be buffered until the batch is full.";
+	series.add(base + 20, 3.5);
+	EXPECT_EQ(series.pending_count(), 0U) << "A full batch should be flushed automatically.";
+
+	auto samples = series.range(base, base + 15);
+	ASSERT_EQ(samples.size(), 3U) << "Equal values at the same timestamp are distinct samples.";
+	EXPECT_EQ(samples[0].timestamp, base);
+	EXPECT_DOUBLE_EQ(samples[0].value, 1.5);
+	EXPECT_DOUBLE_EQ(samples[2].value, 2.5);
+}
+
+TEST_F(timeseries_test, rollups) {
+	series_type series(*tpl, TEST_KEY, std::chrono::milliseconds(0), rollups());
+	const int64_t hour = 3600000;
+	const int64_t base = 1700000000000 / hour * hour;
+
+	for (int i = 0; i < 120; ++i) {
+		series.add(base + i * 60000, static_cast<double>(i));
+	}
+	series.flush();
+	series.add(base + 30, 1000.0);
+
+	auto hourly = series.rollup(std::chrono::hours(1), base, base + 2 * hour - 1);
+	ASSERT_EQ(hourly.size(), 2U);
+	EXPECT_EQ(hourly[0].start, base);
+	EXPECT_EQ(hourly[0].count, 61) << "A later flush should merge into the existing bucket.";
+	EXPECT_DOUBLE_EQ(hourly[0].min, 0.0);
+	EXPECT_DOUBLE_EQ(hourly[0].max, 1000.0);
+	EXPECT_DOUBLE_EQ(hourly[0].sum, 1770.0 + 1000.0);
+	EXPECT_DOUBLE_EQ(hourly[1].mean(), 89.5);
+
+	auto minutes = series.rollup(std::chrono::minutes(1), base, base + 5 * 60000 - 1);
+	EXPECT_EQ(minutes.size(), 5U);
+
+	EXPECT_THROW(series.rollup(std::chrono::seconds(1), base, base), std::invalid_argument);
+}
+
+TEST_F(timeseries_test, retention) {
+	series_type series(*tpl, TEST_KEY, std::chrono::hours(1), rollups());
+	const int64_t now = series_type::now();
+
+	series.add(now - 3 * 3600000, 1.0);
+	series.add(now - 2 * 3600000, 2.0);
+	series.flush();
+	EXPECT_TRUE(series.range(0, now).empty()) << "Expired samples should be trimmed on flush.";
+
+	series.add(now, 3.0);
+	EXPECT_EQ(series.trim(), 0);
+	EXPECT_EQ(series.range(0, now).size(), 1U);
+
+	// Minute buckets expire after an hour; hourly buckets are kept
+	EXPECT_EQ(series.rollup(std::chrono::minutes(1), now - 4 * 3600000, now).size(), 1U);
+	EXPECT_EQ(series.rollup(std::chrono::hours(1), now - 4 * 3600000, now).size(), 3U);
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,181 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "gtest/gtest.h"
+#include "janus/janus.hpp"
+
+#define DEFAULT_REDIS_HOST "127.0.0.1"
+#define DEFAULT_REDIS_PORT 6379
+
+class zset_mirror_test: public ::testing::Test {
+protected:
+	// Type aliases
+	using key_type = std::string;
+	using value_type = std::string;
+	using mirror_type = zset_mirror<key_type, value_type>;
+
+	const key_type TEST_KEY = "test_zset_mirror";
+
+	// Connection parameters
+	std::string redis_host;
+	unsigned short redis_port{DEFAULT_REDIS_PORT};
+
+	std::shared_ptr<kv_connection> conn;
+	std::shared_ptr<serializer<key_type>> k_serializer;
+	std::shared_ptr<serializer<value_type>> v_serializer;
+	std::unique_ptr<redis_template<key_type, value_type>> tpl;
+
+	void SetUp() override {
+		// 1. Retrieve connection parameters from environment variables
+		if (const char *env_host = std::getenv("TEST_REDIS_HOST")) {
+			redis_host = env_host;
+		}
+		else {
+			redis_host = DEFAULT_REDIS_HOST;
+			std::cerr << "Warning: TEST_REDIS_HOST not set. Using default: " << redis_host << std::endl;
+		}
+
+		if (const char *env_port = std::getenv("TEST_REDIS_PORT")) {
+			try {
+				int port_int = std::stoi(env_port);
+				if (port_int > 0 && port_int < 65536) {
+					redis_port = static_cast<unsigned short>(port_int);
+				}
+				else {
+					throw std::runtime_error("Port out of range.");
+				}
+			}
+			catch ([[maybe_unused]] const std::exception &e) {
+				redis_port = DEFAULT_REDIS_PORT;
+				std::cerr << "Warning: Invalid TEST_REDIS_PORT value. Using default: " << redis_port << std::endl;
+			}
+		}
+		else {
+			redis_port = DEFAULT_REDIS_PORT;
+			std::cerr << "Warning: TEST_REDIS_PORT not set. Using default: " << redis_port << std::endl;
+		}
+
+		// 2. Create underlying connection
+		try {
+			conn = std::make_shared<redis_connection>(redis_host, redis_port);
+		}
+		catch (const std::runtime_error &e) {
+			// If connection fails, skip all tests in this fixture
+			GTEST_SKIP() << "Skipping test: Could not connect to Redis at " << redis_host << ":" << redis_port
+						 << ". Error: " << e.what();
+		}
+
+		// 3. Create Serializers
+		k_serializer = std::make_shared<string_serializer<key_type>>();
+		v_serializer = std::make_shared<string_serializer<value_type>>();
+
+		// 4. Construct redis_template
+		tpl = std::make_unique<redis_template<key_type, value_type>>(conn, k_serializer, v_serializer);
+
+		// 5. Clean up test key
+		clear_test_keys();
+	}
+
+	void TearDown() override {
+		// 6. Clean up test key
+		if (tpl) {
+			clear_test_keys();
+		}
+	}
+
+	// Helper to clean keys
+	void clear_test_keys() const {
+		tpl->del(std::vector<key_type>{TEST_KEY, TEST_KEY + ":changes", TEST_KEY + ":changes:seq"});
+	}
+};
+
+// --- Test Cases ---
+
+TEST(order_statistic_skiplist_test, rank_and_order) {
+	order_statistic_skiplist list;
+	for (int i = 0; i < 1000; ++i) {
+		list.insert(static_cast<double>(i % 100), "m" + std::to_string(i));
+	}
+	ASSERT_EQ(list.size(), 1000U);
+
+	// Ordered by score, then member bytes
+	const auto *prev = list.front();
+	for (const auto *n = prev->next(); n; prev = n, n = n->next()) {
+		ASSERT_TRUE(prev->score < n->score || (prev->score == n->score && prev->member < n->member));
+	}
+
+	for (size_t r = 0; r < list.size(); r += 37) {
+		const auto *n = list.at(r);
+		ASSERT_NE(n, nullptr);
+		EXPECT_EQ(list.rank(n->score, n->member), static_cast<long long>(r));
+	}
+	EXPECT_EQ(list.at(1000), nullptr);
+	EXPECT_EQ(list.rank(5.0, "missing"), -1);
+	EXPECT_EQ(list.lower_bound(99.0)->score, 99.0);
+
+	for (int i = 0; i < 1000; i += 2) {
+		EXPECT_TRUE(list.erase(static_cast<double>(i % 100), "m" + std::to_string(i)));
+	}
+	EXPECT_FALSE(list.erase(0.0, "m0"));
+	EXPECT_EQ(list.size(), 500U);
+	EXPECT_EQ(list.at(0)->member, "m1");
+	EXPECT_EQ(list.rank(list.at(499)->score, list.at(499)->member), 499);
+}
+
+TEST_F(zset_mirror_test, load_and_local_reads) {
+	conn->zadd(TEST_KEY, {{"alice", 30}, {"bob", 10}, {"carol", 20}});
+	mirror_type mirror(*tpl, TEST_KEY);
+
+	EXPECT_EQ(mirror.zcard(), 3);
+	EXPECT_EQ(mirror.zrevrange(0, 1), (std::vector<value_type>{"alice", "carol"}));
+	EXPECT_EQ(mirror.zrange(-1, -1), std::vector<value_type>{"alice"});
+	EXPECT_EQ(mirror.zrevrank("bob"), 2);
+	EXPECT_EQ(mirror.zrank("bob"), 0);
+	EXPECT_EQ(mirror.zscore("carol"), 20.0);
+	EXPECT_FALSE(mirror.zscore("dave").has_value());
+	EXPECT_EQ(mirror.zrangebyscore_withscores(15, 30).size(), 2U);
+}
+
+TEST_F(zset_mirror_test, follows_changes_of_other_writers) {
+	mirror_type reader(*tpl, TEST_KEY, std::chrono::milliseconds(0));
+	mirror_type writer(*tpl, TEST_KEY);
+
+	EXPECT_TRUE(writer.zadd("alice", 1));
+	EXPECT_TRUE(writer.zadd("bob", 2));
+	EXPECT_DOUBLE_EQ(writer.zincrby("alice", 5), 6.0);
+	EXPECT_TRUE(writer.zrem("bob"));
+	EXPECT_FALSE(writer.zrem("bob"));
+
+	EXPECT_EQ(reader.sync(), 4U);
+	EXPECT_EQ(reader.zrevrange_withscores(0, -1), (std::vector<std::pair<value_type, double>>{{"alice", 6.0}}));
+	EXPECT_EQ(conn->zscore(TEST_KEY, "alice"), 6.0);
+
+	// Scores keep their full precision
+	writer.zadd("tiny", 1e-7);
+	writer.zadd("exact", 0.1 + 0.2);
+	EXPECT_EQ(conn->zscore(TEST_KEY, "tiny"), 1e-7);
+	EXPECT_EQ(conn->zscore(TEST_KEY, "exact"), 0.1 + 0.2);
+	EXPECT_EQ(reader.zscore("tiny"), 1e-7);
+}
+
+TEST_F(zset_mirror_test, reloads_after_trimmed_changes) {
+	mirror_type reader(*tpl, TEST_KEY, std::chrono::hours(1));
+	mirror_type writer(*tpl, TEST_KEY);
+	for (int i = 0; i < 10; ++i) {
+		writer.zadd("m" + std::to_string(i), i);
+	}
+	// Drop the published changes before the reader saw them
+	conn->pipeline({{"XTRIM", TEST_KEY + ":changes", "MAXLEN", "2"}});
+
+	reader.sync();
+	EXPECT_EQ(reader.zcard(), 10) << "A gap in the change sequence should trigger a full reload.";
+}
+
+int main(int argc, char **argv) {
+	testing::InitGoogleTest(&argc, argv);
+	return RUN_ALL_TESTS();
+}
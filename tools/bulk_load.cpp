@@ -0,0 +1,89 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "janus/bulk_loader.hpp"
+
+namespace {
+void usage(const char *program) {
+	std::fprintf(stderr,
+				 "usage: %s [options] [file]\n"
+				 "Loads the records of a CSV or binary file (standard input by default) into Redis.\n"
+				 "  -h <host>         server host (127.0.0.1)\n"
+				 "  -p <port>         server port (6379)\n"
+				 "  -c <connections>  parallel connections (4)\n"
+				 "  -b <batch>        commands written at once (512)\n"
+				 "  -w <window>       unanswered commands per connection (8192)\n"
+				 "  -e <max errors>   stop after this many error replies (0: never)\n"
+				 "  --command <name>  CSV rows are the arguments of this command instead of whole commands\n"
+				 "  --delimiter <c>   CSV field delimiter (,)\n"
+				 "  --binary          the file holds binary records instead of CSV\n",
+				 program);
+}
+
+void print(const bulk_load_stats &s, bool last) {
+	std::fprintf(stderr, "%s%llu queued, %llu replied, %llu errors, %.1f MB, %.0f commands/s%s",
+				 last ? "" : "\r", static_cast<unsigned long long>(s.queued),
+				 static_cast<unsigned long long>(s.replied), static_cast<unsigned long long>(s.errors),
+				 static_cast<double>(s.bytes) / (1024.0 * 1024.0), s.commands_per_second(), last ? "\n" : "");
+}
+} // namespace
+
+int main(int argc, char **argv) {
+	std::string host = "127.0.0.1";
+	int port = 6379;
+	std::string command;
+	char delimiter = ',';
+	bool binary = false;
+	std::string path;
+	bulk_load_options options;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		if (arg == "-h" && has_value) host = argv[++i];
+		else if (arg == "-p" && has_value) port = std::atoi(argv[++i]);
+		else if (arg == "-c" && has_value) options.connections = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-b" && has_value) options.batch_size = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-w" && has_value) options.window = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "-e" && has_value) options.max_errors = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--command" && has_value) command = argv[++i];
+		else if (arg == "--delimiter" && has_value) delimiter = argv[++i][0];
+		else if (arg == "--binary") binary = true;
+		else if (arg[0] != '-' && path.empty()) path = arg;
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	std::ifstream file;
+	if (!path.empty()) {
+		file.open(path, std::ios::binary);
+		if (!file) {
+			std::fprintf(stderr, "cannot open %s\n", path.c_str());
+			return 1;
+		}
+	}
+	std::istream &in = path.empty() ? std::cin : file;
+	options.on_progress = [](const bulk_load_stats &s) { print(s, false); };
+
+	try {
+		bulk_loader loader(host, port, options);
+		if (binary) loader.load_binary(in);
+		else loader.load_csv(in, command, delimiter);
+		const bulk_load_stats stats = loader.finish();
+		print(stats, true);
+		for (const auto &error: stats.error_samples) {
+			std::fprintf(stderr, "error: %s\n", error.c_str());
+		}
+		return stats.errors == 0 ? 0 : 1;
+	}
+	catch (const std::exception &e) {
+		std::fprintf(stderr, "\n%s\n", e.what());
+		return 1;
+	}
+}
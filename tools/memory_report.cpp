@@ -0,0 +1,126 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+
+#include "janus/memory_analyzer.hpp"
+#include "janus/redis_connection.hpp"
+
+namespace {
+/* Stopped by SIGINT; stop() only stores an atomic flag */
+memory_analyzer *volatile running = nullptr;
+
+void usage(const char *program) {
+	std::fprintf(stderr,
+				 "usage: %s [options] <host:port>\n"
+				 "Reports the memory of a server's keys by prefix and by encoding, and the keys just above the\n"
+				 "listpack thresholds. Run it once per node of a cluster.\n"
+				 "  --match <pattern>   analyze only the keys matching the pattern\n"
+				 "  --count <n>         keys per SCAN and pipeline (1000)\n"
+				 "  --sample <ratio>    share of the keys analyzed (1)\n"
+				 "  --max-keys <n>      stop after scanning n keys\n"
+				 "  --delimiter <c>     separator of the key fields (:)\n"
+				 "  --depth <n>         fields of the key forming its prefix (1)\n"
+				 "  --samples <n>       MEMORY USAGE SAMPLES; 0 counts every element (5)\n"
+				 "  --top <n>           prefixes and keys listed (20)\n",
+				 program);
+}
+
+std::pair<std::string, unsigned short> parse_address(const std::string &address) {
+	const size_t colon = address.rfind(':');
+	if (colon == std::string::npos) return {address, 6379};
+	return {address.substr(0, colon), static_cast<unsigned short>(std::atoi(address.c_str() + colon + 1))};
+}
+
+double megabytes(uint64_t bytes) {
+	return static_cast<double>(bytes) / (1024.0 * 1024.0);
+}
+
+void print(const memory_analysis &a, size_t top) {
+	// Sampled figures are scaled to the keys scanned
+	const double scale = a.analyzed > 0 ? static_cast<double>(a.scanned) / static_cast<double>(a.analyzed) : 0.0;
+	std::printf("%llu keys scanned, %llu analyzed, %llu vanished, %llu errors in %.1f s%s\n",
+				static_cast<unsigned long long>(a.scanned), static_cast<unsigned long long>(a.analyzed),
+				static_cast<unsigned long long>(a.vanished), static_cast<unsigned long long>(a.errors),
+				static_cast<double>(a.elapsed.count()) / 1000.0, a.completed ? "" : " (partial)");
+	std::printf("estimated memory: %.1f MB\n\n", megabytes(a.bytes) * scale);
+
+	std::printf("%-32s %12s %12s %6s %10s  %s\n", "prefix", "keys", "MB", "%", "avg bytes", "biggest key");
+	for (size_t i = 0; i < a.prefixes.size() && i < top; ++i) {
+		const prefix_memory &p = a.prefixes[i];
+		std::printf("%-32s %12.0f %12.1f %6.1f %10llu  %s (%llu bytes)\n", p.prefix.c_str(),
+					static_cast<double>(p.keys) * scale, megabytes(p.bytes) * scale,
+					a.bytes > 0 ? 100.0 * static_cast<double>(p.bytes) / static_cast<double>(a.bytes) : 0.0,
+					static_cast<unsigned long long>(p.bytes / p.keys), p.biggest_key.c_str(),
+					static_cast<unsigned long long>(p.biggest_bytes));
+	}
+
+	std::printf("\n%-32s %12s %12s %6s\n", "type encoding", "keys", "MB", "%");
+	for (const auto &e: a.encodings) {
+		std::printf("%-32s %12.0f %12.1f %6.1f\n", e.first.c_str(), static_cast<double>(e.second.keys) * scale,
+					megabytes(e.second.bytes) * scale,
+					a.bytes > 0 ? 100.0 * static_cast<double>(e.second.bytes) / static_cast<double>(a.bytes) : 0.0);
+	}
+
+	if (!a.near_thresholds.empty()) {
+		std::printf("\nkeys just above a listpack threshold (a compact encoding would shrink them):\n");
+		for (size_t i = 0; i < a.near_thresholds.size() && i < top; ++i) {
+			const near_threshold_key &k = a.near_thresholds[i];
+			std::printf("  %s: %s %s, %llu elements, %llu bytes, over %s\n", k.key.c_str(), k.type.c_str(),
+						k.encoding.c_str(), static_cast<unsigned long long>(k.length),
+						static_cast<unsigned long long>(k.bytes), k.reason.c_str());
+		}
+	}
+	for (const auto &error: a.error_samples) {
+		std::fprintf(stderr, "error: %s\n", error.c_str());
+	}
+}
+} // namespace
+
+int main(int argc, char **argv) {
+	std::string address;
+	memory_analysis_options options;
+	size_t top = 20;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		if (arg == "--match" && has_value) options.match = argv[++i];
+		else if (arg == "--count" && has_value) options.scan_count = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--sample" && has_value) options.sample_ratio = std::atof(argv[++i]);
+		else if (arg == "--max-keys" && has_value) options.max_keys = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--delimiter" && has_value) options.prefix_delimiter = argv[++i][0];
+		else if (arg == "--depth" && has_value) options.prefix_depth = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--samples" && has_value) options.memory_samples = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--top" && has_value) top = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg[0] != '-' && address.empty()) address = arg;
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (address.empty()) {
+		usage(argv[0]);
+		return 2;
+	}
+	// Ctrl-C stops after the batch in progress and reports what was analyzed
+	std::signal(SIGINT, [](int) {
+		if (running) running->stop();
+	});
+
+	try {
+		const auto endpoint = parse_address(address);
+		memory_analyzer analyzer(std::make_shared<redis_connection>(endpoint.first, endpoint.second), options);
+		running = &analyzer;
+		const memory_analysis analysis = analyzer.run();
+		running = nullptr;
+		print(analysis, top);
+		return analysis.errors == 0 ? 0 : 1;
+	}
+	catch (const std::exception &e) {
+		std::fprintf(stderr, "%s\n", e.what());
+		return 1;
+	}
+}
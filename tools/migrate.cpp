@@ -0,0 +1,106 @@
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "janus/key_migrator.hpp"
+#include "janus/redis_connection.hpp"
+
+namespace {
+volatile std::sig_atomic_t interrupted = 0;
+
+void usage(const char *program) {
+	std::fprintf(stderr,
+				 "usage: %s [options] --target <host:port> <source host:port>...\n"
+				 "Copies keys from the sources (the nodes of a cluster, or one server) to the target with\n"
+				 "DUMP/RESTORE.\n"
+				 "  --match <pattern>   copy only the keys matching the pattern\n"
+				 "  --count <n>         keys per SCAN and pipeline (1000)\n"
+				 "  --splits <n>        parallel cursors per standalone source, a power of two (1)\n"
+				 "  --keys-per-second <n>, --bytes-per-second <n>   throughput limits\n"
+				 "  --checkpoint <file> save cursors to resume an interrupted migration\n"
+				 "  --verify <ratio>    share of the keys compared after the copy (0)\n"
+				 "  --no-replace        keep keys that already exist on the target\n",
+				 program);
+}
+
+std::pair<std::string, unsigned short> parse_address(const std::string &address) {
+	const size_t colon = address.rfind(':');
+	if (colon == std::string::npos) return {address, 6379};
+	return {address.substr(0, colon), static_cast<unsigned short>(std::atoi(address.c_str() + colon + 1))};
+}
+
+key_migrator::connection_factory connect(const std::string &address) {
+	const auto endpoint = parse_address(address);
+	return [endpoint]() -> std::shared_ptr<kv_connection> {
+		return std::make_shared<redis_connection>(endpoint.first, endpoint.second);
+	};
+}
+
+void print(const migration_stats &s, bool last) {
+	std::fprintf(stderr, "%s%llu scanned, %llu migrated, %llu vanished, %llu skipped, %llu errors, %.1f MB%s",
+				 last ? "" : "\r", static_cast<unsigned long long>(s.scanned),
+				 static_cast<unsigned long long>(s.migrated), static_cast<unsigned long long>(s.vanished),
+				 static_cast<unsigned long long>(s.skipped), static_cast<unsigned long long>(s.errors),
+				 static_cast<double>(s.bytes) / (1024.0 * 1024.0), last ? "\n" : "");
+}
+} // namespace
+
+int main(int argc, char **argv) {
+	std::vector<key_migrator::connection_factory> sources;
+	std::string target;
+	migration_options options;
+
+	for (int i = 1; i < argc; ++i) {
+		const std::string arg = argv[i];
+		const bool has_value = i + 1 < argc;
+		if (arg == "--target" && has_value) target = argv[++i];
+		else if (arg == "--match" && has_value) options.match = argv[++i];
+		else if (arg == "--count" && has_value) options.scan_count = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--splits" && has_value) options.scan_splits = std::strtoull(argv[++i], nullptr, 10);
+		else if (arg == "--keys-per-second" && has_value) options.max_keys_per_second = std::atof(argv[++i]);
+		else if (arg == "--bytes-per-second" && has_value) options.max_bytes_per_second = std::atof(argv[++i]);
+		else if (arg == "--checkpoint" && has_value) options.checkpoint_path = argv[++i];
+		else if (arg == "--verify" && has_value) options.verify_ratio = std::atof(argv[++i]);
+		else if (arg == "--no-replace") options.replace = false;
+		else if (arg[0] != '-') sources.push_back(connect(arg));
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+	if (sources.empty() || target.empty()) {
+		usage(argv[0]);
+		return 2;
+	}
+	key_migrator *running = nullptr;
+	// Ctrl-C stops after the batches in progress and saves the checkpoint
+	std::signal(SIGINT, [](int) { interrupted = 1; });
+	options.on_progress = [&running](const migration_stats &s) {
+		if (interrupted && running) running->stop();
+		print(s, false);
+	};
+
+	try {
+		key_migrator migrator(sources, connect(target), options);
+		running = &migrator;
+		const migration_stats stats = migrator.run();
+		print(stats, true);
+		for (const auto &error: stats.error_samples) {
+			std::fprintf(stderr, "error: %s\n", error.c_str());
+		}
+		if (stats.verified > 0) {
+			std::fprintf(stderr, "verified %llu keys, %llu mismatches\n",
+						 static_cast<unsigned long long>(stats.verified),
+						 static_cast<unsigned long long>(stats.mismatches));
+		}
+		return stats.completed && stats.errors == 0 && stats.mismatches == 0 ? 0 : 1;
+	}
+	catch (const std::exception &e) {
+		std::fprintf(stderr, "\n%s\n", e.what());
+		return 1;
+	}
+}